@@ -0,0 +1,66 @@
+#ifndef MF_BENCH_H
+#define MF_BENCH_H
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+// Timing for the benchmark executables. Every case is run until it took at least the minimum time, --quick cuts
+// that down so ctest only checks the cases still run. Results are printed one line per case.
+inline double& mf_bench_min_seconds()
+{
+	static double s_fMinSeconds = 0.5;
+	return s_fMinSeconds;
+}
+
+inline void mf_bench_init(int argc, char** argv)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--quick") == 0)
+		{
+			mf_bench_min_seconds() = 0.005;
+		}
+	}
+}
+
+// keeps the compiler from dropping work whose result is never read
+inline void mf_bench_clobber(const void* data)
+{
+#if defined(_MSC_VER)
+	static const void* volatile s_pSink;
+	s_pSink = data;
+#else
+	__asm__ __volatile__("" : : "g"(data) : "memory");
+#endif
+}
+
+// seconds per call of fn, after one warm up call
+template <typename Func>
+double mf_bench_run(Func fn)
+{
+	fn();
+	int64_t iterations = 0;
+	auto start = std::chrono::steady_clock::now();
+	double elapsed = 0.0;
+	int64_t batch = 1;
+	while (elapsed < mf_bench_min_seconds())
+	{
+		for (int64_t i = 0; i < batch; i++)
+		{
+			fn();
+		}
+		iterations += batch;
+		batch *= 2;
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+	return elapsed / iterations;
+}
+
+// units per second of a call that processes units, e.g. samples or bytes, scaled to millions
+inline void mf_bench_report(const char* name, double seconds, double units, const char* unit)
+{
+	printf("%-40s %10.3f us %12.2f M%s/s\n", name, seconds * 1e6, units / seconds / 1e6, unit);
+}
+
+#endif
@@ -0,0 +1,89 @@
+#include "mf_bench.h"
+#include "mf_convert_pool.h"
+#include "libyuv/include/libyuv.h"
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#define WIDTH 3840
+#define HEIGHT 2160
+
+static const char* s_strFormats[] = { "NV12", "IYUV" };
+
+// thread counts from 1 up to the cores of the machine or --threads, doubling on the way
+static std::vector<int> get_thread_counts(int argc, char** argv)
+{
+	int cores = (int)std::thread::hardware_concurrency();
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (strcmp(argv[i], "--threads") == 0)
+		{
+			cores = atoi(argv[i + 1]);
+		}
+	}
+	std::vector<int> counts;
+	for (int count = 1; count < cores; count *= 2)
+	{
+		counts.push_back(count);
+	}
+	counts.push_back(cores > 1 ? cores : 1);
+	return counts;
+}
+
+int main(int argc, char** argv)
+{
+	mf_bench_init(argc, argv);
+	// a monitor frame at 4K, where the conversion is too slow for one core at 60 fps
+	std::vector<uint8_t> src((size_t)WIDTH * 4 * HEIGHT);
+	for (int row = 0; row < HEIGHT; row++)
+	{
+		for (int x = 0; x < WIDTH * 4; x++)
+		{
+			src[(size_t)row * WIDTH * 4 + x] = (uint8_t)(x * 5 + row);
+		}
+	}
+	std::vector<uint8_t> dst((size_t)WIDTH * HEIGHT * 3 / 2);
+	uint8_t* dst_y = dst.data();
+	uint8_t* dst_u = dst_y + WIDTH * HEIGHT;
+	uint8_t* dst_v = dst_u + WIDTH * HEIGHT / 4;
+	for (int f = 0; f < 2; f++)
+	{
+		// the rows the encoder converts per stripe, chroma rows follow from the even row_begin
+		auto convert = [&](int, int row_begin, int row_end)
+		{
+			const uint8_t* src_rows = src.data() + (size_t)row_begin * WIDTH * 4;
+			if (f == 0)
+			{
+				libyuv::ARGBToNV12(src_rows, WIDTH * 4, dst_y + (size_t)row_begin * WIDTH, WIDTH, dst_u + (size_t)(row_begin / 2) * WIDTH, WIDTH,
+					WIDTH, row_end - row_begin);
+			}
+			else
+			{
+				libyuv::ARGBToI420(src_rows, WIDTH * 4, dst_y + (size_t)row_begin * WIDTH, WIDTH, dst_u + (size_t)(row_begin / 2) * (WIDTH / 2), WIDTH / 2,
+					dst_v + (size_t)(row_begin / 2) * (WIDTH / 2), WIDTH / 2, WIDTH, row_end - row_begin);
+			}
+		};
+		double single = 0.0;
+		for (int threads : get_thread_counts(argc, argv))
+		{
+			MFConvertPool pool;
+			if (!pool.start(threads, 0))
+			{
+				fprintf(stderr, "cannot start %d threads\n", threads);
+				return 1;
+			}
+			double seconds = mf_bench_run([&]()
+			{
+				pool.run(HEIGHT, 2, convert);
+				mf_bench_clobber(dst.data());
+			});
+			pool.stop();
+			single = threads == 1 ? seconds : single;
+			char name[64];
+			snprintf(name, sizeof(name), "convert RGB32 -> %s 4K %d threads", s_strFormats[f], threads);
+			mf_bench_report(name, seconds, (double)WIDTH * HEIGHT, "pixels");
+			printf("%-40s %10.2fx of one thread\n", "", single / seconds);
+		}
+	}
+	return 0;
+}
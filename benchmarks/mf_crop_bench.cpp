@@ -0,0 +1,142 @@
+#include "mf_bench.h"
+#include "mf_video_pipeline.h"
+#include "libyuv/include/libyuv.h"
+#include <vector>
+
+#define CROP_LEFT 0.125f
+#define CROP_TOP 0.125f
+#define CROP_RIGHT 0.875f
+#define CROP_BOTTOM 0.875f
+
+static const PIXEL_FORMAT s_eFormats[] = { PIXEL_BGRA, PIXEL_NV12, PIXEL_I420 };
+static const char* s_strFormats[] = { "RGB32", "NV12", "IYUV" };
+static const int s_iSizes[][2] = { { 1920, 1080 }, { 3840, 2160 } };
+
+static VideoFrame* make_frame(PIXEL_FORMAT format, int width, int height)
+{
+	VideoFrame* frame = mf_video_frame_alloc(format, width, height);
+	for (int i = 0; i < mf_pixel_plane_count(format); i++)
+	{
+		for (int row = 0; row < mf_pixel_plane_rows(format, i, height); row++)
+		{
+			uint8_t* line = frame->data[i] + (ptrdiff_t)row * frame->stride[i];
+			for (int x = 0; x < frame->stride[i]; x++)
+			{
+				line[x] = (uint8_t)(x * 7 + row * 3 + i * 50);
+			}
+		}
+	}
+	frame->timestamp = -1;
+	frame->unchanged = false;
+	return frame;
+}
+
+// The path before the crop went through plane offsets: the cropped rows were copied into a new tightly packed
+// buffer, that one was copied or converted again into the encoder's I420 buffer and then deleted.
+static void crop_copy(const VideoFrame& frame, int left, int top, int width, int height, uint8_t* encoder_buffer)
+{
+	uint8_t* cropped = new uint8_t[frame.format == PIXEL_BGRA ? width * height * 4 : width * height * 3 / 2];
+	if (frame.format == PIXEL_BGRA)
+	{
+		for (int row = 0; row < height; row++)
+		{
+			memcpy(cropped + (ptrdiff_t)row * width * 4, frame.data[0] + (ptrdiff_t)(top + row) * frame.stride[0] + left * 4, width * 4);
+		}
+	}
+	else
+	{
+		for (int row = 0; row < height; row++)
+		{
+			memcpy(cropped + (ptrdiff_t)row * width, frame.data[0] + (ptrdiff_t)(top + row) * frame.stride[0] + left, width);
+		}
+		if (frame.format == PIXEL_NV12)
+		{
+			for (int row = 0; row < height / 2; row++)
+			{
+				memcpy(cropped + width * height + (ptrdiff_t)row * width, frame.data[1] + (ptrdiff_t)(top / 2 + row) * frame.stride[1] + left, width);
+			}
+		}
+		else
+		{
+			for (int row = 0; row < height / 2; row++)
+			{
+				memcpy(cropped + width * height + (ptrdiff_t)row * width / 2, frame.data[1] + (ptrdiff_t)(top / 2 + row) * frame.stride[1] + left / 2, width / 2);
+				memcpy(cropped + width * height * 5 / 4 + (ptrdiff_t)row * width / 2, frame.data[2] + (ptrdiff_t)(top / 2 + row) * frame.stride[2] + left / 2, width / 2);
+			}
+		}
+	}
+	uint8_t* y = encoder_buffer;
+	uint8_t* u = encoder_buffer + width * height;
+	uint8_t* v = encoder_buffer + width * height * 5 / 4;
+	if (frame.format == PIXEL_BGRA)
+	{
+		libyuv::ARGBToI420(cropped, width * 4, y, width, u, width / 2, v, width / 2, width, height);
+	}
+	else if (frame.format == PIXEL_NV12)
+	{
+		libyuv::NV12ToI420(cropped, width, cropped + width * height, width, y, width, u, width / 2, v, width / 2, width, height);
+	}
+	else
+	{
+		memcpy(encoder_buffer, cropped, width * height * 3 / 2);
+	}
+	delete[] cropped;
+}
+
+int main(int argc, char** argv)
+{
+	mf_bench_init(argc, argv);
+	std::vector<uint8_t> packet(1 << 20);
+	for (const auto& size : s_iSizes)
+	{
+		int width = size[0];
+		int height = size[1];
+		// the crop the pipeline takes, see MFVideoPipeline::get_cropped_planes
+		int crop_width = XALIGN((int)(width * (CROP_RIGHT - CROP_LEFT)), 16);
+		int crop_height = XALIGN((int)(height * (CROP_BOTTOM - CROP_TOP)), 2);
+		int left = (int)(width * CROP_LEFT) & ~1;
+		int top = (int)(height * CROP_TOP) & ~1;
+		std::vector<uint8_t> encoder_buffer((size_t)crop_width * crop_height * 3 / 2);
+		for (int f = 0; f < 3; f++)
+		{
+			VideoFrame* frame = make_frame(s_eFormats[f], width, height);
+			double pixels = (double)crop_width * crop_height;
+			char name[64];
+
+			double seconds = mf_bench_run([&]()
+			{
+				crop_copy(*frame, left, top, crop_width, crop_height, encoder_buffer.data());
+				mf_bench_clobber(encoder_buffer.data());
+			});
+			snprintf(name, sizeof(name), "crop %s %dx%d copy", s_strFormats[f], width, height);
+			mf_bench_report(name, seconds, pixels, "pixels");
+
+			// the null backend takes IYUV like the old encoder buffer, so both sides end in the same I420 frame
+			MFVideoPipeline pipeline;
+			pipeline.set_crop_rect(CROP_LEFT, CROP_TOP, CROP_RIGHT, CROP_BOTTOM);
+			if (!pipeline.start(mf_create_encoder_backend(ENCODER_BACKEND_NULL, nullptr), width, height, 60, 1))
+			{
+				fprintf(stderr, "cannot start the pipeline at %dx%d\n", width, height);
+				return 1;
+			}
+			int failures = 0;
+			seconds = mf_bench_run([&]()
+			{
+				OutputVData output_data = {};
+				output_data.data = packet.data();
+				output_data.capacity = (unsigned long)packet.size();
+				failures += pipeline.encode(*frame, output_data) != ENCODE_SUCCESS;
+			});
+			pipeline.stop();
+			if (failures)
+			{
+				fprintf(stderr, "%d frames failed to encode\n", failures);
+				return 1;
+			}
+			snprintf(name, sizeof(name), "crop %s %dx%d pipeline", s_strFormats[f], width, height);
+			mf_bench_report(name, seconds, pixels, "pixels");
+			mf_video_frame_unref(frame);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,256 @@
+#include "mf_bench.h"
+#include "mf_file_sink.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define FPS 60
+#define SYNC_INTERVAL_MS 1000
+#define BITRATE (200 * 1000 * 1000) // a high quality 4K recording, so the disk has something to do
+
+// One way of getting muxed packets to disk. sync() is the durability point a recorder without the sink runs on its
+// encode thread, the sink keeps its own on the I/O side and has nothing to do there.
+class BenchWriter
+{
+public:
+	virtual ~BenchWriter() {}
+	virtual bool open(const char* path) = 0;
+	virtual bool write(const uint8_t* data, unsigned long size) = 0;
+	virtual void sync() = 0;
+	virtual bool finish() = 0;
+};
+
+// what the muxer did before the sink, stdio with a large buffer
+class StdioWriter final : public BenchWriter
+{
+public:
+	bool open(const char* path) override
+	{
+		m_pFile = fopen(path, "wb");
+		return m_pFile && setvbuf(m_pFile, nullptr, _IOFBF, 1 << 20) == 0;
+	}
+
+	bool write(const uint8_t* data, unsigned long size) override
+	{
+		return fwrite(data, 1, size, m_pFile) == size;
+	}
+
+	void sync() override
+	{
+		fflush(m_pFile);
+		fdatasync(fileno(m_pFile));
+	}
+
+	bool finish() override
+	{
+		bool ret = fflush(m_pFile) == 0 && fdatasync(fileno(m_pFile)) == 0;
+		return fclose(m_pFile) == 0 && ret;
+	}
+
+private:
+	FILE* m_pFile{ nullptr };
+};
+
+// unbuffered write() per packet
+class FdWriter final : public BenchWriter
+{
+public:
+	bool open(const char* path) override
+	{
+		m_iFd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		return m_iFd >= 0;
+	}
+
+	bool write(const uint8_t* data, unsigned long size) override
+	{
+		return ::write(m_iFd, data, size) == (ssize_t)size;
+	}
+
+	void sync() override
+	{
+		fdatasync(m_iFd);
+	}
+
+	bool finish() override
+	{
+		bool ret = fdatasync(m_iFd) == 0;
+		return close(m_iFd) == 0 && ret;
+	}
+
+private:
+	int m_iFd{ -1 };
+};
+
+class SinkWriter final : public BenchWriter
+{
+public:
+	explicit SinkWriter(FILE_SINK_BACKEND backend)
+		: m_eBackend(backend)
+	{
+	}
+
+	bool open(const char* path) override
+	{
+		FileSinkConfig config;
+		config.backend = m_eBackend;
+		config.sync_interval_ms = SYNC_INTERVAL_MS;
+		return m_Sink.open(path, config);
+	}
+
+	bool write(const uint8_t* data, unsigned long size) override
+	{
+		return m_Sink.write(data, size);
+	}
+
+	void sync() override
+	{
+	}
+
+	bool finish() override
+	{
+		return m_Sink.finish();
+	}
+
+	int64_t get_stalls()
+	{
+		FileSinkStats stats = {};
+		m_Sink.get_stats(stats);
+		return stats.stalls;
+	}
+
+private:
+	FILE_SINK_BACKEND m_eBackend;
+	MFFileSink m_Sink;
+};
+
+// packet of frame i, a key frame every second is four times the size of the others
+static unsigned long packet_size(int64_t i)
+{
+	unsigned long average = BITRATE / 8 / FPS;
+	return i % FPS == 0 ? average * 4 : average * (FPS - 4) / (FPS - 1) + (unsigned long)(i * 7919 % 4096);
+}
+
+// as fast as the writer takes the packets, the time includes finish() so the data is on disk at the end
+static bool run_throughput(const char* name, BenchWriter& writer, const char* path, const std::vector<uint8_t>& data, int64_t total)
+{
+	if (!writer.open(path))
+	{
+		return false;
+	}
+	auto start = std::chrono::steady_clock::now();
+	int64_t written = 0;
+	int64_t packets = 0;
+	bool ok = true;
+	for (; ok && written < total; packets++)
+	{
+		ok = writer.write(data.data(), packet_size(packets));
+		written += packet_size(packets);
+	}
+	ok = writer.finish() && ok;
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	mf_bench_report(name, seconds / packets, (double)written / packets, "B");
+	return ok;
+}
+
+// packets at the frame rate in real time with a durability point every interval, as while recording. reports the
+// time the encode thread spent in each write, a sync that falls due is charged to the write before it
+static bool run_paced(const char* name, BenchWriter& writer, const char* path, const std::vector<uint8_t>& data, int64_t frames)
+{
+	if (!writer.open(path))
+	{
+		return false;
+	}
+	std::vector<double> latencies;
+	auto start = std::chrono::steady_clock::now();
+	auto last_sync = start;
+	bool ok = true;
+	for (int64_t i = 0; ok && i < frames; i++)
+	{
+		std::this_thread::sleep_until(start + std::chrono::microseconds(i * 1000000 / FPS));
+		auto before = std::chrono::steady_clock::now();
+		ok = writer.write(data.data(), packet_size(i));
+		auto after = std::chrono::steady_clock::now();
+		if (after - last_sync >= std::chrono::milliseconds(SYNC_INTERVAL_MS))
+		{
+			writer.sync();
+			last_sync = after;
+			after = std::chrono::steady_clock::now();
+		}
+		latencies.push_back(std::chrono::duration<double, std::milli>(after - before).count());
+	}
+	ok = writer.finish() && ok;
+	std::sort(latencies.begin(), latencies.end());
+	printf("%-40s %10.3f ms p50 %9.3f ms p99 %9.3f ms max\n", name, latencies[latencies.size() / 2],
+		latencies[latencies.size() * 99 / 100], latencies.back());
+	return ok;
+}
+
+// io_uring may be missing or blocked by seccomp, the threads backend still runs then
+static bool uring_available(const char* path)
+{
+	FileSinkConfig config;
+	config.backend = FILE_SINK_BACKEND_URING;
+	MFFileSink sink;
+	if (!sink.open(path, config))
+	{
+		return false;
+	}
+	return sink.finish();
+}
+
+int main(int argc, char** argv)
+{
+	mf_bench_init(argc, argv);
+	std::string dir = ".";
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (strcmp(argv[i], "--dir") == 0)
+		{
+			dir = argv[i + 1];
+		}
+	}
+	std::string path = dir + "/mf_file_sink_bench.tmp";
+	// 20 seconds of recording paced, 256 MB as fast as possible, both cut down for --quick
+	int64_t frames = (int64_t)(mf_bench_min_seconds() * 40.0 * FPS);
+	int64_t total = (int64_t)(mf_bench_min_seconds() * 512.0 * 1024 * 1024);
+	std::vector<uint8_t> data(packet_size(0));
+	for (size_t i = 0; i < data.size(); i++)
+	{
+		data[i] = (uint8_t)(i * 131 + (i >> 9));
+	}
+
+	const char* names[] = { "fwrite", "write", "file sink io_uring", "file sink threads" };
+	bool uring = uring_available(path.c_str());
+	bool ok = true;
+	for (int phase = 0; phase < 2 && ok; phase++)
+	{
+		for (int w = 0; w < 4 && ok; w++)
+		{
+			BenchWriter* writer = w == 0 ? (BenchWriter*)new StdioWriter() : w == 1 ? (BenchWriter*)new FdWriter()
+				: new SinkWriter(w == 2 ? FILE_SINK_BACKEND_URING : FILE_SINK_BACKEND_THREADS);
+			char name[64];
+			snprintf(name, sizeof(name), "%s %s", names[w], phase == 0 ? "throughput" : "paced");
+			if (w == 2 && !uring)
+			{
+				printf("%-40s %10s\n", name, "unavailable");
+				delete writer;
+				continue;
+			}
+			ok = phase == 0 ? run_throughput(name, *writer, path.c_str(), data, total) : run_paced(name, *writer, path.c_str(), data, frames);
+			if (w >= 2)
+			{
+				printf("%-40s %10lld stalls\n", "", (long long)static_cast<SinkWriter*>(writer)->get_stalls());
+			}
+			delete writer;
+			if (!ok)
+			{
+				fprintf(stderr, "%s failed\n", name);
+			}
+		}
+	}
+	unlink(path.c_str());
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,70 @@
+#include "mf_bench.h"
+#include "mf_pixel_convert.h"
+#include "mf_video_frame.h"
+#include <stddef.h>
+
+#define WIDTH 1920
+#define HEIGHT 1080
+
+static const char* s_strFormats[] = { "", "I420", "YV12", "NV12", "YUY2", "UYVY", "BGRA", "RGB24" };
+
+static PlaneView get_planes(const VideoFrame& frame)
+{
+	PlaneView planes = {};
+	for (int i = 0; i < mf_pixel_plane_count(frame.format); i++)
+	{
+		planes.data[i] = frame.data[i];
+		planes.stride[i] = frame.stride[i];
+	}
+	return planes;
+}
+
+// a frame with content in every plane, so no kernel sees a flat input
+static VideoFrame* make_frame(PIXEL_FORMAT format)
+{
+	VideoFrame* frame = mf_video_frame_alloc(format, WIDTH, HEIGHT);
+	for (int i = 0; i < mf_pixel_plane_count(format); i++)
+	{
+		for (int row = 0; row < mf_pixel_plane_rows(format, i, HEIGHT); row++)
+		{
+			uint8_t* line = frame->data[i] + (ptrdiff_t)row * frame->stride[i];
+			for (int x = 0; x < frame->stride[i]; x++)
+			{
+				line[x] = (uint8_t)(x * 3 + row * 5 + i * 70);
+			}
+		}
+	}
+	return frame;
+}
+
+int main(int argc, char** argv)
+{
+	mf_bench_init(argc, argv);
+	for (int in = PIXEL_I420; in < PIXEL_FORMAT_MAX; in++)
+	{
+		VideoFrame* src = make_frame((PIXEL_FORMAT)in);
+		PlaneView src_planes = get_planes(*src);
+		for (int out = PIXEL_I420; out < PIXEL_FORMAT_MAX; out++)
+		{
+			MFPixelConverter converter;
+			if (!converter.configure((PIXEL_FORMAT)in, (PIXEL_FORMAT)out))
+			{
+				fprintf(stderr, "%s -> %s not supported\n", s_strFormats[in], s_strFormats[out]);
+				return 1;
+			}
+			VideoFrame* dst = mf_video_frame_alloc((PIXEL_FORMAT)out, WIDTH, HEIGHT);
+			PlaneView dst_planes = get_planes(*dst);
+			double seconds = mf_bench_run([&]()
+			{
+				converter.convert(src_planes, dst_planes, WIDTH, 0, HEIGHT);
+				mf_bench_clobber(dst->data[0]);
+			});
+			char name[64];
+			snprintf(name, sizeof(name), "convert %s -> %s 1080p", s_strFormats[in], s_strFormats[out]);
+			mf_bench_report(name, seconds, (double)WIDTH * HEIGHT, "pixels");
+			mf_video_frame_unref(dst);
+		}
+		mf_video_frame_unref(src);
+	}
+	return 0;
+}
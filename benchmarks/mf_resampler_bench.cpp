@@ -0,0 +1,121 @@
+#include "mf_bench.h"
+#include "mf_resampler.h"
+#include <math.h>
+#include <vector>
+
+#define CHANNELS 2
+#define CHUNK_MS 10 // capture packet size
+#define TEST_TONE 1000.0
+
+static const double s_dPi = 3.14159265358979323846;
+static const RESAMPLE_QUALITY s_eQualities[] = { RESAMPLE_QUALITY_LOW, RESAMPLE_QUALITY_MEDIUM, RESAMPLE_QUALITY_HIGH };
+static const char* s_strQualities[] = { "low", "medium", "high" };
+static const int s_iRates[][2] = { { 44100, 48000 }, { 48000, 44100 }, { 48000, 16000 }, { 16000, 48000 }, { 48000, 48000 } };
+
+static std::vector<float> make_tone(int rate, int samples, double frequency, double amplitude)
+{
+	std::vector<float> tone((size_t)samples * CHANNELS);
+	for (int i = 0; i < samples; i++)
+	{
+		float value = (float)(amplitude * sin(2.0 * s_dPi * frequency * i / rate));
+		for (int c = 0; c < CHANNELS; c++)
+		{
+			tone[(size_t)i * CHANNELS + c] = value;
+		}
+	}
+	return tone;
+}
+
+// resamples input in capture sized chunks the way the audio encoder does, returns the output of the first channel
+static std::vector<float> resample(MFResampler& resampler, const std::vector<float>& input, int in_rate)
+{
+	int chunk = in_rate * CHUNK_MS / 1000;
+	int in_samples = (int)(input.size() / CHANNELS);
+	std::vector<float> output((size_t)resampler.get_max_output(chunk) * CHANNELS);
+	std::vector<float> mono;
+	for (int offset = 0; offset < in_samples; offset += chunk)
+	{
+		int samples = in_samples - offset < chunk ? in_samples - offset : chunk;
+		int produced = resampler.process(input.data() + (size_t)offset * CHANNELS, samples, output.data(), (int)(output.size() / CHANNELS));
+		for (int i = 0; i < produced; i++)
+		{
+			mono.push_back(output[(size_t)i * CHANNELS]);
+		}
+	}
+	return mono;
+}
+
+// THD+N in dB of a sine at frequency: everything left after the least squares fit of a sine at that frequency is
+// taken out, relative to the fitted sine. measured past the filter's settling at both ends
+static double measure_thd_n(const std::vector<float>& output, int rate, double frequency, int skip)
+{
+	int samples = (int)output.size() - skip * 2;
+	double ss = 0.0;
+	double cc = 0.0;
+	double sc = 0.0;
+	double ys = 0.0;
+	double yc = 0.0;
+	for (int i = skip; i < skip + samples; i++)
+	{
+		double phase = 2.0 * s_dPi * frequency * i / rate;
+		double s = sin(phase);
+		double c = cos(phase);
+		ss += s * s;
+		cc += c * c;
+		sc += s * c;
+		ys += output[i] * s;
+		yc += output[i] * c;
+	}
+	double det = ss * cc - sc * sc;
+	double a = (ys * cc - yc * sc) / det;
+	double b = (yc * ss - ys * sc) / det;
+	double signal = 0.0;
+	double residual = 0.0;
+	for (int i = skip; i < skip + samples; i++)
+	{
+		double phase = 2.0 * s_dPi * frequency * i / rate;
+		double fit = a * sin(phase) + b * cos(phase);
+		double error = output[i] - fit;
+		signal += fit * fit;
+		residual += error * error;
+	}
+	return 10.0 * log10(residual / signal);
+}
+
+int main(int argc, char** argv)
+{
+	mf_bench_init(argc, argv);
+	for (int q = 0; q < 3; q++)
+	{
+		for (const auto& rates : s_iRates)
+		{
+			int in_rate = rates[0];
+			int out_rate = rates[1];
+			MFResampler resampler;
+			if (!resampler.configure(in_rate, out_rate, CHANNELS, s_eQualities[q]))
+			{
+				fprintf(stderr, "cannot configure %d -> %d\n", in_rate, out_rate);
+				return 1;
+			}
+			// one second, long enough for a stable THD+N and short enough to stay in cache for the throughput
+			std::vector<float> input = make_tone(in_rate, in_rate, TEST_TONE, 0.5);
+			std::vector<float> output = resample(resampler, input, in_rate);
+			double thd_n = measure_thd_n(output, out_rate, TEST_TONE, resampler.get_latency() * out_rate / in_rate + out_rate / 100);
+
+			int chunk = in_rate * CHUNK_MS / 1000;
+			std::vector<float> chunk_output((size_t)resampler.get_max_output(chunk) * CHANNELS);
+			size_t offset = 0;
+			double seconds = mf_bench_run([&]()
+			{
+				resampler.process(input.data() + offset * CHANNELS, chunk, chunk_output.data(), (int)(chunk_output.size() / CHANNELS));
+				mf_bench_clobber(chunk_output.data());
+				offset = offset + chunk * 2 <= (size_t)in_rate ? offset + chunk : 0;
+			});
+			char name[64];
+			snprintf(name, sizeof(name), "resample %s %d -> %d", s_strQualities[q], in_rate, out_rate);
+			mf_bench_report(name, seconds, (double)chunk * CHANNELS, "samples");
+			printf("%-40s %10.1f dB THD+N at %.0f Hz\n", "", thd_n, TEST_TONE);
+		}
+	}
+	return 0;
+}
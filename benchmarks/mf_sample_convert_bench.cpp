@@ -0,0 +1,71 @@
+#include "mf_bench.h"
+#include "mf_sample_convert.h"
+#include <math.h>
+#include <vector>
+
+#define CHANNELS 2
+#define SAMPLES 4800 // 100 ms at 48 kHz, a typical capture packet
+
+static const PCM_FORMAT s_eFormats[] = { PCM_U8, PCM_S16, PCM_S24, PCM_S32, PCM_S64, PCM_FLT, PCM_DBL,
+	PCM_U8P, PCM_S16P, PCM_S24P, PCM_S32P, PCM_S64P, PCM_FLTP, PCM_DBLP };
+static const char* s_strFormats[] = { "U8", "S16", "S24", "S32", "S64", "FLT", "DBL",
+	"U8P", "S16P", "S24P", "S32P", "S64P", "FLTP", "DBLP" };
+
+// buffer of a format with pointers the converter takes, one for interleaved and one per channel for planar
+struct PcmBuffer
+{
+	std::vector<uint8_t> data;
+	uint8_t* planes[CHANNELS];
+
+	PcmBuffer(PCM_FORMAT format)
+		: data((size_t)SAMPLES * CHANNELS * mf_pcm_bytes_per_sample(format) + 64)
+	{
+		size_t plane_size = (size_t)SAMPLES * mf_pcm_bytes_per_sample(format);
+		for (int i = 0; i < CHANNELS; i++)
+		{
+			planes[i] = data.data() + (mf_pcm_is_planar(format) ? plane_size * i : 0);
+		}
+	}
+};
+
+int main(int argc, char** argv)
+{
+	mf_bench_init(argc, argv);
+	// a sine in float converted to every input format, so the kernels see real sample values and no denormals
+	std::vector<float> sine((size_t)SAMPLES * CHANNELS);
+	for (int i = 0; i < SAMPLES * CHANNELS; i++)
+	{
+		sine[i] = 0.5f * (float)sin(i / CHANNELS * 2.0 * 3.14159265358979 * 1000.0 / 48000.0);
+	}
+	const uint8_t* sine_planes[1] = { (const uint8_t*)sine.data() };
+	int count = (int)(sizeof(s_eFormats) / sizeof(s_eFormats[0]));
+	for (int in = 0; in < count; in++)
+	{
+		PcmBuffer input(s_eFormats[in]);
+		MFSampleConverter prepare;
+		if (!prepare.configure(PCM_FLT, s_eFormats[in], CHANNELS) || !prepare.convert(sine_planes, input.planes, SAMPLES))
+		{
+			fprintf(stderr, "cannot prepare %s input\n", s_strFormats[in]);
+			return 1;
+		}
+		for (int out = 0; out < count; out++)
+		{
+			PcmBuffer output(s_eFormats[out]);
+			MFSampleConverter converter;
+			if (!converter.configure(s_eFormats[in], s_eFormats[out], CHANNELS))
+			{
+				fprintf(stderr, "%s -> %s not supported\n", s_strFormats[in], s_strFormats[out]);
+				return 1;
+			}
+			double seconds = mf_bench_run([&]()
+			{
+				converter.convert(input.planes, output.planes, SAMPLES);
+				mf_bench_clobber(output.data.data());
+			});
+			char name[64];
+			snprintf(name, sizeof(name), "convert %s -> %s", s_strFormats[in], s_strFormats[out]);
+			mf_bench_report(name, seconds, (double)SAMPLES * CHANNELS, "samples");
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,192 @@
+#include "mf_bench.h"
+#include "mf_tile_codec.h"
+#include <math.h>
+#include <vector>
+
+#define WIDTH 1920
+#define HEIGHT 1080
+#define STRIDE (WIDTH * 4)
+#define TILE_SIZE 64
+#define DIRTY_RECTS 8
+
+static const char* s_strContents[] = { "text", "ui", "gradient" };
+
+static void put_pixel(std::vector<uint8_t>& frame, int x, int y, uint32_t color)
+{
+	uint8_t* pixel = frame.data() + (size_t)y * STRIDE + x * 4;
+	pixel[0] = (uint8_t)color;
+	pixel[1] = (uint8_t)(color >> 8);
+	pixel[2] = (uint8_t)(color >> 16);
+	pixel[3] = 255;
+}
+
+static void fill_rect(std::vector<uint8_t>& frame, int left, int top, int right, int bottom, uint32_t color)
+{
+	for (int y = top; y < bottom && y < HEIGHT; y++)
+	{
+		for (int x = left; x < right && x < WIDTH; x++)
+		{
+			put_pixel(frame, x, y, color);
+		}
+	}
+}
+
+// Synthetic desktop content. text is dark 6x10 glyphs on lines of a white page with anti-aliased grays at the
+// glyph edges, ui is flat panels, buttons and borders, gradient stands in for a photo or video with a color per pixel.
+static std::vector<uint8_t> make_frame(int content)
+{
+	std::vector<uint8_t> frame((size_t)STRIDE * HEIGHT);
+	uint32_t seed = 12345;
+	auto next = [&]()
+	{
+		seed = seed * 1103515245 + 12345;
+		return seed >> 16;
+	};
+	if (content == 0)
+	{
+		fill_rect(frame, 0, 0, WIDTH, HEIGHT, 0xffffff);
+		for (int line = 8; line + 10 < HEIGHT; line += 16)
+		{
+			int length = 40 + next() % 250;
+			for (int g = 0; g < length && 8 + g * 7 + 6 < WIDTH; g++)
+			{
+				if (next() % 6 == 0)
+				{
+					continue; // space
+				}
+				for (int y = 0; y < 10; y++)
+				{
+					for (int x = 0; x < 6; x++)
+					{
+						uint32_t bits = next();
+						if (bits % 3 == 0)
+						{
+							uint8_t level = bits % 7 == 0 ? (uint8_t)(0x80 + bits % 0x60) : 0x20;
+							put_pixel(frame, 8 + g * 7 + x, line + y, level * 0x010101u);
+						}
+					}
+				}
+			}
+		}
+	}
+	else if (content == 1)
+	{
+		fill_rect(frame, 0, 0, WIDTH, HEIGHT, 0x2b2b2b);
+		fill_rect(frame, 0, 0, WIDTH, 32, 0x3c3f41);
+		fill_rect(frame, 0, HEIGHT - 40, WIDTH, HEIGHT, 0x1e1e1e);
+		fill_rect(frame, 0, 32, 280, HEIGHT - 40, 0x313335);
+		for (int i = 0; i < 40; i++)
+		{
+			int left = 300 + next() % (WIDTH - 500);
+			int top = 50 + next() % (HEIGHT - 200);
+			int width = 60 + next() % 140;
+			int height = 24 + next() % 40;
+			fill_rect(frame, left - 1, top - 1, left + width + 1, top + height + 1, 0x555555);
+			fill_rect(frame, left, top, left + width, top + height, 0x4a88c7 + (next() % 4) * 0x101010);
+		}
+	}
+	else
+	{
+		for (int y = 0; y < HEIGHT; y++)
+		{
+			for (int x = 0; x < WIDTH; x++)
+			{
+				uint32_t b = (uint32_t)(127.5 + 127.5 * sin(x * 0.013 + y * 0.007));
+				uint32_t g = (uint32_t)(y * 255 / HEIGHT);
+				uint32_t r = (uint32_t)(x * 255 / WIDTH) ^ (next() & 3);
+				put_pixel(frame, x, y, b | g << 8 | r << 16);
+			}
+		}
+	}
+	return frame;
+}
+
+// small updates the way a desktop changes between frames: a cursor, a caret, a few repainted widgets
+static std::vector<MonitorRect> make_dirty_rects()
+{
+	std::vector<MonitorRect> rects;
+	for (int i = 0; i < DIRTY_RECTS; i++)
+	{
+		int left = (i * 397) % (WIDTH - 100);
+		int top = (i * 211) % (HEIGHT - 40);
+		rects.push_back({ left, top, left + 100, top + 40 });
+	}
+	return rects;
+}
+
+// pixels of the tiles the rects touch, what the encoder actually codes
+static double dirty_tile_pixels(const std::vector<MonitorRect>& rects)
+{
+	int tiles_x = (WIDTH + TILE_SIZE - 1) / TILE_SIZE;
+	int tiles_y = (HEIGHT + TILE_SIZE - 1) / TILE_SIZE;
+	std::vector<uint8_t> dirty((size_t)tiles_x * tiles_y);
+	for (const MonitorRect& rect : rects)
+	{
+		for (int ty = rect.top / TILE_SIZE; ty <= (rect.bottom - 1) / TILE_SIZE; ty++)
+		{
+			for (int tx = rect.left / TILE_SIZE; tx <= (rect.right - 1) / TILE_SIZE; tx++)
+			{
+				dirty[ty * tiles_x + tx] = 1;
+			}
+		}
+	}
+	double pixels = 0.0;
+	for (int ty = 0; ty < tiles_y; ty++)
+	{
+		for (int tx = 0; tx < tiles_x; tx++)
+		{
+			int columns = WIDTH - tx * TILE_SIZE < TILE_SIZE ? WIDTH - tx * TILE_SIZE : TILE_SIZE;
+			int rows = HEIGHT - ty * TILE_SIZE < TILE_SIZE ? HEIGHT - ty * TILE_SIZE : TILE_SIZE;
+			pixels += dirty[ty * tiles_x + tx] ? (double)columns * rows : 0.0;
+		}
+	}
+	return pixels;
+}
+
+int main(int argc, char** argv)
+{
+	mf_bench_init(argc, argv);
+	std::vector<MonitorRect> rects = make_dirty_rects();
+	std::vector<uint8_t> decoded((size_t)STRIDE * HEIGHT);
+	double pixels = (double)WIDTH * HEIGHT;
+	double dirty_pixels = dirty_tile_pixels(rects);
+	char name[64];
+	for (int content = 0; content < 3; content++)
+	{
+		std::vector<uint8_t> frame = make_frame(content);
+		MFTileEncoder encoder;
+		if (!encoder.configure(WIDTH, HEIGHT, TILE_SIZE, 1))
+		{
+			fprintf(stderr, "cannot configure the encoder\n");
+			return 1;
+		}
+		const uint8_t* packet = nullptr;
+		unsigned long size = 0;
+		double seconds = mf_bench_run([&]()
+		{
+			encoder.encode(frame.data(), STRIDE, nullptr, 0, packet, size);
+		});
+		snprintf(name, sizeof(name), "encode %s 1080p full", s_strContents[content]);
+		mf_bench_report(name, seconds, pixels, "pixels");
+		printf("%-40s %10lu bytes %9.1f:1\n", "", size, (double)WIDTH * HEIGHT * 3 / size);
+
+		std::vector<uint8_t> full_packet(packet, packet + size);
+		MFTileDecoder decoder;
+		seconds = mf_bench_run([&]()
+		{
+			decoder.decode(full_packet.data(), (unsigned long)full_packet.size(), decoded.data(), STRIDE, WIDTH, HEIGHT);
+			mf_bench_clobber(decoded.data());
+		});
+		snprintf(name, sizeof(name), "decode %s 1080p full", s_strContents[content]);
+		mf_bench_report(name, seconds, pixels, "pixels");
+
+		seconds = mf_bench_run([&]()
+		{
+			encoder.encode(frame.data(), STRIDE, rects.data(), (int)rects.size(), packet, size);
+		});
+		snprintf(name, sizeof(name), "encode %s 1080p %d rects", s_strContents[content], DIRTY_RECTS);
+		mf_bench_report(name, seconds, dirty_pixels, "pixels");
+		printf("%-40s %10lu bytes\n", "", size);
+	}
+	return 0;
+}
@@ -0,0 +1,109 @@
+#include "mf_bench.h"
+#include "mf_frame_hash.h"
+#include "mf_dirty_region.h"
+#include <vector>
+
+#define WIDTH 3840
+#define HEIGHT 2160
+#define STRIDE (WIDTH * 4)
+
+static const int s_iTileSizes[] = { 32, 64, 128 };
+
+static void fill_frame(std::vector<uint8_t>& frame, int seed)
+{
+	for (int row = 0; row < HEIGHT; row++)
+	{
+		for (int x = 0; x < STRIDE; x++)
+		{
+			frame[(size_t)row * STRIDE + x] = (uint8_t)(x * 3 + row * 5 + seed);
+		}
+	}
+}
+
+// one pixel changed in each of count tiles spread over the frame, like a cursor and a few updated widgets
+static void touch_tiles(std::vector<uint8_t>& frame, int tile_size, int count, int value)
+{
+	int tiles_x = (WIDTH + tile_size - 1) / tile_size;
+	int tiles_y = (HEIGHT + tile_size - 1) / tile_size;
+	for (int i = 0; i < count; i++)
+	{
+		int tile = (int)((int64_t)i * tiles_x * tiles_y / count);
+		int x = tile % tiles_x * tile_size;
+		int y = tile / tiles_x * tile_size;
+		frame[(size_t)y * STRIDE + x * 4] = (uint8_t)value;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	mf_bench_init(argc, argv);
+	std::vector<uint8_t> frame((size_t)STRIDE * HEIGHT);
+	std::vector<uint8_t> other((size_t)STRIDE * HEIGHT);
+	fill_frame(frame, 0);
+	fill_frame(other, 1);
+	double bytes = (double)STRIDE * HEIGHT;
+	char name[64];
+
+	// what a capture without tile hashes does to find out whether anything changed
+	std::vector<uint8_t> prev = frame;
+	int differs = 0;
+	double seconds = mf_bench_run([&]()
+	{
+		differs += memcmp(frame.data(), prev.data(), frame.size()) != 0;
+	});
+	mf_bench_report("memcmp 4K", seconds, bytes, "B");
+	uint64_t hash = 0;
+	seconds = mf_bench_run([&]()
+	{
+		hash += mf_hash_plane(frame.data(), STRIDE, STRIDE, HEIGHT);
+	});
+	mf_bench_report("hash plane 4K", seconds, bytes, "B");
+
+	for (int tile_size : s_iTileSizes)
+	{
+		int tiles = ((WIDTH + tile_size - 1) / tile_size) * ((HEIGHT + tile_size - 1) / tile_size);
+		std::vector<uint64_t> hashes(tiles);
+		seconds = mf_bench_run([&]()
+		{
+			mf_hash_bgra_tiles(frame.data(), STRIDE, WIDTH, HEIGHT, tile_size, hashes.data());
+			mf_bench_clobber(hashes.data());
+		});
+		snprintf(name, sizeof(name), "hash tiles 4K %d", tile_size);
+		mf_bench_report(name, seconds, bytes, "B");
+
+		// static desktop, a few changed tiles, and every tile changed; the frames alternate so each detect compares
+		// against a different previous frame
+		const int dirty_counts[] = { 0, 16, tiles };
+		const char* dirty_names[] = { "static", "16 dirty", "all dirty" };
+		for (int d = 0; d < 3; d++)
+		{
+			std::vector<uint8_t> a = frame;
+			std::vector<uint8_t> b = dirty_counts[d] == tiles ? other : frame;
+			if (dirty_counts[d] != tiles)
+			{
+				touch_tiles(b, tile_size, dirty_counts[d], 255);
+			}
+			MFDirtyRegionDetector detector;
+			if (!detector.configure(WIDTH, HEIGHT, tile_size))
+			{
+				fprintf(stderr, "cannot configure tile size %d\n", tile_size);
+				return 1;
+			}
+			std::vector<MonitorRect> rects;
+			bool odd = false;
+			size_t rect_count = 0;
+			seconds = mf_bench_run([&]()
+			{
+				detector.detect(odd ? b.data() : a.data(), STRIDE, rects);
+				rect_count = rects.size();
+				odd = !odd;
+			});
+			snprintf(name, sizeof(name), "detect 4K %d %s", tile_size, dirty_names[d]);
+			mf_bench_report(name, seconds, bytes, "B");
+			printf("%-40s %10zu rects\n", "", rect_count);
+		}
+	}
+	mf_bench_clobber(&hash);
+	mf_bench_clobber(&differs);
+	return 0;
+}
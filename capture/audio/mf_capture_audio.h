@@ -3,29 +3,15 @@
 
 #include <string>
 #include <vector>
-
-enum PCM_FORMAT
-{
-    PCM_UNKNOWN = -1,
-    PCM_U8 = 0,
-    PCM_S16,
-    PCM_S32,
-    PCM_FLT,
-    PCM_DBL,
-    PCM_U8P,
-    PCM_S16P,
-    PCM_S32P,
-    PCM_FLTP,
-    PCM_DBLP,
-    PCM_S64,
-    PCM_S64P
-};
+#include "mf_pcm_format.h"
+#include "mf_audio_ring.h"
 
 struct AudioParam
 {
 	int sample_rate;
 	int channels;
 	PCM_FORMAT format;
+	uint32_t channel_mask; // MF_CHANNEL_* speaker positions, for MFAudioMixer
 };
 
 struct OutputAudioData
@@ -33,8 +19,12 @@ struct OutputAudioData
 	uint8_t* data;
     int samples;
     AudioParam param;
+    int64_t timestamp; // capture time of the first sample on the mf_clock_now timeline, in 100ns units
 };
 
+// one started device, valid from start_mic / start_speaker until stop. no device id lookup after start
+typedef struct MFAudioSession* AUDIO_SESSION;
+
 class __declspec(dllexport) MFAudioCapture final
 {
 public:
@@ -47,13 +37,17 @@ public:
     std::string get_mic_name(int index);
     std::string get_speaker_id(int index);
     std::string get_speaker_name(int index);
-    bool start_mic(const std::string& device_id);
-    void stop_mic(const std::string& device_id);
-    bool start_speaker(const std::string& device_id);
-    void stop_speaker(const std::string& device_id);
-
-    bool capture_mic(const std::string& device_id, OutputAudioData& output_data);
-    bool capture_speaker(const std::string& device_id, OutputAudioData& output_data);
+    void set_block_size(int samples); // if not set, default is 10 ms at the device rate. applies to devices started afterwards
+    // every started device gets an event driven capture thread filling a lock free ring, the speaker is captured in loopback.
+    // returns nullptr on failure or when the device is already started
+    AUDIO_SESSION start_mic(const std::string& device_id);
+    AUDIO_SESSION start_speaker(const std::string& device_id);
+    void stop(AUDIO_SESSION session);
+
+    // returns exactly one block, false while less than a block is buffered. data is owned by the session and valid
+    // until the next call on it. start and stop must not run concurrently with these
+    bool capture(AUDIO_SESSION session, OutputAudioData& output_data);
+    bool get_stats(AUDIO_SESSION session, AudioRingStats& stats);
 
 private:
     class Impl;
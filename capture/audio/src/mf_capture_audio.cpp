@@ -1,11 +1,38 @@
 #include "mf_capture_audio.h"
+#include "mf_media_clock.h"
+#include "mf_audio_ring.h"
+#include "mf_time.h"
 #include "defer/defer.hpp"
 #include <mmdeviceapi.h>
 #include <audioclient.h>
 #include <audiopolicy.h>
+#include <avrt.h>
 #include <functiondiscoverykeys_devpkey.h>
+#include <algorithm>
 #include <codecvt>
-#include <map>
+#include <thread>
+
+#pragma comment(lib, "avrt.lib")
+
+#define AUDIO_BUFFER_DURATION 2000000 // 200 ms device buffer in 100ns units, the capture thread drains it every period
+#define AUDIO_RING_SECONDS 1
+#define AUDIO_WAIT_TIMEOUT_MS 50
+
+// everything one started device needs, reached straight from the handle
+struct MFAudioSession
+{
+	IAudioClient* audio_client{ nullptr };
+	IAudioCaptureClient* capture_client{ nullptr };
+	HANDLE sample_event{ nullptr };
+	HANDLE stop_event{ nullptr };
+	std::thread thread;
+	AudioParam param{};
+	MFAudioRing ring; // capture thread writes, capture reads
+	std::vector<uint8_t> block;
+	int block_samples{ 0 };
+	std::string device_id;
+	bool loopback{ false };
+};
 
 class MFAudioCapture::Impl
 {
@@ -35,6 +62,11 @@ public:
 
 	~Impl()
 	{
+		for (MFAudioSession* session : m_vecSessions)
+		{
+			close_device(session);
+		}
+		m_vecSessions.clear();
 		if (m_pMicCollection)
 		{
 			m_pMicCollection->Release();
@@ -164,237 +196,226 @@ public:
 		return speaker_name;
 	}
 
-	bool start_mic(const std::string& device_id)
+	void set_block_size(int samples)
 	{
-		if (m_pMicCollection == nullptr)
-		{
-			return false;
-		}
-		int i = find_device_index(m_pMicCollection, device_id);
-		if (i == -1)
-		{
-			return false;
-		}
-		IMMDevice* device = NULL;
-		m_pMicCollection->Item(i, &device);
-		if (device == nullptr)
-		{
-			return false;
-		}
-		
-		IAudioClient* pAudioClient = NULL;
-		IAudioCaptureClient* pCaptureClient = NULL;
-		HRESULT hr = device->Activate(__uuidof(IAudioClient), CLSCTX_ALL, NULL, (void**)&pAudioClient);
-		device->Release();
-		if (FAILED(hr))
-		{
-			return false;
-		}
-		WAVEFORMATEX* pwfx = NULL;
-		hr = pAudioClient->GetMixFormat(&pwfx);
-		if (FAILED(hr))
+		m_iBlockSize = samples > 0 ? samples : 0;
+	}
+
+	MFAudioSession* start_mic(const std::string& device_id)
+	{
+		if (m_pMicCollection == nullptr || is_started(device_id, false))
 		{
-			pAudioClient->Release();
-			return false;
+			return nullptr;
 		}
-		AudioParam param;
-		param.sample_rate = pwfx->nSamplesPerSec;
-		param.channels = pwfx->nChannels;
-		param.format = get_pcm_format(pwfx);
-		m_mapMicParam[i] = param;
-		hr = pAudioClient->Initialize(AUDCLNT_SHAREMODE_SHARED, 0, 10000000, 0, pwfx, NULL);
-		CoTaskMemFree(pwfx);
-		if (FAILED(hr))
+		return open_device(m_pMicCollection, device_id, false);
+	}
+
+	MFAudioSession* start_speaker(const std::string& device_id)
+	{
+		if (m_pSpeakerCollection == nullptr || is_started(device_id, true))
 		{
-			pAudioClient->Release();
-			return false;
+			return nullptr;
 		}
-		hr = pAudioClient->GetService(__uuidof(IAudioCaptureClient), (void**)&pCaptureClient);
-		if (FAILED(hr))
+		return open_device(m_pSpeakerCollection, device_id, true);
+	}
+
+	void stop(MFAudioSession* session)
+	{
+		auto it = std::find(m_vecSessions.begin(), m_vecSessions.end(), session);
+		if (it != m_vecSessions.end())
 		{
-			pAudioClient->Release();
-			return false;
+			m_vecSessions.erase(it);
+			close_device(session);
 		}
-		hr = pAudioClient->Start();
-		if (FAILED(hr))
+	}
+
+	bool capture(MFAudioSession* session, OutputAudioData& output_data)
+	{
+		return session != nullptr && read_block(session, output_data);
+	}
+
+	bool get_stats(MFAudioSession* session, AudioRingStats& stats)
+	{
+		if (session == nullptr)
 		{
-			pCaptureClient->Release();
-			pAudioClient->Release();
 			return false;
 		}
-		m_mapMicAudioClient[i] = pAudioClient;
-		m_mapMicCaptureClient[i] = pCaptureClient;
+		session->ring.get_stats(stats);
 		return true;
 	}
 
-	void stop_mic(const std::string& device_id)
+private:
+	bool is_started(const std::string& device_id, bool loopback)
 	{
-		int i = find_device_index(m_pMicCollection, device_id);
-		if (i == -1)
-		{
-			return;
-		}
-		auto it1 = m_mapMicAudioClient.find(i);
-		if (it1 != m_mapMicAudioClient.end())
-		{
-			it1->second->Stop();
-			it1->second->Release();
-			m_mapMicAudioClient.erase(it1);
-		}
-		auto it2 = m_mapMicCaptureClient.find(i);
-		if (it2 != m_mapMicCaptureClient.end())
-		{
-			it2->second->Release();
-			m_mapMicCaptureClient.erase(it2);
-		}
-		auto it3 = m_mapMicParam.find(i);
-		if (it3 != m_mapMicParam.end())
+		for (MFAudioSession* session : m_vecSessions)
 		{
-			m_mapMicParam.erase(it3);
+			if (session->loopback == loopback && session->device_id == device_id)
+			{
+				return true;
+			}
 		}
+		return false;
 	}
 
-	bool start_speaker(const std::string& device_id)
+	// shared mode, event driven. a render endpoint is opened in loopback mode and captures what it plays
+	MFAudioSession* open_device(IMMDeviceCollection* collection, const std::string& device_id, bool loopback)
 	{
-		if (m_pSpeakerCollection == nullptr)
-		{
-			return false;
-		}
-		int i = find_device_index(m_pSpeakerCollection, device_id);
+		int i = find_device_index(collection, device_id);
 		if (i == -1)
 		{
-			return false;
+			return nullptr;
 		}
-		IMMDevice* device = NULL;
-		m_pSpeakerCollection->Item(i, &device);
-		if (device == nullptr)
+		IMMDevice* mm_device = NULL;
+		collection->Item(i, &mm_device);
+		if (mm_device == nullptr)
 		{
-			return false;
+			return nullptr;
 		}
-
-		IAudioClient* pAudioClient = NULL;
-		IAudioRenderClient* pRenderClient = NULL;
-		HRESULT hr = device->Activate(__uuidof(IAudioClient), CLSCTX_ALL, NULL, (void**)&pAudioClient);
-		device->Release();
+		MFAudioSession* device = new MFAudioSession();
+		device->device_id = device_id;
+		device->loopback = loopback;
+		HRESULT hr = mm_device->Activate(__uuidof(IAudioClient), CLSCTX_ALL, NULL, (void**)&device->audio_client);
+		mm_device->Release();
 		if (FAILED(hr))
 		{
-			return false;
+			close_device(device);
+			return nullptr;
 		}
 		WAVEFORMATEX* pwfx = NULL;
-		hr = pAudioClient->GetMixFormat(&pwfx);
+		hr = device->audio_client->GetMixFormat(&pwfx);
 		if (FAILED(hr))
 		{
-			pAudioClient->Release();
-			return false;
-		}
-		AudioParam param;
-		param.sample_rate = pwfx->nSamplesPerSec;
-		param.channels = pwfx->nChannels;
-		param.format = get_pcm_format(pwfx);
-		m_mapSpeakerParam[i] = param;
-		hr = pAudioClient->Initialize(AUDCLNT_SHAREMODE_SHARED, AUDCLNT_STREAMFLAGS_LOOPBACK, 0, 0, pwfx, NULL);
-		CoTaskMemFree(pwfx);
+			close_device(device);
+			return nullptr;
+		}
+		defer[&]{
+			CoTaskMemFree(pwfx);
+		};
+		device->param.sample_rate = pwfx->nSamplesPerSec;
+		device->param.channels = pwfx->nChannels;
+		device->param.format = get_pcm_format(pwfx);
+		device->param.channel_mask = get_channel_mask(pwfx);
+		DWORD stream_flags = AUDCLNT_STREAMFLAGS_EVENTCALLBACK | (loopback ? AUDCLNT_STREAMFLAGS_LOOPBACK : 0);
+		hr = device->audio_client->Initialize(AUDCLNT_SHAREMODE_SHARED, stream_flags, AUDIO_BUFFER_DURATION, 0, pwfx, NULL);
 		if (FAILED(hr))
 		{
-			pAudioClient->Release();
-			return false;
+			close_device(device);
+			return nullptr;
 		}
-		hr = pAudioClient->GetService(__uuidof(IAudioRenderClient), (void**)&pRenderClient);
+		hr = device->audio_client->GetService(__uuidof(IAudioCaptureClient), (void**)&device->capture_client);
 		if (FAILED(hr))
 		{
-			pAudioClient->Release();
-			return false;
+			close_device(device);
+			return nullptr;
 		}
-		hr = pAudioClient->Start();
-		if (FAILED(hr))
+		device->block_samples = m_iBlockSize > 0 ? m_iBlockSize : (int)pwfx->nSamplesPerSec / 100;
+		device->block.resize((size_t)device->block_samples * pwfx->nBlockAlign);
+		int capacity = (int)pwfx->nSamplesPerSec * AUDIO_RING_SECONDS;
+		device->sample_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+		device->stop_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+		if (!device->ring.configure(capacity > device->block_samples * 2 ? capacity : device->block_samples * 2, pwfx->nBlockAlign, pwfx->nSamplesPerSec) ||
+			device->sample_event == NULL || device->stop_event == NULL ||
+			FAILED(device->audio_client->SetEventHandle(device->sample_event)) || FAILED(device->audio_client->Start()))
 		{
-			pRenderClient->Release();
-			pAudioClient->Release();
-			return false;
+			close_device(device);
+			return nullptr;
 		}
-		m_mapSpeakerAudioClient[i] = pAudioClient;
-		m_mapSpeakerRenderClient[i] = pRenderClient;
-		return true;
+		device->thread = std::thread(&MFAudioCapture::Impl::capture_thread, this, device);
+		m_vecSessions.push_back(device);
+		return device;
 	}
 
-	void stop_speaker(const std::string& device_id)
+	void close_device(MFAudioSession* device)
 	{
-		int i = find_device_index(m_pSpeakerCollection, device_id);
-		if (i == -1)
+		if (device->thread.joinable())
 		{
-			return;
+			SetEvent(device->stop_event);
+			device->thread.join();
 		}
-		auto it1 = m_mapSpeakerAudioClient.find(i);
-		if (it1 != m_mapSpeakerAudioClient.end())
+		if (device->audio_client)
 		{
-			it1->second->Stop();
-			it1->second->Release();
-			m_mapSpeakerAudioClient.erase(it1);
+			device->audio_client->Stop();
 		}
-		auto it2 = m_mapSpeakerRenderClient.find(i);
-		if (it2 != m_mapSpeakerRenderClient.end())
+		if (device->capture_client)
 		{
-			it2->second->Release();
-			m_mapSpeakerRenderClient.erase(it2);
+			device->capture_client->Release();
 		}
-		auto it3 = m_mapSpeakerParam.find(i);
-		if (it3 != m_mapSpeakerParam.end())
+		if (device->audio_client)
 		{
-			m_mapSpeakerParam.erase(it3);
+			device->audio_client->Release();
 		}
-	}
-
-	bool capture_mic(const std::string& device_id, OutputAudioData& output_data)
-	{
-		int i = find_device_index(m_pMicCollection, device_id);
-		if (i == -1)
-		{
-			return false;
-		}
-		auto it = m_mapMicCaptureClient.find(i);
-		if (it == m_mapMicCaptureClient.end())
+		if (device->sample_event)
 		{
-			return false;
+			CloseHandle(device->sample_event);
 		}
-		BYTE* pData = NULL;
-		UINT32 numFramesAvailable = 0;
-		DWORD flags = 0;
-		HRESULT hr = it->second->GetBuffer(&pData, &numFramesAvailable, &flags, NULL, NULL);
-		if (FAILED(hr))
+		if (device->stop_event)
 		{
-			return false;
+			CloseHandle(device->stop_event);
 		}
-		output_data.data = pData;
-		output_data.param = m_mapMicParam[i];
-		output_data.samples = numFramesAvailable;
-		return true;
+		delete device;
 	}
 
-	bool capture_speaker(const std::string& device_id, OutputAudioData& output_data)
+	void capture_thread(MFAudioSession* device)
 	{
-		int i = find_device_index(m_pSpeakerCollection, device_id);
-		if (i == -1)
-		{
-			return false;
+		CoInitializeEx(NULL, COINIT_MULTITHREADED);
+		DWORD task_index = 0;
+		HANDLE task = AvSetMmThreadCharacteristicsW(L"Audio", &task_index);
+		HANDLE events[2] = { device->stop_event, device->sample_event };
+		while (true)
+		{
+			// loopback gets no events while nothing plays, the timeout keeps draining it anyway
+			DWORD wait = WaitForMultipleObjects(2, events, FALSE, AUDIO_WAIT_TIMEOUT_MS);
+			if (wait != WAIT_OBJECT_0 + 1 && wait != WAIT_TIMEOUT)
+			{
+				break;
+			}
+			drain_packets(device);
 		}
-		auto it = m_mapSpeakerRenderClient.find(i);
-		if (it == m_mapSpeakerRenderClient.end())
+		if (task)
 		{
-			return false;
+			AvRevertMmThreadCharacteristics(task);
 		}
-		BYTE* pData = NULL;
-		UINT32 numFramesPadding = 0;
-		HRESULT hr = it->second->GetBuffer(output_data.samples, &pData);
-		if (FAILED(hr))
+		CoUninitialize();
+	}
+
+	void drain_packets(MFAudioSession* device)
+	{
+		UINT32 packet_size = 0;
+		while (SUCCEEDED(device->capture_client->GetNextPacketSize(&packet_size)) && packet_size > 0)
+		{
+			BYTE* pData = NULL;
+			UINT32 numFramesAvailable = 0;
+			DWORD flags = 0;
+			UINT64 qpc_position = 0;
+			if (FAILED(device->capture_client->GetBuffer(&pData, &numFramesAvailable, &flags, NULL, &qpc_position)))
+			{
+				return;
+			}
+			// the QPC position is already in 100ns units on the mf_clock_now timeline
+			int64_t timestamp = (int64_t)qpc_position;
+			if ((flags & AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR) || qpc_position == 0)
+			{
+				timestamp = mf_clock_now() - mf_rescale(numFramesAvailable, MF_HNS_PER_SECOND, device->param.sample_rate);
+			}
+			device->ring.write((flags & AUDCLNT_BUFFERFLAGS_SILENT) ? nullptr : pData, (int)numFramesAvailable, timestamp);
+			device->capture_client->ReleaseBuffer(numFramesAvailable);
+		}
+	}
+
+	bool read_block(MFAudioSession* device, OutputAudioData& output_data)
+	{
+		int64_t timestamp = 0;
+		if (!device->ring.read(device->block.data(), device->block_samples, timestamp))
 		{
 			return false;
 		}
-		output_data.data = pData;
-		output_data.param = m_mapSpeakerParam[i];
+		output_data.data = device->block.data();
+		output_data.samples = device->block_samples;
+		output_data.param = device->param;
+		output_data.timestamp = timestamp;
 		return true;
 	}
 
-private:
 	int find_device_index(IMMDeviceCollection* collection, const std::string& device_id)
 	{
 		UINT count = 0;
@@ -427,10 +448,20 @@ private:
 		return -1;
 	}
 
+	// the shared mode mix format is always interleaved, WAVE_FORMAT_EXTENSIBLE only carries the sample type in SubFormat
 	PCM_FORMAT get_pcm_format(WAVEFORMATEX* pwfx)
 	{
-		if (pwfx->wFormatTag == WAVE_FORMAT_PCM)
+		bool is_float = pwfx->wFormatTag == WAVE_FORMAT_IEEE_FLOAT;
+		bool is_pcm = pwfx->wFormatTag == WAVE_FORMAT_PCM;
+		if (pwfx->wFormatTag == WAVE_FORMAT_EXTENSIBLE)
 		{
+			WAVEFORMATEXTENSIBLE* pEx = (WAVEFORMATEXTENSIBLE*)pwfx;
+			is_float = pEx->SubFormat == KSDATAFORMAT_SUBTYPE_IEEE_FLOAT;
+			is_pcm = pEx->SubFormat == KSDATAFORMAT_SUBTYPE_PCM;
+		}
+		if (is_pcm)
+		{
+			// 24 valid bits in a 32 bit container are left aligned, they read as S32
 			if (pwfx->wBitsPerSample == 8)
 			{
 				return PCM_U8;
@@ -439,6 +470,10 @@ private:
 			{
 				return PCM_S16;
 			}
+			else if (pwfx->wBitsPerSample == 24)
+			{
+				return PCM_S24;
+			}
 			else if (pwfx->wBitsPerSample == 32)
 			{
 				return PCM_S32;
@@ -448,7 +483,7 @@ private:
 				return PCM_S64;
 			}
 		}
-		else if (pwfx->wFormatTag == WAVE_FORMAT_IEEE_FLOAT)
+		else if (is_float)
 		{
 			if (pwfx->wBitsPerSample == 32)
 			{
@@ -459,52 +494,23 @@ private:
 				return PCM_DBL;
 			}
 		}
-		else if (pwfx->wFormatTag == WAVE_FORMAT_EXTENSIBLE)
+		return PCM_UNKNOWN;
+	}
+
+	uint32_t get_channel_mask(WAVEFORMATEX* pwfx)
+	{
+		if (pwfx->wFormatTag == WAVE_FORMAT_EXTENSIBLE && ((WAVEFORMATEXTENSIBLE*)pwfx)->dwChannelMask != 0)
 		{
-			WAVEFORMATEXTENSIBLE* pEx = (WAVEFORMATEXTENSIBLE*)pwfx;
-			if (pEx->SubFormat == KSDATAFORMAT_SUBTYPE_PCM)
-			{
-				if (pwfx->wBitsPerSample == 8)
-				{
-					return PCM_U8P;
-				}
-				else if (pwfx->wBitsPerSample == 16)
-				{
-					return PCM_S16P;
-				}
-				else if (pwfx->wBitsPerSample == 32)
-				{
-					return PCM_S32P;
-				}
-				else if (pwfx->wBitsPerSample == 64)
-				{
-					return PCM_S64P;
-				}
-			}
-			else if (pEx->SubFormat == KSDATAFORMAT_SUBTYPE_IEEE_FLOAT)
-			{
-				if (pwfx->wBitsPerSample == 32)
-				{
-					return PCM_FLTP;
-				}
-				else if (pwfx->wBitsPerSample == 64)
-				{
-					return PCM_DBLP;
-				}
-			}
+			return ((WAVEFORMATEXTENSIBLE*)pwfx)->dwChannelMask;
 		}
-		return PCM_UNKNOWN;
+		return mf_default_channel_mask(pwfx->nChannels);
 	}
 
 	IMMDeviceEnumerator* m_pDeviceEnumerator { nullptr };
 	IMMDeviceCollection* m_pMicCollection { nullptr };
 	IMMDeviceCollection* m_pSpeakerCollection { nullptr };
-	std::map<int, IAudioClient*> m_mapMicAudioClient;
-	std::map<int, IAudioCaptureClient*> m_mapMicCaptureClient;
-	std::map<int, IAudioClient*> m_mapSpeakerAudioClient;
-	std::map<int, IAudioRenderClient*> m_mapSpeakerRenderClient;
-	std::map<int, AudioParam> m_mapMicParam;
-	std::map<int, AudioParam> m_mapSpeakerParam;
+	std::vector<MFAudioSession*> m_vecSessions; // started devices, only start and stop walk it
+	int m_iBlockSize{ 0 };
 };
 
 MFAudioCapture::MFAudioCapture()
@@ -547,32 +553,32 @@ std::string MFAudioCapture::get_speaker_name(int index)
 	return impl_->get_speaker_name(index);
 }
 
-bool MFAudioCapture::start_mic(const std::string& device_id)
+AUDIO_SESSION MFAudioCapture::start_mic(const std::string& device_id)
 {
 	return impl_->start_mic(device_id);
 }
 
-void MFAudioCapture::stop_mic(const std::string& device_id)
+AUDIO_SESSION MFAudioCapture::start_speaker(const std::string& device_id)
 {
-	impl_->stop_mic(device_id);
+	return impl_->start_speaker(device_id);
 }
 
-bool MFAudioCapture::start_speaker(const std::string& device_id)
+void MFAudioCapture::stop(AUDIO_SESSION session)
 {
-	return impl_->start_speaker(device_id);
+	impl_->stop(session);
 }
 
-void MFAudioCapture::stop_speaker(const std::string& device_id)
+bool MFAudioCapture::capture(AUDIO_SESSION session, OutputAudioData& output_data)
 {
-	impl_->stop_speaker(device_id);
+	return impl_->capture(session, output_data);
 }
 
-bool MFAudioCapture::capture_mic(const std::string& device_id, OutputAudioData& output_data)
+void MFAudioCapture::set_block_size(int samples)
 {
-	return impl_->capture_mic(device_id, output_data);
+	impl_->set_block_size(samples);
 }
 
-bool MFAudioCapture::capture_speaker(const std::string& device_id, OutputAudioData& output_data)
+bool MFAudioCapture::get_stats(AUDIO_SESSION session, AudioRingStats& stats)
 {
-	return impl_->capture_speaker(device_id, output_data);
+	return impl_->get_stats(session, stats);
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <vector>
+#include "mf_video_frame.h"
 
 enum CAMERA_COLOR_FORMAT
 {
@@ -45,8 +46,12 @@ struct OutputCameraData
     CAMERA_COLOR_FORMAT format;
 	uint8_t* data;
 	unsigned long size;
+	int64_t timestamp; // capture time on the mf_clock_now timeline, in 100ns units
 };
 
+// one started camera, valid from start until stop. every call on it goes straight to its state, no id lookup
+typedef struct MFCameraSession* CAMERA_SESSION;
+
 class __declspec(dllexport) MFCameraCapture final
 {
 public:
@@ -56,13 +61,15 @@ public:
     int get_camera_count();
     std::string get_camera_id(int index);
     std::string get_camera_name(int index);
-	bool start(const std::string& camera_id, int& width, int& height, CAMERA_COLOR_FORMAT& format);
-	void stop(const std::string& camera_id);
-    void get_resolution_list(const std::string& camera_id, std::vector<std::pair<int, int>>& resolution_list);
-    void set_property(const std::string& camera_id, CAMERA_PROPETIES prop, float value, bool use_auto);
-	float get_property(const std::string& camera_id, CAMERA_PROPETIES prop);
+	CAMERA_SESSION start(const std::string& camera_id, int& width, int& height, CAMERA_COLOR_FORMAT& format); // nullptr on failure
+	void stop(CAMERA_SESSION session);
+    void get_resolution_list(CAMERA_SESSION session, std::vector<std::pair<int, int>>& resolution_list);
+    void set_property(CAMERA_SESSION session, CAMERA_PROPETIES prop, float value, bool use_auto);
+	float get_property(CAMERA_SESSION session, CAMERA_PROPETIES prop);
 
-    bool capture(const std::string& camera_id, OutputCameraData& output_data);
+    bool capture(CAMERA_SESSION session, OutputCameraData& output_data);
+    // the device buffer itself, kept locked until the new reference is dropped. every frame must be released before stop
+    bool capture(CAMERA_SESSION session, VideoFrame*& frame);
 
 private:
     class Impl;
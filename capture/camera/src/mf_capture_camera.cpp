@@ -1,13 +1,31 @@
 #include "mf_capture_camera.h"
+#include "mf_media_clock.h"
 #include <mfapi.h>
 #include <mfidl.h>
 #include <mfreadwrite.h>
 #include <strmif.h>
+#include <algorithm>
 #include <codecvt>
-#include <map>
 #include <mutex>
 
-class MFCameraCapture::Impl
+// everything one started camera needs, reached straight from the handle
+struct MFCameraSession
+{
+	IMFSourceReader* source_reader{ nullptr };
+	IMFMediaSource* media_source{ nullptr };
+	IMFMediaType* media_type{ nullptr };
+	IAMVideoProcAmp* proc_amp{ nullptr };
+	IAMCameraControl* camera_control{ nullptr };
+	int width{ 0 };
+	int height{ 0 };
+	int stride{ 0 };
+	CAMERA_COLOR_FORMAT format{ CAMERA_NONE };
+	PIXEL_FORMAT pixel_format{ PIXEL_NONE };
+	int64_t last_timestamp{ 0 };
+	MFClockDriftEstimator clock_estimator;
+};
+
+class MFCameraCapture::Impl final : public MFVideoFrameOwner
 {
 public:
 	Impl()
@@ -33,6 +51,11 @@ public:
 
 	~Impl()
 	{
+		for (MFCameraSession* session : m_vecSessions)
+		{
+			release_session(session);
+		}
+		m_vecSessions.clear();
 		if (m_pAttributes)
 		{
 			m_pAttributes->Release();
@@ -101,32 +124,32 @@ public:
 		return convert.to_bytes(name);
 	}
 
-	bool start(const std::string& camera_id, int& width, int& height, CAMERA_COLOR_FORMAT& format)
+	MFCameraSession* start(const std::string& camera_id, int& width, int& height, CAMERA_COLOR_FORMAT& format)
 	{
 		std::lock_guard<std::mutex> lock(m_mtEnumCamera);
 		if (m_pMFActivates == nullptr)
 		{
-			return false;
+			return nullptr;
 		}
 		int i = find_camera_index(camera_id);
 		if (i == -1)
 		{
-			return false;
+			return nullptr;
 		}
-		IMFMediaSource* media_source = nullptr;
-		HRESULT hr = m_pMFActivates[i]->ActivateObject(IID_PPV_ARGS(&media_source));
+		MFCameraSession* session = new MFCameraSession();
+		HRESULT hr = m_pMFActivates[i]->ActivateObject(IID_PPV_ARGS(&session->media_source));
 		if (FAILED(hr))
 		{
-			return false;
+			delete session;
+			return nullptr;
 		}
-		IMFSourceReader* source_reader = nullptr;
-		hr = MFCreateSourceReaderFromMediaSource(media_source, m_pAttributes, &source_reader);
+		hr = MFCreateSourceReaderFromMediaSource(session->media_source, m_pAttributes, &session->source_reader);
 		if (FAILED(hr))
 		{
-			return false;
+			release_session(session);
+			return nullptr;
 		}
-		m_mapMediaSource[i] = media_source;
-		m_mapSourceReader[i] = source_reader;
+		IMFSourceReader* source_reader = session->source_reader;
 		
 		int index = 0;
 		int select_index = 0;
@@ -145,11 +168,13 @@ public:
 			hr = MFGetAttributeRatio(native_type, MF_MT_FRAME_RATE, &frame_num, &frame_den);
 			if (frame_num / frame_den < 30)
 			{
+				native_type->Release();
 				continue;
 			}
 			UINT32 frame_width = 0;
 			UINT32 frame_height = 0;
 			hr = MFGetAttributeSize(native_type, MF_MT_FRAME_SIZE, &frame_width, &frame_height);
+			native_type->Release();
 			int delta = 0;
 			if (width < (int)frame_width)
 				delta += (frame_width - width);
@@ -168,70 +193,63 @@ public:
 			}
 		}
 		
-		IMFMediaType* media_type = NULL;
-		source_reader->GetNativeMediaType(MF_SOURCE_READER_FIRST_VIDEO_STREAM, select_index, &media_type);
+		hr = source_reader->GetNativeMediaType(MF_SOURCE_READER_FIRST_VIDEO_STREAM, select_index, &session->media_type);
+		if (FAILED(hr))
+		{
+			release_session(session);
+			return nullptr;
+		}
+		// the media type is fixed for the session, everything capture reports from it is read once here
 		UINT32 frame_width = 0;
 		UINT32 frame_height = 0;
-		MFGetAttributeSize(media_type, MF_MT_FRAME_SIZE, &frame_width, &frame_height);
-		width = frame_width;
-		height = frame_height;
+		MFGetAttributeSize(session->media_type, MF_MT_FRAME_SIZE, &frame_width, &frame_height);
 		GUID subtype;
-		media_type->GetGUID(MF_MT_SUBTYPE, &subtype);
-		format = guid_to_camera_format(subtype);
+		session->media_type->GetGUID(MF_MT_SUBTYPE, &subtype);
+		LONG stride = 0;
+		MFGetStrideForBitmapInfoHeader(subtype.Data1, frame_width, &stride);
+		session->width = frame_width;
+		session->height = frame_height;
+		session->stride = stride;
+		session->format = guid_to_camera_format(subtype);
+		session->pixel_format = camera_to_pixel_format(session->format);
+		width = session->width;
+		height = session->height;
+		format = session->format;
 
 		hr = source_reader->SetStreamSelection(MF_SOURCE_READER_FIRST_VIDEO_STREAM, TRUE);
 		if (FAILED(hr))
 		{
-			return false;
+			release_session(session);
+			return nullptr;
 		}
-		hr = source_reader->SetCurrentMediaType(MF_SOURCE_READER_FIRST_VIDEO_STREAM, NULL, media_type);
+		hr = source_reader->SetCurrentMediaType(MF_SOURCE_READER_FIRST_VIDEO_STREAM, NULL, session->media_type);
 		if (FAILED(hr))
 		{
-			return false;
+			release_session(session);
+			return nullptr;
 		}
-		m_mapMediaType[i] = media_type;
-		return true;
+		// cameras without one of the control interfaces leave it null, the properties it covers then do nothing
+		session->media_source->QueryInterface(IID_PPV_ARGS(&session->proc_amp));
+		session->media_source->QueryInterface(IID_PPV_ARGS(&session->camera_control));
+		m_vecSessions.push_back(session);
+		return session;
 	}
 
-	void stop(const std::string& camera_id)
+	void stop(MFCameraSession* session)
 	{
 		std::lock_guard<std::mutex> lock(m_mtEnumCamera);
-		int i = find_camera_index(camera_id);
-		if (i == -1)
+		auto it = std::find(m_vecSessions.begin(), m_vecSessions.end(), session);
+		if (it == m_vecSessions.end())
 		{
 			return;
 		}
-		auto it1 = m_mapMediaType.find(i);
-		if (it1 != m_mapMediaType.end())
-		{
-			it1->second->Release();
-			m_mapMediaType.erase(it1);
-		}
-		auto it2 = m_mapSourceReader.find(i);
-		if (it2 != m_mapSourceReader.end())
-		{
-			it2->second->Release();
-			m_mapSourceReader.erase(it2);
-		}
-		auto it3 = m_mapMediaSource.find(i);
-		if (it3 != m_mapMediaSource.end())
-		{
-			it3->second->Shutdown();
-			it3->second->Release();
-			m_mapMediaSource.erase(it3);
-		}
+		m_vecSessions.erase(it);
+		release_session(session);
 	}
 
-	void get_resolution_list(const std::string& camera_id, std::vector<std::pair<int, int>>& resolution_list)
+	void get_resolution_list(MFCameraSession* session, std::vector<std::pair<int, int>>& resolution_list)
 	{
-		std::lock_guard<std::mutex> lock(m_mtEnumCamera);
-		int i = find_camera_index(camera_id);
-		if (i == -1)
-		{
-			return;
-		}
-		auto it = m_mapSourceReader.find(i);
-		if (it == m_mapSourceReader.end())
+		if (session == nullptr)
 		{
 			return;
 		}
@@ -240,7 +258,7 @@ public:
 		while (hr == S_OK)
 		{
 			IMFMediaType* native_type = NULL;
-			hr = it->second->GetNativeMediaType(MF_SOURCE_READER_FIRST_VIDEO_STREAM, index, &native_type);
+			hr = session->source_reader->GetNativeMediaType(MF_SOURCE_READER_FIRST_VIDEO_STREAM, index, &native_type);
 			if (SUCCEEDED(hr))
 			{
 				UINT32 frame_width = 0;
@@ -250,175 +268,115 @@ public:
 				{
 					resolution_list.push_back(std::make_pair(frame_width, frame_height));
 				}
+				native_type->Release();
 			}
 			index++;
 		}
 	}
 
-	void set_property(const std::string& camera_id, CAMERA_PROPETIES prop, float value, bool use_auto)
+	void set_property(MFCameraSession* session, CAMERA_PROPETIES prop, float value, bool use_auto)
 	{
-		std::lock_guard<std::mutex> lock(m_mtEnumCamera);
-		int i = find_camera_index(camera_id);
-		if (i == -1)
-		{
-			return;
-		}
-		auto it = m_mapMediaSource.find(i);
-		if (it == m_mapMediaSource.end())
+		if (session == nullptr)
 		{
 			return;
 		}
 		int mf_prop = camera_prop_to_mf_prop(prop);
 		HRESULT hr = S_OK;
-		if (mf_prop < CAMERA_PAN)
+		if (prop < CAMERA_PAN)
 		{
-			IAMVideoProcAmp* proc_amp = NULL;
-			hr = it->second->QueryInterface(IID_PPV_ARGS(&proc_amp));
-			if (SUCCEEDED(hr))
+			if (session->proc_amp)
 			{
 				long min, max, step, def, caps;
-				hr = proc_amp->GetRange(mf_prop, &min, &max, &step, &def, &caps);
+				hr = session->proc_amp->GetRange(mf_prop, &min, &max, &step, &def, &caps);
 				if (SUCCEEDED(hr))
 				{
 					long val = (long)floor(min + (max - min) * value);
 					if (use_auto)
 						val = def;
-					hr = proc_amp->Set(mf_prop, val, use_auto ? VideoProcAmp_Flags_Auto : VideoProcAmp_Flags_Manual);
+					hr = session->proc_amp->Set(mf_prop, val, use_auto ? VideoProcAmp_Flags_Auto : VideoProcAmp_Flags_Manual);
 				}
-				proc_amp->Release();
 			}
 		}
 		else
 		{
-			IAMCameraControl* camera_control = NULL;
-			hr = it->second->QueryInterface(IID_PPV_ARGS(&camera_control));
-			if (SUCCEEDED(hr))
+			if (session->camera_control)
 			{
 				long min, max, step, def, caps;
-				hr = camera_control->GetRange(mf_prop, &min, &max, &step, &def, &caps);
+				hr = session->camera_control->GetRange(mf_prop, &min, &max, &step, &def, &caps);
 				if (SUCCEEDED(hr))
 				{
 					long val = (long)floor(min + (max - min) * value);
 					if (use_auto)
 						val = def;
-					hr = camera_control->Set(mf_prop, val, use_auto ? VideoProcAmp_Flags_Auto : VideoProcAmp_Flags_Manual);
+					hr = session->camera_control->Set(mf_prop, val, use_auto ? CameraControl_Flags_Auto : CameraControl_Flags_Manual);
 				}
-				camera_control->Release();
 			}
 		}
 	}
 
-	float get_property(const std::string& camera_id, CAMERA_PROPETIES prop)
+	float get_property(MFCameraSession* session, CAMERA_PROPETIES prop)
 	{
-		std::lock_guard<std::mutex> lock(m_mtEnumCamera);
-		int i = find_camera_index(camera_id);
-		if (i == -1)
-		{
-			return 0.0f;
-		}
-		auto it = m_mapMediaSource.find(i);
-		if (it == m_mapMediaSource.end())
+		if (session == nullptr)
 		{
 			return 0.0f;
 		}
 		int mf_prop = camera_prop_to_mf_prop(prop);
 		HRESULT hr = S_OK;
 		float value = 0.0f;
-		if (mf_prop < CAMERA_PAN)
+		if (prop < CAMERA_PAN)
 		{
-			IAMVideoProcAmp* proc_amp = NULL;
-			hr = it->second->QueryInterface(IID_PPV_ARGS(&proc_amp));
-			if (SUCCEEDED(hr))
+			if (session->proc_amp)
 			{
 				long min, max, step, def, caps;
-				hr = proc_amp->GetRange(mf_prop, &min, &max, &step, &def, &caps);
+				hr = session->proc_amp->GetRange(mf_prop, &min, &max, &step, &def, &caps);
 				if (SUCCEEDED(hr))
 				{
 					long v = 0, f = 0;
-					hr = proc_amp->Get(mf_prop, &v, &f);
+					hr = session->proc_amp->Get(mf_prop, &v, &f);
 					if (SUCCEEDED(hr))
 					{
 						value = (v - min) / (float)(max - min);
 					}
 				}
-				proc_amp->Release();
 			}
 		}
 		else
 		{
-			IAMCameraControl* camera_control = NULL;
-			hr = it->second->QueryInterface(IID_PPV_ARGS(&camera_control));
-			if (SUCCEEDED(hr))
+			if (session->camera_control)
 			{
 				long min, max, step, def, caps;
-				hr = camera_control->GetRange(mf_prop, &min, &max, &step, &def, &caps);
+				hr = session->camera_control->GetRange(mf_prop, &min, &max, &step, &def, &caps);
 				if (SUCCEEDED(hr))
 				{
 					long v = 0, f = 0;
-					hr = camera_control->Get(mf_prop, &v, &f);
+					hr = session->camera_control->Get(mf_prop, &v, &f);
 					if (SUCCEEDED(hr))
 					{
 						value = (v - min) / (float)(max - min);
 					}
 				}
-				camera_control->Release();
 			}
 		}
 		return value;
 	}
 
-	bool capture(const std::string& camera_id, OutputCameraData& output_data)
+	bool capture(MFCameraSession* session, OutputCameraData& output_data)
 	{
-		int i = find_camera_index(camera_id);
-		if (i == -1)
+		if (session == nullptr)
 		{
 			return false;
 		}
-		auto it1 = m_mapSourceReader.find(i);
-		if (it1 == m_mapSourceReader.end())
-		{
-			return false;
-		}
-		IMFSample* sample = NULL;
-		DWORD stream_index = 0;
-		DWORD flags = 0;
-		LONGLONG timestamp = 0;
-		HRESULT hr = it1->second->ReadSample(MF_SOURCE_READER_FIRST_VIDEO_STREAM, 0, &stream_index, &flags, &timestamp, &sample);
-		if (FAILED(hr))
-		{
-			return false;
-		}
-		if (flags & MF_SOURCE_READERF_ENDOFSTREAM)
-		{
-			return false;
-		}
-		if (sample == NULL)
-		{
-			return false;
-		}
-
-		auto it2 = m_mapMediaType.find(i);
-		if (it2 != m_mapMediaType.end())
-		{
-			UINT32 frame_width = 0;
-			UINT32 frame_height = 0;
-			MFGetAttributeSize(it2->second, MF_MT_FRAME_SIZE, &frame_width, &frame_height);
-			output_data.width = frame_width;
-			output_data.height = frame_height;
-			GUID subtype;
-			it2->second->GetGUID(MF_MT_SUBTYPE, &subtype);
-			output_data.format = guid_to_camera_format(subtype);
-			LONG stride = 0;
-			MFGetStrideForBitmapInfoHeader(subtype.Data1, frame_width, &stride);
-			output_data.stride = stride;
-		}
-		IMFMediaBuffer* buffer = NULL;
-		hr = sample->ConvertToContiguousBuffer(&buffer);
-		if (FAILED(hr))
+		int64_t capture_time = 0;
+		IMFMediaBuffer* buffer = read_buffer(session, capture_time);
+		if (buffer == nullptr)
 		{
-			sample->Release();
 			return false;
 		}
+		output_data.timestamp = capture_time;
+		output_data.width = session->width;
+		output_data.height = session->height;
+		output_data.format = session->format;
+		output_data.stride = session->stride;
 		buffer->GetCurrentLength(&output_data.size);
 		if (output_data.data == nullptr)
 		{
@@ -440,11 +398,112 @@ public:
 		}
 		buffer->Unlock();
 		buffer->Release();
-		sample->Release();
 		return true;
 	}
 
+	bool capture(MFCameraSession* session, VideoFrame*& frame)
+	{
+		if (session == nullptr || session->pixel_format == PIXEL_NONE)
+		{
+			return false;
+		}
+		int64_t capture_time = 0;
+		IMFMediaBuffer* buffer = read_buffer(session, capture_time);
+		if (buffer == nullptr)
+		{
+			return false;
+		}
+		uint8_t* data = nullptr;
+		if (FAILED(buffer->Lock(&data, nullptr, nullptr)))
+		{
+			buffer->Release();
+			return false;
+		}
+		// the frame keeps the buffer locked, bottom-up rgb is handed out as is with a negative stride
+		uint8_t* base = session->stride < 0 ? data + (size_t)(session->height - 1) * -session->stride : data;
+		frame = mf_video_frame_wrap(session->pixel_format, session->width, session->height, base, session->stride, this, buffer);
+		if (frame == nullptr)
+		{
+			buffer->Unlock();
+			buffer->Release();
+			return false;
+		}
+		frame->timestamp = capture_time;
+		return true;
+	}
+
+	void release_frame(VideoFrame* frame) override
+	{
+		IMFMediaBuffer* buffer = static_cast<IMFMediaBuffer*>(frame->opaque);
+		buffer->Unlock();
+		buffer->Release();
+	}
+
 private:
+	// next sample of the session as one contiguous buffer with its capture time, the caller releases it
+	IMFMediaBuffer* read_buffer(MFCameraSession* session, int64_t& capture_time)
+	{
+		IMFSample* sample = NULL;
+		DWORD stream_index = 0;
+		DWORD flags = 0;
+		LONGLONG timestamp = 0;
+		HRESULT hr = session->source_reader->ReadSample(MF_SOURCE_READER_FIRST_VIDEO_STREAM, 0, &stream_index, &flags, &timestamp, &sample);
+		if (FAILED(hr))
+		{
+			return nullptr;
+		}
+		if (flags & MF_SOURCE_READERF_ENDOFSTREAM)
+		{
+			if (sample)
+			{
+				sample->Release();
+			}
+			return nullptr;
+		}
+		if (sample == NULL)
+		{
+			return nullptr;
+		}
+		// sample times are on the source reader's own clock, the estimator maps them onto mf_clock_now
+		session->clock_estimator.add(timestamp, mf_clock_now());
+		capture_time = session->clock_estimator.map(timestamp);
+		if (capture_time <= session->last_timestamp)
+		{
+			capture_time = session->last_timestamp + 1;
+		}
+		session->last_timestamp = capture_time;
+
+		IMFMediaBuffer* buffer = NULL;
+		hr = sample->ConvertToContiguousBuffer(&buffer);
+		sample->Release();
+		if (FAILED(hr))
+		{
+			return nullptr;
+		}
+		return buffer;
+	}
+
+	PIXEL_FORMAT camera_to_pixel_format(CAMERA_COLOR_FORMAT format)
+	{
+		switch (format)
+		{
+		case CAMERA_RGB32:
+			return PIXEL_BGRA;
+		case CAMERA_RGB24:
+			return PIXEL_RGB24;
+		case CAMERA_NV12:
+			return PIXEL_NV12;
+		case CAMERA_YUY2:
+			return PIXEL_YUY2;
+		case CAMERA_I420:
+			return PIXEL_I420;
+		case CAMERA_UYVY:
+			return PIXEL_UYVY;
+		default:
+			return PIXEL_NONE;
+		}
+	}
+
 	CAMERA_COLOR_FORMAT guid_to_camera_format(GUID guid)
 	{
 		if (guid == MFVideoFormat_RGB32)
@@ -474,6 +533,33 @@ private:
 		return CAMERA_NONE;
 	}
 
+	void release_session(MFCameraSession* session)
+	{
+		if (session->proc_amp)
+		{
+			session->proc_amp->Release();
+		}
+		if (session->camera_control)
+		{
+			session->camera_control->Release();
+		}
+		if (session->media_type)
+		{
+			session->media_type->Release();
+		}
+		if (session->source_reader)
+		{
+			session->source_reader->Release();
+		}
+		if (session->media_source)
+		{
+			session->media_source->Shutdown();
+			session->media_source->Release();
+		}
+		delete session;
+	}
+
+	// only start looks a camera up by id, everything after works on the session
 	int find_camera_index(const std::string& camera_id)
 	{
 		if (m_pMFActivates == nullptr)
@@ -485,8 +571,14 @@ private:
 			WCHAR* guid = 0;
 			UINT32 guid_len = 255;
 			m_pMFActivates[i]->GetAllocatedString(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_SYMBOLIC_LINK, &guid, &guid_len);
+			if (guid == nullptr)
+			{
+				continue;
+			}
 			std::wstring_convert<std::codecvt_utf8<wchar_t>, wchar_t> convert;
-			if (camera_id == convert.to_bytes(guid))
+			bool match = camera_id == convert.to_bytes(guid);
+			CoTaskMemFree(guid);
+			if (match)
 			{
 				return i;
 			}
@@ -540,9 +632,7 @@ private:
 	IMFAttributes* m_pAttributes{ nullptr };
 	IMFActivate** m_pMFActivates{ nullptr };
 	UINT32 m_iCameraCount{ 0 };
-	std::map<int, IMFSourceReader*> m_mapSourceReader;
-	std::map<int, IMFMediaSource*> m_mapMediaSource;
-	std::map<int, IMFMediaType*> m_mapMediaType;
+	std::vector<MFCameraSession*> m_vecSessions;
 	std::mutex m_mtEnumCamera;
 };
 
@@ -571,32 +661,37 @@ std::string MFCameraCapture::get_camera_name(int index)
 	return impl_->get_camera_name(index);
 }
 
-bool MFCameraCapture::start(const std::string& camera_id, int& width, int& height, CAMERA_COLOR_FORMAT& format)
+CAMERA_SESSION MFCameraCapture::start(const std::string& camera_id, int& width, int& height, CAMERA_COLOR_FORMAT& format)
 {
 	return impl_->start(camera_id, width, height, format);
 }
 
-void MFCameraCapture::stop(const std::string& camera_id)
+void MFCameraCapture::stop(CAMERA_SESSION session)
+{
+	impl_->stop(session);
+}
+
+void MFCameraCapture::get_resolution_list(CAMERA_SESSION session, std::vector<std::pair<int, int>>& resolution_list)
 {
-	impl_->stop(camera_id);
+	impl_->get_resolution_list(session, resolution_list);
 }
 
-void MFCameraCapture::get_resolution_list(const std::string& camera_id, std::vector<std::pair<int, int>>& resolution_list)
+void MFCameraCapture::set_property(CAMERA_SESSION session, CAMERA_PROPETIES prop, float value, bool use_auto)
 {
-	impl_->get_resolution_list(camera_id, resolution_list);
+	impl_->set_property(session, prop, value, use_auto);
 }
 
-void MFCameraCapture::set_property(const std::string& camera_id, CAMERA_PROPETIES prop, float value, bool use_auto)
+float MFCameraCapture::get_property(CAMERA_SESSION session, CAMERA_PROPETIES prop)
 {
-	impl_->set_property(camera_id, prop, value, use_auto);
+	return impl_->get_property(session, prop);
 }
 
-float MFCameraCapture::get_property(const std::string& camera_id, CAMERA_PROPETIES prop)
+bool MFCameraCapture::capture(CAMERA_SESSION session, OutputCameraData& output_data)
 {
-	return impl_->get_property(camera_id, prop);
+	return impl_->capture(session, output_data);
 }
 
-bool MFCameraCapture::capture(const std::string& camera_id, OutputCameraData& output_data)
+bool MFCameraCapture::capture(CAMERA_SESSION session, VideoFrame*& frame)
 {
-	return impl_->capture(camera_id, output_data);
+	return impl_->capture(session, frame);
 }
\ No newline at end of file
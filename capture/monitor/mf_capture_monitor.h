@@ -2,6 +2,8 @@
 #define MF_CAPTURE_MONITOR_H
 
 #include <string>
+#include "mf_dirty_region.h"
+#include "mf_video_frame.h"
 
 enum MONITOR_COLOR_FORMAT
 {
@@ -16,8 +18,12 @@ struct OutputMonitorData
 	int height;
 	int stride;
 	MONITOR_COLOR_FORMAT format;
-	uint8_t* data;
+	uint8_t* data; // MONITOR_BGRA: mapped rows owned by the capture, valid until the next capture or stop. MONITOR_D3D11: the texture
 	unsigned long size;
+	bool unchanged; // true when the frame is identical to the previous one, only set with dirty region detection
+	int dirty_rect_count;
+	const MonitorRect* dirty_rects; // owned by the capture, valid until the next capture call
+	int64_t timestamp; // capture time on the mf_clock_now timeline, in 100ns units. a repeated frame gets the time of the call
 };
 
 class __declspec(dllexport) MFMonitorCapture final
@@ -32,8 +38,13 @@ public:
 	void get_monitor_resolution(void* hmon, int& width, int& height);
 	bool start(void* hmon, bool show_cursor, MONITOR_COLOR_FORMAT format);
 	void stop();
+	void set_dirty_region_detection(bool enable, int tile_size); // if not set, default is disabled and the whole frame is reported dirty. tile_size 0 means 64
 
+	// MONITOR_BGRA frames are read back one call late, so the copy of a new frame overlaps reading the previous one
 	bool capture(OutputMonitorData& output_data);
+	// MONITOR_BGRA only. the mapped staging rows themselves, they stay mapped until the new reference is dropped,
+	// which any thread may do. every frame must be released before stop
+	bool capture(VideoFrame*& frame);
 
 private:
 	class Impl;
@@ -0,0 +1,47 @@
+#ifndef MF_DIRTY_REGION_H
+#define MF_DIRTY_REGION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+struct MonitorRect
+{
+	int left;
+	int top;
+	int right;
+	int bottom;
+};
+
+// Hashes fixed tiles of consecutive BGRA frames and reports the tiles that changed as merged rectangles.
+// The first frame after configure() or reset() is reported fully dirty.
+class MFDirtyRegionDetector final
+{
+public:
+	MFDirtyRegionDetector();
+	~MFDirtyRegionDetector();
+
+	bool configure(int width, int height, int tile_size);
+	void reset();
+	int get_tile_size();
+
+	// returns false when no tile changed, rects is cleared first
+	bool detect(const uint8_t* data, int stride, std::vector<MonitorRect>& rects);
+
+private:
+	void merge_tiles(std::vector<MonitorRect>& rects);
+
+	int m_iWidth{ 0 };
+	int m_iHeight{ 0 };
+	int m_iTileSize{ 64 };
+	int m_iTilesX{ 0 };
+	int m_iTilesY{ 0 };
+	bool m_bValid{ false };
+	std::vector<uint64_t> m_vecHashes;
+	std::vector<uint64_t> m_vecPrevHashes;
+	std::vector<uint8_t> m_vecDirty;
+	std::vector<size_t> m_vecOpenRects; // rects ending at the row merge_tiles is on, left to right
+	std::vector<size_t> m_vecNextOpenRects;
+};
+
+#endif
@@ -1,4 +1,6 @@
 #include "mf_capture_monitor.h"
+#include "mf_media_clock.h"
+#include "mf_readback_ring.h"
 #include <windows.h>
 #include <d3d11.h>
 #include <dxgi.h>
@@ -11,7 +13,8 @@
 #include <vector>
 #include <mutex>
 
-#define XALIGN(x, a) (((x) + (a)-1) & ~((a)-1))
+#define MONITOR_READBACK_SLOTS 3 // one leased to the caller, one being read back, one for the next copy
+#define MONITOR_READBACK_DEPTH 1
 
 extern "C"
 {
@@ -24,7 +27,7 @@ struct __declspec(uuid("A9B3D012-3DF2-4EE3-B8D1-8695F457D3C1"))
 	virtual HRESULT __stdcall GetInterface(GUID const& id, void** object) = 0;
 };
 
-class MFMonitorCapture::Impl
+class MFMonitorCapture::Impl final : public MFVideoFrameOwner
 {
 public:
 	Impl()
@@ -117,29 +120,8 @@ public:
 		m_Session = m_FramePool.CreateCaptureSession(item);
 
 		m_OutputFormat = format;
-		D3D11_TEXTURE2D_DESC desc = {};
-		desc.Width = m_MonitorSize.Width;
-		desc.Height = m_MonitorSize.Height;
-		desc.MipLevels = 1;
-		desc.ArraySize = 1;
-		desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
-		desc.SampleDesc.Count = 1;
-		desc.SampleDesc.Quality = 0;
-		if (m_OutputFormat == MONITOR_D3D11)
-		{
-			desc.Usage = D3D11_USAGE_DEFAULT;
-			desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-			desc.CPUAccessFlags = 0;
-		}
-		else
-		{
-			desc.Usage = D3D11_USAGE_STAGING;
-			desc.BindFlags = 0;
-			desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
-		}
-		desc.MiscFlags = 0;
-		hr = m_pD3DDevice->CreateTexture2D(&desc, nullptr, &m_pCopyTexture);
-		if (FAILED(hr))
+		m_ReadbackRing.configure(MONITOR_READBACK_SLOTS, MONITOR_READBACK_DEPTH);
+		if (!create_copy_textures(m_MonitorSize.Width, m_MonitorSize.Height))
 		{
 			return false;
 		}
@@ -169,18 +151,26 @@ public:
 			m_Session.Close();
 			m_Session = nullptr;
 		}
-		if (m_pCopyTexture)
-		{
-			m_pCopyTexture->Release();
-			m_pCopyTexture = nullptr;
-		}
+		release_copy_textures();
+	}
+
+	void set_dirty_region_detection(bool enable, int tile_size)
+	{
+		m_bDetectDirtyRegion = enable;
+		m_iDirtyTileSize = tile_size > 0 ? tile_size : 64;
+		m_DirtyRegion.reset();
 	}
 
 	bool capture(OutputMonitorData& output_data)
 	{
 		D3D11_TEXTURE2D_DESC desc = {};
+		bool new_frame = false;
+		int64_t timestamp = 0;
 		{
 			std::lock_guard lock(m_mtTextureLock);
+			new_frame = m_iFrameCount != m_iCapturedFrameCount;
+			m_iCapturedFrameCount = m_iFrameCount;
+			timestamp = new_frame ? m_iFrameTime : mf_clock_now();
 			if (m_pFullScreenTexture)
 			{			
 				m_pFullScreenTexture->GetDesc(&desc);
@@ -190,25 +180,29 @@ public:
 				}
 				else
 				{
+					bool resized = false;
 					if (m_bChangingSize)
 					{
-						if (m_OutputFormat == MONITOR_BGRA)
+						release_copy_textures();
+						create_copy_textures(m_MonitorSize.Width, m_MonitorSize.Height);
+						m_bChangingSize = false;
+						resized = true;
+					}
+					if (m_OutputFormat == MONITOR_D3D11)
+					{
+						if (m_pCopyTexture)
 						{
-							int stride = XALIGN(desc.Width * 4, 64);
-							delete[] output_data.data;
-							output_data.data = new uint8_t[stride * m_MonitorSize.Height];
+							m_pD3DContext->CopyResource(m_pCopyTexture, m_pFullScreenTexture);
 						}
-						D3D11_TEXTURE2D_DESC copy_desc = {};
-						m_pCopyTexture->GetDesc(&copy_desc);
-						copy_desc.Width = m_MonitorSize.Width;
-						copy_desc.Height = m_MonitorSize.Height;
-						m_pCopyTexture->Release();
-						m_pD3DDevice->CreateTexture2D(&copy_desc, nullptr, &m_pCopyTexture);
-						m_bChangingSize = false;
 					}
-					if (m_pCopyTexture)
+					else if (new_frame || resized)
 					{
-						m_pD3DContext->CopyResource(m_pCopyTexture, m_pFullScreenTexture);
+						// queued on the GPU, read back on a later call once the copy has finished
+						int slot = m_vecStagingTexture.empty() ? -1 : m_ReadbackRing.begin_copy(timestamp);
+						if (slot >= 0)
+						{
+							m_pD3DContext->CopyResource(m_vecStagingTexture[slot], m_pFullScreenTexture);
+						}
 					}
 				}
 			}
@@ -224,25 +218,226 @@ public:
 		}
 		else
 		{
-			output_data.width = desc.Width;
-			output_data.height = desc.Height;
-			output_data.format = MONITOR_BGRA;
-			D3D11_MAPPED_SUBRESOURCE mapped;
-			if (m_pCopyTexture)
+			drain_released_slots();
+			// without a new frame, or before the first frame was ever read, the queued copy is read right away
+			int64_t read_timestamp = 0;
+			int slot = m_ReadbackRing.begin_read(!new_frame || m_iLeasedSlot < 0, read_timestamp);
+			// the leased frame is repeated until a copy is read, it gets the time of the call like any repeat
+			timestamp = mf_clock_now();
+			new_frame = false;
+			if (slot >= 0)
 			{
-				if (SUCCEEDED(m_pD3DContext->Map(m_pCopyTexture, 0, D3D11_MAP_READ, 0, &mapped)))
+				if (SUCCEEDED(m_pD3DContext->Map(m_vecStagingTexture[slot], 0, D3D11_MAP_READ, 0, &m_Mapped[slot])))
 				{
-					output_data.stride = mapped.RowPitch;
-					output_data.size = mapped.RowPitch * desc.Height;
-					memcpy(output_data.data, mapped.pData, output_data.size);
-					m_pD3DContext->Unmap(m_pCopyTexture, 0);
+					release_lease();
+					m_iLeasedSlot = slot;
+					m_iSlotRefs[slot] = 1;
+					timestamp = read_timestamp;
+					new_frame = true;
+				}
+				else
+				{
+					m_ReadbackRing.end_read(slot);
 				}
 			}
+			output_data.format = MONITOR_BGRA;
+			if (m_iLeasedSlot >= 0)
+			{
+				output_data.width = m_iStagingWidth;
+				output_data.height = m_iStagingHeight;
+				output_data.stride = m_Mapped[m_iLeasedSlot].RowPitch;
+				output_data.size = m_Mapped[m_iLeasedSlot].RowPitch * m_iStagingHeight;
+				output_data.data = static_cast<uint8_t*>(m_Mapped[m_iLeasedSlot].pData);
+			}
+			else
+			{
+				output_data.width = 0;
+				output_data.height = 0;
+				output_data.stride = 0;
+				output_data.size = 0;
+				output_data.data = nullptr;
+			}
+		}
+		update_dirty_region(output_data, new_frame);
+		output_data.timestamp = timestamp > m_iLastTimestamp ? timestamp : m_iLastTimestamp + 1;
+		m_iLastTimestamp = output_data.timestamp;
+		return true;
+	}
+
+	bool capture(VideoFrame*& frame)
+	{
+		if (m_OutputFormat != MONITOR_BGRA)
+		{
+			return false;
+		}
+		OutputMonitorData output_data = {};
+		capture(output_data);
+		if (m_iLeasedSlot < 0)
+		{
+			return false;
 		}
+		// every call gets its own header, a repeat references the same mapped slot with the time of the call
+		frame = mf_video_frame_wrap(PIXEL_BGRA, output_data.width, output_data.height, output_data.data, output_data.stride, this, (void*)(intptr_t)(m_iSlotGeneration * MONITOR_READBACK_SLOTS + m_iLeasedSlot));
+		if (frame == nullptr)
+		{
+			return false;
+		}
+		m_iSlotRefs[m_iLeasedSlot]++;
+		frame->timestamp = output_data.timestamp;
+		frame->unchanged = output_data.unchanged;
 		return true;
 	}
 
+	// any thread, the slot is unmapped by the next capture or stop on the capture thread
+	void release_frame(VideoFrame* frame) override
+	{
+		std::lock_guard<std::mutex> lock(m_mtReleasedSlots);
+		m_vecReleasedSlots.push_back((int64_t)(intptr_t)frame->opaque);
+	}
+
 private:
+	bool create_copy_textures(int width, int height)
+	{
+		D3D11_TEXTURE2D_DESC desc = {};
+		desc.Width = width;
+		desc.Height = height;
+		desc.MipLevels = 1;
+		desc.ArraySize = 1;
+		desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+		desc.SampleDesc.Count = 1;
+		desc.SampleDesc.Quality = 0;
+		desc.MiscFlags = 0;
+		if (m_OutputFormat == MONITOR_D3D11)
+		{
+			desc.Usage = D3D11_USAGE_DEFAULT;
+			desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+			desc.CPUAccessFlags = 0;
+			return SUCCEEDED(m_pD3DDevice->CreateTexture2D(&desc, nullptr, &m_pCopyTexture));
+		}
+		desc.Usage = D3D11_USAGE_STAGING;
+		desc.BindFlags = 0;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		m_vecStagingTexture.assign(m_ReadbackRing.get_slot_count(), nullptr);
+		for (size_t i = 0; i < m_vecStagingTexture.size(); i++)
+		{
+			if (FAILED(m_pD3DDevice->CreateTexture2D(&desc, nullptr, &m_vecStagingTexture[i])))
+			{
+				release_copy_textures();
+				return false;
+			}
+		}
+		m_iStagingWidth = width;
+		m_iStagingHeight = height;
+		return true;
+	}
+
+	void release_copy_textures()
+	{
+		release_lease();
+		drain_released_slots();
+		// a resize can come while frames are still out, their textures stay mapped until the last one is released
+		for (int i = 0; i < MONITOR_READBACK_SLOTS; i++)
+		{
+			if (m_iSlotRefs[i] > 0)
+			{
+				m_vecRetiredSlots.push_back({ m_iSlotGeneration * MONITOR_READBACK_SLOTS + i, m_vecStagingTexture[i], m_iSlotRefs[i] });
+				m_vecStagingTexture[i] = nullptr;
+				m_iSlotRefs[i] = 0;
+			}
+		}
+		m_ReadbackRing.reset();
+		m_iSlotGeneration++;
+		for (ID3D11Texture2D* texture : m_vecStagingTexture)
+		{
+			if (texture)
+			{
+				texture->Release();
+			}
+		}
+		m_vecStagingTexture.clear();
+		if (m_pCopyTexture)
+		{
+			m_pCopyTexture->Release();
+			m_pCopyTexture = nullptr;
+		}
+	}
+
+	// the caller's rows stay mapped until a newer frame replaces them and no VideoFrame references the slot
+	void release_lease()
+	{
+		if (m_iLeasedSlot >= 0)
+		{
+			unref_slot(m_iLeasedSlot);
+			m_iLeasedSlot = -1;
+		}
+	}
+
+	void unref_slot(int slot)
+	{
+		if (m_iSlotRefs[slot] > 0 && --m_iSlotRefs[slot] == 0)
+		{
+			m_pD3DContext->Unmap(m_vecStagingTexture[slot], 0);
+			m_ReadbackRing.end_read(slot);
+		}
+	}
+
+	void drain_released_slots()
+	{
+		std::lock_guard<std::mutex> lock(m_mtReleasedSlots);
+		for (int64_t released : m_vecReleasedSlots)
+		{
+			if (released / MONITOR_READBACK_SLOTS == m_iSlotGeneration)
+			{
+				unref_slot((int)(released % MONITOR_READBACK_SLOTS));
+				continue;
+			}
+			for (size_t i = 0; i < m_vecRetiredSlots.size(); i++)
+			{
+				RetiredSlot& retired = m_vecRetiredSlots[i];
+				if (retired.id != released)
+				{
+					continue;
+				}
+				if (--retired.refs == 0)
+				{
+					m_pD3DContext->Unmap(retired.texture, 0);
+					retired.texture->Release();
+					m_vecRetiredSlots.erase(m_vecRetiredSlots.begin() + i);
+				}
+				break;
+			}
+		}
+		m_vecReleasedSlots.clear();
+	}
+
+	void update_dirty_region(OutputMonitorData& output_data, bool new_frame)
+	{
+		output_data.unchanged = false;
+		m_vecDirtyRects.assign(1, { 0, 0, output_data.width, output_data.height });
+		if (m_bDetectDirtyRegion && output_data.format == MONITOR_BGRA && output_data.width > 0 && output_data.height > 0)
+		{
+			if (m_DirtyRegion.get_tile_size() != m_iDirtyTileSize || m_iDirtyWidth != output_data.width || m_iDirtyHeight != output_data.height)
+			{
+				m_DirtyRegion.configure(output_data.width, output_data.height, m_iDirtyTileSize);
+				m_iDirtyWidth = output_data.width;
+				m_iDirtyHeight = output_data.height;
+				new_frame = true;
+			}
+			// the frame pool only signals new content, without a new frame there is nothing to hash
+			if (!new_frame)
+			{
+				m_vecDirtyRects.clear();
+			}
+			else
+			{
+				m_DirtyRegion.detect(output_data.data, output_data.stride, m_vecDirtyRects);
+			}
+			output_data.unchanged = m_vecDirtyRects.empty();
+		}
+		output_data.dirty_rect_count = (int)m_vecDirtyRects.size();
+		output_data.dirty_rects = m_vecDirtyRects.empty() ? nullptr : m_vecDirtyRects.data();
+	}
+
 	void on_frame_arrived(winrt::Windows::Graphics::Capture::Direct3D11CaptureFramePool const& sender, winrt::Windows::Foundation::IInspectable const& args)
 	{
 		auto frame = sender.TryGetNextFrame();
@@ -257,6 +452,8 @@ private:
 		std::lock_guard lock(m_mtTextureLock);
 		auto access = frame.Surface().as<IDirect3DDxgiInterfaceAccess>();
 		access->GetInterface(IID_PPV_ARGS(&m_pFullScreenTexture));
+		m_iFrameTime = frame.SystemRelativeTime().count(); // QPC in 100ns units, the mf_clock_now timeline
+		m_iFrameCount++;
 	}
 
 	void on_closed(winrt::Windows::Graphics::Capture::GraphicsCaptureItem const& sender, winrt::Windows::Foundation::IInspectable const& args)
@@ -268,7 +465,24 @@ private:
 	ID3D11Device* m_pD3DDevice{ nullptr };
 	ID3D11DeviceContext* m_pD3DContext{ nullptr };
 	ID3D11Texture2D* m_pFullScreenTexture{ nullptr };
-	ID3D11Texture2D* m_pCopyTexture{ nullptr };
+	ID3D11Texture2D* m_pCopyTexture{ nullptr }; // MONITOR_D3D11 output
+	std::vector<ID3D11Texture2D*> m_vecStagingTexture; // MONITOR_BGRA readback, one per ring slot
+	MFReadbackRing m_ReadbackRing;
+	int m_iLeasedSlot{ -1 }; // the slot capture hands out, holds one of its references
+	int m_iSlotRefs[MONITOR_READBACK_SLOTS]{}; // a slot stays mapped while referenced
+	D3D11_MAPPED_SUBRESOURCE m_Mapped[MONITOR_READBACK_SLOTS]{};
+	std::mutex m_mtReleasedSlots;
+	std::vector<int64_t> m_vecReleasedSlots; // released by VideoFrames on other threads, unmapped on the capture thread
+	int64_t m_iSlotGeneration{ 0 }; // bumped whenever the staging textures are recreated
+	struct RetiredSlot
+	{
+		int64_t id; // generation * slots + slot, as in VideoFrame::opaque
+		ID3D11Texture2D* texture;
+		int refs;
+	};
+	std::vector<RetiredSlot> m_vecRetiredSlots; // mapped textures from before a resize, frames still reference them
+	int m_iStagingWidth{ 0 };
+	int m_iStagingHeight{ 0 };
 	MONITOR_COLOR_FORMAT m_OutputFormat{ MONITOR_COLOR_FORMAT::MONITOR_NONE };
 	winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice m_DirectDevice{ nullptr };
 	winrt::Windows::Graphics::Capture::Direct3D11CaptureFramePool m_FramePool{ nullptr };
@@ -279,6 +493,16 @@ private:
 	std::mutex m_mtTextureLock;
 	bool m_bChangingSize{ false };
 	std::vector<HMONITOR> m_pMonitorList;
+	uint64_t m_iFrameCount{ 0 };
+	int64_t m_iFrameTime{ 0 };
+	int64_t m_iLastTimestamp{ 0 };
+	uint64_t m_iCapturedFrameCount{ 0 };
+	bool m_bDetectDirtyRegion{ false };
+	int m_iDirtyTileSize{ 64 };
+	int m_iDirtyWidth{ 0 };
+	int m_iDirtyHeight{ 0 };
+	MFDirtyRegionDetector m_DirtyRegion;
+	std::vector<MonitorRect> m_vecDirtyRects;
 };
 
 
@@ -322,7 +546,17 @@ void MFMonitorCapture::stop()
 	impl_->stop();
 }
 
+void MFMonitorCapture::set_dirty_region_detection(bool enable, int tile_size)
+{
+	impl_->set_dirty_region_detection(enable, tile_size);
+}
+
 bool MFMonitorCapture::capture( OutputMonitorData& output_data)
 {
 	return impl_->capture(output_data);
+}
+
+bool MFMonitorCapture::capture(VideoFrame*& frame)
+{
+	return impl_->capture(frame);
 }
\ No newline at end of file
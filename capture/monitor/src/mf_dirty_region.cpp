@@ -0,0 +1,128 @@
+#include "mf_dirty_region.h"
+#include "mf_frame_hash.h"
+#include <algorithm>
+
+// past this many rectangles the list costs consumers more than it saves, the bounding box is reported instead
+#define MAX_DIRTY_RECTS 256
+
+MFDirtyRegionDetector::MFDirtyRegionDetector()
+{
+}
+
+MFDirtyRegionDetector::~MFDirtyRegionDetector()
+{
+}
+
+bool MFDirtyRegionDetector::configure(int width, int height, int tile_size)
+{
+	if (width <= 0 || height <= 0 || tile_size < 8)
+	{
+		return false;
+	}
+	m_iWidth = width;
+	m_iHeight = height;
+	m_iTileSize = tile_size;
+	m_iTilesX = (width + tile_size - 1) / tile_size;
+	m_iTilesY = (height + tile_size - 1) / tile_size;
+	m_vecHashes.assign((size_t)m_iTilesX * m_iTilesY, 0);
+	m_vecPrevHashes.assign(m_vecHashes.size(), 0);
+	m_vecDirty.assign(m_vecHashes.size(), 0);
+	m_bValid = false;
+	return true;
+}
+
+void MFDirtyRegionDetector::reset()
+{
+	m_bValid = false;
+}
+
+int MFDirtyRegionDetector::get_tile_size()
+{
+	return m_iTileSize;
+}
+
+bool MFDirtyRegionDetector::detect(const uint8_t* data, int stride, std::vector<MonitorRect>& rects)
+{
+	rects.clear();
+	if (!data || m_vecHashes.empty())
+	{
+		return false;
+	}
+	mf_hash_bgra_tiles(data, stride, m_iWidth, m_iHeight, m_iTileSize, m_vecHashes.data());
+	bool changed = false;
+	for (size_t i = 0; i < m_vecHashes.size(); i++)
+	{
+		m_vecDirty[i] = !m_bValid || m_vecHashes[i] != m_vecPrevHashes[i];
+		changed |= m_vecDirty[i] != 0;
+	}
+	m_vecHashes.swap(m_vecPrevHashes);
+	m_bValid = true;
+	if (changed)
+	{
+		merge_tiles(rects);
+	}
+	return changed;
+}
+
+void MFDirtyRegionDetector::merge_tiles(std::vector<MonitorRect>& rects)
+{
+	// horizontal runs of dirty tiles, a run extends the rectangle above when it spans the same columns. runs of a row
+	// are disjoint and found left to right, so the open rectangles of the row above are matched in one sweep
+	m_vecOpenRects.clear();
+	for (int ty = 0; ty < m_iTilesY; ty++)
+	{
+		m_vecNextOpenRects.clear();
+		size_t open = 0;
+		const uint8_t* dirty = m_vecDirty.data() + (size_t)ty * m_iTilesX;
+		int tx = 0;
+		while (tx < m_iTilesX)
+		{
+			if (!dirty[tx])
+			{
+				tx++;
+				continue;
+			}
+			int run_begin = tx;
+			while (tx < m_iTilesX && dirty[tx])
+			{
+				tx++;
+			}
+			while (open < m_vecOpenRects.size() && rects[m_vecOpenRects[open]].left < run_begin)
+			{
+				open++;
+			}
+			if (open < m_vecOpenRects.size() && rects[m_vecOpenRects[open]].left == run_begin && rects[m_vecOpenRects[open]].right == tx)
+			{
+				rects[m_vecOpenRects[open]].bottom = ty + 1;
+				m_vecNextOpenRects.push_back(m_vecOpenRects[open]);
+				open++;
+			}
+			else
+			{
+				m_vecNextOpenRects.push_back(rects.size());
+				rects.push_back({ run_begin, ty, tx, ty + 1 });
+			}
+		}
+		m_vecOpenRects.swap(m_vecNextOpenRects);
+	}
+
+	if (rects.size() > MAX_DIRTY_RECTS)
+	{
+		MonitorRect bounds = rects[0];
+		for (const auto& rect : rects)
+		{
+			bounds.left = std::min(bounds.left, rect.left);
+			bounds.top = std::min(bounds.top, rect.top);
+			bounds.right = std::max(bounds.right, rect.right);
+			bounds.bottom = std::max(bounds.bottom, rect.bottom);
+		}
+		rects.assign(1, bounds);
+	}
+	for (auto& rect : rects)
+	{
+		rect.left *= m_iTileSize;
+		rect.top *= m_iTileSize;
+		rect.right = std::min(rect.right * m_iTileSize, m_iWidth);
+		rect.bottom = std::min(rect.bottom * m_iTileSize, m_iHeight);
+	}
+}
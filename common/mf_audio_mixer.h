@@ -0,0 +1,51 @@
+#ifndef MF_AUDIO_MIXER_H
+#define MF_AUDIO_MIXER_H
+
+#include "mf_common.h"
+#include "mf_pcm_format.h"
+
+#define MF_MAX_MIX_SOURCES 8
+#define MF_MAX_MIX_CHANNELS 32
+
+struct MixSourceStats
+{
+	int64_t padded; // samples of silence inserted for timestamp gaps, in output samples
+	int64_t dropped; // samples discarded because they overlapped, came too late or did not fit
+};
+
+// Mixes several capture streams, e.g. microphone and speaker loopback, into one. Every source is converted to
+// float, remapped to the output layout, resampled to the output rate and placed on a common timeline by its
+// timestamps. mix() hands out what every source has covered, a source that falls more than the max latency behind
+// the leading one is filled with silence, so a loopback device that stops delivering while nothing plays does not
+// stall the microphone. All buffers are sized when sources are added, push and mix do not allocate.
+class MF_EXPORT MFAudioMixer final
+{
+public:
+	MFAudioMixer();
+	~MFAudioMixer();
+
+	bool configure(int sample_rate, int channels, PCM_FORMAT format, uint32_t channel_mask = 0); // mask 0 takes the default layout of the channel count
+	void set_max_latency(int ms); // if not set, default is 100. applies to sources added afterwards
+	void reset(); // drops the buffered audio of every source and restarts the timeline, sources stay
+
+	// returns the source id, -1 on failure. a source with fewer channels is spread over the output layout, one
+	// with more is downmixed, e.g. 5.1 to stereo folds center and surrounds into the fronts and drops the LFE
+	int add_source(int sample_rate, int channels, PCM_FORMAT format, uint32_t channel_mask = 0);
+	void remove_source(int source);
+	void set_gain(int source, float gain); // if not set, default is 1.0. linear
+
+	// timestamp is the time of the first sample in 100ns units, -1 continues from the previous push. call mix
+	// after every push, a source more than twice the max latency ahead of the output drops what does not fit
+	bool push(int source, const uint8_t* const* data, int samples, int64_t timestamp);
+	// returns the samples written, at most max_samples, and the time of the first one
+	int mix(uint8_t* const* output, int max_samples, int64_t& timestamp);
+
+	int64_t get_latency(); // longest a sample can wait between push and mix, in 100ns units
+	bool get_stats(int source, MixSourceStats& stats);
+
+private:
+	class Impl;
+	Impl* impl_;
+};
+
+#endif
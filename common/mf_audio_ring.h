@@ -0,0 +1,69 @@
+#ifndef MF_AUDIO_RING_H
+#define MF_AUDIO_RING_H
+
+#include "mf_common.h"
+#include <atomic>
+
+#define MF_AUDIO_RING_ANCHORS 64
+
+struct AudioRingStats
+{
+	int64_t written; // samples accepted by write
+	int64_t read; // samples handed out by read
+	int64_t overrun_samples; // samples write dropped because the ring was full
+	int64_t underruns; // read calls that found less than a block
+};
+
+// Single producer single consumer ring of interleaved audio frames with timestamps, lock free on both sides: the
+// capture thread writes whatever packet size the device delivers, the consumer reads fixed blocks. Timestamps are
+// kept as anchors where the producer's timestamps stop following the sample count, the timestamp of any block is
+// extrapolated from the last anchor before it. A full ring drops the new samples, the consumer side never blocks
+// the producer.
+class MF_EXPORT MFAudioRing final
+{
+public:
+	MFAudioRing();
+	~MFAudioRing();
+
+	// capacity is rounded up to a power of two. not thread safe, call before the producer and consumer start
+	bool configure(int capacity_samples, int frame_bytes, int sample_rate);
+	void reset(); // same, only while neither side runs
+
+	// producer. data null writes silence. timestamp in 100ns units, -1 continues. returns the samples accepted
+	int write(const uint8_t* data, int samples, int64_t timestamp);
+
+	// consumer. copies exactly samples or nothing, returns false and counts an underrun when fewer are available
+	bool read(uint8_t* data, int samples, int64_t& timestamp);
+	int get_available();
+
+	void get_stats(AudioRingStats& stats); // either side
+
+private:
+	struct Anchor
+	{
+		uint64_t position;
+		int64_t timestamp;
+	};
+
+	uint8_t* m_pBuffer{ nullptr };
+	uint64_t m_iCapacity{ 0 }; // samples, power of two
+	int m_iFrameBytes{ 0 };
+	int m_iSampleRate{ 0 };
+	Anchor m_Anchors[MF_AUDIO_RING_ANCHORS];
+
+	// producer side
+	alignas(MF_CACHE_LINE) std::atomic<uint64_t> m_iWritePosition{ 0 };
+	std::atomic<uint64_t> m_iAnchorsWritten{ 0 };
+	std::atomic<int64_t> m_iOverrunSamples{ 0 };
+	uint64_t m_iCachedReadPosition{ 0 };
+	Anchor m_ProducerAnchor{ 0, -1 }; // newest anchor, the next timestamp is checked against it
+	bool m_bAnchorPending{ false }; // not published yet, no sample at its position was accepted or no slot was free
+
+	// consumer side
+	alignas(MF_CACHE_LINE) std::atomic<uint64_t> m_iReadPosition{ 0 };
+	std::atomic<uint64_t> m_iAnchorsRead{ 0 };
+	std::atomic<int64_t> m_iUnderruns{ 0 };
+	Anchor m_CurrentAnchor{ 0, -1 };
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef MF_COMMON_H
+#define MF_COMMON_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#define MF_EXPORT __declspec(dllexport)
+#else
+#define MF_EXPORT
+#endif
+
+#ifndef XALIGN
+#define XALIGN(x, a) (((x) + (a)-1) & ~((a)-1))
+#endif
+
+#define MF_CACHE_LINE 64
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+#define MF_ARCH_X86
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define MF_ARCH_ARM64
+#endif
+
+// MSVC accepts intrinsics in any function, gcc and clang need the target enabled per function
+#if defined(MF_ARCH_X86) && !defined(_MSC_VER)
+#define MF_TARGET_SSE2 __attribute__((target("sse2")))
+#define MF_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define MF_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define MF_TARGET_SSE2
+#define MF_TARGET_SSE41
+#define MF_TARGET_AVX2
+#endif
+
+inline void* mf_aligned_malloc(size_t size, size_t alignment)
+{
+#ifdef _WIN32
+	return _aligned_malloc(size, alignment);
+#else
+	void* ptr = nullptr;
+	if (posix_memalign(&ptr, alignment, size) != 0)
+	{
+		return nullptr;
+	}
+	return ptr;
+#endif
+}
+
+inline void mf_aligned_free(void* ptr)
+{
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+#endif
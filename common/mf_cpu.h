@@ -0,0 +1,94 @@
+#ifndef MF_CPU_H
+#define MF_CPU_H
+
+#include "mf_common.h"
+
+#if defined(MF_ARCH_X86)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+enum CPU_FEATURE
+{
+	CPU_FEATURE_SSE2 = 0x1,
+	CPU_FEATURE_SSE41 = 0x2,
+	CPU_FEATURE_SSE42 = 0x4,
+	CPU_FEATURE_AVX2 = 0x8,
+	CPU_FEATURE_NEON = 0x10
+};
+
+// features are probed once, MF_DISABLE_SIMD forces the scalar paths
+inline int mf_detect_cpu_features()
+{
+	int features = 0;
+#if defined(MF_DISABLE_SIMD)
+	return features;
+#elif defined(MF_ARCH_X86)
+	int regs[4] = { 0 };
+#ifdef _MSC_VER
+	__cpuid(regs, 0);
+	int max_leaf = regs[0];
+	__cpuid(regs, 1);
+#else
+	unsigned int a = 0, b = 0, c = 0, d = 0;
+	__get_cpuid(0, &a, &b, &c, &d);
+	int max_leaf = (int)a;
+	__get_cpuid(1, &a, &b, &c, &d);
+	regs[0] = (int)a; regs[1] = (int)b; regs[2] = (int)c; regs[3] = (int)d;
+#endif
+	if (regs[3] & (1 << 26))
+	{
+		features |= CPU_FEATURE_SSE2;
+	}
+	if (regs[2] & (1 << 19))
+	{
+		features |= CPU_FEATURE_SSE41;
+	}
+	if (regs[2] & (1 << 20))
+	{
+		features |= CPU_FEATURE_SSE42;
+	}
+	bool os_avx = (regs[2] & (1 << 27)) && (regs[2] & (1 << 28));
+	if (os_avx && max_leaf >= 7)
+	{
+#ifdef _MSC_VER
+		bool ymm_enabled = (_xgetbv(0) & 0x6) == 0x6;
+		__cpuidex(regs, 7, 0);
+#else
+		unsigned int xcr0_lo = 0, xcr0_hi = 0;
+		__asm__ volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+		bool ymm_enabled = (xcr0_lo & 0x6) == 0x6;
+		__cpuid_count(7, 0, a, b, c, d);
+		regs[1] = (int)b;
+#endif
+		if (ymm_enabled && (regs[1] & (1 << 5)))
+		{
+			features |= CPU_FEATURE_AVX2;
+		}
+	}
+	return features;
+#elif defined(MF_ARCH_ARM64)
+	return CPU_FEATURE_NEON;
+#else
+	return features;
+#endif
+}
+
+// features the kernels may use, tests clear bits to run the scalar paths against the SIMD ones. it applies to
+// dispatch that happens after the change, e.g. a converter constructed later
+inline int& mf_cpu_feature_mask()
+{
+	static int s_iFeatureMask = ~0;
+	return s_iFeatureMask;
+}
+
+inline bool mf_cpu_has(CPU_FEATURE feature)
+{
+	static const int features = mf_detect_cpu_features();
+	return (features & mf_cpu_feature_mask() & feature) != 0;
+}
+
+#endif
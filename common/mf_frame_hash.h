@@ -0,0 +1,14 @@
+#ifndef MF_FRAME_HASH_H
+#define MF_FRAME_HASH_H
+
+#include "mf_common.h"
+
+// 64 bit hash of row_bytes x rows bytes, rows are stride bytes apart and run bottom-up for a negative stride. The
+// value does not depend on the instruction set, so hashes computed on different machines or with MF_DISABLE_SIMD can
+// be compared.
+uint64_t mf_hash_plane(const uint8_t* data, int stride, int row_bytes, int rows);
+
+// hash of every tile_size x tile_size tile of a BGRA frame in row-major order, edge tiles are clipped to the frame
+void mf_hash_bgra_tiles(const uint8_t* data, int stride, int width, int height, int tile_size, uint64_t* hashes);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef MF_FRAME_POOL_H
+#define MF_FRAME_POOL_H
+
+#include "mf_video_frame.h"
+#include <mutex>
+#include <vector>
+
+struct FramePoolBlock;
+
+struct FramePoolStats
+{
+	uint64_t allocated_bytes; // blocks held, in use or idle
+	uint64_t in_use_bytes; // blocks behind frames that are still referenced
+	uint64_t peak_bytes; // highest allocated_bytes so far
+	uint64_t budget_bytes; // 0 is unlimited
+	int64_t hits; // acquires served by an idle block
+	int64_t misses; // acquires that had to allocate
+	int64_t trimmed; // idle blocks freed, by trim() or to stay within a budget
+	int64_t failures; // acquires refused by a budget or the allocator
+	int64_t large_page_blocks; // blocks held that are backed by large pages
+};
+
+// Pool of frame buffers keyed by format, size and layout. A frame goes back to the pool when its last reference is
+// dropped, on any thread, and the next acquire of the same shape reuses the block, so capture and encoding in steady
+// state never reach the general allocator. Blocks start on a cache line, blocks of at least one large page are
+// backed by large pages when enabled and the system grants them. Memory is bounded by the pool budget and by the budget
+// shared by all pools: a block that does not fit first frees idle blocks, least recently used first, then the
+// acquire fails. Blocks idle for more than two seconds, e.g. of a size before a resize, are freed as well.
+// Frames must be released before the pool is destroyed.
+class MF_EXPORT MFFramePool final : public MFVideoFrameOwner
+{
+public:
+	MFFramePool();
+	~MFFramePool();
+
+	// if not set, default is 0 (unlimited). shrinking it frees idle blocks until the pool fits
+	void set_budget(uint64_t bytes);
+	// if not set, default is false. applies to blocks allocated from then on, needs SeLockMemoryPrivilege on Windows
+	void set_large_pages(bool enable);
+
+	// frame with one reference, nullptr when a budget or the allocator refuses. packed lays the planes out without
+	// padding as one Media Foundation memory buffer expects them, otherwise every row starts on a cache line
+	VideoFrame* acquire(PIXEL_FORMAT format, int width, int height, bool packed);
+	void trim(); // frees every idle block
+	void get_stats(FramePoolStats& stats);
+
+	void release_frame(VideoFrame* frame) override;
+
+	// budget shared by every pool in the process, if not set, default is 0 (unlimited)
+	static void set_global_budget(uint64_t bytes);
+	// byte counts and counters summed over the live pools, peak_bytes of all of them together
+	static void get_global_stats(FramePoolStats& stats);
+
+private:
+	FramePoolBlock* take_idle(PIXEL_FORMAT format, int width, int height, int stride);
+	FramePoolBlock* allocate_block(size_t size);
+	bool reserve(uint64_t bytes); // accounts bytes against both budgets, trimming idle blocks to make room
+	void unreserve(uint64_t bytes);
+	bool trim_oldest(); // frees the least recently used idle block, false when none is idle
+	void trim_expired(int64_t now);
+	void free_block(FramePoolBlock* block);
+	int64_t get_oldest_idle(); // last use of the least recently used idle block, INT64_MAX when none is idle
+
+	static bool trim_global(uint64_t bytes); // frees idle blocks of any pool until bytes more fit the global budget
+
+	std::mutex m_mtLock;
+	std::vector<FramePoolBlock*> m_vecIdleBlocks;
+	uint64_t m_iBudget{ 0 };
+	bool m_bLargePages{ false };
+	FramePoolStats m_Stats{ 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+};
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef MF_LZ4_H
+#define MF_LZ4_H
+
+#include "mf_common.h"
+
+// LZ4 block format (no frame header), interoperable with LZ4_compress_default / LZ4_decompress_safe
+
+#define MF_LZ4_HASH_ENTRIES 4096
+
+inline int mf_lz4_compress_bound(int size)
+{
+	return size + size / 255 + 16;
+}
+
+// returns the compressed size, 0 when dst is too small. hash_table holds MF_LZ4_HASH_ENTRIES entries and is
+// only scratch, so one table can be reused by every call on the same thread
+int mf_lz4_compress(const uint8_t* src, int src_size, uint8_t* dst, int dst_capacity, uint32_t* hash_table);
+
+// returns the decompressed size, -1 on malformed input or when dst is too small
+int mf_lz4_decompress(const uint8_t* src, int src_size, uint8_t* dst, int dst_capacity);
+
+#endif
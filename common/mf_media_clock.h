@@ -0,0 +1,65 @@
+#ifndef MF_MEDIA_CLOCK_H
+#define MF_MEDIA_CLOCK_H
+
+#include "mf_common.h"
+
+#define MF_DRIFT_WINDOW 512
+#define MF_DRIFT_SEGMENTS 16
+
+// Now in 100ns units of the monotonic clock every capture timestamp is on. On Windows it is QueryPerformanceCounter,
+// the clock WASAPI QPC positions and Windows.Graphics.Capture SystemRelativeTime already use, elsewhere
+// CLOCK_MONOTONIC. The origin is arbitrary, only differences mean something.
+MF_EXPORT int64_t mf_clock_now();
+
+// Session time base for a recording. Capture timestamps are converted relative to the origin, so the first frame
+// of every source lands near zero and audio and video stay in sync without re-timing afterwards.
+class MF_EXPORT MFMediaClock final
+{
+public:
+	MFMediaClock();
+	~MFMediaClock();
+
+	void start(); // origin is now
+	void start(int64_t origin); // origin on the mf_clock_now timeline
+	int64_t get_origin();
+	int64_t now(); // since the origin, in 100ns units
+
+	// capture timestamp to time_base units since the origin, for InputVMemoryData / InputAMemoryData timestamps.
+	// false for captures from before the origin, they have no place on the timeline and are to be dropped. clamping
+	// them to 0 would stamp several frames alike
+	bool to_time_base(int64_t capture_time, int64_t time_base, int64_t& timestamp);
+
+private:
+	int64_t m_iOrigin{ 0 };
+};
+
+// Maps a device clock, e.g. camera sample times, onto the mf_clock_now timeline. Every sample pairs the device time
+// with its arrival time. Delivery jitter only ever adds delay, so the earliest arrivals are the closest to the
+// capture instants: the rate is a least squares fit through the earliest arrival of each of MF_DRIFT_SEGMENTS
+// slices of the last MF_DRIFT_WINDOW pairs, the offset puts the line on the earliest arrival of all.
+class MF_EXPORT MFClockDriftEstimator final
+{
+public:
+	MFClockDriftEstimator();
+	~MFClockDriftEstimator();
+
+	void reset();
+	void add(int64_t device_time, int64_t clock_time);
+	int64_t map(int64_t device_time); // device_time unchanged plus the offset until two samples are in
+	double get_ratio(); // clock ticks per device tick, 1.0 until two samples are in
+	int get_count();
+
+private:
+	void fit();
+
+	int64_t m_iDevice[MF_DRIFT_WINDOW];
+	int64_t m_iClock[MF_DRIFT_WINDOW];
+	int m_iCount{ 0 };
+	int m_iNext{ 0 };
+	int64_t m_iDeviceBase{ 0 }; // fit is relative to the oldest pair in the window, keeps the doubles exact
+	int64_t m_iClockBase{ 0 };
+	double m_dRatio{ 1.0 };
+	double m_dOffset{ 0.0 };
+};
+
+#endif
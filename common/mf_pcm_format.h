@@ -0,0 +1,109 @@
+#ifndef MF_PCM_FORMAT_H
+#define MF_PCM_FORMAT_H
+
+#include <stdint.h>
+
+enum PCM_FORMAT
+{
+    PCM_UNKNOWN = -1,
+    PCM_U8 = 0,
+    PCM_S16,
+    PCM_S32,
+    PCM_FLT,
+    PCM_DBL,
+    PCM_U8P,
+    PCM_S16P,
+    PCM_S32P,
+    PCM_FLTP,
+    PCM_DBLP,
+    PCM_S64,
+    PCM_S64P,
+    PCM_S24, // 3 bytes per sample, little endian
+    PCM_S24P
+};
+
+// speaker positions, the same bits as the WAVEFORMATEXTENSIBLE dwChannelMask. channels are stored in bit order
+#define MF_CHANNEL_FRONT_LEFT 0x1
+#define MF_CHANNEL_FRONT_RIGHT 0x2
+#define MF_CHANNEL_FRONT_CENTER 0x4
+#define MF_CHANNEL_LOW_FREQUENCY 0x8
+#define MF_CHANNEL_BACK_LEFT 0x10
+#define MF_CHANNEL_BACK_RIGHT 0x20
+#define MF_CHANNEL_FRONT_LEFT_OF_CENTER 0x40
+#define MF_CHANNEL_FRONT_RIGHT_OF_CENTER 0x80
+#define MF_CHANNEL_BACK_CENTER 0x100
+#define MF_CHANNEL_SIDE_LEFT 0x200
+#define MF_CHANNEL_SIDE_RIGHT 0x400
+
+// the layout Windows assumes for a channel count without a mask
+inline uint32_t mf_default_channel_mask(int channels)
+{
+	switch (channels)
+	{
+	case 1:
+		return MF_CHANNEL_FRONT_CENTER;
+	case 2:
+		return 0x3;
+	case 3:
+		return 0x7;
+	case 4:
+		return 0x33; // quad
+	case 5:
+		return 0x37;
+	case 6:
+		return 0x3F; // 5.1
+	case 7:
+		return 0x13F;
+	case 8:
+		return 0x63F; // 7.1 surround
+	default:
+		return channels > 0 && channels < 32 ? (1u << channels) - 1 : 0;
+	}
+}
+
+inline bool mf_pcm_is_planar(PCM_FORMAT format)
+{
+	switch (format)
+	{
+	case PCM_U8P:
+	case PCM_S16P:
+	case PCM_S24P:
+	case PCM_S32P:
+	case PCM_S64P:
+	case PCM_FLTP:
+	case PCM_DBLP:
+		return true;
+	default:
+		return false;
+	}
+}
+
+inline int mf_pcm_bytes_per_sample(PCM_FORMAT format)
+{
+	switch (format)
+	{
+	case PCM_U8:
+	case PCM_U8P:
+		return 1;
+	case PCM_S16:
+	case PCM_S16P:
+		return 2;
+	case PCM_S24:
+	case PCM_S24P:
+		return 3;
+	case PCM_S32:
+	case PCM_S32P:
+	case PCM_FLT:
+	case PCM_FLTP:
+		return 4;
+	case PCM_S64:
+	case PCM_S64P:
+	case PCM_DBL:
+	case PCM_DBLP:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef MF_PIXEL_CONVERT_H
+#define MF_PIXEL_CONVERT_H
+
+#include "mf_common.h"
+#include "mf_pixel_format.h"
+
+// planes of an image as the converters address them, Y U V whatever their order in memory as in VideoFrame
+struct PlaneView
+{
+	uint8_t* data[MF_MAX_PLANES];
+	int stride[MF_MAX_PLANES];
+};
+
+// converts rows of width pixels from one layout to another, src and dst address the same first row
+typedef void (*PixelConvertFunc)(const PlaneView& src, const PlaneView& dst, int width, int rows);
+
+// kernel of the conversion table, nullptr when the pair is not supported. the table covers every pair of PIXEL_FORMAT,
+// which the camera formats, monitor BGRA and the encoder formats all map onto. YV12 shares the I420 kernels, its
+// planes are addressed Y U V like all others
+MF_EXPORT PixelConvertFunc mf_pixel_convert_func(PIXEL_FORMAT src_format, PIXEL_FORMAT dst_format);
+
+// planes at row of an image whose planes address row 0, row is even for the 4:2:0 formats
+MF_EXPORT PlaneView mf_pixel_plane_rows_at(const PlaneView& planes, PIXEL_FORMAT format, int row);
+
+// One format pair resolved to its kernel when a stream starts or its input format changes, frames then go straight
+// to the kernel instead of through a chain of format checks.
+class MF_EXPORT MFPixelConverter final
+{
+public:
+	MFPixelConverter();
+	~MFPixelConverter();
+
+	bool configure(PIXEL_FORMAT src_format, PIXEL_FORMAT dst_format); // false when the pair is not supported
+	bool is_configured(PIXEL_FORMAT src_format, PIXEL_FORMAT dst_format);
+
+	// converts rows [row_begin, row_end) between images of the same size whose planes address row 0. row_begin is even,
+	// so 4:2:0 chroma rows never straddle two stripes converted on different threads
+	void convert(const PlaneView& src, const PlaneView& dst, int width, int row_begin, int row_end);
+
+private:
+	PIXEL_FORMAT m_eSrcFormat{ PIXEL_NONE };
+	PIXEL_FORMAT m_eDstFormat{ PIXEL_NONE };
+	PixelConvertFunc m_pConvert{ nullptr };
+};
+
+#endif
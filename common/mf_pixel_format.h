@@ -0,0 +1,87 @@
+#ifndef MF_PIXEL_FORMAT_H
+#define MF_PIXEL_FORMAT_H
+
+#include <stdint.h>
+
+#define MF_MAX_PLANES 3
+
+// memory layouts of video frames shared by capture and encoding, named by byte order in memory
+enum PIXEL_FORMAT
+{
+	PIXEL_NONE = 0,
+	PIXEL_I420, // Y, U, V planes, chroma subsampled by two both ways
+	PIXEL_YV12, // like I420 with V stored before U
+	PIXEL_NV12, // Y plane, interleaved UV plane
+	PIXEL_YUY2, // Y0 U Y1 V
+	PIXEL_UYVY, // U Y0 V Y1
+	PIXEL_BGRA, // B G R A, MFVideoFormat_RGB32 and DXGI_FORMAT_B8G8R8A8_UNORM
+	PIXEL_RGB24, // B G R, MFVideoFormat_RGB24
+	PIXEL_FORMAT_MAX
+};
+
+inline int mf_pixel_plane_count(PIXEL_FORMAT format)
+{
+	switch (format)
+	{
+	case PIXEL_I420:
+	case PIXEL_YV12:
+		return 3;
+	case PIXEL_NV12:
+		return 2;
+	case PIXEL_YUY2:
+	case PIXEL_UYVY:
+	case PIXEL_BGRA:
+	case PIXEL_RGB24:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// bytes per pixel of the first plane
+inline int mf_pixel_bytes_per_pixel(PIXEL_FORMAT format)
+{
+	switch (format)
+	{
+	case PIXEL_I420:
+	case PIXEL_YV12:
+	case PIXEL_NV12:
+		return 1;
+	case PIXEL_YUY2:
+	case PIXEL_UYVY:
+		return 2;
+	case PIXEL_RGB24:
+		return 3;
+	case PIXEL_BGRA:
+		return 4;
+	default:
+		return 0;
+	}
+}
+
+// rows of a plane, chroma planes of the 4:2:0 formats have half the rows rounded up, 0 for a plane the format lacks
+inline int mf_pixel_plane_rows(PIXEL_FORMAT format, int plane, int height)
+{
+	if (plane < 0 || plane >= mf_pixel_plane_count(format))
+	{
+		return 0;
+	}
+	return plane > 0 ? (height + 1) / 2 : height;
+}
+
+// bytes of a tightly packed frame, the planes following each other as Media Foundation lays them out
+inline int mf_pixel_frame_size(PIXEL_FORMAT format, int width, int height)
+{
+	int luma = width * height * mf_pixel_bytes_per_pixel(format);
+	int chroma = ((width + 1) / 2) * ((height + 1) / 2);
+	switch (mf_pixel_plane_count(format))
+	{
+	case 3:
+	case 2:
+		return luma + chroma * 2;
+	default:
+		return luma;
+	}
+}
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef MF_READBACK_RING_H
+#define MF_READBACK_RING_H
+
+#include "mf_common.h"
+
+#define MF_READBACK_MAX_SLOTS 8
+
+struct ReadbackStats
+{
+	int64_t copies; // frames handed a slot by begin_copy
+	int64_t reads; // slots leased by begin_read
+	int64_t dropped; // copies overwritten before they were read
+};
+
+// Slot bookkeeping for pipelined GPU readback through a ring of staging buffers. A new frame is copied into a free
+// slot and only read once depth newer copies are queued behind it, so the copy has had a frame interval to finish
+// and mapping it does not stall. The read slot stays leased to the caller until it is released, the rows are handed
+// out without another copy. Only indices and timestamps live here, the owner keeps the buffers, which keeps the
+// policy independent of the graphics API. Not thread safe, the capture thread drives it.
+class MF_EXPORT MFReadbackRing final
+{
+public:
+	MFReadbackRing();
+	~MFReadbackRing();
+
+	// slots 3 to MF_READBACK_MAX_SLOTS, depth 1 to slots - 2: one slot stays leased while depth + 1 copies queue up.
+	// depth 1 copies frame k while frame k - 1 is read
+	bool configure(int slots, int depth);
+	void reset(); // every slot free, the owner releases its leases first
+
+	// slot to copy a new frame into. with none free the oldest unread copy is dropped, -1 only when every slot is leased
+	int begin_copy(int64_t timestamp);
+	// oldest copy once more than depth are queued, or any copy with drain. -1 when there is nothing to read
+	int begin_read(bool drain, int64_t& timestamp);
+	void end_read(int slot); // lease released, the slot is free again
+
+	int get_slot_count();
+	int get_pending(); // copies not read yet
+	void get_stats(ReadbackStats& stats);
+
+private:
+	enum SLOT_STATE
+	{
+		SLOT_FREE = 0,
+		SLOT_COPIED,
+		SLOT_LEASED,
+	};
+
+	int oldest_copied();
+
+	int m_iSlots{ 0 };
+	int m_iDepth{ 1 };
+	SLOT_STATE m_eState[MF_READBACK_MAX_SLOTS];
+	int64_t m_iTimestamp[MF_READBACK_MAX_SLOTS];
+	uint64_t m_iSequence[MF_READBACK_MAX_SLOTS]; // copy order, the oldest copy is read first
+	uint64_t m_iNextSequence{ 0 };
+	int m_iPending{ 0 };
+	ReadbackStats m_Stats{ 0, 0, 0 };
+};
+
+#endif
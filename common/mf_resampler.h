@@ -0,0 +1,64 @@
+#ifndef MF_RESAMPLER_H
+#define MF_RESAMPLER_H
+
+#include "mf_common.h"
+#include <vector>
+
+enum RESAMPLE_QUALITY
+{
+	RESAMPLE_QUALITY_LOW = 0, // 16 taps, about 60 dB stopband, rolls off above 0.3 of the lower rate, for monitoring
+	RESAMPLE_QUALITY_MEDIUM, // 64 taps, about 85 dB, flat to 0.41 of the lower rate
+	RESAMPLE_QUALITY_HIGH // 128 taps, about 110 dB, flat to 0.44 of the lower rate
+};
+
+// Polyphase windowed sinc resampler for interleaved float audio. Output sample n sits at input position
+// n * in_rate / out_rate, so timestamps map straight through. The filter has to see taps / 2 input samples past
+// a position before it can produce it, that lookahead is the only latency. Positions advance with an exact
+// rational step, set_drift scales it for clock drift correction without restarting the stream.
+class MF_EXPORT MFResampler final
+{
+public:
+	MFResampler();
+	~MFResampler();
+
+	bool configure(int in_rate, int out_rate, int channels, RESAMPLE_QUALITY quality);
+	void set_drift(double ratio); // if not set, default is 1.0. > 1.0 consumes input faster, 0.9 - 1.1, applies from the next output sample
+	void reset(); // drops the buffered input, the next input starts at position 0
+
+	// consumes all input and returns the output samples written, at most out_capacity. whatever does not fit
+	// stays buffered for the next call. get_max_output tells the capacity that always fits
+	int process(const float* input, int in_samples, float* output, int out_capacity);
+	int flush(float* output, int out_capacity); // pads with silence until every input sample has been covered
+	int get_max_output(int in_samples);
+
+	int get_latency(); // input samples the filter looks ahead
+	double get_output_offset(); // input samples from the end of the input so far to the next output sample, negative while output is pending
+
+private:
+	void append_history(const float* input, int samples); // input null appends silence
+	void build_filter(RESAMPLE_QUALITY quality);
+	void compute_step();
+	int produce(float* output, int out_capacity, int64_t end_position);
+
+	int m_iInRate{ 0 };
+	int m_iOutRate{ 0 };
+	int m_iChannels{ 0 };
+	int m_iTaps{ 0 }; // multiple of 8
+	int m_iHalfTaps{ 0 };
+	int m_iPhaseBits{ 0 };
+	std::vector<float> m_vecFilter; // (1 << phase_bits) + 1 phases of m_iTaps coefficients
+	std::vector<float> m_vecCoeffs; // interpolated coefficients of the current output sample
+	std::vector<float> m_vecHistory; // one plane per channel, m_iHistoryCapacity samples each
+	int m_iHistoryCapacity{ 0 };
+	int m_iHistorySize{ 0 }; // samples per plane
+	int64_t m_iPosition{ 0 }; // integer input position of the next output, relative to the history start
+	uint64_t m_iFraction{ 0 }; // 32.32 fixed point fraction of the position in the low 32 bits
+	uint64_t m_iStep{ 0 }; // 32.32
+	uint64_t m_iStepRemainder{ 0 }; // exact rational remainder of the step, in 1 / m_iStepDenominator of a fraction unit
+	uint64_t m_iStepDenominator{ 1 };
+	uint64_t m_iRemainderAccumulator{ 0 };
+	double m_dDrift{ 1.0 };
+	int64_t m_iInputEnd{ 0 }; // real input samples appended since reset, relative to the history start
+};
+
+#endif
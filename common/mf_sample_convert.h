@@ -0,0 +1,51 @@
+#ifndef MF_SAMPLE_CONVERT_H
+#define MF_SAMPLE_CONVERT_H
+
+#include "mf_common.h"
+#include "mf_pcm_format.h"
+
+#define MF_MAX_CONVERT_CHANNELS 64
+#define MF_DITHER_LANES 8
+
+enum DITHER_MODE
+{
+	DITHER_NONE = 0, // rounds to nearest
+	DITHER_TPDF // triangular noise of +-1 LSB before rounding, decorrelates the quantization error from the signal
+};
+
+// Converts between any two PCM_FORMATs: sample type and interleaved / planar layout at once. Samples go through a
+// float pivot in blocks that stay in L1, or a double pivot when both ends are wider than a float mantissa, e.g. S32
+// to DBL, so no precision is lost that either end could hold. Integer output saturates. The per type kernels are
+// picked from SSE2 / AVX2 / NEON per block, so mf_cpu_feature_mask() takes effect on the next convert().
+class MF_EXPORT MFSampleConverter final
+{
+public:
+	MFSampleConverter();
+	~MFSampleConverter();
+
+	bool configure(PCM_FORMAT in_format, PCM_FORMAT out_format, int channels);
+	void set_dither(DITHER_MODE mode); // if not set, default is DITHER_TPDF. only applies when the output has 16 bits or less and the input more
+
+	// interleaved buffers are passed as a single pointer, planar ones as one pointer per channel. samples per channel
+	bool convert(const uint8_t* const* in, uint8_t* const* out, int samples);
+
+private:
+	void convert_block(const uint8_t* const* in, uint8_t* const* out, int offset, int samples);
+
+	PCM_FORMAT m_eInFormat{ PCM_UNKNOWN };
+	PCM_FORMAT m_eOutFormat{ PCM_UNKNOWN };
+	int m_iChannels{ 0 };
+	int m_iInType{ 0 };
+	int m_iOutType{ 0 };
+	bool m_bInPlanar{ false };
+	bool m_bOutPlanar{ false };
+	bool m_bDoublePivot{ false };
+	bool m_bDither{ false };
+	DITHER_MODE m_eDitherMode{ DITHER_TPDF };
+	float m_fDitherScale{ 0.0f };
+	uint32_t m_iDitherState[MF_DITHER_LANES]{ 0x9E3779B9u, 0x7F4A7C15u, 0x85EBCA6Bu, 0xC2B2AE35u, 0x27D4EB2Fu, 0x165667B1u, 0xD3A2646Cu, 0xFD7046C5u };
+	int m_iBlockSamples{ 0 };
+	uint8_t* m_pPivot{ nullptr }; // two pivot blocks, the second one takes a layout change
+};
+
+#endif
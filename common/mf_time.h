@@ -0,0 +1,31 @@
+#ifndef MF_TIME_H
+#define MF_TIME_H
+
+#include <stdint.h>
+
+#define MF_HNS_PER_SECOND 10000000 // Media Foundation sample times are in 100ns units
+
+// value * num / den rounded to the nearest integer. The quotient and remainder are scaled separately, so the
+// result is exact as long as it fits in 64 bits and (den - 1) * num does.
+inline int64_t mf_rescale(int64_t value, int64_t num, int64_t den)
+{
+	if (den <= 0)
+	{
+		return 0;
+	}
+	if (value < 0)
+	{
+		return -mf_rescale(-value, num, den);
+	}
+	int64_t quotient = value / den;
+	int64_t remainder = value % den;
+	return quotient * num + (remainder * num + den / 2) / den;
+}
+
+// start time of frame index on the grid of a num/den frame rate, in time_base ticks per second
+inline int64_t mf_frame_time(int64_t index, int64_t time_base, int64_t fps_num, int64_t fps_den)
+{
+	return mf_rescale(index, time_base * fps_den, fps_num);
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef MF_VIDEO_FRAME_H
+#define MF_VIDEO_FRAME_H
+
+#include "mf_common.h"
+#include "mf_pixel_format.h"
+#include <atomic>
+
+struct VideoFrame;
+
+// Whatever the planes of a frame belong to: a capture's mapped texture or media buffer, a frame pool.
+class MFVideoFrameOwner
+{
+public:
+	virtual ~MFVideoFrameOwner() {}
+
+	// the last reference is gone, on whichever thread dropped it. the planes go back to the owner, the header is
+	// recycled after this returns
+	virtual void release_frame(VideoFrame* frame) = 0;
+};
+
+// One video frame as it moves from capture to encoding. Stages pass the pointer and take references instead of
+// copying the planes, the memory goes back to its owner once the last reference is dropped.
+struct VideoFrame
+{
+	PIXEL_FORMAT format;
+	int width;
+	int height;
+	uint8_t* data[MF_MAX_PLANES]; // Y U V for I420 and YV12 whatever their order in memory, Y UV for NV12, one plane for packed formats
+	int stride[MF_MAX_PLANES]; // bytes, negative for bottom-up images with data at the last row
+	int64_t timestamp; // capture time on the mf_clock_now timeline, in 100ns units. -1 is none
+	bool unchanged; // identical to the previous frame from the same source
+	MFVideoFrameOwner* owner; // null for frames from mf_video_frame_alloc, their planes are freed with the header
+	void* opaque; // owner data, e.g. the staging slot or media buffer behind the planes
+	std::atomic<int> ref_count; // 0 for a view from mf_video_frame_init, which nobody may keep
+};
+
+// fills frame as a view of a tightly laid out frame at base, planes following each other with stride for the
+// first plane and half of it for 4:2:0 chroma. a negative stride puts base at the last row of a bottom-up image
+MF_EXPORT void mf_video_frame_init(VideoFrame& frame, PIXEL_FORMAT format, int width, int height, uint8_t* base, int stride);
+
+// row pitch of the first plane with every row on a cache line, as mf_video_frame_alloc and MFFramePool lay frames out
+MF_EXPORT int mf_video_frame_aligned_stride(PIXEL_FORMAT format, int width);
+// bytes of a frame laid out as in mf_video_frame_init with stride for the first plane
+MF_EXPORT size_t mf_video_frame_size(PIXEL_FORMAT format, int height, int stride);
+
+// new frame with one reference and 64 byte aligned planes of its own, nullptr on failure
+MF_EXPORT VideoFrame* mf_video_frame_alloc(PIXEL_FORMAT format, int width, int height);
+// new frame with one reference over memory of owner, laid out as in mf_video_frame_init
+MF_EXPORT VideoFrame* mf_video_frame_wrap(PIXEL_FORMAT format, int width, int height, uint8_t* base, int stride, MFVideoFrameOwner* owner, void* opaque);
+
+MF_EXPORT VideoFrame* mf_video_frame_ref(VideoFrame* frame);
+MF_EXPORT void mf_video_frame_unref(VideoFrame* frame);
+
+// the planes follow each other without padding, as one Media Foundation memory buffer expects them
+MF_EXPORT bool mf_video_frame_is_contiguous(const VideoFrame& frame);
+
+#endif
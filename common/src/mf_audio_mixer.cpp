@@ -0,0 +1,716 @@
+#include "mf_audio_mixer.h"
+#include "mf_sample_convert.h"
+#include "mf_resampler.h"
+#include "mf_time.h"
+#include "mf_cpu.h"
+#include <string.h>
+#include <vector>
+#include <mutex>
+
+#if defined(MF_ARCH_X86)
+#include <immintrin.h>
+#elif defined(MF_ARCH_ARM64)
+#include <arm_neon.h>
+#endif
+
+#define MIX_BLOCK 1024 // samples per channel converted, remapped and mixed at a time
+#define MIX_RESYNC_MS 20 // timestamp jitter below this is ignored, above it the source is realigned
+#define MIX_MIN_LATENCY_MS 10
+#define MIX_MAX_LATENCY_MS 2000
+#define MIX_SQRT1_2 0.70710678f
+
+typedef void (*MixAddFunc)(float* dst, const float* src, float gain, int count);
+
+static void mix_add_c(float* dst, const float* src, float gain, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		dst[i] += src[i] * gain;
+	}
+}
+
+#if defined(MF_ARCH_X86)
+MF_TARGET_SSE2 static void mix_add_sse2(float* dst, const float* src, float gain, int count)
+{
+	const __m128 factor = _mm_set1_ps(gain);
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128 a = _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(src + i), factor));
+		__m128 b = _mm_add_ps(_mm_loadu_ps(dst + i + 4), _mm_mul_ps(_mm_loadu_ps(src + i + 4), factor));
+		_mm_storeu_ps(dst + i, a);
+		_mm_storeu_ps(dst + i + 4, b);
+	}
+	mix_add_c(dst + i, src + i, gain, count - i);
+}
+
+MF_TARGET_AVX2 static void mix_add_avx2(float* dst, const float* src, float gain, int count)
+{
+	const __m256 factor = _mm256_set1_ps(gain);
+	int i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256 a = _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_mul_ps(_mm256_loadu_ps(src + i), factor));
+		__m256 b = _mm256_add_ps(_mm256_loadu_ps(dst + i + 8), _mm256_mul_ps(_mm256_loadu_ps(src + i + 8), factor));
+		_mm256_storeu_ps(dst + i, a);
+		_mm256_storeu_ps(dst + i + 8, b);
+	}
+	mix_add_c(dst + i, src + i, gain, count - i);
+}
+#elif defined(MF_ARCH_ARM64)
+static void mix_add_neon(float* dst, const float* src, float gain, int count)
+{
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		vst1q_f32(dst + i, vmlaq_n_f32(vld1q_f32(dst + i), vld1q_f32(src + i), gain));
+		vst1q_f32(dst + i + 4, vmlaq_n_f32(vld1q_f32(dst + i + 4), vld1q_f32(src + i + 4), gain));
+	}
+	mix_add_c(dst + i, src + i, gain, count - i);
+}
+#endif
+
+static MixAddFunc select_mix_add()
+{
+#if defined(MF_ARCH_X86)
+	if (mf_cpu_has(CPU_FEATURE_AVX2))
+	{
+		return mix_add_avx2;
+	}
+	if (mf_cpu_has(CPU_FEATURE_SSE2))
+	{
+		return mix_add_sse2;
+	}
+#elif defined(MF_ARCH_ARM64)
+	if (mf_cpu_has(CPU_FEATURE_NEON))
+	{
+		return mix_add_neon;
+	}
+#endif
+	return mix_add_c;
+}
+
+// where a speaker goes when the output does not have it, the first route whose targets all exist wins
+struct ChannelRoute
+{
+	uint32_t speaker;
+	uint32_t targets[3][2];
+	float gains[3];
+};
+
+static const ChannelRoute s_ChannelRoutes[] = {
+	{ MF_CHANNEL_FRONT_LEFT, { { MF_CHANNEL_FRONT_CENTER, 0 } }, { MIX_SQRT1_2 } },
+	{ MF_CHANNEL_FRONT_RIGHT, { { MF_CHANNEL_FRONT_CENTER, 0 } }, { MIX_SQRT1_2 } },
+	{ MF_CHANNEL_FRONT_CENTER, { { MF_CHANNEL_FRONT_LEFT, MF_CHANNEL_FRONT_RIGHT } }, { MIX_SQRT1_2 } },
+	{ MF_CHANNEL_BACK_LEFT, { { MF_CHANNEL_SIDE_LEFT, 0 }, { MF_CHANNEL_FRONT_LEFT, 0 }, { MF_CHANNEL_FRONT_CENTER, 0 } }, { 1.0f, MIX_SQRT1_2, 0.5f } },
+	{ MF_CHANNEL_BACK_RIGHT, { { MF_CHANNEL_SIDE_RIGHT, 0 }, { MF_CHANNEL_FRONT_RIGHT, 0 }, { MF_CHANNEL_FRONT_CENTER, 0 } }, { 1.0f, MIX_SQRT1_2, 0.5f } },
+	{ MF_CHANNEL_FRONT_LEFT_OF_CENTER, { { MF_CHANNEL_FRONT_LEFT, 0 }, { MF_CHANNEL_FRONT_CENTER, 0 } }, { 1.0f, MIX_SQRT1_2 } },
+	{ MF_CHANNEL_FRONT_RIGHT_OF_CENTER, { { MF_CHANNEL_FRONT_RIGHT, 0 }, { MF_CHANNEL_FRONT_CENTER, 0 } }, { 1.0f, MIX_SQRT1_2 } },
+	{ MF_CHANNEL_BACK_CENTER, { { MF_CHANNEL_BACK_LEFT, MF_CHANNEL_BACK_RIGHT }, { MF_CHANNEL_SIDE_LEFT, MF_CHANNEL_SIDE_RIGHT }, { MF_CHANNEL_FRONT_LEFT, MF_CHANNEL_FRONT_RIGHT } }, { MIX_SQRT1_2, MIX_SQRT1_2, 0.5f } },
+	{ MF_CHANNEL_SIDE_LEFT, { { MF_CHANNEL_BACK_LEFT, 0 }, { MF_CHANNEL_FRONT_LEFT, 0 }, { MF_CHANNEL_FRONT_CENTER, 0 } }, { 1.0f, MIX_SQRT1_2, 0.5f } },
+	{ MF_CHANNEL_SIDE_RIGHT, { { MF_CHANNEL_BACK_RIGHT, 0 }, { MF_CHANNEL_FRONT_RIGHT, 0 }, { MF_CHANNEL_FRONT_CENTER, 0 } }, { 1.0f, MIX_SQRT1_2, 0.5f } }
+};
+
+// index of the channel carrying speaker in a mask, channels are stored in bit order
+static int channel_index(uint32_t mask, uint32_t speaker)
+{
+	if (!(mask & speaker))
+	{
+		return -1;
+	}
+	int index = 0;
+	for (uint32_t bit = 1; bit < speaker; bit <<= 1)
+	{
+		index += (mask & bit) ? 1 : 0;
+	}
+	return index;
+}
+
+static int count_channels(uint32_t mask)
+{
+	int count = 0;
+	for (; mask; mask &= mask - 1)
+	{
+		count++;
+	}
+	return count;
+}
+
+// out_channels x in_channels gains. speakers the output lacks fold into their neighbours, the LFE is dropped. rows
+// that would sum above 1 scale the whole matrix down, so a full scale downmix can not clip
+static void build_matrix(uint32_t in_mask, int in_channels, uint32_t out_mask, int out_channels, float* matrix)
+{
+	memset(matrix, 0, sizeof(float) * in_channels * out_channels);
+	if (in_channels == 1)
+	{
+		// a mono microphone goes to both fronts at full level rather than to a center at -3 dB on each side
+		bool fronts = (out_mask & MF_CHANNEL_FRONT_LEFT) && (out_mask & MF_CHANNEL_FRONT_RIGHT);
+		if (fronts)
+		{
+			matrix[channel_index(out_mask, MF_CHANNEL_FRONT_LEFT)] = 1.0f;
+			matrix[channel_index(out_mask, MF_CHANNEL_FRONT_RIGHT)] = 1.0f;
+		}
+		else
+		{
+			int index = channel_index(out_mask, MF_CHANNEL_FRONT_CENTER);
+			matrix[index >= 0 ? index : 0] = 1.0f;
+		}
+		return;
+	}
+	for (int c = 0; c < in_channels; c++)
+	{
+		// the c-th set bit of the input mask, channels past the mask have no position and are dropped
+		uint32_t speaker = 0;
+		uint32_t rest = in_mask;
+		for (int i = 0; i <= c && rest; i++)
+		{
+			speaker = rest & (~rest + 1);
+			rest &= rest - 1;
+		}
+		if (c >= count_channels(in_mask))
+		{
+			continue;
+		}
+		int direct = channel_index(out_mask, speaker);
+		if (direct >= 0)
+		{
+			matrix[direct * in_channels + c] = 1.0f;
+			continue;
+		}
+		for (const ChannelRoute& route : s_ChannelRoutes)
+		{
+			if (route.speaker != speaker)
+			{
+				continue;
+			}
+			for (int r = 0; r < 3 && route.targets[r][0]; r++)
+			{
+				int first = channel_index(out_mask, route.targets[r][0]);
+				int second = route.targets[r][1] ? channel_index(out_mask, route.targets[r][1]) : -1;
+				if (first < 0 || (route.targets[r][1] && second < 0))
+				{
+					continue;
+				}
+				matrix[first * in_channels + c] += route.gains[r];
+				if (second >= 0)
+				{
+					matrix[second * in_channels + c] += route.gains[r];
+				}
+				break;
+			}
+		}
+	}
+	float peak = 0.0f;
+	for (int o = 0; o < out_channels; o++)
+	{
+		float sum = 0.0f;
+		for (int c = 0; c < in_channels; c++)
+		{
+			sum += matrix[o * in_channels + c];
+		}
+		peak = sum > peak ? sum : peak;
+	}
+	if (peak > 1.0f)
+	{
+		for (int i = 0; i < in_channels * out_channels; i++)
+		{
+			matrix[i] /= peak;
+		}
+	}
+}
+
+static void remap(const float* input, int in_channels, float* output, int out_channels, const float* matrix, int samples)
+{
+	for (int i = 0; i < samples; i++)
+	{
+		const float* in = input + (size_t)i * in_channels;
+		float* out = output + (size_t)i * out_channels;
+		for (int o = 0; o < out_channels; o++)
+		{
+			const float* row = matrix + o * in_channels;
+			float sum = 0.0f;
+			for (int c = 0; c < in_channels; c++)
+			{
+				sum += row[c] * in[c];
+			}
+			out[o] = sum;
+		}
+	}
+}
+
+// the planes of a buffer advanced by offset samples
+template <typename T>
+static void offset_planes(T* const* planes, PCM_FORMAT format, int channels, int offset, T** result)
+{
+	int bytes = mf_pcm_bytes_per_sample(format);
+	if (mf_pcm_is_planar(format))
+	{
+		for (int c = 0; c < channels; c++)
+		{
+			result[c] = planes[c] + (size_t)offset * bytes;
+		}
+	}
+	else
+	{
+		result[0] = planes[0] + (size_t)offset * bytes * channels;
+	}
+}
+
+struct MixSource
+{
+	bool active{ false };
+	int sample_rate{ 0 };
+	int channels{ 0 };
+	PCM_FORMAT format{ PCM_UNKNOWN };
+	float gain{ 1.0f };
+	MFSampleConverter converter; // to interleaved float in the source layout
+	std::vector<float> matrix;
+	bool remap{ false };
+	bool resample{ false };
+	MFResampler resampler; // runs on the output layout
+	int resample_capacity{ 0 }; // output samples of one block that always fit
+	std::vector<float> ring; // output layout and rate, indexed by timeline position modulo the capacity
+	int64_t write_position{ -1 }; // timeline position of the next sample, -1 before the first push
+	int64_t skip{ 0 }; // samples still to drop after a timestamp went backwards
+	MixSourceStats stats{};
+};
+
+class MFAudioMixer::Impl
+{
+public:
+	Impl()
+	{
+	}
+
+	~Impl()
+	{
+	}
+
+	bool configure(int sample_rate, int channels, PCM_FORMAT format, uint32_t channel_mask)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (channel_mask == 0)
+		{
+			channel_mask = mf_default_channel_mask(channels);
+		}
+		if (sample_rate <= 0 || channels <= 0 || channels > MF_MAX_MIX_CHANNELS || count_channels(channel_mask) != channels ||
+			!m_OutputConverter.configure(PCM_FLT, format, channels))
+		{
+			return false;
+		}
+		m_iSampleRate = sample_rate;
+		m_iChannels = channels;
+		m_eFormat = format;
+		m_iChannelMask = channel_mask;
+		m_vecMix.assign((size_t)MIX_BLOCK * channels, 0.0f);
+		m_vecRemap.assign((size_t)MIX_BLOCK * channels, 0.0f);
+		for (MixSource& source : m_Sources)
+		{
+			source.active = false;
+		}
+		m_iPosition = 0;
+		m_iOrigin = -1;
+		return true;
+	}
+
+	void set_max_latency(int ms)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (ms < MIX_MIN_LATENCY_MS || ms > MIX_MAX_LATENCY_MS)
+		{
+			return;
+		}
+		m_iMaxLatencyMs = ms;
+	}
+
+	void reset()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		for (MixSource& source : m_Sources)
+		{
+			source.write_position = -1;
+			source.skip = 0;
+			source.stats = {};
+			if (source.resample)
+			{
+				source.resampler.reset();
+			}
+		}
+		m_iPosition = 0;
+		m_iOrigin = -1;
+	}
+
+	int add_source(int sample_rate, int channels, PCM_FORMAT format, uint32_t channel_mask)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (channel_mask == 0)
+		{
+			channel_mask = mf_default_channel_mask(channels);
+		}
+		if (m_iChannels == 0 || sample_rate <= 0 || channels <= 0 || channels > MF_MAX_MIX_CHANNELS)
+		{
+			return -1;
+		}
+		int id = 0;
+		while (id < MF_MAX_MIX_SOURCES && m_Sources[id].active)
+		{
+			id++;
+		}
+		if (id == MF_MAX_MIX_SOURCES)
+		{
+			return -1;
+		}
+		MixSource& source = m_Sources[id];
+		if (!source.converter.configure(format, PCM_FLT, channels))
+		{
+			return -1;
+		}
+		// a mask that does not describe every channel drops the channels past it
+		if (count_channels(channel_mask) > channels)
+		{
+			channel_mask = mf_default_channel_mask(channels);
+		}
+		source.resample = sample_rate != m_iSampleRate;
+		if (source.resample && !source.resampler.configure(sample_rate, m_iSampleRate, m_iChannels, RESAMPLE_QUALITY_MEDIUM))
+		{
+			return -1;
+		}
+		source.sample_rate = sample_rate;
+		source.channels = channels;
+		source.format = format;
+		source.gain = 1.0f;
+		source.matrix.resize((size_t)channels * m_iChannels);
+		build_matrix(channel_mask, channels, m_iChannelMask, m_iChannels, source.matrix.data());
+		source.remap = channel_mask != m_iChannelMask || channels != m_iChannels;
+		source.resample_capacity = (int)((int64_t)MIX_BLOCK * m_iSampleRate / sample_rate) + 8;
+		int latency = (int)((int64_t)m_iMaxLatencyMs * m_iSampleRate / 1000);
+		source.ring.assign((size_t)latency * 2 * m_iChannels, 0.0f);
+		source.write_position = -1;
+		source.skip = 0;
+		source.stats = {};
+		source.active = true;
+		if (m_vecConvert.size() < (size_t)MIX_BLOCK * channels)
+		{
+			m_vecConvert.resize((size_t)MIX_BLOCK * channels);
+		}
+		if (m_vecResampled.size() < (size_t)source.resample_capacity * m_iChannels)
+		{
+			m_vecResampled.resize((size_t)source.resample_capacity * m_iChannels);
+		}
+		if (source.resample)
+		{
+			int64_t resample_latency = mf_rescale(source.resampler.get_latency(), MF_HNS_PER_SECOND, sample_rate);
+			m_iResampleLatency = resample_latency > m_iResampleLatency ? resample_latency : m_iResampleLatency;
+		}
+		return id;
+	}
+
+	void remove_source(int id)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (id >= 0 && id < MF_MAX_MIX_SOURCES)
+		{
+			m_Sources[id].active = false;
+		}
+	}
+
+	void set_gain(int id, float gain)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (id >= 0 && id < MF_MAX_MIX_SOURCES && gain >= 0.0f)
+		{
+			m_Sources[id].gain = gain;
+		}
+	}
+
+	bool push(int id, const uint8_t* const* data, int samples, int64_t timestamp)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (id < 0 || id >= MF_MAX_MIX_SOURCES || !m_Sources[id].active || samples < 0 || (samples > 0 && (!data || !data[0])))
+		{
+			return false;
+		}
+		MixSource& source = m_Sources[id];
+		int64_t dropped = source.stats.dropped;
+		align(source, timestamp);
+		for (int offset = 0; offset < samples; offset += MIX_BLOCK)
+		{
+			int count = samples - offset < MIX_BLOCK ? samples - offset : MIX_BLOCK;
+			const uint8_t* in_planes[MF_MAX_MIX_CHANNELS];
+			offset_planes(data, source.format, source.channels, offset, in_planes);
+			uint8_t* float_planes[1] = { (uint8_t*)m_vecConvert.data() };
+			source.converter.convert(in_planes, float_planes, count);
+			const float* block = m_vecConvert.data();
+			if (source.remap)
+			{
+				remap(block, source.channels, m_vecRemap.data(), m_iChannels, source.matrix.data(), count);
+				block = m_vecRemap.data();
+			}
+			if (!source.resample)
+			{
+				write(source, block, count);
+				continue;
+			}
+			int produced = 0;
+			do
+			{
+				produced = source.resampler.process(block, count, m_vecResampled.data(), source.resample_capacity);
+				write(source, m_vecResampled.data(), produced);
+				count = 0;
+			} while (produced == source.resample_capacity);
+		}
+		return source.stats.dropped == dropped;
+	}
+
+	int mix(uint8_t* const* output, int max_samples, int64_t& timestamp)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (m_iChannels == 0 || max_samples <= 0 || !output || !output[0])
+		{
+			return 0;
+		}
+		// what every source has covered, or what keeps the leading source within the max latency
+		int64_t covered = INT64_MAX;
+		int64_t lead = 0;
+		for (const MixSource& source : m_Sources)
+		{
+			if (!source.active)
+			{
+				continue;
+			}
+			int64_t available = source.write_position > m_iPosition ? source.write_position - m_iPosition : 0;
+			covered = available < covered ? available : covered;
+			lead = available > lead ? available : lead;
+		}
+		if (covered == INT64_MAX)
+		{
+			return 0;
+		}
+		int64_t latency = (int64_t)m_iMaxLatencyMs * m_iSampleRate / 1000;
+		int64_t samples = covered > lead - latency ? covered : lead - latency;
+		samples = samples < max_samples ? samples : max_samples;
+		if (samples <= 0)
+		{
+			return 0;
+		}
+		timestamp = (m_iOrigin >= 0 ? m_iOrigin : 0) + mf_rescale(m_iPosition, MF_HNS_PER_SECOND, m_iSampleRate);
+		MixAddFunc mix_add = select_mix_add();
+		for (int offset = 0; offset < samples; offset += MIX_BLOCK)
+		{
+			int count = samples - offset < MIX_BLOCK ? (int)(samples - offset) : MIX_BLOCK;
+			memset(m_vecMix.data(), 0, sizeof(float) * count * m_iChannels);
+			for (const MixSource& source : m_Sources)
+			{
+				if (!source.active || source.write_position <= m_iPosition || source.gain == 0.0f)
+				{
+					continue;
+				}
+				int64_t available = source.write_position - m_iPosition;
+				int valid = available < count ? (int)available : count;
+				int capacity = (int)(source.ring.size() / m_iChannels);
+				int start = (int)(m_iPosition % capacity);
+				int first = capacity - start < valid ? capacity - start : valid;
+				mix_add(m_vecMix.data(), &source.ring[(size_t)start * m_iChannels], source.gain, first * m_iChannels);
+				if (valid > first)
+				{
+					mix_add(m_vecMix.data() + (size_t)first * m_iChannels, source.ring.data(), source.gain, (valid - first) * m_iChannels);
+				}
+			}
+			const uint8_t* mix_planes[1] = { (const uint8_t*)m_vecMix.data() };
+			uint8_t* out_planes[MF_MAX_MIX_CHANNELS];
+			offset_planes(output, m_eFormat, m_iChannels, offset, out_planes);
+			m_OutputConverter.convert(mix_planes, out_planes, count);
+			m_iPosition += count;
+		}
+		return (int)samples;
+	}
+
+	int64_t get_latency()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return (int64_t)m_iMaxLatencyMs * (MF_HNS_PER_SECOND / 1000) + m_iResampleLatency;
+	}
+
+	bool get_stats(int id, MixSourceStats& stats)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (id < 0 || id >= MF_MAX_MIX_SOURCES || !m_Sources[id].active)
+		{
+			return false;
+		}
+		stats = m_Sources[id].stats;
+		return true;
+	}
+
+private:
+	// moves the write position to where the timestamp puts the next output of the source
+	void align(MixSource& source, int64_t timestamp)
+	{
+		if (timestamp < 0)
+		{
+			// without a timestamp a source that ran dry continues at the output position instead of arriving late
+			if (source.write_position < m_iPosition)
+			{
+				source.write_position = m_iPosition;
+			}
+			return;
+		}
+		// the first resampler output of this push can still belong to earlier input, the offset says how far back
+		int64_t position_time = timestamp;
+		if (source.resample)
+		{
+			double offset = source.resampler.get_output_offset() * MF_HNS_PER_SECOND / source.sample_rate;
+			position_time += (int64_t)(offset < 0.0 ? offset - 0.5 : offset + 0.5);
+		}
+		if (m_iOrigin < 0)
+		{
+			m_iOrigin = position_time - mf_rescale(m_iPosition, MF_HNS_PER_SECOND, m_iSampleRate);
+		}
+		int64_t position = mf_rescale(position_time - m_iOrigin, m_iSampleRate, MF_HNS_PER_SECOND);
+		if (source.write_position < 0)
+		{
+			source.write_position = position;
+			return;
+		}
+		int64_t drift = position - (source.write_position + source.skip);
+		int64_t tolerance = (int64_t)MIX_RESYNC_MS * m_iSampleRate / 1000;
+		if (drift > tolerance)
+		{
+			// the part of the gap the output already passed went out as silence, only the rest is written
+			int64_t target = source.write_position + drift;
+			if (source.write_position < m_iPosition)
+			{
+				source.write_position = target < m_iPosition ? target : m_iPosition;
+			}
+			int64_t gap = target - source.write_position;
+			write(source, nullptr, (int)(gap < INT32_MAX ? gap : INT32_MAX));
+			source.stats.padded += drift;
+		}
+		else if (drift < -tolerance)
+		{
+			source.skip -= drift;
+		}
+	}
+
+	// input null writes silence. samples before the output position or past the ring capacity are dropped
+	void write(MixSource& source, const float* input, int samples)
+	{
+		if (source.skip > 0)
+		{
+			int skipped = source.skip < samples ? (int)source.skip : samples;
+			source.skip -= skipped;
+			source.stats.dropped += skipped;
+			input = input ? input + (size_t)skipped * m_iChannels : nullptr;
+			samples -= skipped;
+		}
+		if (source.write_position < m_iPosition)
+		{
+			int64_t late = m_iPosition - source.write_position;
+			int skipped = late < samples ? (int)late : samples;
+			source.stats.dropped += skipped;
+			input = input ? input + (size_t)skipped * m_iChannels : nullptr;
+			samples -= skipped;
+			source.write_position += skipped;
+		}
+		int capacity = (int)(source.ring.size() / m_iChannels);
+		int64_t room = m_iPosition + capacity - source.write_position;
+		if (samples > room)
+		{
+			source.stats.dropped += samples - room;
+			samples = (int)room;
+		}
+		while (samples > 0)
+		{
+			int start = (int)(source.write_position % capacity);
+			int count = capacity - start < samples ? capacity - start : samples;
+			float* dst = &source.ring[(size_t)start * m_iChannels];
+			if (input)
+			{
+				memcpy(dst, input, sizeof(float) * count * m_iChannels);
+				input += (size_t)count * m_iChannels;
+			}
+			else
+			{
+				memset(dst, 0, sizeof(float) * count * m_iChannels);
+			}
+			source.write_position += count;
+			samples -= count;
+		}
+	}
+
+	std::mutex m_Mutex; // capture threads push while the encoder thread mixes
+	int m_iSampleRate{ 0 };
+	int m_iChannels{ 0 };
+	PCM_FORMAT m_eFormat{ PCM_UNKNOWN };
+	uint32_t m_iChannelMask{ 0 };
+	int m_iMaxLatencyMs{ 100 };
+	int64_t m_iResampleLatency{ 0 };
+	MFSampleConverter m_OutputConverter;
+	MixSource m_Sources[MF_MAX_MIX_SOURCES];
+	std::vector<float> m_vecConvert; // one block of the widest source
+	std::vector<float> m_vecRemap;
+	std::vector<float> m_vecResampled;
+	std::vector<float> m_vecMix;
+	int64_t m_iPosition{ 0 }; // timeline position of the next mixed sample
+	int64_t m_iOrigin{ -1 }; // time of timeline position 0, -1 until the first timestamp
+};
+
+MFAudioMixer::MFAudioMixer()
+{
+	impl_ = new Impl();
+}
+
+MFAudioMixer::~MFAudioMixer()
+{
+	delete impl_;
+}
+
+bool MFAudioMixer::configure(int sample_rate, int channels, PCM_FORMAT format, uint32_t channel_mask)
+{
+	return impl_->configure(sample_rate, channels, format, channel_mask);
+}
+
+void MFAudioMixer::set_max_latency(int ms)
+{
+	impl_->set_max_latency(ms);
+}
+
+void MFAudioMixer::reset()
+{
+	impl_->reset();
+}
+
+int MFAudioMixer::add_source(int sample_rate, int channels, PCM_FORMAT format, uint32_t channel_mask)
+{
+	return impl_->add_source(sample_rate, channels, format, channel_mask);
+}
+
+void MFAudioMixer::remove_source(int source)
+{
+	impl_->remove_source(source);
+}
+
+void MFAudioMixer::set_gain(int source, float gain)
+{
+	impl_->set_gain(source, gain);
+}
+
+bool MFAudioMixer::push(int source, const uint8_t* const* data, int samples, int64_t timestamp)
+{
+	return impl_->push(source, data, samples, timestamp);
+}
+
+int MFAudioMixer::mix(uint8_t* const* output, int max_samples, int64_t& timestamp)
+{
+	return impl_->mix(output, max_samples, timestamp);
+}
+
+int64_t MFAudioMixer::get_latency()
+{
+	return impl_->get_latency();
+}
+
+bool MFAudioMixer::get_stats(int source, MixSourceStats& stats)
+{
+	return impl_->get_stats(source, stats);
+}
@@ -0,0 +1,171 @@
+#include "mf_audio_ring.h"
+#include "mf_time.h"
+#include <string.h>
+
+#define AUDIO_RING_MAX_CAPACITY (1 << 24)
+#define AUDIO_RING_RESYNC_HNS 10000 // a timestamp more than 1 ms off the sample count starts a new anchor
+
+MFAudioRing::MFAudioRing()
+{
+}
+
+MFAudioRing::~MFAudioRing()
+{
+	if (m_pBuffer)
+	{
+		mf_aligned_free(m_pBuffer);
+	}
+}
+
+bool MFAudioRing::configure(int capacity_samples, int frame_bytes, int sample_rate)
+{
+	if (capacity_samples <= 0 || capacity_samples > AUDIO_RING_MAX_CAPACITY || frame_bytes <= 0 || sample_rate <= 0)
+	{
+		return false;
+	}
+	uint64_t capacity = 1;
+	while (capacity < (uint64_t)capacity_samples)
+	{
+		capacity <<= 1;
+	}
+	if (m_pBuffer)
+	{
+		mf_aligned_free(m_pBuffer);
+	}
+	m_pBuffer = (uint8_t*)mf_aligned_malloc((size_t)capacity * frame_bytes, MF_CACHE_LINE);
+	if (!m_pBuffer)
+	{
+		m_iCapacity = 0;
+		return false;
+	}
+	m_iCapacity = capacity;
+	m_iFrameBytes = frame_bytes;
+	m_iSampleRate = sample_rate;
+	reset();
+	return true;
+}
+
+void MFAudioRing::reset()
+{
+	m_iWritePosition.store(0, std::memory_order_relaxed);
+	m_iAnchorsWritten.store(0, std::memory_order_relaxed);
+	m_iOverrunSamples.store(0, std::memory_order_relaxed);
+	m_iCachedReadPosition = 0;
+	m_ProducerAnchor = { 0, -1 };
+	m_bAnchorPending = false;
+	m_iReadPosition.store(0, std::memory_order_relaxed);
+	m_iAnchorsRead.store(0, std::memory_order_relaxed);
+	m_iUnderruns.store(0, std::memory_order_relaxed);
+	m_CurrentAnchor = { 0, -1 };
+}
+
+int MFAudioRing::write(const uint8_t* data, int samples, int64_t timestamp)
+{
+	if (!m_pBuffer || samples <= 0)
+	{
+		return 0;
+	}
+	uint64_t position = m_iWritePosition.load(std::memory_order_relaxed);
+	uint64_t space = m_iCapacity - (position - m_iCachedReadPosition);
+	if (space < (uint64_t)samples)
+	{
+		m_iCachedReadPosition = m_iReadPosition.load(std::memory_order_acquire);
+		space = m_iCapacity - (position - m_iCachedReadPosition);
+	}
+	int accepted = space < (uint64_t)samples ? (int)space : samples;
+
+	// samples dropped by an overrun never get a position, the next timestamp is then off by their duration and
+	// starts a new anchor. it is published with the first sample it describes, before the samples, and the consumer
+	// only applies it once it reads past its position
+	int64_t expected = m_ProducerAnchor.timestamp >= 0 ?
+		m_ProducerAnchor.timestamp + mf_rescale((int64_t)(position - m_ProducerAnchor.position), MF_HNS_PER_SECOND, m_iSampleRate) : -1;
+	if (timestamp >= 0 && (expected < 0 || timestamp - expected > AUDIO_RING_RESYNC_HNS || expected - timestamp > AUDIO_RING_RESYNC_HNS))
+	{
+		m_ProducerAnchor = { position, timestamp };
+		m_bAnchorPending = true;
+	}
+	if (m_bAnchorPending && accepted > 0)
+	{
+		uint64_t anchors = m_iAnchorsWritten.load(std::memory_order_relaxed);
+		// with every slot unread it stays pending, the pair still maps the later positions right
+		if (anchors - m_iAnchorsRead.load(std::memory_order_acquire) < MF_AUDIO_RING_ANCHORS)
+		{
+			m_Anchors[anchors % MF_AUDIO_RING_ANCHORS] = m_ProducerAnchor;
+			m_iAnchorsWritten.store(anchors + 1, std::memory_order_release);
+			m_bAnchorPending = false;
+		}
+	}
+
+	if (accepted < samples)
+	{
+		m_iOverrunSamples.fetch_add(samples - accepted, std::memory_order_relaxed);
+	}
+	uint64_t done = 0;
+	while (done < (uint64_t)accepted)
+	{
+		uint64_t index = (position + done) & (m_iCapacity - 1);
+		uint64_t count = m_iCapacity - index < accepted - done ? m_iCapacity - index : accepted - done;
+		uint8_t* dst = m_pBuffer + index * m_iFrameBytes;
+		if (data)
+		{
+			memcpy(dst, data + done * m_iFrameBytes, (size_t)count * m_iFrameBytes);
+		}
+		else
+		{
+			memset(dst, 0, (size_t)count * m_iFrameBytes);
+		}
+		done += count;
+	}
+	m_iWritePosition.store(position + accepted, std::memory_order_release);
+	return accepted;
+}
+
+bool MFAudioRing::read(uint8_t* data, int samples, int64_t& timestamp)
+{
+	if (!m_pBuffer || samples <= 0 || (uint64_t)samples > m_iCapacity)
+	{
+		return false;
+	}
+	uint64_t position = m_iReadPosition.load(std::memory_order_relaxed);
+	uint64_t available = m_iWritePosition.load(std::memory_order_acquire) - position;
+	if (available < (uint64_t)samples)
+	{
+		m_iUnderruns.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	uint64_t anchors_read = m_iAnchorsRead.load(std::memory_order_relaxed);
+	uint64_t anchors_written = m_iAnchorsWritten.load(std::memory_order_acquire);
+	while (anchors_read < anchors_written && m_Anchors[anchors_read % MF_AUDIO_RING_ANCHORS].position <= position)
+	{
+		m_CurrentAnchor = m_Anchors[anchors_read % MF_AUDIO_RING_ANCHORS];
+		anchors_read++;
+	}
+	m_iAnchorsRead.store(anchors_read, std::memory_order_release);
+	timestamp = m_CurrentAnchor.timestamp >= 0 ?
+		m_CurrentAnchor.timestamp + mf_rescale((int64_t)(position - m_CurrentAnchor.position), MF_HNS_PER_SECOND, m_iSampleRate) : -1;
+
+	uint64_t done = 0;
+	while (done < (uint64_t)samples)
+	{
+		uint64_t index = (position + done) & (m_iCapacity - 1);
+		uint64_t count = m_iCapacity - index < samples - done ? m_iCapacity - index : samples - done;
+		memcpy(data + done * m_iFrameBytes, m_pBuffer + index * m_iFrameBytes, (size_t)count * m_iFrameBytes);
+		done += count;
+	}
+	m_iReadPosition.store(position + samples, std::memory_order_release);
+	return true;
+}
+
+int MFAudioRing::get_available()
+{
+	uint64_t read_position = m_iReadPosition.load(std::memory_order_acquire);
+	return (int)(m_iWritePosition.load(std::memory_order_acquire) - read_position);
+}
+
+void MFAudioRing::get_stats(AudioRingStats& stats)
+{
+	stats.written = (int64_t)m_iWritePosition.load(std::memory_order_acquire);
+	stats.read = (int64_t)m_iReadPosition.load(std::memory_order_acquire);
+	stats.overrun_samples = m_iOverrunSamples.load(std::memory_order_relaxed);
+	stats.underruns = m_iUnderruns.load(std::memory_order_relaxed);
+}
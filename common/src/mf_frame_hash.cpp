@@ -0,0 +1,238 @@
+#include "mf_frame_hash.h"
+#include "mf_cpu.h"
+#include <string.h>
+
+#if defined(MF_ARCH_X86)
+#include <immintrin.h>
+#elif defined(MF_ARCH_ARM64)
+#include <arm_neon.h>
+#endif
+
+// Every row is consumed in 32 byte blocks by four 64 bit lanes: lane += block ^ key split into two 32 bit
+// halves and multiplied, plus the neighbouring lane's raw data. The key depends on the block position and
+// the lanes are scrambled after each row, so moving blocks or rows around changes the hash.
+#define HASH_KEY_BLOCKS 16
+#define HASH_PRIME32 0x9E3779B1ull
+#define HASH_PRIME64_1 0x9E3779B185EBCA87ull
+#define HASH_PRIME64_2 0xC2B2AE3D27D4EB4Full
+
+struct HashKeys
+{
+	alignas(32) uint64_t key[HASH_KEY_BLOCKS * 4];
+	alignas(32) uint64_t scramble[4];
+
+	HashKeys()
+	{
+		uint64_t state = 0x6A09E667F3BCC909ull;
+		for (int i = 0; i < HASH_KEY_BLOCKS * 4; i++)
+		{
+			// splitmix64
+			state += 0x9E3779B97F4A7C15ull;
+			uint64_t z = state;
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+			key[i] = z ^ (z >> 31);
+		}
+		for (int i = 0; i < 4; i++)
+		{
+			scramble[i] = key[i * 5] | 1;
+		}
+	}
+};
+
+static const HashKeys s_HashKeys;
+
+static inline void accumulate_block_c(uint64_t* acc, const uint8_t* block, const uint64_t* key)
+{
+	uint64_t data[4];
+	memcpy(data, block, 32);
+	for (int i = 0; i < 4; i++)
+	{
+		uint64_t data_key = data[i] ^ key[i];
+		acc[i] += data[i ^ 1];
+		acc[i] += (data_key & 0xFFFFFFFF) * (data_key >> 32);
+	}
+}
+
+static inline void scramble_c(uint64_t* acc)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		uint64_t a = acc[i];
+		a ^= a >> 47;
+		a ^= s_HashKeys.scramble[i];
+		acc[i] = a * HASH_PRIME32;
+	}
+}
+
+// the tail of a row shorter than one block is zero padded, the row length is mixed into the final value
+static void hash_rows_c(uint64_t* acc, const uint8_t* data, int stride, int row_bytes, int rows)
+{
+	int blocks = row_bytes / 32;
+	int tail = row_bytes % 32;
+	uint8_t padded[32];
+	for (int y = 0; y < rows; y++)
+	{
+		const uint8_t* row = data + (ptrdiff_t)y * stride;
+		for (int b = 0; b < blocks; b++)
+		{
+			accumulate_block_c(acc, row + b * 32, s_HashKeys.key + (b % HASH_KEY_BLOCKS) * 4);
+		}
+		if (tail)
+		{
+			memset(padded, 0, sizeof(padded));
+			memcpy(padded, row + blocks * 32, tail);
+			accumulate_block_c(acc, padded, s_HashKeys.key + (blocks % HASH_KEY_BLOCKS) * 4);
+		}
+		scramble_c(acc);
+	}
+}
+
+#if defined(MF_ARCH_X86)
+MF_TARGET_AVX2 static void hash_rows_avx2(uint64_t* acc, const uint8_t* data, int stride, int row_bytes, int rows)
+{
+	int blocks = row_bytes / 32;
+	int tail = row_bytes % 32;
+	alignas(32) uint8_t padded[32];
+	__m256i sum = _mm256_loadu_si256((const __m256i*)acc);
+	const __m256i scramble = _mm256_load_si256((const __m256i*)s_HashKeys.scramble);
+	const __m256i prime = _mm256_set1_epi32((int)HASH_PRIME32);
+	for (int y = 0; y < rows; y++)
+	{
+		const uint8_t* row = data + (ptrdiff_t)y * stride;
+		for (int b = 0; b <= blocks; b++)
+		{
+			__m256i block;
+			if (b < blocks)
+			{
+				block = _mm256_loadu_si256((const __m256i*)(row + b * 32));
+			}
+			else if (tail)
+			{
+				memset(padded, 0, sizeof(padded));
+				memcpy(padded, row + blocks * 32, tail);
+				block = _mm256_load_si256((const __m256i*)padded);
+			}
+			else
+			{
+				break;
+			}
+			__m256i key = _mm256_load_si256((const __m256i*)(s_HashKeys.key + (b % HASH_KEY_BLOCKS) * 4));
+			__m256i data_key = _mm256_xor_si256(block, key);
+			__m256i product = _mm256_mul_epu32(data_key, _mm256_srli_epi64(data_key, 32));
+			sum = _mm256_add_epi64(sum, _mm256_shuffle_epi32(block, _MM_SHUFFLE(1, 0, 3, 2)));
+			sum = _mm256_add_epi64(sum, product);
+		}
+		// a * prime32 in 64 bits: low(a) * p + (high(a) * p << 32)
+		__m256i a = _mm256_xor_si256(sum, _mm256_srli_epi64(sum, 47));
+		a = _mm256_xor_si256(a, scramble);
+		__m256i lo = _mm256_mul_epu32(a, prime);
+		__m256i hi = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), prime);
+		sum = _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32));
+	}
+	_mm256_storeu_si256((__m256i*)acc, sum);
+}
+#elif defined(MF_ARCH_ARM64)
+static void hash_rows_neon(uint64_t* acc, const uint8_t* data, int stride, int row_bytes, int rows)
+{
+	int blocks = row_bytes / 32;
+	int tail = row_bytes % 32;
+	uint8_t padded[32];
+	uint64x2_t sum0 = vld1q_u64(acc);
+	uint64x2_t sum1 = vld1q_u64(acc + 2);
+	for (int y = 0; y < rows; y++)
+	{
+		const uint8_t* row = data + (ptrdiff_t)y * stride;
+		for (int b = 0; b <= blocks; b++)
+		{
+			const uint8_t* src = row + b * 32;
+			if (b == blocks)
+			{
+				if (!tail)
+				{
+					break;
+				}
+				memset(padded, 0, sizeof(padded));
+				memcpy(padded, row + blocks * 32, tail);
+				src = padded;
+			}
+			const uint64_t* key = s_HashKeys.key + (b % HASH_KEY_BLOCKS) * 4;
+			uint64x2_t block0 = vreinterpretq_u64_u8(vld1q_u8(src));
+			uint64x2_t block1 = vreinterpretq_u64_u8(vld1q_u8(src + 16));
+			uint64x2_t data_key0 = veorq_u64(block0, vld1q_u64(key));
+			uint64x2_t data_key1 = veorq_u64(block1, vld1q_u64(key + 2));
+			sum0 = vaddq_u64(sum0, vextq_u64(block0, block0, 1));
+			sum1 = vaddq_u64(sum1, vextq_u64(block1, block1, 1));
+			sum0 = vmlal_u32(sum0, vmovn_u64(data_key0), vshrn_n_u64(data_key0, 32));
+			sum1 = vmlal_u32(sum1, vmovn_u64(data_key1), vshrn_n_u64(data_key1, 32));
+		}
+		vst1q_u64(acc, sum0);
+		vst1q_u64(acc + 2, sum1);
+		scramble_c(acc);
+		sum0 = vld1q_u64(acc);
+		sum1 = vld1q_u64(acc + 2);
+	}
+	vst1q_u64(acc, sum0);
+	vst1q_u64(acc + 2, sum1);
+}
+#endif
+
+typedef void (*HashRowsFunc)(uint64_t* acc, const uint8_t* data, int stride, int row_bytes, int rows);
+
+// looked up per plane rather than once, the lookup is a few loads next to a tile's worth of hashing and a changed
+// mf_cpu_feature_mask applies right away
+static HashRowsFunc select_hash_rows()
+{
+#if defined(MF_ARCH_X86)
+	if (mf_cpu_has(CPU_FEATURE_AVX2))
+	{
+		return hash_rows_avx2;
+	}
+#elif defined(MF_ARCH_ARM64)
+	if (mf_cpu_has(CPU_FEATURE_NEON))
+	{
+		return hash_rows_neon;
+	}
+#endif
+	return hash_rows_c;
+}
+
+static inline uint64_t rotl64(uint64_t value, int bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+uint64_t mf_hash_plane(const uint8_t* data, int stride, int row_bytes, int rows)
+{
+	uint64_t acc[4] = { HASH_PRIME64_1, HASH_PRIME64_2, ~HASH_PRIME64_1, ~HASH_PRIME64_2 };
+	if (data && row_bytes > 0 && rows > 0)
+	{
+		select_hash_rows()(acc, data, stride, row_bytes, rows);
+	}
+	uint64_t h = acc[0] ^ rotl64(acc[1], 17) ^ rotl64(acc[2], 31) ^ rotl64(acc[3], 47);
+	h ^= ((uint64_t)row_bytes << 32) | (uint32_t)rows;
+	h = (h ^ (h >> 33)) * HASH_PRIME64_1;
+	h = (h ^ (h >> 29)) * HASH_PRIME64_2;
+	return h ^ (h >> 32);
+}
+
+void mf_hash_bgra_tiles(const uint8_t* data, int stride, int width, int height, int tile_size, uint64_t* hashes)
+{
+	if (tile_size <= 0)
+	{
+		return;
+	}
+	int tiles_x = (width + tile_size - 1) / tile_size;
+	int tiles_y = (height + tile_size - 1) / tile_size;
+	for (int ty = 0; ty < tiles_y; ty++)
+	{
+		int y = ty * tile_size;
+		int rows = height - y < tile_size ? height - y : tile_size;
+		for (int tx = 0; tx < tiles_x; tx++)
+		{
+			int x = tx * tile_size;
+			int columns = width - x < tile_size ? width - x : tile_size;
+			hashes[ty * tiles_x + tx] = mf_hash_plane(data + (size_t)y * stride + (size_t)x * 4, stride, columns * 4, rows);
+		}
+	}
+}
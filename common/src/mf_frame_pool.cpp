@@ -0,0 +1,440 @@
+#include "mf_frame_pool.h"
+#include "mf_media_clock.h"
+#include <algorithm>
+#include <atomic>
+#include <new>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+// idle blocks older than this are freed on the next acquire, 100ns units
+#define FRAME_POOL_IDLE_LIMIT 20000000
+
+struct FramePoolBlock
+{
+	uint8_t* memory;
+	size_t size; // bytes counted against the budgets, whole large pages for a large page block
+	PIXEL_FORMAT format;
+	int width;
+	int height;
+	int stride;
+	bool large_page;
+	int64_t last_use; // mf_clock_now when the block went idle
+};
+
+static std::mutex s_mtPools;
+static std::vector<MFFramePool*> s_vecPools;
+static std::atomic<uint64_t> s_iGlobalBytes{ 0 };
+static std::atomic<uint64_t> s_iGlobalPeak{ 0 };
+static std::atomic<uint64_t> s_iGlobalBudget{ 0 };
+static std::atomic<bool> s_bLargePagesDenied{ false };
+
+static size_t get_large_page_size()
+{
+#ifdef _WIN32
+	return GetLargePageMinimum();
+#elif defined(__linux__)
+	return 2 * 1024 * 1024;
+#else
+	return 0;
+#endif
+}
+
+#ifdef _WIN32
+// large pages need SeLockMemoryPrivilege, which is granted by policy but disabled in the process token
+static bool enable_lock_memory_privilege()
+{
+	HANDLE token = nullptr;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+	{
+		return false;
+	}
+	TOKEN_PRIVILEGES privileges = {};
+	privileges.PrivilegeCount = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	bool ret = LookupPrivilegeValue(nullptr, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid) &&
+		AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr) && GetLastError() == ERROR_SUCCESS;
+	CloseHandle(token);
+	return ret;
+}
+#endif
+
+static uint8_t* alloc_large_pages(size_t size)
+{
+	if (s_bLargePagesDenied.load(std::memory_order_relaxed))
+	{
+		return nullptr;
+	}
+#ifdef _WIN32
+	static bool privilege = enable_lock_memory_privilege();
+	void* memory = privilege ? VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE) : nullptr;
+	if (memory == nullptr)
+	{
+		// without the privilege every later attempt fails the same way
+		s_bLargePagesDenied.store(true, std::memory_order_relaxed);
+	}
+	return (uint8_t*)memory;
+#elif defined(__linux__)
+	void* memory = mf_aligned_malloc(size, get_large_page_size());
+	if (memory && madvise(memory, size, MADV_HUGEPAGE) != 0)
+	{
+		// transparent huge pages are off, the block is allocated again with normal pages
+		mf_aligned_free(memory);
+		s_bLargePagesDenied.store(true, std::memory_order_relaxed);
+		return nullptr;
+	}
+	return (uint8_t*)memory;
+#else
+	return nullptr;
+#endif
+}
+
+static void free_memory(uint8_t* memory, bool large_page)
+{
+#ifdef _WIN32
+	if (large_page)
+	{
+		VirtualFree(memory, 0, MEM_RELEASE);
+		return;
+	}
+#else
+	(void)large_page; // huge pages come from posix_memalign and go back through the same free
+#endif
+	mf_aligned_free(memory);
+}
+
+static void update_peak(std::atomic<uint64_t>& peak, uint64_t value)
+{
+	uint64_t current = peak.load(std::memory_order_relaxed);
+	while (value > current && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed))
+	{
+	}
+}
+
+MFFramePool::MFFramePool()
+{
+	std::lock_guard<std::mutex> lock(s_mtPools);
+	s_vecPools.push_back(this);
+}
+
+MFFramePool::~MFFramePool()
+{
+	{
+		std::lock_guard<std::mutex> lock(s_mtPools);
+		s_vecPools.erase(std::find(s_vecPools.begin(), s_vecPools.end(), this));
+	}
+	trim();
+}
+
+void MFFramePool::set_budget(uint64_t bytes)
+{
+	std::lock_guard<std::mutex> lock(m_mtLock);
+	m_iBudget = bytes;
+	while (m_iBudget > 0 && m_Stats.allocated_bytes > m_iBudget && trim_oldest())
+	{
+	}
+}
+
+void MFFramePool::set_large_pages(bool enable)
+{
+	std::lock_guard<std::mutex> lock(m_mtLock);
+	m_bLargePages = enable;
+}
+
+VideoFrame* MFFramePool::acquire(PIXEL_FORMAT format, int width, int height, bool packed)
+{
+	int bytes_per_pixel = mf_pixel_bytes_per_pixel(format);
+	if (bytes_per_pixel == 0 || width <= 0 || height <= 0)
+	{
+		return nullptr;
+	}
+	int stride = packed ? width * bytes_per_pixel : mf_video_frame_aligned_stride(format, width);
+	FramePoolBlock* block = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_mtLock);
+		trim_expired(mf_clock_now());
+		block = take_idle(format, width, height, stride);
+		if (block)
+		{
+			m_Stats.hits++;
+			m_Stats.in_use_bytes += block->size;
+		}
+	}
+	if (block == nullptr)
+	{
+		block = allocate_block(mf_video_frame_size(format, height, stride));
+		if (block == nullptr)
+		{
+			return nullptr;
+		}
+		block->format = format;
+		block->width = width;
+		block->height = height;
+		block->stride = stride;
+		std::lock_guard<std::mutex> lock(m_mtLock);
+		m_Stats.misses++;
+		m_Stats.in_use_bytes += block->size;
+	}
+	VideoFrame* frame = mf_video_frame_wrap(format, width, height, block->memory, stride, this, block);
+	if (frame == nullptr)
+	{
+		VideoFrame unused;
+		mf_video_frame_init(unused, format, width, height, block->memory, stride);
+		unused.opaque = block;
+		release_frame(&unused);
+	}
+	return frame;
+}
+
+void MFFramePool::trim()
+{
+	std::lock_guard<std::mutex> lock(m_mtLock);
+	while (trim_oldest())
+	{
+	}
+}
+
+void MFFramePool::get_stats(FramePoolStats& stats)
+{
+	std::lock_guard<std::mutex> lock(m_mtLock);
+	stats = m_Stats;
+	stats.budget_bytes = m_iBudget;
+}
+
+void MFFramePool::release_frame(VideoFrame* frame)
+{
+	FramePoolBlock* block = (FramePoolBlock*)frame->opaque;
+	std::lock_guard<std::mutex> lock(m_mtLock);
+	m_Stats.in_use_bytes -= block->size;
+	block->last_use = mf_clock_now();
+	uint64_t global_budget = s_iGlobalBudget.load(std::memory_order_relaxed);
+	if ((m_iBudget > 0 && m_Stats.allocated_bytes > m_iBudget) ||
+		(global_budget > 0 && s_iGlobalBytes.load(std::memory_order_relaxed) > global_budget))
+	{
+		// a budget shrank while the frame was out
+		free_block(block);
+		return;
+	}
+	m_vecIdleBlocks.push_back(block);
+}
+
+void MFFramePool::set_global_budget(uint64_t bytes)
+{
+	s_iGlobalBudget.store(bytes, std::memory_order_relaxed);
+	trim_global(0);
+}
+
+void MFFramePool::get_global_stats(FramePoolStats& stats)
+{
+	stats = { 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+	std::lock_guard<std::mutex> lock(s_mtPools);
+	for (MFFramePool* pool : s_vecPools)
+	{
+		std::lock_guard<std::mutex> pool_lock(pool->m_mtLock);
+		stats.allocated_bytes += pool->m_Stats.allocated_bytes;
+		stats.in_use_bytes += pool->m_Stats.in_use_bytes;
+		stats.hits += pool->m_Stats.hits;
+		stats.misses += pool->m_Stats.misses;
+		stats.trimmed += pool->m_Stats.trimmed;
+		stats.failures += pool->m_Stats.failures;
+		stats.large_page_blocks += pool->m_Stats.large_page_blocks;
+	}
+	stats.peak_bytes = s_iGlobalPeak.load(std::memory_order_relaxed);
+	stats.budget_bytes = s_iGlobalBudget.load(std::memory_order_relaxed);
+}
+
+FramePoolBlock* MFFramePool::take_idle(PIXEL_FORMAT format, int width, int height, int stride)
+{
+	// the most recently used match, its pages are the likeliest to still be in the cache and the TLB
+	for (size_t i = m_vecIdleBlocks.size(); i > 0; i--)
+	{
+		FramePoolBlock* block = m_vecIdleBlocks[i - 1];
+		if (block->format == format && block->width == width && block->height == height && block->stride == stride)
+		{
+			m_vecIdleBlocks.erase(m_vecIdleBlocks.begin() + (i - 1));
+			return block;
+		}
+	}
+	return nullptr;
+}
+
+FramePoolBlock* MFFramePool::allocate_block(size_t size)
+{
+	bool large_pages = false;
+	{
+		std::lock_guard<std::mutex> lock(m_mtLock);
+		large_pages = m_bLargePages;
+	}
+	size_t page = large_pages && !s_bLargePagesDenied.load(std::memory_order_relaxed) ? get_large_page_size() : 0;
+	bool large_page = page > 0 && size >= page;
+	size_t reserved = large_page ? XALIGN(size, page) : size;
+	if (!reserve(reserved))
+	{
+		return nullptr;
+	}
+	uint8_t* memory = large_page ? alloc_large_pages(reserved) : nullptr;
+	if (memory == nullptr && large_page)
+	{
+		unreserve(reserved - size);
+		reserved = size;
+		large_page = false;
+	}
+	if (memory == nullptr)
+	{
+		memory = (uint8_t*)mf_aligned_malloc(size, MF_CACHE_LINE);
+	}
+	FramePoolBlock* block = memory ? new (std::nothrow) FramePoolBlock() : nullptr;
+	if (block == nullptr)
+	{
+		if (memory)
+		{
+			free_memory(memory, large_page);
+		}
+		unreserve(reserved);
+		std::lock_guard<std::mutex> lock(m_mtLock);
+		m_Stats.failures++;
+		return nullptr;
+	}
+	block->memory = memory;
+	block->size = reserved;
+	block->large_page = large_page;
+	block->last_use = 0;
+	if (large_page)
+	{
+		std::lock_guard<std::mutex> lock(m_mtLock);
+		m_Stats.large_page_blocks++;
+	}
+	return block;
+}
+
+bool MFFramePool::reserve(uint64_t bytes)
+{
+	while (true)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mtLock);
+			if (m_iBudget > 0 && m_Stats.allocated_bytes + bytes > m_iBudget)
+			{
+				if (trim_oldest())
+				{
+					continue;
+				}
+				m_Stats.failures++;
+				return false;
+			}
+			uint64_t global_budget = s_iGlobalBudget.load(std::memory_order_relaxed);
+			uint64_t global_bytes = s_iGlobalBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+			if (global_budget == 0 || global_bytes <= global_budget)
+			{
+				m_Stats.allocated_bytes += bytes;
+				m_Stats.peak_bytes = std::max(m_Stats.peak_bytes, m_Stats.allocated_bytes);
+				update_peak(s_iGlobalPeak, global_bytes);
+				return true;
+			}
+			s_iGlobalBytes.fetch_sub(bytes, std::memory_order_relaxed);
+			if (trim_oldest())
+			{
+				continue;
+			}
+		}
+		// nothing idle here, the other pools give up their oldest idle blocks. no pool lock may be held for that
+		if (!trim_global(bytes))
+		{
+			std::lock_guard<std::mutex> lock(m_mtLock);
+			m_Stats.failures++;
+			return false;
+		}
+	}
+}
+
+void MFFramePool::unreserve(uint64_t bytes)
+{
+	std::lock_guard<std::mutex> lock(m_mtLock);
+	m_Stats.allocated_bytes -= bytes;
+	s_iGlobalBytes.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+bool MFFramePool::trim_oldest()
+{
+	if (m_vecIdleBlocks.empty())
+	{
+		return false;
+	}
+	auto oldest = std::min_element(m_vecIdleBlocks.begin(), m_vecIdleBlocks.end(),
+		[](const FramePoolBlock* a, const FramePoolBlock* b) { return a->last_use < b->last_use; });
+	FramePoolBlock* block = *oldest;
+	m_vecIdleBlocks.erase(oldest);
+	free_block(block);
+	return true;
+}
+
+void MFFramePool::trim_expired(int64_t now)
+{
+	for (size_t i = m_vecIdleBlocks.size(); i > 0; i--)
+	{
+		FramePoolBlock* block = m_vecIdleBlocks[i - 1];
+		if (now - block->last_use > FRAME_POOL_IDLE_LIMIT)
+		{
+			m_vecIdleBlocks.erase(m_vecIdleBlocks.begin() + (i - 1));
+			free_block(block);
+		}
+	}
+}
+
+void MFFramePool::free_block(FramePoolBlock* block)
+{
+	m_Stats.allocated_bytes -= block->size;
+	m_Stats.trimmed++;
+	if (block->large_page)
+	{
+		m_Stats.large_page_blocks--;
+	}
+	s_iGlobalBytes.fetch_sub(block->size, std::memory_order_relaxed);
+	free_memory(block->memory, block->large_page);
+	delete block;
+}
+
+int64_t MFFramePool::get_oldest_idle()
+{
+	int64_t oldest = INT64_MAX;
+	for (FramePoolBlock* block : m_vecIdleBlocks)
+	{
+		oldest = std::min(oldest, block->last_use);
+	}
+	return oldest;
+}
+
+bool MFFramePool::trim_global(uint64_t bytes)
+{
+	std::lock_guard<std::mutex> lock(s_mtPools);
+	while (true)
+	{
+		uint64_t global_budget = s_iGlobalBudget.load(std::memory_order_relaxed);
+		if (global_budget == 0 || s_iGlobalBytes.load(std::memory_order_relaxed) + bytes <= global_budget)
+		{
+			return true;
+		}
+		MFFramePool* oldest_pool = nullptr;
+		int64_t oldest = INT64_MAX;
+		for (MFFramePool* pool : s_vecPools)
+		{
+			std::lock_guard<std::mutex> pool_lock(pool->m_mtLock);
+			int64_t last_use = pool->get_oldest_idle();
+			if (last_use < oldest)
+			{
+				oldest = last_use;
+				oldest_pool = pool;
+			}
+		}
+		if (oldest_pool == nullptr)
+		{
+			return false;
+		}
+		std::lock_guard<std::mutex> pool_lock(oldest_pool->m_mtLock);
+		oldest_pool->trim_oldest();
+	}
+}
@@ -0,0 +1,256 @@
+#include "mf_lz4.h"
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5 // the block always ends with at least this many literals
+#define LZ4_MFLIMIT 12 // and the last match starts at least this far from the end
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_BITS 12
+
+static inline uint32_t read32(const uint8_t* p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint64_t read64(const uint8_t* p)
+{
+	uint64_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline int trailing_zero_bytes(uint64_t value)
+{
+#ifdef _MSC_VER
+	unsigned long index = 0;
+	_BitScanForward64(&index, value);
+	return (int)(index >> 3);
+#else
+	return __builtin_ctzll(value) >> 3;
+#endif
+}
+
+static inline uint32_t hash_sequence(uint32_t sequence)
+{
+	return (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+// compares eight bytes per step, the first differing byte is found from the xor (little endian only)
+static inline int match_length(const uint8_t* p, const uint8_t* match, const uint8_t* limit)
+{
+	const uint8_t* start = p;
+	while (p + 8 <= limit)
+	{
+		uint64_t diff = read64(p) ^ read64(match);
+		if (diff)
+		{
+			return (int)(p - start) + trailing_zero_bytes(diff);
+		}
+		p += 8;
+		match += 8;
+	}
+	while (p < limit && *p == *match)
+	{
+		p++;
+		match++;
+	}
+	return (int)(p - start);
+}
+
+static inline uint8_t* write_length(uint8_t* op, int length)
+{
+	while (length >= 255)
+	{
+		*op++ = 255;
+		length -= 255;
+	}
+	*op++ = (uint8_t)length;
+	return op;
+}
+
+int mf_lz4_compress(const uint8_t* src, int src_size, uint8_t* dst, int dst_capacity, uint32_t* hash_table)
+{
+	if (src_size < 0 || dst_capacity <= 0)
+	{
+		return 0;
+	}
+	const uint8_t* ip = src;
+	const uint8_t* anchor = src;
+	const uint8_t* end = src + src_size;
+	uint8_t* op = dst;
+	uint8_t* op_end = dst + dst_capacity;
+
+	if (src_size > LZ4_MFLIMIT)
+	{
+		// positions are stored + 1, so a cleared table means no candidate
+		memset(hash_table, 0, MF_LZ4_HASH_ENTRIES * sizeof(uint32_t));
+		const uint8_t* match_start_limit = end - LZ4_MFLIMIT;
+		const uint8_t* match_end_limit = end - LZ4_LAST_LITERALS;
+		int step_counter = 1 << 6;
+		while (ip <= match_start_limit)
+		{
+			uint32_t sequence = read32(ip);
+			uint32_t h = hash_sequence(sequence);
+			uint32_t candidate = hash_table[h];
+			uint32_t position = (uint32_t)(ip - src);
+			hash_table[h] = position + 1;
+			if (candidate == 0 || position + 1 - candidate > LZ4_MAX_OFFSET || read32(src + candidate - 1) != sequence)
+			{
+				// incompressible data is skipped faster the longer no match turns up
+				ip += step_counter++ >> 6;
+				continue;
+			}
+			step_counter = 1 << 6;
+			const uint8_t* match = src + candidate - 1;
+			while (ip > anchor && match > src && ip[-1] == match[-1])
+			{
+				ip--;
+				match--;
+			}
+			int literals = (int)(ip - anchor);
+			int length = LZ4_MIN_MATCH + match_length(ip + LZ4_MIN_MATCH, match + LZ4_MIN_MATCH, match_end_limit);
+			if (op + 1 + literals / 255 + 1 + literals + 2 + (length - LZ4_MIN_MATCH) / 255 + 1 > op_end)
+			{
+				return 0;
+			}
+			uint8_t* token = op++;
+			if (literals >= 15)
+			{
+				*token = 15 << 4;
+				op = write_length(op, literals - 15);
+			}
+			else
+			{
+				*token = (uint8_t)(literals << 4);
+			}
+			memcpy(op, anchor, literals);
+			op += literals;
+			uint16_t offset = (uint16_t)(ip - match);
+			op[0] = (uint8_t)offset;
+			op[1] = (uint8_t)(offset >> 8);
+			op += 2;
+			if (length - LZ4_MIN_MATCH >= 15)
+			{
+				*token |= 15;
+				op = write_length(op, length - LZ4_MIN_MATCH - 15);
+			}
+			else
+			{
+				*token |= (uint8_t)(length - LZ4_MIN_MATCH);
+			}
+			ip += length;
+			anchor = ip;
+			if (ip <= match_start_limit)
+			{
+				hash_table[hash_sequence(read32(ip - 2))] = (uint32_t)(ip - 2 - src) + 1;
+			}
+		}
+	}
+
+	int literals = (int)(end - anchor);
+	if (op + 1 + literals / 255 + 1 + literals > op_end)
+	{
+		return 0;
+	}
+	uint8_t* token = op++;
+	if (literals >= 15)
+	{
+		*token = 15 << 4;
+		op = write_length(op, literals - 15);
+	}
+	else
+	{
+		*token = (uint8_t)(literals << 4);
+	}
+	memcpy(op, anchor, literals);
+	op += literals;
+	return (int)(op - dst);
+}
+
+int mf_lz4_decompress(const uint8_t* src, int src_size, uint8_t* dst, int dst_capacity)
+{
+	const uint8_t* ip = src;
+	const uint8_t* end = src + src_size;
+	uint8_t* op = dst;
+	uint8_t* op_end = dst + dst_capacity;
+	while (ip < end)
+	{
+		uint8_t token = *ip++;
+		size_t literals = token >> 4;
+		if (literals == 15)
+		{
+			uint8_t value = 0;
+			do
+			{
+				if (ip >= end)
+				{
+					return -1;
+				}
+				value = *ip++;
+				literals += value;
+			} while (value == 255);
+		}
+		if (literals > (size_t)(end - ip) || literals > (size_t)(op_end - op))
+		{
+			return -1;
+		}
+		memcpy(op, ip, literals);
+		op += literals;
+		ip += literals;
+		if (ip >= end)
+		{
+			break;
+		}
+
+		if (end - ip < 2)
+		{
+			return -1;
+		}
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - dst))
+		{
+			return -1;
+		}
+		size_t length = token & 15;
+		if (length == 15)
+		{
+			uint8_t value = 0;
+			do
+			{
+				if (ip >= end)
+				{
+					return -1;
+				}
+				value = *ip++;
+				length += value;
+			} while (value == 255);
+		}
+		length += LZ4_MIN_MATCH;
+		if (length > (size_t)(op_end - op))
+		{
+			return -1;
+		}
+		const uint8_t* match = op - offset;
+		if (offset >= length)
+		{
+			memcpy(op, match, length);
+			op += length;
+		}
+		else
+		{
+			// overlapping copy repeats the last offset bytes
+			for (size_t i = 0; i < length; i++)
+			{
+				*op++ = match[i];
+			}
+		}
+	}
+	return (int)(op - dst);
+}
@@ -0,0 +1,173 @@
+#include "mf_media_clock.h"
+#include "mf_time.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+int64_t mf_clock_now()
+{
+#ifdef _WIN32
+	static const int64_t frequency = []()
+	{
+		LARGE_INTEGER value;
+		QueryPerformanceFrequency(&value);
+		return (int64_t)value.QuadPart;
+	}();
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return mf_rescale(counter.QuadPart, MF_HNS_PER_SECOND, frequency);
+#else
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * MF_HNS_PER_SECOND + now.tv_nsec / 100;
+#endif
+}
+
+MFMediaClock::MFMediaClock()
+{
+}
+
+MFMediaClock::~MFMediaClock()
+{
+}
+
+void MFMediaClock::start()
+{
+	m_iOrigin = mf_clock_now();
+}
+
+void MFMediaClock::start(int64_t origin)
+{
+	m_iOrigin = origin;
+}
+
+int64_t MFMediaClock::get_origin()
+{
+	return m_iOrigin;
+}
+
+int64_t MFMediaClock::now()
+{
+	return mf_clock_now() - m_iOrigin;
+}
+
+bool MFMediaClock::to_time_base(int64_t capture_time, int64_t time_base, int64_t& timestamp)
+{
+	int64_t elapsed = capture_time - m_iOrigin;
+	if (elapsed < 0)
+	{
+		return false;
+	}
+	timestamp = mf_rescale(elapsed, time_base, MF_HNS_PER_SECOND);
+	return true;
+}
+
+MFClockDriftEstimator::MFClockDriftEstimator()
+{
+}
+
+MFClockDriftEstimator::~MFClockDriftEstimator()
+{
+}
+
+void MFClockDriftEstimator::reset()
+{
+	m_iCount = 0;
+	m_iNext = 0;
+	m_dRatio = 1.0;
+	m_dOffset = 0.0;
+}
+
+void MFClockDriftEstimator::add(int64_t device_time, int64_t clock_time)
+{
+	// a device clock that jumps back, e.g. a restarted stream, starts a new fit
+	if (m_iCount > 0 && device_time <= m_iDevice[(m_iNext + MF_DRIFT_WINDOW - 1) % MF_DRIFT_WINDOW])
+	{
+		reset();
+	}
+	m_iDevice[m_iNext] = device_time;
+	m_iClock[m_iNext] = clock_time;
+	m_iNext = (m_iNext + 1) % MF_DRIFT_WINDOW;
+	m_iCount = m_iCount < MF_DRIFT_WINDOW ? m_iCount + 1 : MF_DRIFT_WINDOW;
+	fit();
+}
+
+int64_t MFClockDriftEstimator::map(int64_t device_time)
+{
+	if (m_iCount == 0)
+	{
+		return device_time;
+	}
+	double mapped = m_dOffset + (double)(device_time - m_iDeviceBase) * m_dRatio;
+	return m_iClockBase + (int64_t)(mapped < 0.0 ? mapped - 0.5 : mapped + 0.5);
+}
+
+double MFClockDriftEstimator::get_ratio()
+{
+	return m_dRatio;
+}
+
+int MFClockDriftEstimator::get_count()
+{
+	return m_iCount;
+}
+
+void MFClockDriftEstimator::fit()
+{
+	int oldest = (m_iNext + MF_DRIFT_WINDOW - m_iCount) % MF_DRIFT_WINDOW;
+	m_iDeviceBase = m_iDevice[oldest];
+	m_iClockBase = m_iClock[oldest];
+	if (m_iCount >= 2)
+	{
+		// the fit runs over the earliest arrival of each segment, a line through the mean would carry the jitter
+		double x[MF_DRIFT_SEGMENTS];
+		double y[MF_DRIFT_SEGMENTS];
+		int segments = m_iCount < MF_DRIFT_SEGMENTS ? m_iCount : MF_DRIFT_SEGMENTS;
+		for (int s = 0; s < segments; s++)
+		{
+			int begin = m_iCount * s / segments;
+			int end = m_iCount * (s + 1) / segments;
+			for (int i = begin; i < end; i++)
+			{
+				int index = (oldest + i) % MF_DRIFT_WINDOW;
+				double dx = (double)(m_iDevice[index] - m_iDeviceBase);
+				double dy = (double)(m_iClock[index] - m_iClockBase);
+				if (i == begin || dy - dx < y[s] - x[s])
+				{
+					x[s] = dx;
+					y[s] = dy;
+				}
+			}
+		}
+		double mean_x = 0.0;
+		double mean_y = 0.0;
+		for (int s = 0; s < segments; s++)
+		{
+			mean_x += x[s];
+			mean_y += y[s];
+		}
+		mean_x /= segments;
+		mean_y /= segments;
+		double sxx = 0.0;
+		double sxy = 0.0;
+		for (int s = 0; s < segments; s++)
+		{
+			sxx += (x[s] - mean_x) * (x[s] - mean_x);
+			sxy += (x[s] - mean_x) * (y[s] - mean_y);
+		}
+		// real clocks differ by parts per million, anything far off is a burst of delayed samples, not drift
+		double ratio = sxx > 0.0 ? sxy / sxx : 1.0;
+		m_dRatio = ratio > 0.99 && ratio < 1.01 ? ratio : 1.0;
+	}
+	double offset = 0.0;
+	for (int i = 0; i < m_iCount; i++)
+	{
+		int index = (oldest + i) % MF_DRIFT_WINDOW;
+		double residual = (double)(m_iClock[index] - m_iClockBase) - (double)(m_iDevice[index] - m_iDeviceBase) * m_dRatio;
+		offset = i == 0 || residual < offset ? residual : offset;
+	}
+	m_dOffset = offset;
+}
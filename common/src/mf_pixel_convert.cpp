@@ -0,0 +1,310 @@
+#include "mf_pixel_convert.h"
+#include "libyuv/include/libyuv.h"
+#include <vector>
+
+// rows a two step conversion stages at a time, even so 4:2:0 chroma stays paired, few enough to stay in cache
+#define CONVERT_CHUNK_ROWS 16
+
+// Y0 U Y1 V <-> U Y0 V Y1, one 4 byte group holds two pixels
+static const uint8_t s_SwapPairs[16] = { 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14 };
+
+static void copy_i420(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	libyuv::I420Copy(src.data[0], src.stride[0], src.data[1], src.stride[1], src.data[2], src.stride[2],
+		dst.data[0], dst.stride[0], dst.data[1], dst.stride[1], dst.data[2], dst.stride[2], width, rows);
+}
+
+static void copy_nv12(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	libyuv::CopyPlane(src.data[0], src.stride[0], dst.data[0], dst.stride[0], width, rows);
+	libyuv::CopyPlane(src.data[1], src.stride[1], dst.data[1], dst.stride[1], (width + 1) & ~1, (rows + 1) / 2);
+}
+
+template<int bytes_per_pixel>
+static void copy_packed(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	libyuv::CopyPlane(src.data[0], src.stride[0], dst.data[0], dst.stride[0], width * bytes_per_pixel, rows);
+}
+
+// 4:2:2 rows hold whole pixel pairs, an odd width still ends with the V of its last pair
+static void copy_pairs(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	libyuv::CopyPlane(src.data[0], src.stride[0], dst.data[0], dst.stride[0], (width + 1) / 2 * 4, rows);
+}
+
+static void swap_pairs(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	libyuv::ARGBShuffle(src.data[0], src.stride[0], dst.data[0], dst.stride[0], s_SwapPairs, (width + 1) / 2, rows);
+}
+
+static void i420_to_nv12(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	libyuv::I420ToNV12(src.data[0], src.stride[0], src.data[1], src.stride[1], src.data[2], src.stride[2],
+		dst.data[0], dst.stride[0], dst.data[1], dst.stride[1], width, rows);
+}
+
+static void i420_to_yuy2(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	libyuv::I420ToYUY2(src.data[0], src.stride[0], src.data[1], src.stride[1], src.data[2], src.stride[2], dst.data[0], dst.stride[0], width, rows);
+}
+
+static void i420_to_uyvy(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	libyuv::I420ToUYVY(src.data[0], src.stride[0], src.data[1], src.stride[1], src.data[2], src.stride[2], dst.data[0], dst.stride[0], width, rows);
+}
+
+static void i420_to_bgra(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	libyuv::I420ToARGB(src.data[0], src.stride[0], src.data[1], src.stride[1], src.data[2], src.stride[2], dst.data[0], dst.stride[0], width, rows);
+}
+
+static void i420_to_rgb24(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	libyuv::I420ToRGB24(src.data[0], src.stride[0], src.data[1], src.stride[1], src.data[2], src.stride[2], dst.data[0], dst.stride[0], width, rows);
+}
+
+static void nv12_to_i420(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	libyuv::NV12ToI420(src.data[0], src.stride[0], src.data[1], src.stride[1],
+		dst.data[0], dst.stride[0], dst.data[1], dst.stride[1], dst.data[2], dst.stride[2], width, rows);
+}
+
+static void nv12_to_bgra(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	libyuv::NV12ToARGB(src.data[0], src.stride[0], src.data[1], src.stride[1], dst.data[0], dst.stride[0], width, rows);
+}
+
+static void nv12_to_rgb24(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	libyuv::NV12ToRGB24(src.data[0], src.stride[0], src.data[1], src.stride[1], dst.data[0], dst.stride[0], width, rows);
+}
+
+static void yuy2_to_i420(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	libyuv::YUY2ToI420(src.data[0], src.stride[0], dst.data[0], dst.stride[0], dst.data[1], dst.stride[1], dst.data[2], dst.stride[2], width, rows);
+}
+
+static void yuy2_to_nv12(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	libyuv::YUY2ToNV12(src.data[0], src.stride[0], dst.data[0], dst.stride[0], dst.data[1], dst.stride[1], width, rows);
+}
+
+static void yuy2_to_bgra(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	libyuv::YUY2ToARGB(src.data[0], src.stride[0], dst.data[0], dst.stride[0], width, rows);
+}
+
+static void uyvy_to_i420(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	libyuv::UYVYToI420(src.data[0], src.stride[0], dst.data[0], dst.stride[0], dst.data[1], dst.stride[1], dst.data[2], dst.stride[2], width, rows);
+}
+
+static void uyvy_to_nv12(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	libyuv::UYVYToNV12(src.data[0], src.stride[0], dst.data[0], dst.stride[0], dst.data[1], dst.stride[1], width, rows);
+}
+
+static void uyvy_to_bgra(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	libyuv::UYVYToARGB(src.data[0], src.stride[0], dst.data[0], dst.stride[0], width, rows);
+}
+
+static void bgra_to_i420(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	libyuv::ARGBToI420(src.data[0], src.stride[0], dst.data[0], dst.stride[0], dst.data[1], dst.stride[1], dst.data[2], dst.stride[2], width, rows);
+}
+
+static void bgra_to_nv12(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	libyuv::ARGBToNV12(src.data[0], src.stride[0], dst.data[0], dst.stride[0], dst.data[1], dst.stride[1], width, rows);
+}
+
+static void bgra_to_yuy2(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	libyuv::ARGBToYUY2(src.data[0], src.stride[0], dst.data[0], dst.stride[0], width, rows);
+}
+
+static void bgra_to_uyvy(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	libyuv::ARGBToUYVY(src.data[0], src.stride[0], dst.data[0], dst.stride[0], width, rows);
+}
+
+static void bgra_to_rgb24(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	libyuv::ARGBToRGB24(src.data[0], src.stride[0], dst.data[0], dst.stride[0], width, rows);
+}
+
+static void rgb24_to_i420(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	libyuv::RGB24ToI420(src.data[0], src.stride[0], dst.data[0], dst.stride[0], dst.data[1], dst.stride[1], dst.data[2], dst.stride[2], width, rows);
+}
+
+static void rgb24_to_bgra(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	libyuv::RGB24ToARGB(src.data[0], src.stride[0], dst.data[0], dst.stride[0], width, rows);
+}
+
+// pairs libyuv has no kernel for go through a few rows of an intermediate format in a scratch of the calling thread,
+// so the source is still read once and the intermediate never leaves the cache
+template<PIXEL_FORMAT src_format, PIXEL_FORMAT mid_format, PIXEL_FORMAT dst_format, PixelConvertFunc first, PixelConvertFunc second>
+static void convert_via(const PlaneView& src, const PlaneView& dst, int width, int rows)
+{
+	thread_local std::vector<uint8_t> scratch;
+	int stride = XALIGN(width * mf_pixel_bytes_per_pixel(mid_format), MF_CACHE_LINE * 2);
+	PlaneView mid = {};
+	mid.stride[0] = stride;
+	size_t luma_size = (size_t)stride * CONVERT_CHUNK_ROWS;
+	size_t size = luma_size + (mf_pixel_plane_count(mid_format) == 3 ? luma_size / 2 : 0);
+	if (scratch.size() < size)
+	{
+		scratch.resize(size);
+	}
+	mid.data[0] = scratch.data();
+	if (mf_pixel_plane_count(mid_format) == 3)
+	{
+		mid.data[1] = mid.data[0] + luma_size;
+		mid.data[2] = mid.data[1] + luma_size / 4;
+		mid.stride[1] = stride / 2;
+		mid.stride[2] = stride / 2;
+	}
+	for (int row = 0; row < rows; row += CONVERT_CHUNK_ROWS)
+	{
+		int chunk = rows - row < CONVERT_CHUNK_ROWS ? rows - row : CONVERT_CHUNK_ROWS;
+		first(mf_pixel_plane_rows_at(src, src_format, row), mid, width, chunk);
+		second(mid, mf_pixel_plane_rows_at(dst, dst_format, row), width, chunk);
+	}
+}
+
+struct ConvertEntry
+{
+	PIXEL_FORMAT src_format;
+	PIXEL_FORMAT dst_format;
+	PixelConvertFunc convert;
+};
+
+// YV12 is added with the I420 kernels when the table is built
+static const ConvertEntry s_ConvertEntries[] =
+{
+	{ PIXEL_I420, PIXEL_I420, copy_i420 },
+	{ PIXEL_I420, PIXEL_NV12, i420_to_nv12 },
+	{ PIXEL_I420, PIXEL_YUY2, i420_to_yuy2 },
+	{ PIXEL_I420, PIXEL_UYVY, i420_to_uyvy },
+	{ PIXEL_I420, PIXEL_BGRA, i420_to_bgra },
+	{ PIXEL_I420, PIXEL_RGB24, i420_to_rgb24 },
+
+	{ PIXEL_NV12, PIXEL_I420, nv12_to_i420 },
+	{ PIXEL_NV12, PIXEL_NV12, copy_nv12 },
+	{ PIXEL_NV12, PIXEL_YUY2, convert_via<PIXEL_NV12, PIXEL_I420, PIXEL_YUY2, nv12_to_i420, i420_to_yuy2> },
+	{ PIXEL_NV12, PIXEL_UYVY, convert_via<PIXEL_NV12, PIXEL_I420, PIXEL_UYVY, nv12_to_i420, i420_to_uyvy> },
+	{ PIXEL_NV12, PIXEL_BGRA, nv12_to_bgra },
+	{ PIXEL_NV12, PIXEL_RGB24, nv12_to_rgb24 },
+
+	{ PIXEL_YUY2, PIXEL_I420, yuy2_to_i420 },
+	{ PIXEL_YUY2, PIXEL_NV12, yuy2_to_nv12 },
+	{ PIXEL_YUY2, PIXEL_YUY2, copy_pairs },
+	{ PIXEL_YUY2, PIXEL_UYVY, swap_pairs },
+	{ PIXEL_YUY2, PIXEL_BGRA, yuy2_to_bgra },
+	{ PIXEL_YUY2, PIXEL_RGB24, convert_via<PIXEL_YUY2, PIXEL_BGRA, PIXEL_RGB24, yuy2_to_bgra, bgra_to_rgb24> },
+
+	{ PIXEL_UYVY, PIXEL_I420, uyvy_to_i420 },
+	{ PIXEL_UYVY, PIXEL_NV12, uyvy_to_nv12 },
+	{ PIXEL_UYVY, PIXEL_YUY2, swap_pairs },
+	{ PIXEL_UYVY, PIXEL_UYVY, copy_pairs },
+	{ PIXEL_UYVY, PIXEL_BGRA, uyvy_to_bgra },
+	{ PIXEL_UYVY, PIXEL_RGB24, convert_via<PIXEL_UYVY, PIXEL_BGRA, PIXEL_RGB24, uyvy_to_bgra, bgra_to_rgb24> },
+
+	{ PIXEL_BGRA, PIXEL_I420, bgra_to_i420 },
+	{ PIXEL_BGRA, PIXEL_NV12, bgra_to_nv12 },
+	{ PIXEL_BGRA, PIXEL_YUY2, bgra_to_yuy2 },
+	{ PIXEL_BGRA, PIXEL_UYVY, bgra_to_uyvy },
+	{ PIXEL_BGRA, PIXEL_BGRA, copy_packed<4> },
+	{ PIXEL_BGRA, PIXEL_RGB24, bgra_to_rgb24 },
+
+	{ PIXEL_RGB24, PIXEL_I420, rgb24_to_i420 },
+	{ PIXEL_RGB24, PIXEL_NV12, convert_via<PIXEL_RGB24, PIXEL_I420, PIXEL_NV12, rgb24_to_i420, i420_to_nv12> },
+	{ PIXEL_RGB24, PIXEL_YUY2, convert_via<PIXEL_RGB24, PIXEL_BGRA, PIXEL_YUY2, rgb24_to_bgra, bgra_to_yuy2> },
+	{ PIXEL_RGB24, PIXEL_UYVY, convert_via<PIXEL_RGB24, PIXEL_BGRA, PIXEL_UYVY, rgb24_to_bgra, bgra_to_uyvy> },
+	{ PIXEL_RGB24, PIXEL_BGRA, rgb24_to_bgra },
+	{ PIXEL_RGB24, PIXEL_RGB24, copy_packed<3> },
+};
+
+struct ConvertTable
+{
+	PixelConvertFunc convert[PIXEL_FORMAT_MAX][PIXEL_FORMAT_MAX];
+
+	ConvertTable()
+	{
+		for (int i = 0; i < PIXEL_FORMAT_MAX; i++)
+		{
+			for (int j = 0; j < PIXEL_FORMAT_MAX; j++)
+			{
+				convert[i][j] = nullptr;
+			}
+		}
+		for (const ConvertEntry& entry : s_ConvertEntries)
+		{
+			convert[entry.src_format][entry.dst_format] = entry.convert;
+			if (entry.src_format == PIXEL_I420)
+			{
+				convert[PIXEL_YV12][entry.dst_format] = entry.convert;
+			}
+			if (entry.dst_format == PIXEL_I420)
+			{
+				convert[entry.src_format][PIXEL_YV12] = entry.convert;
+			}
+		}
+		convert[PIXEL_YV12][PIXEL_YV12] = copy_i420;
+	}
+};
+
+static const ConvertTable s_ConvertTable;
+
+PixelConvertFunc mf_pixel_convert_func(PIXEL_FORMAT src_format, PIXEL_FORMAT dst_format)
+{
+	if (src_format <= PIXEL_NONE || src_format >= PIXEL_FORMAT_MAX || dst_format <= PIXEL_NONE || dst_format >= PIXEL_FORMAT_MAX)
+	{
+		return nullptr;
+	}
+	return s_ConvertTable.convert[src_format][dst_format];
+}
+
+PlaneView mf_pixel_plane_rows_at(const PlaneView& planes, PIXEL_FORMAT format, int row)
+{
+	PlaneView view = planes;
+	view.data[0] = planes.data[0] + (ptrdiff_t)row * planes.stride[0];
+	for (int i = 1; i < mf_pixel_plane_count(format); i++)
+	{
+		view.data[i] = planes.data[i] + (ptrdiff_t)(row / 2) * planes.stride[i];
+	}
+	return view;
+}
+
+MFPixelConverter::MFPixelConverter()
+{
+}
+
+MFPixelConverter::~MFPixelConverter()
+{
+}
+
+bool MFPixelConverter::configure(PIXEL_FORMAT src_format, PIXEL_FORMAT dst_format)
+{
+	m_pConvert = mf_pixel_convert_func(src_format, dst_format);
+	m_eSrcFormat = m_pConvert ? src_format : PIXEL_NONE;
+	m_eDstFormat = m_pConvert ? dst_format : PIXEL_NONE;
+	return m_pConvert != nullptr;
+}
+
+bool MFPixelConverter::is_configured(PIXEL_FORMAT src_format, PIXEL_FORMAT dst_format)
+{
+	return m_pConvert && m_eSrcFormat == src_format && m_eDstFormat == dst_format;
+}
+
+void MFPixelConverter::convert(const PlaneView& src, const PlaneView& dst, int width, int row_begin, int row_end)
+{
+	if (m_pConvert == nullptr || row_end <= row_begin)
+	{
+		return;
+	}
+	m_pConvert(mf_pixel_plane_rows_at(src, m_eSrcFormat, row_begin), mf_pixel_plane_rows_at(dst, m_eDstFormat, row_begin), width, row_end - row_begin);
+}
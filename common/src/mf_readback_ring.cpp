@@ -0,0 +1,115 @@
+#include "mf_readback_ring.h"
+
+MFReadbackRing::MFReadbackRing()
+{
+	reset();
+}
+
+MFReadbackRing::~MFReadbackRing()
+{
+}
+
+bool MFReadbackRing::configure(int slots, int depth)
+{
+	if (slots < 3 || slots > MF_READBACK_MAX_SLOTS || depth < 1 || depth > slots - 2)
+	{
+		return false;
+	}
+	m_iSlots = slots;
+	m_iDepth = depth;
+	reset();
+	return true;
+}
+
+void MFReadbackRing::reset()
+{
+	for (int i = 0; i < MF_READBACK_MAX_SLOTS; i++)
+	{
+		m_eState[i] = SLOT_FREE;
+		m_iTimestamp[i] = 0;
+		m_iSequence[i] = 0;
+	}
+	m_iNextSequence = 0;
+	m_iPending = 0;
+	m_Stats = { 0, 0, 0 };
+}
+
+int MFReadbackRing::begin_copy(int64_t timestamp)
+{
+	int slot = -1;
+	for (int i = 0; i < m_iSlots; i++)
+	{
+		if (m_eState[i] == SLOT_FREE)
+		{
+			slot = i;
+			break;
+		}
+	}
+	if (slot < 0)
+	{
+		// the reader fell behind, the newest frame is worth more than the oldest queued one
+		slot = oldest_copied();
+		if (slot < 0)
+		{
+			return -1;
+		}
+		m_iPending--;
+		m_Stats.dropped++;
+	}
+	m_eState[slot] = SLOT_COPIED;
+	m_iTimestamp[slot] = timestamp;
+	m_iSequence[slot] = m_iNextSequence++;
+	m_iPending++;
+	m_Stats.copies++;
+	return slot;
+}
+
+int MFReadbackRing::begin_read(bool drain, int64_t& timestamp)
+{
+	if (m_iPending == 0 || (!drain && m_iPending <= m_iDepth))
+	{
+		return -1;
+	}
+	int slot = oldest_copied();
+	m_eState[slot] = SLOT_LEASED;
+	m_iPending--;
+	m_Stats.reads++;
+	timestamp = m_iTimestamp[slot];
+	return slot;
+}
+
+void MFReadbackRing::end_read(int slot)
+{
+	if (slot >= 0 && slot < m_iSlots && m_eState[slot] == SLOT_LEASED)
+	{
+		m_eState[slot] = SLOT_FREE;
+	}
+}
+
+int MFReadbackRing::get_slot_count()
+{
+	return m_iSlots;
+}
+
+int MFReadbackRing::get_pending()
+{
+	return m_iPending;
+}
+
+void MFReadbackRing::get_stats(ReadbackStats& stats)
+{
+	stats = m_Stats;
+}
+
+int MFReadbackRing::oldest_copied()
+{
+	int slot = -1;
+	for (int i = 0; i < m_iSlots; i++)
+	{
+		if (m_eState[i] == SLOT_COPIED && (slot < 0 || m_iSequence[i] < m_iSequence[slot]))
+		{
+			slot = i;
+		}
+	}
+	return slot;
+}
@@ -0,0 +1,439 @@
+#include "mf_resampler.h"
+#include "mf_cpu.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(MF_ARCH_X86)
+#include <immintrin.h>
+#elif defined(MF_ARCH_ARM64)
+#include <arm_neon.h>
+#endif
+
+#define RESAMPLE_MAX_CHANNELS 64
+#define RESAMPLE_MAX_TAPS 1024
+#define RESAMPLE_PI 3.14159265358979323846
+
+struct ResampleQualityParam
+{
+	int taps; // at unity or up conversion, down conversion scales it by the ratio
+	int phase_bits;
+	double beta; // Kaiser window
+	double transition; // width of the transition band as a fraction of the lower rate
+};
+
+static const ResampleQualityParam s_QualityParams[] = {
+	{ 16, 6, 5.0, 0.25 },
+	{ 64, 8, 8.5, 0.085 },
+	{ 128, 9, 11.0, 0.055 }
+};
+
+typedef void (*InterpolateFunc)(const float* h0, const float* h1, float t, float* coeffs, int taps);
+typedef float (*DotFunc)(const float* x, const float* coeffs, int taps);
+
+// taps are a multiple of 8 in every kernel
+
+static void interpolate_c(const float* h0, const float* h1, float t, float* coeffs, int taps)
+{
+	for (int k = 0; k < taps; k++)
+	{
+		coeffs[k] = h0[k] + t * (h1[k] - h0[k]);
+	}
+}
+
+static float dot_c(const float* x, const float* coeffs, int taps)
+{
+	float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for (int k = 0; k < taps; k += 4)
+	{
+		sum[0] += x[k] * coeffs[k];
+		sum[1] += x[k + 1] * coeffs[k + 1];
+		sum[2] += x[k + 2] * coeffs[k + 2];
+		sum[3] += x[k + 3] * coeffs[k + 3];
+	}
+	return (sum[0] + sum[2]) + (sum[1] + sum[3]);
+}
+
+#if defined(MF_ARCH_X86)
+MF_TARGET_SSE2 static void interpolate_sse2(const float* h0, const float* h1, float t, float* coeffs, int taps)
+{
+	const __m128 factor = _mm_set1_ps(t);
+	for (int k = 0; k < taps; k += 4)
+	{
+		__m128 a = _mm_loadu_ps(h0 + k);
+		__m128 b = _mm_loadu_ps(h1 + k);
+		_mm_storeu_ps(coeffs + k, _mm_add_ps(a, _mm_mul_ps(factor, _mm_sub_ps(b, a))));
+	}
+}
+
+MF_TARGET_SSE2 static float dot_sse2(const float* x, const float* coeffs, int taps)
+{
+	__m128 sum0 = _mm_setzero_ps();
+	__m128 sum1 = _mm_setzero_ps();
+	for (int k = 0; k < taps; k += 8)
+	{
+		sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(x + k), _mm_loadu_ps(coeffs + k)));
+		sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(x + k + 4), _mm_loadu_ps(coeffs + k + 4)));
+	}
+	__m128 sum = _mm_add_ps(sum0, sum1);
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+	return _mm_cvtss_f32(sum);
+}
+
+MF_TARGET_AVX2 static void interpolate_avx2(const float* h0, const float* h1, float t, float* coeffs, int taps)
+{
+	const __m256 factor = _mm256_set1_ps(t);
+	for (int k = 0; k < taps; k += 8)
+	{
+		__m256 a = _mm256_loadu_ps(h0 + k);
+		__m256 b = _mm256_loadu_ps(h1 + k);
+		_mm256_storeu_ps(coeffs + k, _mm256_add_ps(a, _mm256_mul_ps(factor, _mm256_sub_ps(b, a))));
+	}
+}
+
+MF_TARGET_AVX2 static float dot_avx2(const float* x, const float* coeffs, int taps)
+{
+	__m256 sum0 = _mm256_setzero_ps();
+	__m256 sum1 = _mm256_setzero_ps();
+	int k = 0;
+	for (; k + 16 <= taps; k += 16)
+	{
+		sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_loadu_ps(x + k), _mm256_loadu_ps(coeffs + k)));
+		sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_loadu_ps(x + k + 8), _mm256_loadu_ps(coeffs + k + 8)));
+	}
+	if (k < taps)
+	{
+		sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_loadu_ps(x + k), _mm256_loadu_ps(coeffs + k)));
+	}
+	__m256 sum = _mm256_add_ps(sum0, sum1);
+	__m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+	half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+	half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+	return _mm_cvtss_f32(half);
+}
+#elif defined(MF_ARCH_ARM64)
+static void interpolate_neon(const float* h0, const float* h1, float t, float* coeffs, int taps)
+{
+	for (int k = 0; k < taps; k += 4)
+	{
+		float32x4_t a = vld1q_f32(h0 + k);
+		float32x4_t b = vld1q_f32(h1 + k);
+		vst1q_f32(coeffs + k, vmlaq_n_f32(a, vsubq_f32(b, a), t));
+	}
+}
+
+static float dot_neon(const float* x, const float* coeffs, int taps)
+{
+	float32x4_t sum0 = vdupq_n_f32(0.0f);
+	float32x4_t sum1 = vdupq_n_f32(0.0f);
+	for (int k = 0; k < taps; k += 8)
+	{
+		sum0 = vfmaq_f32(sum0, vld1q_f32(x + k), vld1q_f32(coeffs + k));
+		sum1 = vfmaq_f32(sum1, vld1q_f32(x + k + 4), vld1q_f32(coeffs + k + 4));
+	}
+	return vaddvq_f32(vaddq_f32(sum0, sum1));
+}
+#endif
+
+static InterpolateFunc select_interpolate()
+{
+#if defined(MF_ARCH_X86)
+	if (mf_cpu_has(CPU_FEATURE_AVX2))
+	{
+		return interpolate_avx2;
+	}
+	if (mf_cpu_has(CPU_FEATURE_SSE2))
+	{
+		return interpolate_sse2;
+	}
+#elif defined(MF_ARCH_ARM64)
+	if (mf_cpu_has(CPU_FEATURE_NEON))
+	{
+		return interpolate_neon;
+	}
+#endif
+	return interpolate_c;
+}
+
+static DotFunc select_dot()
+{
+#if defined(MF_ARCH_X86)
+	if (mf_cpu_has(CPU_FEATURE_AVX2))
+	{
+		return dot_avx2;
+	}
+	if (mf_cpu_has(CPU_FEATURE_SSE2))
+	{
+		return dot_sse2;
+	}
+#elif defined(MF_ARCH_ARM64)
+	if (mf_cpu_has(CPU_FEATURE_NEON))
+	{
+		return dot_neon;
+	}
+#endif
+	return dot_c;
+}
+
+// zeroth order modified Bessel function of the first kind, the series converges fast for the betas used here
+static double bessel_i0(double x)
+{
+	double sum = 1.0;
+	double term = 1.0;
+	double half = x / 2.0;
+	for (int k = 1; k < 50; k++)
+	{
+		term *= (half / k) * (half / k);
+		sum += term;
+		if (term < sum * 1e-17)
+		{
+			break;
+		}
+	}
+	return sum;
+}
+
+MFResampler::MFResampler()
+{
+}
+
+MFResampler::~MFResampler()
+{
+}
+
+bool MFResampler::configure(int in_rate, int out_rate, int channels, RESAMPLE_QUALITY quality)
+{
+	if (in_rate <= 0 || out_rate <= 0 || channels <= 0 || channels > RESAMPLE_MAX_CHANNELS ||
+		quality < RESAMPLE_QUALITY_LOW || quality > RESAMPLE_QUALITY_HIGH)
+	{
+		return false;
+	}
+	m_iInRate = in_rate;
+	m_iOutRate = out_rate;
+	m_iChannels = channels;
+	m_dDrift = 1.0;
+	build_filter(quality);
+	compute_step();
+	reset();
+	return true;
+}
+
+void MFResampler::set_drift(double ratio)
+{
+	if (ratio < 0.9 || ratio > 1.1)
+	{
+		return;
+	}
+	m_dDrift = ratio;
+	compute_step();
+}
+
+void MFResampler::reset()
+{
+	// half - 1 samples of silence put input sample 0 at the first position the filter can be centered on
+	m_iHistorySize = 0;
+	append_history(nullptr, m_iHalfTaps - 1);
+	m_iPosition = m_iHalfTaps - 1;
+	m_iInputEnd = m_iPosition;
+	m_iFraction = 0;
+	m_iRemainderAccumulator = 0;
+}
+
+int MFResampler::process(const float* input, int in_samples, float* output, int out_capacity)
+{
+	if (m_iChannels == 0 || in_samples < 0 || (in_samples > 0 && !input))
+	{
+		return 0;
+	}
+	append_history(input, in_samples);
+	m_iInputEnd += in_samples;
+	return produce(output, out_capacity, INT64_MAX);
+}
+
+int MFResampler::flush(float* output, int out_capacity)
+{
+	if (m_iChannels == 0)
+	{
+		return 0;
+	}
+	if (m_iHistorySize < m_iInputEnd + m_iHalfTaps)
+	{
+		append_history(nullptr, (int)(m_iInputEnd + m_iHalfTaps - m_iHistorySize));
+	}
+	int count = produce(output, out_capacity, m_iInputEnd);
+	if (count < out_capacity)
+	{
+		reset();
+	}
+	return count;
+}
+
+int MFResampler::get_max_output(int in_samples)
+{
+	if (m_iChannels == 0)
+	{
+		return 0;
+	}
+	double available = (double)m_iHistorySize + in_samples - m_iHalfTaps - m_iPosition;
+	double step = (double)m_iStep / 4294967296.0;
+	return available > 0 ? (int)(available / step) + 2 : 1;
+}
+
+int MFResampler::get_latency()
+{
+	return m_iHalfTaps;
+}
+
+double MFResampler::get_output_offset()
+{
+	return (double)(m_iPosition - m_iInputEnd) + (double)m_iFraction / 4294967296.0;
+}
+
+void MFResampler::append_history(const float* input, int samples)
+{
+	if (samples <= 0)
+	{
+		return;
+	}
+	int needed = m_iHistorySize + samples;
+	if (needed > m_iHistoryCapacity)
+	{
+		// grows to the largest chunk seen, steady state input of similar sizes does not allocate
+		int capacity = needed + needed / 2;
+		std::vector<float> history((size_t)capacity * m_iChannels);
+		for (int c = 0; c < m_iChannels; c++)
+		{
+			if (m_iHistorySize > 0)
+			{
+				memcpy(&history[(size_t)c * capacity], &m_vecHistory[(size_t)c * m_iHistoryCapacity], sizeof(float) * m_iHistorySize);
+			}
+		}
+		m_vecHistory.swap(history);
+		m_iHistoryCapacity = capacity;
+	}
+	for (int c = 0; c < m_iChannels; c++)
+	{
+		float* plane = &m_vecHistory[(size_t)c * m_iHistoryCapacity + m_iHistorySize];
+		if (!input)
+		{
+			memset(plane, 0, sizeof(float) * samples);
+			continue;
+		}
+		const float* src = input + c;
+		for (int i = 0; i < samples; i++)
+		{
+			plane[i] = src[(size_t)i * m_iChannels];
+		}
+	}
+	m_iHistorySize = needed;
+}
+
+void MFResampler::build_filter(RESAMPLE_QUALITY quality)
+{
+	const ResampleQualityParam& param = s_QualityParams[quality];
+	// down conversion lowers the cutoff below the output Nyquist and stretches the filter by the same ratio
+	double scale = m_iOutRate < m_iInRate ? (double)m_iOutRate / m_iInRate : 1.0;
+	int taps = XALIGN((int)ceil(param.taps / scale), 8);
+	m_iTaps = taps < RESAMPLE_MAX_TAPS ? taps : RESAMPLE_MAX_TAPS;
+	m_iHalfTaps = m_iTaps / 2;
+	m_iPhaseBits = param.phase_bits;
+	double cutoff = (0.5 - param.transition / 2.0) * scale; // cycles per input sample
+	int phases = 1 << m_iPhaseBits;
+	m_vecFilter.assign((size_t)(phases + 1) * m_iTaps, 0.0f);
+	m_vecCoeffs.assign(m_iTaps, 0.0f);
+	double i0_beta = bessel_i0(param.beta);
+	for (int p = 0; p <= phases; p++)
+	{
+		double fraction = (double)p / phases;
+		double sum = 0.0;
+		double coeffs[RESAMPLE_MAX_TAPS];
+		for (int k = 0; k < m_iTaps; k++)
+		{
+			double d = k - m_iHalfTaps + 1 - fraction;
+			double x = 2.0 * cutoff * d;
+			double sinc = fabs(x) < 1e-12 ? 1.0 : sin(RESAMPLE_PI * x) / (RESAMPLE_PI * x);
+			double r = d / m_iHalfTaps;
+			double window = fabs(r) >= 1.0 ? 0.0 : bessel_i0(param.beta * sqrt(1.0 - r * r)) / i0_beta;
+			coeffs[k] = 2.0 * cutoff * sinc * window;
+			sum += coeffs[k];
+		}
+		// unity gain at DC for every phase, otherwise the gain ripples with the fraction
+		for (int k = 0; k < m_iTaps; k++)
+		{
+			m_vecFilter[(size_t)p * m_iTaps + k] = (float)(coeffs[k] / sum);
+		}
+	}
+}
+
+void MFResampler::compute_step()
+{
+	if (m_dDrift == 1.0)
+	{
+		uint64_t numerator = (uint64_t)m_iInRate << 32;
+		m_iStep = numerator / (uint64_t)m_iOutRate;
+		m_iStepRemainder = numerator % (uint64_t)m_iOutRate;
+		m_iStepDenominator = (uint64_t)m_iOutRate;
+	}
+	else
+	{
+		m_iStep = (uint64_t)llround((double)m_iInRate / m_iOutRate * m_dDrift * 4294967296.0);
+		m_iStepRemainder = 0;
+		m_iStepDenominator = 1;
+	}
+	m_iRemainderAccumulator = 0;
+}
+
+int MFResampler::produce(float* output, int out_capacity, int64_t end_position)
+{
+	InterpolateFunc interpolate = select_interpolate();
+	DotFunc dot = select_dot();
+	int count = 0;
+	int phase_shift = 32 - m_iPhaseBits;
+	uint64_t phase_mask = ((uint64_t)1 << phase_shift) - 1;
+	float phase_scale = 1.0f / (float)((uint64_t)1 << phase_shift);
+	float* coeffs = m_vecCoeffs.data();
+	while (count < out_capacity && m_iPosition + m_iHalfTaps < m_iHistorySize && m_iPosition < end_position)
+	{
+		uint64_t phase = m_iFraction >> phase_shift;
+		float t = (float)(m_iFraction & phase_mask) * phase_scale;
+		const float* h0 = &m_vecFilter[phase * m_iTaps];
+		interpolate(h0, h0 + m_iTaps, t, coeffs, m_iTaps);
+		size_t start = (size_t)(m_iPosition - m_iHalfTaps + 1);
+		float* out = output + (size_t)count * m_iChannels;
+		for (int c = 0; c < m_iChannels; c++)
+		{
+			out[c] = dot(&m_vecHistory[(size_t)c * m_iHistoryCapacity + start], coeffs, m_iTaps);
+		}
+		count++;
+
+		m_iFraction += m_iStep;
+		m_iRemainderAccumulator += m_iStepRemainder;
+		if (m_iRemainderAccumulator >= m_iStepDenominator)
+		{
+			m_iRemainderAccumulator -= m_iStepDenominator;
+			m_iFraction++;
+		}
+		m_iPosition += (int64_t)(m_iFraction >> 32);
+		m_iFraction &= 0xFFFFFFFFull;
+	}
+
+	// only the window of the next output has to stay
+	int64_t discard = m_iPosition - m_iHalfTaps + 1;
+	if (discard > m_iHistorySize)
+	{
+		discard = m_iHistorySize;
+	}
+	if (discard > 0)
+	{
+		int keep = m_iHistorySize - (int)discard;
+		for (int c = 0; c < m_iChannels; c++)
+		{
+			float* plane = &m_vecHistory[(size_t)c * m_iHistoryCapacity];
+			memmove(plane, plane + discard, sizeof(float) * keep);
+		}
+		m_iHistorySize = keep;
+		m_iPosition -= discard;
+		m_iInputEnd -= discard;
+	}
+	return count;
+}
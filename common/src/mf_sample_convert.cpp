@@ -0,0 +1,909 @@
+#include "mf_sample_convert.h"
+#include "mf_cpu.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(MF_ARCH_X86)
+#include <immintrin.h>
+#elif defined(MF_ARCH_ARM64)
+#include <arm_neon.h>
+#endif
+
+#define PIVOT_VALUES 4096 // samples of all channels per block, 16 KB as float
+
+// sample types without the layout, the kernels work on flat arrays of them
+enum SAMPLE_TYPE
+{
+	SAMPLE_U8 = 0,
+	SAMPLE_S16,
+	SAMPLE_S24,
+	SAMPLE_S32,
+	SAMPLE_S64,
+	SAMPLE_FLT,
+	SAMPLE_DBL,
+	SAMPLE_TYPE_COUNT
+};
+
+static const int s_SampleBits[SAMPLE_TYPE_COUNT] = { 8, 16, 24, 32, 64, 24, 53 }; // float types count their mantissa
+
+static int get_sample_type(PCM_FORMAT format)
+{
+	switch (format)
+	{
+	case PCM_U8:
+	case PCM_U8P:
+		return SAMPLE_U8;
+	case PCM_S16:
+	case PCM_S16P:
+		return SAMPLE_S16;
+	case PCM_S24:
+	case PCM_S24P:
+		return SAMPLE_S24;
+	case PCM_S32:
+	case PCM_S32P:
+		return SAMPLE_S32;
+	case PCM_S64:
+	case PCM_S64P:
+		return SAMPLE_S64;
+	case PCM_FLT:
+	case PCM_FLTP:
+		return SAMPLE_FLT;
+	case PCM_DBL:
+	case PCM_DBLP:
+		return SAMPLE_DBL;
+	default:
+		return -1;
+	}
+}
+
+typedef void (*UnpackFunc)(const uint8_t* src, float* dst, int count);
+typedef void (*PackFunc)(const float* src, uint8_t* dst, int count);
+typedef void (*UnpackDoubleFunc)(const uint8_t* src, double* dst, int count);
+typedef void (*PackDoubleFunc)(const double* src, uint8_t* dst, int count);
+typedef void (*Interleave2Func)(const uint8_t* left, const uint8_t* right, uint8_t* dst, int count);
+typedef void (*Deinterleave2Func)(const uint8_t* src, uint8_t* left, uint8_t* right, int count);
+typedef void (*DitherFunc)(float* data, int count, uint32_t* state, float scale);
+
+template <typename T>
+static inline T load(const uint8_t* p)
+{
+	T value;
+	memcpy(&value, p, sizeof(T));
+	return value;
+}
+
+template <typename T>
+static inline void store(uint8_t* p, T value)
+{
+	memcpy(p, &value, sizeof(T));
+}
+
+// NaN compares false and ends up at lo, like max / min in the SIMD kernels
+static inline float clamp(float value, float lo, float hi)
+{
+	value = value > lo ? value : lo;
+	return value < hi ? value : hi;
+}
+
+static inline double clamp(double value, double lo, double hi)
+{
+	value = value > lo ? value : lo;
+	return value < hi ? value : hi;
+}
+
+// scalar kernels, full range in float is [-1, 1)
+
+static void unpack_u8_c(const uint8_t* src, float* dst, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		dst[i] = (float)(src[i] - 128) * (1.0f / 128.0f);
+	}
+}
+
+static void unpack_s16_c(const uint8_t* src, float* dst, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		dst[i] = (float)load<int16_t>(src + i * 2) * (1.0f / 32768.0f);
+	}
+}
+
+static void unpack_s24_c(const uint8_t* src, float* dst, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		const uint8_t* p = src + i * 3;
+		int32_t value = (int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 24)) >> 8;
+		dst[i] = (float)value * (1.0f / 8388608.0f);
+	}
+}
+
+static void unpack_s32_c(const uint8_t* src, float* dst, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		dst[i] = (float)load<int32_t>(src + i * 4) * (1.0f / 2147483648.0f);
+	}
+}
+
+static void unpack_s64_c(const uint8_t* src, float* dst, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		dst[i] = (float)((double)load<int64_t>(src + i * 8) * (1.0 / 9223372036854775808.0));
+	}
+}
+
+static void unpack_flt_c(const uint8_t* src, float* dst, int count)
+{
+	memcpy(dst, src, (size_t)count * 4);
+}
+
+static void unpack_dbl_c(const uint8_t* src, float* dst, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		dst[i] = (float)load<double>(src + i * 8);
+	}
+}
+
+static void pack_u8_c(const float* src, uint8_t* dst, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		dst[i] = (uint8_t)(lrintf(clamp(src[i] * 128.0f, -128.0f, 127.0f)) + 128);
+	}
+}
+
+static void pack_s16_c(const float* src, uint8_t* dst, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		store<int16_t>(dst + i * 2, (int16_t)lrintf(clamp(src[i] * 32768.0f, -32768.0f, 32767.0f)));
+	}
+}
+
+static void pack_s24_c(const float* src, uint8_t* dst, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		int32_t value = (int32_t)lrintf(clamp(src[i] * 8388608.0f, -8388608.0f, 8388607.0f));
+		uint8_t* p = dst + i * 3;
+		p[0] = (uint8_t)value;
+		p[1] = (uint8_t)(value >> 8);
+		p[2] = (uint8_t)(value >> 16);
+	}
+}
+
+// 2147483520 is the largest float below 2^31
+static void pack_s32_c(const float* src, uint8_t* dst, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		store<int32_t>(dst + i * 4, (int32_t)lrintf(clamp(src[i] * 2147483648.0f, -2147483648.0f, 2147483520.0f)));
+	}
+}
+
+static void pack_s64_c(const float* src, uint8_t* dst, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		// a float below 1.0 keeps the product below 2^63
+		double value = clamp((double)src[i], -1.0, 0.99999994039535522);
+		store<int64_t>(dst + i * 8, llrint(value * 9223372036854775808.0));
+	}
+}
+
+static void pack_flt_c(const float* src, uint8_t* dst, int count)
+{
+	memcpy(dst, src, (size_t)count * 4);
+}
+
+static void pack_dbl_c(const float* src, uint8_t* dst, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		store<double>(dst + i * 8, (double)src[i]);
+	}
+}
+
+// double pivot, only between the types wider than a float mantissa
+
+static void unpack_s32_d(const uint8_t* src, double* dst, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		dst[i] = (double)load<int32_t>(src + i * 4) * (1.0 / 2147483648.0);
+	}
+}
+
+static void unpack_s64_d(const uint8_t* src, double* dst, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		dst[i] = (double)load<int64_t>(src + i * 8) * (1.0 / 9223372036854775808.0);
+	}
+}
+
+static void unpack_dbl_d(const uint8_t* src, double* dst, int count)
+{
+	memcpy(dst, src, (size_t)count * 8);
+}
+
+static void pack_s32_d(const double* src, uint8_t* dst, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		store<int32_t>(dst + i * 4, (int32_t)llrint(clamp(src[i] * 2147483648.0, -2147483648.0, 2147483647.0)));
+	}
+}
+
+// 9223372036854774784 is the largest double below 2^63
+static void pack_s64_d(const double* src, uint8_t* dst, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		store<int64_t>(dst + i * 8, llrint(clamp(src[i] * 9223372036854775808.0, -9223372036854775808.0, 9223372036854774784.0)));
+	}
+}
+
+static void pack_dbl_d(const double* src, uint8_t* dst, int count)
+{
+	memcpy(dst, src, (size_t)count * 8);
+}
+
+static void interleave2_c(const uint8_t* left, const uint8_t* right, uint8_t* dst, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		store<uint32_t>(dst + i * 8, load<uint32_t>(left + i * 4));
+		store<uint32_t>(dst + i * 8 + 4, load<uint32_t>(right + i * 4));
+	}
+}
+
+static void deinterleave2_c(const uint8_t* src, uint8_t* left, uint8_t* right, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		store<uint32_t>(left + i * 4, load<uint32_t>(src + i * 8));
+		store<uint32_t>(right + i * 4, load<uint32_t>(src + i * 8 + 4));
+	}
+}
+
+// MF_DITHER_LANES independent xorshift32 generators, sample i always takes lane i % MF_DITHER_LANES so the SIMD kernels
+// produce the same noise. the difference of the two 16 bit halves is triangular
+static inline float dither_step(uint32_t& state, float scale)
+{
+	uint32_t value = state;
+	value ^= value << 13;
+	value ^= value >> 17;
+	value ^= value << 5;
+	state = value;
+	return (float)((int32_t)(value & 0xFFFF) - (int32_t)(value >> 16)) * scale;
+}
+
+static void dither_c(float* data, int count, uint32_t* state, float scale)
+{
+	int i = 0;
+	for (; i + MF_DITHER_LANES <= count; i += MF_DITHER_LANES)
+	{
+		for (int lane = 0; lane < MF_DITHER_LANES; lane++)
+		{
+			data[i + lane] += dither_step(state[lane], scale);
+		}
+	}
+	for (int lane = 0; i < count; i++, lane++)
+	{
+		data[i] += dither_step(state[lane], scale);
+	}
+}
+
+#if defined(MF_ARCH_X86)
+MF_TARGET_SSE2 static inline __m128 dither_step_sse2(__m128i& state, __m128 scale)
+{
+	const __m128i mask = _mm_set1_epi32(0xFFFF);
+	__m128i value = state;
+	value = _mm_xor_si128(value, _mm_slli_epi32(value, 13));
+	value = _mm_xor_si128(value, _mm_srli_epi32(value, 17));
+	value = _mm_xor_si128(value, _mm_slli_epi32(value, 5));
+	state = value;
+	__m128i noise = _mm_sub_epi32(_mm_and_si128(value, mask), _mm_srli_epi32(value, 16));
+	return _mm_mul_ps(_mm_cvtepi32_ps(noise), scale);
+}
+
+MF_TARGET_SSE2 static void dither_sse2(float* data, int count, uint32_t* state, float scale)
+{
+	__m128i lo = _mm_loadu_si128((const __m128i*)state);
+	__m128i hi = _mm_loadu_si128((const __m128i*)(state + 4));
+	const __m128 factor = _mm_set1_ps(scale);
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		_mm_storeu_ps(data + i, _mm_add_ps(_mm_loadu_ps(data + i), dither_step_sse2(lo, factor)));
+		_mm_storeu_ps(data + i + 4, _mm_add_ps(_mm_loadu_ps(data + i + 4), dither_step_sse2(hi, factor)));
+	}
+	_mm_storeu_si128((__m128i*)state, lo);
+	_mm_storeu_si128((__m128i*)(state + 4), hi);
+	dither_c(data + i, count - i, state, scale);
+}
+
+MF_TARGET_SSE2 static void unpack_s16_sse2(const uint8_t* src, float* dst, int count)
+{
+	const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i value = _mm_loadu_si128((const __m128i*)(src + i * 2));
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(value, value), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(value, value), 16);
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+		_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+	}
+	unpack_s16_c(src + i * 2, dst + i, count - i);
+}
+
+// cvtps rounds to nearest even like lrintf under the default rounding mode
+MF_TARGET_SSE2 static void pack_s16_sse2(const float* src, uint8_t* dst, int count)
+{
+	const __m128 scale = _mm_set1_ps(32768.0f);
+	const __m128 lo = _mm_set1_ps(-32768.0f);
+	const __m128 hi = _mm_set1_ps(32767.0f);
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i), scale), lo), hi);
+		__m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i + 4), scale), lo), hi);
+		_mm_storeu_si128((__m128i*)(dst + i * 2), _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+	}
+	pack_s16_c(src + i, dst + i * 2, count - i);
+}
+
+MF_TARGET_SSE2 static void unpack_s32_sse2(const uint8_t* src, float* dst, int count)
+{
+	const __m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i value = _mm_loadu_si128((const __m128i*)(src + i * 4));
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(value), scale));
+	}
+	unpack_s32_c(src + i * 4, dst + i, count - i);
+}
+
+MF_TARGET_SSE2 static void pack_s32_sse2(const float* src, uint8_t* dst, int count)
+{
+	const __m128 scale = _mm_set1_ps(2147483648.0f);
+	const __m128 lo = _mm_set1_ps(-2147483648.0f);
+	const __m128 hi = _mm_set1_ps(2147483520.0f);
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 value = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i), scale), lo), hi);
+		_mm_storeu_si128((__m128i*)(dst + i * 4), _mm_cvtps_epi32(value));
+	}
+	pack_s32_c(src + i, dst + i * 4, count - i);
+}
+
+MF_TARGET_SSE2 static void interleave2_sse2(const uint8_t* left, const uint8_t* right, uint8_t* dst, int count)
+{
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 l = _mm_loadu_ps((const float*)(left + i * 4));
+		__m128 r = _mm_loadu_ps((const float*)(right + i * 4));
+		_mm_storeu_ps((float*)(dst + i * 8), _mm_unpacklo_ps(l, r));
+		_mm_storeu_ps((float*)(dst + i * 8 + 16), _mm_unpackhi_ps(l, r));
+	}
+	interleave2_c(left + i * 4, right + i * 4, dst + i * 8, count - i);
+}
+
+MF_TARGET_SSE2 static void deinterleave2_sse2(const uint8_t* src, uint8_t* left, uint8_t* right, int count)
+{
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 a = _mm_loadu_ps((const float*)(src + i * 8));
+		__m128 b = _mm_loadu_ps((const float*)(src + i * 8 + 16));
+		_mm_storeu_ps((float*)(left + i * 4), _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm_storeu_ps((float*)(right + i * 4), _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+	}
+	deinterleave2_c(src + i * 8, left + i * 4, right + i * 4, count - i);
+}
+
+MF_TARGET_AVX2 static void unpack_s16_avx2(const uint8_t* src, float* dst, int count)
+{
+	const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+	int i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + i * 2)));
+		__m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + i * 2 + 16)));
+		_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), scale));
+		_mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), scale));
+	}
+	unpack_s16_c(src + i * 2, dst + i, count - i);
+}
+
+MF_TARGET_AVX2 static void pack_s16_avx2(const float* src, uint8_t* dst, int count)
+{
+	const __m256 scale = _mm256_set1_ps(32768.0f);
+	const __m256 lo = _mm256_set1_ps(-32768.0f);
+	const __m256 hi = _mm256_set1_ps(32767.0f);
+	int i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src + i), scale), lo), hi);
+		__m256 b = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src + i + 8), scale), lo), hi);
+		// packs works per 128 bit lane, the permute restores the sample order
+		__m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+		_mm256_storeu_si256((__m256i*)(dst + i * 2), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+	pack_s16_c(src + i, dst + i * 2, count - i);
+}
+
+MF_TARGET_AVX2 static void unpack_s32_avx2(const uint8_t* src, float* dst, int count)
+{
+	const __m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i value = _mm256_loadu_si256((const __m256i*)(src + i * 4));
+		_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(value), scale));
+	}
+	unpack_s32_c(src + i * 4, dst + i, count - i);
+}
+
+MF_TARGET_AVX2 static void pack_s32_avx2(const float* src, uint8_t* dst, int count)
+{
+	const __m256 scale = _mm256_set1_ps(2147483648.0f);
+	const __m256 lo = _mm256_set1_ps(-2147483648.0f);
+	const __m256 hi = _mm256_set1_ps(2147483520.0f);
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 value = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src + i), scale), lo), hi);
+		_mm256_storeu_si256((__m256i*)(dst + i * 4), _mm256_cvtps_epi32(value));
+	}
+	pack_s32_c(src + i, dst + i * 4, count - i);
+}
+
+MF_TARGET_AVX2 static void dither_avx2(float* data, int count, uint32_t* state, float scale)
+{
+	const __m256i mask = _mm256_set1_epi32(0xFFFF);
+	const __m256 factor = _mm256_set1_ps(scale);
+	__m256i value = _mm256_loadu_si256((const __m256i*)state);
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		value = _mm256_xor_si256(value, _mm256_slli_epi32(value, 13));
+		value = _mm256_xor_si256(value, _mm256_srli_epi32(value, 17));
+		value = _mm256_xor_si256(value, _mm256_slli_epi32(value, 5));
+		__m256i noise = _mm256_sub_epi32(_mm256_and_si256(value, mask), _mm256_srli_epi32(value, 16));
+		_mm256_storeu_ps(data + i, _mm256_add_ps(_mm256_loadu_ps(data + i), _mm256_mul_ps(_mm256_cvtepi32_ps(noise), factor)));
+	}
+	_mm256_storeu_si256((__m256i*)state, value);
+	dither_c(data + i, count - i, state, scale);
+}
+#elif defined(MF_ARCH_ARM64)
+static void unpack_s16_neon(const uint8_t* src, float* dst, int count)
+{
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		int16x8_t value = vld1q_s16((const int16_t*)(src + i * 2));
+		vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(value))), 1.0f / 32768.0f));
+		vst1q_f32(dst + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(value))), 1.0f / 32768.0f));
+	}
+	unpack_s16_c(src + i * 2, dst + i, count - i);
+}
+
+// vmaxnm returns the number when the other operand is NaN, NaN ends up at lo as in the scalar kernel
+static void pack_s16_neon(const float* src, uint8_t* dst, int count)
+{
+	const float32x4_t lo = vdupq_n_f32(-32768.0f);
+	const float32x4_t hi = vdupq_n_f32(32767.0f);
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		float32x4_t a = vminnmq_f32(vmaxnmq_f32(vmulq_n_f32(vld1q_f32(src + i), 32768.0f), lo), hi);
+		float32x4_t b = vminnmq_f32(vmaxnmq_f32(vmulq_n_f32(vld1q_f32(src + i + 4), 32768.0f), lo), hi);
+		int16x8_t packed = vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(a)), vqmovn_s32(vcvtnq_s32_f32(b)));
+		vst1q_s16((int16_t*)(dst + i * 2), packed);
+	}
+	pack_s16_c(src + i, dst + i * 2, count - i);
+}
+
+static void unpack_s32_neon(const uint8_t* src, float* dst, int count)
+{
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		int32x4_t value = vld1q_s32((const int32_t*)(src + i * 4));
+		vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(value), 1.0f / 2147483648.0f));
+	}
+	unpack_s32_c(src + i * 4, dst + i, count - i);
+}
+
+static void pack_s32_neon(const float* src, uint8_t* dst, int count)
+{
+	const float32x4_t lo = vdupq_n_f32(-2147483648.0f);
+	const float32x4_t hi = vdupq_n_f32(2147483520.0f);
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		float32x4_t value = vminnmq_f32(vmaxnmq_f32(vmulq_n_f32(vld1q_f32(src + i), 2147483648.0f), lo), hi);
+		vst1q_s32((int32_t*)(dst + i * 4), vcvtnq_s32_f32(value));
+	}
+	pack_s32_c(src + i, dst + i * 4, count - i);
+}
+
+static void interleave2_neon(const uint8_t* left, const uint8_t* right, uint8_t* dst, int count)
+{
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		uint32x4x2_t value = { { vld1q_u32((const uint32_t*)(left + i * 4)), vld1q_u32((const uint32_t*)(right + i * 4)) } };
+		vst2q_u32((uint32_t*)(dst + i * 8), value);
+	}
+	interleave2_c(left + i * 4, right + i * 4, dst + i * 8, count - i);
+}
+
+static void deinterleave2_neon(const uint8_t* src, uint8_t* left, uint8_t* right, int count)
+{
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		uint32x4x2_t value = vld2q_u32((const uint32_t*)(src + i * 8));
+		vst1q_u32((uint32_t*)(left + i * 4), value.val[0]);
+		vst1q_u32((uint32_t*)(right + i * 4), value.val[1]);
+	}
+	deinterleave2_c(src + i * 8, left + i * 4, right + i * 4, count - i);
+}
+
+static inline float32x4_t dither_step_neon(uint32x4_t& state, float scale)
+{
+	uint32x4_t value = state;
+	value = veorq_u32(value, vshlq_n_u32(value, 13));
+	value = veorq_u32(value, vshrq_n_u32(value, 17));
+	value = veorq_u32(value, vshlq_n_u32(value, 5));
+	state = value;
+	int32x4_t noise = vsubq_s32(vreinterpretq_s32_u32(vandq_u32(value, vdupq_n_u32(0xFFFF))), vreinterpretq_s32_u32(vshrq_n_u32(value, 16)));
+	return vmulq_n_f32(vcvtq_f32_s32(noise), scale);
+}
+
+static void dither_neon(float* data, int count, uint32_t* state, float scale)
+{
+	uint32x4_t lo = vld1q_u32(state);
+	uint32x4_t hi = vld1q_u32(state + 4);
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		vst1q_f32(data + i, vaddq_f32(vld1q_f32(data + i), dither_step_neon(lo, scale)));
+		vst1q_f32(data + i + 4, vaddq_f32(vld1q_f32(data + i + 4), dither_step_neon(hi, scale)));
+	}
+	vst1q_u32(state, lo);
+	vst1q_u32(state + 4, hi);
+	dither_c(data + i, count - i, state, scale);
+}
+#endif
+
+struct SampleKernels
+{
+	UnpackFunc unpack[SAMPLE_TYPE_COUNT];
+	PackFunc pack[SAMPLE_TYPE_COUNT];
+	UnpackDoubleFunc unpack_double[SAMPLE_TYPE_COUNT]; // S32, S64 and DBL only
+	PackDoubleFunc pack_double[SAMPLE_TYPE_COUNT];
+	Interleave2Func interleave2; // any 4 byte samples, moved bit exact
+	Deinterleave2Func deinterleave2;
+	DitherFunc dither;
+};
+
+static SampleKernels select_kernels()
+{
+	SampleKernels kernels = {
+		{ unpack_u8_c, unpack_s16_c, unpack_s24_c, unpack_s32_c, unpack_s64_c, unpack_flt_c, unpack_dbl_c },
+		{ pack_u8_c, pack_s16_c, pack_s24_c, pack_s32_c, pack_s64_c, pack_flt_c, pack_dbl_c },
+		{ nullptr, nullptr, nullptr, unpack_s32_d, unpack_s64_d, nullptr, unpack_dbl_d },
+		{ nullptr, nullptr, nullptr, pack_s32_d, pack_s64_d, nullptr, pack_dbl_d },
+		interleave2_c,
+		deinterleave2_c,
+		dither_c
+	};
+#if defined(MF_ARCH_X86)
+	if (mf_cpu_has(CPU_FEATURE_SSE2))
+	{
+		kernels.unpack[SAMPLE_S16] = unpack_s16_sse2;
+		kernels.pack[SAMPLE_S16] = pack_s16_sse2;
+		kernels.unpack[SAMPLE_S32] = unpack_s32_sse2;
+		kernels.pack[SAMPLE_S32] = pack_s32_sse2;
+		kernels.interleave2 = interleave2_sse2;
+		kernels.deinterleave2 = deinterleave2_sse2;
+		kernels.dither = dither_sse2;
+	}
+	if (mf_cpu_has(CPU_FEATURE_AVX2))
+	{
+		kernels.unpack[SAMPLE_S16] = unpack_s16_avx2;
+		kernels.pack[SAMPLE_S16] = pack_s16_avx2;
+		kernels.unpack[SAMPLE_S32] = unpack_s32_avx2;
+		kernels.pack[SAMPLE_S32] = pack_s32_avx2;
+		kernels.dither = dither_avx2;
+	}
+#elif defined(MF_ARCH_ARM64)
+	if (mf_cpu_has(CPU_FEATURE_NEON))
+	{
+		kernels.unpack[SAMPLE_S16] = unpack_s16_neon;
+		kernels.pack[SAMPLE_S16] = pack_s16_neon;
+		kernels.unpack[SAMPLE_S32] = unpack_s32_neon;
+		kernels.pack[SAMPLE_S32] = pack_s32_neon;
+		kernels.interleave2 = interleave2_neon;
+		kernels.deinterleave2 = deinterleave2_neon;
+		kernels.dither = dither_neon;
+	}
+#endif
+	return kernels;
+}
+
+// layout changes move whole samples of size bytes and never look at their value
+template <typename T>
+static void interleave_typed(const uint8_t* const* planes, uint8_t* dst, int channels, int count)
+{
+	for (int c = 0; c < channels; c++)
+	{
+		const uint8_t* src = planes[c];
+		uint8_t* out = dst + c * sizeof(T);
+		for (int i = 0; i < count; i++)
+		{
+			store<T>(out + (size_t)i * channels * sizeof(T), load<T>(src + i * sizeof(T)));
+		}
+	}
+}
+
+template <typename T>
+static void deinterleave_typed(const uint8_t* src, uint8_t* const* planes, int channels, int count)
+{
+	for (int c = 0; c < channels; c++)
+	{
+		const uint8_t* in = src + c * sizeof(T);
+		uint8_t* dst = planes[c];
+		for (int i = 0; i < count; i++)
+		{
+			store<T>(dst + i * sizeof(T), load<T>(in + (size_t)i * channels * sizeof(T)));
+		}
+	}
+}
+
+static void interleave(const SampleKernels& kernels, const uint8_t* const* planes, uint8_t* dst, int channels, int count, int size)
+{
+	if (size == 4 && channels == 2)
+	{
+		kernels.interleave2(planes[0], planes[1], dst, count);
+		return;
+	}
+	switch (size)
+	{
+	case 1:
+		interleave_typed<uint8_t>(planes, dst, channels, count);
+		break;
+	case 2:
+		interleave_typed<uint16_t>(planes, dst, channels, count);
+		break;
+	case 4:
+		interleave_typed<uint32_t>(planes, dst, channels, count);
+		break;
+	case 8:
+		interleave_typed<uint64_t>(planes, dst, channels, count);
+		break;
+	default:
+		for (int c = 0; c < channels; c++)
+		{
+			for (int i = 0; i < count; i++)
+			{
+				memcpy(dst + ((size_t)i * channels + c) * size, planes[c] + (size_t)i * size, size);
+			}
+		}
+		break;
+	}
+}
+
+static void deinterleave(const SampleKernels& kernels, const uint8_t* src, uint8_t* const* planes, int channels, int count, int size)
+{
+	if (size == 4 && channels == 2)
+	{
+		kernels.deinterleave2(src, planes[0], planes[1], count);
+		return;
+	}
+	switch (size)
+	{
+	case 1:
+		deinterleave_typed<uint8_t>(src, planes, channels, count);
+		break;
+	case 2:
+		deinterleave_typed<uint16_t>(src, planes, channels, count);
+		break;
+	case 4:
+		deinterleave_typed<uint32_t>(src, planes, channels, count);
+		break;
+	case 8:
+		deinterleave_typed<uint64_t>(src, planes, channels, count);
+		break;
+	default:
+		for (int c = 0; c < channels; c++)
+		{
+			for (int i = 0; i < count; i++)
+			{
+				memcpy(planes[c] + (size_t)i * size, src + ((size_t)i * channels + c) * size, size);
+			}
+		}
+		break;
+	}
+}
+
+MFSampleConverter::MFSampleConverter()
+{
+}
+
+MFSampleConverter::~MFSampleConverter()
+{
+	mf_aligned_free(m_pPivot);
+}
+
+bool MFSampleConverter::configure(PCM_FORMAT in_format, PCM_FORMAT out_format, int channels)
+{
+	int in_type = get_sample_type(in_format);
+	int out_type = get_sample_type(out_format);
+	if (in_type < 0 || out_type < 0 || channels <= 0 || channels > MF_MAX_CONVERT_CHANNELS)
+	{
+		return false;
+	}
+	if (!m_pPivot)
+	{
+		m_pPivot = (uint8_t*)mf_aligned_malloc(PIVOT_VALUES * sizeof(double) * 2, MF_CACHE_LINE);
+		if (!m_pPivot)
+		{
+			return false;
+		}
+	}
+	m_eInFormat = in_format;
+	m_eOutFormat = out_format;
+	m_iChannels = channels;
+	m_iInType = in_type;
+	m_iOutType = out_type;
+	m_bInPlanar = mf_pcm_is_planar(in_format);
+	m_bOutPlanar = mf_pcm_is_planar(out_format);
+	SampleKernels kernels = select_kernels();
+	m_bDoublePivot = kernels.unpack_double[in_type] && kernels.pack_double[out_type];
+	m_iBlockSamples = PIVOT_VALUES / channels;
+	set_dither(m_eDitherMode);
+	return true;
+}
+
+void MFSampleConverter::set_dither(DITHER_MODE mode)
+{
+	m_eDitherMode = mode;
+	int out_bits = s_SampleBits[m_iOutType];
+	m_bDither = mode == DITHER_TPDF && m_iInType != m_iOutType && out_bits <= 16 && s_SampleBits[m_iInType] > out_bits;
+	// two 16 bit uniforms per draw, their difference spans +-1 LSB of the output
+	m_fDitherScale = m_bDither ? 1.0f / (float)(1 << (out_bits - 1)) / 65536.0f : 0.0f;
+}
+
+bool MFSampleConverter::convert(const uint8_t* const* in, uint8_t* const* out, int samples)
+{
+	if (m_iChannels == 0 || !in || !out || samples < 0)
+	{
+		return false;
+	}
+	int in_planes = m_bInPlanar ? m_iChannels : 1;
+	int out_planes = m_bOutPlanar ? m_iChannels : 1;
+	for (int c = 0; c < in_planes; c++)
+	{
+		if (!in[c])
+		{
+			return false;
+		}
+	}
+	for (int c = 0; c < out_planes; c++)
+	{
+		if (!out[c])
+		{
+			return false;
+		}
+	}
+	if (m_iInType == m_iOutType)
+	{
+		SampleKernels kernels = select_kernels();
+		int size = mf_pcm_bytes_per_sample(m_eInFormat);
+		if (m_bInPlanar == m_bOutPlanar)
+		{
+			size_t plane_bytes = (size_t)samples * size * (m_bInPlanar ? 1 : m_iChannels);
+			for (int c = 0; c < in_planes; c++)
+			{
+				if (out[c] != in[c])
+				{
+					memmove(out[c], in[c], plane_bytes);
+				}
+			}
+		}
+		else if (m_bInPlanar)
+		{
+			interleave(kernels, in, out[0], m_iChannels, samples, size);
+		}
+		else
+		{
+			deinterleave(kernels, in[0], out, m_iChannels, samples, size);
+		}
+		return true;
+	}
+	for (int offset = 0; offset < samples; offset += m_iBlockSamples)
+	{
+		int count = samples - offset < m_iBlockSamples ? samples - offset : m_iBlockSamples;
+		convert_block(in, out, offset, count);
+	}
+	return true;
+}
+
+void MFSampleConverter::convert_block(const uint8_t* const* in, uint8_t* const* out, int offset, int samples)
+{
+	// selected per block rather than once so mf_cpu_feature_mask() applies to converters already configured
+	SampleKernels kernels = select_kernels();
+	int channels = m_iChannels;
+	int in_size = mf_pcm_bytes_per_sample(m_eInFormat);
+	int out_size = mf_pcm_bytes_per_sample(m_eOutFormat);
+	int pivot_size = m_bDoublePivot ? 8 : 4;
+	size_t plane_stride = (size_t)m_iBlockSamples * pivot_size;
+	uint8_t* pivot = m_pPivot;
+	uint8_t* spare = m_pPivot + PIVOT_VALUES * sizeof(double);
+	uint8_t* pivot_planes[MF_MAX_CONVERT_CHANNELS];
+	uint8_t* spare_planes[MF_MAX_CONVERT_CHANNELS];
+	for (int c = 0; c < channels; c++)
+	{
+		pivot_planes[c] = pivot + c * plane_stride;
+		spare_planes[c] = spare + c * plane_stride;
+	}
+
+	// sample type to pivot in the input layout. a planar pivot keeps m_iBlockSamples values per plane
+	int in_planes = m_bInPlanar ? channels : 1;
+	int in_count = m_bInPlanar ? samples : samples * channels;
+	size_t in_offset = (size_t)offset * in_size * (m_bInPlanar ? 1 : channels);
+	for (int c = 0; c < in_planes; c++)
+	{
+		if (m_bDoublePivot)
+		{
+			kernels.unpack_double[m_iInType](in[c] + in_offset, (double*)pivot_planes[c], in_count);
+		}
+		else
+		{
+			kernels.unpack[m_iInType](in[c] + in_offset, (float*)pivot_planes[c], in_count);
+		}
+	}
+
+	if (m_bInPlanar && !m_bOutPlanar)
+	{
+		interleave(kernels, pivot_planes, spare, channels, samples, pivot_size);
+		memcpy(pivot_planes, spare_planes, sizeof(uint8_t*) * channels);
+	}
+	else if (!m_bInPlanar && m_bOutPlanar)
+	{
+		deinterleave(kernels, pivot, spare_planes, channels, samples, pivot_size);
+		memcpy(pivot_planes, spare_planes, sizeof(uint8_t*) * channels);
+	}
+
+	int out_planes = m_bOutPlanar ? channels : 1;
+	int out_count = m_bOutPlanar ? samples : samples * channels;
+	size_t out_offset = (size_t)offset * out_size * (m_bOutPlanar ? 1 : channels);
+	for (int c = 0; c < out_planes; c++)
+	{
+		if (m_bDoublePivot)
+		{
+			kernels.pack_double[m_iOutType]((const double*)pivot_planes[c], out[c] + out_offset, out_count);
+		}
+		else
+		{
+			if (m_bDither)
+			{
+				kernels.dither((float*)pivot_planes[c], out_count, m_iDitherState, m_fDitherScale);
+			}
+			kernels.pack[m_iOutType]((const float*)pivot_planes[c], out[c] + out_offset, out_count);
+		}
+	}
+}
@@ -0,0 +1,189 @@
+#include "mf_video_frame.h"
+#include <mutex>
+#include <new>
+
+// headers of released frames are kept for the next wrap, so capture in steady state never allocates one
+#define HEADER_CACHE_SIZE 64
+
+static std::mutex s_mtHeaderCache;
+static VideoFrame* s_pHeaderCache[HEADER_CACHE_SIZE];
+static int s_iHeaderCount = 0;
+
+static VideoFrame* new_header()
+{
+	{
+		std::lock_guard<std::mutex> lock(s_mtHeaderCache);
+		if (s_iHeaderCount > 0)
+		{
+			return s_pHeaderCache[--s_iHeaderCount];
+		}
+	}
+	return new (std::nothrow) VideoFrame();
+}
+
+static void free_header(VideoFrame* frame)
+{
+	{
+		std::lock_guard<std::mutex> lock(s_mtHeaderCache);
+		if (s_iHeaderCount < HEADER_CACHE_SIZE)
+		{
+			s_pHeaderCache[s_iHeaderCount++] = frame;
+			return;
+		}
+	}
+	delete frame;
+}
+
+void mf_video_frame_init(VideoFrame& frame, PIXEL_FORMAT format, int width, int height, uint8_t* base, int stride)
+{
+	frame.format = format;
+	frame.width = width;
+	frame.height = height;
+	for (int i = 0; i < MF_MAX_PLANES; i++)
+	{
+		frame.data[i] = nullptr;
+		frame.stride[i] = 0;
+	}
+	frame.timestamp = -1;
+	frame.unchanged = false;
+	frame.owner = nullptr;
+	frame.opaque = nullptr;
+	frame.ref_count.store(0, std::memory_order_relaxed);
+
+	frame.data[0] = base;
+	frame.stride[0] = stride;
+	if (base == nullptr || mf_pixel_plane_count(format) == 1)
+	{
+		return;
+	}
+	// chroma follows the whole luma plane, bottom-up layouts only exist for the packed rgb formats
+	uint8_t* chroma = base + (size_t)(stride < 0 ? -stride : stride) * height;
+	int chroma_rows = mf_pixel_plane_rows(format, 1, height);
+	if (format == PIXEL_NV12)
+	{
+		frame.data[1] = chroma;
+		frame.stride[1] = stride;
+	}
+	else
+	{
+		int chroma_stride = (stride + 1) / 2;
+		uint8_t* second = chroma + (size_t)chroma_stride * chroma_rows;
+		frame.data[1] = format == PIXEL_YV12 ? second : chroma;
+		frame.data[2] = format == PIXEL_YV12 ? chroma : second;
+		frame.stride[1] = chroma_stride;
+		frame.stride[2] = chroma_stride;
+	}
+}
+
+int mf_video_frame_aligned_stride(PIXEL_FORMAT format, int width)
+{
+	// every row starts on a cache line, so the SIMD converters never split a load across two
+	int stride = XALIGN(width * mf_pixel_bytes_per_pixel(format), MF_CACHE_LINE);
+	if (mf_pixel_plane_count(format) == 3)
+	{
+		stride = XALIGN(stride, MF_CACHE_LINE * 2);
+	}
+	return stride;
+}
+
+size_t mf_video_frame_size(PIXEL_FORMAT format, int height, int stride)
+{
+	size_t luma_stride = (size_t)(stride < 0 ? -stride : stride);
+	size_t chroma_rows = (size_t)mf_pixel_plane_rows(format, 1, height);
+	switch (mf_pixel_plane_count(format))
+	{
+	case 3:
+		return luma_stride * height + (luma_stride + 1) / 2 * 2 * chroma_rows;
+	case 2:
+		return luma_stride * height + luma_stride * chroma_rows;
+	default:
+		return luma_stride * height;
+	}
+}
+
+VideoFrame* mf_video_frame_alloc(PIXEL_FORMAT format, int width, int height)
+{
+	if (mf_pixel_bytes_per_pixel(format) == 0 || width <= 0 || height <= 0)
+	{
+		return nullptr;
+	}
+	int stride = mf_video_frame_aligned_stride(format, width);
+	uint8_t* base = (uint8_t*)mf_aligned_malloc(mf_video_frame_size(format, height, stride), MF_CACHE_LINE);
+	if (base == nullptr)
+	{
+		return nullptr;
+	}
+	VideoFrame* frame = new_header();
+	if (frame == nullptr)
+	{
+		mf_aligned_free(base);
+		return nullptr;
+	}
+	mf_video_frame_init(*frame, format, width, height, base, stride);
+	frame->ref_count.store(1, std::memory_order_relaxed);
+	return frame;
+}
+
+VideoFrame* mf_video_frame_wrap(PIXEL_FORMAT format, int width, int height, uint8_t* base, int stride, MFVideoFrameOwner* owner, void* opaque)
+{
+	VideoFrame* frame = new_header();
+	if (frame == nullptr)
+	{
+		return nullptr;
+	}
+	mf_video_frame_init(*frame, format, width, height, base, stride);
+	frame->owner = owner;
+	frame->opaque = opaque;
+	frame->ref_count.store(1, std::memory_order_relaxed);
+	return frame;
+}
+
+VideoFrame* mf_video_frame_ref(VideoFrame* frame)
+{
+	if (frame)
+	{
+		frame->ref_count.fetch_add(1, std::memory_order_relaxed);
+	}
+	return frame;
+}
+
+void mf_video_frame_unref(VideoFrame* frame)
+{
+	if (frame == nullptr || frame->ref_count.fetch_sub(1, std::memory_order_acq_rel) != 1)
+	{
+		return;
+	}
+	if (frame->owner)
+	{
+		frame->owner->release_frame(frame);
+	}
+	else
+	{
+		mf_aligned_free(frame->data[0]);
+	}
+	free_header(frame);
+}
+
+bool mf_video_frame_is_contiguous(const VideoFrame& frame)
+{
+	int planes = mf_pixel_plane_count(frame.format);
+	int luma_stride = frame.width * mf_pixel_bytes_per_pixel(frame.format);
+	if (planes == 0 || frame.data[0] == nullptr || frame.stride[0] != luma_stride)
+	{
+		return false;
+	}
+	if (planes == 1)
+	{
+		return true;
+	}
+	VideoFrame packed;
+	mf_video_frame_init(packed, frame.format, frame.width, frame.height, frame.data[0], luma_stride);
+	for (int i = 1; i < planes; i++)
+	{
+		if (frame.data[i] != packed.data[i] || frame.stride[i] != packed.stride[i])
+		{
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,53 @@
+#ifndef MF_BITSTREAM_ARENA_H
+#define MF_BITSTREAM_ARENA_H
+
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+
+struct BitstreamBlock;
+
+struct BitstreamLease
+{
+	uint8_t* data;
+	unsigned long size;
+	unsigned long capacity;
+	BitstreamBlock* block;
+};
+
+// Pool of reusable bitstream blocks. Encoders write each frame into an acquired block and either copy
+// it out and release it immediately, or hand the block to the caller who releases it later.
+// Block capacity follows the peak frame size of the recent window, so steady state does no allocation.
+class MFBitstreamArena final
+{
+public:
+	MFBitstreamArena();
+	~MFBitstreamArena();
+
+	void reset(unsigned long initial_capacity, int max_blocks); // leased blocks stay valid until released
+	bool acquire(unsigned long min_capacity, BitstreamLease& lease);
+	void commit(BitstreamLease& lease, unsigned long size);
+	void release(BitstreamBlock* block); // may be called from any thread
+	void trim(); // frees idle blocks
+
+	unsigned long get_block_capacity();
+	int get_block_count();
+	int get_leased_count();
+	uint64_t get_allocation_count();
+
+private:
+	bool ensure_capacity(BitstreamBlock* block, unsigned long capacity);
+
+	std::mutex m_mtLock;
+	std::vector<BitstreamBlock*> m_vecBlocks;
+	std::vector<BitstreamBlock*> m_vecFreeBlocks;
+	int m_iMaxBlocks{ 8 };
+	int m_iLeasedCount{ 0 };
+	unsigned long m_iBlockCapacity{ 0 };
+	unsigned long m_iMinCapacity{ 0 };
+	unsigned long m_iWindowPeak{ 0 };
+	int m_iWindowFrames{ 0 };
+	uint64_t m_iAllocationCount{ 0 };
+};
+
+#endif
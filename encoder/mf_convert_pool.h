@@ -0,0 +1,62 @@
+#ifndef MF_CONVERT_POOL_H
+#define MF_CONVERT_POOL_H
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Splits a frame into horizontal stripes and runs them on a fixed set of workers plus the calling thread.
+// Stripes are claimed through an atomic counter, so a late worker only picks up whatever is left.
+class MFConvertPool final
+{
+public:
+	MFConvertPool();
+	~MFConvertPool();
+
+	// thread_count includes the calling thread, worker i is pinned to the i-th core set in affinity_mask (0 lets the OS schedule)
+	bool start(int thread_count, uint64_t affinity_mask);
+	void stop();
+	int get_thread_count();
+
+	// task(stripe, row_begin, row_end), stripe boundaries are multiples of row_align, returns once every stripe is done
+	template<typename Task>
+	void run(int rows, int row_align, Task& task)
+	{
+		dispatch(rows, row_align, &MFConvertPool::invoke<Task>, &task);
+	}
+
+private:
+	typedef void (*StripeFunc)(void* context, int stripe, int row_begin, int row_end);
+
+	template<typename Task>
+	static void invoke(void* context, int stripe, int row_begin, int row_end)
+	{
+		(*static_cast<Task*>(context))(stripe, row_begin, row_end);
+	}
+
+	void dispatch(int rows, int row_align, StripeFunc func, void* context);
+	void run_stripes();
+	void worker_proc();
+	static void pin_thread(std::thread& thread, int core);
+
+	std::vector<std::thread> m_vecWorkers;
+	std::mutex m_mtJob;
+	std::condition_variable m_cvJob;
+	std::condition_variable m_cvDone;
+	uint64_t m_iGeneration{ 0 };
+	int m_iActiveWorkers{ 0 };
+	bool m_bQuit{ false };
+
+	StripeFunc m_pFunc{ nullptr };
+	void* m_pContext{ nullptr };
+	int m_iRows{ 0 };
+	int m_iRowAlign{ 2 };
+	int m_iStripes{ 0 };
+	std::atomic<int> m_iNextStripe{ 0 };
+	std::atomic<int> m_iPendingStripes{ 0 };
+};
+
+#endif
@@ -3,33 +3,8 @@
 
 #include <d3d11.h>
 #include <stdint.h>
-
-enum ERROR_CODE
-{
-    ENCODE_SUCCESS = 0,
-    ENCODE_FAIL,
-    ENCODE_MORE_INPUT,
-    ENCODE_EOF
-};
-
-enum VIDEO_FORMAT
-{
-    VIDEO_FORMAT_IYUV = 0,
-	VIDEO_FORMAT_NV12,
-    VIDEO_FORMAT_YV12,
-	VIDEO_FORMAT_RGB32,
-	VIDEO_FORMAT_MAX
-};
-
-enum AUDIO_FORMAT
-{
-	AUDIO_FORMAT_U8 = 0,
-	AUDIO_FORMAT_S16LE,
-	AUDIO_FORMAT_S24LE,
-	AUDIO_FORMAT_S32LE,
-	AUDIO_FORMAT_FLT,
-	AUDIO_FORMAT_DBL
-};
+#include "mf_encoder_types.h"
+#include "mf_frame_pool.h"
 
 struct InputVMemoryData
 {
@@ -38,6 +13,8 @@ struct InputVMemoryData
     VIDEO_FORMAT format;
     uint8_t* data;
     unsigned long size;
+    bool unchanged{ false }; // hint that the frame is identical to the previous one, e.g. OutputMonitorData::unchanged
+    int64_t timestamp{ -1 }; // presentation time in time base units, or capture time after set_clock_origin. -1 puts the frame on the nominal frame rate grid. set it for every frame or for none
 };
 
 struct InputVTextureData
@@ -46,32 +23,18 @@ struct InputVTextureData
     int height;
     VIDEO_FORMAT format;
     ID3D11Texture2D* texture;
-};
-
-struct OutputVData
-{
-    uint8_t* data;
-    unsigned long size;
-    int64_t duration;
-    int64_t timestamp;
-    bool key_frame;
+    bool unchanged{ false };
+    int64_t timestamp{ -1 };
 };
 
 struct InputAMemoryData
 {
-	int sample_rate;
+	int sample_rate; // input at another rate than start() is resampled, channels and format have to match
 	int channels;
 	int format;
 	uint8_t* data;
 	unsigned long size;
-};
-
-struct OutputAData
-{
-	uint8_t* data;
-	unsigned long size;
-    int64_t duration;
-	int64_t timestamp;
+	int64_t timestamp{ -1 }; // time of the first sample in time base units, or capture time after set_clock_origin. -1 continues from the previous input
 };
 
 class __declspec(dllexport) MFVideoEncoder final
@@ -81,13 +44,35 @@ public:
     ~MFVideoEncoder();
 
     bool start(int width, int height, float fps); // width and height must be consistent with input data
+    bool start(int width, int height, int fps_num, int fps_den); // exact rational frame rate, e.g. 30000 / 1001
+    void set_backend(ENCODER_BACKEND backend, const char* library_path); // if not set, default is ENCODER_BACKEND_MFT. applies from the next start(), other backends take memory input only
     void stop();
     void set_time_base(int64_t time_base); // if not set, default is 90000. otherwise output timestamp is invalid
+    void set_clock_origin(int64_t origin); // if not set, input timestamps are in time base units. otherwise they are capture timestamps, e.g. OutputMonitorData::timestamp, taken relative to origin, e.g. MFMediaClock::get_origin(). frames captured before origin return ENCODE_DROPPED
     void set_crop_rect(float left, float top, float right, float bottom); // if not set, default is 0.0f, 0.0f, 1.0f, 1.0f
     void set_scale_ratio(float ratio); // if not set, default is 1.0f
+    void set_output_mode(OUTPUT_MODE mode); // if not set, default is OUTPUT_MODE_COPY
+    void set_convert_threads(int thread_count, uint64_t affinity_mask); // if not set, default is 1 (memory input is converted on the calling thread), affinity_mask 0 is unpinned
+    bool set_rate_control(const RateControlParam& param); // if not set, default is CBR with default bitrate and gop. can be changed mid-stream, it applies from the next frame handed to the encoder, see EncodeQueueStats::rate_control_failures
+    void set_skip_mode(SKIP_MODE mode, int max_skipped_frames); // if not set, default is SKIP_MODE_NONE. a frame is encoded anyway after max_skipped_frames skips, 0 is unlimited
+    // bounds the pooled frames memory input is converted into, 0 is unlimited. if not set, default is 0 and false.
+    // an input that finds no room returns ENCODE_QUEUE_FULL until earlier frames are encoded, see also MFFramePool::set_global_budget
+    void set_frame_memory(uint64_t budget_bytes, bool large_pages);
+    void get_frame_memory_stats(FramePoolStats& stats);
 
     int encode(const InputVTextureData& input_data, OutputVData& output_data);
     int encode(const InputVMemoryData& input_data, OutputVData& output_data);
+    // planes of any PIXEL_FORMAT at any stride, e.g. from a camera or monitor capture. a contiguous frame in the encoder's input format at its size is referenced instead of copied. data[0] null flushes
+    int encode(const VideoFrame& frame, OutputVData& output_data);
+    void release_output(OutputVData& output_data); // returns a leased bitstream, all leases must be returned before stop()
+
+    // asynchronous alternative to encode(), do not mix both on one encoder. input is converted in submit and encoded on a dedicated thread
+    void set_queue_depth(int depth); // if not set, default is 2. frames queued for encoding and outputs waiting for poll are each bounded by it
+    int submit(const InputVTextureData& input_data); // ENCODE_QUEUE_FULL when depth frames are queued, empty input flushes the encoder. an NV12 texture is referenced, not copied, until its output is polled
+    int submit(const InputVMemoryData& input_data);
+    int submit(const VideoFrame& frame); // a referenced frame stays referenced until its output is polled
+    int poll(OutputVData& output_data); // ENCODE_MORE_INPUT when no output is ready, ENCODE_EOF once a flush has drained
+    void get_queue_stats(EncodeQueueStats& stats);
 
 private:
     class Impl;
@@ -103,8 +88,12 @@ public:
 	bool start(int sample_rate, int channels, AUDIO_FORMAT format);
 	void stop();
 	void set_time_base(int64_t time_base); // if not set, default is 90000. otherwise output timestamp is invalid
+	void set_clock_origin(int64_t origin); // if not set, input timestamps are in time base units. otherwise they are capture timestamps, e.g. OutputAudioData::timestamp, taken relative to origin. samples captured before origin are dropped, ENCODE_DROPPED when that is all of them
 
+	// input of any length is cut into 1024 sample AAC frames, empty input flushes and pads the last frame with silence.
+	// one input can complete several frames, the first output is returned here and the others by poll()
 	int encode(const InputAMemoryData& input_data, OutputAData& output_data);
+	int poll(OutputAData& output_data); // ENCODE_MORE_INPUT when no output is ready, ENCODE_EOF once a flush has drained
 
 private:
     class Impl;
@@ -0,0 +1,90 @@
+#ifndef MF_ENCODER_BACKEND_H
+#define MF_ENCODER_BACKEND_H
+
+#include "mf_encoder_types.h"
+#include "mf_video_frame.h"
+
+// fractions of the input size
+struct CropRect
+{
+	float left;
+	float top;
+	float right;
+	float bottom;
+};
+
+struct EncoderBackendConfig
+{
+	int width; // encoded size
+	int height;
+	int fps_num;
+	int fps_den;
+	int64_t time_base;
+	RateControlParam rate_control;
+	// for surfaces, which the backend crops and scales itself: the input size, the crop and the size after the crop
+	int input_width;
+	int input_height;
+	CropRect crop;
+	int cropped_width;
+	int cropped_height;
+};
+
+// planar frame in the backend's input format, or a surface from acquire_surface. timestamps in time base units
+struct EncoderFrame
+{
+	const uint8_t* data[3];
+	int stride[3];
+	int64_t timestamp;
+	int64_t duration;
+	VideoFrame* frame; // owner of the planes, contiguous as in mf_video_frame_init. a backend reading them after encode() returns takes a reference
+	void* surface; // set instead of the planes
+};
+
+struct EncoderPacket
+{
+	unsigned long size;
+	int64_t timestamp;
+	int64_t duration;
+	bool key_frame;
+};
+
+// A codec behind MFVideoPipeline, the Media Foundation transform included. Backends only see converted planar frames
+// or surfaces, crop, scale, conversion, timestamps and output handling stay in the pipeline, so everything but the
+// codec itself is shared between backends.
+class MFEncoderBackend
+{
+public:
+	virtual ~MFEncoderBackend() {}
+
+	virtual bool open(const EncoderBackendConfig& config) = 0;
+	virtual void close() = 0;
+	virtual VIDEO_FORMAT get_input_format() = 0;
+	virtual unsigned long get_max_packet_size() = 0;
+	// false when any value was refused, those keep their previous setting. the pipeline calls it once right after open()
+	// with the configured values as well, so a backend that could not apply them all while opening tries again
+	virtual bool set_rate_control(const RateControlParam& param) = 0;
+	virtual void force_key_frame() = 0;
+
+	// frame null drains, the packet is written to dst. returns ENCODE_SUCCESS, ENCODE_MORE_INPUT, ENCODE_EOF or ENCODE_FAIL
+	virtual int encode(const EncoderFrame* frame, uint8_t* dst, unsigned long capacity, EncoderPacket& packet) = 0;
+
+	// platform input the backend reads itself instead of planes, e.g. a D3D11 texture of format at the input size that
+	// the Media Foundation transform crops and converts on the GPU. null when the backend takes no such input. the
+	// pipeline hands the result to encode() as EncoderFrame::surface and gives it back through release_surface
+	virtual void* acquire_surface(void* input, VIDEO_FORMAT format)
+	{
+		(void)input;
+		(void)format;
+		return nullptr;
+	}
+	virtual void release_surface(void* surface)
+	{
+		(void)surface;
+	}
+};
+
+// library_path only applies to runtime loaded codecs, null picks the platform default name. ENCODER_BACKEND_MFT needs
+// the D3D11 device of MFVideoEncoder, which creates it itself, and returns null here
+MFEncoderBackend* mf_create_encoder_backend(ENCODER_BACKEND backend, const char* library_path);
+
+#endif
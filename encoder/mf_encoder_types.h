@@ -0,0 +1,108 @@
+#ifndef MF_ENCODER_TYPES_H
+#define MF_ENCODER_TYPES_H
+
+#include <stdint.h>
+
+enum ERROR_CODE
+{
+    ENCODE_SUCCESS = 0,
+    ENCODE_FAIL,
+    ENCODE_MORE_INPUT,
+    ENCODE_EOF,
+    ENCODE_QUEUE_FULL,
+    ENCODE_DROPPED // the input was discarded without output, e.g. captured before the clock origin
+};
+
+enum VIDEO_FORMAT
+{
+    VIDEO_FORMAT_IYUV = 0,
+	VIDEO_FORMAT_NV12,
+    VIDEO_FORMAT_YV12,
+	VIDEO_FORMAT_RGB32,
+	VIDEO_FORMAT_MAX
+};
+
+enum AUDIO_FORMAT
+{
+	AUDIO_FORMAT_U8 = 0,
+	AUDIO_FORMAT_S16LE,
+	AUDIO_FORMAT_S24LE,
+	AUDIO_FORMAT_S32LE,
+	AUDIO_FORMAT_FLT,
+	AUDIO_FORMAT_DBL
+};
+
+enum OUTPUT_MODE
+{
+    OUTPUT_MODE_COPY = 0, // bitstream is copied into OutputVData::data, which holds OutputVData::capacity bytes
+    OUTPUT_MODE_LEASE // OutputVData::data points into the encoder arena until release_output is called
+};
+
+enum SKIP_MODE
+{
+    SKIP_MODE_NONE = 0, // every frame is encoded
+    SKIP_MODE_HINT, // frames flagged unchanged by the caller are skipped
+    SKIP_MODE_DETECT // like SKIP_MODE_HINT, memory input is also compared with the previous frame by hash
+};
+
+enum RATE_CONTROL_MODE
+{
+    RATE_CONTROL_CBR = 0,
+    RATE_CONTROL_VBR, // peak constrained when max_bitrate is set
+    RATE_CONTROL_CQP
+};
+
+struct RateControlParam
+{
+    RATE_CONTROL_MODE mode;
+    uint32_t target_bitrate; // bits per second, 0 means width * height * 100
+    uint32_t max_bitrate; // VBR peak in bits per second, 0 is unconstrained
+    uint32_t vbv_size; // bits, 0 lets the encoder choose
+    uint32_t gop_length; // frames, 0 means 5 seconds
+    uint32_t min_qp; // 0 - 51, both 0 leaves the range to the encoder
+    uint32_t max_qp;
+    uint32_t qp; // CQP only
+};
+
+enum ENCODER_BACKEND
+{
+    ENCODER_BACKEND_MFT = 0, // Media Foundation H.264 encoder, Windows only
+    ENCODER_BACKEND_OPENH264, // openh264 loaded at runtime
+    ENCODER_BACKEND_NULL // emits placeholder packets, for pipeline benchmarks
+};
+
+struct EncodeQueueStats
+{
+    int queue_depth;
+    int queued_inputs;
+    int ready_outputs;
+    int64_t submitted_frames;
+    int64_t rejected_frames; // submit calls that returned ENCODE_QUEUE_FULL
+    int64_t rate_control_failures; // rate control settings the encoder refused in full or in part, refused values keep their previous setting
+    double average_latency_ms; // submit to output ready, smoothed
+    double max_latency_ms;
+    double depth_latency_ms; // queue_depth frame intervals, the worst case a full queue adds
+};
+
+struct OutputVData
+{
+    uint8_t* data;
+    unsigned long size;
+    int64_t duration; // the nominal frame interval, an estimate with caller timestamps: the frame really lasts until the next timestamp, which is not known yet
+    int64_t timestamp;
+    bool key_frame;
+    void* lease;
+    bool skipped; // the input was not encoded, size is 0 and the previous frame stays on screen for duration
+    unsigned long capacity; // bytes at data for OUTPUT_MODE_COPY. a packet that does not fit returns ENCODE_FAIL with size set to the bytes it needs
+};
+
+struct OutputAData
+{
+	uint8_t* data;
+	unsigned long size;
+    int64_t duration;
+	int64_t timestamp;
+	unsigned long capacity; // bytes at data. a frame that does not fit returns ENCODE_FAIL with size set to the bytes it needs and stays for the next poll
+};
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef MF_NAL_PARSER_H
+#define MF_NAL_PARSER_H
+
+#include "mf_common.h"
+#include <vector>
+
+// H.264 bitstream helpers for the Annex-B output of MFVideoEncoder. NAL units are returned as views into the
+// caller's buffer, nothing is copied except the parameter sets kept by MFParameterSetCache.
+
+enum NAL_TYPE
+{
+	NAL_TYPE_SLICE = 1,
+	NAL_TYPE_IDR = 5,
+	NAL_TYPE_SEI = 6,
+	NAL_TYPE_SPS = 7,
+	NAL_TYPE_PPS = 8,
+	NAL_TYPE_AUD = 9,
+	NAL_TYPE_END_SEQUENCE = 10,
+	NAL_TYPE_END_STREAM = 11,
+	NAL_TYPE_FILLER = 12
+};
+
+enum SLICE_TYPE
+{
+	SLICE_TYPE_P = 0,
+	SLICE_TYPE_B,
+	SLICE_TYPE_I,
+	SLICE_TYPE_SP,
+	SLICE_TYPE_SI
+};
+
+struct NalUnit
+{
+	const uint8_t* data; // NAL header byte, start code or length prefix excluded
+	unsigned long size;
+	unsigned long offset; // of data in the parsed buffer
+	int prefix_size; // bytes between the previous unit (or the buffer start) and data, 4 for a 4 byte start code or length
+	int type; // NAL_TYPE
+	int ref_idc;
+};
+
+struct H264Sps
+{
+	int id;
+	int profile_idc;
+	int constraint_flags;
+	int level_idc;
+	int chroma_format_idc;
+	int bit_depth_luma;
+	int bit_depth_chroma;
+	bool separate_colour_plane;
+	int log2_max_frame_num;
+	int poc_type;
+	int log2_max_poc_lsb;
+	int max_num_ref_frames;
+	bool frame_mbs_only;
+	int width; // cropped
+	int height;
+};
+
+struct H264Pps
+{
+	int id;
+	int sps_id;
+	bool entropy_coding_mode; // CABAC
+	bool bottom_field_pic_order_present;
+};
+
+struct SliceHeader
+{
+	int first_mb;
+	SLICE_TYPE slice_type;
+	int pps_id;
+	int frame_num;
+	bool idr;
+	int idr_pic_id;
+	bool field_pic;
+	bool bottom_field;
+	int poc_lsb; // poc_type 0 only, otherwise 0
+};
+
+// first 00 00 01 at or after data, end when there is none
+MF_EXPORT const uint8_t* mf_find_start_code(const uint8_t* data, const uint8_t* end);
+
+// units is cleared first, leading bytes before the first start code are ignored
+MF_EXPORT void mf_split_annexb(const uint8_t* data, unsigned long size, std::vector<NalUnit>& units);
+
+// length_size is 1, 2 or 4, returns false on a truncated unit (units up to it are kept)
+MF_EXPORT bool mf_split_avcc(const uint8_t* data, unsigned long size, int length_size, std::vector<NalUnit>& units);
+
+// rewrites 4 byte start codes into 4 byte big-endian lengths without moving data. returns false and leaves the
+// buffer untouched when a unit has a 3 byte start code or stray bytes between units, use mf_annexb_to_avcc then.
+// units is scratch owned by the caller, kept across calls so converting every packet does not allocate
+MF_EXPORT bool mf_annexb_to_avcc_in_place(uint8_t* data, unsigned long size, std::vector<NalUnit>& units);
+
+// converts in one pass, returns the bytes written to dst, 0 when capacity is too small
+MF_EXPORT unsigned long mf_annexb_to_avcc(const uint8_t* data, unsigned long size, uint8_t* dst, unsigned long capacity);
+
+// 4 byte lengths back into 4 byte start codes, in place. returns false and leaves the buffer untouched on a
+// truncated unit
+MF_EXPORT bool mf_avcc_to_annexb_in_place(uint8_t* data, unsigned long size);
+
+MF_EXPORT bool mf_parse_sps(const uint8_t* data, unsigned long size, H264Sps& sps);
+MF_EXPORT bool mf_parse_pps(const uint8_t* data, unsigned long size, H264Pps& pps);
+
+// Keeps the latest SPS and PPS per id and reads slice headers against them. The stored units are copies, so the
+// cache stays valid after the encoder output is released.
+class MF_EXPORT MFParameterSetCache final
+{
+public:
+	MFParameterSetCache();
+	~MFParameterSetCache();
+
+	void clear();
+
+	// returns true when nal is an SPS or PPS that parsed and differs from the stored one
+	bool update(const NalUnit& nal);
+
+	// scans a whole access unit, returns true when any parameter set changed
+	bool update(const std::vector<NalUnit>& units);
+
+	// bumped on every change, lets muxers and packetizers notice new parameter sets cheaply
+	uint64_t get_version();
+
+	const H264Sps* get_sps(int id);
+	const H264Pps* get_pps(int id);
+	const std::vector<uint8_t>* get_sps_nal(int id);
+	const std::vector<uint8_t>* get_pps_nal(int id);
+
+	// needs the PPS referenced by the slice and its SPS
+	bool parse_slice_header(const NalUnit& nal, SliceHeader& header);
+
+	// AVCDecoderConfigurationRecord (ISO/IEC 14496-15 avcC) with 4 byte lengths and every cached set, at most the
+	// 31 SPS and 255 PPS of lowest id the record can count. false until at least one SPS and PPS were seen
+	bool get_avcc_record(std::vector<uint8_t>& record);
+
+private:
+	static const int MAX_SPS = 32;
+	static const int MAX_PPS = 256;
+
+	H264Sps m_tSps[MAX_SPS];
+	H264Pps m_tPps[MAX_PPS];
+	std::vector<uint8_t> m_vecSpsNal[MAX_SPS];
+	std::vector<uint8_t> m_vecPpsNal[MAX_PPS];
+	uint64_t m_iVersion{ 0 };
+};
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef MF_OPENH264_BACKEND_H
+#define MF_OPENH264_BACKEND_H
+
+#include "mf_encoder_backend.h"
+#include <string>
+
+class ISVCEncoder;
+
+// Software H.264 through openh264, loaded with LoadLibrary / dlopen on open() so the library is only needed at
+// runtime and is not a build dependency. The ABI is declared locally in the translation unit.
+class MFOpenH264Backend final : public MFEncoderBackend
+{
+public:
+	explicit MFOpenH264Backend(const char* library_path);
+	~MFOpenH264Backend();
+
+	bool open(const EncoderBackendConfig& config) override;
+	void close() override;
+	VIDEO_FORMAT get_input_format() override;
+	unsigned long get_max_packet_size() override;
+	bool set_rate_control(const RateControlParam& param) override;
+	void force_key_frame() override;
+	int encode(const EncoderFrame* frame, uint8_t* dst, unsigned long capacity, EncoderPacket& packet) override;
+
+private:
+	bool load_library();
+	void unload_library();
+	bool initialize_encoder();
+
+	typedef int (*CreateEncoderFunc)(ISVCEncoder** encoder);
+	typedef void (*DestroyEncoderFunc)(ISVCEncoder* encoder);
+
+	std::string m_strLibraryPath;
+	void* m_pLibrary{ nullptr };
+	CreateEncoderFunc m_pCreateEncoder{ nullptr };
+	DestroyEncoderFunc m_pDestroyEncoder{ nullptr };
+	ISVCEncoder* m_pEncoder{ nullptr };
+	EncoderBackendConfig m_tConfig{};
+	void* m_pFrameInfo{ nullptr };
+};
+
+#endif
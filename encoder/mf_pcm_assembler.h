@@ -0,0 +1,65 @@
+#ifndef MF_PCM_ASSEMBLER_H
+#define MF_PCM_ASSEMBLER_H
+
+#include "mf_common.h"
+#include "mf_encoder_types.h"
+
+struct PcmFrame
+{
+	const uint8_t* data; // frame_size samples, valid until the next call on the assembler
+	int samples; // valid samples, less than frame_size only for the padded last frame of flush()
+	int64_t timestamp;
+	int64_t duration; // covers the valid samples
+};
+
+// Cuts interleaved PCM of any chunk size into codec frames of exactly frame_size samples per channel, e.g. 1024 for
+// AAC-LC, 480 or 960 for Opus at 48 kHz. Frames lying entirely inside an input chunk are returned in place, only the
+// samples straddling two chunks are copied into a staging frame allocated by configure(), so the steady state does
+// no allocation. Timestamps are counted in samples from the first input and rescaled per frame, they do not drift.
+//
+//   assembler.push(data, size, timestamp);
+//   while (assembler.pop(frame)) { encode frame }
+//   ...
+//   while (assembler.flush(frame)) { encode frame } // end of stream
+class MF_EXPORT MFPcmAssembler final
+{
+public:
+	MFPcmAssembler();
+	~MFPcmAssembler();
+
+	bool configure(AUDIO_FORMAT format, int channels, int sample_rate, int frame_size, int64_t time_base);
+	void set_max_drift(int milliseconds); // if not set, default is 20. an input timestamp further off the sample count starts a new run
+	void reset(); // drops the staged samples, the next input starts a new run
+
+	// size must be whole samples. data is not copied and has to stay valid until pop() returns false.
+	// timestamp -1 continues from the previous input, the first input without one starts at 0
+	bool push(const uint8_t* data, unsigned long size, int64_t timestamp);
+	bool pop(PcmFrame& frame); // false when the input is consumed, its tail stays staged for the next push
+	bool flush(PcmFrame& frame); // like pop(), then returns the staged tail padded with silence and resets
+
+	int get_frame_size();
+	int get_staged_samples();
+
+private:
+	void emit(const uint8_t* data, int samples, PcmFrame& frame);
+	void pad_staged(PcmFrame& frame);
+
+	uint8_t* m_pStaging{ nullptr };
+	int m_iStaged{ 0 }; // samples in the staging frame
+	const uint8_t* m_pInput{ nullptr };
+	unsigned long m_iInputSize{ 0 }; // bytes of the current input not consumed yet
+	int m_iFrameSize{ 0 };
+	int m_iBlockAlign{ 0 };
+	int m_iSampleRate{ 0 };
+	int64_t m_iTimeBase{ 0 };
+	int64_t m_iMaxDrift{ 0 }; // time base units
+	int m_iMaxDriftMs{ 20 };
+	uint8_t m_iSilence{ 0 };
+	bool m_bStarted{ false };
+	int64_t m_iOrigin{ 0 }; // timestamp of the first sample of the run
+	int64_t m_iPosition{ 0 }; // samples emitted in the run
+	bool m_bResync{ false };
+	int64_t m_iResyncTime{ 0 };
+};
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef MF_SCALE_CONVERT_H
+#define MF_SCALE_CONVERT_H
+
+#include <stdint.h>
+#include <vector>
+
+enum SCALE_FILTER
+{
+	SCALE_FILTER_BILINEAR = 0,
+	SCALE_FILTER_BOX
+};
+
+// Fused crop + scale + BGRA to NV12/I420 conversion. Each pair of output rows is filtered into a small
+// BGRA scratch row that stays in cache and converted right away, so the source frame is streamed once.
+class MFScaleConverter final
+{
+public:
+	MFScaleConverter();
+	~MFScaleConverter();
+
+	bool configure(int src_width, int src_height, int dst_width, int dst_height, SCALE_FILTER filter);
+	bool is_configured(int src_width, int src_height, int dst_width, int dst_height);
+	void set_slot_count(int slots); // one scratch slot per thread converting stripes concurrently, default is 1
+
+	// src points at the top-left pixel of the cropped region
+	void bgra_to_nv12(const uint8_t* src, int src_stride, uint8_t* dst_y, int dst_stride_y, uint8_t* dst_uv, int dst_stride_uv);
+	void bgra_to_i420(const uint8_t* src, int src_stride, uint8_t* dst_y, int dst_stride_y, uint8_t* dst_u, int dst_stride_u, uint8_t* dst_v, int dst_stride_v);
+	// converts destination rows [row_begin, row_end) only, row_begin must be even, dst pointers still address row 0
+	void bgra_to_nv12(const uint8_t* src, int src_stride, uint8_t* dst_y, int dst_stride_y, uint8_t* dst_uv, int dst_stride_uv, int row_begin, int row_end, int slot);
+	void bgra_to_i420(const uint8_t* src, int src_stride, uint8_t* dst_y, int dst_stride_y, uint8_t* dst_u, int dst_stride_u, uint8_t* dst_v, int dst_stride_v, int row_begin, int row_end, int slot);
+
+private:
+	struct HorizontalTap
+	{
+		int x0;
+		int x1;
+		int weight; // bilinear: fraction of x1 in 1/256, box: 65536 / (columns * rows)
+	};
+
+	struct Scratch
+	{
+		std::vector<uint8_t> blend_row;
+		std::vector<uint16_t> sum_row;
+		std::vector<uint8_t> scaled_rows;
+	};
+
+	void resize_scratch(Scratch& scratch);
+	const uint8_t* filter_row(const uint8_t* src, int src_stride, int dst_row, uint8_t* dst, Scratch& scratch);
+	void convert_rows(const uint8_t* src, int src_stride, uint8_t* dst_y, int dst_stride_y, uint8_t* dst_u, int dst_stride_u, uint8_t* dst_v, int dst_stride_v,
+		bool interleaved, int row_begin, int row_end, int slot);
+
+	int m_iSrcWidth{ 0 };
+	int m_iSrcHeight{ 0 };
+	int m_iDstWidth{ 0 };
+	int m_iDstHeight{ 0 };
+	SCALE_FILTER m_eFilter{ SCALE_FILTER_BILINEAR };
+	bool m_bScaling{ false };
+	bool m_bHalving{ false };
+	std::vector<HorizontalTap> m_vecTaps;
+	std::vector<uint32_t> m_vecReciprocal;
+	std::vector<Scratch> m_vecScratch;
+
+	void (*m_pBlendRows)(const uint8_t* row0, const uint8_t* row1, uint8_t* dst, int bytes, int fraction){ nullptr };
+	void (*m_pAccumulateRow)(const uint8_t* src, uint16_t* sum, int bytes){ nullptr };
+	void (*m_pHalfRow)(const uint8_t* row0, const uint8_t* row1, uint8_t* dst, int dst_width){ nullptr };
+	void (*m_pRowsToNV12)(const uint8_t* row0, const uint8_t* row1, uint8_t* dst_y0, uint8_t* dst_y1, uint8_t* dst_uv, int width){ nullptr };
+	void (*m_pRowsToI420)(const uint8_t* row0, const uint8_t* row1, uint8_t* dst_y0, uint8_t* dst_y1, uint8_t* dst_u, uint8_t* dst_v, int width){ nullptr };
+};
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef MF_TILE_CODEC_H
+#define MF_TILE_CODEC_H
+
+#include "mf_common.h"
+#include "mf_convert_pool.h"
+#include "mf_dirty_region.h"
+#include <vector>
+
+// Lossless codec for screen content. A BGRA frame is cut into fixed tiles and every tile that intersects a dirty
+// rect is coded on its own as a solid color, a palette of up to 256 colors with run-length coded indices, or packed
+// BGR. Palette runs and BGR data go through LZ4 when that makes them smaller. Alpha is not transmitted.
+//
+// packet:   "MFTC" | u16 version | u16 tile_size | u32 width | u32 height | u32 tile_count | tile...
+// tile:     u16 tile_x | u16 tile_y | u8 TILE_MODE | u32 payload_size | payload
+// solid:    B G R
+// palette:  u8 color_count - 1 | color_count x B G R | u32 run_bytes | u32 stored_bytes | runs (LZ4 when stored < run_bytes)
+//           runs are u8 index | LEB128 run length - 1, in row-major order across the whole tile
+// raw:      u32 bgr_bytes | u32 stored_bytes | BGR rows (LZ4 when stored < bgr_bytes)
+// all values are little endian, edge tiles are clipped to the frame.
+
+#define MF_TILE_CODEC_VERSION 1
+
+enum TILE_MODE
+{
+	TILE_MODE_SOLID = 0,
+	TILE_MODE_PALETTE,
+	TILE_MODE_RAW
+};
+
+class MF_EXPORT MFTileEncoder final
+{
+public:
+	MFTileEncoder();
+	~MFTileEncoder();
+
+	// tile_size is a multiple of 8 up to 256, thread_count includes the calling thread
+	bool configure(int width, int height, int tile_size, int thread_count);
+
+	// rects null or rect_count 0 codes every tile. packet points into the encoder and stays valid until the next
+	// call, returns false when configure() was not called or no tile intersects the rects
+	bool encode(const uint8_t* data, int stride, const MonitorRect* rects, int rect_count, const uint8_t*& packet, unsigned long& size);
+
+private:
+	struct Slot
+	{
+		std::vector<uint8_t> output;
+		std::vector<uint8_t> pixels;
+		std::vector<uint8_t> compressed;
+		std::vector<uint32_t> hash_table;
+	};
+
+	void mark_tiles(const MonitorRect* rects, int rect_count);
+	void encode_tile(const uint8_t* data, int stride, int tile, Slot& slot);
+	bool encode_palette(const uint8_t* tile, int stride, int columns, int rows, Slot& slot);
+	void encode_raw(const uint8_t* tile, int stride, int columns, int rows, Slot& slot);
+	void write_payload(Slot& slot, int raw_bytes);
+
+	int m_iWidth{ 0 };
+	int m_iHeight{ 0 };
+	int m_iTileSize{ 64 };
+	int m_iTilesX{ 0 };
+	int m_iTilesY{ 0 };
+	std::vector<uint8_t> m_vecDirty;
+	std::vector<int> m_vecTiles;
+	std::vector<Slot> m_vecSlots;
+	std::vector<uint8_t> m_vecPacket;
+	MFConvertPool m_ConvertPool;
+};
+
+class MF_EXPORT MFTileDecoder final
+{
+public:
+	MFTileDecoder();
+	~MFTileDecoder();
+
+	// applies the tiles of one packet to a BGRA frame of the packet's size, alpha is set to 255. returns false on a
+	// malformed packet or a size mismatch, tiles before the error are already written
+	bool decode(const uint8_t* packet, unsigned long size, uint8_t* data, int stride, int width, int height);
+
+private:
+	bool decode_palette(const uint8_t* payload, unsigned long size, uint8_t* tile, int stride, int columns, int rows);
+	bool decode_raw(const uint8_t* payload, unsigned long size, uint8_t* tile, int stride, int columns, int rows);
+	const uint8_t* unpack(const uint8_t* payload, unsigned long size, unsigned long& raw_bytes);
+
+	std::vector<uint8_t> m_vecScratch;
+};
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef MF_VIDEO_PIPELINE_H
+#define MF_VIDEO_PIPELINE_H
+
+#include "mf_encoder_backend.h"
+#include "mf_bitstream_arena.h"
+#include "mf_scale_convert.h"
+#include "mf_convert_pool.h"
+#include "mf_pixel_convert.h"
+#include "mf_frame_pool.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// the pixel layout of an encoder format, PIXEL_NONE for the ones without a memory layout
+PIXEL_FORMAT mf_video_pixel_format(VIDEO_FORMAT format);
+
+// Everything between the input and the codec that does not depend on the platform: crop, scale and conversion of
+// memory frames, skip detection, timestamps, the asynchronous encode queue and the bitstream arena. The codec is an
+// MFEncoderBackend, the Media Foundation transform as well as the portable ones, so they all get the same input
+// handling. MFVideoEncoder is this pipeline plus the Windows inputs, e.g. D3D11 textures handed to the backend as surfaces.
+class MFVideoPipeline final
+{
+public:
+	MFVideoPipeline();
+	~MFVideoPipeline();
+
+	// takes ownership of backend and opens it at the input size after crop and scale, it is deleted by stop() or on failure
+	bool start(MFEncoderBackend* backend, int width, int height, int fps_num, int fps_den);
+	void stop();
+	bool is_started();
+
+	void set_time_base(int64_t time_base); // if not set, default is 90000
+	void set_clock_origin(int64_t origin); // if not set, input timestamps are in time base units, see MFVideoEncoder
+	void set_crop_rect(float left, float top, float right, float bottom); // if not set, default is 0.0f, 0.0f, 1.0f, 1.0f
+	void set_scale_ratio(float ratio); // if not set, default is 1.0f
+	void set_output_mode(OUTPUT_MODE mode); // if not set, default is OUTPUT_MODE_COPY
+	void set_convert_threads(int thread_count, uint64_t affinity_mask);
+	bool set_rate_control(const RateControlParam& param);
+	void set_skip_mode(SKIP_MODE mode, int max_skipped_frames);
+	void set_frame_memory(uint64_t budget_bytes, bool large_pages);
+	void get_frame_memory_stats(FramePoolStats& stats);
+	void set_queue_depth(int depth);
+
+	// frame.data[0] null flushes. surface is platform input the backend reads itself through acquire_surface, of
+	// format at the size start() was given, null flushes
+	int encode(const VideoFrame& frame, OutputVData& output_data);
+	int encode(void* surface, VIDEO_FORMAT format, int64_t timestamp, bool unchanged, OutputVData& output_data);
+	int submit(const VideoFrame& frame);
+	int submit(void* surface, VIDEO_FORMAT format, int64_t timestamp, bool unchanged);
+	int poll(OutputVData& output_data);
+	void release_output(OutputVData& output_data);
+	void get_queue_stats(EncodeQueueStats& stats);
+
+private:
+	// one frame on its way to the backend, built on the calling thread and encoded there or on the encode thread
+	struct EncodeJob
+	{
+		VideoFrame* frame; // referenced planes in the backend's input format, null for a surface, a flush or a skip
+		void* surface; // from MFEncoderBackend::acquire_surface
+		int64_t timestamp;
+		int64_t duration;
+		OutputVData output; // filled in already when the frame was skipped
+		bool flush;
+		std::chrono::steady_clock::time_point submit_time;
+	};
+
+	struct EncodeResult
+	{
+		int code;
+		OutputVData output;
+	};
+
+	int prepare_job(const VideoFrame& frame, EncodeJob& job);
+	int prepare_job(void* surface, VIDEO_FORMAT format, int64_t timestamp, bool unchanged, EncodeJob& job);
+	int finish_job(EncodeJob& job, int64_t input_timestamp);
+	void release_job(EncodeJob& job);
+	int encode_job(const EncodeJob& job, OutputVData& output_data, OUTPUT_MODE output_mode);
+	int submit_job(int ret, EncodeJob& job);
+
+	bool scale_memory_data(const PlaneView& src, PIXEL_FORMAT src_format, int src_width, int src_height, VideoFrame& dst);
+	void get_cropped_planes(const VideoFrame& frame, PlaneView& planes, int& frame_width, int& frame_height);
+	bool check_skip(bool unchanged, const PlaneView* planes, PIXEL_FORMAT format, int width, int height);
+	uint64_t hash_planes(const PlaneView& planes, PIXEL_FORMAT format, int width, int height);
+	bool before_clock_origin(int64_t input_timestamp);
+	bool assign_timestamp(int64_t input_timestamp, int64_t& timestamp, int64_t& duration);
+	int skip_frame(int64_t input_timestamp, OutputVData& output_data);
+	void apply_pending_rate_control();
+
+	void start_encode_thread();
+	void stop_encode_thread();
+	void encode_thread_proc();
+	std::chrono::steady_clock::time_point pop_in_flight_time();
+	void push_result(int code, const OutputVData& output_data, std::chrono::steady_clock::time_point submit_time);
+
+	MFEncoderBackend* m_pBackend{ nullptr };
+	PIXEL_FORMAT m_eInputFormat{ PIXEL_NONE }; // of the backend
+	int m_iEncodedWidth{ 0 };
+	int m_iEncodedHeight{ 0 };
+	int m_iFpsNum{ 0 };
+	int m_iFpsDen{ 1 };
+
+	MFBitstreamArena m_BitstreamArena;
+	OUTPUT_MODE m_eOutputMode{ OUTPUT_MODE_COPY };
+
+	int64_t m_iTimeBase{ 90000 };
+	int64_t m_iClockOrigin{ 0 };
+	bool m_bClockOrigin{ false }; // input timestamps are capture times, see set_clock_origin
+	int64_t m_iFrameCount{ 0 };
+	int64_t m_iLastTimestamp{ -1 };
+	SKIP_MODE m_eSkipMode{ SKIP_MODE_NONE };
+	int m_iMaxSkippedFrames{ 0 };
+	int m_iSkippedFrames{ 0 };
+	uint64_t m_iInputHash{ 0 };
+	bool m_bInputHashValid{ false };
+
+	CropRect m_tCropRatio{ 0.0f, 0.0f, 1.0f, 1.0f };
+	float m_fScaleRatio{ 1.0f };
+	MFScaleConverter m_ScaleConverter;
+	MFPixelConverter m_PixelConverter; // frame format to encoder format, resolved when the input format changes
+	MFPixelConverter m_StageConverter; // packed input to I420 ahead of scaling
+	MFConvertPool m_ConvertPool;
+	MFFramePool m_FramePool;
+
+	RateControlParam m_tRateControl{ RATE_CONTROL_CBR, 0, 0, 0, 0, 0, 0, 10 };
+	RateControlParam m_tPendingRateControl{};
+	bool m_bRateControlPending{ false };
+	int64_t m_iRateControlFailures{ 0 };
+	std::mutex m_mtRateControl;
+
+	std::thread m_tEncodeThread;
+	std::mutex m_mtQueue;
+	std::condition_variable m_cvQueue;
+	std::deque<EncodeJob> m_dqEncodeJobs;
+	std::deque<EncodeResult> m_dqEncodeResults;
+	std::deque<std::chrono::steady_clock::time_point> m_dqInFlightTimes; // encode thread only
+	int m_iQueueDepth{ 2 };
+	bool m_bQuitEncodeThread{ false };
+	int64_t m_iSubmittedFrames{ 0 };
+	int64_t m_iRejectedFrames{ 0 };
+	double m_fAverageLatency{ 0.0 };
+	double m_fMaxLatency{ 0.0 };
+};
+
+#endif
@@ -0,0 +1,165 @@
+#include "mf_bitstream_arena.h"
+#include "mf_common.h"
+#include <algorithm>
+
+#define ARENA_PAGE_SIZE 4096
+#define ARENA_WINDOW_FRAMES 256
+
+struct BitstreamBlock
+{
+	uint8_t* data;
+	unsigned long capacity;
+	bool leased;
+};
+
+MFBitstreamArena::MFBitstreamArena()
+{
+}
+
+MFBitstreamArena::~MFBitstreamArena()
+{
+	for (BitstreamBlock* block : m_vecBlocks)
+	{
+		mf_aligned_free(block->data);
+		delete block;
+	}
+}
+
+void MFBitstreamArena::reset(unsigned long initial_capacity, int max_blocks)
+{
+	std::lock_guard<std::mutex> lock(m_mtLock);
+	m_iMaxBlocks = max_blocks > 0 ? max_blocks : 1;
+	m_iMinCapacity = XALIGN(initial_capacity, ARENA_PAGE_SIZE);
+	m_iBlockCapacity = m_iMinCapacity;
+	m_iWindowPeak = 0;
+	m_iWindowFrames = 0;
+	m_vecBlocks.reserve(m_iMaxBlocks);
+	m_vecFreeBlocks.reserve(m_iMaxBlocks);
+}
+
+bool MFBitstreamArena::acquire(unsigned long min_capacity, BitstreamLease& lease)
+{
+	std::lock_guard<std::mutex> lock(m_mtLock);
+	if (min_capacity > m_iBlockCapacity)
+	{
+		m_iBlockCapacity = XALIGN(min_capacity, ARENA_PAGE_SIZE);
+	}
+	BitstreamBlock* block = nullptr;
+	if (!m_vecFreeBlocks.empty())
+	{
+		block = m_vecFreeBlocks.back();
+		m_vecFreeBlocks.pop_back();
+	}
+	else if ((int)m_vecBlocks.size() < m_iMaxBlocks)
+	{
+		block = new BitstreamBlock{ nullptr, 0, false };
+		m_vecBlocks.push_back(block);
+	}
+	else
+	{
+		return false;
+	}
+	// blocks are resized lazily, only when they are too small or far larger than the current peak
+	if (block->capacity < m_iBlockCapacity || block->capacity > m_iBlockCapacity * 2)
+	{
+		if (!ensure_capacity(block, m_iBlockCapacity))
+		{
+			m_vecFreeBlocks.push_back(block);
+			return false;
+		}
+	}
+	block->leased = true;
+	m_iLeasedCount++;
+	lease.data = block->data;
+	lease.size = 0;
+	lease.capacity = block->capacity;
+	lease.block = block;
+	return true;
+}
+
+void MFBitstreamArena::commit(BitstreamLease& lease, unsigned long size)
+{
+	lease.size = std::min(size, lease.capacity);
+	std::lock_guard<std::mutex> lock(m_mtLock);
+	m_iWindowPeak = std::max(m_iWindowPeak, lease.size);
+	unsigned long target = std::max(m_iMinCapacity, (unsigned long)XALIGN(m_iWindowPeak + m_iWindowPeak / 2, ARENA_PAGE_SIZE));
+	if (target > m_iBlockCapacity)
+	{
+		m_iBlockCapacity = target;
+	}
+	if (++m_iWindowFrames >= ARENA_WINDOW_FRAMES)
+	{
+		if (target < m_iBlockCapacity / 2)
+		{
+			m_iBlockCapacity = target;
+		}
+		m_iWindowPeak = 0;
+		m_iWindowFrames = 0;
+	}
+}
+
+void MFBitstreamArena::release(BitstreamBlock* block)
+{
+	if (block == nullptr)
+	{
+		return;
+	}
+	std::lock_guard<std::mutex> lock(m_mtLock);
+	if (!block->leased)
+	{
+		return;
+	}
+	block->leased = false;
+	m_iLeasedCount--;
+	m_vecFreeBlocks.push_back(block);
+}
+
+void MFBitstreamArena::trim()
+{
+	std::lock_guard<std::mutex> lock(m_mtLock);
+	for (BitstreamBlock* block : m_vecFreeBlocks)
+	{
+		m_vecBlocks.erase(std::find(m_vecBlocks.begin(), m_vecBlocks.end(), block));
+		mf_aligned_free(block->data);
+		delete block;
+	}
+	m_vecFreeBlocks.clear();
+}
+
+unsigned long MFBitstreamArena::get_block_capacity()
+{
+	std::lock_guard<std::mutex> lock(m_mtLock);
+	return m_iBlockCapacity;
+}
+
+int MFBitstreamArena::get_block_count()
+{
+	std::lock_guard<std::mutex> lock(m_mtLock);
+	return (int)m_vecBlocks.size();
+}
+
+int MFBitstreamArena::get_leased_count()
+{
+	std::lock_guard<std::mutex> lock(m_mtLock);
+	return m_iLeasedCount;
+}
+
+uint64_t MFBitstreamArena::get_allocation_count()
+{
+	std::lock_guard<std::mutex> lock(m_mtLock);
+	return m_iAllocationCount;
+}
+
+bool MFBitstreamArena::ensure_capacity(BitstreamBlock* block, unsigned long capacity)
+{
+	uint8_t* data = (uint8_t*)mf_aligned_malloc(capacity, MF_CACHE_LINE);
+	if (data == nullptr)
+	{
+		return false;
+	}
+	mf_aligned_free(block->data);
+	block->data = data;
+	block->capacity = capacity;
+	m_iAllocationCount++;
+	return true;
+}
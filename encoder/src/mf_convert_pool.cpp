@@ -0,0 +1,167 @@
+#include "mf_convert_pool.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+MFConvertPool::MFConvertPool()
+{
+}
+
+MFConvertPool::~MFConvertPool()
+{
+	stop();
+}
+
+bool MFConvertPool::start(int thread_count, uint64_t affinity_mask)
+{
+	stop();
+	if (thread_count < 1)
+	{
+		return false;
+	}
+
+	std::vector<int> cores;
+	for (int core = 0; core < 64; core++)
+	{
+		if (affinity_mask & (1ull << core))
+		{
+			cores.push_back(core);
+		}
+	}
+	m_bQuit = false;
+	for (int i = 0; i < thread_count - 1; i++)
+	{
+		m_vecWorkers.emplace_back(&MFConvertPool::worker_proc, this);
+		if (!cores.empty())
+		{
+			pin_thread(m_vecWorkers.back(), cores[i % cores.size()]);
+		}
+	}
+	return true;
+}
+
+void MFConvertPool::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mtJob);
+		m_bQuit = true;
+	}
+	m_cvJob.notify_all();
+	for (auto& worker : m_vecWorkers)
+	{
+		worker.join();
+	}
+	m_vecWorkers.clear();
+}
+
+int MFConvertPool::get_thread_count()
+{
+	return (int)m_vecWorkers.size() + 1;
+}
+
+void MFConvertPool::dispatch(int rows, int row_align, StripeFunc func, void* context)
+{
+	if (rows <= 0)
+	{
+		return;
+	}
+	int stripes = get_thread_count();
+	if (row_align < 1)
+	{
+		row_align = 1;
+	}
+	// no point in stripes thinner than a couple of aligned rows
+	int max_stripes = rows / (row_align * 8);
+	if (stripes > max_stripes)
+	{
+		stripes = max_stripes > 1 ? max_stripes : 1;
+	}
+	if (stripes == 1)
+	{
+		func(context, 0, 0, rows);
+		return;
+	}
+
+	{
+		// a worker that woke late for the previous job may still be in run_stripes reading its fields, the new job is
+		// only published once it left, every worker entering later sees the new generation
+		std::unique_lock<std::mutex> lock(m_mtJob);
+		m_cvDone.wait(lock, [this]() { return m_iActiveWorkers == 0; });
+		m_pFunc = func;
+		m_pContext = context;
+		m_iRows = rows;
+		m_iRowAlign = row_align;
+		m_iStripes = stripes;
+		m_iNextStripe.store(0);
+		m_iPendingStripes.store(stripes);
+		m_iGeneration++;
+	}
+	m_cvJob.notify_all();
+	run_stripes();
+
+	// workers still inside run_stripes find no stripe left and are waited for by the next dispatch
+	std::unique_lock<std::mutex> lock(m_mtJob);
+	m_cvDone.wait(lock, [this]() { return m_iPendingStripes.load() == 0; });
+}
+
+void MFConvertPool::run_stripes()
+{
+	int stripe = 0;
+	while ((stripe = m_iNextStripe.fetch_add(1)) < m_iStripes)
+	{
+		int row_begin = (int)((int64_t)m_iRows * stripe / m_iStripes) / m_iRowAlign * m_iRowAlign;
+		int row_end = stripe + 1 == m_iStripes ? m_iRows : (int)((int64_t)m_iRows * (stripe + 1) / m_iStripes) / m_iRowAlign * m_iRowAlign;
+		if (row_end > row_begin)
+		{
+			m_pFunc(m_pContext, stripe, row_begin, row_end);
+		}
+		if (m_iPendingStripes.fetch_sub(1) == 1)
+		{
+			std::lock_guard<std::mutex> lock(m_mtJob);
+			m_cvDone.notify_all();
+		}
+	}
+}
+
+void MFConvertPool::worker_proc()
+{
+	uint64_t generation = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mtJob);
+			m_cvJob.wait(lock, [&]() { return m_bQuit || m_iGeneration != generation; });
+			if (m_bQuit)
+			{
+				return;
+			}
+			generation = m_iGeneration;
+			m_iActiveWorkers++;
+		}
+		run_stripes();
+		{
+			std::lock_guard<std::mutex> lock(m_mtJob);
+			m_iActiveWorkers--;
+			if (m_iActiveWorkers == 0)
+			{
+				m_cvDone.notify_all();
+			}
+		}
+	}
+}
+
+void MFConvertPool::pin_thread(std::thread& thread, int core)
+{
+#ifdef _WIN32
+	SetThreadAffinityMask((HANDLE)thread.native_handle(), (DWORD_PTR)1 << core);
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core, &set);
+	pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#endif
+}
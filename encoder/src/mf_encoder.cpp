@@ -1,11 +1,21 @@
-
 #include "mf_encoder.h"
+#include "mf_video_pipeline.h"
+#include "mf_time.h"
+#include "mf_pcm_assembler.h"
+#include "mf_sample_convert.h"
+#include "mf_resampler.h"
 #include "defer/defer.hpp"
 #include "dx11convert/dx11convert.h"
-#include "libyuv/include/libyuv.h"
+#include <d3d10.h>
 #include <mfapi.h>
 #include <mftransform.h>
 #include <mfidl.h>
+#include <codecapi.h>
+#include <strmif.h>
+#include <vector>
+#include <deque>
+#include <cmath>
+#include <string>
 
 #pragma comment(lib, "mf.lib")
 #pragma comment(lib, "mfplat.lib")
@@ -14,49 +24,221 @@
 
 #define MPEG_TIME_BASE 90000
 #define XALIGN(x, a) (((x) + (a)-1) & ~((a)-1))
+#define AAC_FRAME_SIZE 1024 // samples per channel in an AAC-LC frame
+#define AAC_BYTES_PER_SECOND 24000 // 192 kbps, one of the bitrates the MFT accepts
+#define MAX_AAC_FRAME_SIZE 6144 // 6144 bits per channel, 8 channels
+#define MAX_PENDING_AUDIO_OUTPUTS 64 // frames completed by one input and not polled yet
 
 const CLSID CLSID_CMSAACEncMFT = { 0x93AF0C51, 0x2275, 0x45D2, { 0xA5, 0x0A, 0xFC, 0x8D, 0xD4, 0x2B, 0x5B, 0xE0 } };
 
-struct CropRect
+// IMFMediaBuffer over externally owned memory, lets the MFT write the bitstream straight into an arena block
+class ArenaMediaBuffer final : public IMFMediaBuffer
 {
-	float left;
-	float top;
-	float right;
-	float bottom;
+public:
+    void bind(uint8_t* data, DWORD capacity)
+    {
+        m_pData = data;
+        m_iMaxLength = capacity;
+        m_iCurrentLength = 0;
+    }
+
+    STDMETHODIMP QueryInterface(REFIID riid, void** ppv) override
+    {
+        if (ppv == nullptr)
+        {
+            return E_POINTER;
+        }
+        if (riid == __uuidof(IUnknown) || riid == __uuidof(IMFMediaBuffer))
+        {
+            *ppv = static_cast<IMFMediaBuffer*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *ppv = nullptr;
+        return E_NOINTERFACE;
+    }
+
+    STDMETHODIMP_(ULONG) AddRef() override
+    {
+        return InterlockedIncrement(&m_lRefCount);
+    }
+
+    STDMETHODIMP_(ULONG) Release() override
+    {
+        ULONG count = InterlockedDecrement(&m_lRefCount);
+        if (count == 0)
+        {
+            delete this;
+        }
+        return count;
+    }
+
+    STDMETHODIMP Lock(BYTE** ppbBuffer, DWORD* pcbMaxLength, DWORD* pcbCurrentLength) override
+    {
+        if (ppbBuffer == nullptr || m_pData == nullptr)
+        {
+            return E_POINTER;
+        }
+        *ppbBuffer = m_pData;
+        if (pcbMaxLength)
+        {
+            *pcbMaxLength = m_iMaxLength;
+        }
+        if (pcbCurrentLength)
+        {
+            *pcbCurrentLength = m_iCurrentLength;
+        }
+        return S_OK;
+    }
+
+    STDMETHODIMP Unlock() override
+    {
+        return S_OK;
+    }
+
+    STDMETHODIMP GetCurrentLength(DWORD* pcbCurrentLength) override
+    {
+        *pcbCurrentLength = m_iCurrentLength;
+        return S_OK;
+    }
+
+    STDMETHODIMP SetCurrentLength(DWORD cbCurrentLength) override
+    {
+        if (cbCurrentLength > m_iMaxLength)
+        {
+            return E_INVALIDARG;
+        }
+        m_iCurrentLength = cbCurrentLength;
+        return S_OK;
+    }
+
+    STDMETHODIMP GetMaxLength(DWORD* pcbMaxLength) override
+    {
+        *pcbMaxLength = m_iMaxLength;
+        return S_OK;
+    }
+
+private:
+    ~ArenaMediaBuffer() = default;
+
+    LONG m_lRefCount{ 1 };
+    uint8_t* m_pData{ nullptr };
+    DWORD m_iMaxLength{ 0 };
+    DWORD m_iCurrentLength{ 0 };
 };
 
-class MFVideoEncoder::Impl
+// IMFMediaBuffer over the planes of a contiguous VideoFrame, holds a frame reference until the encoder lets go of the sample
+class FrameMediaBuffer final : public IMFMediaBuffer
 {
 public:
-    Impl(ID3D11Device* d3d_device, ID3D11DeviceContext* d3d_context)
-        : m_pD3DDevice(d3d_device)
-        , m_pD3DDeviceCtx(d3d_context)
+    FrameMediaBuffer(VideoFrame* frame, DWORD length)
+        : m_pFrame(mf_video_frame_ref(frame))
+        , m_iLength(length)
     {
-		CoInitializeEx(NULL, COINIT_APARTMENTTHREADED);
-		MFStartup(MF_VERSION);
-        if (m_pD3DDevice == nullptr && m_pD3DDeviceCtx == nullptr)
+    }
+
+    STDMETHODIMP QueryInterface(REFIID riid, void** ppv) override
+    {
+        if (ppv == nullptr)
         {
-            D3D_FEATURE_LEVEL featureLevels[] =
-            {
-                D3D_FEATURE_LEVEL_11_1,
-                D3D_FEATURE_LEVEL_11_0
-            };
+            return E_POINTER;
+        }
+        if (riid == __uuidof(IUnknown) || riid == __uuidof(IMFMediaBuffer))
+        {
+            *ppv = static_cast<IMFMediaBuffer*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *ppv = nullptr;
+        return E_NOINTERFACE;
+    }
 
-            UINT uiFeatureLevels = ARRAYSIZE(featureLevels);
-            D3D_FEATURE_LEVEL featureLevel;
-            UINT uiD3D11CreateFlag = D3D11_CREATE_DEVICE_SINGLETHREADED;
-            D3D11CreateDevice(NULL, D3D_DRIVER_TYPE_HARDWARE, NULL, uiD3D11CreateFlag, featureLevels, uiFeatureLevels, D3D11_SDK_VERSION, &m_pD3DDevice, &featureLevel, &m_pD3DDeviceCtx);
-            m_bOwnD3DDevice = true;
+    STDMETHODIMP_(ULONG) AddRef() override
+    {
+        return InterlockedIncrement(&m_lRefCount);
+    }
+
+    STDMETHODIMP_(ULONG) Release() override
+    {
+        ULONG count = InterlockedDecrement(&m_lRefCount);
+        if (count == 0)
+        {
+            delete this;
         }
-	}
+        return count;
+    }
 
-    ~Impl()
+    STDMETHODIMP Lock(BYTE** ppbBuffer, DWORD* pcbMaxLength, DWORD* pcbCurrentLength) override
     {
-		MFShutdown();
-		CoUninitialize();
-	}
-	bool start(int width, int height, float fps)
-	{
+        if (ppbBuffer == nullptr)
+        {
+            return E_POINTER;
+        }
+        *ppbBuffer = m_pFrame->data[0];
+        if (pcbMaxLength)
+        {
+            *pcbMaxLength = m_iLength;
+        }
+        if (pcbCurrentLength)
+        {
+            *pcbCurrentLength = m_iLength;
+        }
+        return S_OK;
+    }
+
+    STDMETHODIMP Unlock() override
+    {
+        return S_OK;
+    }
+
+    STDMETHODIMP GetCurrentLength(DWORD* pcbCurrentLength) override
+    {
+        *pcbCurrentLength = m_iLength;
+        return S_OK;
+    }
+
+    STDMETHODIMP SetCurrentLength(DWORD cbCurrentLength) override
+    {
+        return cbCurrentLength == m_iLength ? S_OK : E_INVALIDARG;
+    }
+
+    STDMETHODIMP GetMaxLength(DWORD* pcbMaxLength) override
+    {
+        *pcbMaxLength = m_iLength;
+        return S_OK;
+    }
+
+private:
+    ~FrameMediaBuffer()
+    {
+        mf_video_frame_unref(m_pFrame);
+    }
+
+    LONG m_lRefCount{ 1 };
+    VideoFrame* m_pFrame{ nullptr };
+    DWORD m_iLength{ 0 };
+};
+
+// The Media Foundation H.264 transform behind the pipeline. Memory frames are wrapped without a copy, textures come
+// in as surfaces and are cropped and converted to the transform's input on the GPU.
+class MFTransformBackend final : public MFEncoderBackend
+{
+public:
+    MFTransformBackend(ID3D11Device* d3d_device, ID3D11DeviceContext* d3d_context)
+        : m_pD3DDevice(d3d_device)
+        , m_pD3DDeviceCtx(d3d_context)
+    {
+    }
+
+    ~MFTransformBackend()
+    {
+        close();
+    }
+
+    bool open(const EncoderBackendConfig& config) override
+    {
+        close();
+        m_tConfig = config;
         bool ret = true;
         IMFMediaType* pInputType = nullptr;
         IMFMediaType* pOutputType = nullptr;
@@ -71,38 +253,29 @@ public:
             }
             if (!ret)
             {
-                if (m_pMFTVideoEncoder)
-                {
-                    m_pMFTVideoEncoder->Release();
-                    m_pMFTVideoEncoder = nullptr;
-                }
-                if (m_pMFTConvert)
-                {
-                    m_pMFTConvert->Release();
-                    m_pMFTConvert = nullptr;
-                }
+                close();
             }
         };
 
-        UINT32 frame_width = XALIGN((UINT32)(width * (m_tCropRatio.right - m_tCropRatio.left)), 16);
-        UINT32 frame_height = XALIGN((UINT32)(height * (m_tCropRatio.bottom - m_tCropRatio.top)), 2);
-        m_iEncodedWidth = XALIGN((UINT32)(frame_width * m_fScaleRatio), 16);
-        m_iEncodedHeight = XALIGN((UINT32)(frame_height * m_fScaleRatio), 2);
         HRESULT hr = CoCreateInstance(CLSID_MSH264EncoderMFT, NULL, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&m_pMFTVideoEncoder));
         if (FAILED(hr))
         {
             ret = false;
             return ret;
         }
-        int fps_num = (int)(fps * 1000);
-        int fps_den = 1000;
+        // the rate control mode has to be in place before the media types are set
+        m_bRateControlSettled = apply_rate_control(config.rate_control, true, false);
+        UINT32 width = (UINT32)config.width;
+        UINT32 height = (UINT32)config.height;
+        UINT32 bitrate = config.rate_control.target_bitrate ? config.rate_control.target_bitrate : width * height * 100;
+        UINT32 gop_length = config.rate_control.gop_length ? config.rate_control.gop_length : config.fps_num * 5 / config.fps_den;
         MFCreateMediaType(&pOutputType);
         pOutputType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
         pOutputType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_H264);
-        MFSetAttributeSize(pOutputType, MF_MT_FRAME_SIZE, m_iEncodedWidth, m_iEncodedHeight);
-        MFSetAttributeRatio(pOutputType, MF_MT_FRAME_RATE, fps_num, fps_den);
-        pOutputType->SetUINT32(MF_MT_MAX_KEYFRAME_SPACING, fps_num * 5 / fps_den);
-        pOutputType->SetUINT32(MF_MT_AVG_BITRATE, m_iEncodedWidth * m_iEncodedHeight * 100);
+        MFSetAttributeSize(pOutputType, MF_MT_FRAME_SIZE, width, height);
+        MFSetAttributeRatio(pOutputType, MF_MT_FRAME_RATE, config.fps_num, config.fps_den);
+        pOutputType->SetUINT32(MF_MT_MAX_KEYFRAME_SPACING, gop_length);
+        pOutputType->SetUINT32(MF_MT_AVG_BITRATE, bitrate);
         pOutputType->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive);
         pOutputType->SetUINT32(MF_MT_ALL_SAMPLES_INDEPENDENT, FALSE);
         hr = m_pMFTVideoEncoder->SetOutputType(0, pOutputType, 0);
@@ -114,13 +287,15 @@ public:
         MFCreateMediaType(&pInputType);
         pInputType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
         pInputType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_NV12);
-        MFSetAttributeSize(pInputType, MF_MT_FRAME_SIZE, m_iEncodedWidth, m_iEncodedHeight);
-        MFSetAttributeRatio(pInputType, MF_MT_FRAME_RATE, fps_num, fps_den);
+        MFSetAttributeSize(pInputType, MF_MT_FRAME_SIZE, width, height);
+        MFSetAttributeRatio(pInputType, MF_MT_FRAME_RATE, config.fps_num, config.fps_den);
         MFSetAttributeRatio(pInputType, MF_MT_PIXEL_ASPECT_RATIO, 1, 1);
+        m_eInputFormat = VIDEO_FORMAT_NV12;
         hr = m_pMFTVideoEncoder->SetInputType(0, pInputType, 0);
         if (FAILED(hr))
         {
             pInputType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_IYUV);
+            m_eInputFormat = VIDEO_FORMAT_IYUV;
             hr = m_pMFTVideoEncoder->SetInputType(0, pInputType, 0);
             if (FAILED(hr))
             {
@@ -139,7 +314,7 @@ public:
                 ret = false;
                 return ret;
             }
-            MFSetAttributeSize(pInputType, MF_MT_FRAME_SIZE, frame_width, frame_height);
+            MFSetAttributeSize(pInputType, MF_MT_FRAME_SIZE, config.cropped_width, config.cropped_height);
             pInputType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_RGB32);
             hr = m_pMFTConvert->SetInputType(0, pInputType, 0);
             if (FAILED(hr))
@@ -151,13 +326,20 @@ public:
         else
         {
             m_pDX11ShaderNV12 = new DX11ShaderNV12(m_pD3DDevice, m_pD3DDeviceCtx);
-            m_pDX11ShaderNV12->prepare_resources(m_iEncodedWidth, m_iEncodedHeight);
+            m_pDX11ShaderNV12->prepare_resources(width, height);
         }
+
+        MFT_OUTPUT_STREAM_INFO stream_info = {};
+        m_pMFTVideoEncoder->GetOutputStreamInfo(0, &stream_info);
+        m_iOutputMinSize = stream_info.cbSize;
+        m_pOutputBuffer = new ArenaMediaBuffer();
+        MFCreateSample(&m_pOutputSample);
+        m_pOutputSample->AddBuffer(m_pOutputBuffer);
         return ret;
-	}
+    }
 
-	void stop()
-	{
+    void close() override
+    {
         if (m_pMFTVideoEncoder)
         {
             m_pMFTVideoEncoder->Release();
@@ -174,187 +356,219 @@ public:
             delete m_pDX11ShaderNV12;
             m_pDX11ShaderNV12 = nullptr;
         }
-        if (m_bOwnD3DDevice)
+        if (m_pOutputSample)
         {
-            m_pD3DDeviceCtx->Release();
-            m_pD3DDeviceCtx = nullptr;
-			m_pD3DDevice->Release();
-			m_pD3DDevice = nullptr;
-		}
-        m_iFrameCount = 0;
-        m_tCropRatio = { 0.0f, 0.0f, 1.0f, 1.0f };
-        m_fScaleRatio = 1.0f;
-	}
+            m_pOutputSample->Release();
+            m_pOutputSample = nullptr;
+        }
+        if (m_pOutputBuffer)
+        {
+            m_pOutputBuffer->Release();
+            m_pOutputBuffer = nullptr;
+        }
+    }
 
-    void set_time_base(int64_t time_base)
+    VIDEO_FORMAT get_input_format() override
     {
-        m_iTimeBase = time_base;
+        return m_eInputFormat;
     }
 
-    void set_crop_rect(float left, float top, float right, float bottom)
+    unsigned long get_max_packet_size() override
     {
-        m_tCropRatio.left = left;
-        m_tCropRatio.top = top;
-        m_tCropRatio.right = right;
-        m_tCropRatio.bottom = bottom;
+        return m_iOutputMinSize > 0 ? m_iOutputMinSize : m_tConfig.width * m_tConfig.height * 3 / 2;
     }
 
-    void set_scale_ratio(float ratio)
+    bool set_rate_control(const RateControlParam& param) override
     {
-        m_fScaleRatio = ratio;
-	}
+        if (!m_pMFTVideoEncoder)
+        {
+            m_tConfig.rate_control = param;
+            return true;
+        }
+        // after a value was refused while opening every value is sent again, the encoder's state is not known otherwise
+        bool ret = apply_rate_control(param, !m_bRateControlSettled, true);
+        m_bRateControlSettled = m_bRateControlSettled || ret;
+        return ret;
+    }
 
-	int encode(const InputVTextureData& input_data, OutputVData& output_data)
-	{
-        UINT32 width = 0;
-        UINT32 height = 0;
-        VIDEO_FORMAT format = VIDEO_FORMAT_IYUV;
-        float fps = 0.0f;
-        if (!get_encoder_config(width, height, format, fps))
+    void force_key_frame() override
+    {
+        ICodecAPI* codec_api = nullptr;
+        if (m_pMFTVideoEncoder && SUCCEEDED(m_pMFTVideoEncoder->QueryInterface(IID_PPV_ARGS(&codec_api))))
         {
-            return ENCODE_FAIL;
+            set_codec_value(codec_api, CODECAPI_AVEncVideoForceKeyFrame, 1, false);
+            codec_api->Release();
         }
+    }
 
+    int encode(const EncoderFrame* frame, uint8_t* dst, unsigned long capacity, EncoderPacket& packet) override
+    {
         IMFSample* yuv_sample = nullptr;
+        if (frame)
+        {
+            if (frame->surface)
+            {
+                yuv_sample = static_cast<IMFSample*>(frame->surface);
+                yuv_sample->AddRef();
+            }
+            else if (frame->frame)
+            {
+                // the buffer references the frame until the transform lets go of the sample
+                const VideoFrame& planes = *frame->frame;
+                IMFMediaBuffer* input_buffer = new FrameMediaBuffer(frame->frame, (DWORD)mf_video_frame_size(planes.format, planes.height, planes.stride[0]));
+                MFCreateSample(&yuv_sample);
+                yuv_sample->AddBuffer(input_buffer);
+                input_buffer->Release();
+            }
+            else
+            {
+                return ENCODE_FAIL;
+            }
+            yuv_sample->SetSampleDuration(mf_rescale(frame->duration, MF_HNS_PER_SECOND, m_tConfig.time_base));
+            yuv_sample->SetSampleTime(mf_rescale(frame->timestamp, MF_HNS_PER_SECOND, m_tConfig.time_base));
+            if (m_tRateControl.mode == RATE_CONTROL_CQP)
+            {
+                yuv_sample->SetUINT32(MFSampleExtension_VideoEncodeQP, m_tRateControl.qp);
+            }
+        }
         defer[&]{
             if (yuv_sample)
             {
                 yuv_sample->Release();
             }
         };
-        if (input_data.texture)
+
+        HRESULT hr1 = S_OK;
+        HRESULT hr2 = S_OK;
+        bool has_output = false;
+        do
         {
-            ID3D11Texture2D* cropped_texture = nullptr;
-            if (abs(m_tCropRatio.right - m_tCropRatio.left - 1.0f) > 0.01f || abs(m_tCropRatio.bottom - m_tCropRatio.top - 1.0f) > 0.01f)
+            if (yuv_sample)
             {
-                crop_texture(input_data.texture, &cropped_texture);
+                hr1 = m_pMFTVideoEncoder->ProcessInput(0, yuv_sample, 0);
+                if (FAILED(hr1) && hr1 != 0xC00D36B5)
+                {
+                    return ENCODE_FAIL;
+                }
             }
             else
             {
-                cropped_texture = input_data.texture;
+                m_pMFTVideoEncoder->ProcessMessage(MFT_MESSAGE_NOTIFY_END_OF_STREAM, 0);
+                m_pMFTVideoEncoder->ProcessMessage(MFT_MESSAGE_COMMAND_DRAIN, 0);
             }
-            if (format != input_data.format)
+            // the output sample is reused across frames, stale attributes such as CleanPoint must not leak
+            m_pOutputSample->DeleteAllItems();
+            m_pOutputBuffer->bind(dst, capacity);
+            MFT_OUTPUT_DATA_BUFFER mft_output_data = {};
+            mft_output_data.dwStreamID = 0;
+            mft_output_data.dwStatus = 0;
+            mft_output_data.pSample = m_pOutputSample;
+            DWORD dwStatus = 0;
+            hr2 = m_pMFTVideoEncoder->ProcessOutput(0, 1, &mft_output_data, &dwStatus);
+            if (mft_output_data.pEvents)
             {
-                yuv_sample = get_yuv_texture_sample(cropped_texture);
+                mft_output_data.pEvents->Release();
             }
-            else
+            if (FAILED(hr2) && hr2 != 0xC00D6D72)
             {
-                IMFMediaBuffer* input_buffer = nullptr;
-                HRESULT hr = MFCreateDXGISurfaceBuffer(__uuidof(ID3D11Texture2D), cropped_texture, 0, FALSE, &input_buffer);
-                if (FAILED(hr))
-                {
-                    return ENCODE_FAIL;
-                }
-                MFCreateSample(&yuv_sample);
-                yuv_sample->AddBuffer(input_buffer);
-                input_buffer->Release();
+                return ENCODE_FAIL;
             }
-            if (cropped_texture != input_data.texture)
+            if (SUCCEEDED(hr2))
             {
-                cropped_texture->Release();
+                int64_t sample_duration = 0;
+                int64_t sample_time = 0;
+                m_pOutputSample->GetSampleDuration(&sample_duration);
+                m_pOutputSample->GetSampleTime(&sample_time);
+                // time bases up to 10MHz survive the round trip through 100ns units exactly
+                packet.duration = mf_rescale(sample_duration, m_tConfig.time_base, MF_HNS_PER_SECOND);
+                packet.timestamp = mf_rescale(sample_time, m_tConfig.time_base, MF_HNS_PER_SECOND);
+                UINT32 key_frame = 0;
+                m_pOutputSample->GetUINT32(MFSampleExtension_CleanPoint, &key_frame);
+                packet.key_frame = key_frame != 0;
+                DWORD length = 0;
+                m_pOutputBuffer->GetCurrentLength(&length);
+                packet.size = length;
+                has_output = true;
             }
-        }
-        if (yuv_sample)
-        {
-            int64_t frame_duration = (int64_t)(m_iTimeBase / fps);
-            yuv_sample->SetSampleDuration(frame_duration);
-            yuv_sample->SetSampleTime(m_iFrameCount * frame_duration);
-            m_iFrameCount++;
-            yuv_sample->SetUINT32(MFSampleExtension_VideoEncodeQP, 10);
-        }
-        return internal_encode(yuv_sample, output_data);
-	}
+        } while (hr1 == 0xC00D36B5);
 
-	int encode(const InputVMemoryData& input_data, OutputVData& output_data)
-	{
-        UINT32 width = 0;
-        UINT32 height = 0;
-        VIDEO_FORMAT format = VIDEO_FORMAT_IYUV;
-        float fps = 0.0f;
-        if (!get_encoder_config(width, height, format, fps))
+        if (has_output)
         {
-            return ENCODE_FAIL;
+            return ENCODE_SUCCESS;
         }
+        return yuv_sample == nullptr ? ENCODE_EOF : ENCODE_MORE_INPUT;
+    }
 
-        IMFSample* yuv_sample = nullptr;
-        if (input_data.data)
+    void* acquire_surface(void* input, VIDEO_FORMAT format) override
+    {
+        ID3D11Texture2D* input_texture = static_cast<ID3D11Texture2D*>(input);
+        ID3D11Texture2D* cropped_texture = input_texture;
+        const CropRect& crop = m_tConfig.crop;
+        if (abs(crop.right - crop.left - 1.0f) > 0.01f || abs(crop.bottom - crop.top - 1.0f) > 0.01f)
         {
-            uint8_t* cropped_data = nullptr;
-            if (abs(m_tCropRatio.right - m_tCropRatio.left - 1.0f) > 0.01f || abs(m_tCropRatio.bottom - m_tCropRatio.top - 1.0f) > 0.01f)
+            cropped_texture = nullptr;
+            if (!crop_texture(input_texture, &cropped_texture))
             {
-                crop_memory_data(input_data.data, &cropped_data, input_data.width, input_data.height, input_data.format);
-            }
-            else
-            {
-                cropped_data = input_data.data;
+                return nullptr;
             }
+        }
+        IMFSample* yuv_sample = nullptr;
+        if (format != m_eInputFormat)
+        {
+            yuv_sample = get_yuv_texture_sample(cropped_texture);
+        }
+        else
+        {
             IMFMediaBuffer* input_buffer = nullptr;
-            uint8_t* data = nullptr;
-            if (format != input_data.format)
-            {
-                MFCreateMemoryBuffer(width * height * 3 / 2, &input_buffer);
-                input_buffer->Lock(&data, nullptr, nullptr);
-                if (input_data.format == VIDEO_FORMAT_RGB32)
-                {
-                    if (format == VIDEO_FORMAT_NV12)
-                    {
-                        libyuv::ARGBToNV12(cropped_data, width * 4, data, width, data + width * height, width, width, height);
-                    }
-                    else if (format == VIDEO_FORMAT_IYUV)
-                    {
-                        libyuv::ARGBToI420(cropped_data, width * 4, data, width, data + width * height, width / 2, data + width * height * 5 / 4, width / 2, width, height);
-                    }
-                }
-                else if (input_data.format == VIDEO_FORMAT_NV12)
-                {
-                    if (format == VIDEO_FORMAT_IYUV)
-                    {
-						libyuv::NV12ToI420(cropped_data, width, cropped_data + width * height, width, data, width, data + width * height, width / 2, data + width * height * 5 / 4, width / 2, width, height);
-					}
-				}
-                else if (input_data.format == VIDEO_FORMAT_IYUV)
-                {
-                    if (format == VIDEO_FORMAT_NV12)
-                    {
-						libyuv::I420ToNV12(cropped_data, width, cropped_data + width * height, width / 2, cropped_data + width * height * 5 / 4, width / 2, data, width, data + width * height, width, width, height);
-					}
-				}
-            }
-            else
-            {
-                MFCreateMemoryBuffer(input_data.size, &input_buffer);
-                input_buffer->Lock(&data, nullptr, nullptr);
-                if (input_data.format == VIDEO_FORMAT_RGB32)
-                {
-					memcpy(data, cropped_data, width * height * 4);
-				}
-				else
-				{
-					memcpy(data, cropped_data, width * height * 3 / 2);
-				}
-            }
-            input_buffer->Unlock();
-            MFCreateSample(&yuv_sample);
-            yuv_sample->AddBuffer(input_buffer);
-            input_buffer->Release();
-            if (cropped_data != input_data.data)
+            if (SUCCEEDED(MFCreateDXGISurfaceBuffer(__uuidof(ID3D11Texture2D), cropped_texture, 0, FALSE, &input_buffer)))
             {
-                delete[] cropped_data;
+                MFCreateSample(&yuv_sample);
+                yuv_sample->AddBuffer(input_buffer);
+                input_buffer->Release();
             }
         }
-
-        if (yuv_sample)
+        if (cropped_texture != input_texture)
         {
-            int64_t frame_duration = (int64_t)(m_iTimeBase / fps);
-            yuv_sample->SetSampleDuration(frame_duration);
-            yuv_sample->SetSampleTime(m_iFrameCount * frame_duration);
-            m_iFrameCount++;
-            yuv_sample->SetUINT32(MFSampleExtension_VideoEncodeQP, 10);
+            cropped_texture->Release();
         }
-        return internal_encode(yuv_sample, output_data);
-	}
+        return yuv_sample;
+    }
+
+    void release_surface(void* surface) override
+    {
+        static_cast<IMFSample*>(surface)->Release();
+    }
 
 private:
+    bool crop_texture(ID3D11Texture2D* input_texture, ID3D11Texture2D** output_texture)
+    {
+        const CropRect& crop = m_tConfig.crop;
+        D3D11_TEXTURE2D_DESC input_desc = {};
+        input_texture->GetDesc(&input_desc);
+        D3D11_TEXTURE2D_DESC desc = {};
+        desc.Width = XALIGN((UINT)(input_desc.Width * (crop.right - crop.left)), 16);
+        desc.Height = XALIGN((UINT)(input_desc.Height * (crop.bottom - crop.top)), 2);
+        desc.MipLevels = 1;
+        desc.ArraySize = 1;
+        desc.Format = input_desc.Format;
+        desc.SampleDesc.Count = 1;
+        desc.SampleDesc.Quality = 0;
+        desc.Usage = D3D11_USAGE_DEFAULT;
+        desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+        desc.CPUAccessFlags = 0;
+        desc.MiscFlags = 0;
+        HRESULT hr = m_pD3DDevice->CreateTexture2D(&desc, nullptr, output_texture);
+        if (FAILED(hr))
+        {
+            return false;
+        }
+        UINT left = (UINT)(input_desc.Width * crop.left);
+        UINT top = (UINT)(input_desc.Height * crop.top);
+        D3D11_BOX box = { left, top, 0, left + desc.Width, top + desc.Height, 1 };
+        m_pD3DDeviceCtx->CopySubresourceRegion(*output_texture, 0, 0, 0, 0, input_texture, 0, &box);
+        return true;
+    }
+
     IMFSample* get_yuv_texture_sample(ID3D11Texture2D* input_texture)
     {
         IMFMediaBuffer* input_buffer = nullptr;
@@ -431,7 +645,7 @@ private:
                 output_data.dwStatus = 0;
                 output_data.pSample = nullptr;
                 MFCreateSample(&output_data.pSample);
-                MFCreateMemoryBuffer(m_iEncodedWidth * m_iEncodedHeight * 3 / 2, &output_buffer);
+                MFCreateMemoryBuffer(m_tConfig.width * m_tConfig.height * 3 / 2, &output_buffer);
                 output_data.pSample->AddBuffer(output_buffer);
                 DWORD dwStatus = 0;
                 HRESULT hr2 = m_pMFTConvert->ProcessOutput(0, 1, &output_data, &dwStatus);
@@ -442,6 +656,7 @@ private:
                 }
                 if (FAILED(hr2))
                 {
+                    output_data.pSample->Release();
                     return nullptr;
                 }
                 yuv_sample = output_data.pSample;
@@ -450,224 +665,288 @@ private:
         return yuv_sample;
     }
 
-    GUID video_format_to_guid(VIDEO_FORMAT format)
+    // only the values that changed are sent unless send_all, and only the ones the encoder took are recorded, one it
+    // rejects keeps its previous value and is sent again with the next change. false when any value was rejected
+    bool apply_rate_control(const RateControlParam& param, bool send_all, bool streaming)
     {
-        switch (format)
-        {
-        case VIDEO_FORMAT_IYUV:
-            return MFVideoFormat_IYUV;
-        case VIDEO_FORMAT_NV12:
-	        return MFVideoFormat_NV12;
-        case VIDEO_FORMAT_YV12:
-	        return MFVideoFormat_YV12;
-        case VIDEO_FORMAT_RGB32:
-	        return MFVideoFormat_RGB32;
-        default:
-	        return GUID_NULL;
-        }
-	}
-
-    VIDEO_FORMAT guid_to_video_format(GUID guid)
-    {
-        if (guid == MFVideoFormat_IYUV)
-        {
-            return VIDEO_FORMAT_IYUV;
-        }
-        else if (guid == MFVideoFormat_NV12)
-        {
-	        return VIDEO_FORMAT_NV12;
-        }
-        else if (guid == MFVideoFormat_YV12)
-        {
-	        return VIDEO_FORMAT_YV12;
-        }
-        else if (guid == MFVideoFormat_RGB32)
-        {
-	        return VIDEO_FORMAT_RGB32;
-        }
-        else
-        {
-	        return VIDEO_FORMAT_MAX;
-        }
-	}
-
-    bool get_encoder_config(UINT32& width, UINT32& height, VIDEO_FORMAT& format, float& fps)
-    {
-        IMFMediaType* input_type = nullptr;
-        m_pMFTVideoEncoder->GetInputCurrentType(0, &input_type);
-        if (input_type == nullptr)
+        ICodecAPI* codec_api = nullptr;
+        if (FAILED(m_pMFTVideoEncoder->QueryInterface(IID_PPV_ARGS(&codec_api))))
         {
+            if (send_all)
+            {
+                m_tRateControl = param;
+            }
             return false;
         }
-        MFGetAttributeSize(input_type, MF_MT_FRAME_SIZE, &width, &height);
-        UINT32 fps_num = 0;
-        UINT32 fps_den = 0;
-        MFGetAttributeRatio(input_type, MF_MT_FRAME_RATE, &fps_num, &fps_den);
-        fps = (float)fps_num / fps_den;
-        GUID guid_format;
-        input_type->GetGUID(MF_MT_SUBTYPE, &guid_format);
-        format = guid_to_video_format(guid_format);
-        input_type->Release();
-        return true;
-    }
-
-    int internal_encode(IMFSample* yuv_sample, OutputVData& output_data)
-    {
-        HRESULT hr1 = S_OK;
-        HRESULT hr2 = S_OK;
-        IMFMediaBuffer* output_buffer = nullptr;
-        MFCreateMemoryBuffer(16 * 1024 * 1024, &output_buffer);
-        if (output_data.data == nullptr)
+        defer[&]{
+            codec_api->Release();
+        };
+        // when every value is sent the rejected ones are still requested through the output type while opening, they
+        // are kept so later changes are compared against them
+        RateControlParam applied = send_all ? param : m_tRateControl;
+        const RateControlParam& current = m_tRateControl;
+        bool ret = true;
+        if (send_all || param.mode != current.mode || (param.mode == RATE_CONTROL_VBR && (param.max_bitrate != 0) != (current.max_bitrate != 0)))
         {
-            output_data.data = new uint8_t[16 * 1024 * 1024];
+            UINT32 mode = eAVEncCommonRateControlMode_CBR;
+            if (param.mode == RATE_CONTROL_VBR)
+            {
+                mode = param.max_bitrate ? eAVEncCommonRateControlMode_PeakConstrainedVBR : eAVEncCommonRateControlMode_UnconstrainedVBR;
+            }
+            else if (param.mode == RATE_CONTROL_CQP)
+            {
+                mode = eAVEncCommonRateControlMode_Quality;
+            }
+            if (set_codec_value(codec_api, CODECAPI_AVEncCommonRateControlMode, mode, streaming))
+            {
+                applied.mode = param.mode;
+            }
+            else
+            {
+                ret = false;
+            }
         }
-
-        do
+        if (param.mode != RATE_CONTROL_CQP)
         {
-            if (yuv_sample)
+            UINT32 bitrate = param.target_bitrate ? param.target_bitrate : m_tConfig.width * m_tConfig.height * 100;
+            if (send_all || param.target_bitrate != current.target_bitrate)
             {
-                hr1 = m_pMFTVideoEncoder->ProcessInput(0, yuv_sample, 0);
-                if (FAILED(hr1) && hr1 != 0xC00D36B5)
+                if (set_codec_value(codec_api, CODECAPI_AVEncCommonMeanBitRate, bitrate, false))
                 {
-                    output_buffer->Release();
-                    return ENCODE_FAIL;
+                    applied.target_bitrate = param.target_bitrate;
+                }
+                else
+                {
+                    ret = false;
                 }
             }
+            if (param.max_bitrate && (send_all || param.max_bitrate != current.max_bitrate))
+            {
+                if (set_codec_value(codec_api, CODECAPI_AVEncCommonMaxBitRate, param.max_bitrate, false))
+                {
+                    applied.max_bitrate = param.max_bitrate;
+                }
+                else
+                {
+                    ret = false;
+                }
+            }
+            if (param.vbv_size && (send_all || param.vbv_size != current.vbv_size))
+            {
+                if (set_codec_value(codec_api, CODECAPI_AVEncCommonBufferSize, param.vbv_size, false))
+                {
+                    applied.vbv_size = param.vbv_size;
+                }
+                else
+                {
+                    ret = false;
+                }
+            }
+        }
+        if (param.gop_length && (send_all || param.gop_length != current.gop_length))
+        {
+            if (set_codec_value(codec_api, CODECAPI_AVEncMPVGOPSize, param.gop_length, streaming))
+            {
+                applied.gop_length = param.gop_length;
+            }
             else
             {
-                m_pMFTVideoEncoder->ProcessMessage(MFT_MESSAGE_NOTIFY_END_OF_STREAM, 0);
-                m_pMFTVideoEncoder->ProcessMessage(MFT_MESSAGE_COMMAND_DRAIN, 0);
+                ret = false;
             }
-            MFT_OUTPUT_DATA_BUFFER mft_output_data = {};
-            mft_output_data.dwStreamID = 0;
-            mft_output_data.dwStatus = 0;
-            mft_output_data.pSample = nullptr;
-            DWORD dwStatus = 0;
-            MFCreateSample(&mft_output_data.pSample);
-            mft_output_data.pSample->AddBuffer(output_buffer);
-            hr2 = m_pMFTVideoEncoder->ProcessOutput(0, 1, &mft_output_data, &dwStatus);
-            if (FAILED(hr2) && hr2 != 0xC00D6D72)
+        }
+        if ((param.min_qp || param.max_qp) && (send_all || param.min_qp != current.min_qp || param.max_qp != current.max_qp))
+        {
+            // the range is recorded as a pair, a half applied range is sent again in full
+            bool min_set = set_codec_value(codec_api, CODECAPI_AVEncVideoMinQP, param.min_qp, false);
+            bool max_set = set_codec_value(codec_api, CODECAPI_AVEncVideoMaxQP, param.max_qp, false);
+            if (min_set && max_set)
             {
-                mft_output_data.pSample->Release();
-                output_buffer->Release();
-                return ENCODE_FAIL;
+                applied.min_qp = param.min_qp;
+                applied.max_qp = param.max_qp;
             }
-            if (SUCCEEDED(hr2))
+            else
             {
-                mft_output_data.pSample->GetSampleDuration(&output_data.duration);
-                mft_output_data.pSample->GetSampleTime(&output_data.timestamp);
-                UINT32 key_frame = 0;
-                mft_output_data.pSample->GetUINT32(MFSampleExtension_CleanPoint, &key_frame);
-                output_data.key_frame = key_frame != 0;
-                output_buffer->GetCurrentLength(&output_data.size);
-                uint8_t* data = nullptr;
-                output_buffer->Lock(&data, nullptr, nullptr);
-                memcpy(output_data.data, data, output_data.size);
-                output_buffer->Unlock();
-            }
-            mft_output_data.pSample->Release();
-        } while (hr1 == 0xC00D36B5);
-        output_buffer->Release();
-        if (hr2 == 0xC00D6D72)
+                ret = false;
+            }
+        }
+        if (param.mode == RATE_CONTROL_CQP && (send_all || param.qp != current.qp || current.mode != RATE_CONTROL_CQP))
         {
-            if (yuv_sample == nullptr)
+            VARIANT value;
+            VariantInit(&value);
+            value.vt = VT_UI8;
+            value.ullVal = param.qp;
+            if (SUCCEEDED(codec_api->SetValue(&CODECAPI_AVEncVideoEncodeQP, &value)))
             {
-                return ENCODE_EOF;
+                applied.qp = param.qp;
             }
             else
             {
-                return ENCODE_MORE_INPUT;
+                ret = false;
             }
         }
-        return ENCODE_SUCCESS;
+        m_tRateControl = applied;
+        return ret;
     }
 
-    void crop_texture(ID3D11Texture2D* input_texture, ID3D11Texture2D** output_texture)
+    // check_modifiable for values encoders may only take before streaming, e.g. the rate control mode and the gop size
+    static bool set_codec_value(ICodecAPI* codec_api, const GUID& api, UINT32 data, bool check_modifiable)
     {
-        D3D11_TEXTURE2D_DESC input_desc = {};
-        input_texture->GetDesc(&input_desc);
-        D3D11_TEXTURE2D_DESC desc = {};
-        desc.Width = XALIGN((UINT)(input_desc.Width * (m_tCropRatio.right - m_tCropRatio.left)), 16);
-        desc.Height = XALIGN((UINT)(input_desc.Height * (m_tCropRatio.bottom - m_tCropRatio.top)), 2);
-        desc.MipLevels = 1;
-        desc.ArraySize = 1;
-        desc.Format = input_desc.Format;
-        desc.SampleDesc.Count = 1;
-        desc.SampleDesc.Quality = 0;
-        desc.Usage = D3D11_USAGE_DEFAULT;
-        desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-        desc.CPUAccessFlags = 0;
-        desc.MiscFlags = 0;
-        HRESULT hr = m_pD3DDevice->CreateTexture2D(&desc, nullptr, output_texture);
-        if (SUCCEEDED(hr))
+        if (check_modifiable && codec_api->IsModifiable(&api) != S_OK)
         {
-            UINT left = (UINT)(input_desc.Width * m_tCropRatio.left);
-            UINT top = (UINT)(input_desc.Height * m_tCropRatio.top);
-            D3D11_BOX box = { left, top, 0, left + desc.Width, top + desc.Height, 1 };
-            m_pD3DDeviceCtx->CopySubresourceRegion(*output_texture, 0, 0, 0, 0, input_texture, 0, &box);
+            return false;
         }
+        VARIANT value;
+        VariantInit(&value);
+        value.vt = VT_UI4;
+        value.ulVal = data;
+        return SUCCEEDED(codec_api->SetValue(&api, &value));
     }
 
-    void crop_memory_data(uint8_t* input_data, uint8_t** output_data, UINT width, UINT height, VIDEO_FORMAT format)
+    ID3D11Device* m_pD3DDevice{ nullptr };
+    ID3D11DeviceContext* m_pD3DDeviceCtx{ nullptr };
+    IMFTransform* m_pMFTVideoEncoder{ nullptr };
+    IMFTransform* m_pMFTConvert{ nullptr };
+    DX11ShaderNV12* m_pDX11ShaderNV12{ nullptr };
+    ArenaMediaBuffer* m_pOutputBuffer{ nullptr };
+    IMFSample* m_pOutputSample{ nullptr };
+    DWORD m_iOutputMinSize{ 0 };
+    EncoderBackendConfig m_tConfig{};
+    VIDEO_FORMAT m_eInputFormat{ VIDEO_FORMAT_NV12 };
+    RateControlParam m_tRateControl{}; // what the encoder took
+    bool m_bRateControlSettled{ false }; // every value of m_tRateControl is known to be in effect
+};
+
+class MFVideoEncoder::Impl
+{
+public:
+    Impl(ID3D11Device* d3d_device, ID3D11DeviceContext* d3d_context)
+        : m_pD3DDevice(d3d_device)
+        , m_pD3DDeviceCtx(d3d_context)
+    {
+		CoInitializeEx(NULL, COINIT_APARTMENTTHREADED);
+		MFStartup(MF_VERSION);
+        if (m_pD3DDevice == nullptr && m_pD3DDeviceCtx == nullptr)
+        {
+            D3D_FEATURE_LEVEL featureLevels[] =
+            {
+                D3D_FEATURE_LEVEL_11_1,
+                D3D_FEATURE_LEVEL_11_0
+            };
+
+            UINT uiFeatureLevels = ARRAYSIZE(featureLevels);
+            D3D_FEATURE_LEVEL featureLevel;
+            UINT uiD3D11CreateFlag = D3D11_CREATE_DEVICE_SINGLETHREADED;
+            D3D11CreateDevice(NULL, D3D_DRIVER_TYPE_HARDWARE, NULL, uiD3D11CreateFlag, featureLevels, uiFeatureLevels, D3D11_SDK_VERSION, &m_pD3DDevice, &featureLevel, &m_pD3DDeviceCtx);
+            m_bOwnD3DDevice = true;
+        }
+	}
+
+    ~Impl()
+    {
+        // the transform has to be gone before Media Foundation shuts down
+        stop();
+		MFShutdown();
+		CoUninitialize();
+	}
+
+	bool start(int width, int height, int fps_num, int fps_den)
 	{
-		UINT frame_width = XALIGN((UINT)(width * (m_tCropRatio.right - m_tCropRatio.left)), 16);
-		UINT frame_height = XALIGN((UINT)(height * (m_tCropRatio.bottom - m_tCropRatio.top)), 2);
-        if (format == VIDEO_FORMAT_RGB32)
+        MFEncoderBackend* backend = nullptr;
+        if (m_eBackend == ENCODER_BACKEND_MFT)
         {
-            *output_data = new uint8_t[frame_width * frame_height * 4];
-            for (UINT i = 0; i < frame_height; i++)
-            {
-                memcpy(*output_data + i * frame_width * 4, input_data + (UINT)(i + height * m_tCropRatio.top) * width * 4 + (UINT)(width * m_tCropRatio.left) * 4, frame_width * 4);
-            }
+            backend = new MFTransformBackend(m_pD3DDevice, m_pD3DDeviceCtx);
         }
-        else if (format == VIDEO_FORMAT_NV12)
+        else
         {
-            *output_data = new uint8_t[frame_width * frame_height * 3 / 2];
-            for (UINT i = 0; i < frame_height; i++)
-			{
-				memcpy(*output_data + i * frame_width, input_data + (UINT)(i + height * m_tCropRatio.top) * width + (UINT)(width * m_tCropRatio.left), frame_width);
-			}
-            for (UINT i = 0; i < frame_height / 2; i++)
-            {
-                memcpy(*output_data + frame_width * frame_height + i * frame_width, input_data + width * height + (UINT)(i + height * m_tCropRatio.top) * width + (UINT)(width * m_tCropRatio.left), frame_width);
-            }
+            backend = mf_create_encoder_backend(m_eBackend, m_strBackendLibrary.empty() ? nullptr : m_strBackendLibrary.c_str());
         }
-        else if (format == VIDEO_FORMAT_IYUV)
+        return m_Pipeline.start(backend, width, height, fps_num, fps_den);
+	}
+
+	void stop()
+	{
+        m_Pipeline.stop();
+        if (m_bOwnD3DDevice && m_pD3DDevice)
         {
-            *output_data = new uint8_t[frame_width * frame_height * 3 / 2];
-            for (UINT i = 0; i < frame_height; i++)
-            {
-                memcpy(*output_data + i * frame_width, input_data + (UINT)(i + height * m_tCropRatio.top) * width + (UINT)(width * m_tCropRatio.left), frame_width);
-            }
-            for (UINT i = 0; i < frame_height / 2; i++)
-            {
-                memcpy(*output_data + frame_width * frame_height + i * frame_width / 2, input_data + width * height + (UINT)(i + height * m_tCropRatio.top) * width / 2 + (UINT)(width * m_tCropRatio.left) / 2, frame_width / 2);
-            }
-            for (UINT i = 0; i < frame_height / 2; i++)
-            {
-                memcpy(*output_data + frame_width * frame_height * 5 / 4 + i * frame_width / 2, input_data + width * height * 5 / 4 + (UINT)(i + height * m_tCropRatio.top) * width / 2 + (UINT)(width * m_tCropRatio.left) / 2, frame_width / 2);
-            }
-        }
+            m_pD3DDeviceCtx->Release();
+            m_pD3DDeviceCtx = nullptr;
+			m_pD3DDevice->Release();
+			m_pD3DDevice = nullptr;
+		}
 	}
 
-    ID3D11Device* m_pD3DDevice{ nullptr };
-    ID3D11DeviceContext* m_pD3DDeviceCtx{ nullptr };
-    IMFTransform* m_pMFTVideoEncoder{ nullptr };
-    IMFTransform* m_pMFTConvert{ nullptr };
-    DX11ShaderNV12* m_pDX11ShaderNV12{ nullptr };
-    bool m_bOwnD3DDevice{ false };
+    void set_backend(ENCODER_BACKEND backend, const char* library_path)
+    {
+        m_eBackend = backend;
+        m_strBackendLibrary = library_path ? library_path : "";
+    }
 
-    int64_t m_iTimeBase{ MPEG_TIME_BASE };
-    int64_t m_iFrameCount{ 0 };
-    UINT32 m_iEncodedWidth{ 0 };
-    UINT32 m_iEncodedHeight{ 0 };
+	int encode(const InputVTextureData& input_data, OutputVData& output_data)
+	{
+        return m_Pipeline.encode(input_data.texture, input_data.format, input_data.timestamp, input_data.unchanged, output_data);
+	}
 
-    CropRect m_tCropRatio{ 0.0f, 0.0f, 1.0f, 1.0f };
-    float m_fScaleRatio{ 1.0f };
-};
+	int encode(const InputVMemoryData& input_data, OutputVData& output_data)
+	{
+        VideoFrame frame;
+        init_memory_frame(input_data, frame);
+        return m_Pipeline.encode(frame, output_data);
+	}
+
+	int encode(const VideoFrame& frame, OutputVData& output_data)
+	{
+        return m_Pipeline.encode(frame, output_data);
+	}
+
+    int submit(const InputVTextureData& input_data)
+    {
+        protect_device();
+        return m_Pipeline.submit(input_data.texture, input_data.format, input_data.timestamp, input_data.unchanged);
+    }
+
+    int submit(const InputVMemoryData& input_data)
+    {
+        VideoFrame frame;
+        init_memory_frame(input_data, frame);
+        return m_Pipeline.submit(frame);
+    }
+
+    int submit(const VideoFrame& frame)
+    {
+        return m_Pipeline.submit(frame);
+    }
 
+    MFVideoPipeline m_Pipeline;
+
+private:
+    // a view of the caller's buffer, it holds no reference so the planes are always copied or converted
+    static void init_memory_frame(const InputVMemoryData& input_data, VideoFrame& frame)
+    {
+        PIXEL_FORMAT pixel_format = mf_video_pixel_format(input_data.format);
+        mf_video_frame_init(frame, pixel_format, input_data.width, input_data.height, input_data.data, input_data.width * mf_pixel_bytes_per_pixel(pixel_format));
+        frame.unchanged = input_data.unchanged;
+        frame.timestamp = input_data.timestamp;
+    }
 
+    void protect_device()
+    {
+        // the transform reads texture inputs on the encode thread while the caller keeps using the immediate context
+        ID3D10Multithread* multithread = nullptr;
+        if (!m_bDeviceProtected && m_pD3DDevice && SUCCEEDED(m_pD3DDevice->QueryInterface(IID_PPV_ARGS(&multithread))))
+        {
+            multithread->SetMultithreadProtected(TRUE);
+            multithread->Release();
+            m_bDeviceProtected = true;
+        }
+    }
 
+    ID3D11Device* m_pD3DDevice{ nullptr };
+    ID3D11DeviceContext* m_pD3DDeviceCtx{ nullptr };
+    bool m_bOwnD3DDevice{ false };
+    bool m_bDeviceProtected{ false };
+    ENCODER_BACKEND m_eBackend{ ENCODER_BACKEND_MFT };
+    std::string m_strBackendLibrary;
+};
 
 MFVideoEncoder::MFVideoEncoder(ID3D11Device* d3d_device, ID3D11DeviceContext* d3d_context)
 {
@@ -681,7 +960,12 @@ MFVideoEncoder::~MFVideoEncoder()
 
 bool MFVideoEncoder::start(int width, int height, float fps)
 {
-    return impl_->start(width, height, fps);
+    return impl_->start(width, height, (int)(fps * 1000), 1000);
+}
+
+bool MFVideoEncoder::start(int width, int height, int fps_num, int fps_den)
+{
+    return impl_->start(width, height, fps_num, fps_den);
 }
 
 void MFVideoEncoder::stop()
@@ -691,17 +975,87 @@ void MFVideoEncoder::stop()
 
 void MFVideoEncoder::set_time_base(int64_t time_base)
 {
-    impl_->set_time_base(time_base);
+    impl_->m_Pipeline.set_time_base(time_base);
+}
+
+void MFVideoEncoder::set_clock_origin(int64_t origin)
+{
+    impl_->m_Pipeline.set_clock_origin(origin);
 }
 
 void MFVideoEncoder::set_crop_rect(float left, float top, float right, float bottom)
 {
-    impl_->set_crop_rect(left, top, right, bottom);
+    impl_->m_Pipeline.set_crop_rect(left, top, right, bottom);
 }
 
 void MFVideoEncoder::set_scale_ratio(float ratio)
 {
-    impl_->set_scale_ratio(ratio);
+    impl_->m_Pipeline.set_scale_ratio(ratio);
+}
+
+void MFVideoEncoder::set_output_mode(OUTPUT_MODE mode)
+{
+    impl_->m_Pipeline.set_output_mode(mode);
+}
+
+void MFVideoEncoder::set_convert_threads(int thread_count, uint64_t affinity_mask)
+{
+    impl_->m_Pipeline.set_convert_threads(thread_count, affinity_mask);
+}
+
+void MFVideoEncoder::set_backend(ENCODER_BACKEND backend, const char* library_path)
+{
+    impl_->set_backend(backend, library_path);
+}
+
+bool MFVideoEncoder::set_rate_control(const RateControlParam& param)
+{
+    return impl_->m_Pipeline.set_rate_control(param);
+}
+
+void MFVideoEncoder::set_skip_mode(SKIP_MODE mode, int max_skipped_frames)
+{
+    impl_->m_Pipeline.set_skip_mode(mode, max_skipped_frames);
+}
+
+void MFVideoEncoder::set_frame_memory(uint64_t budget_bytes, bool large_pages)
+{
+    impl_->m_Pipeline.set_frame_memory(budget_bytes, large_pages);
+}
+
+void MFVideoEncoder::get_frame_memory_stats(FramePoolStats& stats)
+{
+    impl_->m_Pipeline.get_frame_memory_stats(stats);
+}
+
+void MFVideoEncoder::set_queue_depth(int depth)
+{
+    impl_->m_Pipeline.set_queue_depth(depth);
+}
+
+int MFVideoEncoder::submit(const InputVTextureData& input_data)
+{
+    return impl_->submit(input_data);
+}
+
+int MFVideoEncoder::submit(const InputVMemoryData& input_data)
+{
+    return impl_->submit(input_data);
+}
+
+int MFVideoEncoder::submit(const VideoFrame& frame)
+{
+    return impl_->submit(frame);
+}
+
+int MFVideoEncoder::poll(OutputVData& output_data)
+{
+    return impl_->m_Pipeline.poll(output_data);
+}
+
+void MFVideoEncoder::get_queue_stats(EncodeQueueStats& stats)
+{
+    impl_->m_Pipeline.get_queue_stats(stats);
 }
 
 int MFVideoEncoder::encode(const InputVTextureData& input_data, OutputVData& output_data)
@@ -714,6 +1068,16 @@ int MFVideoEncoder::encode(const InputVMemoryData& input_data, OutputVData& outp
 	return impl_->encode(input_data, output_data);
 }
 
+int MFVideoEncoder::encode(const VideoFrame& frame, OutputVData& output_data)
+{
+	return impl_->encode(frame, output_data);
+}
+
+void MFVideoEncoder::release_output(OutputVData& output_data)
+{
+    impl_->m_Pipeline.release_output(output_data);
+}
+
 
 class MFAudioEncoder::Impl
 {
@@ -725,7 +1089,7 @@ public:
 
 	~Impl()
 	{
-
+		stop();
 	}
 
 	bool start(int sample_rate, int channels, AUDIO_FORMAT format)
@@ -747,7 +1111,13 @@ public:
 				pOutputType->Release();
 			}
 		};
-		int bits = get_bits_per_sample(format);
+		// the AAC MFT only takes 16 bit PCM, other formats are converted in encode()
+		PCM_FORMAT pcm_format = get_pcm_format(format);
+		if (pcm_format == PCM_UNKNOWN || !m_SampleConverter.configure(pcm_format, PCM_S16, channels))
+		{
+			return false;
+		}
+		int bits = 16;
 		MFCreateMediaType(&pInputType);
 		pInputType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Audio);
 		pInputType->SetGUID(MF_MT_SUBTYPE, MFAudioFormat_PCM);
@@ -768,24 +1138,71 @@ public:
 		pOutputType->SetUINT32(MF_MT_AUDIO_NUM_CHANNELS, channels);
 		pOutputType->SetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, sample_rate);
 		pOutputType->SetUINT32(MF_MT_AUDIO_BITS_PER_SAMPLE, bits);
-		pInputType->SetUINT32(MF_MT_AUDIO_BLOCK_ALIGNMENT, bits / 8 * channels);
-		pOutputType->SetUINT32(MF_MT_AUDIO_AVG_BYTES_PER_SECOND, bits / 8 * channels * sample_rate);
+		pOutputType->SetUINT32(MF_MT_AUDIO_AVG_BYTES_PER_SECOND, AAC_BYTES_PER_SECOND);
 		pOutputType->SetUINT32(MF_MT_AAC_PAYLOAD_TYPE, 0);
 		hr = m_pMFTAudioEncoder->SetOutputType(0, pOutputType, 0);
 		if (FAILED(hr))
 		{
 			return false;
 		}
+
+		// frame times are kept in 100ns units like the MFT's, set_time_base only applies to the output
+		if (!m_PcmAssembler.configure(AUDIO_FORMAT_S16LE, channels, sample_rate, AAC_FRAME_SIZE, MF_HNS_PER_SECOND))
+		{
+			return false;
+		}
+		m_iSampleRate = sample_rate;
+		m_iChannels = channels;
+		m_eFormat = format;
+		m_iResampleRate = 0;
+		m_bEof = false;
+		MFT_OUTPUT_STREAM_INFO stream_info = {};
+		m_pMFTAudioEncoder->GetOutputStreamInfo(0, &stream_info);
+		m_iOutputMinSize = stream_info.cbSize > 0 ? stream_info.cbSize : MAX_AAC_FRAME_SIZE;
+		m_BitstreamArena.reset(m_iOutputMinSize, MAX_PENDING_AUDIO_OUTPUTS);
+		m_pInputBuffer = new ArenaMediaBuffer();
+		MFCreateSample(&m_pInputSample);
+		m_pInputSample->AddBuffer(m_pInputBuffer);
+		m_pOutputBuffer = new ArenaMediaBuffer();
+		MFCreateSample(&m_pOutputSample);
+		m_pOutputSample->AddBuffer(m_pOutputBuffer);
 		return true;
 	}
 
 	void stop()
 	{
+		while (!m_dqPendingOutputs.empty())
+		{
+			m_BitstreamArena.release(m_dqPendingOutputs.front().lease.block);
+			m_dqPendingOutputs.pop_front();
+		}
 		if (m_pMFTAudioEncoder)
 		{
 			m_pMFTAudioEncoder->Release();
 			m_pMFTAudioEncoder = nullptr;
 		}
+		if (m_pInputSample)
+		{
+			m_pInputSample->Release();
+			m_pInputSample = nullptr;
+		}
+		if (m_pInputBuffer)
+		{
+			m_pInputBuffer->Release();
+			m_pInputBuffer = nullptr;
+		}
+		if (m_pOutputSample)
+		{
+			m_pOutputSample->Release();
+			m_pOutputSample = nullptr;
+		}
+		if (m_pOutputBuffer)
+		{
+			m_pOutputBuffer->Release();
+			m_pOutputBuffer = nullptr;
+		}
+		m_PcmAssembler.reset();
+		m_BitstreamArena.trim();
 	}
 
 	void set_time_base(int64_t time_base)
@@ -793,13 +1210,292 @@ public:
 		m_iTimeBase = time_base;
 	}
 
+	void set_clock_origin(int64_t origin)
+	{
+		m_iClockOrigin = origin;
+		m_bClockOrigin = true;
+	}
+
 	int encode(const InputAMemoryData& input_data, OutputAData& output_data)
 	{
-		// TODO
+		if (!m_pMFTAudioEncoder)
+		{
+			return ENCODE_FAIL;
+		}
+		if (input_data.data == nullptr || input_data.size == 0)
+		{
+			if (m_iResampleRate > 0 && !resample(nullptr, 0, -1))
+			{
+				return ENCODE_FAIL;
+			}
+			PcmFrame frame = {};
+			while (m_PcmAssembler.flush(frame))
+			{
+				if (!encode_frame(frame))
+				{
+					return ENCODE_FAIL;
+				}
+			}
+			m_pMFTAudioEncoder->ProcessMessage(MFT_MESSAGE_NOTIFY_END_OF_STREAM, 0);
+			m_pMFTAudioEncoder->ProcessMessage(MFT_MESSAGE_COMMAND_DRAIN, 0);
+			if (!collect_outputs())
+			{
+				return ENCODE_FAIL;
+			}
+			m_bEof = true;
+			return poll(output_data);
+		}
+		if (input_data.channels != m_iChannels || input_data.format != m_eFormat)
+		{
+			return ENCODE_FAIL;
+		}
+		int block_align = get_bits_per_sample(m_eFormat) / 8 * m_iChannels;
+		if (input_data.size % block_align)
+		{
+			return ENCODE_FAIL;
+		}
+		m_bEof = false;
+		int samples = (int)(input_data.size / block_align);
+		const uint8_t* data = input_data.data;
+		int64_t timestamp = -1;
+		if (input_data.timestamp >= 0 && m_bClockOrigin)
+		{
+			// capture time on the mf_clock_now timeline is already in 100ns units. samples from before the origin are
+			// dropped, the first one kept lands on 0
+			int64_t early = input_data.timestamp < m_iClockOrigin ? mf_rescale(m_iClockOrigin - input_data.timestamp, input_data.sample_rate, MF_HNS_PER_SECOND) : 0;
+			if (early >= samples)
+			{
+				return ENCODE_DROPPED;
+			}
+			data += early * block_align;
+			samples -= (int)early;
+			timestamp = early > 0 ? 0 : input_data.timestamp - m_iClockOrigin;
+		}
+		else if (input_data.timestamp >= 0)
+		{
+			timestamp = mf_rescale(input_data.timestamp, MF_HNS_PER_SECOND, m_iTimeBase);
+		}
+		if (input_data.sample_rate != m_iSampleRate)
+		{
+			if (!configure_resampler(input_data.sample_rate) || !resample(data, samples, timestamp))
+			{
+				return ENCODE_FAIL;
+			}
+			return poll(output_data);
+		}
+		const uint8_t* pcm = data;
+		unsigned long pcm_size = (unsigned long)samples * block_align;
+		if (m_eFormat != AUDIO_FORMAT_S16LE)
+		{
+			pcm_size = (unsigned long)samples * m_iChannels * 2;
+			if (m_vecConverted.size() < pcm_size)
+			{
+				m_vecConverted.resize(pcm_size);
+			}
+			const uint8_t* in_planes[1] = { data };
+			uint8_t* out_planes[1] = { m_vecConverted.data() };
+			m_SampleConverter.convert(in_planes, out_planes, samples);
+			pcm = m_vecConverted.data();
+		}
+		if (!push_pcm(pcm, pcm_size, timestamp))
+		{
+			return ENCODE_FAIL;
+		}
+		return poll(output_data);
+	}
+
+	int poll(OutputAData& output_data)
+	{
+		if (m_dqPendingOutputs.empty())
+		{
+			return m_bEof ? ENCODE_EOF : ENCODE_MORE_INPUT;
+		}
+		PendingAudioOutput& pending = m_dqPendingOutputs.front();
+		output_data.size = pending.lease.size;
+		if (output_data.data == nullptr || output_data.capacity < pending.lease.size)
+		{
+			return ENCODE_FAIL;
+		}
+		memcpy(output_data.data, pending.lease.data, pending.lease.size);
+		output_data.timestamp = mf_rescale(pending.timestamp, m_iTimeBase, MF_HNS_PER_SECOND);
+		output_data.duration = mf_rescale(pending.timestamp + pending.duration, m_iTimeBase, MF_HNS_PER_SECOND) - output_data.timestamp;
+		m_BitstreamArena.release(pending.lease.block);
+		m_dqPendingOutputs.pop_front();
 		return ENCODE_SUCCESS;
 	}
 
 private:
+	struct PendingAudioOutput
+	{
+		BitstreamLease lease;
+		int64_t timestamp; // 100ns units
+		int64_t duration;
+	};
+
+	bool encode_frame(const PcmFrame& frame)
+	{
+		DWORD frame_bytes = (DWORD)m_PcmAssembler.get_frame_size() * m_iChannels * 2;
+		// the MFT reads the frame in place, it is done with it once its output has been collected
+		m_pInputBuffer->bind(const_cast<uint8_t*>(frame.data), frame_bytes);
+		m_pInputBuffer->SetCurrentLength(frame_bytes);
+		m_pInputSample->SetSampleTime(frame.timestamp);
+		m_pInputSample->SetSampleDuration(frame.duration);
+		HRESULT hr = m_pMFTAudioEncoder->ProcessInput(0, m_pInputSample, 0);
+		if (hr == 0xC00D36B5)
+		{
+			if (!collect_outputs())
+			{
+				return false;
+			}
+			hr = m_pMFTAudioEncoder->ProcessInput(0, m_pInputSample, 0);
+		}
+		if (FAILED(hr))
+		{
+			return false;
+		}
+		return collect_outputs();
+	}
+
+	// the frames may point into the input, they are all encoded before returning
+	bool push_pcm(const uint8_t* pcm, unsigned long size, int64_t timestamp)
+	{
+		if (!m_PcmAssembler.push(pcm, size, timestamp))
+		{
+			return false;
+		}
+		PcmFrame frame = {};
+		while (m_PcmAssembler.pop(frame))
+		{
+			if (!encode_frame(frame))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool configure_resampler(int sample_rate)
+	{
+		if (sample_rate == m_iResampleRate)
+		{
+			return true;
+		}
+		if (!m_Resampler.configure(sample_rate, m_iSampleRate, m_iChannels, RESAMPLE_QUALITY_MEDIUM) ||
+			!m_ResampleInConverter.configure(get_pcm_format(m_eFormat), PCM_FLT, m_iChannels) ||
+			!m_ResampleOutConverter.configure(PCM_FLT, PCM_S16, m_iChannels))
+		{
+			m_iResampleRate = 0;
+			return false;
+		}
+		m_iResampleRate = sample_rate;
+		return true;
+	}
+
+	// input at another rate goes through float, the resampler and back to S16. null data drains the resampler
+	bool resample(const uint8_t* data, int samples, int64_t timestamp)
+	{
+		int channels = m_iChannels;
+		int64_t out_timestamp = -1;
+		if (data)
+		{
+			// the first output of this call may still come from the previous input, the offset says how far back
+			if (timestamp >= 0)
+			{
+				out_timestamp = timestamp + (int64_t)floor(m_Resampler.get_output_offset() * MF_HNS_PER_SECOND / m_iResampleRate + 0.5);
+			}
+			if (m_vecResampleInput.size() < (size_t)samples * channels)
+			{
+				m_vecResampleInput.resize((size_t)samples * channels);
+			}
+			const uint8_t* in_planes[1] = { data };
+			uint8_t* float_planes[1] = { (uint8_t*)m_vecResampleInput.data() };
+			m_ResampleInConverter.convert(in_planes, float_planes, samples);
+		}
+		int capacity = m_Resampler.get_max_output(data ? samples : m_Resampler.get_latency());
+		if (m_vecResampleOutput.size() < (size_t)capacity * channels)
+		{
+			m_vecResampleOutput.resize((size_t)capacity * channels);
+		}
+		int count = 0;
+		do
+		{
+			count = data ? m_Resampler.process(m_vecResampleInput.data(), samples, m_vecResampleOutput.data(), capacity)
+				: m_Resampler.flush(m_vecResampleOutput.data(), capacity);
+			unsigned long pcm_size = (unsigned long)count * channels * 2;
+			if (m_vecConverted.size() < pcm_size)
+			{
+				m_vecConverted.resize(pcm_size);
+			}
+			const uint8_t* float_planes[1] = { (const uint8_t*)m_vecResampleOutput.data() };
+			uint8_t* out_planes[1] = { m_vecConverted.data() };
+			m_ResampleOutConverter.convert(float_planes, out_planes, count);
+			if (count > 0 && !push_pcm(m_vecConverted.data(), pcm_size, out_timestamp))
+			{
+				return false;
+			}
+			out_timestamp = -1;
+			samples = 0;
+		} while (count == capacity);
+		return true;
+	}
+
+	bool collect_outputs()
+	{
+		while (true)
+		{
+			BitstreamLease lease = {};
+			if (!m_BitstreamArena.acquire(m_iOutputMinSize, lease))
+			{
+				return false;
+			}
+			m_pOutputSample->DeleteAllItems();
+			m_pOutputBuffer->bind(lease.data, lease.capacity);
+			MFT_OUTPUT_DATA_BUFFER mft_output_data = {};
+			mft_output_data.dwStreamID = 0;
+			mft_output_data.pSample = m_pOutputSample;
+			DWORD dwStatus = 0;
+			HRESULT hr = m_pMFTAudioEncoder->ProcessOutput(0, 1, &mft_output_data, &dwStatus);
+			if (mft_output_data.pEvents)
+			{
+				mft_output_data.pEvents->Release();
+			}
+			if (FAILED(hr))
+			{
+				m_BitstreamArena.release(lease.block);
+				return hr == 0xC00D6D72;
+			}
+			PendingAudioOutput pending = {};
+			m_pOutputSample->GetSampleTime(&pending.timestamp);
+			m_pOutputSample->GetSampleDuration(&pending.duration);
+			DWORD length = 0;
+			m_pOutputBuffer->GetCurrentLength(&length);
+			m_BitstreamArena.commit(lease, length);
+			pending.lease = lease;
+			m_dqPendingOutputs.push_back(pending);
+		}
+	}
+
+	PCM_FORMAT get_pcm_format(AUDIO_FORMAT format)
+	{
+		switch (format)
+		{
+		case AUDIO_FORMAT_U8:
+			return PCM_U8;
+		case AUDIO_FORMAT_S16LE:
+			return PCM_S16;
+		case AUDIO_FORMAT_S24LE:
+			return PCM_S24;
+		case AUDIO_FORMAT_S32LE:
+			return PCM_S32;
+		case AUDIO_FORMAT_FLT:
+			return PCM_FLT;
+		case AUDIO_FORMAT_DBL:
+			return PCM_DBL;
+		default:
+			return PCM_UNKNOWN;
+		}
+	}
+
 	int get_bits_per_sample(AUDIO_FORMAT format)
 	{
 		switch (format)
@@ -822,6 +1518,28 @@ private:
 
 	IMFTransform* m_pMFTAudioEncoder{ nullptr };
 	int64_t m_iTimeBase{ MPEG_TIME_BASE };
+	int64_t m_iClockOrigin{ 0 };
+	bool m_bClockOrigin{ false };
+	int m_iSampleRate{ 0 };
+	int m_iChannels{ 0 };
+	AUDIO_FORMAT m_eFormat{ AUDIO_FORMAT_S16LE };
+	MFSampleConverter m_SampleConverter;
+	std::vector<uint8_t> m_vecConverted; // grows to the largest input, S16
+	MFResampler m_Resampler; // input at another rate than start() is resampled
+	MFSampleConverter m_ResampleInConverter;
+	MFSampleConverter m_ResampleOutConverter;
+	std::vector<float> m_vecResampleInput;
+	std::vector<float> m_vecResampleOutput;
+	int m_iResampleRate{ 0 };
+	MFPcmAssembler m_PcmAssembler;
+	IMFSample* m_pInputSample{ nullptr };
+	ArenaMediaBuffer* m_pInputBuffer{ nullptr };
+	IMFSample* m_pOutputSample{ nullptr };
+	ArenaMediaBuffer* m_pOutputBuffer{ nullptr };
+	MFBitstreamArena m_BitstreamArena;
+	unsigned long m_iOutputMinSize{ 0 };
+	std::deque<PendingAudioOutput> m_dqPendingOutputs;
+	bool m_bEof{ false };
 };
 
 MFAudioEncoder::MFAudioEncoder()
@@ -849,7 +1567,17 @@ void MFAudioEncoder::set_time_base(int64_t time_base)
 	impl_->set_time_base(time_base);
 }
 
+void MFAudioEncoder::set_clock_origin(int64_t origin)
+{
+	impl_->set_clock_origin(origin);
+}
+
 int MFAudioEncoder::encode(const InputAMemoryData& input_data, OutputAData& output_data)
 {
 	return impl_->encode(input_data, output_data);
+}
+
+int MFAudioEncoder::poll(OutputAData& output_data)
+{
+	return impl_->poll(output_data);
 }
\ No newline at end of file
@@ -0,0 +1,86 @@
+#include "mf_encoder_backend.h"
+#include "mf_openh264_backend.h"
+#include <string.h>
+
+// Stands in for a codec when benchmarking the pipeline: every frame becomes one access unit delimiter NAL, with
+// key frames on the configured gop so downstream stages see a realistic packet pattern.
+class MFNullBackend final : public MFEncoderBackend
+{
+public:
+	bool open(const EncoderBackendConfig& config) override
+	{
+		m_tConfig = config;
+		m_iFrameCount = 0;
+		m_bForceKeyFrame = false;
+		return config.width > 0 && config.height > 0;
+	}
+
+	void close() override
+	{
+	}
+
+	VIDEO_FORMAT get_input_format() override
+	{
+		return VIDEO_FORMAT_IYUV;
+	}
+
+	unsigned long get_max_packet_size() override
+	{
+		return 64;
+	}
+
+	bool set_rate_control(const RateControlParam& param) override
+	{
+		m_tConfig.rate_control = param;
+		return true;
+	}
+
+	void force_key_frame() override
+	{
+		m_bForceKeyFrame = true;
+	}
+
+	int encode(const EncoderFrame* frame, uint8_t* dst, unsigned long capacity, EncoderPacket& packet) override
+	{
+		static const uint8_t access_unit_delimiter[] = { 0x00, 0x00, 0x00, 0x01, 0x09, 0xF0 };
+		if (!frame)
+		{
+			return ENCODE_EOF;
+		}
+		if (capacity < sizeof(access_unit_delimiter))
+		{
+			return ENCODE_FAIL;
+		}
+		uint32_t gop_length = m_tConfig.rate_control.gop_length;
+		if (gop_length == 0 && m_tConfig.fps_den > 0)
+		{
+			gop_length = m_tConfig.fps_num * 5 / m_tConfig.fps_den;
+		}
+		memcpy(dst, access_unit_delimiter, sizeof(access_unit_delimiter));
+		packet.size = sizeof(access_unit_delimiter);
+		packet.timestamp = frame->timestamp;
+		packet.duration = frame->duration;
+		packet.key_frame = m_bForceKeyFrame || gop_length == 0 || m_iFrameCount % gop_length == 0;
+		m_bForceKeyFrame = false;
+		m_iFrameCount++;
+		return ENCODE_SUCCESS;
+	}
+
+private:
+	EncoderBackendConfig m_tConfig{};
+	int64_t m_iFrameCount{ 0 };
+	bool m_bForceKeyFrame{ false };
+};
+
+MFEncoderBackend* mf_create_encoder_backend(ENCODER_BACKEND backend, const char* library_path)
+{
+	switch (backend)
+	{
+	case ENCODER_BACKEND_OPENH264:
+		return new MFOpenH264Backend(library_path);
+	case ENCODER_BACKEND_NULL:
+		return new MFNullBackend();
+	default:
+		return nullptr;
+	}
+}
@@ -0,0 +1,715 @@
+#include "mf_nal_parser.h"
+#include "mf_cpu.h"
+#include <string.h>
+
+#if defined(MF_ARCH_X86)
+#include <immintrin.h>
+#elif defined(MF_ARCH_ARM64)
+#include <arm_neon.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// p[2] > 1 rules out a start code at p, p + 1 and p + 2, p[1] != 0 rules out p and p + 1
+static const uint8_t* find_start_code_c(const uint8_t* p, const uint8_t* end)
+{
+	while (end - p >= 3)
+	{
+		if (p[2] > 1)
+		{
+			p += 3;
+		}
+		else if (p[1])
+		{
+			p += 2;
+		}
+		else if (p[0] || p[2] != 1)
+		{
+			p++;
+		}
+		else
+		{
+			return p;
+		}
+	}
+	return end;
+}
+
+#if defined(MF_ARCH_X86)
+// three shifted loads compared against 00 00 01 give one candidate bit per position
+MF_TARGET_AVX2 static const uint8_t* find_start_code_avx2(const uint8_t* p, const uint8_t* end)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi8(1);
+	while (end - p >= 34)
+	{
+		uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), zero));
+		if (mask)
+		{
+			mask &= (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + 1)), zero));
+			mask &= (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + 2)), one));
+			if (mask)
+			{
+#ifdef _MSC_VER
+				unsigned long index = 0;
+				_BitScanForward(&index, mask);
+				return p + index;
+#else
+				return p + __builtin_ctz(mask);
+#endif
+			}
+		}
+		p += 32;
+	}
+	return find_start_code_c(p, end);
+}
+#elif defined(MF_ARCH_ARM64)
+static const uint8_t* find_start_code_neon(const uint8_t* p, const uint8_t* end)
+{
+	const uint8x16_t zero = vdupq_n_u8(0);
+	const uint8x16_t one = vdupq_n_u8(1);
+	while (end - p >= 18)
+	{
+		uint8x16_t match = vandq_u8(vceqq_u8(vld1q_u8(p), zero), vceqq_u8(vld1q_u8(p + 1), zero));
+		match = vandq_u8(match, vceqq_u8(vld1q_u8(p + 2), one));
+		if (vmaxvq_u8(match))
+		{
+			return find_start_code_c(p, p + 18);
+		}
+		p += 16;
+	}
+	return find_start_code_c(p, end);
+}
+#endif
+
+typedef const uint8_t* (*FindStartCodeFunc)(const uint8_t* p, const uint8_t* end);
+
+static FindStartCodeFunc select_find_start_code()
+{
+#if defined(MF_ARCH_X86)
+	if (mf_cpu_has(CPU_FEATURE_AVX2))
+	{
+		return find_start_code_avx2;
+	}
+#elif defined(MF_ARCH_ARM64)
+	if (mf_cpu_has(CPU_FEATURE_NEON))
+	{
+		return find_start_code_neon;
+	}
+#endif
+	return find_start_code_c;
+}
+
+const uint8_t* mf_find_start_code(const uint8_t* data, const uint8_t* end)
+{
+	if (!data || data >= end)
+	{
+		return end;
+	}
+	return select_find_start_code()(data, end);
+}
+
+static inline void add_unit(std::vector<NalUnit>& units, const uint8_t* base, const uint8_t* data, unsigned long size, int prefix_size)
+{
+	NalUnit unit;
+	unit.data = data;
+	unit.size = size;
+	unit.offset = (unsigned long)(data - base);
+	unit.prefix_size = prefix_size;
+	unit.type = data[0] & 0x1F;
+	unit.ref_idc = (data[0] >> 5) & 0x3;
+	units.push_back(unit);
+}
+
+// calls handler(nal, size, prefix_size) for every unit in order until it returns false, false then
+template<typename Handler>
+static bool walk_annexb(const uint8_t* data, unsigned long size, Handler& handler)
+{
+	if (!data)
+	{
+		return true;
+	}
+	const uint8_t* end = data + size;
+	const uint8_t* previous_end = data;
+	const uint8_t* p = mf_find_start_code(data, end);
+	while (p < end)
+	{
+		const uint8_t* nal = p + 3;
+		const uint8_t* next = mf_find_start_code(nal, end);
+		// trailing_zero_8bits and the leading zero of a 4 byte start code belong to neither unit
+		const uint8_t* nal_end = next;
+		while (nal_end > nal && nal_end[-1] == 0)
+		{
+			nal_end--;
+		}
+		if (nal_end > nal)
+		{
+			if (!handler(nal, (unsigned long)(nal_end - nal), (int)(nal - previous_end)))
+			{
+				return false;
+			}
+			previous_end = nal_end;
+		}
+		p = next;
+	}
+	return true;
+}
+
+void mf_split_annexb(const uint8_t* data, unsigned long size, std::vector<NalUnit>& units)
+{
+	units.clear();
+	auto handler = [&](const uint8_t* nal, unsigned long nal_size, int prefix_size)
+	{
+		add_unit(units, data, nal, nal_size, prefix_size);
+		return true;
+	};
+	walk_annexb(data, size, handler);
+}
+
+bool mf_split_avcc(const uint8_t* data, unsigned long size, int length_size, std::vector<NalUnit>& units)
+{
+	units.clear();
+	if (!data || (length_size != 1 && length_size != 2 && length_size != 4))
+	{
+		return false;
+	}
+	unsigned long offset = 0;
+	while (offset < size)
+	{
+		if (size - offset < (unsigned long)length_size)
+		{
+			return false;
+		}
+		unsigned long length = 0;
+		for (int i = 0; i < length_size; i++)
+		{
+			length = (length << 8) | data[offset + i];
+		}
+		offset += length_size;
+		if (length > size - offset)
+		{
+			return false;
+		}
+		if (length)
+		{
+			add_unit(units, data, data + offset, length, length_size);
+		}
+		offset += length;
+	}
+	return true;
+}
+
+bool mf_annexb_to_avcc_in_place(uint8_t* data, unsigned long size, std::vector<NalUnit>& units)
+{
+	mf_split_annexb(data, size, units);
+	if (units.empty())
+	{
+		return false;
+	}
+	for (auto& unit : units)
+	{
+		if (unit.prefix_size != 4)
+		{
+			return false;
+		}
+	}
+	const NalUnit& last = units.back();
+	if (last.offset + last.size != size)
+	{
+		return false;
+	}
+	for (auto& unit : units)
+	{
+		uint8_t* prefix = data + unit.offset - 4;
+		prefix[0] = (uint8_t)(unit.size >> 24);
+		prefix[1] = (uint8_t)(unit.size >> 16);
+		prefix[2] = (uint8_t)(unit.size >> 8);
+		prefix[3] = (uint8_t)unit.size;
+	}
+	return true;
+}
+
+unsigned long mf_annexb_to_avcc(const uint8_t* data, unsigned long size, uint8_t* dst, unsigned long capacity)
+{
+	unsigned long written = 0;
+	auto handler = [&](const uint8_t* nal, unsigned long nal_size, int)
+	{
+		if (capacity - written < nal_size + 4)
+		{
+			return false;
+		}
+		dst[written] = (uint8_t)(nal_size >> 24);
+		dst[written + 1] = (uint8_t)(nal_size >> 16);
+		dst[written + 2] = (uint8_t)(nal_size >> 8);
+		dst[written + 3] = (uint8_t)nal_size;
+		memcpy(dst + written + 4, nal, nal_size);
+		written += nal_size + 4;
+		return true;
+	};
+	return walk_annexb(data, size, handler) ? written : 0;
+}
+
+// the lengths are walked twice, once to check nothing is truncated before the buffer is touched
+bool mf_avcc_to_annexb_in_place(uint8_t* data, unsigned long size)
+{
+	if (!data)
+	{
+		return false;
+	}
+	for (int pass = 0; pass < 2; pass++)
+	{
+		unsigned long offset = 0;
+		while (offset < size)
+		{
+			if (size - offset < 4)
+			{
+				return false;
+			}
+			uint8_t* prefix = data + offset;
+			unsigned long length = ((unsigned long)prefix[0] << 24) | ((unsigned long)prefix[1] << 16) | ((unsigned long)prefix[2] << 8) | prefix[3];
+			if (length > size - offset - 4)
+			{
+				return false;
+			}
+			if (pass && length)
+			{
+				prefix[0] = 0;
+				prefix[1] = 0;
+				prefix[2] = 0;
+				prefix[3] = 1;
+			}
+			offset += 4 + length;
+		}
+	}
+	return true;
+}
+
+// Exp-Golomb reader over the escaped payload, emulation prevention bytes (00 00 03) are dropped on the fly
+struct NalBitReader
+{
+	const uint8_t* p;
+	const uint8_t* end;
+	uint32_t current{ 0 };
+	int bits_left{ 0 };
+	int zero_count{ 0 };
+	bool overrun{ false };
+
+	NalBitReader(const uint8_t* data, unsigned long size) : p(data), end(data + size) {}
+
+	bool load()
+	{
+		if (p >= end)
+		{
+			overrun = true;
+			return false;
+		}
+		uint8_t value = *p++;
+		if (zero_count == 2 && value == 3)
+		{
+			zero_count = 0;
+			if (p >= end)
+			{
+				overrun = true;
+				return false;
+			}
+			value = *p++;
+		}
+		zero_count = value ? 0 : zero_count + 1;
+		current = value;
+		bits_left = 8;
+		return true;
+	}
+
+	uint32_t bit()
+	{
+		if (!bits_left && !load())
+		{
+			return 0;
+		}
+		return (current >> --bits_left) & 1;
+	}
+
+	uint32_t bits(int count)
+	{
+		uint32_t value = 0;
+		for (int i = 0; i < count; i++)
+		{
+			value = (value << 1) | bit();
+		}
+		return value;
+	}
+
+	uint32_t ue()
+	{
+		int leading_zeros = 0;
+		while (!bit())
+		{
+			if (overrun || ++leading_zeros > 31)
+			{
+				overrun = true;
+				return 0;
+			}
+		}
+		return leading_zeros ? ((1u << leading_zeros) - 1) + bits(leading_zeros) : 0;
+	}
+
+	int32_t se()
+	{
+		uint32_t value = ue();
+		return value & 1 ? (int32_t)((value + 1) / 2) : -(int32_t)(value / 2);
+	}
+};
+
+static void skip_scaling_list(NalBitReader& reader, int size)
+{
+	int last_scale = 8;
+	int next_scale = 8;
+	for (int i = 0; i < size; i++)
+	{
+		if (next_scale)
+		{
+			next_scale = (last_scale + reader.se() + 256) % 256;
+		}
+		last_scale = next_scale ? next_scale : last_scale;
+	}
+}
+
+bool mf_parse_sps(const uint8_t* data, unsigned long size, H264Sps& sps)
+{
+	if (!data || size < 4 || (data[0] & 0x1F) != NAL_TYPE_SPS)
+	{
+		return false;
+	}
+	NalBitReader reader(data + 1, size - 1);
+	memset(&sps, 0, sizeof(sps));
+	sps.profile_idc = reader.bits(8);
+	sps.constraint_flags = reader.bits(8);
+	sps.level_idc = reader.bits(8);
+	uint32_t id = reader.ue();
+	if (id >= 32)
+	{
+		return false;
+	}
+	sps.id = (int)id;
+	sps.chroma_format_idc = 1;
+	sps.bit_depth_luma = 8;
+	sps.bit_depth_chroma = 8;
+	switch (sps.profile_idc)
+	{
+	case 100: case 110: case 122: case 244: case 44: case 83: case 86: case 118: case 128: case 138: case 139: case 134: case 135:
+	{
+		sps.chroma_format_idc = (int)reader.ue();
+		if (sps.chroma_format_idc > 3)
+		{
+			return false;
+		}
+		if (sps.chroma_format_idc == 3)
+		{
+			sps.separate_colour_plane = reader.bit() != 0;
+		}
+		sps.bit_depth_luma = (int)reader.ue() + 8;
+		sps.bit_depth_chroma = (int)reader.ue() + 8;
+		reader.bit(); // qpprime_y_zero_transform_bypass_flag
+		if (reader.bit()) // seq_scaling_matrix_present_flag
+		{
+			int lists = sps.chroma_format_idc == 3 ? 12 : 8;
+			for (int i = 0; i < lists; i++)
+			{
+				if (reader.bit())
+				{
+					skip_scaling_list(reader, i < 6 ? 16 : 64);
+				}
+			}
+		}
+		break;
+	}
+	default:
+		break;
+	}
+	sps.log2_max_frame_num = (int)reader.ue() + 4;
+	sps.poc_type = (int)reader.ue();
+	if (sps.log2_max_frame_num > 16 || sps.poc_type > 2)
+	{
+		return false;
+	}
+	if (sps.poc_type == 0)
+	{
+		sps.log2_max_poc_lsb = (int)reader.ue() + 4;
+		if (sps.log2_max_poc_lsb > 16)
+		{
+			return false;
+		}
+	}
+	else if (sps.poc_type == 1)
+	{
+		reader.bit(); // delta_pic_order_always_zero_flag
+		reader.se(); // offset_for_non_ref_pic
+		reader.se(); // offset_for_top_to_bottom_field
+		uint32_t cycle = reader.ue();
+		if (cycle > 255)
+		{
+			return false;
+		}
+		for (uint32_t i = 0; i < cycle; i++)
+		{
+			reader.se();
+		}
+	}
+	sps.max_num_ref_frames = (int)reader.ue();
+	reader.bit(); // gaps_in_frame_num_value_allowed_flag
+	uint32_t width_mbs = reader.ue() + 1;
+	uint32_t height_map_units = reader.ue() + 1;
+	sps.frame_mbs_only = reader.bit() != 0;
+	if (!sps.frame_mbs_only)
+	{
+		reader.bit(); // mb_adaptive_frame_field_flag
+	}
+	reader.bit(); // direct_8x8_inference_flag
+	uint32_t crop_left = 0, crop_right = 0, crop_top = 0, crop_bottom = 0;
+	if (reader.bit())
+	{
+		crop_left = reader.ue();
+		crop_right = reader.ue();
+		crop_top = reader.ue();
+		crop_bottom = reader.ue();
+	}
+	if (reader.overrun || width_mbs > 1024 || height_map_units > 1024)
+	{
+		return false;
+	}
+	// crop units follow the chroma subsampling, ChromaArrayType 0 crops in luma samples
+	int chroma_array_type = sps.separate_colour_plane ? 0 : sps.chroma_format_idc;
+	int crop_unit_x = chroma_array_type == 1 || chroma_array_type == 2 ? 2 : 1;
+	int crop_unit_y = (chroma_array_type == 1 ? 2 : 1) * (sps.frame_mbs_only ? 1 : 2);
+	sps.width = (int)width_mbs * 16 - crop_unit_x * (int)(crop_left + crop_right);
+	sps.height = (int)height_map_units * 16 * (sps.frame_mbs_only ? 1 : 2) - crop_unit_y * (int)(crop_top + crop_bottom);
+	return sps.width > 0 && sps.height > 0;
+}
+
+bool mf_parse_pps(const uint8_t* data, unsigned long size, H264Pps& pps)
+{
+	if (!data || size < 2 || (data[0] & 0x1F) != NAL_TYPE_PPS)
+	{
+		return false;
+	}
+	NalBitReader reader(data + 1, size - 1);
+	memset(&pps, 0, sizeof(pps));
+	uint32_t id = reader.ue();
+	uint32_t sps_id = reader.ue();
+	pps.entropy_coding_mode = reader.bit() != 0;
+	pps.bottom_field_pic_order_present = reader.bit() != 0;
+	if (reader.overrun || id >= 256 || sps_id >= 32)
+	{
+		return false;
+	}
+	pps.id = (int)id;
+	pps.sps_id = (int)sps_id;
+	return true;
+}
+
+MFParameterSetCache::MFParameterSetCache()
+{
+	clear();
+}
+
+MFParameterSetCache::~MFParameterSetCache()
+{
+}
+
+void MFParameterSetCache::clear()
+{
+	memset(m_tSps, 0, sizeof(m_tSps));
+	memset(m_tPps, 0, sizeof(m_tPps));
+	for (auto& nal : m_vecSpsNal)
+	{
+		nal.clear();
+	}
+	for (auto& nal : m_vecPpsNal)
+	{
+		nal.clear();
+	}
+	m_iVersion++;
+}
+
+bool MFParameterSetCache::update(const NalUnit& nal)
+{
+	std::vector<uint8_t>* stored = nullptr;
+	if (nal.type == NAL_TYPE_SPS)
+	{
+		H264Sps sps;
+		if (!mf_parse_sps(nal.data, nal.size, sps))
+		{
+			return false;
+		}
+		stored = &m_vecSpsNal[sps.id];
+		if (stored->size() == nal.size && memcmp(stored->data(), nal.data, nal.size) == 0)
+		{
+			return false;
+		}
+		m_tSps[sps.id] = sps;
+	}
+	else if (nal.type == NAL_TYPE_PPS)
+	{
+		H264Pps pps;
+		if (!mf_parse_pps(nal.data, nal.size, pps))
+		{
+			return false;
+		}
+		stored = &m_vecPpsNal[pps.id];
+		if (stored->size() == nal.size && memcmp(stored->data(), nal.data, nal.size) == 0)
+		{
+			return false;
+		}
+		m_tPps[pps.id] = pps;
+	}
+	else
+	{
+		return false;
+	}
+	stored->assign(nal.data, nal.data + nal.size);
+	m_iVersion++;
+	return true;
+}
+
+bool MFParameterSetCache::update(const std::vector<NalUnit>& units)
+{
+	bool changed = false;
+	for (auto& unit : units)
+	{
+		changed |= update(unit);
+	}
+	return changed;
+}
+
+uint64_t MFParameterSetCache::get_version()
+{
+	return m_iVersion;
+}
+
+const H264Sps* MFParameterSetCache::get_sps(int id)
+{
+	return id >= 0 && id < MAX_SPS && !m_vecSpsNal[id].empty() ? &m_tSps[id] : nullptr;
+}
+
+const H264Pps* MFParameterSetCache::get_pps(int id)
+{
+	return id >= 0 && id < MAX_PPS && !m_vecPpsNal[id].empty() ? &m_tPps[id] : nullptr;
+}
+
+const std::vector<uint8_t>* MFParameterSetCache::get_sps_nal(int id)
+{
+	return id >= 0 && id < MAX_SPS && !m_vecSpsNal[id].empty() ? &m_vecSpsNal[id] : nullptr;
+}
+
+const std::vector<uint8_t>* MFParameterSetCache::get_pps_nal(int id)
+{
+	return id >= 0 && id < MAX_PPS && !m_vecPpsNal[id].empty() ? &m_vecPpsNal[id] : nullptr;
+}
+
+bool MFParameterSetCache::parse_slice_header(const NalUnit& nal, SliceHeader& header)
+{
+	if (nal.size < 2 || (nal.type != NAL_TYPE_SLICE && nal.type != NAL_TYPE_IDR))
+	{
+		return false;
+	}
+	NalBitReader reader(nal.data + 1, nal.size - 1);
+	memset(&header, 0, sizeof(header));
+	header.first_mb = (int)reader.ue();
+	uint32_t slice_type = reader.ue();
+	uint32_t pps_id = reader.ue();
+	// slice_type 5 - 9 says every slice of the picture has the same type
+	const H264Pps* pps = slice_type <= 9 ? get_pps((int)pps_id) : nullptr;
+	const H264Sps* sps = pps ? get_sps(pps->sps_id) : nullptr;
+	if (!sps)
+	{
+		return false;
+	}
+	header.slice_type = (SLICE_TYPE)(slice_type % 5);
+	header.pps_id = (int)pps_id;
+	header.idr = nal.type == NAL_TYPE_IDR;
+	if (sps->separate_colour_plane)
+	{
+		reader.bits(2); // colour_plane_id
+	}
+	header.frame_num = (int)reader.bits(sps->log2_max_frame_num);
+	if (!sps->frame_mbs_only)
+	{
+		header.field_pic = reader.bit() != 0;
+		if (header.field_pic)
+		{
+			header.bottom_field = reader.bit() != 0;
+		}
+	}
+	if (header.idr)
+	{
+		header.idr_pic_id = (int)reader.ue();
+	}
+	if (sps->poc_type == 0)
+	{
+		header.poc_lsb = (int)reader.bits(sps->log2_max_poc_lsb);
+	}
+	return !reader.overrun;
+}
+
+bool MFParameterSetCache::get_avcc_record(std::vector<uint8_t>& record)
+{
+	record.clear();
+	const std::vector<uint8_t>* first_sps = nullptr;
+	int sps_count = 0;
+	int pps_count = 0;
+	for (auto& nal : m_vecSpsNal)
+	{
+		if (!nal.empty())
+		{
+			first_sps = first_sps ? first_sps : &nal;
+			sps_count++;
+		}
+	}
+	for (auto& nal : m_vecPpsNal)
+	{
+		pps_count += nal.empty() ? 0 : 1;
+	}
+	if (!first_sps || !pps_count)
+	{
+		return false;
+	}
+
+	// the first count stored sets in id order
+	auto append_sets = [&record](const std::vector<uint8_t>* sets, int count)
+	{
+		for (int i = 0; count > 0; i++)
+		{
+			if (!sets[i].empty())
+			{
+				record.push_back((uint8_t)(sets[i].size() >> 8));
+				record.push_back((uint8_t)sets[i].size());
+				record.insert(record.end(), sets[i].begin(), sets[i].end());
+				count--;
+			}
+		}
+	};
+	record.push_back(1); // configurationVersion
+	record.push_back((*first_sps)[1]); // AVCProfileIndication
+	record.push_back((*first_sps)[2]); // profile_compatibility
+	record.push_back((*first_sps)[3]); // AVCLevelIndication
+	record.push_back(0xFC | 3); // lengthSizeMinusOne
+	// numOfSequenceParameterSets has 5 bits and numOfPictureParameterSets 8, ids run to 31 and 255 so the lowest
+	// ones are kept when every id is in use
+	sps_count = sps_count > 31 ? 31 : sps_count;
+	pps_count = pps_count > 255 ? 255 : pps_count;
+	record.push_back((uint8_t)(0xE0 | sps_count));
+	append_sets(m_vecSpsNal, sps_count);
+	record.push_back((uint8_t)pps_count);
+	append_sets(m_vecPpsNal, pps_count);
+
+	const H264Sps& sps = m_tSps[first_sps - m_vecSpsNal];
+	if (sps.profile_idc == 100 || sps.profile_idc == 110 || sps.profile_idc == 122 || sps.profile_idc == 144)
+	{
+		record.push_back((uint8_t)(0xFC | sps.chroma_format_idc));
+		record.push_back((uint8_t)(0xF8 | (sps.bit_depth_luma - 8)));
+		record.push_back((uint8_t)(0xF8 | (sps.bit_depth_chroma - 8)));
+		record.push_back(0); // numOfSequenceParameterSetExt
+	}
+	return true;
+}
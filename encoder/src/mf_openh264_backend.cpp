@@ -0,0 +1,340 @@
+#include "mf_openh264_backend.h"
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#define OPENH264_API __cdecl
+#define OPENH264_LIBRARY "openh264.dll"
+#else
+#include <dlfcn.h>
+#define OPENH264_API
+#define OPENH264_LIBRARY "libopenh264.so"
+#endif
+
+// subset of openh264's codec_app_def.h / codec_api.h, the layouts are stable across the 1.x and 2.x releases
+#define OPENH264_MAX_LAYERS 128
+
+enum OPENH264_USAGE
+{
+	OPENH264_CAMERA_VIDEO_REAL_TIME = 0,
+	OPENH264_SCREEN_CONTENT_REAL_TIME
+};
+
+enum OPENH264_RC_MODE
+{
+	OPENH264_RC_QUALITY_MODE = 0,
+	OPENH264_RC_BITRATE_MODE = 1,
+	OPENH264_RC_OFF_MODE = -1
+};
+
+enum OPENH264_OPTION
+{
+	OPENH264_OPTION_DATAFORMAT = 0,
+	OPENH264_OPTION_IDR_INTERVAL,
+	OPENH264_OPTION_SVC_ENCODE_PARAM_BASE,
+	OPENH264_OPTION_SVC_ENCODE_PARAM_EXT,
+	OPENH264_OPTION_FRAME_RATE,
+	OPENH264_OPTION_BITRATE,
+	OPENH264_OPTION_MAX_BITRATE
+};
+
+enum OPENH264_FRAME_TYPE
+{
+	OPENH264_FRAME_INVALID = 0,
+	OPENH264_FRAME_IDR,
+	OPENH264_FRAME_I,
+	OPENH264_FRAME_P,
+	OPENH264_FRAME_SKIP,
+	OPENH264_FRAME_IPMIXED
+};
+
+#define OPENH264_FORMAT_I420 23
+#define OPENH264_SPATIAL_LAYER_ALL 4
+
+struct OpenH264ParamBase
+{
+	int usage_type;
+	int pic_width;
+	int pic_height;
+	int target_bitrate;
+	int rc_mode;
+	float max_frame_rate;
+};
+
+struct OpenH264SourcePicture
+{
+	int color_format;
+	int stride[4];
+	unsigned char* data[4];
+	int pic_width;
+	int pic_height;
+	long long timestamp;
+};
+
+struct OpenH264LayerInfo
+{
+	unsigned char temporal_id;
+	unsigned char spatial_id;
+	unsigned char quality_id;
+	int frame_type;
+	unsigned char layer_type;
+	int sub_seq_id;
+	int nal_count;
+	int* nal_lengths;
+	unsigned char* bitstream;
+};
+
+struct OpenH264FrameInfo
+{
+	int layer_count;
+	OpenH264LayerInfo layers[OPENH264_MAX_LAYERS];
+	int frame_type;
+	int frame_size;
+	long long timestamp;
+};
+
+struct OpenH264BitrateInfo
+{
+	int layer;
+	int bitrate;
+};
+
+class ISVCEncoder
+{
+public:
+	virtual int OPENH264_API Initialize(const OpenH264ParamBase* param) = 0;
+	virtual int OPENH264_API InitializeExt(const void* param) = 0;
+	virtual int OPENH264_API GetDefaultParams(void* param) = 0;
+	virtual int OPENH264_API Uninitialize() = 0;
+	virtual int OPENH264_API EncodeFrame(const OpenH264SourcePicture* picture, OpenH264FrameInfo* info) = 0;
+	virtual int OPENH264_API EncodeParameterSets(OpenH264FrameInfo* info) = 0;
+	virtual int OPENH264_API ForceIntraFrame(bool idr, int layer_id = -1) = 0;
+	virtual int OPENH264_API SetOption(int option, void* value) = 0;
+	virtual int OPENH264_API GetOption(int option, void* value) = 0;
+	virtual ~ISVCEncoder() {}
+};
+
+MFOpenH264Backend::MFOpenH264Backend(const char* library_path)
+	: m_strLibraryPath(library_path ? library_path : OPENH264_LIBRARY)
+{
+}
+
+MFOpenH264Backend::~MFOpenH264Backend()
+{
+	close();
+	unload_library();
+}
+
+bool MFOpenH264Backend::open(const EncoderBackendConfig& config)
+{
+	close();
+	if (config.width <= 0 || config.height <= 0 || config.fps_num <= 0 || config.fps_den <= 0 || !load_library())
+	{
+		return false;
+	}
+	m_tConfig = config;
+	if (m_pCreateEncoder(&m_pEncoder) != 0 || !m_pEncoder)
+	{
+		m_pEncoder = nullptr;
+		return false;
+	}
+	if (!initialize_encoder())
+	{
+		close();
+		return false;
+	}
+	m_pFrameInfo = new OpenH264FrameInfo();
+	return true;
+}
+
+void MFOpenH264Backend::close()
+{
+	if (m_pEncoder)
+	{
+		m_pEncoder->Uninitialize();
+		m_pDestroyEncoder(m_pEncoder);
+		m_pEncoder = nullptr;
+	}
+	delete (OpenH264FrameInfo*)m_pFrameInfo;
+	m_pFrameInfo = nullptr;
+}
+
+VIDEO_FORMAT MFOpenH264Backend::get_input_format()
+{
+	return VIDEO_FORMAT_IYUV;
+}
+
+unsigned long MFOpenH264Backend::get_max_packet_size()
+{
+	// an I frame of noise stays well below the raw frame size
+	return (unsigned long)m_tConfig.width * m_tConfig.height * 3 / 2 + 4096;
+}
+
+bool MFOpenH264Backend::set_rate_control(const RateControlParam& param)
+{
+	if (!m_pEncoder)
+	{
+		m_tConfig.rate_control = param;
+		return true;
+	}
+	// the rate control mode is fixed at initialization, switching it costs a new IDR
+	if (param.mode != m_tConfig.rate_control.mode)
+	{
+		m_tConfig.rate_control = param;
+		m_pEncoder->Uninitialize();
+		return initialize_encoder();
+	}
+	bool ret = true;
+	if (param.target_bitrate != m_tConfig.rate_control.target_bitrate && param.mode != RATE_CONTROL_CQP)
+	{
+		OpenH264BitrateInfo bitrate = { OPENH264_SPATIAL_LAYER_ALL, (int)param.target_bitrate };
+		ret &= m_pEncoder->SetOption(OPENH264_OPTION_BITRATE, &bitrate) == 0;
+	}
+	if (param.max_bitrate != m_tConfig.rate_control.max_bitrate && param.max_bitrate)
+	{
+		OpenH264BitrateInfo bitrate = { OPENH264_SPATIAL_LAYER_ALL, (int)param.max_bitrate };
+		ret &= m_pEncoder->SetOption(OPENH264_OPTION_MAX_BITRATE, &bitrate) == 0;
+	}
+	if (param.gop_length != m_tConfig.rate_control.gop_length)
+	{
+		int interval = (int)param.gop_length;
+		ret &= m_pEncoder->SetOption(OPENH264_OPTION_IDR_INTERVAL, &interval) == 0;
+	}
+	m_tConfig.rate_control = param;
+	return ret;
+}
+
+void MFOpenH264Backend::force_key_frame()
+{
+	if (m_pEncoder)
+	{
+		m_pEncoder->ForceIntraFrame(true);
+	}
+}
+
+int MFOpenH264Backend::encode(const EncoderFrame* frame, uint8_t* dst, unsigned long capacity, EncoderPacket& packet)
+{
+	if (!m_pEncoder)
+	{
+		return ENCODE_FAIL;
+	}
+	// no lookahead and no B frames, there is never anything left to drain
+	if (!frame)
+	{
+		return ENCODE_EOF;
+	}
+	OpenH264SourcePicture picture = {};
+	picture.color_format = OPENH264_FORMAT_I420;
+	picture.pic_width = m_tConfig.width;
+	picture.pic_height = m_tConfig.height;
+	for (int i = 0; i < 3; i++)
+	{
+		picture.data[i] = const_cast<unsigned char*>(frame->data[i]);
+		picture.stride[i] = frame->stride[i];
+	}
+	picture.timestamp = m_tConfig.time_base > 0 ? frame->timestamp * 1000 / m_tConfig.time_base : 0;
+
+	OpenH264FrameInfo* info = (OpenH264FrameInfo*)m_pFrameInfo;
+	memset(info, 0, sizeof(OpenH264FrameInfo));
+	if (m_pEncoder->EncodeFrame(&picture, info) != 0)
+	{
+		return ENCODE_FAIL;
+	}
+	if (info->frame_type == OPENH264_FRAME_SKIP || info->frame_type == OPENH264_FRAME_INVALID)
+	{
+		return ENCODE_MORE_INPUT;
+	}
+	unsigned long size = 0;
+	for (int layer = 0; layer < info->layer_count; layer++)
+	{
+		const OpenH264LayerInfo& layer_info = info->layers[layer];
+		unsigned long layer_size = 0;
+		for (int nal = 0; nal < layer_info.nal_count; nal++)
+		{
+			layer_size += layer_info.nal_lengths[nal];
+		}
+		if (size + layer_size > capacity)
+		{
+			return ENCODE_FAIL;
+		}
+		memcpy(dst + size, layer_info.bitstream, layer_size);
+		size += layer_size;
+	}
+	packet.size = size;
+	packet.timestamp = frame->timestamp;
+	packet.duration = frame->duration;
+	packet.key_frame = info->frame_type == OPENH264_FRAME_IDR;
+	return ENCODE_SUCCESS;
+}
+
+bool MFOpenH264Backend::load_library()
+{
+	if (m_pLibrary)
+	{
+		return true;
+	}
+#ifdef _WIN32
+	HMODULE library = LoadLibraryA(m_strLibraryPath.c_str());
+	if (library)
+	{
+		m_pCreateEncoder = (CreateEncoderFunc)GetProcAddress(library, "WelsCreateSVCEncoder");
+		m_pDestroyEncoder = (DestroyEncoderFunc)GetProcAddress(library, "WelsDestroySVCEncoder");
+	}
+#else
+	void* library = dlopen(m_strLibraryPath.c_str(), RTLD_NOW | RTLD_LOCAL);
+	if (library)
+	{
+		m_pCreateEncoder = (CreateEncoderFunc)dlsym(library, "WelsCreateSVCEncoder");
+		m_pDestroyEncoder = (DestroyEncoderFunc)dlsym(library, "WelsDestroySVCEncoder");
+	}
+#endif
+	m_pLibrary = (void*)library;
+	if (!m_pLibrary || !m_pCreateEncoder || !m_pDestroyEncoder)
+	{
+		unload_library();
+		return false;
+	}
+	return true;
+}
+
+void MFOpenH264Backend::unload_library()
+{
+	if (m_pLibrary)
+	{
+#ifdef _WIN32
+		FreeLibrary((HMODULE)m_pLibrary);
+#else
+		dlclose(m_pLibrary);
+#endif
+		m_pLibrary = nullptr;
+	}
+	m_pCreateEncoder = nullptr;
+	m_pDestroyEncoder = nullptr;
+}
+
+bool MFOpenH264Backend::initialize_encoder()
+{
+	const RateControlParam& rate_control = m_tConfig.rate_control;
+	OpenH264ParamBase param = {};
+	param.usage_type = OPENH264_SCREEN_CONTENT_REAL_TIME;
+	param.pic_width = m_tConfig.width;
+	param.pic_height = m_tConfig.height;
+	param.target_bitrate = rate_control.target_bitrate ? (int)rate_control.target_bitrate : m_tConfig.width * m_tConfig.height * 100;
+	// the base parameters have no fixed QP, quality mode is the closest openh264 offers
+	param.rc_mode = rate_control.mode == RATE_CONTROL_CQP ? OPENH264_RC_QUALITY_MODE : OPENH264_RC_BITRATE_MODE;
+	param.max_frame_rate = (float)m_tConfig.fps_num / m_tConfig.fps_den;
+	if (m_pEncoder->Initialize(&param) != 0)
+	{
+		return false;
+	}
+	int format = OPENH264_FORMAT_I420;
+	m_pEncoder->SetOption(OPENH264_OPTION_DATAFORMAT, &format);
+	int interval = rate_control.gop_length ? (int)rate_control.gop_length : m_tConfig.fps_num * 5 / m_tConfig.fps_den;
+	m_pEncoder->SetOption(OPENH264_OPTION_IDR_INTERVAL, &interval);
+	if (rate_control.mode == RATE_CONTROL_VBR && rate_control.max_bitrate)
+	{
+		OpenH264BitrateInfo bitrate = { OPENH264_SPATIAL_LAYER_ALL, (int)rate_control.max_bitrate };
+		m_pEncoder->SetOption(OPENH264_OPTION_MAX_BITRATE, &bitrate);
+	}
+	return true;
+}
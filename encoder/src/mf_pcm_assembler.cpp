@@ -0,0 +1,204 @@
+#include "mf_pcm_assembler.h"
+#include "mf_time.h"
+#include <string.h>
+
+static int get_bytes_per_sample(AUDIO_FORMAT format)
+{
+	switch (format)
+	{
+	case AUDIO_FORMAT_U8:
+		return 1;
+	case AUDIO_FORMAT_S16LE:
+		return 2;
+	case AUDIO_FORMAT_S24LE:
+		return 3;
+	case AUDIO_FORMAT_S32LE:
+	case AUDIO_FORMAT_FLT:
+		return 4;
+	case AUDIO_FORMAT_DBL:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+MFPcmAssembler::MFPcmAssembler()
+{
+}
+
+MFPcmAssembler::~MFPcmAssembler()
+{
+	mf_aligned_free(m_pStaging);
+}
+
+bool MFPcmAssembler::configure(AUDIO_FORMAT format, int channels, int sample_rate, int frame_size, int64_t time_base)
+{
+	int bytes_per_sample = get_bytes_per_sample(format);
+	if (bytes_per_sample == 0 || channels <= 0 || sample_rate <= 0 || frame_size <= 0 || time_base <= 0)
+	{
+		return false;
+	}
+	mf_aligned_free(m_pStaging);
+	m_iBlockAlign = bytes_per_sample * channels;
+	m_iFrameSize = frame_size;
+	m_pStaging = (uint8_t*)mf_aligned_malloc(XALIGN((size_t)frame_size * m_iBlockAlign, MF_CACHE_LINE), MF_CACHE_LINE);
+	if (!m_pStaging)
+	{
+		m_iFrameSize = 0;
+		return false;
+	}
+	m_iSampleRate = sample_rate;
+	m_iTimeBase = time_base;
+	m_iMaxDrift = mf_rescale(m_iMaxDriftMs, time_base, 1000);
+	m_iSilence = format == AUDIO_FORMAT_U8 ? 0x80 : 0;
+	reset();
+	return true;
+}
+
+void MFPcmAssembler::set_max_drift(int milliseconds)
+{
+	m_iMaxDriftMs = milliseconds > 0 ? milliseconds : 0;
+	m_iMaxDrift = mf_rescale(m_iMaxDriftMs, m_iTimeBase, 1000);
+}
+
+void MFPcmAssembler::reset()
+{
+	m_iStaged = 0;
+	m_pInput = nullptr;
+	m_iInputSize = 0;
+	m_bStarted = false;
+	m_iOrigin = 0;
+	m_iPosition = 0;
+	m_bResync = false;
+	m_iResyncTime = 0;
+}
+
+bool MFPcmAssembler::push(const uint8_t* data, unsigned long size, int64_t timestamp)
+{
+	if (!m_pStaging || m_iInputSize > 0 || (size > 0 && !data) || size % m_iBlockAlign)
+	{
+		return false;
+	}
+	m_pInput = data;
+	m_iInputSize = size;
+	if (timestamp < 0)
+	{
+		m_bStarted = true;
+		return true;
+	}
+	if (!m_bStarted)
+	{
+		m_iOrigin = timestamp;
+		m_iPosition = 0;
+		m_bStarted = true;
+		return true;
+	}
+	// the sample count is the clock, input timestamps only correct it across capture gaps and clock drift
+	int64_t expected = m_iOrigin + mf_rescale(m_iPosition + m_iStaged, m_iTimeBase, m_iSampleRate);
+	if (timestamp > expected + m_iMaxDrift)
+	{
+		if (m_iStaged == 0)
+		{
+			m_iOrigin = timestamp;
+			m_iPosition = 0;
+		}
+		else
+		{
+			// the staged samples keep their time, the frame is completed with silence before the new run starts
+			m_bResync = true;
+			m_iResyncTime = timestamp;
+		}
+	}
+	else if (timestamp < expected - m_iMaxDrift)
+	{
+		// output time cannot go back, the samples the input overlaps with are dropped instead
+		int64_t overlap = mf_rescale(expected - timestamp, m_iSampleRate, m_iTimeBase);
+		int64_t available = m_iInputSize / m_iBlockAlign;
+		int64_t skipped = overlap < available ? overlap : available;
+		m_pInput += skipped * m_iBlockAlign;
+		m_iInputSize -= (unsigned long)(skipped * m_iBlockAlign);
+	}
+	return true;
+}
+
+bool MFPcmAssembler::pop(PcmFrame& frame)
+{
+	if (m_bResync)
+	{
+		m_bResync = false;
+		pad_staged(frame);
+		int64_t end = m_iOrigin + mf_rescale(m_iPosition, m_iTimeBase, m_iSampleRate);
+		m_iOrigin = m_iResyncTime > end ? m_iResyncTime : end;
+		m_iPosition = 0;
+		return true;
+	}
+	unsigned long frame_bytes = (unsigned long)m_iFrameSize * m_iBlockAlign;
+	if (m_iStaged == 0 && m_iInputSize >= frame_bytes)
+	{
+		emit(m_pInput, m_iFrameSize, frame);
+		m_pInput += frame_bytes;
+		m_iInputSize -= frame_bytes;
+		return true;
+	}
+	if (m_iInputSize > 0)
+	{
+		unsigned long needed = (unsigned long)(m_iFrameSize - m_iStaged) * m_iBlockAlign;
+		unsigned long copied = m_iInputSize < needed ? m_iInputSize : needed;
+		memcpy(m_pStaging + (size_t)m_iStaged * m_iBlockAlign, m_pInput, copied);
+		m_pInput += copied;
+		m_iInputSize -= copied;
+		m_iStaged += (int)(copied / m_iBlockAlign);
+		if (m_iStaged == m_iFrameSize)
+		{
+			m_iStaged = 0;
+			emit(m_pStaging, m_iFrameSize, frame);
+			return true;
+		}
+	}
+	m_pInput = nullptr;
+	return false;
+}
+
+bool MFPcmAssembler::flush(PcmFrame& frame)
+{
+	if (pop(frame))
+	{
+		return true;
+	}
+	if (m_iStaged > 0)
+	{
+		pad_staged(frame);
+		return true;
+	}
+	reset();
+	return false;
+}
+
+int MFPcmAssembler::get_frame_size()
+{
+	return m_iFrameSize;
+}
+
+int MFPcmAssembler::get_staged_samples()
+{
+	return m_iStaged;
+}
+
+void MFPcmAssembler::emit(const uint8_t* data, int samples, PcmFrame& frame)
+{
+	int64_t start = m_iOrigin + mf_rescale(m_iPosition, m_iTimeBase, m_iSampleRate);
+	frame.data = data;
+	frame.samples = samples;
+	frame.timestamp = start;
+	frame.duration = m_iOrigin + mf_rescale(m_iPosition + samples, m_iTimeBase, m_iSampleRate) - start;
+	// a padded frame still occupies a whole frame of output time
+	m_iPosition += m_iFrameSize;
+}
+
+void MFPcmAssembler::pad_staged(PcmFrame& frame)
+{
+	int samples = m_iStaged;
+	memset(m_pStaging + (size_t)samples * m_iBlockAlign, m_iSilence, (size_t)(m_iFrameSize - samples) * m_iBlockAlign);
+	m_iStaged = 0;
+	emit(m_pStaging, samples, frame);
+}
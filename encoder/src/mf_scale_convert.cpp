@@ -0,0 +1,605 @@
+#include "mf_scale_convert.h"
+#include "mf_cpu.h"
+#include <string.h>
+#include <algorithm>
+
+#if defined(MF_ARCH_X86)
+#include <immintrin.h>
+#elif defined(MF_ARCH_ARM64)
+#include <arm_neon.h>
+#endif
+
+// BT.601 limited range with 7 bit luma and 8 bit chroma coefficients, identical in every kernel below
+static inline uint8_t bgra_to_y(int b, int g, int r)
+{
+	return (uint8_t)(((13 * b + 65 * g + 33 * r + 64) >> 7) + 16);
+}
+
+static inline uint8_t bgra_to_u(int b, int g, int r)
+{
+	return (uint8_t)((112 * b - 74 * g - 38 * r + 0x8080) >> 8);
+}
+
+static inline uint8_t bgra_to_v(int b, int g, int r)
+{
+	return (uint8_t)((112 * r - 94 * g - 18 * b + 0x8080) >> 8);
+}
+
+static inline int avg_round(int a, int b)
+{
+	return (a + b + 1) >> 1;
+}
+
+static void average_quad(const uint8_t* row0, const uint8_t* row1, int x, int width, int& b, int& g, int& r)
+{
+	const uint8_t* p00 = row0 + x * 4;
+	const uint8_t* p10 = row1 + x * 4;
+	const uint8_t* p01 = x + 1 < width ? p00 + 4 : p00;
+	const uint8_t* p11 = x + 1 < width ? p10 + 4 : p10;
+	b = avg_round(avg_round(p00[0], p10[0]), avg_round(p01[0], p11[0]));
+	g = avg_round(avg_round(p00[1], p10[1]), avg_round(p01[1], p11[1]));
+	r = avg_round(avg_round(p00[2], p10[2]), avg_round(p01[2], p11[2]));
+}
+
+static void rows_to_nv12_c(const uint8_t* row0, const uint8_t* row1, uint8_t* dst_y0, uint8_t* dst_y1, uint8_t* dst_uv, int width)
+{
+	for (int x = 0; x < width; x++)
+	{
+		dst_y0[x] = bgra_to_y(row0[x * 4], row0[x * 4 + 1], row0[x * 4 + 2]);
+		dst_y1[x] = bgra_to_y(row1[x * 4], row1[x * 4 + 1], row1[x * 4 + 2]);
+	}
+	for (int x = 0; x < width; x += 2)
+	{
+		int b, g, r;
+		average_quad(row0, row1, x, width, b, g, r);
+		dst_uv[x] = bgra_to_u(b, g, r);
+		dst_uv[x + 1] = bgra_to_v(b, g, r);
+	}
+}
+
+static void rows_to_i420_c(const uint8_t* row0, const uint8_t* row1, uint8_t* dst_y0, uint8_t* dst_y1, uint8_t* dst_u, uint8_t* dst_v, int width)
+{
+	for (int x = 0; x < width; x++)
+	{
+		dst_y0[x] = bgra_to_y(row0[x * 4], row0[x * 4 + 1], row0[x * 4 + 2]);
+		dst_y1[x] = bgra_to_y(row1[x * 4], row1[x * 4 + 1], row1[x * 4 + 2]);
+	}
+	for (int x = 0; x < width; x += 2)
+	{
+		int b, g, r;
+		average_quad(row0, row1, x, width, b, g, r);
+		dst_u[x / 2] = bgra_to_u(b, g, r);
+		dst_v[x / 2] = bgra_to_v(b, g, r);
+	}
+}
+
+static void blend_rows_c(const uint8_t* row0, const uint8_t* row1, uint8_t* dst, int bytes, int fraction)
+{
+	int f0 = 256 - fraction;
+	for (int i = 0; i < bytes; i++)
+	{
+		dst[i] = (uint8_t)((row0[i] * f0 + row1[i] * fraction + 128) >> 8);
+	}
+}
+
+static void accumulate_row_c(const uint8_t* src, uint16_t* sum, int bytes)
+{
+	for (int i = 0; i < bytes; i++)
+	{
+		sum[i] += src[i];
+	}
+}
+
+static void half_row_c(const uint8_t* row0, const uint8_t* row1, uint8_t* dst, int dst_width)
+{
+	for (int x = 0; x < dst_width; x++)
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			dst[x * 4 + c] = (uint8_t)avg_round(avg_round(row0[x * 8 + c], row1[x * 8 + c]), avg_round(row0[x * 8 + 4 + c], row1[x * 8 + 4 + c]));
+		}
+	}
+}
+
+#if defined(MF_ARCH_X86)
+MF_TARGET_AVX2 static inline __m256i avx2_bgra_to_y16(__m256i p0, __m256i p1)
+{
+	const __m256i k_y = _mm256_set1_epi32(0x0021410D);
+	__m256i sum = _mm256_hadd_epi16(_mm256_maddubs_epi16(p0, k_y), _mm256_maddubs_epi16(p1, k_y));
+	sum = _mm256_srli_epi16(_mm256_add_epi16(sum, _mm256_set1_epi16(64)), 7);
+	return _mm256_add_epi16(sum, _mm256_set1_epi16(16));
+}
+
+MF_TARGET_AVX2 static inline void avx2_store_y32(const uint8_t* row, uint8_t* dst)
+{
+	const __m256i k_perm = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	__m256i p0 = _mm256_loadu_si256((const __m256i*)row);
+	__m256i p1 = _mm256_loadu_si256((const __m256i*)(row + 32));
+	__m256i p2 = _mm256_loadu_si256((const __m256i*)(row + 64));
+	__m256i p3 = _mm256_loadu_si256((const __m256i*)(row + 96));
+	__m256i y = _mm256_packus_epi16(avx2_bgra_to_y16(p0, p1), avx2_bgra_to_y16(p2, p3));
+	_mm256_storeu_si256((__m256i*)dst, _mm256_permutevar8x32_epi32(y, k_perm));
+}
+
+// averages 2x2 blocks of 32 pixels from two rows and returns 16 U and 16 V values as 16 bit lanes in pixel order
+MF_TARGET_AVX2 static inline void avx2_bgra_to_uv16(const uint8_t* row0, const uint8_t* row1, __m256i& u, __m256i& v)
+{
+	const __m256i k_u = _mm256_set1_epi32(0x00DAB670);
+	const __m256i k_v = _mm256_set1_epi32(0x0070A2EE);
+	const __m256i k_bias = _mm256_set1_epi16((short)0x8080);
+	const __m256i k_perm = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	__m256i a0 = _mm256_avg_epu8(_mm256_loadu_si256((const __m256i*)row0), _mm256_loadu_si256((const __m256i*)row1));
+	__m256i a1 = _mm256_avg_epu8(_mm256_loadu_si256((const __m256i*)(row0 + 32)), _mm256_loadu_si256((const __m256i*)(row1 + 32)));
+	__m256i a2 = _mm256_avg_epu8(_mm256_loadu_si256((const __m256i*)(row0 + 64)), _mm256_loadu_si256((const __m256i*)(row1 + 64)));
+	__m256i a3 = _mm256_avg_epu8(_mm256_loadu_si256((const __m256i*)(row0 + 96)), _mm256_loadu_si256((const __m256i*)(row1 + 96)));
+	__m256i q0 = _mm256_avg_epu8(
+		_mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(a0), _mm256_castsi256_ps(a1), 0x88)),
+		_mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(a0), _mm256_castsi256_ps(a1), 0xDD)));
+	__m256i q1 = _mm256_avg_epu8(
+		_mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(a2), _mm256_castsi256_ps(a3), 0x88)),
+		_mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(a2), _mm256_castsi256_ps(a3), 0xDD)));
+	u = _mm256_hadd_epi16(_mm256_maddubs_epi16(q0, k_u), _mm256_maddubs_epi16(q1, k_u));
+	v = _mm256_hadd_epi16(_mm256_maddubs_epi16(q0, k_v), _mm256_maddubs_epi16(q1, k_v));
+	u = _mm256_permutevar8x32_epi32(_mm256_srli_epi16(_mm256_add_epi16(u, k_bias), 8), k_perm);
+	v = _mm256_permutevar8x32_epi32(_mm256_srli_epi16(_mm256_add_epi16(v, k_bias), 8), k_perm);
+}
+
+MF_TARGET_AVX2 static void rows_to_nv12_avx2(const uint8_t* row0, const uint8_t* row1, uint8_t* dst_y0, uint8_t* dst_y1, uint8_t* dst_uv, int width)
+{
+	int x = 0;
+	for (; x + 32 <= width; x += 32)
+	{
+		avx2_store_y32(row0 + x * 4, dst_y0 + x);
+		avx2_store_y32(row1 + x * 4, dst_y1 + x);
+		__m256i u, v;
+		avx2_bgra_to_uv16(row0 + x * 4, row1 + x * 4, u, v);
+		_mm256_storeu_si256((__m256i*)(dst_uv + x), _mm256_or_si256(u, _mm256_slli_epi16(v, 8)));
+	}
+	if (x < width)
+	{
+		rows_to_nv12_c(row0 + x * 4, row1 + x * 4, dst_y0 + x, dst_y1 + x, dst_uv + x, width - x);
+	}
+}
+
+MF_TARGET_AVX2 static void rows_to_i420_avx2(const uint8_t* row0, const uint8_t* row1, uint8_t* dst_y0, uint8_t* dst_y1, uint8_t* dst_u, uint8_t* dst_v, int width)
+{
+	int x = 0;
+	for (; x + 32 <= width; x += 32)
+	{
+		avx2_store_y32(row0 + x * 4, dst_y0 + x);
+		avx2_store_y32(row1 + x * 4, dst_y1 + x);
+		__m256i u, v;
+		avx2_bgra_to_uv16(row0 + x * 4, row1 + x * 4, u, v);
+		__m256i uv = _mm256_permute4x64_epi64(_mm256_packus_epi16(u, v), 0xD8);
+		_mm_storeu_si128((__m128i*)(dst_u + x / 2), _mm256_castsi256_si128(uv));
+		_mm_storeu_si128((__m128i*)(dst_v + x / 2), _mm256_extracti128_si256(uv, 1));
+	}
+	if (x < width)
+	{
+		rows_to_i420_c(row0 + x * 4, row1 + x * 4, dst_y0 + x, dst_y1 + x, dst_u + x / 2, dst_v + x / 2, width - x);
+	}
+}
+
+MF_TARGET_AVX2 static void blend_rows_avx2(const uint8_t* row0, const uint8_t* row1, uint8_t* dst, int bytes, int fraction)
+{
+	const __m256i f0 = _mm256_set1_epi16((short)(256 - fraction));
+	const __m256i f1 = _mm256_set1_epi16((short)fraction);
+	const __m256i round = _mm256_set1_epi16(128);
+	int i = 0;
+	for (; i + 32 <= bytes; i += 32)
+	{
+		__m256i r0 = _mm256_loadu_si256((const __m256i*)(row0 + i));
+		__m256i r1 = _mm256_loadu_si256((const __m256i*)(row1 + i));
+		__m256i zero = _mm256_setzero_si256();
+		__m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(r0, zero), f0), _mm256_mullo_epi16(_mm256_unpacklo_epi8(r1, zero), f1));
+		__m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(r0, zero), f0), _mm256_mullo_epi16(_mm256_unpackhi_epi8(r1, zero), f1));
+		lo = _mm256_srli_epi16(_mm256_add_epi16(lo, round), 8);
+		hi = _mm256_srli_epi16(_mm256_add_epi16(hi, round), 8);
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_packus_epi16(lo, hi));
+	}
+	if (i < bytes)
+	{
+		blend_rows_c(row0 + i, row1 + i, dst + i, bytes - i, fraction);
+	}
+}
+
+MF_TARGET_AVX2 static void half_row_avx2(const uint8_t* row0, const uint8_t* row1, uint8_t* dst, int dst_width)
+{
+	int x = 0;
+	for (; x + 8 <= dst_width; x += 8)
+	{
+		__m256i a0 = _mm256_avg_epu8(_mm256_loadu_si256((const __m256i*)(row0 + x * 8)), _mm256_loadu_si256((const __m256i*)(row1 + x * 8)));
+		__m256i a1 = _mm256_avg_epu8(_mm256_loadu_si256((const __m256i*)(row0 + x * 8 + 32)), _mm256_loadu_si256((const __m256i*)(row1 + x * 8 + 32)));
+		__m256i q = _mm256_avg_epu8(
+			_mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(a0), _mm256_castsi256_ps(a1), 0x88)),
+			_mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(a0), _mm256_castsi256_ps(a1), 0xDD)));
+		_mm256_storeu_si256((__m256i*)(dst + x * 4), _mm256_permute4x64_epi64(q, 0xD8));
+	}
+	if (x < dst_width)
+	{
+		half_row_c(row0 + x * 8, row1 + x * 8, dst + x * 4, dst_width - x);
+	}
+}
+
+MF_TARGET_AVX2 static void accumulate_row_avx2(const uint8_t* src, uint16_t* sum, int bytes)
+{
+	int i = 0;
+	for (; i + 16 <= bytes; i += 16)
+	{
+		__m256i s = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(src + i)));
+		__m256i acc = _mm256_loadu_si256((const __m256i*)(sum + i));
+		_mm256_storeu_si256((__m256i*)(sum + i), _mm256_add_epi16(acc, s));
+	}
+	if (i < bytes)
+	{
+		accumulate_row_c(src + i, sum + i, bytes - i);
+	}
+}
+#endif
+
+#if defined(MF_ARCH_ARM64)
+static inline uint8x8_t neon_bgra_to_y(uint8x8_t b, uint8x8_t g, uint8x8_t r)
+{
+	uint16x8_t sum = vmull_u8(b, vdup_n_u8(13));
+	sum = vmlal_u8(sum, g, vdup_n_u8(65));
+	sum = vmlal_u8(sum, r, vdup_n_u8(33));
+	return vadd_u8(vshrn_n_u16(vaddq_u16(sum, vdupq_n_u16(64)), 7), vdup_n_u8(16));
+}
+
+static inline void neon_bgra_to_uv(const uint8_t* row0, const uint8_t* row1, uint8x8_t& u, uint8x8_t& v)
+{
+	uint8x16x4_t p0 = vld4q_u8(row0);
+	uint8x16x4_t p1 = vld4q_u8(row1);
+	uint8x16_t ab = vrhaddq_u8(p0.val[0], p1.val[0]);
+	uint8x16_t ag = vrhaddq_u8(p0.val[1], p1.val[1]);
+	uint8x16_t ar = vrhaddq_u8(p0.val[2], p1.val[2]);
+	uint8x8_t b = vrhadd_u8(vget_low_u8(vuzp1q_u8(ab, ab)), vget_low_u8(vuzp2q_u8(ab, ab)));
+	uint8x8_t g = vrhadd_u8(vget_low_u8(vuzp1q_u8(ag, ag)), vget_low_u8(vuzp2q_u8(ag, ag)));
+	uint8x8_t r = vrhadd_u8(vget_low_u8(vuzp1q_u8(ar, ar)), vget_low_u8(vuzp2q_u8(ar, ar)));
+	uint16x8_t su = vaddq_u16(vmull_u8(b, vdup_n_u8(112)), vdupq_n_u16(0x8080));
+	su = vmlsl_u8(su, g, vdup_n_u8(74));
+	su = vmlsl_u8(su, r, vdup_n_u8(38));
+	uint16x8_t sv = vaddq_u16(vmull_u8(r, vdup_n_u8(112)), vdupq_n_u16(0x8080));
+	sv = vmlsl_u8(sv, g, vdup_n_u8(94));
+	sv = vmlsl_u8(sv, b, vdup_n_u8(18));
+	u = vshrn_n_u16(su, 8);
+	v = vshrn_n_u16(sv, 8);
+}
+
+static inline void neon_store_y16(const uint8_t* row, uint8_t* dst)
+{
+	uint8x16x4_t p = vld4q_u8(row);
+	vst1_u8(dst, neon_bgra_to_y(vget_low_u8(p.val[0]), vget_low_u8(p.val[1]), vget_low_u8(p.val[2])));
+	vst1_u8(dst + 8, neon_bgra_to_y(vget_high_u8(p.val[0]), vget_high_u8(p.val[1]), vget_high_u8(p.val[2])));
+}
+
+static void rows_to_nv12_neon(const uint8_t* row0, const uint8_t* row1, uint8_t* dst_y0, uint8_t* dst_y1, uint8_t* dst_uv, int width)
+{
+	int x = 0;
+	for (; x + 16 <= width; x += 16)
+	{
+		neon_store_y16(row0 + x * 4, dst_y0 + x);
+		neon_store_y16(row1 + x * 4, dst_y1 + x);
+		uint8x8x2_t uv;
+		neon_bgra_to_uv(row0 + x * 4, row1 + x * 4, uv.val[0], uv.val[1]);
+		vst2_u8(dst_uv + x, uv);
+	}
+	if (x < width)
+	{
+		rows_to_nv12_c(row0 + x * 4, row1 + x * 4, dst_y0 + x, dst_y1 + x, dst_uv + x, width - x);
+	}
+}
+
+static void rows_to_i420_neon(const uint8_t* row0, const uint8_t* row1, uint8_t* dst_y0, uint8_t* dst_y1, uint8_t* dst_u, uint8_t* dst_v, int width)
+{
+	int x = 0;
+	for (; x + 16 <= width; x += 16)
+	{
+		neon_store_y16(row0 + x * 4, dst_y0 + x);
+		neon_store_y16(row1 + x * 4, dst_y1 + x);
+		uint8x8_t u, v;
+		neon_bgra_to_uv(row0 + x * 4, row1 + x * 4, u, v);
+		vst1_u8(dst_u + x / 2, u);
+		vst1_u8(dst_v + x / 2, v);
+	}
+	if (x < width)
+	{
+		rows_to_i420_c(row0 + x * 4, row1 + x * 4, dst_y0 + x, dst_y1 + x, dst_u + x / 2, dst_v + x / 2, width - x);
+	}
+}
+
+static void blend_rows_neon(const uint8_t* row0, const uint8_t* row1, uint8_t* dst, int bytes, int fraction)
+{
+	uint16x8_t f0 = vdupq_n_u16((uint16_t)(256 - fraction));
+	uint16x8_t f1 = vdupq_n_u16((uint16_t)fraction);
+	uint16x8_t round = vdupq_n_u16(128);
+	int i = 0;
+	for (; i + 8 <= bytes; i += 8)
+	{
+		uint16x8_t sum = vmulq_u16(vmovl_u8(vld1_u8(row0 + i)), f0);
+		sum = vmlaq_u16(sum, vmovl_u8(vld1_u8(row1 + i)), f1);
+		vst1_u8(dst + i, vshrn_n_u16(vaddq_u16(sum, round), 8));
+	}
+	if (i < bytes)
+	{
+		blend_rows_c(row0 + i, row1 + i, dst + i, bytes - i, fraction);
+	}
+}
+
+static void half_row_neon(const uint8_t* row0, const uint8_t* row1, uint8_t* dst, int dst_width)
+{
+	int x = 0;
+	for (; x + 8 <= dst_width; x += 8)
+	{
+		uint8x16x4_t p0 = vld4q_u8(row0 + x * 8);
+		uint8x16x4_t p1 = vld4q_u8(row1 + x * 8);
+		uint8x8x4_t out;
+		for (int c = 0; c < 4; c++)
+		{
+			uint8x16_t a = vrhaddq_u8(p0.val[c], p1.val[c]);
+			out.val[c] = vrhadd_u8(vget_low_u8(vuzp1q_u8(a, a)), vget_low_u8(vuzp2q_u8(a, a)));
+		}
+		vst4_u8(dst + x * 4, out);
+	}
+	if (x < dst_width)
+	{
+		half_row_c(row0 + x * 8, row1 + x * 8, dst + x * 4, dst_width - x);
+	}
+}
+
+static void accumulate_row_neon(const uint8_t* src, uint16_t* sum, int bytes)
+{
+	int i = 0;
+	for (; i + 8 <= bytes; i += 8)
+	{
+		vst1q_u16(sum + i, vaddw_u8(vld1q_u16(sum + i), vld1_u8(src + i)));
+	}
+	if (i < bytes)
+	{
+		accumulate_row_c(src + i, sum + i, bytes - i);
+	}
+}
+#endif
+
+MFScaleConverter::MFScaleConverter()
+{
+	m_pBlendRows = blend_rows_c;
+	m_pAccumulateRow = accumulate_row_c;
+	m_pHalfRow = half_row_c;
+	m_pRowsToNV12 = rows_to_nv12_c;
+	m_pRowsToI420 = rows_to_i420_c;
+#if defined(MF_ARCH_X86)
+	if (mf_cpu_has(CPU_FEATURE_AVX2))
+	{
+		m_pBlendRows = blend_rows_avx2;
+		m_pAccumulateRow = accumulate_row_avx2;
+		m_pHalfRow = half_row_avx2;
+		m_pRowsToNV12 = rows_to_nv12_avx2;
+		m_pRowsToI420 = rows_to_i420_avx2;
+	}
+#elif defined(MF_ARCH_ARM64)
+	if (mf_cpu_has(CPU_FEATURE_NEON))
+	{
+		m_pBlendRows = blend_rows_neon;
+		m_pAccumulateRow = accumulate_row_neon;
+		m_pHalfRow = half_row_neon;
+		m_pRowsToNV12 = rows_to_nv12_neon;
+		m_pRowsToI420 = rows_to_i420_neon;
+	}
+#endif
+}
+
+MFScaleConverter::~MFScaleConverter()
+{
+}
+
+bool MFScaleConverter::configure(int src_width, int src_height, int dst_width, int dst_height, SCALE_FILTER filter)
+{
+	if (src_width <= 0 || src_height <= 0 || dst_width <= 0 || dst_height <= 0)
+	{
+		return false;
+	}
+	// the vertical box sum is kept in 16 bits, which caps the row span at 257
+	if (filter == SCALE_FILTER_BOX && src_height / dst_height > 256)
+	{
+		return false;
+	}
+	m_iSrcWidth = src_width;
+	m_iSrcHeight = src_height;
+	m_iDstWidth = dst_width;
+	m_iDstHeight = dst_height;
+	m_eFilter = filter;
+	m_bScaling = src_width != dst_width || src_height != dst_height;
+	// an exact 2:1 reduction is the 2x2 average for both filters, the common 4K to 1080p case
+	m_bHalving = src_width == dst_width * 2 && src_height == dst_height * 2;
+
+	m_vecTaps.resize(dst_width);
+	for (int x = 0; x < dst_width; x++)
+	{
+		HorizontalTap& tap = m_vecTaps[x];
+		if (filter == SCALE_FILTER_BOX)
+		{
+			tap.x0 = (int)((int64_t)x * src_width / dst_width);
+			tap.x1 = std::max((int)((int64_t)(x + 1) * src_width / dst_width), tap.x0 + 1);
+			tap.x1 = std::min(tap.x1, src_width);
+			tap.weight = tap.x1 - tap.x0;
+		}
+		else
+		{
+			// sample centers are aligned, (x + 0.5) * src / dst - 0.5 in 16.16 fixed point
+			int64_t sx = (((int64_t)x * 2 + 1) * src_width << 16) / (dst_width * 2) - 32768;
+			if (sx < 0)
+			{
+				sx = 0;
+			}
+			tap.x0 = std::min((int)(sx >> 16), src_width - 1);
+			tap.x1 = std::min(tap.x0 + 1, src_width - 1);
+			tap.weight = (int)((sx >> 8) & 0xFF);
+		}
+	}
+	int max_rows = (src_height + dst_height - 1) / dst_height + 1;
+	int max_columns = (src_width + dst_width - 1) / dst_width + 1;
+	m_vecReciprocal.resize((size_t)max_rows * max_columns + 1);
+	for (size_t i = 1; i < m_vecReciprocal.size(); i++)
+	{
+		m_vecReciprocal[i] = (uint32_t)((65536 + i / 2) / i);
+	}
+	if (m_vecScratch.empty())
+	{
+		m_vecScratch.resize(1);
+	}
+	for (auto& scratch : m_vecScratch)
+	{
+		resize_scratch(scratch);
+	}
+	return true;
+}
+
+bool MFScaleConverter::is_configured(int src_width, int src_height, int dst_width, int dst_height)
+{
+	return m_iSrcWidth == src_width && m_iSrcHeight == src_height && m_iDstWidth == dst_width && m_iDstHeight == dst_height;
+}
+
+void MFScaleConverter::set_slot_count(int slots)
+{
+	if (slots < 1)
+	{
+		slots = 1;
+	}
+	size_t old_size = m_vecScratch.size();
+	m_vecScratch.resize(slots);
+	for (size_t i = old_size; i < m_vecScratch.size(); i++)
+	{
+		resize_scratch(m_vecScratch[i]);
+	}
+}
+
+void MFScaleConverter::bgra_to_nv12(const uint8_t* src, int src_stride, uint8_t* dst_y, int dst_stride_y, uint8_t* dst_uv, int dst_stride_uv)
+{
+	convert_rows(src, src_stride, dst_y, dst_stride_y, dst_uv, dst_stride_uv, nullptr, 0, true, 0, m_iDstHeight, 0);
+}
+
+void MFScaleConverter::bgra_to_i420(const uint8_t* src, int src_stride, uint8_t* dst_y, int dst_stride_y, uint8_t* dst_u, int dst_stride_u, uint8_t* dst_v, int dst_stride_v)
+{
+	convert_rows(src, src_stride, dst_y, dst_stride_y, dst_u, dst_stride_u, dst_v, dst_stride_v, false, 0, m_iDstHeight, 0);
+}
+
+void MFScaleConverter::bgra_to_nv12(const uint8_t* src, int src_stride, uint8_t* dst_y, int dst_stride_y, uint8_t* dst_uv, int dst_stride_uv, int row_begin, int row_end, int slot)
+{
+	convert_rows(src, src_stride, dst_y, dst_stride_y, dst_uv, dst_stride_uv, nullptr, 0, true, row_begin, row_end, slot);
+}
+
+void MFScaleConverter::bgra_to_i420(const uint8_t* src, int src_stride, uint8_t* dst_y, int dst_stride_y, uint8_t* dst_u, int dst_stride_u, uint8_t* dst_v, int dst_stride_v, int row_begin, int row_end, int slot)
+{
+	convert_rows(src, src_stride, dst_y, dst_stride_y, dst_u, dst_stride_u, dst_v, dst_stride_v, false, row_begin, row_end, slot);
+}
+
+void MFScaleConverter::resize_scratch(Scratch& scratch)
+{
+	scratch.blend_row.resize((size_t)m_iSrcWidth * 4);
+	scratch.sum_row.resize((size_t)m_iSrcWidth * 4);
+	scratch.scaled_rows.resize((size_t)m_iDstWidth * 4 * 2 + m_iDstWidth);
+}
+
+const uint8_t* MFScaleConverter::filter_row(const uint8_t* src, int src_stride, int dst_row, uint8_t* dst, Scratch& scratch)
+{
+	if (!m_bScaling)
+	{
+		return src + (size_t)dst_row * src_stride;
+	}
+	if (m_bHalving)
+	{
+		const uint8_t* row0 = src + (size_t)dst_row * 2 * src_stride;
+		m_pHalfRow(row0, row0 + src_stride, dst, m_iDstWidth);
+		return dst;
+	}
+	if (m_eFilter == SCALE_FILTER_BOX)
+	{
+		int y0 = (int)((int64_t)dst_row * m_iSrcHeight / m_iDstHeight);
+		int y1 = std::max((int)((int64_t)(dst_row + 1) * m_iSrcHeight / m_iDstHeight), y0 + 1);
+		y1 = std::min(y1, m_iSrcHeight);
+		int rows = y1 - y0;
+		uint16_t* sum = scratch.sum_row.data();
+		memset(sum, 0, scratch.sum_row.size() * sizeof(uint16_t));
+		for (int y = y0; y < y1; y++)
+		{
+			m_pAccumulateRow(src + (size_t)y * src_stride, sum, m_iSrcWidth * 4);
+		}
+		for (int x = 0; x < m_iDstWidth; x++)
+		{
+			const HorizontalTap& tap = m_vecTaps[x];
+			uint32_t reciprocal = m_vecReciprocal[tap.weight * rows];
+			uint32_t b = 0, g = 0, r = 0, a = 0;
+			for (int i = tap.x0; i < tap.x1; i++)
+			{
+				b += sum[i * 4];
+				g += sum[i * 4 + 1];
+				r += sum[i * 4 + 2];
+				a += sum[i * 4 + 3];
+			}
+			dst[x * 4] = (uint8_t)std::min<uint32_t>((b * reciprocal + 32768) >> 16, 255);
+			dst[x * 4 + 1] = (uint8_t)std::min<uint32_t>((g * reciprocal + 32768) >> 16, 255);
+			dst[x * 4 + 2] = (uint8_t)std::min<uint32_t>((r * reciprocal + 32768) >> 16, 255);
+			dst[x * 4 + 3] = (uint8_t)std::min<uint32_t>((a * reciprocal + 32768) >> 16, 255);
+		}
+		return dst;
+	}
+
+	int64_t sy = (((int64_t)dst_row * 2 + 1) * m_iSrcHeight << 16) / (m_iDstHeight * 2) - 32768;
+	if (sy < 0)
+	{
+		sy = 0;
+	}
+	int y0 = std::min((int)(sy >> 16), m_iSrcHeight - 1);
+	int y1 = std::min(y0 + 1, m_iSrcHeight - 1);
+	int fraction = (int)((sy >> 8) & 0xFF);
+	const uint8_t* row = src + (size_t)y0 * src_stride;
+	if (fraction != 0 && y1 != y0)
+	{
+		m_pBlendRows(row, src + (size_t)y1 * src_stride, scratch.blend_row.data(), m_iSrcWidth * 4, fraction);
+		row = scratch.blend_row.data();
+	}
+	for (int x = 0; x < m_iDstWidth; x++)
+	{
+		const HorizontalTap& tap = m_vecTaps[x];
+		const uint8_t* p0 = row + tap.x0 * 4;
+		const uint8_t* p1 = row + tap.x1 * 4;
+		int f1 = tap.weight;
+		int f0 = 256 - f1;
+		dst[x * 4] = (uint8_t)((p0[0] * f0 + p1[0] * f1 + 128) >> 8);
+		dst[x * 4 + 1] = (uint8_t)((p0[1] * f0 + p1[1] * f1 + 128) >> 8);
+		dst[x * 4 + 2] = (uint8_t)((p0[2] * f0 + p1[2] * f1 + 128) >> 8);
+		dst[x * 4 + 3] = (uint8_t)((p0[3] * f0 + p1[3] * f1 + 128) >> 8);
+	}
+	return dst;
+}
+
+void MFScaleConverter::convert_rows(const uint8_t* src, int src_stride, uint8_t* dst_y, int dst_stride_y, uint8_t* dst_u, int dst_stride_u, uint8_t* dst_v, int dst_stride_v,
+	bool interleaved, int row_begin, int row_end, int slot)
+{
+	if (slot < 0 || slot >= (int)m_vecScratch.size())
+	{
+		return;
+	}
+	Scratch& scratch = m_vecScratch[slot];
+	uint8_t* scaled0 = scratch.scaled_rows.data();
+	uint8_t* scaled1 = scaled0 + m_iDstWidth * 4;
+	uint8_t* spare_y = scaled1 + m_iDstWidth * 4;
+	row_end = std::min(row_end, m_iDstHeight);
+	for (int y = row_begin & ~1; y < row_end; y += 2)
+	{
+		bool has_second = y + 1 < m_iDstHeight;
+		const uint8_t* row0 = filter_row(src, src_stride, y, scaled0, scratch);
+		const uint8_t* row1 = has_second ? filter_row(src, src_stride, y + 1, scaled1, scratch) : row0;
+		uint8_t* y0 = dst_y + (size_t)y * dst_stride_y;
+		uint8_t* y1 = has_second ? y0 + dst_stride_y : spare_y;
+		if (interleaved)
+		{
+			m_pRowsToNV12(row0, row1, y0, y1, dst_u + (size_t)(y / 2) * dst_stride_u, m_iDstWidth);
+		}
+		else
+		{
+			m_pRowsToI420(row0, row1, y0, y1, dst_u + (size_t)(y / 2) * dst_stride_u, dst_v + (size_t)(y / 2) * dst_stride_v, m_iDstWidth);
+		}
+	}
+}
@@ -0,0 +1,614 @@
+#include "mf_tile_codec.h"
+#include "mf_cpu.h"
+#include "mf_lz4.h"
+#include <string.h>
+
+#if defined(MF_ARCH_X86)
+#include <immintrin.h>
+#elif defined(MF_ARCH_ARM64)
+#include <arm_neon.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#define TILE_PACKET_HEADER_SIZE 20
+#define TILE_HEADER_SIZE 9
+#define TILE_MAX_PALETTE 256
+#define TILE_PALETTE_SLOTS 1024 // open addressing table, kept at 4x the palette size
+#define TILE_RGB_MASK 0x00FFFFFFu
+
+static inline uint32_t read32(const uint8_t* p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint32_t get_u32(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint16_t get_u16(const uint8_t* p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline void put_u32(uint8_t* p, uint32_t value)
+{
+	p[0] = (uint8_t)value;
+	p[1] = (uint8_t)(value >> 8);
+	p[2] = (uint8_t)(value >> 16);
+	p[3] = (uint8_t)(value >> 24);
+}
+
+static inline void put_u16(uint8_t* p, uint16_t value)
+{
+	p[0] = (uint8_t)value;
+	p[1] = (uint8_t)(value >> 8);
+}
+
+static inline void append_u32(std::vector<uint8_t>& out, uint32_t value)
+{
+	size_t offset = out.size();
+	out.resize(offset + 4);
+	put_u32(out.data() + offset, value);
+}
+
+static inline int lowest_bit(uint32_t value)
+{
+#ifdef _MSC_VER
+	unsigned long index = 0;
+	_BitScanForward(&index, value);
+	return (int)index;
+#else
+	return __builtin_ctz(value);
+#endif
+}
+
+// number of leading BGRA pixels whose color equals color, alpha ignored
+static int count_equal_c(const uint8_t* row, uint32_t color, int count)
+{
+	int i = 0;
+	while (i < count && (read32(row + i * 4) & TILE_RGB_MASK) == color)
+	{
+		i++;
+	}
+	return i;
+}
+
+#if defined(MF_ARCH_X86)
+MF_TARGET_AVX2 static int count_equal_avx2(const uint8_t* row, uint32_t color, int count)
+{
+	const __m256i mask = _mm256_set1_epi32((int)TILE_RGB_MASK);
+	const __m256i target = _mm256_set1_epi32((int)color);
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i pixels = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(row + i * 4)), mask);
+		uint32_t differ = ~(uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(pixels, target))) & 0xFF;
+		if (differ)
+		{
+			return i + lowest_bit(differ);
+		}
+	}
+	return i + count_equal_c(row + i * 4, color, count - i);
+}
+#elif defined(MF_ARCH_ARM64)
+static int count_equal_neon(const uint8_t* row, uint32_t color, int count)
+{
+	const uint32x4_t mask = vdupq_n_u32(TILE_RGB_MASK);
+	const uint32x4_t target = vdupq_n_u32(color);
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		uint32x4_t pixels = vandq_u32(vld1q_u32((const uint32_t*)(row + i * 4)), mask);
+		if (vminvq_u32(vceqq_u32(pixels, target)) == 0)
+		{
+			break;
+		}
+	}
+	return i + count_equal_c(row + i * 4, color, count - i);
+}
+#endif
+
+typedef int (*CountEqualFunc)(const uint8_t* row, uint32_t color, int count);
+
+static CountEqualFunc select_count_equal()
+{
+#if defined(MF_ARCH_X86)
+	if (mf_cpu_has(CPU_FEATURE_AVX2))
+	{
+		return count_equal_avx2;
+	}
+#elif defined(MF_ARCH_ARM64)
+	if (mf_cpu_has(CPU_FEATURE_NEON))
+	{
+		return count_equal_neon;
+	}
+#endif
+	return count_equal_c;
+}
+
+static const CountEqualFunc s_pCountEqual = select_count_equal();
+
+MFTileEncoder::MFTileEncoder()
+{
+}
+
+MFTileEncoder::~MFTileEncoder()
+{
+	m_ConvertPool.stop();
+}
+
+bool MFTileEncoder::configure(int width, int height, int tile_size, int thread_count)
+{
+	if (width <= 0 || height <= 0 || tile_size < 8 || tile_size > 256 || tile_size % 8 || thread_count < 1)
+	{
+		return false;
+	}
+	m_iWidth = width;
+	m_iHeight = height;
+	m_iTileSize = tile_size;
+	m_iTilesX = (width + tile_size - 1) / tile_size;
+	m_iTilesY = (height + tile_size - 1) / tile_size;
+	m_vecDirty.assign((size_t)m_iTilesX * m_iTilesY, 0);
+	m_vecTiles.reserve(m_vecDirty.size());
+	if (m_ConvertPool.get_thread_count() != thread_count)
+	{
+		m_ConvertPool.start(thread_count, 0);
+	}
+	m_vecSlots.resize(m_ConvertPool.get_thread_count());
+	for (auto& slot : m_vecSlots)
+	{
+		slot.hash_table.resize(MF_LZ4_HASH_ENTRIES);
+	}
+	return true;
+}
+
+bool MFTileEncoder::encode(const uint8_t* data, int stride, const MonitorRect* rects, int rect_count, const uint8_t*& packet, unsigned long& size)
+{
+	packet = nullptr;
+	size = 0;
+	if (!data || m_vecDirty.empty())
+	{
+		return false;
+	}
+	mark_tiles(rects, rect_count);
+	if (m_vecTiles.empty())
+	{
+		return false;
+	}
+
+	for (auto& slot : m_vecSlots)
+	{
+		slot.output.clear();
+	}
+	// stripes cover ascending tile ranges, so the slots concatenated in order keep the tiles in row-major order
+	auto encode_tiles = [&](int stripe, int begin, int end)
+	{
+		Slot& slot = m_vecSlots[stripe];
+		for (int i = begin; i < end; i++)
+		{
+			encode_tile(data, stride, m_vecTiles[i], slot);
+		}
+	};
+	m_ConvertPool.run((int)m_vecTiles.size(), 1, encode_tiles);
+
+	size_t total = TILE_PACKET_HEADER_SIZE;
+	for (auto& slot : m_vecSlots)
+	{
+		total += slot.output.size();
+	}
+	m_vecPacket.resize(total);
+	uint8_t* out = m_vecPacket.data();
+	memcpy(out, "MFTC", 4);
+	put_u16(out + 4, MF_TILE_CODEC_VERSION);
+	put_u16(out + 6, (uint16_t)m_iTileSize);
+	put_u32(out + 8, (uint32_t)m_iWidth);
+	put_u32(out + 12, (uint32_t)m_iHeight);
+	put_u32(out + 16, (uint32_t)m_vecTiles.size());
+	out += TILE_PACKET_HEADER_SIZE;
+	for (auto& slot : m_vecSlots)
+	{
+		if (!slot.output.empty())
+		{
+			memcpy(out, slot.output.data(), slot.output.size());
+			out += slot.output.size();
+		}
+	}
+	packet = m_vecPacket.data();
+	size = (unsigned long)total;
+	return true;
+}
+
+void MFTileEncoder::mark_tiles(const MonitorRect* rects, int rect_count)
+{
+	m_vecTiles.clear();
+	if (!rects || rect_count <= 0)
+	{
+		for (int i = 0; i < (int)m_vecDirty.size(); i++)
+		{
+			m_vecTiles.push_back(i);
+		}
+		return;
+	}
+	memset(m_vecDirty.data(), 0, m_vecDirty.size());
+	for (int i = 0; i < rect_count; i++)
+	{
+		const MonitorRect& rect = rects[i];
+		int left = rect.left > 0 ? rect.left : 0;
+		int top = rect.top > 0 ? rect.top : 0;
+		int right = rect.right < m_iWidth ? rect.right : m_iWidth;
+		int bottom = rect.bottom < m_iHeight ? rect.bottom : m_iHeight;
+		if (left >= right || top >= bottom)
+		{
+			continue;
+		}
+		for (int ty = top / m_iTileSize; ty <= (bottom - 1) / m_iTileSize; ty++)
+		{
+			memset(m_vecDirty.data() + ty * m_iTilesX + left / m_iTileSize, 1, (right - 1) / m_iTileSize - left / m_iTileSize + 1);
+		}
+	}
+	for (int i = 0; i < (int)m_vecDirty.size(); i++)
+	{
+		if (m_vecDirty[i])
+		{
+			m_vecTiles.push_back(i);
+		}
+	}
+}
+
+void MFTileEncoder::encode_tile(const uint8_t* data, int stride, int tile, Slot& slot)
+{
+	int tile_x = tile % m_iTilesX;
+	int tile_y = tile / m_iTilesX;
+	int x = tile_x * m_iTileSize;
+	int y = tile_y * m_iTileSize;
+	int columns = m_iWidth - x < m_iTileSize ? m_iWidth - x : m_iTileSize;
+	int rows = m_iHeight - y < m_iTileSize ? m_iHeight - y : m_iTileSize;
+	const uint8_t* src = data + (size_t)y * stride + (size_t)x * 4;
+
+	size_t header = slot.output.size();
+	slot.output.resize(header + TILE_HEADER_SIZE);
+	TILE_MODE mode = TILE_MODE_SOLID;
+	uint32_t color = read32(src) & TILE_RGB_MASK;
+	for (int row = 0; row < rows; row++)
+	{
+		if (s_pCountEqual(src + (size_t)row * stride, color, columns) != columns)
+		{
+			mode = TILE_MODE_PALETTE;
+			break;
+		}
+	}
+	if (mode == TILE_MODE_SOLID)
+	{
+		slot.output.push_back((uint8_t)color);
+		slot.output.push_back((uint8_t)(color >> 8));
+		slot.output.push_back((uint8_t)(color >> 16));
+	}
+	else if (!encode_palette(src, stride, columns, rows, slot))
+	{
+		mode = TILE_MODE_RAW;
+		encode_raw(src, stride, columns, rows, slot);
+	}
+
+	uint8_t* out = slot.output.data() + header;
+	put_u16(out, (uint16_t)tile_x);
+	put_u16(out + 2, (uint16_t)tile_y);
+	out[4] = (uint8_t)mode;
+	put_u32(out + 5, (uint32_t)(slot.output.size() - header - TILE_HEADER_SIZE));
+}
+
+bool MFTileEncoder::encode_palette(const uint8_t* tile, int stride, int columns, int rows, Slot& slot)
+{
+	uint32_t keys[TILE_PALETTE_SLOTS];
+	uint8_t indices[TILE_PALETTE_SLOTS];
+	uint32_t palette[TILE_MAX_PALETTE];
+	int colors = 0;
+	memset(keys, 0, sizeof(keys));
+
+	std::vector<uint8_t>& runs = slot.pixels;
+	runs.clear();
+	int run_index = -1;
+	uint32_t run_length = 0;
+	auto flush_run = [&]()
+	{
+		runs.push_back((uint8_t)run_index);
+		uint32_t value = run_length - 1;
+		while (value >= 0x80)
+		{
+			runs.push_back((uint8_t)(value | 0x80));
+			value >>= 7;
+		}
+		runs.push_back((uint8_t)value);
+	};
+
+	for (int row = 0; row < rows; row++)
+	{
+		const uint8_t* line = tile + (size_t)row * stride;
+		int column = 0;
+		while (column < columns)
+		{
+			uint32_t color = read32(line + column * 4) & TILE_RGB_MASK;
+			int run = s_pCountEqual(line + column * 4, color, columns - column);
+			column += run;
+
+			// the top byte marks a used slot, colors only occupy the low 24 bits
+			uint32_t key = color | 0x01000000u;
+			uint32_t h = (color * 0x9E3779B1u) >> 22;
+			while (keys[h] && keys[h] != key)
+			{
+				h = (h + 1) & (TILE_PALETTE_SLOTS - 1);
+			}
+			if (!keys[h])
+			{
+				if (colors == TILE_MAX_PALETTE)
+				{
+					return false;
+				}
+				keys[h] = key;
+				indices[h] = (uint8_t)colors;
+				palette[colors++] = color;
+			}
+			int index = indices[h];
+			if (index == run_index)
+			{
+				run_length += run;
+				continue;
+			}
+			if (run_index >= 0)
+			{
+				flush_run();
+			}
+			run_index = index;
+			run_length = run;
+		}
+	}
+	flush_run();
+
+	slot.output.push_back((uint8_t)(colors - 1));
+	for (int i = 0; i < colors; i++)
+	{
+		slot.output.push_back((uint8_t)palette[i]);
+		slot.output.push_back((uint8_t)(palette[i] >> 8));
+		slot.output.push_back((uint8_t)(palette[i] >> 16));
+	}
+	write_payload(slot, (int)runs.size());
+	return true;
+}
+
+void MFTileEncoder::encode_raw(const uint8_t* tile, int stride, int columns, int rows, Slot& slot)
+{
+	slot.pixels.resize((size_t)columns * rows * 3);
+	uint8_t* dst = slot.pixels.data();
+	for (int row = 0; row < rows; row++)
+	{
+		const uint8_t* src = tile + (size_t)row * stride;
+		for (int column = 0; column < columns; column++)
+		{
+			dst[0] = src[0];
+			dst[1] = src[1];
+			dst[2] = src[2];
+			dst += 3;
+			src += 4;
+		}
+	}
+	write_payload(slot, (int)slot.pixels.size());
+}
+
+void MFTileEncoder::write_payload(Slot& slot, int raw_bytes)
+{
+	slot.compressed.resize(mf_lz4_compress_bound(raw_bytes));
+	int compressed = mf_lz4_compress(slot.pixels.data(), raw_bytes, slot.compressed.data(), (int)slot.compressed.size(), slot.hash_table.data());
+	bool stored_raw = compressed <= 0 || compressed >= raw_bytes;
+	const uint8_t* payload = stored_raw ? slot.pixels.data() : slot.compressed.data();
+	int stored = stored_raw ? raw_bytes : compressed;
+
+	append_u32(slot.output, (uint32_t)raw_bytes);
+	append_u32(slot.output, (uint32_t)stored);
+	slot.output.insert(slot.output.end(), payload, payload + stored);
+}
+
+MFTileDecoder::MFTileDecoder()
+{
+}
+
+MFTileDecoder::~MFTileDecoder()
+{
+}
+
+bool MFTileDecoder::decode(const uint8_t* packet, unsigned long size, uint8_t* data, int stride, int width, int height)
+{
+	if (!packet || !data || size < TILE_PACKET_HEADER_SIZE || memcmp(packet, "MFTC", 4) != 0 || get_u16(packet + 4) != MF_TILE_CODEC_VERSION)
+	{
+		return false;
+	}
+	int tile_size = get_u16(packet + 6);
+	if (tile_size < 8 || tile_size > 256 || get_u32(packet + 8) != (uint32_t)width || get_u32(packet + 12) != (uint32_t)height)
+	{
+		return false;
+	}
+	int tiles_x = (width + tile_size - 1) / tile_size;
+	int tiles_y = (height + tile_size - 1) / tile_size;
+	uint32_t tile_count = get_u32(packet + 16);
+	const uint8_t* p = packet + TILE_PACKET_HEADER_SIZE;
+	const uint8_t* end = packet + size;
+	for (uint32_t i = 0; i < tile_count; i++)
+	{
+		if (end - p < TILE_HEADER_SIZE)
+		{
+			return false;
+		}
+		int tile_x = get_u16(p);
+		int tile_y = get_u16(p + 2);
+		uint8_t mode = p[4];
+		uint32_t payload_size = get_u32(p + 5);
+		p += TILE_HEADER_SIZE;
+		if (tile_x >= tiles_x || tile_y >= tiles_y || payload_size > (uint32_t)(end - p))
+		{
+			return false;
+		}
+		int x = tile_x * tile_size;
+		int y = tile_y * tile_size;
+		int columns = width - x < tile_size ? width - x : tile_size;
+		int rows = height - y < tile_size ? height - y : tile_size;
+		uint8_t* tile = data + (size_t)y * stride + (size_t)x * 4;
+
+		bool ret = false;
+		if (mode == TILE_MODE_SOLID)
+		{
+			if (payload_size == 3)
+			{
+				uint32_t color = 0xFF000000u | p[0] | (p[1] << 8) | (p[2] << 16);
+				for (int row = 0; row < rows; row++)
+				{
+					uint32_t* line = (uint32_t*)(tile + (size_t)row * stride);
+					for (int column = 0; column < columns; column++)
+					{
+						line[column] = color;
+					}
+				}
+				ret = true;
+			}
+		}
+		else if (mode == TILE_MODE_PALETTE)
+		{
+			ret = decode_palette(p, payload_size, tile, stride, columns, rows);
+		}
+		else if (mode == TILE_MODE_RAW)
+		{
+			ret = decode_raw(p, payload_size, tile, stride, columns, rows);
+		}
+		if (!ret)
+		{
+			return false;
+		}
+		p += payload_size;
+	}
+	return true;
+}
+
+bool MFTileDecoder::decode_palette(const uint8_t* payload, unsigned long size, uint8_t* tile, int stride, int columns, int rows)
+{
+	if (size < 1)
+	{
+		return false;
+	}
+	int colors = payload[0] + 1;
+	unsigned long palette_bytes = 1 + colors * 3;
+	if (size < palette_bytes)
+	{
+		return false;
+	}
+	uint32_t palette[TILE_MAX_PALETTE];
+	for (int i = 0; i < colors; i++)
+	{
+		const uint8_t* entry = payload + 1 + i * 3;
+		palette[i] = 0xFF000000u | entry[0] | (entry[1] << 8) | (entry[2] << 16);
+	}
+	unsigned long run_bytes = 0;
+	const uint8_t* runs = unpack(payload + palette_bytes, size - palette_bytes, run_bytes);
+	if (!runs)
+	{
+		return false;
+	}
+
+	const uint8_t* end = runs + run_bytes;
+	int row = 0;
+	int column = 0;
+	while (runs < end && row < rows)
+	{
+		int index = *runs++;
+		uint32_t value = 0;
+		int shift = 0;
+		uint8_t byte = 0;
+		do
+		{
+			if (runs >= end || shift > 21)
+			{
+				return false;
+			}
+			byte = *runs++;
+			value |= (uint32_t)(byte & 0x7F) << shift;
+			shift += 7;
+		} while (byte & 0x80);
+		if (index >= colors)
+		{
+			return false;
+		}
+		uint32_t color = palette[index];
+		uint32_t run = value + 1;
+		while (run && row < rows)
+		{
+			uint32_t* line = (uint32_t*)(tile + (size_t)row * stride);
+			uint32_t count = (uint32_t)(columns - column) < run ? (uint32_t)(columns - column) : run;
+			for (uint32_t i = 0; i < count; i++)
+			{
+				line[column + i] = color;
+			}
+			run -= count;
+			column += count;
+			if (column == columns)
+			{
+				column = 0;
+				row++;
+			}
+		}
+		if (run)
+		{
+			return false;
+		}
+	}
+	return runs == end && row == rows;
+}
+
+bool MFTileDecoder::decode_raw(const uint8_t* payload, unsigned long size, uint8_t* tile, int stride, int columns, int rows)
+{
+	unsigned long raw_bytes = 0;
+	const uint8_t* src = unpack(payload, size, raw_bytes);
+	if (!src || raw_bytes != (unsigned long)columns * rows * 3)
+	{
+		return false;
+	}
+	for (int row = 0; row < rows; row++)
+	{
+		uint8_t* dst = tile + (size_t)row * stride;
+		for (int column = 0; column < columns; column++)
+		{
+			dst[0] = src[0];
+			dst[1] = src[1];
+			dst[2] = src[2];
+			dst[3] = 0xFF;
+			dst += 4;
+			src += 3;
+		}
+	}
+	return true;
+}
+
+const uint8_t* MFTileDecoder::unpack(const uint8_t* payload, unsigned long size, unsigned long& raw_bytes)
+{
+	if (size < 8)
+	{
+		return nullptr;
+	}
+	raw_bytes = get_u32(payload);
+	uint32_t stored = get_u32(payload + 4);
+	// a 256x256 tile of single pixel runs is the largest payload the encoder produces
+	if (stored != size - 8 || raw_bytes > 256 * 256 * 3 || stored > raw_bytes)
+	{
+		return nullptr;
+	}
+	if (stored == raw_bytes)
+	{
+		return payload + 8;
+	}
+	m_vecScratch.resize(raw_bytes);
+	if (mf_lz4_decompress(payload + 8, (int)stored, m_vecScratch.data(), (int)raw_bytes) != (int)raw_bytes)
+	{
+		return nullptr;
+	}
+	return m_vecScratch.data();
+}
@@ -0,0 +1,892 @@
+#include "mf_video_pipeline.h"
+#include "mf_frame_hash.h"
+#include "mf_time.h"
+#include "libyuv/include/libyuv.h"
+#include <string.h>
+
+#define MAX_LEASED_OUTPUTS 16
+
+PIXEL_FORMAT mf_video_pixel_format(VIDEO_FORMAT format)
+{
+	switch (format)
+	{
+	case VIDEO_FORMAT_IYUV:
+		return PIXEL_I420;
+	case VIDEO_FORMAT_NV12:
+		return PIXEL_NV12;
+	case VIDEO_FORMAT_YV12:
+		return PIXEL_YV12;
+	case VIDEO_FORMAT_RGB32:
+		return PIXEL_BGRA;
+	default:
+		return PIXEL_NONE;
+	}
+}
+
+static PlaneView get_planes(const VideoFrame& frame)
+{
+	PlaneView planes = {};
+	for (int i = 0; i < MF_MAX_PLANES; i++)
+	{
+		planes.data[i] = frame.data[i];
+		planes.stride[i] = frame.stride[i];
+	}
+	return planes;
+}
+
+MFVideoPipeline::MFVideoPipeline()
+{
+}
+
+MFVideoPipeline::~MFVideoPipeline()
+{
+	stop();
+}
+
+bool MFVideoPipeline::start(MFEncoderBackend* backend, int width, int height, int fps_num, int fps_den)
+{
+	if (m_pBackend || !backend || width <= 0 || height <= 0 || fps_num <= 0 || fps_den <= 0)
+	{
+		delete backend;
+		return false;
+	}
+	int frame_width = XALIGN((int)(width * (m_tCropRatio.right - m_tCropRatio.left)), 16);
+	int frame_height = XALIGN((int)(height * (m_tCropRatio.bottom - m_tCropRatio.top)), 2);
+	m_iEncodedWidth = XALIGN((int)(frame_width * m_fScaleRatio), 16);
+	m_iEncodedHeight = XALIGN((int)(frame_height * m_fScaleRatio), 2);
+	EncoderBackendConfig config = { m_iEncodedWidth, m_iEncodedHeight, fps_num, fps_den, m_iTimeBase, m_tRateControl,
+		width, height, m_tCropRatio, frame_width, frame_height };
+	if (!backend->open(config))
+	{
+		delete backend;
+		return false;
+	}
+	m_eInputFormat = mf_video_pixel_format(backend->get_input_format());
+	if (m_eInputFormat == PIXEL_NONE)
+	{
+		backend->close();
+		delete backend;
+		return false;
+	}
+	m_pBackend = backend;
+	m_iFpsNum = fps_num;
+	m_iFpsDen = fps_den;
+	m_BitstreamArena.reset(m_pBackend->get_max_packet_size(), MAX_LEASED_OUTPUTS);
+	// values the backend could not take while opening are tried once more, and counted when they are refused again
+	if (!m_pBackend->set_rate_control(m_tRateControl))
+	{
+		std::lock_guard<std::mutex> lock(m_mtRateControl);
+		m_iRateControlFailures++;
+	}
+	return true;
+}
+
+void MFVideoPipeline::stop()
+{
+	stop_encode_thread();
+	if (m_pBackend)
+	{
+		m_pBackend->close();
+		delete m_pBackend;
+		m_pBackend = nullptr;
+	}
+	m_BitstreamArena.trim();
+	m_FramePool.trim();
+	if (m_bRateControlPending)
+	{
+		m_tRateControl = m_tPendingRateControl;
+		m_bRateControlPending = false;
+	}
+	m_eInputFormat = PIXEL_NONE;
+	m_iFrameCount = 0;
+	m_iLastTimestamp = -1;
+	m_iSkippedFrames = 0;
+	m_bInputHashValid = false;
+	m_iSubmittedFrames = 0;
+	m_iRejectedFrames = 0;
+	m_iRateControlFailures = 0;
+	m_fAverageLatency = 0.0;
+	m_fMaxLatency = 0.0;
+	m_tCropRatio = { 0.0f, 0.0f, 1.0f, 1.0f };
+	m_fScaleRatio = 1.0f;
+}
+
+bool MFVideoPipeline::is_started()
+{
+	return m_pBackend != nullptr;
+}
+
+void MFVideoPipeline::set_time_base(int64_t time_base)
+{
+	m_iTimeBase = time_base;
+}
+
+void MFVideoPipeline::set_clock_origin(int64_t origin)
+{
+	m_iClockOrigin = origin;
+	m_bClockOrigin = true;
+}
+
+void MFVideoPipeline::set_crop_rect(float left, float top, float right, float bottom)
+{
+	m_tCropRatio = { left, top, right, bottom };
+}
+
+void MFVideoPipeline::set_scale_ratio(float ratio)
+{
+	m_fScaleRatio = ratio;
+}
+
+void MFVideoPipeline::set_output_mode(OUTPUT_MODE mode)
+{
+	m_eOutputMode = mode;
+}
+
+void MFVideoPipeline::set_convert_threads(int thread_count, uint64_t affinity_mask)
+{
+	m_ConvertPool.start(thread_count, affinity_mask);
+}
+
+bool MFVideoPipeline::set_rate_control(const RateControlParam& param)
+{
+	if (param.qp > 51 || param.max_qp > 51 || param.min_qp > param.max_qp)
+	{
+		return false;
+	}
+	if (!m_pBackend)
+	{
+		m_tRateControl = param;
+		return true;
+	}
+	// picked up by whichever thread feeds the encoder next, it is never reconfigured concurrently with an encode call
+	std::lock_guard<std::mutex> lock(m_mtRateControl);
+	m_tPendingRateControl = param;
+	m_bRateControlPending = true;
+	return true;
+}
+
+void MFVideoPipeline::set_skip_mode(SKIP_MODE mode, int max_skipped_frames)
+{
+	m_eSkipMode = mode;
+	m_iMaxSkippedFrames = max_skipped_frames;
+	m_iSkippedFrames = 0;
+	m_bInputHashValid = false;
+}
+
+void MFVideoPipeline::set_frame_memory(uint64_t budget_bytes, bool large_pages)
+{
+	m_FramePool.set_budget(budget_bytes);
+	m_FramePool.set_large_pages(large_pages);
+}
+
+void MFVideoPipeline::get_frame_memory_stats(FramePoolStats& stats)
+{
+	m_FramePool.get_stats(stats);
+}
+
+void MFVideoPipeline::set_queue_depth(int depth)
+{
+	// queued results hold arena leases, leave the other half of the arena to the caller
+	std::lock_guard<std::mutex> lock(m_mtQueue);
+	m_iQueueDepth = depth < 1 ? 1 : (depth > MAX_LEASED_OUTPUTS / 2 ? MAX_LEASED_OUTPUTS / 2 : depth);
+}
+
+int MFVideoPipeline::encode(const VideoFrame& frame, OutputVData& output_data)
+{
+	EncodeJob job = {};
+	int ret = prepare_job(frame, job);
+	if (ret == ENCODE_SUCCESS && !job.output.skipped)
+	{
+		ret = encode_job(job, output_data, m_eOutputMode);
+		release_job(job);
+		return ret;
+	}
+	if (ret == ENCODE_SUCCESS)
+	{
+		// the caller's buffer stays with the caller, a skipped frame has no bitstream
+		uint8_t* data = output_data.data;
+		output_data = job.output;
+		output_data.data = data;
+	}
+	return ret;
+}
+
+int MFVideoPipeline::encode(void* surface, VIDEO_FORMAT format, int64_t timestamp, bool unchanged, OutputVData& output_data)
+{
+	EncodeJob job = {};
+	int ret = prepare_job(surface, format, timestamp, unchanged, job);
+	if (ret == ENCODE_SUCCESS && !job.output.skipped)
+	{
+		ret = encode_job(job, output_data, m_eOutputMode);
+		release_job(job);
+		return ret;
+	}
+	if (ret == ENCODE_SUCCESS)
+	{
+		uint8_t* data = output_data.data;
+		output_data = job.output;
+		output_data.data = data;
+	}
+	return ret;
+}
+
+int MFVideoPipeline::submit(const VideoFrame& frame)
+{
+	if (!m_pBackend)
+	{
+		return ENCODE_FAIL;
+	}
+	if (!m_tEncodeThread.joinable())
+	{
+		start_encode_thread();
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mtQueue);
+		if ((int)m_dqEncodeJobs.size() >= m_iQueueDepth)
+		{
+			m_iRejectedFrames++;
+			return ENCODE_QUEUE_FULL;
+		}
+	}
+	// conversion happens here on the submitting thread, so it overlaps with the codec working on earlier frames
+	EncodeJob job = {};
+	int ret = prepare_job(frame, job);
+	return submit_job(ret, job);
+}
+
+int MFVideoPipeline::submit(void* surface, VIDEO_FORMAT format, int64_t timestamp, bool unchanged)
+{
+	if (!m_pBackend)
+	{
+		return ENCODE_FAIL;
+	}
+	if (!m_tEncodeThread.joinable())
+	{
+		start_encode_thread();
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mtQueue);
+		if ((int)m_dqEncodeJobs.size() >= m_iQueueDepth)
+		{
+			m_iRejectedFrames++;
+			return ENCODE_QUEUE_FULL;
+		}
+	}
+	EncodeJob job = {};
+	int ret = prepare_job(surface, format, timestamp, unchanged, job);
+	return submit_job(ret, job);
+}
+
+int MFVideoPipeline::poll(OutputVData& output_data)
+{
+	EncodeResult result = {};
+	{
+		std::lock_guard<std::mutex> lock(m_mtQueue);
+		if (m_dqEncodeResults.empty())
+		{
+			return ENCODE_MORE_INPUT;
+		}
+		EncodeResult& front = m_dqEncodeResults.front();
+		if (front.code == ENCODE_SUCCESS && !front.output.skipped && m_eOutputMode == OUTPUT_MODE_COPY &&
+			(output_data.data == nullptr || output_data.capacity < front.output.size))
+		{
+			// kept for a poll with a larger buffer
+			output_data.size = front.output.size;
+			return ENCODE_FAIL;
+		}
+		result = front;
+		m_dqEncodeResults.pop_front();
+	}
+	m_cvQueue.notify_all();
+	if (result.code != ENCODE_SUCCESS)
+	{
+		return result.code;
+	}
+	output_data.duration = result.output.duration;
+	output_data.timestamp = result.output.timestamp;
+	output_data.key_frame = result.output.key_frame;
+	output_data.skipped = result.output.skipped;
+	if (result.output.skipped || m_eOutputMode == OUTPUT_MODE_LEASE)
+	{
+		output_data.data = result.output.skipped ? output_data.data : result.output.data;
+		output_data.size = result.output.size;
+		output_data.lease = result.output.lease;
+	}
+	else
+	{
+		memcpy(output_data.data, result.output.data, result.output.size);
+		output_data.size = result.output.size;
+		output_data.lease = nullptr;
+		m_BitstreamArena.release((BitstreamBlock*)result.output.lease);
+	}
+	return ENCODE_SUCCESS;
+}
+
+void MFVideoPipeline::release_output(OutputVData& output_data)
+{
+	if (output_data.lease)
+	{
+		m_BitstreamArena.release(reinterpret_cast<BitstreamBlock*>(output_data.lease));
+		output_data.lease = nullptr;
+		output_data.data = nullptr;
+		output_data.size = 0;
+	}
+}
+
+void MFVideoPipeline::get_queue_stats(EncodeQueueStats& stats)
+{
+	std::lock_guard<std::mutex> lock(m_mtQueue);
+	stats.queue_depth = m_iQueueDepth;
+	stats.queued_inputs = (int)m_dqEncodeJobs.size();
+	stats.ready_outputs = (int)m_dqEncodeResults.size();
+	stats.submitted_frames = m_iSubmittedFrames;
+	stats.rejected_frames = m_iRejectedFrames;
+	{
+		std::lock_guard<std::mutex> rate_control_lock(m_mtRateControl);
+		stats.rate_control_failures = m_iRateControlFailures;
+	}
+	stats.average_latency_ms = m_fAverageLatency;
+	stats.max_latency_ms = m_fMaxLatency;
+	stats.depth_latency_ms = m_pBackend ? m_iQueueDepth * 1000.0 * m_iFpsDen / m_iFpsNum : 0.0;
+}
+
+// builds the encoder input on the calling thread, neither frame nor surface is set for a flush or a skipped frame
+int MFVideoPipeline::prepare_job(const VideoFrame& frame, EncodeJob& job)
+{
+	if (!m_pBackend)
+	{
+		return ENCODE_FAIL;
+	}
+	job.output.skipped = false;
+	if (!frame.data[0])
+	{
+		job.flush = true;
+		return ENCODE_SUCCESS;
+	}
+	if (before_clock_origin(frame.timestamp))
+	{
+		return ENCODE_DROPPED;
+	}
+	// the kernel is looked up once per input format, not per frame
+	if (!m_PixelConverter.is_configured(frame.format, m_eInputFormat) && !m_PixelConverter.configure(frame.format, m_eInputFormat))
+	{
+		return ENCODE_FAIL;
+	}
+	// the crop is only a plane offset, the source is read once by the converter or the copy below
+	PlaneView src = {};
+	int frame_width = 0;
+	int frame_height = 0;
+	get_cropped_planes(frame, src, frame_width, frame_height);
+	if (check_skip(frame.unchanged, &src, frame.format, frame_width, frame_height))
+	{
+		return skip_frame(frame.timestamp, job.output);
+	}
+	int width = m_iEncodedWidth;
+	int height = m_iEncodedHeight;
+	if (frame.ref_count.load(std::memory_order_relaxed) > 0 && frame.format == m_eInputFormat &&
+		frame_width == frame.width && frame_height == frame.height && frame_width == width && frame_height == height &&
+		mf_video_frame_is_contiguous(frame))
+	{
+		// the frame already is what the encoder reads, it is referenced instead of copied
+		job.frame = mf_video_frame_ref(const_cast<VideoFrame*>(&frame));
+	}
+	else
+	{
+		// converted frames come from the pool and go back once the backend lets go of them
+		VideoFrame* converted = m_FramePool.acquire(m_eInputFormat, width, height, true);
+		if (converted == nullptr)
+		{
+			return ENCODE_QUEUE_FULL;
+		}
+		bool ret = true;
+		if (frame_width != width || frame_height != height)
+		{
+			ret = scale_memory_data(src, frame.format, frame_width, frame_height, *converted);
+		}
+		else
+		{
+			// a copy when the formats match, the same stripes either way
+			PlaneView dst = get_planes(*converted);
+			auto convert = [&](int, int row_begin, int row_end)
+			{
+				m_PixelConverter.convert(src, dst, width, row_begin, row_end);
+			};
+			m_ConvertPool.run(height, 2, convert);
+		}
+		if (!ret)
+		{
+			mf_video_frame_unref(converted);
+			return ENCODE_FAIL;
+		}
+		job.frame = converted;
+	}
+	return finish_job(job, frame.timestamp);
+}
+
+int MFVideoPipeline::prepare_job(void* surface, VIDEO_FORMAT format, int64_t timestamp, bool unchanged, EncodeJob& job)
+{
+	if (!m_pBackend)
+	{
+		return ENCODE_FAIL;
+	}
+	job.output.skipped = false;
+	if (!surface)
+	{
+		job.flush = true;
+		return ENCODE_SUCCESS;
+	}
+	if (before_clock_origin(timestamp))
+	{
+		return ENCODE_DROPPED;
+	}
+	// surfaces are never read back for the comparison, only the caller hint applies
+	if (check_skip(unchanged, nullptr, mf_video_pixel_format(format), 0, 0))
+	{
+		return skip_frame(timestamp, job.output);
+	}
+	job.surface = m_pBackend->acquire_surface(surface, format);
+	if (!job.surface)
+	{
+		return ENCODE_FAIL;
+	}
+	return finish_job(job, timestamp);
+}
+
+int MFVideoPipeline::finish_job(EncodeJob& job, int64_t input_timestamp)
+{
+	if (!assign_timestamp(input_timestamp, job.timestamp, job.duration))
+	{
+		release_job(job);
+		return ENCODE_FAIL;
+	}
+	return ENCODE_SUCCESS;
+}
+
+void MFVideoPipeline::release_job(EncodeJob& job)
+{
+	if (job.frame)
+	{
+		mf_video_frame_unref(job.frame);
+		job.frame = nullptr;
+	}
+	if (job.surface)
+	{
+		m_pBackend->release_surface(job.surface);
+		job.surface = nullptr;
+	}
+}
+
+int MFVideoPipeline::encode_job(const EncodeJob& job, OutputVData& output_data, OUTPUT_MODE output_mode)
+{
+	output_data.skipped = false;
+	if (!job.flush)
+	{
+		apply_pending_rate_control();
+	}
+	BitstreamLease lease = {};
+	if (!m_BitstreamArena.acquire(m_pBackend->get_max_packet_size(), lease))
+	{
+		return ENCODE_FAIL;
+	}
+	EncoderPacket packet = {};
+	int ret = ENCODE_FAIL;
+	if (job.flush)
+	{
+		ret = m_pBackend->encode(nullptr, lease.data, lease.capacity, packet);
+	}
+	else
+	{
+		EncoderFrame frame = {};
+		if (job.frame)
+		{
+			for (int i = 0; i < MF_MAX_PLANES; i++)
+			{
+				frame.data[i] = job.frame->data[i];
+				frame.stride[i] = job.frame->stride[i];
+			}
+		}
+		frame.timestamp = job.timestamp;
+		frame.duration = job.duration;
+		frame.frame = job.frame;
+		frame.surface = job.surface;
+		ret = m_pBackend->encode(&frame, lease.data, lease.capacity, packet);
+	}
+	if (ret != ENCODE_SUCCESS)
+	{
+		m_BitstreamArena.release(lease.block);
+		return ret;
+	}
+	m_BitstreamArena.commit(lease, packet.size);
+	output_data.duration = packet.duration;
+	output_data.timestamp = packet.timestamp;
+	output_data.key_frame = packet.key_frame;
+	if (output_mode == OUTPUT_MODE_LEASE)
+	{
+		output_data.data = lease.data;
+		output_data.size = lease.size;
+		output_data.lease = lease.block;
+	}
+	else
+	{
+		if (output_data.data == nullptr || output_data.capacity < lease.size)
+		{
+			output_data.size = lease.size;
+			m_BitstreamArena.release(lease.block);
+			return ENCODE_FAIL;
+		}
+		memcpy(output_data.data, lease.data, lease.size);
+		output_data.size = lease.size;
+		output_data.lease = nullptr;
+		m_BitstreamArena.release(lease.block);
+	}
+	return ENCODE_SUCCESS;
+}
+
+int MFVideoPipeline::submit_job(int ret, EncodeJob& job)
+{
+	if (ret != ENCODE_SUCCESS)
+	{
+		return ret;
+	}
+	job.submit_time = std::chrono::steady_clock::now();
+	{
+		std::lock_guard<std::mutex> lock(m_mtQueue);
+		m_dqEncodeJobs.push_back(job);
+		m_iSubmittedFrames++;
+	}
+	m_cvQueue.notify_all();
+	return ENCODE_SUCCESS;
+}
+
+bool MFVideoPipeline::scale_memory_data(const PlaneView& src, PIXEL_FORMAT src_format, int src_width, int src_height, VideoFrame& dst)
+{
+	int width = dst.width;
+	int height = dst.height;
+	PlaneView dst_planes = get_planes(dst);
+	if (src_format == PIXEL_BGRA && dst.format == PIXEL_BGRA)
+	{
+		libyuv::ARGBScale(src.data[0], src.stride[0], src_width, src_height, dst_planes.data[0], dst_planes.stride[0], width, height, libyuv::kFilterBox);
+		return true;
+	}
+	if (src_format == PIXEL_BGRA)
+	{
+		if (!m_ScaleConverter.is_configured(src_width, src_height, width, height) &&
+			!m_ScaleConverter.configure(src_width, src_height, width, height, width < src_width ? SCALE_FILTER_BOX : SCALE_FILTER_BILINEAR))
+		{
+			return false;
+		}
+		m_ScaleConverter.set_slot_count(m_ConvertPool.get_thread_count());
+		auto convert = [&](int stripe, int row_begin, int row_end)
+		{
+			if (dst.format == PIXEL_NV12)
+			{
+				m_ScaleConverter.bgra_to_nv12(src.data[0], src.stride[0], dst_planes.data[0], dst_planes.stride[0], dst_planes.data[1], dst_planes.stride[1], row_begin, row_end, stripe);
+			}
+			else
+			{
+				m_ScaleConverter.bgra_to_i420(src.data[0], src.stride[0], dst_planes.data[0], dst_planes.stride[0], dst_planes.data[1], dst_planes.stride[1],
+					dst_planes.data[2], dst_planes.stride[2], row_begin, row_end, stripe);
+			}
+		};
+		m_ConvertPool.run(height, 2, convert);
+		return true;
+	}
+	// packed yuv and RGB24 have no scaler, they are brought to I420 at their own size first
+	VideoFrame* staged_frame = nullptr;
+	PlaneView planes = src;
+	if (mf_pixel_plane_count(src_format) == 1)
+	{
+		staged_frame = m_FramePool.acquire(PIXEL_I420, src_width, src_height, false);
+		if (staged_frame == nullptr || (!m_StageConverter.is_configured(src_format, PIXEL_I420) && !m_StageConverter.configure(src_format, PIXEL_I420)))
+		{
+			mf_video_frame_unref(staged_frame);
+			return false;
+		}
+		planes = get_planes(*staged_frame);
+		auto convert = [&](int, int row_begin, int row_end)
+		{
+			m_StageConverter.convert(src, planes, src_width, row_begin, row_end);
+		};
+		m_ConvertPool.run(src_height, 2, convert);
+		src_format = PIXEL_I420;
+	}
+	// yuv is scaled in its own layout, through a scratch frame only when the layout changes as well
+	bool interleaved = src_format == PIXEL_NV12;
+	VideoFrame* scaled_frame = nullptr;
+	PlaneView scaled = dst_planes;
+	if (interleaved != (dst.format == PIXEL_NV12) || dst.format == PIXEL_BGRA)
+	{
+		scaled_frame = m_FramePool.acquire(interleaved ? PIXEL_NV12 : PIXEL_I420, width, height, false);
+		if (scaled_frame == nullptr)
+		{
+			mf_video_frame_unref(staged_frame);
+			return false;
+		}
+		scaled = get_planes(*scaled_frame);
+	}
+	if (interleaved)
+	{
+		libyuv::NV12Scale(planes.data[0], planes.stride[0], planes.data[1], planes.stride[1], src_width, src_height,
+			scaled.data[0], scaled.stride[0], scaled.data[1], scaled.stride[1], width, height, libyuv::kFilterBox);
+	}
+	else
+	{
+		libyuv::I420Scale(planes.data[0], planes.stride[0], planes.data[1], planes.stride[1], planes.data[2], planes.stride[2], src_width, src_height,
+			scaled.data[0], scaled.stride[0], scaled.data[1], scaled.stride[1], scaled.data[2], scaled.stride[2], width, height, libyuv::kFilterBox);
+	}
+	if (scaled_frame)
+	{
+		mf_pixel_convert_func(scaled_frame->format, dst.format)(scaled, dst_planes, width, height);
+	}
+	mf_video_frame_unref(scaled_frame);
+	mf_video_frame_unref(staged_frame);
+	return true;
+}
+
+void MFVideoPipeline::get_cropped_planes(const VideoFrame& frame, PlaneView& planes, int& frame_width, int& frame_height)
+{
+	int width = frame.width;
+	int height = frame.height;
+	frame_width = XALIGN((int)(width * (m_tCropRatio.right - m_tCropRatio.left)), 16);
+	frame_height = XALIGN((int)(height * (m_tCropRatio.bottom - m_tCropRatio.top)), 2);
+	frame_width = frame_width < width ? frame_width : width & ~1;
+	frame_height = frame_height < height ? frame_height : height & ~1;
+	// chroma is subsampled by two, so the crop origin must stay on even coordinates
+	int left = (int)(width * m_tCropRatio.left) & ~1;
+	int top = (int)(height * m_tCropRatio.top) & ~1;
+	if (left + frame_width > width)
+	{
+		left = (width - frame_width) & ~1;
+	}
+	if (top + frame_height > height)
+	{
+		top = (height - frame_height) & ~1;
+	}
+	// strides come from the frame, rows may be padded or run bottom-up
+	int bytes_per_pixel = mf_pixel_bytes_per_pixel(frame.format);
+	planes.stride[0] = frame.stride[0];
+	planes.data[0] = frame.data[0] + (ptrdiff_t)top * frame.stride[0] + left * bytes_per_pixel;
+	for (int i = 1; i < mf_pixel_plane_count(frame.format); i++)
+	{
+		planes.stride[i] = frame.stride[i];
+		planes.data[i] = frame.data[i] + (ptrdiff_t)(top / 2) * frame.stride[i] + (frame.format == PIXEL_NV12 ? left : left / 2);
+	}
+}
+
+bool MFVideoPipeline::check_skip(bool unchanged, const PlaneView* planes, PIXEL_FORMAT format, int width, int height)
+{
+	if (m_eSkipMode == SKIP_MODE_NONE)
+	{
+		return false;
+	}
+	bool skip = unchanged;
+	if (m_eSkipMode == SKIP_MODE_DETECT && planes)
+	{
+		// refreshed on every frame, so a skipped frame is compared with the content on screen
+		uint64_t hash = hash_planes(*planes, format, width, height);
+		skip = skip || (m_bInputHashValid && hash == m_iInputHash);
+		m_iInputHash = hash;
+		m_bInputHashValid = true;
+	}
+	if (m_iFrameCount == 0 || (m_iMaxSkippedFrames > 0 && m_iSkippedFrames >= m_iMaxSkippedFrames))
+	{
+		skip = false;
+	}
+	m_iSkippedFrames = skip ? m_iSkippedFrames + 1 : 0;
+	return skip;
+}
+
+uint64_t MFVideoPipeline::hash_planes(const PlaneView& planes, PIXEL_FORMAT format, int width, int height)
+{
+	uint64_t hash = mf_hash_plane(planes.data[0], planes.stride[0], width * mf_pixel_bytes_per_pixel(format), height);
+	if (format == PIXEL_NV12)
+	{
+		hash = hash * 31 + mf_hash_plane(planes.data[1], planes.stride[1], width, height / 2);
+	}
+	else if (mf_pixel_plane_count(format) == 3)
+	{
+		hash = hash * 31 + mf_hash_plane(planes.data[1], planes.stride[1], width / 2, height / 2);
+		hash = hash * 31 + mf_hash_plane(planes.data[2], planes.stride[2], width / 2, height / 2);
+	}
+	return hash;
+}
+
+// captured before the session started, e.g. queued in the capture before the clock was started. such frames have no
+// place on the timeline, clamping them to 0 would give the second one the same timestamp as the first
+bool MFVideoPipeline::before_clock_origin(int64_t input_timestamp)
+{
+	return m_bClockOrigin && input_timestamp >= 0 && input_timestamp < m_iClockOrigin;
+}
+
+// caller timestamps are taken as they are and must increase, otherwise the frame index is put on the exact
+// rational frame grid so long recordings do not drift. duration is the nominal frame interval either way
+bool MFVideoPipeline::assign_timestamp(int64_t input_timestamp, int64_t& timestamp, int64_t& duration)
+{
+	if (input_timestamp >= 0 && m_bClockOrigin)
+	{
+		// capture time on the mf_clock_now timeline, frames from before the origin were dropped already
+		input_timestamp = mf_rescale(input_timestamp - m_iClockOrigin, m_iTimeBase, MF_HNS_PER_SECOND);
+	}
+	if (input_timestamp >= 0)
+	{
+		if (m_iLastTimestamp >= 0 && input_timestamp <= m_iLastTimestamp)
+		{
+			return false;
+		}
+		timestamp = input_timestamp;
+	}
+	else
+	{
+		timestamp = mf_frame_time(m_iFrameCount, m_iTimeBase, m_iFpsNum, m_iFpsDen);
+	}
+	// the next timestamp is not known before this frame is encoded, so the nominal interval stands in for its duration.
+	// a muxer takes the real one from the next frame, see MFMp4Muxer
+	duration = mf_frame_time(m_iFrameCount + 1, m_iTimeBase, m_iFpsNum, m_iFpsDen) - mf_frame_time(m_iFrameCount, m_iTimeBase, m_iFpsNum, m_iFpsDen);
+	m_iLastTimestamp = timestamp;
+	m_iFrameCount++;
+	return true;
+}
+
+// nothing reaches the backend, the time slot is still consumed so later timestamps stay on the frame grid
+int MFVideoPipeline::skip_frame(int64_t input_timestamp, OutputVData& output_data)
+{
+	if (!assign_timestamp(input_timestamp, output_data.timestamp, output_data.duration))
+	{
+		return ENCODE_FAIL;
+	}
+	output_data.size = 0;
+	output_data.key_frame = false;
+	output_data.lease = nullptr;
+	output_data.skipped = true;
+	return ENCODE_SUCCESS;
+}
+
+void MFVideoPipeline::apply_pending_rate_control()
+{
+	RateControlParam param = {};
+	{
+		std::lock_guard<std::mutex> lock(m_mtRateControl);
+		if (!m_bRateControlPending)
+		{
+			return;
+		}
+		param = m_tPendingRateControl;
+		m_bRateControlPending = false;
+	}
+	// the request is kept for the next start either way, the backend tracks what it actually applied
+	m_tRateControl = param;
+	if (!m_pBackend->set_rate_control(param))
+	{
+		std::lock_guard<std::mutex> lock(m_mtRateControl);
+		m_iRateControlFailures++;
+	}
+}
+
+void MFVideoPipeline::start_encode_thread()
+{
+	m_bQuitEncodeThread = false;
+	m_tEncodeThread = std::thread(&MFVideoPipeline::encode_thread_proc, this);
+}
+
+void MFVideoPipeline::stop_encode_thread()
+{
+	if (!m_tEncodeThread.joinable())
+	{
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mtQueue);
+		m_bQuitEncodeThread = true;
+	}
+	m_cvQueue.notify_all();
+	m_tEncodeThread.join();
+	for (auto& job : m_dqEncodeJobs)
+	{
+		release_job(job);
+	}
+	m_dqEncodeJobs.clear();
+	for (auto& result : m_dqEncodeResults)
+	{
+		if (result.output.lease)
+		{
+			m_BitstreamArena.release((BitstreamBlock*)result.output.lease);
+		}
+	}
+	m_dqEncodeResults.clear();
+	m_dqInFlightTimes.clear();
+}
+
+void MFVideoPipeline::encode_thread_proc()
+{
+	while (true)
+	{
+		EncodeJob job = {};
+		{
+			// results are bounded by the queue depth too, otherwise an idle poller would exhaust the arena
+			std::unique_lock<std::mutex> lock(m_mtQueue);
+			m_cvQueue.wait(lock, [this]() {
+				return m_bQuitEncodeThread || (!m_dqEncodeJobs.empty() && (int)m_dqEncodeResults.size() < m_iQueueDepth);
+			});
+			if (m_bQuitEncodeThread)
+			{
+				return;
+			}
+			job = m_dqEncodeJobs.front();
+			m_dqEncodeJobs.pop_front();
+		}
+		if (job.output.skipped)
+		{
+			push_result(ENCODE_SUCCESS, job.output, job.submit_time);
+			continue;
+		}
+		if (!job.flush)
+		{
+			m_dqInFlightTimes.push_back(job.submit_time);
+			OutputVData output_data = {};
+			int ret = encode_job(job, output_data, OUTPUT_MODE_LEASE);
+			release_job(job);
+			if (ret == ENCODE_SUCCESS)
+			{
+				push_result(ret, output_data, pop_in_flight_time());
+			}
+			else if (ret == ENCODE_FAIL)
+			{
+				push_result(ret, output_data, job.submit_time);
+			}
+			continue;
+		}
+		while (true)
+		{
+			OutputVData output_data = {};
+			int ret = encode_job(job, output_data, OUTPUT_MODE_LEASE);
+			if (ret != ENCODE_SUCCESS)
+			{
+				push_result(ret == ENCODE_FAIL ? ENCODE_FAIL : ENCODE_EOF, output_data, job.submit_time);
+				m_dqInFlightTimes.clear();
+				break;
+			}
+			push_result(ret, output_data, pop_in_flight_time());
+		}
+	}
+}
+
+std::chrono::steady_clock::time_point MFVideoPipeline::pop_in_flight_time()
+{
+	// backends emit in input order, so the oldest input without output belongs to this output
+	if (m_dqInFlightTimes.empty())
+	{
+		return std::chrono::steady_clock::now();
+	}
+	auto submit_time = m_dqInFlightTimes.front();
+	m_dqInFlightTimes.pop_front();
+	return submit_time;
+}
+
+void MFVideoPipeline::push_result(int code, const OutputVData& output_data, std::chrono::steady_clock::time_point submit_time)
+{
+	double latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - submit_time).count();
+	std::lock_guard<std::mutex> lock(m_mtQueue);
+	m_dqEncodeResults.push_back({ code, output_data });
+	m_fAverageLatency = m_fAverageLatency == 0.0 ? latency : m_fAverageLatency * 0.9375 + latency * 0.0625;
+	m_fMaxLatency = latency > m_fMaxLatency ? latency : m_fMaxLatency;
+}
@@ -0,0 +1,54 @@
+#ifndef MF_FILE_SINK_H
+#define MF_FILE_SINK_H
+
+#include "mf_common.h"
+#include "mf_muxer_output.h"
+
+enum FILE_SINK_BACKEND
+{
+	FILE_SINK_BACKEND_AUTO = 0, // io_uring when the kernel supports it, threads otherwise
+	FILE_SINK_BACKEND_URING, // Linux only
+	FILE_SINK_BACKEND_THREADS // positional writes from a small pool of I/O threads
+};
+
+struct FileSinkConfig
+{
+	FILE_SINK_BACKEND backend{ FILE_SINK_BACKEND_AUTO };
+	int buffer_size{ 1 << 20 }; // bytes per write request, rounded up to 4096
+	int max_buffers{ 16 }; // write-behind memory is buffer_size * max_buffers, write() waits when all are in flight
+	int64_t preallocate_size{ 64 << 20 }; // extent reserved ahead of the write position, 0 disables. the file size only grows with the data
+	int sync_interval_ms{ 1000 }; // durability point period, 0 syncs only in finish()
+	bool direct_io{ false }; // O_DIRECT / FILE_FLAG_NO_BUFFERING, bypasses the page cache
+	int io_threads{ 2 }; // FILE_SINK_BACKEND_THREADS only
+};
+
+struct FileSinkStats
+{
+	FILE_SINK_BACKEND backend;
+	int64_t bytes_accepted;
+	int64_t bytes_written; // completed by the disk
+	int64_t sync_points;
+	int64_t stalls; // write() calls that had to wait for a free buffer
+	double max_stall_ms;
+	double max_write_ms; // slowest write() call, stalls included
+};
+
+// Recording sink that keeps disk latency off the encode thread. write() only copies into aligned buffers, full
+// buffers are written behind by io_uring or by the I/O threads. Durability points sync everything submitted so far.
+class MF_EXPORT MFFileSink final : public MFMuxerOutput
+{
+public:
+	MFFileSink();
+	~MFFileSink();
+
+	bool open(const char* path, const FileSinkConfig& config);
+	bool write(const uint8_t* data, unsigned long size) override; // false once a write failed, the file is incomplete then
+	bool finish() override; // drains, syncs and closes the file
+	void get_stats(FileSinkStats& stats);
+
+private:
+	class Impl;
+	Impl* impl_;
+};
+
+#endif
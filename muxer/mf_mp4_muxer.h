@@ -0,0 +1,39 @@
+#ifndef MF_MP4_MUXER_H
+#define MF_MP4_MUXER_H
+
+#include "mf_common.h"
+#include "mf_encoder_types.h"
+#include "mf_muxer_output.h"
+
+// Fragmented MP4 recording. An init segment (ftyp + moov without samples) is followed by moof / mdat pairs that
+// are only ever appended, so a recording cut short by a crash stays playable up to the last complete fragment
+// and no sample index grows with the file. Video is the H.264 Annex-B output of MFVideoEncoder, audio the raw
+// AAC-LC output of MFAudioEncoder. Video is written as avc3 with its parameter sets kept in the samples, so they may
+// change mid-recording, e.g. when the encoder is restarted. write_video and write_audio may be called from different threads.
+class MF_EXPORT MFMp4Muxer final
+{
+public:
+	MFMp4Muxer();
+	~MFMp4Muxer();
+
+	// configure the tracks before open(), a muxer with only one of them writes a single track file
+	void set_video(int width, int height, int64_t time_base); // time_base as passed to MFVideoEncoder::set_time_base
+	void set_audio(int sample_rate, int channels, int64_t time_base);
+	void set_fragment_duration(int milliseconds); // if not set, default is 1000. with video a fragment starts at the first key frame after it
+	void set_max_interleave(int milliseconds); // if not set, default is 500. how long a finished fragment waits for the lagging track
+
+	bool open(const char* path); // writes through an MFFileSink with the default FileSinkConfig
+	bool open(MFMuxerOutput* output); // output is not owned and must outlive close()
+	bool close(); // writes the buffered samples as the last fragment
+
+	// video before the first key frame is dropped. returns false when the sample was not written, e.g. audio that
+	// arrives after its fragment was already closed by the max interleave
+	bool write_video(const OutputVData& data);
+	bool write_audio(const OutputAData& data);
+
+private:
+	class Impl;
+	Impl* impl_;
+};
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef MF_MUXER_OUTPUT_H
+#define MF_MUXER_OUTPUT_H
+
+#include <stdint.h>
+
+// Append-only byte sink behind a muxer. Muxers never seek, so an output can be a file, a socket or a pipe.
+class MFMuxerOutput
+{
+public:
+	virtual ~MFMuxerOutput() {}
+
+	// the data only has to stay valid for the duration of the call
+	virtual bool write(const uint8_t* data, unsigned long size) = 0;
+
+	// flushes whatever the output buffers, no write follows
+	virtual bool finish() = 0;
+};
+
+#endif
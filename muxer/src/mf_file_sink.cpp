@@ -0,0 +1,867 @@
+#include "mf_file_sink.h"
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#define FILE_SINK_ALIGNMENT 4096
+
+enum IO_JOB_TYPE
+{
+	IO_JOB_WRITE = 0,
+	IO_JOB_SYNC,
+	IO_JOB_ALLOCATE
+};
+
+struct IoJob
+{
+	IO_JOB_TYPE type;
+	int buffer;
+	int64_t offset;
+	int64_t length;
+};
+
+struct SinkBuffer
+{
+	uint8_t* data;
+	uint32_t size; // payload bytes
+	uint32_t length; // bytes to write, size padded to the alignment for the last direct I/O write
+	uint32_t done;
+	int64_t offset;
+};
+
+#ifdef _WIN32
+typedef HANDLE SinkFile;
+#define SINK_INVALID_FILE INVALID_HANDLE_VALUE
+
+static SinkFile file_open(const char* path, bool direct_io)
+{
+	DWORD flags = FILE_ATTRIBUTE_NORMAL | (direct_io ? FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH : 0);
+	return CreateFileA(path, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, flags, NULL);
+}
+
+static void file_close(SinkFile file)
+{
+	CloseHandle(file);
+}
+
+// an OVERLAPPED offset on a synchronous handle makes WriteFile positional
+static int64_t file_pwrite(SinkFile file, const uint8_t* data, uint32_t size, int64_t offset)
+{
+	OVERLAPPED overlapped = {};
+	overlapped.Offset = (DWORD)offset;
+	overlapped.OffsetHigh = (DWORD)(offset >> 32);
+	DWORD written = 0;
+	return WriteFile(file, data, size, &written, &overlapped) ? (int64_t)written : -1;
+}
+
+static bool file_sync(SinkFile file)
+{
+	return FlushFileBuffers(file) != FALSE;
+}
+
+static bool file_allocate(SinkFile file, int64_t offset, int64_t length)
+{
+	FILE_ALLOCATION_INFO info = {};
+	info.AllocationSize.QuadPart = offset + length;
+	return SetFileInformationByHandle(file, FileAllocationInfo, &info, sizeof(info)) != FALSE;
+}
+
+static bool file_truncate(SinkFile file, int64_t size)
+{
+	FILE_END_OF_FILE_INFO info = {};
+	info.EndOfFile.QuadPart = size;
+	return SetFileInformationByHandle(file, FileEndOfFileInfo, &info, sizeof(info)) != FALSE;
+}
+#else
+typedef int SinkFile;
+#define SINK_INVALID_FILE -1
+
+static SinkFile file_open(const char* path, bool direct_io)
+{
+	int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+#ifdef O_DIRECT
+	flags |= direct_io ? O_DIRECT : 0;
+#endif
+	return ::open(path, flags, 0644);
+}
+
+static void file_close(SinkFile file)
+{
+	::close(file);
+}
+
+static int64_t file_pwrite(SinkFile file, const uint8_t* data, uint32_t size, int64_t offset)
+{
+	ssize_t written = 0;
+	do
+	{
+		written = pwrite(file, data, size, (off_t)offset);
+	} while (written < 0 && errno == EINTR);
+	return written;
+}
+
+static bool file_sync(SinkFile file)
+{
+#ifdef __linux__
+	return fdatasync(file) == 0;
+#else
+	return fsync(file) == 0;
+#endif
+}
+
+// KEEP_SIZE reserves the extent without moving the end of file, a crash leaves no zero tail behind
+static bool file_allocate(SinkFile file, int64_t offset, int64_t length)
+{
+#ifdef __linux__
+	return fallocate(file, FALLOC_FL_KEEP_SIZE, (off_t)offset, (off_t)length) == 0;
+#else
+	(void)file;
+	(void)offset;
+	(void)length;
+	return false;
+#endif
+}
+
+static bool file_truncate(SinkFile file, int64_t size)
+{
+	return ftruncate(file, (off_t)size) == 0;
+}
+#endif
+
+#ifdef __linux__
+// Minimal io_uring through the raw syscalls, liburing is not a dependency. Only the submitting thread touches the
+// rings, the kernel side is synchronized through the acquire / release accesses of the ring indices.
+class SinkRing
+{
+public:
+	~SinkRing()
+	{
+		close();
+	}
+
+	bool open(unsigned entries)
+	{
+		io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		m_iFd = (int)syscall(__NR_io_uring_setup, entries, &params);
+		if (m_iFd < 0)
+		{
+			return false;
+		}
+		m_iSqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		m_iCqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (single_mmap)
+		{
+			m_iSqSize = m_iCqSize = std::max(m_iSqSize, m_iCqSize);
+		}
+		m_pSq = mmap(nullptr, m_iSqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_iFd, IORING_OFF_SQ_RING);
+		if (m_pSq == MAP_FAILED)
+		{
+			m_pSq = nullptr;
+			close();
+			return false;
+		}
+		m_pCq = single_mmap ? m_pSq : mmap(nullptr, m_iCqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_iFd, IORING_OFF_CQ_RING);
+		m_iSqesSize = params.sq_entries * sizeof(io_uring_sqe);
+		m_pSqes = (io_uring_sqe*)mmap(nullptr, m_iSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_iFd, IORING_OFF_SQES);
+		if (m_pCq == MAP_FAILED || m_pSqes == MAP_FAILED)
+		{
+			m_pCq = m_pCq == MAP_FAILED ? nullptr : m_pCq;
+			m_pSqes = m_pSqes == MAP_FAILED ? nullptr : m_pSqes;
+			close();
+			return false;
+		}
+		uint8_t* sq = (uint8_t*)m_pSq;
+		uint8_t* cq = (uint8_t*)m_pCq;
+		m_pSqTail = (unsigned*)(sq + params.sq_off.tail);
+		m_pSqArray = (unsigned*)(sq + params.sq_off.array);
+		m_iSqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+		m_pCqHead = (unsigned*)(cq + params.cq_off.head);
+		m_pCqTail = (unsigned*)(cq + params.cq_off.tail);
+		m_iCqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+		m_pCqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+		return true;
+	}
+
+	void close()
+	{
+		if (m_pSqes)
+		{
+			munmap(m_pSqes, m_iSqesSize);
+		}
+		if (m_pCq && m_pCq != m_pSq)
+		{
+			munmap(m_pCq, m_iCqSize);
+		}
+		if (m_pSq)
+		{
+			munmap(m_pSq, m_iSqSize);
+		}
+		m_pSqes = nullptr;
+		m_pCq = nullptr;
+		m_pSq = nullptr;
+		if (m_iFd >= 0)
+		{
+			::close(m_iFd);
+			m_iFd = -1;
+		}
+	}
+
+	// the caller keeps in-flight requests below the ring size, so a free SQE always exists. it is filled in and then
+	// handed to the kernel by publish(), a kernel polling the ring must not see the tail move before the fields
+	io_uring_sqe* get_sqe()
+	{
+		io_uring_sqe* sqe = &m_pSqes[*m_pSqTail & m_iSqMask];
+		memset(sqe, 0, sizeof(*sqe));
+		return sqe;
+	}
+
+	void publish()
+	{
+		unsigned tail = *m_pSqTail;
+		unsigned index = tail & m_iSqMask;
+		m_pSqArray[index] = index;
+		__atomic_store_n(m_pSqTail, tail + 1, __ATOMIC_RELEASE);
+		m_iUnsubmitted++;
+	}
+
+	bool enter(unsigned min_complete)
+	{
+		unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+		while (true)
+		{
+			int ret = (int)syscall(__NR_io_uring_enter, m_iFd, m_iUnsubmitted, min_complete, flags, nullptr, 0);
+			if (ret >= 0)
+			{
+				m_iUnsubmitted -= std::min((unsigned)ret, m_iUnsubmitted);
+				return true;
+			}
+			if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			{
+				return false;
+			}
+		}
+	}
+
+	template<typename Handler>
+	int reap(Handler& handler)
+	{
+		int count = 0;
+		unsigned head = *m_pCqHead;
+		while (head != __atomic_load_n(m_pCqTail, __ATOMIC_ACQUIRE))
+		{
+			const io_uring_cqe& cqe = m_pCqes[head & m_iCqMask];
+			handler(cqe.user_data, cqe.res);
+			head++;
+			count++;
+		}
+		__atomic_store_n(m_pCqHead, head, __ATOMIC_RELEASE);
+		return count;
+	}
+
+private:
+	int m_iFd{ -1 };
+	void* m_pSq{ nullptr };
+	void* m_pCq{ nullptr };
+	io_uring_sqe* m_pSqes{ nullptr };
+	size_t m_iSqSize{ 0 };
+	size_t m_iCqSize{ 0 };
+	size_t m_iSqesSize{ 0 };
+	unsigned* m_pSqTail{ nullptr };
+	unsigned* m_pSqArray{ nullptr };
+	unsigned m_iSqMask{ 0 };
+	unsigned* m_pCqHead{ nullptr };
+	unsigned* m_pCqTail{ nullptr };
+	unsigned m_iCqMask{ 0 };
+	io_uring_cqe* m_pCqes{ nullptr };
+	unsigned m_iUnsubmitted{ 0 };
+};
+
+#define SINK_USER_SYNC 0xFFFFFFFF00000001ull
+#define SINK_USER_ALLOCATE 0xFFFFFFFF00000002ull
+#endif
+
+class MFFileSink::Impl
+{
+public:
+	Impl()
+	{
+	}
+
+	~Impl()
+	{
+		finish();
+	}
+
+	bool open(const char* path, const FileSinkConfig& config)
+	{
+		finish();
+		m_tConfig = config;
+		m_tConfig.buffer_size = XALIGN(std::max(config.buffer_size, FILE_SINK_ALIGNMENT), FILE_SINK_ALIGNMENT);
+		m_tConfig.max_buffers = std::max(config.max_buffers, 2);
+		m_tConfig.io_threads = std::max(config.io_threads, 1);
+		m_tConfig.preallocate_size = std::max(config.preallocate_size, (int64_t)0);
+		m_hFile = path ? file_open(path, m_tConfig.direct_io) : SINK_INVALID_FILE;
+		if (m_hFile == SINK_INVALID_FILE)
+		{
+			return false;
+		}
+
+		m_vecBuffers.resize(m_tConfig.max_buffers);
+		m_vecFree.clear();
+		for (int i = 0; i < m_tConfig.max_buffers; i++)
+		{
+			m_vecBuffers[i].data = (uint8_t*)mf_aligned_malloc(m_tConfig.buffer_size, FILE_SINK_ALIGNMENT);
+			m_vecBuffers[i].size = 0;
+			m_vecFree.push_back(i);
+		}
+		m_iCurrent = -1;
+		m_iAppendOffset = 0;
+		m_iSubmitOffset = 0;
+		m_iAllocatedEnd = 0;
+		m_iPending = 0;
+		m_bFailed = false;
+		m_bQuit = false;
+		memset(&m_tStats, 0, sizeof(m_tStats));
+		m_tLastSync = std::chrono::steady_clock::now();
+
+		m_eBackend = FILE_SINK_BACKEND_THREADS;
+#ifdef __linux__
+		m_iRingSyncs = 0;
+		m_bResync = false;
+		// every buffer, two durability points and one preallocation can be in flight at once
+		if (m_tConfig.backend != FILE_SINK_BACKEND_THREADS && m_Ring.open((unsigned)m_tConfig.max_buffers + 4))
+		{
+			m_eBackend = FILE_SINK_BACKEND_URING;
+		}
+#endif
+		if (m_tConfig.backend == FILE_SINK_BACKEND_URING && m_eBackend != FILE_SINK_BACKEND_URING)
+		{
+			close_file();
+			return false;
+		}
+		if (m_eBackend == FILE_SINK_BACKEND_THREADS)
+		{
+			for (int i = 0; i < m_tConfig.io_threads; i++)
+			{
+				m_vecWorkers.emplace_back(&Impl::worker_proc, this);
+			}
+		}
+		m_tStats.backend = m_eBackend;
+		m_bOpened = true;
+		preallocate();
+		return true;
+	}
+
+	bool write(const uint8_t* data, unsigned long size)
+	{
+		if (!m_bOpened || m_bFailed)
+		{
+			return false;
+		}
+		auto start = std::chrono::steady_clock::now();
+		unsigned long offset = 0;
+		while (offset < size)
+		{
+			if (m_iCurrent < 0 && !acquire_buffer())
+			{
+				return false;
+			}
+			SinkBuffer& buffer = m_vecBuffers[m_iCurrent];
+			uint32_t count = (uint32_t)std::min<unsigned long>(m_tConfig.buffer_size - buffer.size, size - offset);
+			memcpy(buffer.data + buffer.size, data + offset, count);
+			buffer.size += count;
+			offset += count;
+			if (buffer.size == (uint32_t)m_tConfig.buffer_size)
+			{
+				submit_current();
+			}
+		}
+		m_iAppendOffset += size;
+		preallocate();
+		if (m_tConfig.sync_interval_ms > 0 && std::chrono::steady_clock::now() - m_tLastSync >= std::chrono::milliseconds(m_tConfig.sync_interval_ms))
+		{
+			sync_point();
+		}
+		poll_completions(false);
+
+		double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		std::lock_guard<std::mutex> lock(m_mtIo);
+		m_tStats.bytes_accepted = m_iAppendOffset;
+		m_tStats.max_write_ms = std::max(m_tStats.max_write_ms, elapsed_ms);
+		return !m_bFailed;
+	}
+
+	bool finish()
+	{
+		if (!m_bOpened)
+		{
+			return true;
+		}
+		if (m_iCurrent >= 0 && m_vecBuffers[m_iCurrent].size)
+		{
+			submit_current();
+		}
+		submit_job({ IO_JOB_SYNC, -1, 0, 0 });
+		wait_idle();
+		if (m_eBackend == FILE_SINK_BACKEND_THREADS)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mtIo);
+				m_bQuit = true;
+			}
+			m_cvIo.notify_all();
+			for (auto& worker : m_vecWorkers)
+			{
+				worker.join();
+			}
+			m_vecWorkers.clear();
+		}
+		// direct I/O pads the last write to the alignment
+		if (m_tConfig.direct_io && !m_bFailed && !file_truncate(m_hFile, m_iAppendOffset))
+		{
+			m_bFailed = true;
+		}
+		close_file();
+		return !m_bFailed;
+	}
+
+	void get_stats(FileSinkStats& stats)
+	{
+		std::lock_guard<std::mutex> lock(m_mtIo);
+		stats = m_tStats;
+	}
+
+private:
+	void close_file()
+	{
+#ifdef __linux__
+		m_Ring.close();
+#endif
+		if (m_hFile != SINK_INVALID_FILE)
+		{
+			file_close(m_hFile);
+			m_hFile = SINK_INVALID_FILE;
+		}
+		for (auto& buffer : m_vecBuffers)
+		{
+			mf_aligned_free(buffer.data);
+		}
+		m_vecBuffers.clear();
+		m_vecFree.clear();
+		m_iCurrent = -1;
+		m_bOpened = false;
+	}
+
+	bool acquire_buffer()
+	{
+		std::unique_lock<std::mutex> lock(m_mtIo);
+		if (m_vecFree.empty())
+		{
+			// write-behind memory is exhausted, the disk is behind the encoder
+			auto start = std::chrono::steady_clock::now();
+			while (m_vecFree.empty() && !m_bFailed)
+			{
+				if (m_eBackend == FILE_SINK_BACKEND_THREADS)
+				{
+					m_cvIo.wait(lock);
+				}
+				else
+				{
+					lock.unlock();
+					poll_completions(true);
+					lock.lock();
+				}
+			}
+			m_tStats.stalls++;
+			m_tStats.max_stall_ms = std::max(m_tStats.max_stall_ms, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		}
+		if (m_bFailed)
+		{
+			return false;
+		}
+		m_iCurrent = m_vecFree.back();
+		m_vecFree.pop_back();
+		m_vecBuffers[m_iCurrent].size = 0;
+		return true;
+	}
+
+	void submit_current()
+	{
+		SinkBuffer& buffer = m_vecBuffers[m_iCurrent];
+		buffer.offset = m_iSubmitOffset;
+		buffer.done = 0;
+		buffer.length = buffer.size;
+		if (m_tConfig.direct_io && buffer.size % FILE_SINK_ALIGNMENT)
+		{
+			buffer.length = XALIGN(buffer.size, FILE_SINK_ALIGNMENT);
+			memset(buffer.data + buffer.size, 0, buffer.length - buffer.size);
+		}
+		m_iSubmitOffset += buffer.size;
+		int index = m_iCurrent;
+		m_iCurrent = -1;
+		submit_job({ IO_JOB_WRITE, index, buffer.offset, buffer.length });
+	}
+
+	// everything submitted before the point is on disk once it completes. buffered I/O writes out the partial
+	// buffer first, direct I/O can only write whole blocks and leaves it for the next point
+	void sync_point()
+	{
+		m_tLastSync = std::chrono::steady_clock::now();
+		{
+			std::lock_guard<std::mutex> lock(m_mtIo);
+			if (m_bSyncPending)
+			{
+				return;
+			}
+			m_bSyncPending = true;
+		}
+		if (!m_tConfig.direct_io && m_iCurrent >= 0 && m_vecBuffers[m_iCurrent].size)
+		{
+			submit_current();
+		}
+		submit_job({ IO_JOB_SYNC, -1, 0, 0 });
+	}
+
+	void preallocate()
+	{
+		int64_t write_behind = (int64_t)m_tConfig.buffer_size * m_tConfig.max_buffers;
+		int64_t length = 0;
+		{
+			std::lock_guard<std::mutex> lock(m_mtIo);
+			if (!m_tConfig.preallocate_size || m_bAllocatePending || m_iSubmitOffset + write_behind <= m_iAllocatedEnd)
+			{
+				return;
+			}
+			length = std::max(m_tConfig.preallocate_size, write_behind);
+			m_bAllocatePending = true;
+		}
+		submit_job({ IO_JOB_ALLOCATE, -1, m_iAllocatedEnd, length });
+		m_iAllocatedEnd += length;
+	}
+
+	void submit_job(const IoJob& job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mtIo);
+			m_iPending++;
+		}
+#ifdef __linux__
+		if (m_eBackend == FILE_SINK_BACKEND_URING)
+		{
+			io_uring_sqe* sqe = m_Ring.get_sqe();
+			sqe->fd = m_hFile;
+			if (job.type == IO_JOB_WRITE)
+			{
+				prepare_write(sqe, job.buffer);
+			}
+			else if (job.type == IO_JOB_SYNC)
+			{
+				prepare_sync(sqe);
+			}
+			else
+			{
+				sqe->opcode = IORING_OP_FALLOCATE;
+				sqe->off = (uint64_t)job.offset;
+				sqe->addr = (uint64_t)job.length;
+				sqe->len = FALLOC_FL_KEEP_SIZE;
+				sqe->user_data = SINK_USER_ALLOCATE;
+			}
+			m_Ring.publish();
+			if (!m_Ring.enter(0))
+			{
+				fail();
+			}
+			return;
+		}
+#endif
+		{
+			std::lock_guard<std::mutex> lock(m_mtIo);
+			m_dqJobs.push_back(job);
+		}
+		m_cvIo.notify_all();
+	}
+
+#ifdef __linux__
+	void prepare_write(io_uring_sqe* sqe, int index)
+	{
+		SinkBuffer& buffer = m_vecBuffers[index];
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->fd = m_hFile;
+		sqe->addr = (uint64_t)(uintptr_t)(buffer.data + buffer.done);
+		sqe->len = buffer.length - buffer.done;
+		sqe->off = (uint64_t)(buffer.offset + buffer.done);
+		sqe->user_data = (uint64_t)index;
+	}
+
+	// drain orders the sync after every request submitted before it, but not after the ones submitted later
+	void prepare_sync(io_uring_sqe* sqe)
+	{
+		sqe->opcode = IORING_OP_FSYNC;
+		sqe->fd = m_hFile;
+		sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+		sqe->flags = IOSQE_IO_DRAIN;
+		sqe->user_data = SINK_USER_SYNC;
+		m_iRingSyncs++;
+	}
+#endif
+
+	void poll_completions(bool wait)
+	{
+#ifdef __linux__
+		if (m_eBackend != FILE_SINK_BACKEND_URING)
+		{
+			return;
+		}
+		if (wait && !m_Ring.enter(1))
+		{
+			fail();
+			return;
+		}
+		auto handler = [this](uint64_t user_data, int result)
+		{
+			if (user_data == SINK_USER_SYNC)
+			{
+				m_iRingSyncs--;
+				if (result >= 0 && m_bResync)
+				{
+					// a short write went out behind this sync, the point only holds once another sync drains it
+					m_bResync = false;
+					prepare_sync(m_Ring.get_sqe());
+					m_Ring.publish();
+					if (!m_Ring.enter(0))
+					{
+						fail();
+					}
+					return;
+				}
+				complete_job({ IO_JOB_SYNC, -1, 0, 0 }, result >= 0);
+			}
+			else if (user_data == SINK_USER_ALLOCATE)
+			{
+				complete_job({ IO_JOB_ALLOCATE, -1, 0, 0 }, result >= 0);
+			}
+			else
+			{
+				int index = (int)user_data;
+				SinkBuffer& buffer = m_vecBuffers[index];
+				if (result > 0 && buffer.done + (uint32_t)result < buffer.length)
+				{
+					// short write, the rest goes out as a new request for the same buffer
+					buffer.done += (uint32_t)result;
+					prepare_write(m_Ring.get_sqe(), index);
+					m_Ring.publish();
+					m_bResync = m_bResync || m_iRingSyncs > 0;
+					if (!m_Ring.enter(0))
+					{
+						fail();
+					}
+					return;
+				}
+				complete_job({ IO_JOB_WRITE, index, 0, 0 }, result > 0);
+			}
+		};
+		m_Ring.reap(handler);
+#else
+		(void)wait;
+#endif
+	}
+
+	void complete_job(const IoJob& job, bool ok)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mtIo);
+			m_iPending--;
+			if (job.type == IO_JOB_WRITE)
+			{
+				m_vecFree.push_back(job.buffer);
+				if (ok)
+				{
+					m_tStats.bytes_written += m_vecBuffers[job.buffer].size;
+				}
+			}
+			else if (job.type == IO_JOB_SYNC)
+			{
+				m_bSyncPending = false;
+				m_tStats.sync_points += ok ? 1 : 0;
+			}
+			else
+			{
+				m_bAllocatePending = false;
+				// a file system without fallocate support just writes without reserved extents
+				if (!ok)
+				{
+					m_tConfig.preallocate_size = 0;
+				}
+			}
+			if (!ok && job.type != IO_JOB_ALLOCATE)
+			{
+				m_bFailed = true;
+			}
+		}
+		m_cvIo.notify_all();
+	}
+
+	void fail()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mtIo);
+			m_bFailed = true;
+		}
+		m_cvIo.notify_all();
+	}
+
+	void wait_idle()
+	{
+		if (m_eBackend == FILE_SINK_BACKEND_URING)
+		{
+			while (!m_bFailed && pending_jobs())
+			{
+				poll_completions(true);
+			}
+			return;
+		}
+		std::unique_lock<std::mutex> lock(m_mtIo);
+		m_cvIo.wait(lock, [this]() { return m_iPending == 0; });
+	}
+
+	int pending_jobs()
+	{
+		std::lock_guard<std::mutex> lock(m_mtIo);
+		return m_iPending;
+	}
+
+	// writes run concurrently at their own offsets, a sync at the head of the queue waits until the writes
+	// taken before it are done so it covers them
+	void worker_proc()
+	{
+		std::unique_lock<std::mutex> lock(m_mtIo);
+		while (true)
+		{
+			m_cvIo.wait(lock, [this]()
+			{
+				return (m_bQuit && m_dqJobs.empty()) || (!m_dqJobs.empty() && (m_dqJobs.front().type != IO_JOB_SYNC || m_iActiveWrites == 0));
+			});
+			if (m_dqJobs.empty())
+			{
+				break;
+			}
+			IoJob job = m_dqJobs.front();
+			m_dqJobs.pop_front();
+			m_iActiveWrites += job.type == IO_JOB_WRITE ? 1 : 0;
+			bool skip = m_bFailed && job.type == IO_JOB_WRITE;
+			lock.unlock();
+
+			bool ok = false;
+			if (job.type == IO_JOB_WRITE && !skip)
+			{
+				SinkBuffer& buffer = m_vecBuffers[job.buffer];
+				ok = true;
+				while (buffer.done < buffer.length)
+				{
+					int64_t written = file_pwrite(m_hFile, buffer.data + buffer.done, buffer.length - buffer.done, buffer.offset + buffer.done);
+					if (written <= 0)
+					{
+						ok = false;
+						break;
+					}
+					buffer.done += (uint32_t)written;
+				}
+			}
+			else if (job.type == IO_JOB_SYNC)
+			{
+				ok = file_sync(m_hFile);
+			}
+			else if (job.type == IO_JOB_ALLOCATE)
+			{
+				ok = file_allocate(m_hFile, job.offset, job.length);
+			}
+
+			lock.lock();
+			m_iActiveWrites -= job.type == IO_JOB_WRITE ? 1 : 0;
+			lock.unlock();
+			complete_job(job, ok);
+			lock.lock();
+		}
+	}
+
+	FileSinkConfig m_tConfig;
+	FILE_SINK_BACKEND m_eBackend{ FILE_SINK_BACKEND_THREADS };
+	SinkFile m_hFile{ SINK_INVALID_FILE };
+	bool m_bOpened{ false };
+	std::vector<SinkBuffer> m_vecBuffers;
+	std::vector<int> m_vecFree;
+	int m_iCurrent{ -1 };
+	int64_t m_iAppendOffset{ 0 };
+	int64_t m_iSubmitOffset{ 0 };
+	int64_t m_iAllocatedEnd{ 0 };
+	bool m_bSyncPending{ false };
+	bool m_bAllocatePending{ false };
+	std::chrono::steady_clock::time_point m_tLastSync;
+	FileSinkStats m_tStats{};
+
+	std::mutex m_mtIo;
+	std::condition_variable m_cvIo;
+	std::deque<IoJob> m_dqJobs;
+	std::vector<std::thread> m_vecWorkers;
+	int m_iPending{ 0 };
+	int m_iActiveWrites{ 0 };
+	std::atomic<bool> m_bFailed{ false };
+	bool m_bQuit{ false };
+#ifdef __linux__
+	SinkRing m_Ring;
+	int m_iRingSyncs{ 0 }; // syncs on the ring that have not completed yet
+	bool m_bResync{ false }; // a short write was resubmitted after a sync in flight, see poll_completions
+#endif
+};
+
+MFFileSink::MFFileSink()
+{
+	impl_ = new Impl();
+}
+
+MFFileSink::~MFFileSink()
+{
+	delete impl_;
+}
+
+bool MFFileSink::open(const char* path, const FileSinkConfig& config)
+{
+	return impl_->open(path, config);
+}
+
+bool MFFileSink::write(const uint8_t* data, unsigned long size)
+{
+	return impl_->write(data, size);
+}
+
+bool MFFileSink::finish()
+{
+	return impl_->finish();
+}
+
+void MFFileSink::get_stats(FileSinkStats& stats)
+{
+	impl_->get_stats(stats);
+}
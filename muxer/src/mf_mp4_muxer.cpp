@@ -0,0 +1,814 @@
+#include "mf_mp4_muxer.h"
+#include "mf_file_sink.h"
+#include "mf_nal_parser.h"
+#include "mf_time.h"
+#include <string.h>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#define MP4_VIDEO_TRACK_ID 1
+#define MP4_AUDIO_TRACK_ID 2
+#define MP4_MOVIE_TIMESCALE 1000
+#define MP4_KEY_SAMPLE_FLAGS 0x02000000 // sample_depends_on 2, sync sample
+#define MP4_DELTA_SAMPLE_FLAGS 0x01010000 // sample_depends_on 1, sample_is_non_sync_sample
+#define MP4_MAX_FRAGMENT_FACTOR 10 // a fragment is cut without a key frame once it is this many fragment durations long
+
+static const uint32_t s_AacSampleRates[] = { 96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350 };
+
+// big-endian box writer, begin() returns the offset end() patches the size into
+class Mp4BoxWriter
+{
+public:
+	explicit Mp4BoxWriter(std::vector<uint8_t>& buffer) : m_vecBuffer(buffer) {}
+
+	void u8(uint32_t value)
+	{
+		m_vecBuffer.push_back((uint8_t)value);
+	}
+	void u16(uint32_t value)
+	{
+		u8(value >> 8);
+		u8(value);
+	}
+	void u24(uint32_t value)
+	{
+		u8(value >> 16);
+		u16(value);
+	}
+	void u32(uint32_t value)
+	{
+		u16(value >> 16);
+		u16(value);
+	}
+	void u64(uint64_t value)
+	{
+		u32((uint32_t)(value >> 32));
+		u32((uint32_t)value);
+	}
+	void zeros(int count)
+	{
+		m_vecBuffer.insert(m_vecBuffer.end(), count, 0);
+	}
+	void bytes(const void* data, size_t size)
+	{
+		m_vecBuffer.insert(m_vecBuffer.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+	}
+	void fourcc(const char* type)
+	{
+		bytes(type, 4);
+	}
+	size_t begin(const char* type)
+	{
+		size_t offset = m_vecBuffer.size();
+		u32(0);
+		fourcc(type);
+		return offset;
+	}
+	size_t begin_full(const char* type, int version, uint32_t flags)
+	{
+		size_t offset = begin(type);
+		u8(version);
+		u24(flags);
+		return offset;
+	}
+	void end(size_t offset)
+	{
+		uint32_t size = (uint32_t)(m_vecBuffer.size() - offset);
+		m_vecBuffer[offset] = (uint8_t)(size >> 24);
+		m_vecBuffer[offset + 1] = (uint8_t)(size >> 16);
+		m_vecBuffer[offset + 2] = (uint8_t)(size >> 8);
+		m_vecBuffer[offset + 3] = (uint8_t)size;
+	}
+	size_t size()
+	{
+		return m_vecBuffer.size();
+	}
+	void matrix()
+	{
+		static const uint32_t unity[9] = { 0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000 };
+		for (uint32_t value : unity)
+		{
+			u32(value);
+		}
+	}
+
+private:
+	std::vector<uint8_t>& m_vecBuffer;
+};
+
+struct Mp4Sample
+{
+	int64_t timestamp; // caller time base
+	int64_t duration;
+	uint32_t size;
+	bool key;
+};
+
+struct Mp4Track
+{
+	int id;
+	bool enabled;
+	uint32_t timescale;
+	int64_t time_base;
+	std::deque<Mp4Sample> samples;
+	std::vector<uint8_t> data; // payloads of samples, in order
+	size_t data_head; // bytes at the front of data that were written already
+	int64_t flushed_end; // track time the next fragment continues from, -1 before the first fragment
+};
+
+class MFMp4Muxer::Impl
+{
+public:
+	Impl()
+	{
+		m_tVideo.id = MP4_VIDEO_TRACK_ID;
+		m_tAudio.id = MP4_AUDIO_TRACK_ID;
+	}
+
+	~Impl()
+	{
+		close();
+	}
+
+	void set_video(int width, int height, int64_t time_base)
+	{
+		m_iWidth = width;
+		m_iHeight = height;
+		m_tVideo.enabled = width > 0 && height > 0 && time_base > 0 && time_base <= UINT32_MAX;
+		m_tVideo.time_base = time_base;
+		m_tVideo.timescale = (uint32_t)time_base;
+	}
+
+	void set_audio(int sample_rate, int channels, int64_t time_base)
+	{
+		m_iSampleRate = sample_rate;
+		m_iChannels = channels;
+		// AAC channel configurations cover 1 - 6 and 8 channels
+		m_tAudio.enabled = sample_rate > 0 && ((channels > 0 && channels <= 6) || channels == 8) && time_base > 0;
+		m_tAudio.time_base = time_base;
+		m_tAudio.timescale = (uint32_t)sample_rate;
+	}
+
+	void set_fragment_duration(int milliseconds)
+	{
+		m_iFragmentMs = milliseconds > 0 ? milliseconds : 1000;
+	}
+
+	void set_max_interleave(int milliseconds)
+	{
+		m_iMaxInterleaveMs = milliseconds >= 0 ? milliseconds : 500;
+	}
+
+	bool open(MFMuxerOutput* output, MFMuxerOutput* owned)
+	{
+		close();
+		if (!output || (!m_tVideo.enabled && !m_tAudio.enabled))
+		{
+			delete owned;
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(m_mtMux);
+		m_pOutput = output;
+		m_pOwnedOutput = owned;
+		m_bInitWritten = false;
+		m_bFailed = false;
+		m_iSequence = 0;
+		m_iOrigin = 0;
+		m_iCutTime = -1;
+		m_ParameterSets.clear();
+		for (Mp4Track* track : { &m_tVideo, &m_tAudio })
+		{
+			track->samples.clear();
+			track->data.clear();
+			track->data_head = 0;
+			track->flushed_end = -1;
+		}
+		return true;
+	}
+
+	bool close()
+	{
+		std::lock_guard<std::mutex> lock(m_mtMux);
+		if (!m_pOutput)
+		{
+			return false;
+		}
+		if (m_bInitWritten)
+		{
+			write_fragment(INT64_MAX, true);
+		}
+		bool ret = !m_bFailed && m_pOutput->finish();
+		delete m_pOwnedOutput;
+		m_pOwnedOutput = nullptr;
+		m_pOutput = nullptr;
+		return ret;
+	}
+
+	bool write_video(const OutputVData& data)
+	{
+		std::lock_guard<std::mutex> lock(m_mtMux);
+		if (!m_pOutput || !m_tVideo.enabled || m_bFailed)
+		{
+			return false;
+		}
+		// a skipped frame extends the previous one, its duration follows from the next timestamp
+		if (data.skipped || !data.data || !data.size)
+		{
+			return true;
+		}
+		if (!m_bInitWritten && !data.key_frame)
+		{
+			return false;
+		}
+		if (!m_tVideo.samples.empty() && data.timestamp <= m_tVideo.samples.back().timestamp)
+		{
+			return false;
+		}
+
+		// parameter sets stay in the samples, the avc3 entry lets them change after the init segment was written
+		mf_split_annexb(data.data, data.size, m_vecUnits);
+		m_ParameterSets.update(m_vecUnits);
+		uint32_t size = 0;
+		for (auto& unit : m_vecUnits)
+		{
+			if (unit.type == NAL_TYPE_AUD)
+			{
+				continue;
+			}
+			uint8_t length[4] = { (uint8_t)(unit.size >> 24), (uint8_t)(unit.size >> 16), (uint8_t)(unit.size >> 8), (uint8_t)unit.size };
+			m_tVideo.data.insert(m_tVideo.data.end(), length, length + 4);
+			m_tVideo.data.insert(m_tVideo.data.end(), unit.data, unit.data + unit.size);
+			size += 4 + (uint32_t)unit.size;
+		}
+		if (!size)
+		{
+			return false;
+		}
+		m_tVideo.samples.push_back({ data.timestamp, data.duration, size, data.key_frame });
+
+		if (!m_bInitWritten)
+		{
+			std::vector<uint8_t> avcc;
+			if (!m_ParameterSets.get_avcc_record(avcc))
+			{
+				m_tVideo.samples.clear();
+				m_tVideo.data.clear();
+				m_tVideo.data_head = 0;
+				return false;
+			}
+			// audio captured before the first key frame is kept, the track then starts earlier than video
+			m_iOrigin = data.timestamp;
+			if (!m_tAudio.samples.empty() && m_tAudio.samples.front().timestamp < m_iOrigin)
+			{
+				m_iOrigin = m_tAudio.samples.front().timestamp;
+			}
+			write_init(avcc);
+		}
+		else
+		{
+			int64_t fragment_start = m_tVideo.samples.front().timestamp;
+			int64_t elapsed_ms = mf_rescale(data.timestamp - fragment_start, 1000, m_tVideo.time_base);
+			if (m_iCutTime < 0 && ((data.key_frame && elapsed_ms >= m_iFragmentMs) || elapsed_ms >= (int64_t)m_iFragmentMs * MP4_MAX_FRAGMENT_FACTOR))
+			{
+				m_iCutTime = data.timestamp;
+			}
+		}
+		try_flush();
+		return !m_bFailed;
+	}
+
+	bool write_audio(const OutputAData& data)
+	{
+		std::lock_guard<std::mutex> lock(m_mtMux);
+		if (!m_pOutput || !m_tAudio.enabled || m_bFailed || !data.data || !data.size)
+		{
+			return false;
+		}
+		const uint8_t* payload = data.data;
+		unsigned long size = data.size;
+		// the AAC encoder emits raw frames, ADTS headers are stripped in case a caller feeds them anyway
+		if (size > 7 && payload[0] == 0xFF && (payload[1] & 0xF6) == 0xF0)
+		{
+			unsigned long header = payload[1] & 0x01 ? 7 : 9;
+			if (size <= header)
+			{
+				return false;
+			}
+			payload += header;
+			size -= header;
+		}
+		if ((!m_tAudio.samples.empty() && data.timestamp < m_tAudio.samples.back().timestamp) || (m_bInitWritten && data.timestamp < m_iOrigin))
+		{
+			return false;
+		}
+		// the fragment covering this time was already written, see set_max_interleave
+		if (m_tAudio.flushed_end >= 0 && track_time(m_tAudio, data.timestamp) < m_tAudio.flushed_end - (int64_t)m_tAudio.timescale / 100)
+		{
+			return false;
+		}
+		m_tAudio.samples.push_back({ data.timestamp, data.duration, (uint32_t)size, true });
+		m_tAudio.data.insert(m_tAudio.data.end(), payload, payload + size);
+
+		if (!m_bInitWritten)
+		{
+			if (!m_tVideo.enabled)
+			{
+				m_iOrigin = m_tAudio.samples.front().timestamp;
+				write_init(std::vector<uint8_t>());
+			}
+			else
+			{
+				// bounded while waiting for the first video key frame
+				int64_t limit = mf_rescale(m_iMaxInterleaveMs, m_tAudio.time_base, 1000);
+				while (m_tAudio.samples.size() > 1 && data.timestamp - m_tAudio.samples.front().timestamp > limit)
+				{
+					pop_samples(m_tAudio, 1);
+				}
+				return true;
+			}
+		}
+		else if (!m_tVideo.enabled && m_iCutTime < 0)
+		{
+			int64_t elapsed_ms = mf_rescale(data.timestamp - m_tAudio.samples.front().timestamp, 1000, m_tAudio.time_base);
+			if (elapsed_ms >= m_iFragmentMs)
+			{
+				m_iCutTime = data.timestamp;
+			}
+		}
+		try_flush();
+		return !m_bFailed;
+	}
+
+private:
+	int64_t track_time(const Mp4Track& track, int64_t timestamp)
+	{
+		return mf_rescale(timestamp - m_iOrigin, track.timescale, track.time_base);
+	}
+
+	// with both tracks a fragment waits until audio has reached the cut or video is max interleave past it
+	void try_flush()
+	{
+		if (m_iCutTime < 0 || !m_bInitWritten)
+		{
+			return;
+		}
+		if (m_tVideo.enabled && m_tAudio.enabled)
+		{
+			bool audio_ready = !m_tAudio.samples.empty() && m_tAudio.samples.back().timestamp >= m_iCutTime;
+			int64_t video_lead_ms = mf_rescale(m_tVideo.samples.back().timestamp - m_iCutTime, 1000, m_tVideo.time_base);
+			if (!audio_ready && video_lead_ms < m_iMaxInterleaveMs)
+			{
+				return;
+			}
+		}
+		write_fragment(m_iCutTime, false);
+		m_iCutTime = -1;
+	}
+
+	// payloads are only moved down once the written ones are at least half of data, so every byte moves at most
+	// once on average instead of on every pop
+	void pop_samples(Mp4Track& track, size_t count)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			track.data_head += track.samples.front().size;
+			track.samples.pop_front();
+		}
+		if (track.data_head == track.data.size())
+		{
+			track.data.clear();
+			track.data_head = 0;
+		}
+		else if (track.data_head * 2 >= track.data.size())
+		{
+			track.data.erase(track.data.begin(), track.data.begin() + track.data_head);
+			track.data_head = 0;
+		}
+	}
+
+	void write_output(const uint8_t* data, size_t size)
+	{
+		if (!m_bFailed && size && !m_pOutput->write(data, (unsigned long)size))
+		{
+			m_bFailed = true;
+		}
+	}
+
+	void write_init(const std::vector<uint8_t>& avcc)
+	{
+		std::vector<uint8_t> buffer;
+		Mp4BoxWriter w(buffer);
+		size_t ftyp = w.begin("ftyp");
+		w.fourcc("isom");
+		w.u32(0x200);
+		w.fourcc("isom");
+		w.fourcc("iso6");
+		w.fourcc("mp41");
+		if (m_tVideo.enabled)
+		{
+			w.fourcc("avc1");
+		}
+		w.end(ftyp);
+
+		size_t moov = w.begin("moov");
+		size_t mvhd = w.begin_full("mvhd", 0, 0);
+		w.u32(0); // creation_time
+		w.u32(0); // modification_time
+		w.u32(MP4_MOVIE_TIMESCALE);
+		w.u32(0); // duration, unknown while recording
+		w.u32(0x00010000); // rate
+		w.u16(0x0100); // volume
+		w.zeros(10);
+		w.matrix();
+		w.zeros(24);
+		w.u32(MP4_AUDIO_TRACK_ID + 1); // next_track_ID
+		w.end(mvhd);
+		if (m_tVideo.enabled)
+		{
+			write_track(w, m_tVideo, &avcc);
+		}
+		if (m_tAudio.enabled)
+		{
+			write_track(w, m_tAudio, nullptr);
+		}
+		size_t mvex = w.begin("mvex");
+		for (Mp4Track* track : { &m_tVideo, &m_tAudio })
+		{
+			if (track->enabled)
+			{
+				size_t trex = w.begin_full("trex", 0, 0);
+				w.u32(track->id);
+				w.u32(1); // default_sample_description_index
+				w.u32(0);
+				w.u32(0);
+				w.u32(0);
+				w.end(trex);
+			}
+		}
+		w.end(mvex);
+		w.end(moov);
+		write_output(buffer.data(), buffer.size());
+		m_bInitWritten = true;
+	}
+
+	void write_track(Mp4BoxWriter& w, const Mp4Track& track, const std::vector<uint8_t>* avcc)
+	{
+		bool video = avcc != nullptr;
+		size_t trak = w.begin("trak");
+		size_t tkhd = w.begin_full("tkhd", 0, 0x3); // enabled, in movie
+		w.u32(0);
+		w.u32(0);
+		w.u32(track.id);
+		w.u32(0);
+		w.u32(0); // duration
+		w.zeros(8);
+		w.u16(0); // layer
+		w.u16(0); // alternate_group
+		w.u16(video ? 0 : 0x0100);
+		w.u16(0);
+		w.matrix();
+		w.u32(video ? (uint32_t)m_iWidth << 16 : 0);
+		w.u32(video ? (uint32_t)m_iHeight << 16 : 0);
+		w.end(tkhd);
+
+		size_t mdia = w.begin("mdia");
+		size_t mdhd = w.begin_full("mdhd", 0, 0);
+		w.u32(0);
+		w.u32(0);
+		w.u32(track.timescale);
+		w.u32(0);
+		w.u16(0x55C4); // "und"
+		w.u16(0);
+		w.end(mdhd);
+		size_t hdlr = w.begin_full("hdlr", 0, 0);
+		w.u32(0);
+		w.fourcc(video ? "vide" : "soun");
+		w.zeros(12);
+		const char* name = video ? "VideoHandler" : "SoundHandler";
+		w.bytes(name, strlen(name) + 1);
+		w.end(hdlr);
+
+		size_t minf = w.begin("minf");
+		if (video)
+		{
+			size_t vmhd = w.begin_full("vmhd", 0, 1);
+			w.zeros(8);
+			w.end(vmhd);
+		}
+		else
+		{
+			size_t smhd = w.begin_full("smhd", 0, 0);
+			w.zeros(4);
+			w.end(smhd);
+		}
+		size_t dinf = w.begin("dinf");
+		size_t dref = w.begin_full("dref", 0, 0);
+		w.u32(1);
+		size_t url = w.begin_full("url ", 0, 1); // media is in the same file
+		w.end(url);
+		w.end(dref);
+		w.end(dinf);
+
+		size_t stbl = w.begin("stbl");
+		size_t stsd = w.begin_full("stsd", 0, 0);
+		w.u32(1);
+		if (video)
+		{
+			write_avc3(w, *avcc);
+		}
+		else
+		{
+			write_mp4a(w);
+		}
+		w.end(stsd);
+		// the sample tables stay empty, samples are described by the fragments
+		for (const char* type : { "stts", "stsc", "stco" })
+		{
+			size_t box = w.begin_full(type, 0, 0);
+			w.u32(0);
+			w.end(box);
+		}
+		size_t stsz = w.begin_full("stsz", 0, 0);
+		w.u32(0);
+		w.u32(0);
+		w.end(stsz);
+		w.end(stbl);
+		w.end(minf);
+		w.end(mdia);
+		w.end(trak);
+	}
+
+	// avc3 rather than avc1, so the SPS and PPS in the samples take precedence over the avcC, which only holds the
+	// sets of the first key frame
+	void write_avc3(Mp4BoxWriter& w, const std::vector<uint8_t>& avcc)
+	{
+		size_t avc3 = w.begin("avc3");
+		w.zeros(6);
+		w.u16(1); // data_reference_index
+		w.zeros(16);
+		w.u16(m_iWidth);
+		w.u16(m_iHeight);
+		w.u32(0x00480000); // 72 dpi
+		w.u32(0x00480000);
+		w.u32(0);
+		w.u16(1); // frame_count
+		w.zeros(32); // compressorname
+		w.u16(0x0018);
+		w.u16(0xFFFF);
+		size_t avcc_box = w.begin("avcC");
+		w.bytes(avcc.data(), avcc.size());
+		w.end(avcc_box);
+		w.end(avc3);
+	}
+
+	void write_mp4a(Mp4BoxWriter& w)
+	{
+		int rate_index = 15;
+		for (int i = 0; i < (int)(sizeof(s_AacSampleRates) / sizeof(s_AacSampleRates[0])); i++)
+		{
+			if (s_AacSampleRates[i] == (uint32_t)m_iSampleRate)
+			{
+				rate_index = i;
+			}
+		}
+		// AudioSpecificConfig: AAC-LC, an explicit 24 bit rate follows an escape index
+		std::vector<uint8_t> config;
+		uint64_t bits = 0;
+		int bit_count = 0;
+		auto put_bits = [&](uint32_t value, int count)
+		{
+			bits = (bits << count) | value;
+			bit_count += count;
+		};
+		put_bits(2, 5);
+		put_bits(rate_index, 4);
+		if (rate_index == 15)
+		{
+			put_bits(m_iSampleRate, 24);
+		}
+		put_bits(m_iChannels == 8 ? 7 : m_iChannels, 4);
+		put_bits(0, 3);
+		put_bits(0, (8 - bit_count % 8) % 8);
+		for (int shift = bit_count - 8; shift >= 0; shift -= 8)
+		{
+			config.push_back((uint8_t)(bits >> shift));
+		}
+
+		size_t mp4a = w.begin("mp4a");
+		w.zeros(6);
+		w.u16(1);
+		w.zeros(8);
+		w.u16(m_iChannels);
+		w.u16(16); // samplesize
+		w.u32(0);
+		w.u32(m_iSampleRate <= 0xFFFF ? (uint32_t)m_iSampleRate << 16 : 0);
+		size_t esds = w.begin_full("esds", 0, 0);
+		uint32_t config_size = (uint32_t)config.size();
+		w.u8(0x03); // ES_Descriptor
+		w.u8(3 + 2 + 13 + 2 + config_size + 3);
+		w.u16(MP4_AUDIO_TRACK_ID);
+		w.u8(0);
+		w.u8(0x04); // DecoderConfigDescriptor
+		w.u8(13 + 2 + config_size);
+		w.u8(0x40); // ISO/IEC 14496-3 audio
+		w.u8(0x15); // audio stream
+		w.u24(0); // bufferSizeDB
+		w.u32(0); // maxBitrate
+		w.u32(0); // avgBitrate
+		w.u8(0x05); // DecoderSpecificInfo
+		w.u8(config_size);
+		w.bytes(config.data(), config.size());
+		w.u8(0x06); // SLConfigDescriptor
+		w.u8(1);
+		w.u8(0x02);
+		w.end(esds);
+		w.end(mp4a);
+	}
+
+	// samples before cut_time go out, the rest waits for the next fragment. A sample's duration is the distance to
+	// the following one, the very last sample keeps the duration the encoder reported
+	void write_fragment(int64_t cut_time, bool last)
+	{
+		struct TrackRun
+		{
+			Mp4Track* track;
+			size_t count;
+			size_t bytes;
+			size_t data_offset_pos;
+		};
+		TrackRun runs[2];
+		int run_count = 0;
+		for (Mp4Track* track : { &m_tVideo, &m_tAudio })
+		{
+			if (!track->enabled)
+			{
+				continue;
+			}
+			size_t count = 0;
+			size_t bytes = 0;
+			while (count < track->samples.size() && track->samples[count].timestamp < cut_time)
+			{
+				if (count + 1 == track->samples.size() && !last)
+				{
+					break;
+				}
+				bytes += track->samples[count].size;
+				count++;
+			}
+			if (count)
+			{
+				runs[run_count++] = { track, count, bytes, 0 };
+			}
+		}
+		if (!run_count)
+		{
+			return;
+		}
+
+		m_vecFragment.clear();
+		Mp4BoxWriter w(m_vecFragment);
+		size_t moof = w.begin("moof");
+		size_t mfhd = w.begin_full("mfhd", 0, 0);
+		w.u32(++m_iSequence);
+		w.end(mfhd);
+		for (int i = 0; i < run_count; i++)
+		{
+			Mp4Track& track = *runs[i].track;
+			size_t traf = w.begin("traf");
+			size_t tfhd = w.begin_full("tfhd", 0, 0x020000); // default-base-is-moof
+			w.u32(track.id);
+			w.end(tfhd);
+			int64_t base = track_time(track, track.samples.front().timestamp);
+			if (track.flushed_end > base && track.flushed_end - base < (int64_t)track.timescale / 100)
+			{
+				base = track.flushed_end;
+			}
+			size_t tfdt = w.begin_full("tfdt", 1, 0);
+			w.u64((uint64_t)base);
+			w.end(tfdt);
+			size_t trun = w.begin_full("trun", 0, 0x000701); // data offset, sample duration, size and flags
+			w.u32((uint32_t)runs[i].count);
+			runs[i].data_offset_pos = w.size();
+			w.u32(0);
+			int64_t time = base;
+			for (size_t s = 0; s < runs[i].count; s++)
+			{
+				const Mp4Sample& sample = track.samples[s];
+				int64_t next = s + 1 < track.samples.size() ? track_time(track, track.samples[s + 1].timestamp) : track_time(track, sample.timestamp + sample.duration);
+				int64_t duration = next > time ? next - time : 1;
+				w.u32((uint32_t)duration);
+				w.u32(sample.size);
+				w.u32(sample.key ? MP4_KEY_SAMPLE_FLAGS : MP4_DELTA_SAMPLE_FLAGS);
+				time += duration;
+			}
+			track.flushed_end = time;
+			w.end(trun);
+			w.end(traf);
+		}
+		w.end(moof);
+
+		// trun data offsets are relative to the moof start, mdat carries the tracks back to back
+		size_t data_offset = m_vecFragment.size() + 8;
+		uint64_t mdat_size = 8;
+		for (int i = 0; i < run_count; i++)
+		{
+			uint8_t* pos = m_vecFragment.data() + runs[i].data_offset_pos;
+			pos[0] = (uint8_t)(data_offset >> 24);
+			pos[1] = (uint8_t)(data_offset >> 16);
+			pos[2] = (uint8_t)(data_offset >> 8);
+			pos[3] = (uint8_t)data_offset;
+			data_offset += runs[i].bytes;
+			mdat_size += runs[i].bytes;
+		}
+		w.u32((uint32_t)mdat_size);
+		w.fourcc("mdat");
+		write_output(m_vecFragment.data(), m_vecFragment.size());
+		for (int i = 0; i < run_count; i++)
+		{
+			write_output(runs[i].track->data.data() + runs[i].track->data_head, runs[i].bytes);
+			pop_samples(*runs[i].track, runs[i].count);
+		}
+	}
+
+	std::mutex m_mtMux;
+	MFMuxerOutput* m_pOutput{ nullptr };
+	MFMuxerOutput* m_pOwnedOutput{ nullptr };
+	int m_iWidth{ 0 };
+	int m_iHeight{ 0 };
+	int m_iSampleRate{ 0 };
+	int m_iChannels{ 0 };
+	int m_iFragmentMs{ 1000 };
+	int m_iMaxInterleaveMs{ 500 };
+	Mp4Track m_tVideo{};
+	Mp4Track m_tAudio{};
+	bool m_bInitWritten{ false };
+	bool m_bFailed{ false };
+	uint32_t m_iSequence{ 0 };
+	int64_t m_iOrigin{ 0 }; // caller timestamp that maps to track time 0
+	int64_t m_iCutTime{ -1 }; // caller timestamp the pending fragment ends at
+	MFParameterSetCache m_ParameterSets;
+	std::vector<NalUnit> m_vecUnits;
+	std::vector<uint8_t> m_vecFragment;
+};
+
+MFMp4Muxer::MFMp4Muxer()
+{
+	impl_ = new Impl();
+}
+
+MFMp4Muxer::~MFMp4Muxer()
+{
+	delete impl_;
+}
+
+void MFMp4Muxer::set_video(int width, int height, int64_t time_base)
+{
+	impl_->set_video(width, height, time_base);
+}
+
+void MFMp4Muxer::set_audio(int sample_rate, int channels, int64_t time_base)
+{
+	impl_->set_audio(sample_rate, channels, time_base);
+}
+
+void MFMp4Muxer::set_fragment_duration(int milliseconds)
+{
+	impl_->set_fragment_duration(milliseconds);
+}
+
+void MFMp4Muxer::set_max_interleave(int milliseconds)
+{
+	impl_->set_max_interleave(milliseconds);
+}
+
+bool MFMp4Muxer::open(const char* path)
+{
+	MFFileSink* sink = new MFFileSink();
+	if (!sink->open(path, FileSinkConfig()))
+	{
+		delete sink;
+		return false;
+	}
+	return impl_->open(sink, sink);
+}
+
+bool MFMp4Muxer::open(MFMuxerOutput* output)
+{
+	return impl_->open(output, nullptr);
+}
+
+bool MFMp4Muxer::close()
+{
+	return impl_->close();
+}
+
+bool MFMp4Muxer::write_video(const OutputVData& data)
+{
+	return impl_->write_video(data);
+}
+
+bool MFMp4Muxer::write_audio(const OutputAData& data)
+{
+	return impl_->write_audio(data);
+}
@@ -0,0 +1,286 @@
+#include "mf_test.h"
+#include "mf_audio_mixer.h"
+#include "mf_time.h"
+#include <math.h>
+#include <vector>
+
+#define RATE 48000
+#define CHUNK 480 // 10 ms at RATE
+#define CHUNK_TIME 100000 // 10 ms in 100ns units
+#define START_TIME 50000000 // capture timestamps rarely start at 0
+
+// interleaved float with every channel at value
+static bool push_constant(MFAudioMixer& mixer, int source, int channels, int samples, float value, int64_t timestamp)
+{
+	std::vector<float> data((size_t)samples * channels, value);
+	const uint8_t* planes[1] = { (const uint8_t*)data.data() };
+	return mixer.push(source, planes, samples, timestamp);
+}
+
+// mixes everything available into stereo float, returns the samples and the time of the first one
+static std::vector<float> mix_all(MFAudioMixer& mixer, int64_t& timestamp)
+{
+	std::vector<float> output;
+	std::vector<float> block(CHUNK * 2);
+	uint8_t* planes[1] = { (uint8_t*)block.data() };
+	int64_t first = -1;
+	int samples = 0;
+	while ((samples = mixer.mix(planes, CHUNK, timestamp)) > 0)
+	{
+		first = first < 0 ? timestamp : first;
+		output.insert(output.end(), block.begin(), block.begin() + samples * 2);
+	}
+	timestamp = first;
+	return output;
+}
+
+// a mono microphone and a stereo loopback that starts 30 ms later: the mic goes to both fronts at full level, the
+// loopback adds in exactly where its timestamps put it, the time before it is silence from the loopback, and a gap
+// in the loopback timestamps is filled with silence and counted
+static void test_offset_sources()
+{
+	MFAudioMixer mixer;
+	MF_CHECK(mixer.configure(RATE, 2, PCM_FLT));
+	int mic = mixer.add_source(RATE, 1, PCM_FLT);
+	int loopback = mixer.add_source(RATE, 2, PCM_FLT);
+	MF_CHECK(mic >= 0 && loopback >= 0 && mic != loopback);
+
+	// mic 0 - 200 ms, loopback 30 - 80 ms, a 40 ms hole, then 120 - 200 ms. each push is followed by a mix as in the
+	// encoder, pushing ahead of the mixer by more than the latency would drop samples
+	std::vector<float> output;
+	int64_t first_time = -1;
+	for (int chunk = 0; chunk < 20; chunk++)
+	{
+		MF_CHECK(push_constant(mixer, mic, 1, CHUNK, 0.25f, START_TIME + (int64_t)chunk * CHUNK_TIME));
+		if (chunk >= 3 && (chunk < 8 || chunk >= 12))
+		{
+			MF_CHECK(push_constant(mixer, loopback, 2, CHUNK, 0.5f, START_TIME + (int64_t)chunk * CHUNK_TIME));
+		}
+		int64_t timestamp = 0;
+		std::vector<float> part = mix_all(mixer, timestamp);
+		if (!part.empty() && first_time < 0)
+		{
+			first_time = timestamp;
+		}
+		output.insert(output.end(), part.begin(), part.end());
+	}
+	MF_CHECK_EQ(first_time, START_TIME);
+	MF_CHECK_EQ(output.size(), (size_t)20 * CHUNK * 2);
+	int wrong = 0;
+	for (size_t i = 0; i < output.size() / 2; i++)
+	{
+		int chunk = (int)(i / CHUNK);
+		float expected = (chunk >= 3 && (chunk < 8 || chunk >= 12)) ? 0.75f : 0.25f;
+		wrong += output[i * 2] != expected || output[i * 2 + 1] != expected;
+	}
+	MF_CHECK_EQ(wrong, 0);
+	MixSourceStats stats = {};
+	MF_CHECK(mixer.get_stats(loopback, stats));
+	MF_CHECK_EQ(stats.padded, 4 * CHUNK);
+	MF_CHECK_EQ(stats.dropped, 0);
+	MF_CHECK(mixer.get_stats(mic, stats));
+	MF_CHECK_EQ(stats.padded, 0);
+	MF_CHECK_EQ(stats.dropped, 0);
+}
+
+// jitter below the resync threshold does not move a source, continuous timestamps -1 follow on
+static void test_jitter()
+{
+	MFAudioMixer mixer;
+	MF_CHECK(mixer.configure(RATE, 2, PCM_FLT));
+	int mic = mixer.add_source(RATE, 1, PCM_FLT);
+	// offset from the nominal time of each push in 100ns units, -1 pushes without a timestamp
+	const int64_t jitter[] = { 0, 30000, -40000, 10000, -1, -1, 150000, -150000 };
+	int64_t timestamp = 0;
+	size_t mixed = 0;
+	for (int chunk = 0; chunk < (int)(sizeof(jitter) / sizeof(jitter[0])); chunk++)
+	{
+		int64_t time = jitter[chunk] == -1 ? -1 : START_TIME + (int64_t)chunk * CHUNK_TIME + jitter[chunk];
+		MF_CHECK(push_constant(mixer, mic, 1, CHUNK, 0.5f, time));
+		mixed += mix_all(mixer, timestamp).size() / 2;
+	}
+	MF_CHECK_EQ(mixed, (size_t)8 * CHUNK);
+	MixSourceStats stats = {};
+	MF_CHECK(mixer.get_stats(mic, stats));
+	MF_CHECK_EQ(stats.padded, 0);
+	MF_CHECK_EQ(stats.dropped, 0);
+}
+
+// a 44.1 kHz loopback starting 50 ms after the 48 kHz mic lands at 50 ms of the output once it has gone through
+// the resampler, whose lookahead is taken out of its timestamps
+static void test_resampled_offset()
+{
+	MFAudioMixer mixer;
+	MF_CHECK(mixer.configure(RATE, 2, PCM_FLT));
+	int mic = mixer.add_source(RATE, 1, PCM_FLT);
+	int loopback = mixer.add_source(44100, 2, PCM_FLT);
+	std::vector<float> output;
+	int64_t timestamp = 0;
+	for (int chunk = 0; chunk < 30; chunk++)
+	{
+		MF_CHECK(push_constant(mixer, mic, 1, CHUNK, 0.25f, START_TIME + (int64_t)chunk * CHUNK_TIME));
+		if (chunk >= 5)
+		{
+			MF_CHECK(push_constant(mixer, loopback, 2, 441, 0.5f, START_TIME + (int64_t)chunk * CHUNK_TIME));
+		}
+		std::vector<float> part = mix_all(mixer, timestamp);
+		output.insert(output.end(), part.begin(), part.end());
+	}
+	MF_CHECK(output.size() >= (size_t)25 * CHUNK * 2);
+	// the edge rings over half the filter, around 0.7 ms at 64 taps
+	int edge = 5 * CHUNK;
+	int wrong = 0;
+	for (int i = 0; i < (int)(output.size() / 2); i++)
+	{
+		if (i > edge - 48 && i < edge + 48)
+		{
+			continue;
+		}
+		float expected = i < edge ? 0.25f : 0.75f;
+		wrong += fabsf(output[(size_t)i * 2] - expected) > 1e-3f || fabsf(output[(size_t)i * 2 + 1] - expected) > 1e-3f;
+	}
+	MF_CHECK_EQ(wrong, 0);
+	MixSourceStats stats = {};
+	MF_CHECK(mixer.get_stats(loopback, stats));
+	MF_CHECK_EQ(stats.padded, 0);
+	MF_CHECK_EQ(stats.dropped, 0);
+	MF_CHECK(mixer.get_latency() > 100 * 10000);
+}
+
+// 5.1 into stereo: the fronts stay, center and backs fold in at -3 dB, the LFE is dropped and the result is scaled
+// so a full scale downmix can not clip
+static void test_downmix_5_1()
+{
+	MFAudioMixer mixer;
+	MF_CHECK(mixer.configure(RATE, 2, PCM_FLT));
+	int source = mixer.add_source(RATE, 6, PCM_FLT, 0x3F); // FL FR FC LFE BL BR
+	MF_CHECK(source >= 0);
+	// block k has only channel k at full scale
+	const int block = 100;
+	std::vector<float> data((size_t)block * 6 * 6, 0.0f);
+	for (int k = 0; k < 6; k++)
+	{
+		for (int i = 0; i < block; i++)
+		{
+			data[((size_t)k * block + i) * 6 + k] = 1.0f;
+		}
+	}
+	const uint8_t* planes[1] = { (const uint8_t*)data.data() };
+	MF_CHECK(mixer.push(source, planes, block * 6, START_TIME));
+	int64_t timestamp = 0;
+	std::vector<float> output = mix_all(mixer, timestamp);
+	MF_CHECK_EQ(output.size(), (size_t)block * 6 * 2);
+	if (output.size() != (size_t)block * 6 * 2)
+	{
+		return;
+	}
+	const float sqrt1_2 = 0.70710678f;
+	const float norm = 1.0f / (1.0f + 2.0f * sqrt1_2);
+	const float expected[6][2] = {
+		{ norm, 0.0f }, // FL
+		{ 0.0f, norm }, // FR
+		{ sqrt1_2 * norm, sqrt1_2 * norm }, // FC
+		{ 0.0f, 0.0f }, // LFE
+		{ sqrt1_2 * norm, 0.0f }, // BL
+		{ 0.0f, sqrt1_2 * norm } // BR
+	};
+	for (int k = 0; k < 6; k++)
+	{
+		for (int i = 0; i < block; i++)
+		{
+			const float* out = &output[((size_t)k * block + i) * 2];
+			MF_CHECK(fabsf(out[0] - expected[k][0]) < 1e-6f);
+			MF_CHECK(fabsf(out[1] - expected[k][1]) < 1e-6f);
+		}
+	}
+	// all channels at full scale stay within full scale
+	std::vector<float> full((size_t)block * 6, 1.0f);
+	planes[0] = (const uint8_t*)full.data();
+	MF_CHECK(mixer.push(source, planes, block, -1));
+	output = mix_all(mixer, timestamp);
+	MF_CHECK_EQ(output.size(), (size_t)block * 2);
+	for (float value : output)
+	{
+		MF_CHECK(value <= 1.0f + 1e-6f && value > 0.99f);
+	}
+}
+
+// a source that never delivers holds the output back by the max latency and no more, a source that comes back late
+// loses what the output already passed, and removing the silent source releases what was held back
+static void test_late_and_missing()
+{
+	MFAudioMixer mixer;
+	MF_CHECK(mixer.configure(RATE, 2, PCM_FLT));
+	mixer.set_max_latency(50);
+	int mic = mixer.add_source(RATE, 1, PCM_FLT);
+	int loopback = mixer.add_source(RATE, 2, PCM_FLT);
+	int64_t timestamp = 0;
+	size_t mixed = 0;
+	int64_t first_time = -1;
+	for (int chunk = 0; chunk < 20; chunk++)
+	{
+		MF_CHECK(push_constant(mixer, mic, 1, CHUNK, 0.25f, START_TIME + (int64_t)chunk * CHUNK_TIME));
+		std::vector<float> part = mix_all(mixer, timestamp);
+		if (!part.empty() && first_time < 0)
+		{
+			first_time = timestamp;
+		}
+		mixed += part.size() / 2;
+		// output never runs further behind the mic than the max latency
+		MF_CHECK_EQ(mixed, (size_t)(chunk + 1) * CHUNK > 5 * CHUNK ? (size_t)(chunk + 1) * CHUNK - 5 * CHUNK : 0);
+	}
+	MF_CHECK_EQ(first_time, START_TIME);
+
+	// the loopback shows up with 100 ms that end where the mic is, the first 50 ms are behind the output
+	MF_CHECK(!push_constant(mixer, loopback, 2, 10 * CHUNK, 0.5f, START_TIME + 10 * (int64_t)CHUNK_TIME));
+	MixSourceStats stats = {};
+	MF_CHECK(mixer.get_stats(loopback, stats));
+	MF_CHECK_EQ(stats.dropped, 5 * CHUNK);
+	std::vector<float> part = mix_all(mixer, timestamp);
+	MF_CHECK_EQ(timestamp, START_TIME + 15 * (int64_t)CHUNK_TIME);
+	MF_CHECK_EQ(part.size(), (size_t)5 * CHUNK * 2);
+	for (float value : part)
+	{
+		MF_CHECK_EQ(value, 0.75f);
+	}
+
+	// the mic goes on alone, once the loopback is removed nothing is held back
+	MF_CHECK(push_constant(mixer, mic, 1, CHUNK, 0.25f, START_TIME + 20 * (int64_t)CHUNK_TIME));
+	MF_CHECK(mix_all(mixer, timestamp).empty());
+	mixer.remove_source(loopback);
+	MF_CHECK(!mixer.get_stats(loopback, stats));
+	part = mix_all(mixer, timestamp);
+	MF_CHECK_EQ(part.size(), (size_t)CHUNK * 2);
+	MF_CHECK_EQ(timestamp, START_TIME + 20 * (int64_t)CHUNK_TIME);
+}
+
+// bad arguments are refused
+static void test_invalid()
+{
+	MFAudioMixer mixer;
+	MF_CHECK_EQ(mixer.add_source(RATE, 2, PCM_FLT), -1);
+	MF_CHECK(!mixer.configure(0, 2, PCM_FLT));
+	MF_CHECK(!mixer.configure(RATE, 2, PCM_FLT, 0x7)); // mask of 3 channels
+	MF_CHECK(mixer.configure(RATE, 2, PCM_S16));
+	MF_CHECK_EQ(mixer.add_source(RATE, 2, PCM_UNKNOWN), -1);
+	int source = mixer.add_source(RATE, 2, PCM_S16);
+	MF_CHECK(source >= 0);
+	MF_CHECK(!mixer.push(source + 1, nullptr, 0, 0));
+	MF_CHECK(!mixer.push(source, nullptr, 10, 0));
+	for (int i = 1; i < MF_MAX_MIX_SOURCES; i++)
+	{
+		MF_CHECK(mixer.add_source(RATE, 1, PCM_S16) >= 0);
+	}
+	MF_CHECK_EQ(mixer.add_source(RATE, 1, PCM_S16), -1);
+}
+
+int main()
+{
+	test_offset_sources();
+	test_jitter();
+	test_resampled_offset();
+	test_downmix_5_1();
+	test_late_and_missing();
+	test_invalid();
+	return mf_test_result("mf_audio_mixer_test");
+}
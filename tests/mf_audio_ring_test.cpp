@@ -0,0 +1,138 @@
+#include "mf_test.h"
+#include "mf_audio_ring.h"
+#include "mf_time.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#define SAMPLE_RATE 48000
+#define TOTAL_SAMPLES 3000000
+#define MAX_PACKET 960
+#define BLOCK_SIZE 1024
+#define RING_CAPACITY 8192
+#define RESYNC_TOLERANCE 10001 // the ring's 1 ms resync threshold plus rounding
+
+static int64_t sample_time(int64_t samples)
+{
+	return mf_rescale(samples, MF_HNS_PER_SECOND, SAMPLE_RATE);
+}
+
+// One producer writing packets of random size against one consumer reading fixed blocks from a small ring. Every
+// sample is its index in the generated stream and every packet is stamped with the time of its first sample, so the
+// consumer tells samples dropped by an overrun from lost or reordered ones and checks the timestamps. Build with
+// MF_TSAN to check the memory ordering as well.
+static void test_stress()
+{
+	MFAudioRing ring;
+	MF_CHECK(ring.configure(RING_CAPACITY, sizeof(uint64_t), SAMPLE_RATE));
+	std::atomic<bool> producer_done{ false };
+	int64_t generated = 0;
+	int64_t accepted = 0;
+	std::thread producer([&]()
+	{
+		std::vector<uint64_t> packet(MAX_PACKET);
+		unsigned int seed = 1;
+		while (generated < TOTAL_SAMPLES)
+		{
+			seed = seed * 1103515245 + 12345;
+			int samples = 1 + (int)((seed >> 16) % MAX_PACKET);
+			for (int i = 0; i < samples; i++)
+			{
+				packet[i] = (uint64_t)(generated + i);
+			}
+			accepted += ring.write((const uint8_t*)packet.data(), samples, sample_time(generated));
+			generated += samples;
+			// bursts and pauses, so the ring runs both full and dry
+			if ((seed >> 8) % 16 == 0)
+			{
+				std::this_thread::yield();
+			}
+		}
+		producer_done.store(true, std::memory_order_release);
+	});
+
+	std::vector<uint64_t> block(BLOCK_SIZE);
+	int64_t blocks = 0;
+	int64_t failed_reads = 0;
+	uint64_t next = 0;
+	bool ordered = true;
+	bool timed = true;
+	while (true)
+	{
+		// checked ahead of the read, a failed read after the producer finished means the ring is drained
+		bool done = producer_done.load(std::memory_order_acquire);
+		int64_t timestamp = -1;
+		if (!ring.read((uint8_t*)block.data(), BLOCK_SIZE, timestamp))
+		{
+			failed_reads++;
+			if (done)
+			{
+				break;
+			}
+			std::this_thread::yield();
+			continue;
+		}
+		// samples only go missing as a whole, they never repeat or come out of order
+		ordered = ordered && block[0] >= next;
+		for (int i = 1; i < BLOCK_SIZE; i++)
+		{
+			ordered = ordered && block[i] > block[i - 1];
+		}
+		next = block[BLOCK_SIZE - 1] + 1;
+		// gaps below the resync threshold stay on the previous anchor, otherwise the time is exact
+		int64_t error = timestamp - sample_time((int64_t)block[0]);
+		timed = timed && error <= RESYNC_TOLERANCE && error >= -RESYNC_TOLERANCE;
+		blocks++;
+	}
+	producer.join();
+
+	AudioRingStats stats = {};
+	ring.get_stats(stats);
+	MF_CHECK(ordered);
+	MF_CHECK(timed);
+	MF_CHECK_EQ(stats.written, accepted);
+	MF_CHECK_EQ(stats.written + stats.overrun_samples, generated);
+	MF_CHECK_EQ(stats.read, blocks * BLOCK_SIZE);
+	MF_CHECK_EQ(stats.underruns, failed_reads);
+	MF_CHECK(stats.written - stats.read < BLOCK_SIZE);
+	printf("audio ring: %lld samples written, %lld overrun, %lld blocks read, %lld underruns\n", (long long)stats.written,
+		(long long)stats.overrun_samples, (long long)blocks, (long long)stats.underruns);
+}
+
+// an overrun drops the new samples and the next timestamp after the gap starts a new anchor
+static void test_overrun_anchor()
+{
+	MFAudioRing ring;
+	MF_CHECK(ring.configure(1024, sizeof(uint64_t), SAMPLE_RATE));
+	std::vector<uint64_t> data(2048);
+	for (int i = 0; i < 2048; i++)
+	{
+		data[i] = i;
+	}
+	MF_CHECK_EQ(ring.write((const uint8_t*)data.data(), 1000, 0), 1000);
+	MF_CHECK_EQ(ring.write((const uint8_t*)(data.data() + 1000), 100, sample_time(1000)), 24);
+	std::vector<uint64_t> block(512);
+	int64_t timestamp = -1;
+	MF_CHECK(ring.read((uint8_t*)block.data(), 512, timestamp));
+	MF_CHECK_EQ(timestamp, 0);
+	MF_CHECK_EQ(ring.write((const uint8_t*)(data.data() + 1100), 512, sample_time(1100)), 512);
+	MF_CHECK(ring.read((uint8_t*)block.data(), 512, timestamp));
+	MF_CHECK_EQ(block[0], 512);
+	MF_CHECK_EQ(timestamp, sample_time(512));
+	MF_CHECK(ring.read((uint8_t*)block.data(), 512, timestamp));
+	MF_CHECK_EQ(block[0], 1100);
+	MF_CHECK_EQ(timestamp, sample_time(1100));
+	MF_CHECK(!ring.read((uint8_t*)block.data(), 512, timestamp));
+
+	AudioRingStats stats = {};
+	ring.get_stats(stats);
+	MF_CHECK_EQ(stats.overrun_samples, 76);
+	MF_CHECK_EQ(stats.underruns, 1);
+}
+
+int main()
+{
+	test_overrun_anchor();
+	test_stress();
+	return mf_test_result("mf_audio_ring_test");
+}
@@ -0,0 +1,121 @@
+#include "mf_test.h"
+#include "mf_bitstream_arena.h"
+#include <string.h>
+
+// no more than max_blocks leases at a time, released blocks are reused and a double release is ignored
+static void test_leases()
+{
+	MFBitstreamArena arena;
+	arena.reset(1000, 4);
+	MF_CHECK_EQ(arena.get_block_capacity(), 4096);
+	BitstreamLease leases[5] = {};
+	for (int i = 0; i < 4; i++)
+	{
+		MF_CHECK(arena.acquire(1000, leases[i]));
+		MF_CHECK(leases[i].data != nullptr);
+		MF_CHECK_EQ(leases[i].capacity, 4096);
+		MF_CHECK_EQ(leases[i].size, 0);
+	}
+	MF_CHECK(!arena.acquire(1000, leases[4]));
+	MF_CHECK_EQ(arena.get_leased_count(), 4);
+	MF_CHECK_EQ(arena.get_block_count(), 4);
+
+	arena.release(leases[2].block);
+	arena.release(leases[2].block);
+	arena.release(nullptr);
+	MF_CHECK_EQ(arena.get_leased_count(), 3);
+	MF_CHECK(arena.acquire(1000, leases[4]));
+	MF_CHECK(leases[4].block == leases[2].block);
+	MF_CHECK_EQ(arena.get_allocation_count(), 4);
+
+	// commit never reports more than the block holds
+	arena.commit(leases[4], 100000);
+	MF_CHECK_EQ(leases[4].size, leases[4].capacity);
+	for (int i = 0; i < 5; i++)
+	{
+		if (i != 2)
+		{
+			arena.release(leases[i].block);
+		}
+	}
+	MF_CHECK_EQ(arena.get_leased_count(), 0);
+}
+
+// frames below the current capacity reuse the same block without allocating
+static void test_steady_state()
+{
+	MFBitstreamArena arena;
+	arena.reset(4096, 8);
+	for (int i = 0; i < 10000; i++)
+	{
+		BitstreamLease lease = {};
+		MF_CHECK(arena.acquire(4096, lease));
+		unsigned long size = 500 + (unsigned long)(i * 7919) % 2000;
+		memset(lease.data, i, size);
+		arena.commit(lease, size);
+		MF_CHECK_EQ(lease.size, size);
+		arena.release(lease.block);
+	}
+	MF_CHECK_EQ(arena.get_allocation_count(), 1);
+	MF_CHECK_EQ(arena.get_block_count(), 1);
+}
+
+// a request above the capacity raises it right away, a large frame grows the blocks to one and a half times the
+// peak and a window of small frames shrinks them again
+static void test_peak_window()
+{
+	MFBitstreamArena arena;
+	arena.reset(4096, 8);
+	BitstreamLease lease = {};
+	MF_CHECK(arena.acquire(12000, lease));
+	MF_CHECK_EQ(lease.capacity, 12288);
+	arena.commit(lease, 10000);
+	arena.release(lease.block);
+	MF_CHECK_EQ(arena.get_block_capacity(), 16384);
+	MF_CHECK(arena.acquire(4096, lease));
+	MF_CHECK_EQ(lease.capacity, 16384);
+	MF_CHECK_EQ(arena.get_allocation_count(), 2);
+	arena.commit(lease, 1000);
+	arena.release(lease.block);
+
+	for (int i = 0; i < 512; i++)
+	{
+		MF_CHECK(arena.acquire(4096, lease));
+		arena.commit(lease, 1000);
+		arena.release(lease.block);
+	}
+	MF_CHECK_EQ(arena.get_block_capacity(), 4096);
+	MF_CHECK(arena.acquire(4096, lease));
+	MF_CHECK_EQ(lease.capacity, 4096);
+	arena.release(lease.block);
+}
+
+// trim frees the idle blocks only, leased ones stay valid across reset and trim
+static void test_trim()
+{
+	MFBitstreamArena arena;
+	arena.reset(4096, 4);
+	BitstreamLease kept = {};
+	BitstreamLease idle = {};
+	MF_CHECK(arena.acquire(4096, kept));
+	MF_CHECK(arena.acquire(4096, idle));
+	memset(kept.data, 0x5A, 4096);
+	arena.release(idle.block);
+	arena.reset(8192, 4);
+	arena.trim();
+	MF_CHECK_EQ(arena.get_block_count(), 1);
+	MF_CHECK_EQ(arena.get_leased_count(), 1);
+	MF_CHECK(kept.data[0] == 0x5A && kept.data[4095] == 0x5A);
+	arena.release(kept.block);
+	arena.trim();
+	MF_CHECK_EQ(arena.get_block_count(), 0);
+}
+
+int main()
+{
+	test_leases();
+	test_steady_state();
+	test_peak_window();
+	test_trim();
+	return mf_test_result("mf_bitstream_arena_test");
+}
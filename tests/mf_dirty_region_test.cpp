@@ -0,0 +1,226 @@
+#include "mf_test.h"
+#include "mf_dirty_region.h"
+#include "mf_frame_hash.h"
+#include "mf_cpu.h"
+#include <algorithm>
+#include <vector>
+
+#define TILE_SIZE 32
+
+// BGRA frame with padded rows and content that differs from tile to tile
+struct Frame
+{
+	int width;
+	int height;
+	int stride;
+	std::vector<uint8_t> data;
+
+	Frame(int w, int h)
+		: width(w), height(h), stride(w * 4 + 20), data((size_t)(w * 4 + 20) * h)
+	{
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < stride; x++)
+			{
+				data[(size_t)y * stride + x] = (uint8_t)(x * 7 + y * 13);
+			}
+		}
+	}
+
+	void touch(int x, int y)
+	{
+		data[(size_t)y * stride + x * 4 + 1] ^= 0x40;
+	}
+};
+
+static bool same_rect(const MonitorRect& rect, int left, int top, int right, int bottom)
+{
+	return rect.left == left && rect.top == top && rect.right == right && rect.bottom == bottom;
+}
+
+static void sort_rects(std::vector<MonitorRect>& rects)
+{
+	std::sort(rects.begin(), rects.end(), [](const MonitorRect& a, const MonitorRect& b)
+	{
+		return a.top != b.top ? a.top < b.top : a.left < b.left;
+	});
+}
+
+// the first frame after configure and after reset is dirty as a whole, an identical frame is not dirty at all
+static void test_first_frame()
+{
+	Frame frame(200, 150);
+	MFDirtyRegionDetector detector;
+	MF_CHECK(!detector.configure(200, 150, 4));
+	MF_CHECK(detector.configure(200, 150, TILE_SIZE));
+	MF_CHECK_EQ(detector.get_tile_size(), TILE_SIZE);
+	std::vector<MonitorRect> rects;
+	MF_CHECK(detector.detect(frame.data.data(), frame.stride, rects));
+	MF_CHECK_EQ(rects.size(), 1);
+	MF_CHECK(rects.size() == 1 && same_rect(rects[0], 0, 0, 200, 150));
+	MF_CHECK(!detector.detect(frame.data.data(), frame.stride, rects));
+	MF_CHECK(rects.empty());
+	detector.reset();
+	MF_CHECK(detector.detect(frame.data.data(), frame.stride, rects));
+	MF_CHECK(rects.size() == 1 && same_rect(rects[0], 0, 0, 200, 150));
+	MF_CHECK(!detector.detect(nullptr, frame.stride, rects));
+}
+
+// one changed pixel dirties the tile it is in and nothing else, the edge tiles are clipped to the frame
+static void test_single_pixel()
+{
+	Frame frame(200, 150);
+	MFDirtyRegionDetector detector;
+	MF_CHECK(detector.configure(200, 150, TILE_SIZE));
+	std::vector<MonitorRect> rects;
+	detector.detect(frame.data.data(), frame.stride, rects);
+
+	frame.touch(70, 40);
+	MF_CHECK(detector.detect(frame.data.data(), frame.stride, rects));
+	MF_CHECK(rects.size() == 1 && same_rect(rects[0], 64, 32, 96, 64));
+
+	frame.touch(199, 149);
+	MF_CHECK(detector.detect(frame.data.data(), frame.stride, rects));
+	MF_CHECK(rects.size() == 1 && same_rect(rects[0], 192, 128, 200, 150));
+
+	frame.touch(0, 149);
+	MF_CHECK(detector.detect(frame.data.data(), frame.stride, rects));
+	MF_CHECK(rects.size() == 1 && same_rect(rects[0], 0, 128, 32, 150));
+
+	// bytes past the width are row padding, not picture
+	frame.data[(size_t)10 * frame.stride + 200 * 4 + 3] ^= 0xFF;
+	MF_CHECK(!detector.detect(frame.data.data(), frame.stride, rects));
+}
+
+// a run of tiles spanning the same columns in consecutive rows is one rectangle, a run that spans other columns
+// starts a new one
+static void test_merge()
+{
+	Frame frame(320, 320);
+	MFDirtyRegionDetector detector;
+	MF_CHECK(detector.configure(320, 320, TILE_SIZE));
+	std::vector<MonitorRect> rects;
+	detector.detect(frame.data.data(), frame.stride, rects);
+
+	for (int ty = 1; ty <= 4; ty++)
+	{
+		frame.touch(2 * TILE_SIZE + 5, ty * TILE_SIZE + 3);
+		frame.touch(3 * TILE_SIZE + 5, ty * TILE_SIZE + 3);
+	}
+	MF_CHECK(detector.detect(frame.data.data(), frame.stride, rects));
+	MF_CHECK(rects.size() == 1 && same_rect(rects[0], 2 * TILE_SIZE, TILE_SIZE, 4 * TILE_SIZE, 5 * TILE_SIZE));
+
+	// rows 6 and 7 cover columns 1-2, row 8 columns 1-3 and row 9 columns 1-2 again; two separate columns in row 6
+	for (int ty = 6; ty <= 9; ty++)
+	{
+		frame.touch(1 * TILE_SIZE, ty * TILE_SIZE);
+		frame.touch(2 * TILE_SIZE, ty * TILE_SIZE);
+	}
+	frame.touch(3 * TILE_SIZE, 8 * TILE_SIZE);
+	frame.touch(6 * TILE_SIZE, 6 * TILE_SIZE);
+	frame.touch(8 * TILE_SIZE, 6 * TILE_SIZE);
+	MF_CHECK(detector.detect(frame.data.data(), frame.stride, rects));
+	sort_rects(rects);
+	MF_CHECK_EQ(rects.size(), 5);
+	if (rects.size() == 5)
+	{
+		MF_CHECK(same_rect(rects[0], 1 * TILE_SIZE, 6 * TILE_SIZE, 3 * TILE_SIZE, 8 * TILE_SIZE));
+		MF_CHECK(same_rect(rects[1], 6 * TILE_SIZE, 6 * TILE_SIZE, 7 * TILE_SIZE, 7 * TILE_SIZE));
+		MF_CHECK(same_rect(rects[2], 8 * TILE_SIZE, 6 * TILE_SIZE, 9 * TILE_SIZE, 7 * TILE_SIZE));
+		MF_CHECK(same_rect(rects[3], 1 * TILE_SIZE, 8 * TILE_SIZE, 4 * TILE_SIZE, 9 * TILE_SIZE));
+		MF_CHECK(same_rect(rects[4], 1 * TILE_SIZE, 9 * TILE_SIZE, 3 * TILE_SIZE, 10 * TILE_SIZE));
+	}
+
+	// every other column dirty on every row: each row extends all open columns of the row above at once
+	detector.detect(frame.data.data(), frame.stride, rects);
+	for (int ty = 0; ty < 10; ty++)
+	{
+		for (int tx = 0; tx < 10; tx += 2)
+		{
+			frame.touch(tx * TILE_SIZE, ty * TILE_SIZE);
+		}
+	}
+	MF_CHECK(detector.detect(frame.data.data(), frame.stride, rects));
+	sort_rects(rects);
+	MF_CHECK_EQ(rects.size(), 5);
+	for (size_t i = 0; i < rects.size(); i++)
+	{
+		MF_CHECK(same_rect(rects[i], (int)i * 2 * TILE_SIZE, 0, ((int)i * 2 + 1) * TILE_SIZE, 10 * TILE_SIZE));
+	}
+}
+
+// a checkerboard of dirty tiles is more rectangles than the list may hold, their bounding box is reported
+static void test_bounding_box()
+{
+	const int tile_size = 8;
+	Frame frame(400, 330);
+	MFDirtyRegionDetector detector;
+	MF_CHECK(detector.configure(400, 330, tile_size));
+	std::vector<MonitorRect> rects;
+	detector.detect(frame.data.data(), frame.stride, rects);
+	for (int ty = 3; ty < 31; ty++)
+	{
+		for (int tx = 2 + ty % 2; tx < 38; tx += 2)
+		{
+			frame.touch(tx * tile_size + 1, ty * tile_size + 1);
+		}
+	}
+	MF_CHECK(detector.detect(frame.data.data(), frame.stride, rects));
+	MF_CHECK(rects.size() == 1 && same_rect(rects[0], 2 * tile_size, 3 * tile_size, 38 * tile_size, 31 * tile_size));
+
+	// a few rectangles stay a list
+	for (int i = 0; i < 10; i++)
+	{
+		frame.touch(i * 4 * tile_size, 2 * tile_size);
+	}
+	MF_CHECK(detector.detect(frame.data.data(), frame.stride, rects));
+	MF_CHECK_EQ(rects.size(), 10);
+}
+
+// the hash is the same whichever kernel computes it, for any row length and for tiles clipped at the edges
+static void test_hash_kernels()
+{
+	const int sizes[][2] = { { 1, 1 }, { 7, 3 }, { 31, 5 }, { 64, 64 }, { 100, 37 }, { 257, 129 }, { 1921, 67 } };
+	const int tile_sizes[] = { 8, 16, 32, 64, 128 };
+	for (const auto& size : sizes)
+	{
+		Frame frame(size[0], size[1]);
+		for (int tile_size : tile_sizes)
+		{
+			int tiles = ((size[0] + tile_size - 1) / tile_size) * ((size[1] + tile_size - 1) / tile_size);
+			std::vector<uint64_t> simd(tiles);
+			std::vector<uint64_t> scalar(tiles);
+			mf_hash_bgra_tiles(frame.data.data(), frame.stride, size[0], size[1], tile_size, simd.data());
+			mf_cpu_feature_mask() = 0;
+			mf_hash_bgra_tiles(frame.data.data(), frame.stride, size[0], size[1], tile_size, scalar.data());
+			mf_cpu_feature_mask() = ~0;
+			MF_CHECK(simd == scalar);
+		}
+	}
+	std::vector<uint8_t> data(4096);
+	for (size_t i = 0; i < data.size(); i++)
+	{
+		data[i] = (uint8_t)(i * 131 + (i >> 7));
+	}
+	for (int row_bytes = 1; row_bytes <= 300; row_bytes++)
+	{
+		uint64_t simd = mf_hash_plane(data.data() + 1, 301, row_bytes, 13);
+		mf_cpu_feature_mask() = 0;
+		uint64_t scalar = mf_hash_plane(data.data() + 1, 301, row_bytes, 13);
+		mf_cpu_feature_mask() = ~0;
+		MF_CHECK(simd == scalar);
+	}
+	// the size is part of the hash, so empty or reshaped regions of equal bytes do not collide
+	MF_CHECK(mf_hash_plane(data.data(), 64, 64, 2) != mf_hash_plane(data.data(), 128, 128, 1));
+	MF_CHECK(mf_hash_plane(data.data(), 64, 0, 2) != mf_hash_plane(data.data(), 64, 0, 3));
+}
+
+int main()
+{
+	test_first_frame();
+	test_single_pixel();
+	test_merge();
+	test_bounding_box();
+	test_hash_kernels();
+	return mf_test_result("mf_dirty_region_test");
+}
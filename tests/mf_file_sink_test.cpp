@@ -0,0 +1,153 @@
+#include "mf_test.h"
+#include "mf_file_sink.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#define TEST_PATH "mf_file_sink_test.tmp"
+
+static std::vector<uint8_t> read_file(const char* path)
+{
+	std::vector<uint8_t> data;
+	FILE* file = fopen(path, "rb");
+	if (!file)
+	{
+		return data;
+	}
+	uint8_t buffer[65536];
+	size_t read = 0;
+	while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+	{
+		data.insert(data.end(), buffer, buffer + read);
+	}
+	fclose(file);
+	return data;
+}
+
+// Writes about total bytes in chunks of 1 byte to 200 KB, pausing now and then so durability points fall between
+// writes, and reads the file back. The chunk sizes and contents depend on seed only.
+static bool write_and_verify(const FileSinkConfig& config, int64_t total, uint32_t seed, FileSinkStats& stats)
+{
+	MFFileSink sink;
+	if (!sink.open(TEST_PATH, config))
+	{
+		return false;
+	}
+	std::vector<uint8_t> expected;
+	std::vector<uint8_t> chunk;
+	bool ok = true;
+	for (int i = 0; ok && (int64_t)expected.size() < total; i++)
+	{
+		seed = seed * 1664525 + 1013904223;
+		size_t size = i % 5 == 0 ? 1 + (seed >> 28) : 1 + (seed >> 8) % (200 * 1024);
+		chunk.resize(size);
+		for (size_t b = 0; b < size; b++)
+		{
+			chunk[b] = (uint8_t)((expected.size() + b) * 31 + (seed >> 24));
+		}
+		ok = sink.write(chunk.data(), (unsigned long)size);
+		expected.insert(expected.end(), chunk.begin(), chunk.end());
+		if (config.sync_interval_ms > 0 && i % 8 == 7)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(config.sync_interval_ms));
+		}
+	}
+	ok = sink.finish() && ok;
+	sink.get_stats(stats);
+	MF_CHECK(!sink.write(chunk.data(), 1));
+	std::vector<uint8_t> actual = read_file(TEST_PATH);
+	unlink(TEST_PATH);
+	MF_CHECK_EQ(actual.size(), expected.size());
+	MF_CHECK(actual == expected);
+	MF_CHECK_EQ(stats.bytes_accepted, (int64_t)expected.size());
+	MF_CHECK(stats.bytes_written >= stats.bytes_accepted);
+	return ok;
+}
+
+// io_uring may be missing or blocked by seccomp, the threads backend still runs then
+static bool uring_available()
+{
+	FileSinkConfig config;
+	config.backend = FILE_SINK_BACKEND_URING;
+	MFFileSink sink;
+	bool ret = sink.open(TEST_PATH, config) && sink.finish();
+	unlink(TEST_PATH);
+	return ret;
+}
+
+// every backend writes the bytes it was given, buffered or direct, with and without preallocated extents and
+// durability points, with more data than the write-behind buffers hold so write() has to wait for the disk
+static void test_read_back()
+{
+	FILE_SINK_BACKEND backends[] = { FILE_SINK_BACKEND_URING, FILE_SINK_BACKEND_THREADS };
+	bool uring = uring_available();
+	if (!uring)
+	{
+		printf("io_uring unavailable, only the threads backend is tested\n");
+	}
+	for (FILE_SINK_BACKEND backend : backends)
+	{
+		if (backend == FILE_SINK_BACKEND_URING && !uring)
+		{
+			continue;
+		}
+		for (int direct = 0; direct < 2; direct++)
+		{
+			for (int variant = 0; variant < 3; variant++)
+			{
+				FileSinkConfig config;
+				config.backend = backend;
+				config.direct_io = direct != 0;
+				config.buffer_size = variant == 2 ? 5000 : 64 * 1024; // 5000 rounds up to 8192
+				config.max_buffers = 4;
+				config.io_threads = 3;
+				config.preallocate_size = variant == 1 ? 0 : 1 << 20;
+				config.sync_interval_ms = variant == 0 ? 0 : 2;
+				FileSinkStats stats = {};
+				bool ok = write_and_verify(config, 6 << 20, 7 + variant, stats);
+				if (!ok && direct)
+				{
+					// O_DIRECT is refused by some file systems, e.g. older tmpfs
+					printf("direct I/O unavailable for backend %d\n", (int)backend);
+					continue;
+				}
+				MF_CHECK(ok);
+				MF_CHECK_EQ(stats.backend, backend);
+				MF_CHECK(stats.sync_points >= 1);
+				if (config.sync_interval_ms)
+				{
+					MF_CHECK(stats.sync_points > 1);
+				}
+			}
+		}
+	}
+}
+
+// open and finish without data leave an empty file, finish twice is harmless and a path that cannot be created fails
+static void test_empty()
+{
+	MFFileSink sink;
+	FileSinkConfig config;
+	MF_CHECK(sink.open(TEST_PATH, config));
+	MF_CHECK(sink.finish());
+	MF_CHECK(sink.finish());
+	MF_CHECK(read_file(TEST_PATH).empty());
+	FILE* file = fopen(TEST_PATH, "rb");
+	MF_CHECK(file != nullptr);
+	if (file)
+	{
+		fclose(file);
+	}
+	unlink(TEST_PATH);
+	MF_CHECK(!sink.open("/nonexistent/dir/" TEST_PATH, config));
+	MF_CHECK(!sink.open(nullptr, config));
+}
+
+int main()
+{
+	test_read_back();
+	test_empty();
+	return mf_test_result("mf_file_sink_test");
+}
@@ -0,0 +1,202 @@
+#include "mf_test.h"
+#include "mf_frame_pool.h"
+#include <chrono>
+#include <thread>
+
+// packed I420 64x64, and the other shapes of the same size the LRU tests use
+#define BLOCK_SIZE (64 * 64 * 3 / 2)
+
+static FramePoolStats get_stats(MFFramePool& pool)
+{
+	FramePoolStats stats = {};
+	pool.get_stats(stats);
+	return stats;
+}
+
+// every acquire hands out a frame of the asked shape, packed ones without padding, the others with every row on a
+// cache line
+static void test_layout()
+{
+	MFFramePool pool;
+	const PIXEL_FORMAT formats[] = { PIXEL_I420, PIXEL_YV12, PIXEL_NV12, PIXEL_YUY2, PIXEL_BGRA, PIXEL_RGB24 };
+	for (PIXEL_FORMAT format : formats)
+	{
+		VideoFrame* aligned = pool.acquire(format, 100, 50, false);
+		VideoFrame* packed = pool.acquire(format, 100, 50, true);
+		MF_CHECK(aligned != nullptr && packed != nullptr);
+		if (!aligned || !packed)
+		{
+			continue;
+		}
+		MF_CHECK_EQ(aligned->format, format);
+		MF_CHECK_EQ(aligned->width, 100);
+		MF_CHECK_EQ(aligned->height, 50);
+		MF_CHECK_EQ(aligned->ref_count.load(), 1);
+		MF_CHECK(aligned->owner == &pool);
+		MF_CHECK_EQ(aligned->stride[0], mf_video_frame_aligned_stride(format, 100));
+		for (int i = 0; i < mf_pixel_plane_count(format); i++)
+		{
+			MF_CHECK_EQ((uintptr_t)aligned->data[i] % MF_CACHE_LINE, 0u);
+			MF_CHECK_EQ(aligned->stride[i] % MF_CACHE_LINE, 0);
+		}
+		MF_CHECK_EQ((uintptr_t)packed->data[0] % MF_CACHE_LINE, 0u);
+		MF_CHECK_EQ(packed->stride[0], 100 * mf_pixel_bytes_per_pixel(format));
+		MF_CHECK(mf_video_frame_is_contiguous(*packed));
+		mf_video_frame_unref(aligned);
+		mf_video_frame_unref(packed);
+	}
+	MF_CHECK(pool.acquire(PIXEL_NONE, 100, 50, true) == nullptr);
+	MF_CHECK(pool.acquire(PIXEL_I420, 0, 50, true) == nullptr);
+	pool.trim();
+	FramePoolStats stats = get_stats(pool);
+	MF_CHECK_EQ(stats.allocated_bytes, 0u);
+	MF_CHECK_EQ(stats.in_use_bytes, 0u);
+}
+
+// the last reference gives the block back, on any thread, and the next acquire of the same shape reuses it
+static void test_reuse()
+{
+	MFFramePool pool;
+	VideoFrame* frame = pool.acquire(PIXEL_I420, 64, 64, true);
+	uint8_t* memory = frame->data[0];
+	mf_video_frame_ref(frame);
+	mf_video_frame_unref(frame);
+	FramePoolStats stats = get_stats(pool);
+	MF_CHECK_EQ(stats.misses, 1);
+	MF_CHECK_EQ(stats.in_use_bytes, (uint64_t)BLOCK_SIZE);
+	MF_CHECK_EQ(stats.allocated_bytes, (uint64_t)BLOCK_SIZE);
+	std::thread([frame]() { mf_video_frame_unref(frame); }).join();
+	stats = get_stats(pool);
+	MF_CHECK_EQ(stats.in_use_bytes, 0u);
+	MF_CHECK_EQ(stats.allocated_bytes, (uint64_t)BLOCK_SIZE);
+
+	frame = pool.acquire(PIXEL_I420, 64, 64, true);
+	MF_CHECK(frame->data[0] == memory);
+	// another shape, or the same shape with another row layout, is a block of its own
+	VideoFrame* other = pool.acquire(PIXEL_I420, 64, 64, false);
+	MF_CHECK(other->data[0] != memory);
+	mf_video_frame_unref(other);
+	mf_video_frame_unref(frame);
+	stats = get_stats(pool);
+	MF_CHECK_EQ(stats.hits, 1);
+	MF_CHECK_EQ(stats.misses, 2);
+	MF_CHECK_EQ(stats.peak_bytes, stats.allocated_bytes);
+	MF_CHECK_EQ(stats.trimmed, 0);
+	MF_CHECK_EQ(stats.failures, 0);
+	pool.trim();
+	stats = get_stats(pool);
+	MF_CHECK_EQ(stats.allocated_bytes, 0u);
+	MF_CHECK_EQ(stats.trimmed, 2);
+	MF_CHECK(stats.peak_bytes > 0);
+}
+
+// a block that does not fit the budget frees idle blocks least recently used first, and fails once none is idle
+static void test_budget_lru()
+{
+	MFFramePool pool;
+	pool.set_budget(3 * BLOCK_SIZE);
+	VideoFrame* a = pool.acquire(PIXEL_I420, 64, 64, true);
+	VideoFrame* b = pool.acquire(PIXEL_NV12, 64, 64, true);
+	VideoFrame* c = pool.acquire(PIXEL_I420, 32, 128, true);
+	MF_CHECK(a && b && c);
+	MF_CHECK(pool.acquire(PIXEL_I420, 128, 32, true) == nullptr);
+	FramePoolStats stats = get_stats(pool);
+	MF_CHECK_EQ(stats.failures, 1);
+	MF_CHECK_EQ(stats.budget_bytes, (uint64_t)3 * BLOCK_SIZE);
+	// released oldest first, so a is the least recently used
+	for (VideoFrame* frame : { a, b, c })
+	{
+		mf_video_frame_unref(frame);
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+	}
+	VideoFrame* d = pool.acquire(PIXEL_I420, 128, 32, true);
+	MF_CHECK(d != nullptr);
+	stats = get_stats(pool);
+	MF_CHECK_EQ(stats.trimmed, 1);
+	MF_CHECK_EQ(stats.allocated_bytes, (uint64_t)3 * BLOCK_SIZE);
+	// a is gone, so its shape allocates again and takes b's room, c is still idle
+	VideoFrame* a2 = pool.acquire(PIXEL_I420, 64, 64, true);
+	VideoFrame* c2 = pool.acquire(PIXEL_I420, 32, 128, true);
+	MF_CHECK(a2 && c2);
+	stats = get_stats(pool);
+	MF_CHECK_EQ(stats.trimmed, 2);
+	MF_CHECK_EQ(stats.hits, 1);
+	MF_CHECK_EQ(stats.misses, 5);
+	MF_CHECK(stats.allocated_bytes <= 3 * BLOCK_SIZE);
+
+	// a budget that shrinks while frames are out frees them when they come back instead of keeping them idle
+	pool.set_budget(BLOCK_SIZE);
+	mf_video_frame_unref(d);
+	mf_video_frame_unref(a2);
+	stats = get_stats(pool);
+	MF_CHECK_EQ(stats.allocated_bytes, (uint64_t)BLOCK_SIZE);
+	mf_video_frame_unref(c2);
+	stats = get_stats(pool);
+	MF_CHECK_EQ(stats.allocated_bytes, (uint64_t)BLOCK_SIZE);
+	MF_CHECK_EQ(stats.in_use_bytes, 0u);
+	MF_CHECK(stats.peak_bytes <= 3 * BLOCK_SIZE);
+	pool.set_budget(0);
+}
+
+// the global budget bounds all pools together, a pool short of room takes idle blocks from the others
+static void test_global_budget()
+{
+	MFFramePool first;
+	MFFramePool second;
+	MFFramePool::set_global_budget(2 * BLOCK_SIZE);
+	mf_video_frame_unref(first.acquire(PIXEL_I420, 64, 64, true));
+	VideoFrame* y = second.acquire(PIXEL_I420, 64, 64, true);
+	VideoFrame* z = second.acquire(PIXEL_NV12, 64, 64, true);
+	MF_CHECK(y && z);
+	MF_CHECK_EQ(get_stats(first).trimmed, 1);
+	MF_CHECK_EQ(get_stats(first).allocated_bytes, 0u);
+	// nothing is idle anywhere
+	MF_CHECK(first.acquire(PIXEL_I420, 64, 64, true) == nullptr);
+	MF_CHECK_EQ(get_stats(first).failures, 1);
+	FramePoolStats stats = {};
+	MFFramePool::get_global_stats(stats);
+	MF_CHECK_EQ(stats.allocated_bytes, (uint64_t)2 * BLOCK_SIZE);
+	MF_CHECK_EQ(stats.in_use_bytes, (uint64_t)2 * BLOCK_SIZE);
+	MF_CHECK_EQ(stats.budget_bytes, (uint64_t)2 * BLOCK_SIZE);
+	MF_CHECK_EQ(stats.misses, 3);
+	MF_CHECK_EQ(stats.failures, 1);
+	MF_CHECK(stats.peak_bytes >= 2 * BLOCK_SIZE);
+	mf_video_frame_unref(y);
+	mf_video_frame_unref(z);
+	// lowering the global budget trims idle blocks of every pool
+	MFFramePool::set_global_budget(BLOCK_SIZE);
+	MFFramePool::get_global_stats(stats);
+	MF_CHECK_EQ(stats.allocated_bytes, (uint64_t)BLOCK_SIZE);
+	MFFramePool::set_global_budget(0);
+}
+
+// large pages are only used for blocks of at least one large page and when the system grants them, the pool works
+// the same either way
+static void test_large_pages()
+{
+	MFFramePool pool;
+	pool.set_large_pages(true);
+	VideoFrame* small = pool.acquire(PIXEL_I420, 64, 64, true);
+	VideoFrame* large = pool.acquire(PIXEL_BGRA, 1920, 1080, false);
+	MF_CHECK(small && large);
+	FramePoolStats stats = get_stats(pool);
+	MF_CHECK(stats.large_page_blocks <= 1);
+	MF_CHECK(stats.allocated_bytes >= (uint64_t)BLOCK_SIZE + 1920 * 1080 * 4);
+	large->data[0][(size_t)1079 * large->stride[0] + 1919 * 4] = 1;
+	mf_video_frame_unref(small);
+	mf_video_frame_unref(large);
+	pool.trim();
+	stats = get_stats(pool);
+	MF_CHECK_EQ(stats.large_page_blocks, 0);
+	MF_CHECK_EQ(stats.allocated_bytes, 0u);
+}
+
+int main()
+{
+	test_layout();
+	test_reuse();
+	test_budget_lru();
+	test_global_budget();
+	test_large_pages();
+	return mf_test_result("mf_frame_pool_test");
+}
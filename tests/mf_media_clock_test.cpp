@@ -0,0 +1,124 @@
+#include "mf_test.h"
+#include "mf_media_clock.h"
+#include "mf_time.h"
+#include <math.h>
+
+#define FRAME_INTERVAL 333333 // 30 fps in 100ns units
+#define CLOCK_BASE 123456789012LL
+#define DELAY 20000
+
+// arrival of the frame at device_time on a clock running fast by ppm parts per million, after a fixed delay
+static int64_t arrival(int64_t device_time, double ppm)
+{
+	return CLOCK_BASE + (int64_t)llround((double)device_time * (1.0 + ppm * 1e-6)) + DELAY;
+}
+
+static void test_to_time_base()
+{
+	MFMediaClock clock;
+	clock.start(CLOCK_BASE);
+	MF_CHECK_EQ(clock.get_origin(), CLOCK_BASE);
+	int64_t timestamp = -1;
+	MF_CHECK(!clock.to_time_base(CLOCK_BASE - 1, 90000, timestamp));
+	MF_CHECK_EQ(timestamp, -1);
+	MF_CHECK(clock.to_time_base(CLOCK_BASE, 90000, timestamp));
+	MF_CHECK_EQ(timestamp, 0);
+	MF_CHECK(clock.to_time_base(CLOCK_BASE + MF_HNS_PER_SECOND, 90000, timestamp));
+	MF_CHECK_EQ(timestamp, 90000);
+	MF_CHECK(clock.to_time_base(CLOCK_BASE + FRAME_INTERVAL, 1000, timestamp));
+	MF_CHECK_EQ(timestamp, 33);
+}
+
+// until two samples are in the device time only gets the offset
+static void test_first_samples()
+{
+	MFClockDriftEstimator estimator;
+	MF_CHECK_EQ(estimator.map(5000), 5000);
+	MF_CHECK(estimator.get_ratio() == 1.0);
+	estimator.add(1000000, arrival(1000000, 0.0));
+	MF_CHECK_EQ(estimator.get_count(), 1);
+	MF_CHECK(estimator.get_ratio() == 1.0);
+	MF_CHECK_EQ(estimator.map(1000000), arrival(1000000, 0.0));
+	MF_CHECK_EQ(estimator.map(1000000 + FRAME_INTERVAL), arrival(1000000 + FRAME_INTERVAL, 0.0));
+}
+
+// a steady drift is found exactly and the mapping tracks it over the whole window
+static void test_drift()
+{
+	const double ppm = 100.0;
+	MFClockDriftEstimator estimator;
+	for (int i = 0; i < 2000; i++)
+	{
+		int64_t device_time = (int64_t)i * FRAME_INTERVAL;
+		estimator.add(device_time, arrival(device_time, ppm));
+	}
+	MF_CHECK_EQ(estimator.get_count(), MF_DRIFT_WINDOW);
+	MF_CHECK(fabs(estimator.get_ratio() - (1.0 + ppm * 1e-6)) < 1e-8);
+	int64_t device_time = (int64_t)2000 * FRAME_INTERVAL;
+	int64_t error = estimator.map(device_time) - arrival(device_time, ppm);
+	MF_CHECK(error >= -2 && error <= 2);
+}
+
+// delivery jitter only adds delay, the fit runs through the earliest arrivals and ignores the rest
+static void test_jitter()
+{
+	const double ppm = -50.0;
+	MFClockDriftEstimator estimator;
+	unsigned int seed = 7;
+	for (int i = 0; i < 1024; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		// every eighth frame arrives on time, the others up to 5 ms late
+		int64_t jitter = i % 8 == 0 ? 0 : (int64_t)((seed >> 16) % 50000);
+		int64_t device_time = (int64_t)i * FRAME_INTERVAL;
+		estimator.add(device_time, arrival(device_time, ppm) + jitter);
+	}
+	MF_CHECK(fabs(estimator.get_ratio() - (1.0 + ppm * 1e-6)) < 1e-7);
+	int64_t device_time = (int64_t)1024 * FRAME_INTERVAL;
+	int64_t error = estimator.map(device_time) - arrival(device_time, ppm);
+	MF_CHECK(error >= -100 && error <= 100);
+}
+
+// a burst of late samples looks like a rate far from any real clock, it is not taken as drift
+static void test_burst()
+{
+	MFClockDriftEstimator estimator;
+	for (int i = 0; i < 64; i++)
+	{
+		int64_t device_time = (int64_t)i * FRAME_INTERVAL;
+		estimator.add(device_time, arrival(device_time, 0.0) + (i >= 32 ? (int64_t)(i - 31) * FRAME_INTERVAL : 0));
+	}
+	MF_CHECK(estimator.get_ratio() == 1.0);
+	MF_CHECK_EQ(estimator.map(0), arrival(0, 0.0));
+}
+
+// a device clock going back starts a new fit, the old pairs would bend the line
+static void test_restart()
+{
+	MFClockDriftEstimator estimator;
+	for (int i = 0; i < 100; i++)
+	{
+		int64_t device_time = (int64_t)i * FRAME_INTERVAL;
+		estimator.add(device_time, arrival(device_time, 200.0));
+	}
+	MF_CHECK_EQ(estimator.get_count(), 100);
+	int64_t restart_clock = arrival((int64_t)100 * FRAME_INTERVAL, 200.0);
+	estimator.add(0, restart_clock);
+	MF_CHECK_EQ(estimator.get_count(), 1);
+	MF_CHECK(estimator.get_ratio() == 1.0);
+	MF_CHECK_EQ(estimator.map(FRAME_INTERVAL), restart_clock + FRAME_INTERVAL);
+	estimator.reset();
+	MF_CHECK_EQ(estimator.get_count(), 0);
+	MF_CHECK_EQ(estimator.map(42), 42);
+}
+
+int main()
+{
+	test_to_time_base();
+	test_first_samples();
+	test_drift();
+	test_jitter();
+	test_burst();
+	test_restart();
+	return mf_test_result("mf_media_clock_test");
+}
@@ -0,0 +1,434 @@
+#include "mf_test.h"
+#include "mf_mp4_muxer.h"
+#include "mf_nal_parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#define TIME_BASE 90000
+#define FRAME_DURATION 3000 // 30 fps
+#define AUDIO_RATE 48000
+#define AUDIO_FRAME 1024
+#define AUDIO_DURATION (AUDIO_FRAME * TIME_BASE / AUDIO_RATE)
+#define VIDEO_FRAMES 100
+#define GOP_LENGTH 30
+#define SKIPPED_FRAME 45
+#define CHANGED_SPS_FRAME 60
+
+// baseline 640x360, POC type 2
+static const uint8_t s_Sps[] = { 0x67, 0x42, 0xC0, 0x1E, 0xDA, 0x02, 0x80, 0xBF, 0xE5, 0x40 };
+static const uint8_t s_Pps[] = { 0x68, 0xCE, 0x38, 0x80 };
+// the same at level 3.1, sent from CHANGED_SPS_FRAME on
+static const uint8_t s_ChangedSps[] = { 0x67, 0x42, 0xC0, 0x1F, 0xDA, 0x02, 0x80, 0xBF, 0xE5, 0x40 };
+
+// Collects what the muxer appends. Whenever a new moof starts, everything before it has to be whole boxes: a muxer
+// that patched a size or an offset afterwards would need to seek back.
+class MemoryOutput final : public MFMuxerOutput
+{
+public:
+	bool write(const uint8_t* data, unsigned long size) override
+	{
+		if (size >= 8 && memcmp(data + 4, "moof", 4) == 0)
+		{
+			fragments++;
+			complete_fragments += complete_boxes() ? 1 : 0;
+		}
+		bytes.insert(bytes.end(), data, data + size);
+		return true;
+	}
+
+	bool finish() override
+	{
+		finished = true;
+		return true;
+	}
+
+	bool complete_boxes();
+
+	std::vector<uint8_t> bytes;
+	int fragments{ 0 };
+	int complete_fragments{ 0 };
+	bool finished{ false };
+};
+
+struct Box
+{
+	std::string type;
+	size_t offset; // of the size field
+	size_t size;
+};
+
+static uint32_t get_u32(const std::vector<uint8_t>& data, size_t offset)
+{
+	return (uint32_t)data[offset] << 24 | data[offset + 1] << 16 | data[offset + 2] << 8 | data[offset + 3];
+}
+
+static uint64_t get_u64(const std::vector<uint8_t>& data, size_t offset)
+{
+	return (uint64_t)get_u32(data, offset) << 32 | get_u32(data, offset + 4);
+}
+
+// boxes in [begin, end), false when a size runs past end or a box is left incomplete
+static bool list_boxes(const std::vector<uint8_t>& data, size_t begin, size_t end, std::vector<Box>& boxes)
+{
+	boxes.clear();
+	size_t offset = begin;
+	while (offset < end)
+	{
+		if (end - offset < 8)
+		{
+			return false;
+		}
+		size_t size = get_u32(data, offset);
+		if (size < 8 || size > end - offset)
+		{
+			return false;
+		}
+		boxes.push_back({ std::string((const char*)data.data() + offset + 4, 4), offset, size });
+		offset += size;
+	}
+	return true;
+}
+
+bool MemoryOutput::complete_boxes()
+{
+	std::vector<Box> boxes;
+	return list_boxes(bytes, 0, bytes.size(), boxes);
+}
+
+// first box of each type along path, children start skip bytes into the box for sample entries and full boxes
+static bool find_box(const std::vector<uint8_t>& data, const Box& parent, const char* type, Box& found, size_t skip = 8)
+{
+	std::vector<Box> children;
+	list_boxes(data, parent.offset + skip, parent.offset + parent.size, children);
+	for (const Box& child : children)
+	{
+		if (child.type == type)
+		{
+			found = child;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool find_path(const std::vector<uint8_t>& data, const Box& root, const std::vector<const char*>& path, Box& found)
+{
+	Box box = root;
+	for (const char* type : path)
+	{
+		// stsd carries an entry count, the visual and audio sample entries their fixed fields before the children
+		size_t skip = box.type == "stsd" ? 16 : box.type == "avc3" ? 86 : box.type == "mp4a" ? 36 : 8;
+		if (!find_box(data, box, type, found, skip))
+		{
+			return false;
+		}
+		box = found;
+	}
+	return true;
+}
+
+static std::vector<uint8_t> make_access_unit(int frame, bool key)
+{
+	static const uint8_t start_code[] = { 0, 0, 0, 1 };
+	static const uint8_t aud[] = { 0x09, 0xF0 };
+	std::vector<uint8_t> au;
+	au.insert(au.end(), start_code, start_code + 4);
+	au.insert(au.end(), aud, aud + sizeof(aud));
+	if (key)
+	{
+		au.insert(au.end(), start_code, start_code + 4);
+		const uint8_t* sps = frame >= CHANGED_SPS_FRAME ? s_ChangedSps : s_Sps;
+		au.insert(au.end(), sps, sps + sizeof(s_Sps));
+		au.insert(au.end(), start_code + 1, start_code + 4);
+		au.insert(au.end(), s_Pps, s_Pps + sizeof(s_Pps));
+	}
+	au.insert(au.end(), start_code, start_code + 4);
+	au.push_back(key ? 0x65 : 0x41);
+	// slice payload of a size that varies per frame, no zero bytes so no start code can appear in it
+	for (int i = 0; i < 20 + frame % 7 * 13; i++)
+	{
+		au.push_back((uint8_t)(0x11 + (frame + i) % 200));
+	}
+	return au;
+}
+
+static std::vector<uint8_t> make_audio_frame(int index)
+{
+	std::vector<uint8_t> frame(100 + index % 5 * 10);
+	for (size_t i = 0; i < frame.size(); i++)
+	{
+		frame[i] = (uint8_t)(index * 3 + i);
+	}
+	return frame;
+}
+
+// each frame as the muxer should store it: every NAL but the AUD behind a 4 byte length, parameter sets included
+static std::vector<uint8_t> expected_video_sample(int frame)
+{
+	std::vector<uint8_t> au = make_access_unit(frame, frame % GOP_LENGTH == 0);
+	std::vector<NalUnit> units;
+	mf_split_annexb(au.data(), (unsigned long)au.size(), units);
+	std::vector<uint8_t> sample;
+	for (const NalUnit& unit : units)
+	{
+		if (unit.type != NAL_TYPE_AUD)
+		{
+			sample.insert(sample.end(), { 0, 0, 0, (uint8_t)unit.size });
+			sample.insert(sample.end(), unit.data, unit.data + unit.size);
+		}
+	}
+	return sample;
+}
+
+// video and audio interleaved by timestamp the way two encoder threads deliver them, audio starts a little early
+static void mux(MFMp4Muxer& muxer, int& rejected)
+{
+	rejected = 0;
+	int audio = 0;
+	int64_t audio_start = 1000 - AUDIO_DURATION;
+	for (int frame = 0; frame < VIDEO_FRAMES; frame++)
+	{
+		int64_t timestamp = 1000 + (int64_t)frame * FRAME_DURATION;
+		while (audio_start + (int64_t)audio * AUDIO_DURATION <= timestamp)
+		{
+			std::vector<uint8_t> payload = make_audio_frame(audio);
+			OutputAData data = { payload.data(), (unsigned long)payload.size(), AUDIO_DURATION, audio_start + (int64_t)audio * AUDIO_DURATION, 0 };
+			rejected += muxer.write_audio(data) ? 0 : 1;
+			audio++;
+		}
+		bool key = frame % GOP_LENGTH == 0;
+		std::vector<uint8_t> au = make_access_unit(frame, key);
+		OutputVData data = { au.data(), (unsigned long)au.size(), FRAME_DURATION, timestamp, key, nullptr, false, 0 };
+		if (frame == SKIPPED_FRAME)
+		{
+			data.data = nullptr;
+			data.size = 0;
+			data.skipped = true;
+		}
+		rejected += muxer.write_video(data) ? 0 : 1;
+	}
+}
+
+struct TrackSamples
+{
+	int count{ 0 };
+	uint64_t next_decode_time{ 0 };
+	std::vector<uint32_t> durations;
+	std::vector<std::vector<uint8_t>> payloads;
+	std::vector<uint32_t> flags;
+};
+
+static void test_fragments()
+{
+	MemoryOutput output;
+	MFMp4Muxer muxer;
+	muxer.set_video(640, 360, TIME_BASE);
+	muxer.set_audio(AUDIO_RATE, 2, TIME_BASE);
+	muxer.set_fragment_duration(1000);
+	MF_CHECK(muxer.open(&output));
+
+	// nothing goes out before the first key frame
+	std::vector<uint8_t> au = make_access_unit(1, false);
+	OutputVData delta = { au.data(), (unsigned long)au.size(), FRAME_DURATION, 0, false, nullptr, false, 0 };
+	MF_CHECK(!muxer.write_video(delta));
+	MF_CHECK(output.bytes.empty());
+
+	int rejected = 0;
+	mux(muxer, rejected);
+	MF_CHECK_EQ(rejected, 0);
+	MF_CHECK(muxer.close());
+	MF_CHECK(output.finished);
+	MF_CHECK(output.fragments >= 3);
+	MF_CHECK_EQ(output.complete_fragments, output.fragments);
+
+	const std::vector<uint8_t>& data = output.bytes;
+	std::vector<Box> boxes;
+	MF_CHECK(list_boxes(data, 0, data.size(), boxes));
+	MF_CHECK(boxes.size() >= 4 && boxes.size() % 2 == 0);
+	if (boxes.size() < 4)
+	{
+		return;
+	}
+	// the init segment comes first, fragments are moof / mdat pairs after it
+	MF_CHECK(boxes[0].type == "ftyp" && boxes[1].type == "moov");
+	Box found;
+	MF_CHECK(find_path(data, boxes[1], { "mvex", "trex" }, found));
+	std::vector<Box> trex;
+	Box mvex;
+	MF_CHECK(find_box(data, boxes[1], "mvex", mvex));
+	list_boxes(data, mvex.offset + 8, mvex.offset + mvex.size, trex);
+	MF_CHECK(trex.size() == 2 && get_u32(data, trex[0].offset + 12) == 1 && get_u32(data, trex[1].offset + 12) == 2);
+
+	std::vector<Box> traks;
+	list_boxes(data, boxes[1].offset + 8, boxes[1].offset + boxes[1].size, traks);
+	MF_CHECK(traks.size() == 4 && traks[1].type == "trak" && traks[2].type == "trak");
+	if (traks.size() == 4)
+	{
+		// the avcC keeps the sets of the first key frame, the changed SPS is only in the samples
+		MF_CHECK(find_path(data, traks[1], { "mdia", "minf", "stbl", "stsd", "avc3", "avcC" }, found));
+		const uint8_t expected_avcc[] = { 1, 0x42, 0xC0, 0x1E, 0xFF, 0xE1, 0, sizeof(s_Sps) };
+		MF_CHECK(found.size == 8 + 8 + sizeof(s_Sps) + 3 + sizeof(s_Pps));
+		MF_CHECK(memcmp(data.data() + found.offset + 8, expected_avcc, sizeof(expected_avcc)) == 0);
+		MF_CHECK(memcmp(data.data() + found.offset + 16, s_Sps, sizeof(s_Sps)) == 0);
+		MF_CHECK(memcmp(data.data() + found.offset + 16 + sizeof(s_Sps) + 3, s_Pps, sizeof(s_Pps)) == 0);
+		MF_CHECK(find_path(data, traks[1], { "mdia", "mdhd" }, found) && get_u32(data, found.offset + 20) == TIME_BASE);
+
+		// AudioSpecificConfig of AAC-LC, 48 kHz, stereo is 0x11 0x90
+		MF_CHECK(find_path(data, traks[2], { "mdia", "minf", "stbl", "stsd", "mp4a", "esds" }, found));
+		const uint8_t config[] = { 0x05, 0x02, 0x11, 0x90 };
+		MF_CHECK(found.size > 12 + 4 && memcmp(data.data() + found.offset + found.size - 3 - sizeof(config), config, sizeof(config)) == 0);
+		MF_CHECK(find_path(data, traks[2], { "mdia", "mdhd" }, found) && get_u32(data, found.offset + 20) == AUDIO_RATE);
+	}
+
+	TrackSamples tracks[2];
+	uint32_t sequence = 0;
+	for (size_t i = 2; i + 1 < boxes.size(); i += 2)
+	{
+		const Box& moof = boxes[i];
+		const Box& mdat = boxes[i + 1];
+		MF_CHECK(moof.type == "moof" && mdat.type == "mdat");
+		MF_CHECK(find_box(data, moof, "mfhd", found) && get_u32(data, found.offset + 12) == ++sequence);
+		std::vector<Box> trafs;
+		list_boxes(data, moof.offset + 8, moof.offset + moof.size, trafs);
+		for (const Box& traf : trafs)
+		{
+			if (traf.type != "traf")
+			{
+				continue;
+			}
+			Box tfhd, tfdt, trun;
+			MF_CHECK(find_box(data, traf, "tfhd", tfhd) && find_box(data, traf, "tfdt", tfdt) && find_box(data, traf, "trun", trun));
+			uint32_t track_id = get_u32(data, tfhd.offset + 12);
+			MF_CHECK(track_id == 1 || track_id == 2);
+			TrackSamples& track = tracks[track_id == 2 ? 1 : 0];
+			// each fragment continues where the previous one of the track ended
+			uint64_t decode_time = get_u64(data, tfdt.offset + 12);
+			MF_CHECK(track.count == 0 || decode_time == track.next_decode_time);
+			MF_CHECK_EQ(get_u32(data, trun.offset + 8) & 0xFFFFFF, 0x000701);
+			uint32_t count = get_u32(data, trun.offset + 12);
+			size_t sample_offset = moof.offset + get_u32(data, trun.offset + 16);
+			// the run lies in the mdat that follows its moof
+			MF_CHECK(sample_offset >= mdat.offset + 8);
+			for (uint32_t s = 0; s < count; s++)
+			{
+				size_t entry = trun.offset + 20 + s * 12;
+				uint32_t duration = get_u32(data, entry);
+				uint32_t size = get_u32(data, entry + 4);
+				MF_CHECK(sample_offset + size <= mdat.offset + mdat.size);
+				if (sample_offset + size > mdat.offset + mdat.size)
+				{
+					return;
+				}
+				track.durations.push_back(duration);
+				track.flags.push_back(get_u32(data, entry + 8));
+				track.payloads.emplace_back(data.begin() + sample_offset, data.begin() + sample_offset + size);
+				sample_offset += size;
+				decode_time += duration;
+			}
+			track.count += count;
+			track.next_decode_time = decode_time;
+		}
+	}
+
+	// the skipped frame is folded into the one before it
+	MF_CHECK_EQ(tracks[0].count, VIDEO_FRAMES - 1);
+	int frame = 0;
+	for (int s = 0; s < tracks[0].count; s++, frame++)
+	{
+		frame += frame == SKIPPED_FRAME ? 1 : 0;
+		MF_CHECK_EQ(tracks[0].durations[s], frame + 1 == SKIPPED_FRAME ? 2 * FRAME_DURATION : FRAME_DURATION);
+		MF_CHECK(tracks[0].payloads[s] == expected_video_sample(frame));
+		MF_CHECK_EQ(tracks[0].flags[s], frame % GOP_LENGTH == 0 ? 0x02000000 : 0x01010000);
+	}
+	int audio_frames = ((VIDEO_FRAMES - 1) * FRAME_DURATION + AUDIO_DURATION) / AUDIO_DURATION + 1;
+	MF_CHECK_EQ(tracks[1].count, audio_frames);
+	for (int s = 0; s < tracks[1].count; s++)
+	{
+		MF_CHECK_EQ(tracks[1].durations[s], AUDIO_FRAME);
+		MF_CHECK(tracks[1].payloads[s] == make_audio_frame(s));
+	}
+}
+
+// a path goes through the file sink and gives the same bytes as an output object
+static void test_file_output()
+{
+	MemoryOutput output;
+	MFMp4Muxer muxer;
+	muxer.set_video(640, 360, TIME_BASE);
+	muxer.set_audio(AUDIO_RATE, 2, TIME_BASE);
+	MF_CHECK(muxer.open(&output));
+	int rejected = 0;
+	mux(muxer, rejected);
+	MF_CHECK(muxer.close());
+
+	char path[] = "/tmp/mf_mp4_muxer_test_XXXXXX";
+	int fd = mkstemp(path);
+	MF_CHECK(fd >= 0);
+	if (fd < 0)
+	{
+		return;
+	}
+	close(fd);
+	MF_CHECK(muxer.open(path));
+	mux(muxer, rejected);
+	MF_CHECK(muxer.close());
+	std::vector<uint8_t> file;
+	FILE* f = fopen(path, "rb");
+	MF_CHECK(f != nullptr);
+	if (f)
+	{
+		uint8_t buffer[4096];
+		size_t read = 0;
+		while ((read = fread(buffer, 1, sizeof(buffer), f)) > 0)
+		{
+			file.insert(file.end(), buffer, buffer + read);
+		}
+		fclose(f);
+	}
+	remove(path);
+	MF_CHECK(file == output.bytes);
+	MF_CHECK(!muxer.open("/nonexistent/dir/out.mp4"));
+}
+
+// an audio only recording writes a single track file cut on the fragment duration
+static void test_audio_only()
+{
+	MemoryOutput output;
+	MFMp4Muxer muxer;
+	muxer.set_audio(AUDIO_RATE, 1, TIME_BASE);
+	muxer.set_fragment_duration(500);
+	MF_CHECK(muxer.open(&output));
+	std::vector<uint8_t> payload = make_audio_frame(0);
+	for (int i = 0; i < 100; i++)
+	{
+		OutputAData data = { payload.data(), (unsigned long)payload.size(), AUDIO_DURATION, (int64_t)i * AUDIO_DURATION, 0 };
+		MF_CHECK(muxer.write_audio(data));
+	}
+	OutputAData late = { payload.data(), (unsigned long)payload.size(), AUDIO_DURATION, 0, 0 };
+	MF_CHECK(!muxer.write_audio(late));
+	MF_CHECK(muxer.close());
+	std::vector<Box> boxes;
+	MF_CHECK(list_boxes(output.bytes, 0, output.bytes.size(), boxes));
+	// 100 frames of 21.3 ms are four fragments of 500 ms and the rest
+	MF_CHECK_EQ(boxes.size(), 2 + 5 * 2);
+	MF_CHECK(boxes.size() > 2 && boxes[1].type == "moov");
+	Box trak;
+	std::vector<Box> traks;
+	if (boxes.size() > 2)
+	{
+		list_boxes(output.bytes, boxes[1].offset + 8, boxes[1].offset + boxes[1].size, traks);
+	}
+	MF_CHECK(traks.size() == 3 && traks[1].type == "trak" && find_box(output.bytes, traks[1], "mdia", trak));
+}
+
+int main()
+{
+	test_fragments();
+	test_file_output();
+	test_audio_only();
+	return mf_test_result("mf_mp4_muxer_test");
+}
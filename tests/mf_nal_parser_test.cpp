@@ -0,0 +1,408 @@
+#include "mf_test.h"
+#include "mf_nal_parser.h"
+#include "mf_cpu.h"
+#include <string.h>
+#include <vector>
+
+// RBSP writer for synthetic parameter sets and slices, nal() adds the header byte, the stop bit and the emulation
+// prevention bytes
+struct BitWriter
+{
+	std::vector<uint8_t> rbsp;
+	int bit_count{ 0 };
+
+	void bit(uint32_t value)
+	{
+		if (bit_count % 8 == 0)
+		{
+			rbsp.push_back(0);
+		}
+		rbsp.back() |= (uint8_t)((value & 1) << (7 - bit_count % 8));
+		bit_count++;
+	}
+
+	void bits(uint32_t value, int count)
+	{
+		for (int i = count - 1; i >= 0; i--)
+		{
+			bit(value >> i);
+		}
+	}
+
+	void ue(uint32_t value)
+	{
+		int length = 0;
+		while ((value + 1) >> (length + 1))
+		{
+			length++;
+		}
+		bits(0, length);
+		bits(value + 1, length + 1);
+	}
+
+	std::vector<uint8_t> nal(uint8_t header)
+	{
+		bit(1);
+		std::vector<uint8_t> out(1, header);
+		int zeros = 0;
+		for (uint8_t value : rbsp)
+		{
+			if (zeros == 2 && value <= 3)
+			{
+				out.push_back(3);
+				zeros = 0;
+			}
+			out.push_back(value);
+			zeros = value ? 0 : zeros + 1;
+		}
+		return out;
+	}
+};
+
+// high profile 1920x1088 cropped to 1080, 16 bit frame_num and POC LSB
+static std::vector<uint8_t> make_sps(int id)
+{
+	BitWriter writer;
+	writer.bits(100, 8);
+	writer.bits(0, 8);
+	writer.bits(40, 8);
+	writer.ue(id);
+	writer.ue(1); // chroma_format_idc
+	writer.ue(0);
+	writer.ue(0);
+	writer.bit(0);
+	writer.bit(0);
+	writer.ue(12); // log2_max_frame_num - 4
+	writer.ue(0); // poc_type
+	writer.ue(12); // log2_max_poc_lsb - 4
+	writer.ue(2); // max_num_ref_frames
+	writer.bit(0);
+	writer.ue(119);
+	writer.ue(67);
+	writer.bit(1); // frame_mbs_only
+	writer.bit(1);
+	writer.bit(1); // frame_cropping_flag
+	writer.ue(0);
+	writer.ue(0);
+	writer.ue(0);
+	writer.ue(4);
+	writer.bit(0); // vui_parameters_present_flag
+	return writer.nal(0x67);
+}
+
+static std::vector<uint8_t> make_pps(int id, int sps_id, bool cabac)
+{
+	BitWriter writer;
+	writer.ue(id);
+	writer.ue(sps_id);
+	writer.bit(cabac ? 1 : 0);
+	writer.bit(0);
+	writer.ue(0); // num_slice_groups_minus1
+	return writer.nal(0x68);
+}
+
+static std::vector<uint8_t> make_slice(bool idr, int slice_type, int pps_id, int frame_num, int idr_pic_id, int poc_lsb)
+{
+	BitWriter writer;
+	writer.ue(0);
+	writer.ue(slice_type);
+	writer.ue(pps_id);
+	writer.bits(frame_num, 16);
+	if (idr)
+	{
+		writer.ue(idr_pic_id);
+	}
+	writer.bits(poc_lsb, 16);
+	writer.bits(0x5A5A, 16); // stands in for the rest of the slice
+	return writer.nal(idr ? 0x65 : 0x41);
+}
+
+static void append_unit(std::vector<uint8_t>& stream, const std::vector<uint8_t>& nal, int prefix_size)
+{
+	static const uint8_t start_code[] = { 0, 0, 0, 1 };
+	stream.insert(stream.end(), start_code + 4 - prefix_size, start_code + 4);
+	stream.insert(stream.end(), nal.begin(), nal.end());
+}
+
+static const uint8_t* naive_find(const uint8_t* p, const uint8_t* end)
+{
+	for (; end - p >= 3; p++)
+	{
+		if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+		{
+			return p;
+		}
+	}
+	return end;
+}
+
+// the SIMD scan finds the same start code as the scalar one from every starting point, with start codes that
+// straddle the vector width and runs of zeros that only nearly make one
+static void test_start_code_scan()
+{
+	for (int pattern = 0; pattern < 3; pattern++)
+	{
+		std::vector<uint8_t> data(301);
+		uint32_t seed = 17 + pattern;
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			seed = seed * 1664525 + 1013904223;
+			data[i] = pattern == 0 ? (uint8_t)(seed >> 24 | 0x10) : pattern == 1 ? (uint8_t)(seed >> 30) : 0;
+		}
+		if (pattern != 1)
+		{
+			const int positions[] = { 30, 31, 63, 64, 95, 130, 160, 161, 298 };
+			for (int position : positions)
+			{
+				data[position] = 0;
+				data[position + 1] = 0;
+				data[position + 2] = 1;
+			}
+		}
+		const uint8_t* end = data.data() + data.size();
+		for (size_t start = 0; start <= data.size(); start++)
+		{
+			const uint8_t* p = data.data() + start;
+			const uint8_t* expected = naive_find(p, end);
+			MF_CHECK(mf_find_start_code(p, end) == expected);
+			mf_cpu_feature_mask() = 0;
+			MF_CHECK(mf_find_start_code(p, end) == expected);
+			mf_cpu_feature_mask() = ~0;
+		}
+	}
+	MF_CHECK(mf_find_start_code(nullptr, nullptr) == nullptr);
+}
+
+// 3 and 4 byte start codes, leading garbage and trailing_zero_8bits, units are views with their prefix sizes
+static void test_split_annexb()
+{
+	std::vector<uint8_t> sps = make_sps(0);
+	std::vector<uint8_t> pps = make_pps(0, 0, true);
+	std::vector<uint8_t> slice = make_slice(true, 7, 0, 0, 3, 0);
+	std::vector<uint8_t> stream = { 0xAA, 0xBB };
+	append_unit(stream, sps, 4);
+	append_unit(stream, pps, 3);
+	stream.push_back(0);
+	stream.push_back(0);
+	append_unit(stream, slice, 4);
+	stream.insert(stream.end(), 3, 0);
+
+	std::vector<NalUnit> units;
+	mf_split_annexb(stream.data(), (unsigned long)stream.size(), units);
+	MF_CHECK_EQ(units.size(), 3);
+	if (units.size() == 3)
+	{
+		MF_CHECK_EQ(units[0].type, NAL_TYPE_SPS);
+		MF_CHECK_EQ(units[0].ref_idc, 3);
+		MF_CHECK_EQ(units[0].offset, 6);
+		MF_CHECK_EQ(units[0].prefix_size, 6);
+		MF_CHECK(units[0].size == sps.size() && memcmp(units[0].data, sps.data(), sps.size()) == 0);
+		MF_CHECK_EQ(units[1].type, NAL_TYPE_PPS);
+		MF_CHECK_EQ(units[1].prefix_size, 3);
+		MF_CHECK(units[1].size == pps.size() && memcmp(units[1].data, pps.data(), pps.size()) == 0);
+		MF_CHECK_EQ(units[2].type, NAL_TYPE_IDR);
+		MF_CHECK_EQ(units[2].prefix_size, 6);
+		MF_CHECK(units[2].size == slice.size() && memcmp(units[2].data, slice.data(), slice.size()) == 0);
+	}
+	mf_split_annexb(stream.data(), 2, units);
+	MF_CHECK(units.empty());
+
+	std::vector<uint8_t> avcc = { 0, 0, 0, 2, 0x09, 0xF0, 0, 0, 0, 4, 0x41, 1, 2, 3 };
+	MF_CHECK(mf_split_avcc(avcc.data(), (unsigned long)avcc.size(), 4, units));
+	MF_CHECK(units.size() == 2 && units[0].type == NAL_TYPE_AUD && units[1].offset == 10 && units[1].size == 4);
+	MF_CHECK(!mf_split_avcc(avcc.data(), (unsigned long)avcc.size() - 1, 4, units));
+	MF_CHECK_EQ(units.size(), 1);
+	MF_CHECK(!mf_split_avcc(avcc.data(), (unsigned long)avcc.size(), 3, units));
+}
+
+// the fields the muxers and packetizers use, read through emulation prevention bytes
+static void test_parameter_sets()
+{
+	std::vector<uint8_t> sps_nal = make_sps(0);
+	H264Sps sps;
+	MF_CHECK(mf_parse_sps(sps_nal.data(), (unsigned long)sps_nal.size(), sps));
+	MF_CHECK_EQ(sps.profile_idc, 100);
+	MF_CHECK_EQ(sps.level_idc, 40);
+	MF_CHECK_EQ(sps.chroma_format_idc, 1);
+	MF_CHECK_EQ(sps.bit_depth_luma, 8);
+	MF_CHECK_EQ(sps.log2_max_frame_num, 16);
+	MF_CHECK_EQ(sps.poc_type, 0);
+	MF_CHECK_EQ(sps.log2_max_poc_lsb, 16);
+	MF_CHECK_EQ(sps.max_num_ref_frames, 2);
+	MF_CHECK(sps.frame_mbs_only);
+	MF_CHECK_EQ(sps.width, 1920);
+	MF_CHECK_EQ(sps.height, 1080);
+	MF_CHECK(!mf_parse_sps(sps_nal.data(), 6, sps));
+	std::vector<uint8_t> pps_nal = make_pps(3, 0, true);
+	MF_CHECK(!mf_parse_sps(pps_nal.data(), (unsigned long)pps_nal.size(), sps));
+
+	H264Pps pps;
+	MF_CHECK(mf_parse_pps(pps_nal.data(), (unsigned long)pps_nal.size(), pps));
+	MF_CHECK(pps.id == 3 && pps.sps_id == 0 && pps.entropy_coding_mode && !pps.bottom_field_pic_order_present);
+
+	MFParameterSetCache cache;
+	std::vector<NalUnit> units;
+	std::vector<uint8_t> stream;
+	append_unit(stream, sps_nal, 4);
+	append_unit(stream, pps_nal, 4);
+	mf_split_annexb(stream.data(), (unsigned long)stream.size(), units);
+	uint64_t version = cache.get_version();
+	MF_CHECK(cache.update(units));
+	MF_CHECK(cache.get_version() != version);
+	version = cache.get_version();
+	MF_CHECK(!cache.update(units));
+	MF_CHECK_EQ(cache.get_version(), version);
+	MF_CHECK(cache.get_sps(0) && cache.get_sps(0)->height == 1080);
+	MF_CHECK(!cache.get_sps(1) && !cache.get_pps(0) && !cache.get_pps(300));
+	MF_CHECK(cache.get_pps_nal(3) && *cache.get_pps_nal(3) == pps_nal);
+
+	// zero frame_num and POC bits run into 00 00 00, which is escaped
+	std::vector<uint8_t> slice_nal = make_slice(false, 5, 3, 0, 0, 5);
+	bool escaped = false;
+	for (size_t i = 2; i < slice_nal.size(); i++)
+	{
+		escaped |= slice_nal[i - 2] == 0 && slice_nal[i - 1] == 0 && slice_nal[i] == 3;
+	}
+	MF_CHECK(escaped);
+	NalUnit slice = { slice_nal.data(), (unsigned long)slice_nal.size(), 0, 4, NAL_TYPE_SLICE, 2 };
+	SliceHeader header;
+	MF_CHECK(cache.parse_slice_header(slice, header));
+	MF_CHECK(header.slice_type == SLICE_TYPE_P && header.pps_id == 3 && header.frame_num == 0 && !header.idr);
+	MF_CHECK_EQ(header.poc_lsb, 5);
+
+	slice_nal = make_slice(true, 7, 3, 0x1234, 9, 0xBEEF);
+	slice = { slice_nal.data(), (unsigned long)slice_nal.size(), 0, 4, NAL_TYPE_IDR, 3 };
+	MF_CHECK(cache.parse_slice_header(slice, header));
+	MF_CHECK(header.slice_type == SLICE_TYPE_I && header.idr && header.frame_num == 0x1234 && header.idr_pic_id == 9);
+	MF_CHECK_EQ(header.poc_lsb, 0xBEEF);
+
+	// a slice of a PPS the cache has not seen is not guessed at
+	slice_nal = make_slice(false, 0, 4, 1, 0, 2);
+	slice = { slice_nal.data(), (unsigned long)slice_nal.size(), 0, 4, NAL_TYPE_SLICE, 2 };
+	MF_CHECK(!cache.parse_slice_header(slice, header));
+
+	std::vector<uint8_t> pps2_nal = make_pps(0, 0, false);
+	NalUnit pps2 = { pps2_nal.data(), (unsigned long)pps2_nal.size(), 0, 4, NAL_TYPE_PPS, 3 };
+	MF_CHECK(cache.update(pps2));
+	std::vector<uint8_t> record;
+	MF_CHECK(cache.get_avcc_record(record));
+	std::vector<uint8_t> expected = { 1, 100, 0, 40, 0xFF, 0xE1, 0, (uint8_t)sps_nal.size() };
+	expected.insert(expected.end(), sps_nal.begin(), sps_nal.end());
+	expected.push_back(2);
+	expected.push_back(0);
+	expected.push_back((uint8_t)pps2_nal.size());
+	expected.insert(expected.end(), pps2_nal.begin(), pps2_nal.end());
+	expected.push_back(0);
+	expected.push_back((uint8_t)pps_nal.size());
+	expected.insert(expected.end(), pps_nal.begin(), pps_nal.end());
+	const uint8_t high_profile[] = { 0xFD, 0xF8, 0xF8, 0 };
+	expected.insert(expected.end(), high_profile, high_profile + 4);
+	MF_CHECK(record == expected);
+
+	cache.clear();
+	MF_CHECK(!cache.get_avcc_record(record));
+}
+
+// Annex-B to AVCC and back gives the units unchanged, in place only with 4 byte start codes and nothing between units
+static void test_avcc_round_trip()
+{
+	std::vector<uint8_t> sps = make_sps(0);
+	std::vector<uint8_t> pps = make_pps(0, 0, true);
+	std::vector<uint8_t> idr = make_slice(true, 7, 0, 0, 0, 0);
+	std::vector<uint8_t> p_slice = make_slice(false, 5, 0, 1, 0, 2);
+
+	std::vector<uint8_t> annexb;
+	append_unit(annexb, sps, 4);
+	append_unit(annexb, pps, 4);
+	append_unit(annexb, idr, 4);
+	append_unit(annexb, p_slice, 4);
+	std::vector<uint8_t> buffer = annexb;
+	std::vector<NalUnit> units;
+	MF_CHECK(mf_annexb_to_avcc_in_place(buffer.data(), (unsigned long)buffer.size(), units));
+	MF_CHECK(mf_split_avcc(buffer.data(), (unsigned long)buffer.size(), 4, units));
+	MF_CHECK_EQ(units.size(), 4);
+	MF_CHECK(units.size() == 4 && units[3].size == p_slice.size() && memcmp(units[3].data, p_slice.data(), p_slice.size()) == 0);
+	MF_CHECK(mf_avcc_to_annexb_in_place(buffer.data(), (unsigned long)buffer.size()));
+	MF_CHECK(buffer == annexb);
+
+	std::vector<uint8_t> mixed;
+	append_unit(mixed, sps, 4);
+	append_unit(mixed, pps, 3);
+	append_unit(mixed, idr, 3);
+	mixed.push_back(0); // trailing_zero_8bits
+	append_unit(mixed, p_slice, 4);
+	buffer = mixed;
+	MF_CHECK(!mf_annexb_to_avcc_in_place(buffer.data(), (unsigned long)buffer.size(), units));
+	MF_CHECK(buffer == mixed);
+
+	std::vector<uint8_t> avcc(mixed.size() + 16);
+	MF_CHECK_EQ(mf_annexb_to_avcc(mixed.data(), (unsigned long)mixed.size(), avcc.data(), (unsigned long)avcc.size()), annexb.size());
+	avcc.resize(annexb.size());
+	MF_CHECK(mf_avcc_to_annexb_in_place(avcc.data(), (unsigned long)avcc.size()));
+	MF_CHECK(avcc == annexb);
+	MF_CHECK_EQ(mf_annexb_to_avcc(mixed.data(), (unsigned long)mixed.size(), avcc.data(), (unsigned long)annexb.size() - 1), 0);
+
+	// a length running past the end is found before any start code is written
+	buffer = annexb;
+	MF_CHECK(mf_annexb_to_avcc_in_place(buffer.data(), (unsigned long)buffer.size(), units));
+	std::vector<uint8_t> truncated(buffer.begin(), buffer.end() - 1);
+	std::vector<uint8_t> original = truncated;
+	MF_CHECK(!mf_avcc_to_annexb_in_place(truncated.data(), (unsigned long)truncated.size()));
+	MF_CHECK(truncated == original);
+}
+
+// avcC counts SPS in 5 bits and PPS in 8, with every id in use the record keeps the lowest 31 and 255
+static void test_avcc_record_limits()
+{
+	MFParameterSetCache cache;
+	for (int id = 0; id < 32; id++)
+	{
+		std::vector<uint8_t> sps = make_sps(id);
+		MF_CHECK(cache.update({ sps.data(), (unsigned long)sps.size(), 0, 4, NAL_TYPE_SPS, 3 }));
+	}
+	for (int id = 0; id < 256; id++)
+	{
+		std::vector<uint8_t> pps = make_pps(id, 0, false);
+		MF_CHECK(cache.update({ pps.data(), (unsigned long)pps.size(), 0, 4, NAL_TYPE_PPS, 3 }));
+	}
+	std::vector<uint8_t> record;
+	MF_CHECK(cache.get_avcc_record(record));
+	MF_CHECK(record.size() > 6);
+	if (record.size() <= 6)
+	{
+		return;
+	}
+	MF_CHECK_EQ(record[5], 0xE0 | 31);
+	size_t offset = 6;
+	for (int i = 0; i < 31 && offset + 2 <= record.size(); i++)
+	{
+		offset += 2 + ((record[offset] << 8) | record[offset + 1]);
+	}
+	MF_CHECK(offset < record.size());
+	if (offset >= record.size())
+	{
+		return;
+	}
+	MF_CHECK_EQ(record[offset], 255);
+	offset++;
+	H264Pps pps;
+	for (int i = 0; i < 255 && offset + 2 <= record.size(); i++)
+	{
+		size_t size = (record[offset] << 8) | record[offset + 1];
+		MF_CHECK(offset + 2 + size <= record.size() && mf_parse_pps(record.data() + offset + 2, (unsigned long)size, pps));
+		MF_CHECK_EQ(pps.id, i);
+		offset += 2 + size;
+	}
+	// the high profile fields close the record
+	MF_CHECK_EQ(offset + 4, record.size());
+}
+
+int main()
+{
+	test_start_code_scan();
+	test_split_annexb();
+	test_parameter_sets();
+	test_avcc_round_trip();
+	test_avcc_record_limits();
+	return mf_test_result("mf_nal_parser_test");
+}
@@ -0,0 +1,213 @@
+#include "mf_test.h"
+#include "mf_pcm_assembler.h"
+#include "mf_time.h"
+#include <vector>
+
+#define SAMPLE_RATE 48000
+#define FRAME_SIZE 1024
+#define CHANNELS 2
+
+// stereo S16 whose left channel counts samples, so any lost, repeated or reordered sample shows up
+static std::vector<uint8_t> make_chunk(int first, int samples)
+{
+	std::vector<uint8_t> chunk((size_t)samples * CHANNELS * 2);
+	int16_t* data = (int16_t*)chunk.data();
+	for (int i = 0; i < samples; i++)
+	{
+		data[i * CHANNELS] = (int16_t)(first + i);
+		data[i * CHANNELS + 1] = (int16_t)~(first + i);
+	}
+	return chunk;
+}
+
+static bool check_counter(const PcmFrame& frame, int first)
+{
+	const int16_t* data = (const int16_t*)frame.data;
+	for (int i = 0; i < frame.samples; i++)
+	{
+		if (data[i * CHANNELS] != (int16_t)(first + i) || data[i * CHANNELS + 1] != (int16_t)~(first + i))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static int64_t sample_time(int64_t samples)
+{
+	return mf_rescale(samples, MF_HNS_PER_SECOND, SAMPLE_RATE);
+}
+
+static void configure(MFPcmAssembler& assembler)
+{
+	MF_CHECK(assembler.configure(AUDIO_FORMAT_S16LE, CHANNELS, SAMPLE_RATE, FRAME_SIZE, MF_HNS_PER_SECOND));
+}
+
+// chunks of odd sizes come out as whole frames in order, frames inside a chunk are not copied, and the timestamps are
+// the sample count rescaled, exact across the whole run
+static void test_chunk_boundaries()
+{
+	MFPcmAssembler assembler;
+	configure(assembler);
+	const int sizes[] = { 441, 700, 1500, 1024, 3, 4096, 2047, 1, 1023, 480 };
+	int total = 0;
+	int frames = 0;
+	int in_place = 0;
+	for (int i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++)
+	{
+		std::vector<uint8_t> chunk = make_chunk(total, sizes[i]);
+		MF_CHECK(assembler.push(chunk.data(), (unsigned long)chunk.size(), i == 0 ? 0 : -1));
+		PcmFrame frame = {};
+		while (assembler.pop(frame))
+		{
+			MF_CHECK_EQ(frame.samples, FRAME_SIZE);
+			MF_CHECK(check_counter(frame, frames * FRAME_SIZE));
+			MF_CHECK_EQ(frame.timestamp, sample_time((int64_t)frames * FRAME_SIZE));
+			MF_CHECK_EQ(frame.duration, sample_time((int64_t)(frames + 1) * FRAME_SIZE) - frame.timestamp);
+			in_place += frame.data >= chunk.data() && frame.data < chunk.data() + chunk.size();
+			frames++;
+		}
+		total += sizes[i];
+		MF_CHECK_EQ(assembler.get_staged_samples(), total - frames * FRAME_SIZE);
+	}
+	MF_CHECK_EQ(frames, total / FRAME_SIZE);
+	MF_CHECK(in_place > 0);
+}
+
+// timestamps jittering within the drift limit do not move the output, the sample count stays the clock
+static void test_timestamp_continuity()
+{
+	MFPcmAssembler assembler;
+	configure(assembler);
+	const int64_t jitter[] = { 0, 40000, -30000, 150000, -150000, 10000 };
+	int total = 0;
+	int frames = 0;
+	for (int i = 0; i < 60; i++)
+	{
+		int samples = 480;
+		std::vector<uint8_t> chunk = make_chunk(total, samples);
+		int64_t timestamp = 1000000 + sample_time(total) + jitter[i % 6];
+		MF_CHECK(assembler.push(chunk.data(), (unsigned long)chunk.size(), i == 0 ? 1000000 : timestamp));
+		PcmFrame frame = {};
+		while (assembler.pop(frame))
+		{
+			MF_CHECK(check_counter(frame, frames * FRAME_SIZE));
+			MF_CHECK_EQ(frame.timestamp, 1000000 + sample_time((int64_t)frames * FRAME_SIZE));
+			frames++;
+		}
+		total += samples;
+	}
+	MF_CHECK_EQ(frames, total / FRAME_SIZE);
+}
+
+// a gap beyond the drift limit completes the staged frame with silence at its old time, the next run starts at the
+// input timestamp
+static void test_resync_gap()
+{
+	MFPcmAssembler assembler;
+	configure(assembler);
+	std::vector<uint8_t> first = make_chunk(0, 1500);
+	MF_CHECK(assembler.push(first.data(), (unsigned long)first.size(), 0));
+	PcmFrame frame = {};
+	MF_CHECK(assembler.pop(frame));
+	MF_CHECK(!assembler.pop(frame));
+	MF_CHECK_EQ(assembler.get_staged_samples(), 476);
+
+	int64_t gap_time = sample_time(1500) + 1000000;
+	std::vector<uint8_t> second = make_chunk(10000, 2048);
+	MF_CHECK(assembler.push(second.data(), (unsigned long)second.size(), gap_time));
+	MF_CHECK(assembler.pop(frame));
+	MF_CHECK_EQ(frame.samples, 476);
+	MF_CHECK_EQ(frame.timestamp, sample_time(FRAME_SIZE));
+	MF_CHECK_EQ(frame.duration, sample_time(FRAME_SIZE + 476) - sample_time(FRAME_SIZE));
+	MF_CHECK(check_counter(frame, FRAME_SIZE));
+	const int16_t* padding = (const int16_t*)frame.data;
+	bool silent = true;
+	for (int i = 476 * CHANNELS; i < FRAME_SIZE * CHANNELS; i++)
+	{
+		silent = silent && padding[i] == 0;
+	}
+	MF_CHECK(silent);
+
+	MF_CHECK(assembler.pop(frame));
+	MF_CHECK_EQ(frame.samples, FRAME_SIZE);
+	MF_CHECK_EQ(frame.timestamp, gap_time);
+	MF_CHECK(check_counter(frame, 10000));
+	MF_CHECK(assembler.pop(frame));
+	MF_CHECK_EQ(frame.timestamp, gap_time + sample_time(FRAME_SIZE));
+	MF_CHECK(check_counter(frame, 10000 + FRAME_SIZE));
+	MF_CHECK(!assembler.pop(frame));
+}
+
+// input that starts before the samples already taken overlaps them, the repeated samples are dropped
+static void test_overlap_drop()
+{
+	MFPcmAssembler assembler;
+	configure(assembler);
+	std::vector<uint8_t> first = make_chunk(0, 4800);
+	MF_CHECK(assembler.push(first.data(), (unsigned long)first.size(), 0));
+	PcmFrame frame = {};
+	int frames = 0;
+	while (assembler.pop(frame))
+	{
+		frames++;
+	}
+	MF_CHECK_EQ(frames, 4);
+
+	// the second chunk repeats the last 2400 samples, it is stamped 50 ms early
+	std::vector<uint8_t> second = make_chunk(2400, 4800);
+	MF_CHECK(assembler.push(second.data(), (unsigned long)second.size(), sample_time(2400)));
+	while (assembler.pop(frame))
+	{
+		MF_CHECK(check_counter(frame, frames * FRAME_SIZE));
+		MF_CHECK_EQ(frame.timestamp, sample_time((int64_t)frames * FRAME_SIZE));
+		frames++;
+	}
+	MF_CHECK_EQ(frames, 7200 / FRAME_SIZE);
+	MF_CHECK_EQ(assembler.get_staged_samples(), 7200 - frames * FRAME_SIZE);
+
+	// an input entirely inside the overlap is dropped as a whole
+	std::vector<uint8_t> third = make_chunk(0, 480);
+	MF_CHECK(assembler.push(third.data(), (unsigned long)third.size(), 0));
+	MF_CHECK(!assembler.pop(frame));
+	MF_CHECK_EQ(assembler.get_staged_samples(), 7200 - frames * FRAME_SIZE);
+}
+
+// the tail comes out padded with U8 silence, which is 0x80 and not 0, and the duration covers the valid samples only
+static void test_flush_u8()
+{
+	MFPcmAssembler assembler;
+	MF_CHECK(assembler.configure(AUDIO_FORMAT_U8, 1, SAMPLE_RATE, FRAME_SIZE, MF_HNS_PER_SECOND));
+	std::vector<uint8_t> chunk(1500, 7);
+	MF_CHECK(assembler.push(chunk.data(), (unsigned long)chunk.size(), 0));
+	PcmFrame frame = {};
+	MF_CHECK(assembler.flush(frame));
+	MF_CHECK_EQ(frame.samples, FRAME_SIZE);
+	MF_CHECK(assembler.flush(frame));
+	MF_CHECK_EQ(frame.samples, 476);
+	MF_CHECK_EQ(frame.timestamp, sample_time(FRAME_SIZE));
+	MF_CHECK_EQ(frame.duration, sample_time(1500) - sample_time(FRAME_SIZE));
+	bool valid = true;
+	for (int i = 0; i < FRAME_SIZE; i++)
+	{
+		valid = valid && frame.data[i] == (i < 476 ? 7 : 0x80);
+	}
+	MF_CHECK(valid);
+	MF_CHECK(!assembler.flush(frame));
+	MF_CHECK_EQ(assembler.get_staged_samples(), 0);
+
+	// flush resets, the next input starts a new run at its own timestamp
+	MF_CHECK(assembler.push(chunk.data(), (unsigned long)chunk.size(), 5000000));
+	MF_CHECK(assembler.pop(frame));
+	MF_CHECK_EQ(frame.timestamp, 5000000);
+}
+
+int main()
+{
+	test_chunk_boundaries();
+	test_timestamp_continuity();
+	test_resync_gap();
+	test_overlap_drop();
+	test_flush_u8();
+	return mf_test_result("mf_pcm_assembler_test");
+}
@@ -0,0 +1,439 @@
+#include "mf_test.h"
+#include "mf_pixel_convert.h"
+#include "mf_video_frame.h"
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define SENTINEL 0xcd
+#define GUARD_BYTES 64
+
+static const PIXEL_FORMAT s_Formats[] = { PIXEL_I420, PIXEL_YV12, PIXEL_NV12, PIXEL_YUY2, PIXEL_UYVY, PIXEL_BGRA, PIXEL_RGB24 };
+static const char* s_strFormats[] = { "", "I420", "YV12", "NV12", "YUY2", "UYVY", "BGRA", "RGB24" };
+
+static bool is_rgb(PIXEL_FORMAT format)
+{
+	return format == PIXEL_BGRA || format == PIXEL_RGB24;
+}
+
+static bool is_packed_yuv(PIXEL_FORMAT format)
+{
+	return format == PIXEL_YUY2 || format == PIXEL_UYVY;
+}
+
+// bytes of a row that a kernel may write, packed 4:2:2 rows hold whole pixel pairs
+static int row_bytes(PIXEL_FORMAT format, int plane, int width)
+{
+	if (is_packed_yuv(format))
+	{
+		return (width + 1) / 2 * 4;
+	}
+	if (plane == 0)
+	{
+		return width * mf_pixel_bytes_per_pixel(format);
+	}
+	return format == PIXEL_NV12 ? (width + 1) / 2 * 2 : (width + 1) / 2;
+}
+
+// an image over a buffer whose padding and tail keep SENTINEL unless a kernel writes out of bounds
+struct TestImage
+{
+	std::vector<uint8_t> buffer;
+	VideoFrame frame;
+	PlaneView planes;
+};
+
+static void init_image(TestImage& image, PIXEL_FORMAT format, int width, int height, int padding)
+{
+	// NV12 shares the stride between its planes, and an odd width has one chroma pair more than luma bytes
+	int stride = row_bytes(format, 0, width) + padding;
+	if (format == PIXEL_NV12 && (width & 1))
+	{
+		stride++;
+	}
+	image.buffer.assign(mf_video_frame_size(format, height, stride) + GUARD_BYTES, SENTINEL);
+	mf_video_frame_init(image.frame, format, width, height, image.buffer.data(), stride);
+	image.planes = {};
+	for (int i = 0; i < mf_pixel_plane_count(format); i++)
+	{
+		image.planes.data[i] = image.frame.data[i];
+		image.planes.stride[i] = image.frame.stride[i];
+	}
+}
+
+static uint8_t* pixel(const TestImage& image, int plane, int x, int y)
+{
+	return image.planes.data[plane] + (ptrdiff_t)y * image.planes.stride[plane] + x;
+}
+
+// yuv pattern with chroma constant over each 2x2 block, so every subsampling of it is exact
+static uint8_t pattern_y(int x, int y)
+{
+	return (uint8_t)(16 + (x * 7 + y * 13) % 220);
+}
+
+static uint8_t pattern_u(int x, int y)
+{
+	return (uint8_t)(16 + ((x / 2) * 11 + (y / 2) * 5) % 225);
+}
+
+static uint8_t pattern_v(int x, int y)
+{
+	return (uint8_t)(16 + ((x / 2) * 3 + (y / 2) * 17 + 100) % 225);
+}
+
+// rgb pattern, channel order r g b
+static void pattern_rgb(int x, int y, int rgb[3])
+{
+	rgb[0] = (x * 29 + y * 7) % 256;
+	rgb[1] = (x * 5 + y * 31 + 80) % 256;
+	rgb[2] = (x * 13 + y * 3 + 160) % 256;
+}
+
+static void fill_pattern(TestImage& image)
+{
+	PIXEL_FORMAT format = image.frame.format;
+	int width = image.frame.width;
+	int height = image.frame.height;
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			if (is_rgb(format))
+			{
+				int rgb[3];
+				pattern_rgb(x, y, rgb);
+				int bytes = mf_pixel_bytes_per_pixel(format);
+				uint8_t* p = pixel(image, 0, x * bytes, y);
+				p[0] = (uint8_t)rgb[2];
+				p[1] = (uint8_t)rgb[1];
+				p[2] = (uint8_t)rgb[0];
+				if (bytes == 4)
+				{
+					p[3] = 0xff;
+				}
+				continue;
+			}
+			if (is_packed_yuv(format))
+			{
+				// Y0 U Y1 V or U Y0 V Y1, an odd last pixel repeats its luma as the second one of the pair
+				uint8_t* p = pixel(image, 0, x / 2 * 4, y);
+				int luma = format == PIXEL_YUY2 ? 0 : 1;
+				int chroma = format == PIXEL_YUY2 ? 1 : 0;
+				p[luma + (x & 1) * 2] = pattern_y(x, y);
+				if ((x & 1) == 0)
+				{
+					p[luma + 2] = pattern_y(x, y);
+				}
+				p[chroma] = pattern_u(x, y);
+				p[chroma + 2] = pattern_v(x, y);
+				continue;
+			}
+			*pixel(image, 0, x, y) = pattern_y(x, y);
+			if ((x & 1) || (y & 1))
+			{
+				continue;
+			}
+			if (format == PIXEL_NV12)
+			{
+				pixel(image, 1, x, y / 2)[0] = pattern_u(x, y);
+				pixel(image, 1, x, y / 2)[1] = pattern_v(x, y);
+			}
+			else
+			{
+				*pixel(image, 1, x / 2, y / 2) = pattern_u(x, y);
+				*pixel(image, 2, x / 2, y / 2) = pattern_v(x, y);
+			}
+		}
+	}
+}
+
+// BT.601 limited range, the matrix libyuv uses for its unsuffixed kernels
+static void rgb_to_yuv(const double rgb[3], double yuv[3])
+{
+	yuv[0] = 0.257 * rgb[0] + 0.504 * rgb[1] + 0.098 * rgb[2] + 16.0;
+	yuv[1] = -0.148 * rgb[0] - 0.291 * rgb[1] + 0.439 * rgb[2] + 128.0;
+	yuv[2] = 0.439 * rgb[0] - 0.368 * rgb[1] - 0.071 * rgb[2] + 128.0;
+}
+
+static void yuv_to_rgb(const double yuv[3], double rgb[3])
+{
+	double y = 1.164 * (yuv[0] - 16.0);
+	rgb[0] = y + 1.596 * (yuv[2] - 128.0);
+	rgb[1] = y - 0.813 * (yuv[2] - 128.0) - 0.391 * (yuv[1] - 128.0);
+	rgb[2] = y + 2.018 * (yuv[1] - 128.0);
+	for (int i = 0; i < 3; i++)
+	{
+		rgb[i] = rgb[i] < 0.0 ? 0.0 : (rgb[i] > 255.0 ? 255.0 : rgb[i]);
+	}
+}
+
+// the source pattern of pixel (x, y) as yuv, with the chroma a yuv source stores for it
+static void source_yuv(PIXEL_FORMAT src_format, int x, int y, double yuv[3])
+{
+	if (is_rgb(src_format))
+	{
+		int rgb[3];
+		pattern_rgb(x, y, rgb);
+		double value[3] = { (double)rgb[0], (double)rgb[1], (double)rgb[2] };
+		rgb_to_yuv(value, yuv);
+		return;
+	}
+	yuv[0] = pattern_y(x, y);
+	yuv[1] = pattern_u(x, y);
+	yuv[2] = pattern_v(x, y);
+}
+
+static void source_rgb(PIXEL_FORMAT src_format, int x, int y, double rgb[3])
+{
+	if (is_rgb(src_format))
+	{
+		int value[3];
+		pattern_rgb(x, y, value);
+		for (int i = 0; i < 3; i++)
+		{
+			rgb[i] = value[i];
+		}
+		return;
+	}
+	double yuv[3];
+	source_yuv(src_format, x, y, yuv);
+	yuv_to_rgb(yuv, rgb);
+}
+
+// chroma of the block at (x, y) of block_width x block_height, averaged over the pixels inside the image
+static void source_chroma(PIXEL_FORMAT src_format, int x, int y, int block_width, int block_height, int width, int height, double uv[2])
+{
+	uv[0] = 0.0;
+	uv[1] = 0.0;
+	int count = 0;
+	for (int by = y; by < y + block_height && by < height; by++)
+	{
+		for (int bx = x; bx < x + block_width && bx < width; bx++)
+		{
+			double yuv[3];
+			source_yuv(src_format, bx, by, yuv);
+			uv[0] += yuv[1];
+			uv[1] += yuv[2];
+			count++;
+		}
+	}
+	uv[0] /= count;
+	uv[1] /= count;
+}
+
+struct ErrorStats
+{
+	double max_error;
+	int failures;
+};
+
+static void compare(ErrorStats& stats, int actual, double expected, double tolerance)
+{
+	double error = fabs(actual - expected);
+	stats.max_error = error > stats.max_error ? error : stats.max_error;
+	if (error > tolerance)
+	{
+		stats.failures++;
+	}
+}
+
+// checks every sample of dst against the scalar model of the source pattern. a change of color space is allowed the
+// rounding of libyuv's fixed point kernels, a repacking within one has to be exact
+static void check_against_reference(const TestImage& dst, PIXEL_FORMAT src_format, ErrorStats& stats)
+{
+	PIXEL_FORMAT format = dst.frame.format;
+	int width = dst.frame.width;
+	int height = dst.frame.height;
+	bool same_space = is_rgb(format) == is_rgb(src_format);
+	double tolerance = same_space ? 0.5 : 3.0;
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			if (is_rgb(format))
+			{
+				double rgb[3];
+				source_rgb(src_format, x, y, rgb);
+				int bytes = mf_pixel_bytes_per_pixel(format);
+				const uint8_t* p = pixel(dst, 0, x * bytes, y);
+				compare(stats, p[2], rgb[0], tolerance);
+				compare(stats, p[1], rgb[1], tolerance);
+				compare(stats, p[0], rgb[2], tolerance);
+				if (bytes == 4)
+				{
+					compare(stats, p[3], 255.0, 0.5);
+				}
+				continue;
+			}
+			double yuv[3];
+			source_yuv(src_format, x, y, yuv);
+			if (is_packed_yuv(format))
+			{
+				const uint8_t* p = pixel(dst, 0, x / 2 * 4, y);
+				int luma = format == PIXEL_YUY2 ? 0 : 1;
+				int chroma = format == PIXEL_YUY2 ? 1 : 0;
+				compare(stats, p[luma + (x & 1) * 2], yuv[0], tolerance);
+				if ((x & 1) == 0)
+				{
+					double uv[2];
+					source_chroma(src_format, x, y, 2, 1, width, height, uv);
+					compare(stats, p[chroma], uv[0], tolerance);
+					compare(stats, p[chroma + 2], uv[1], tolerance);
+				}
+				continue;
+			}
+			compare(stats, *pixel(dst, 0, x, y), yuv[0], tolerance);
+			if ((x & 1) || (y & 1))
+			{
+				continue;
+			}
+			double uv[2];
+			source_chroma(src_format, x, y, 2, 2, width, height, uv);
+			if (format == PIXEL_NV12)
+			{
+				compare(stats, pixel(dst, 1, x, y / 2)[0], uv[0], tolerance);
+				compare(stats, pixel(dst, 1, x, y / 2)[1], uv[1], tolerance);
+			}
+			else
+			{
+				compare(stats, *pixel(dst, 1, x / 2, y / 2), uv[0], tolerance);
+				compare(stats, *pixel(dst, 2, x / 2, y / 2), uv[1], tolerance);
+			}
+		}
+	}
+}
+
+// bytes past the rows of every plane, i.e. the padding and the tail of the buffer, are left alone
+static bool padding_untouched(const TestImage& image)
+{
+	PIXEL_FORMAT format = image.frame.format;
+	for (int i = 0; i < mf_pixel_plane_count(format); i++)
+	{
+		int bytes = row_bytes(format, i, image.frame.width);
+		for (int row = 0; row < mf_pixel_plane_rows(format, i, image.frame.height); row++)
+		{
+			const uint8_t* line = image.planes.data[i] + (ptrdiff_t)row * image.planes.stride[i];
+			for (int x = bytes; x < image.planes.stride[i]; x++)
+			{
+				if (line[x] != SENTINEL)
+				{
+					return false;
+				}
+			}
+		}
+	}
+	for (size_t i = image.buffer.size() - GUARD_BYTES; i < image.buffer.size(); i++)
+	{
+		if (image.buffer[i] != SENTINEL)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// every pair converts the pattern as the scalar model does, at even and odd sizes, packed and with padded rows, and
+// converting in stripes gives the same bytes as converting the whole frame
+static void test_all_pairs()
+{
+	const int sizes[][2] = { { 32, 16 }, { 33, 17 }, { 7, 5 }, { 2, 2 }, { 1, 1 }, { 48, 38 } };
+	double max_errors[2] = { 0.0, 0.0 };
+	for (PIXEL_FORMAT src_format : s_Formats)
+	{
+		for (PIXEL_FORMAT dst_format : s_Formats)
+		{
+			MFPixelConverter converter;
+			MF_CHECK(converter.configure(src_format, dst_format));
+			MF_CHECK(converter.is_configured(src_format, dst_format));
+			ErrorStats stats = { 0.0, 0 };
+			for (auto& size : sizes)
+			{
+				for (int padding = 0; padding <= 24; padding += 24)
+				{
+					int width = size[0];
+					int height = size[1];
+					TestImage src;
+					init_image(src, src_format, width, height, padding);
+					fill_pattern(src);
+					TestImage dst;
+					init_image(dst, dst_format, width, height, padding + 8);
+					converter.convert(src.planes, dst.planes, width, 0, height);
+					check_against_reference(dst, src_format, stats);
+					MF_CHECK(padding_untouched(dst));
+
+					// stripes start on even rows, as MFConvertPool hands them out
+					TestImage striped;
+					init_image(striped, dst_format, width, height, padding + 8);
+					for (int row = 0; row < height; row += 6)
+					{
+						converter.convert(src.planes, striped.planes, width, row, row + 6 < height ? row + 6 : height);
+					}
+					MF_CHECK(striped.buffer == dst.buffer);
+				}
+			}
+			bool same_space = is_rgb(src_format) == is_rgb(dst_format);
+			double& max_error = max_errors[same_space ? 0 : 1];
+			max_error = stats.max_error > max_error ? stats.max_error : max_error;
+			if (stats.failures)
+			{
+				fprintf(stderr, "%s to %s: %d samples off, up to %.2f\n", s_strFormats[src_format], s_strFormats[dst_format], stats.failures, stats.max_error);
+			}
+			MF_CHECK_EQ(stats.failures, 0);
+		}
+	}
+	printf("largest error within a color space %.2f, across %.2f\n", max_errors[0], max_errors[1]);
+}
+
+// packed 4:2:2 swaps and same format copies are lossless both ways
+static void test_round_trip()
+{
+	TestImage src;
+	init_image(src, PIXEL_YUY2, 34, 9, 4);
+	fill_pattern(src);
+	TestImage uyvy;
+	init_image(uyvy, PIXEL_UYVY, 34, 9, 0);
+	TestImage back;
+	init_image(back, PIXEL_YUY2, 34, 9, 4);
+	mf_pixel_convert_func(PIXEL_YUY2, PIXEL_UYVY)(src.planes, uyvy.planes, 34, 9);
+	mf_pixel_convert_func(PIXEL_UYVY, PIXEL_YUY2)(uyvy.planes, back.planes, 34, 9);
+	MF_CHECK(back.buffer == src.buffer);
+
+	// I420 and YV12 differ in memory only, their planes are addressed alike
+	TestImage i420;
+	init_image(i420, PIXEL_I420, 33, 17, 0);
+	fill_pattern(i420);
+	TestImage yv12;
+	init_image(yv12, PIXEL_YV12, 33, 17, 0);
+	mf_pixel_convert_func(PIXEL_I420, PIXEL_YV12)(i420.planes, yv12.planes, 33, 17);
+	MF_CHECK(memcmp(yv12.frame.data[0], i420.frame.data[0], 33 * 17) == 0);
+	MF_CHECK(memcmp(yv12.frame.data[1], i420.frame.data[1], 17 * 9) == 0);
+	MF_CHECK(memcmp(yv12.frame.data[2], i420.frame.data[2], 17 * 9) == 0);
+	MF_CHECK(yv12.frame.data[2] < yv12.frame.data[1]);
+}
+
+// formats outside the table have no kernel, a failed configure leaves the converter unconfigured
+static void test_invalid()
+{
+	MF_CHECK(mf_pixel_convert_func(PIXEL_NONE, PIXEL_I420) == nullptr);
+	MF_CHECK(mf_pixel_convert_func(PIXEL_I420, PIXEL_NONE) == nullptr);
+	MF_CHECK(mf_pixel_convert_func(PIXEL_FORMAT_MAX, PIXEL_I420) == nullptr);
+	MF_CHECK(mf_pixel_convert_func(PIXEL_I420, PIXEL_FORMAT_MAX) == nullptr);
+	MFPixelConverter converter;
+	MF_CHECK(!converter.is_configured(PIXEL_NONE, PIXEL_NONE));
+	MF_CHECK(converter.configure(PIXEL_NV12, PIXEL_I420));
+	MF_CHECK(!converter.configure(PIXEL_NV12, PIXEL_NONE));
+	MF_CHECK(!converter.is_configured(PIXEL_NV12, PIXEL_I420));
+	MF_CHECK(!converter.is_configured(PIXEL_NONE, PIXEL_NONE));
+}
+
+int main()
+{
+	test_all_pairs();
+	test_round_trip();
+	test_invalid();
+	return mf_test_result("mf_pixel_convert_test");
+}
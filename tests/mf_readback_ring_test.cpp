@@ -0,0 +1,215 @@
+#include "mf_test.h"
+#include "mf_readback_ring.h"
+#include <vector>
+
+// Staging buffers of a GPU whose copies finish latency frames after they were issued. Mapping a buffer before its
+// copy finished stalls, copying into a buffer the caller still reads from tears the frame, both are counted.
+class FakeGpu
+{
+public:
+	FakeGpu(int slots, int latency)
+		: m_vecContent(slots, -1)
+		, m_vecReadyAt(slots, 0)
+		, m_vecMapped(slots, false)
+		, m_iLatency(latency)
+	{
+	}
+
+	void copy(int slot, int frame, int now)
+	{
+		m_iTorn += m_vecMapped[slot];
+		m_vecContent[slot] = frame;
+		m_vecReadyAt[slot] = now + m_iLatency;
+	}
+
+	int map(int slot, int now)
+	{
+		m_iStalls += now < m_vecReadyAt[slot];
+		m_vecMapped[slot] = true;
+		return m_vecContent[slot];
+	}
+
+	void unmap(int slot)
+	{
+		m_vecMapped[slot] = false;
+	}
+
+	int m_iStalls{ 0 };
+	int m_iTorn{ 0 };
+
+private:
+	std::vector<int> m_vecContent;
+	std::vector<int> m_vecReadyAt;
+	std::vector<bool> m_vecMapped;
+	int m_iLatency;
+};
+
+static int64_t frame_time(int frame)
+{
+	return (int64_t)frame * 166667;
+}
+
+static void test_configure()
+{
+	MFReadbackRing ring;
+	MF_CHECK(!ring.configure(2, 1));
+	MF_CHECK(!ring.configure(MF_READBACK_MAX_SLOTS + 1, 1));
+	MF_CHECK(!ring.configure(4, 0));
+	MF_CHECK(!ring.configure(4, 3));
+	MF_CHECK(ring.configure(4, 2));
+	MF_CHECK_EQ(ring.get_slot_count(), 4);
+	int64_t timestamp = 0;
+	MF_CHECK_EQ(ring.begin_read(true, timestamp), -1);
+}
+
+// Captures frames with a GPU that finishes copies latency frames later. The caller keeps each read slot leased while
+// it encodes the frame and releases it one frame later. Returns the frames read in order.
+static std::vector<int> run_capture(int slots, int depth, int latency, int frames, FakeGpu& gpu)
+{
+	MFReadbackRing ring;
+	MF_CHECK(ring.configure(slots, depth));
+	std::vector<int> read;
+	int leased = -1;
+	for (int now = 0; now < frames; now++)
+	{
+		int slot = ring.begin_copy(frame_time(now));
+		MF_CHECK(slot >= 0);
+		gpu.copy(slot, now, now);
+		int64_t timestamp = -1;
+		int read_slot = ring.begin_read(false, timestamp);
+		if (leased >= 0)
+		{
+			gpu.unmap(leased);
+			ring.end_read(leased);
+			leased = -1;
+		}
+		if (read_slot >= 0)
+		{
+			int frame = gpu.map(read_slot, now);
+			MF_CHECK_EQ(timestamp, frame_time(frame));
+			read.push_back(frame);
+			leased = read_slot;
+		}
+	}
+	if (leased >= 0)
+	{
+		gpu.unmap(leased);
+		ring.end_read(leased);
+	}
+	// end of stream, the queued copies come out oldest first
+	int64_t timestamp = -1;
+	for (int slot = ring.begin_read(true, timestamp); slot >= 0; slot = ring.begin_read(true, timestamp))
+	{
+		int frame = gpu.map(slot, frames + latency);
+		MF_CHECK_EQ(timestamp, frame_time(frame));
+		read.push_back(frame);
+		gpu.unmap(slot);
+		ring.end_read(slot);
+	}
+	ReadbackStats stats = {};
+	ring.get_stats(stats);
+	MF_CHECK_EQ(stats.copies, frames);
+	MF_CHECK_EQ(stats.reads, (int64_t)read.size());
+	MF_CHECK_EQ(stats.dropped, 0);
+	MF_CHECK_EQ(ring.get_pending(), 0);
+	return read;
+}
+
+// with depth at least the copy latency every frame is read in order, without a stall and without a torn frame
+static void test_pipelined()
+{
+	for (int latency = 1; latency <= 3; latency++)
+	{
+		FakeGpu gpu(latency + 2, latency);
+		std::vector<int> read = run_capture(latency + 2, latency, latency, 100, gpu);
+		MF_CHECK_EQ(read.size(), 100);
+		bool ordered = true;
+		for (int i = 0; i < (int)read.size(); i++)
+		{
+			ordered = ordered && read[i] == i;
+		}
+		MF_CHECK(ordered);
+		MF_CHECK_EQ(gpu.m_iStalls, 0);
+		MF_CHECK_EQ(gpu.m_iTorn, 0);
+	}
+}
+
+// a ring shallower than the copy latency maps copies that are still in flight
+static void test_too_shallow()
+{
+	FakeGpu gpu(3, 2);
+	std::vector<int> read = run_capture(3, 1, 2, 50, gpu);
+	MF_CHECK_EQ(read.size(), 50);
+	MF_CHECK(gpu.m_iStalls > 0);
+	MF_CHECK_EQ(gpu.m_iTorn, 0);
+}
+
+// a reader that falls behind loses the oldest copies, the newest frames survive and stay in order
+static void test_reader_behind()
+{
+	MFReadbackRing ring;
+	MF_CHECK(ring.configure(4, 1));
+	FakeGpu gpu(4, 1);
+	for (int now = 0; now < 10; now++)
+	{
+		int slot = ring.begin_copy(frame_time(now));
+		MF_CHECK(slot >= 0);
+		gpu.copy(slot, now, now);
+	}
+	ReadbackStats stats = {};
+	ring.get_stats(stats);
+	MF_CHECK_EQ(stats.dropped, 6);
+	MF_CHECK_EQ(ring.get_pending(), 4);
+	int64_t timestamp = -1;
+	int expected = 6;
+	for (int slot = ring.begin_read(false, timestamp); slot >= 0; slot = ring.begin_read(false, timestamp))
+	{
+		MF_CHECK_EQ(gpu.map(slot, 10), expected);
+		MF_CHECK_EQ(timestamp, frame_time(expected));
+		gpu.unmap(slot);
+		ring.end_read(slot);
+		expected++;
+	}
+	// depth copies stay queued without drain
+	MF_CHECK_EQ(expected, 9);
+	MF_CHECK_EQ(ring.get_pending(), 1);
+}
+
+// leased slots are never handed out for a copy, with all of them leased begin_copy fails
+static void test_all_leased()
+{
+	MFReadbackRing ring;
+	MF_CHECK(ring.configure(3, 1));
+	for (int now = 0; now < 3; now++)
+	{
+		MF_CHECK(ring.begin_copy(frame_time(now)) >= 0);
+	}
+	int64_t timestamp = -1;
+	int slots[3];
+	for (int i = 0; i < 3; i++)
+	{
+		slots[i] = ring.begin_read(true, timestamp);
+		MF_CHECK(slots[i] >= 0);
+		MF_CHECK_EQ(timestamp, frame_time(i));
+	}
+	MF_CHECK_EQ(ring.begin_copy(frame_time(3)), -1);
+	ring.end_read(slots[1]);
+	ring.end_read(slots[1]);
+	MF_CHECK_EQ(ring.begin_copy(frame_time(3)), slots[1]);
+	MF_CHECK_EQ(ring.begin_copy(frame_time(4)), slots[1]);
+	ReadbackStats stats = {};
+	ring.get_stats(stats);
+	MF_CHECK_EQ(stats.dropped, 1);
+	ring.end_read(slots[0]);
+	ring.end_read(slots[2]);
+}
+
+int main()
+{
+	test_configure();
+	test_pipelined();
+	test_too_shallow();
+	test_reader_behind();
+	test_all_leased();
+	return mf_test_result("mf_readback_ring_test");
+}
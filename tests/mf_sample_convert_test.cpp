@@ -0,0 +1,508 @@
+#include "mf_test.h"
+#include "mf_sample_convert.h"
+#include "mf_cpu.h"
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#define SAMPLES 2500 // more than one pivot block for every channel count below
+
+enum REF_TYPE
+{
+	REF_U8 = 0,
+	REF_S16,
+	REF_S24,
+	REF_S32,
+	REF_S64,
+	REF_FLT,
+	REF_DBL,
+	REF_TYPE_COUNT
+};
+
+struct FormatInfo
+{
+	PCM_FORMAT format;
+	REF_TYPE type;
+	const char* name;
+};
+
+static const FormatInfo s_Formats[] = {
+	{ PCM_U8, REF_U8, "U8" }, { PCM_S16, REF_S16, "S16" }, { PCM_S24, REF_S24, "S24" }, { PCM_S32, REF_S32, "S32" },
+	{ PCM_S64, REF_S64, "S64" }, { PCM_FLT, REF_FLT, "FLT" }, { PCM_DBL, REF_DBL, "DBL" },
+	{ PCM_U8P, REF_U8, "U8P" }, { PCM_S16P, REF_S16, "S16P" }, { PCM_S24P, REF_S24, "S24P" },
+	{ PCM_S32P, REF_S32, "S32P" }, { PCM_S64P, REF_S64, "S64P" }, { PCM_FLTP, REF_FLT, "FLTP" },
+	{ PCM_DBLP, REF_DBL, "DBLP" }
+};
+
+#define FORMAT_COUNT (int)(sizeof(s_Formats) / sizeof(s_Formats[0]))
+
+// bits a type holds exactly, the float types count their mantissa
+static const int s_TypeBits[REF_TYPE_COUNT] = { 8, 16, 24, 32, 64, 24, 53 };
+
+// samples of all channels in one block of memory, planes one after the other for planar formats
+struct PcmBuffer
+{
+	PCM_FORMAT format;
+	int channels;
+	int samples;
+	std::vector<uint8_t> data;
+	uint8_t* planes[MF_MAX_CONVERT_CHANNELS];
+
+	PcmBuffer(PCM_FORMAT buffer_format, int buffer_channels, int buffer_samples)
+		: format(buffer_format), channels(buffer_channels), samples(buffer_samples),
+		  data((size_t)buffer_samples * buffer_channels * mf_pcm_bytes_per_sample(buffer_format))
+	{
+		for (int c = 0; c < channels; c++)
+		{
+			planes[c] = data.data() + (mf_pcm_is_planar(format) ? (size_t)c * samples * mf_pcm_bytes_per_sample(format) : 0);
+		}
+	}
+
+	uint8_t* at(int channel, int sample)
+	{
+		int size = mf_pcm_bytes_per_sample(format);
+		if (mf_pcm_is_planar(format))
+		{
+			return planes[channel] + (size_t)sample * size;
+		}
+		return data.data() + ((size_t)sample * channels + channel) * size;
+	}
+};
+
+static uint32_t next_random(uint32_t& seed)
+{
+	seed = seed * 1664525 + 1013904223;
+	return seed;
+}
+
+// full scale integers including both ends, floats up to +-1.5 so clipping is exercised, and exact +-1.0
+static void fill_random(PcmBuffer& buffer, REF_TYPE type, uint32_t seed)
+{
+	for (int c = 0; c < buffer.channels; c++)
+	{
+		for (int i = 0; i < buffer.samples; i++)
+		{
+			uint8_t* p = buffer.at(c, i);
+			uint32_t r = next_random(seed);
+			double value = ((double)(r >> 8) / 8388608.0 - 1.0) * 1.5;
+			if (i % 97 == 0)
+			{
+				value = i % 2 ? 1.0 : -1.0;
+			}
+			switch (type)
+			{
+			case REF_FLT:
+			{
+				float f = (float)value;
+				memcpy(p, &f, 4);
+				break;
+			}
+			case REF_DBL:
+				memcpy(p, &value, 8);
+				break;
+			default:
+				for (int b = 0; b < mf_pcm_bytes_per_sample(buffer.format); b++)
+				{
+					p[b] = (uint8_t)(next_random(seed) >> 24);
+				}
+				if (i % 89 == 0)
+				{
+					// most negative and most positive value
+					memset(p, i % 2 ? 0xFF : 0x00, mf_pcm_bytes_per_sample(buffer.format));
+					p[mf_pcm_bytes_per_sample(buffer.format) - 1] ^= type == REF_U8 ? 0x00 : 0x80;
+				}
+				break;
+			}
+		}
+	}
+}
+
+// plain scalar reference of the conversion rules: full scale is [-1, 1), the pivot is float unless both types are
+// wider than a float mantissa, rounding to nearest even and saturating
+
+static bool ref_double_pivot(REF_TYPE in, REF_TYPE out)
+{
+	return (in == REF_S32 || in == REF_S64 || in == REF_DBL) && (out == REF_S32 || out == REF_S64 || out == REF_DBL);
+}
+
+static float ref_unpack(REF_TYPE type, const uint8_t* p)
+{
+	switch (type)
+	{
+	case REF_U8:
+		return (float)(p[0] - 128) / 128.0f;
+	case REF_S16:
+	{
+		int16_t v;
+		memcpy(&v, p, 2);
+		return (float)v / 32768.0f;
+	}
+	case REF_S24:
+	{
+		int32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+		v = v >= 0x800000 ? v - 0x1000000 : v;
+		return (float)v / 8388608.0f;
+	}
+	case REF_S32:
+	{
+		int32_t v;
+		memcpy(&v, p, 4);
+		return (float)v / 2147483648.0f;
+	}
+	case REF_S64:
+	{
+		int64_t v;
+		memcpy(&v, p, 8);
+		return (float)((double)v / 9223372036854775808.0);
+	}
+	case REF_FLT:
+	{
+		float v;
+		memcpy(&v, p, 4);
+		return v;
+	}
+	default:
+	{
+		double v;
+		memcpy(&v, p, 8);
+		return (float)v;
+	}
+	}
+}
+
+static double ref_unpack_double(REF_TYPE type, const uint8_t* p)
+{
+	if (type == REF_S32)
+	{
+		int32_t v;
+		memcpy(&v, p, 4);
+		return (double)v / 2147483648.0;
+	}
+	if (type == REF_S64)
+	{
+		int64_t v;
+		memcpy(&v, p, 8);
+		return (double)v / 9223372036854775808.0;
+	}
+	double v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static float ref_clamp(float value, float lo, float hi)
+{
+	return value < lo ? lo : (value > hi ? hi : value);
+}
+
+static double ref_clamp(double value, double lo, double hi)
+{
+	return value < lo ? lo : (value > hi ? hi : value);
+}
+
+static void ref_pack(REF_TYPE type, float value, uint8_t* p)
+{
+	switch (type)
+	{
+	case REF_U8:
+		p[0] = (uint8_t)(lrintf(ref_clamp(value * 128.0f, -128.0f, 127.0f)) + 128);
+		break;
+	case REF_S16:
+	{
+		int16_t v = (int16_t)lrintf(ref_clamp(value * 32768.0f, -32768.0f, 32767.0f));
+		memcpy(p, &v, 2);
+		break;
+	}
+	case REF_S24:
+	{
+		int32_t v = (int32_t)lrintf(ref_clamp(value * 8388608.0f, -8388608.0f, 8388607.0f));
+		p[0] = (uint8_t)v;
+		p[1] = (uint8_t)(v >> 8);
+		p[2] = (uint8_t)(v >> 16);
+		break;
+	}
+	case REF_S32:
+	{
+		// the largest float below 2^31
+		int32_t v = (int32_t)lrintf(ref_clamp(value * 2147483648.0f, -2147483648.0f, 2147483520.0f));
+		memcpy(p, &v, 4);
+		break;
+	}
+	case REF_S64:
+	{
+		int64_t v = llrint(ref_clamp((double)value, -1.0, 1.0 - 1.0 / 16777216.0) * 9223372036854775808.0);
+		memcpy(p, &v, 8);
+		break;
+	}
+	case REF_FLT:
+		memcpy(p, &value, 4);
+		break;
+	default:
+	{
+		double v = value;
+		memcpy(p, &v, 8);
+		break;
+	}
+	}
+}
+
+static void ref_pack_double(REF_TYPE type, double value, uint8_t* p)
+{
+	if (type == REF_S32)
+	{
+		int32_t v = (int32_t)llrint(ref_clamp(value * 2147483648.0, -2147483648.0, 2147483647.0));
+		memcpy(p, &v, 4);
+	}
+	else if (type == REF_S64)
+	{
+		// the largest double below 2^63
+		int64_t v = llrint(ref_clamp(value * 9223372036854775808.0, -9223372036854775808.0, 9223372036854774784.0));
+		memcpy(p, &v, 8);
+	}
+	else
+	{
+		memcpy(p, &value, 8);
+	}
+}
+
+static void ref_convert(PcmBuffer& in, REF_TYPE in_type, PcmBuffer& out, REF_TYPE out_type)
+{
+	for (int c = 0; c < in.channels; c++)
+	{
+		for (int i = 0; i < in.samples; i++)
+		{
+			if (in_type == out_type)
+			{
+				memcpy(out.at(c, i), in.at(c, i), mf_pcm_bytes_per_sample(in.format));
+			}
+			else if (ref_double_pivot(in_type, out_type))
+			{
+				ref_pack_double(out_type, ref_unpack_double(in_type, in.at(c, i)), out.at(c, i));
+			}
+			else
+			{
+				ref_pack(out_type, ref_unpack(in_type, in.at(c, i)), out.at(c, i));
+			}
+		}
+	}
+}
+
+static bool convert(PCM_FORMAT in_format, PCM_FORMAT out_format, DITHER_MODE dither, PcmBuffer& in, PcmBuffer& out)
+{
+	MFSampleConverter converter;
+	if (!converter.configure(in_format, out_format, in.channels))
+	{
+		return false;
+	}
+	converter.set_dither(dither);
+	return converter.convert(in.planes, out.planes, in.samples);
+}
+
+// every pair of formats at 1, 2 and 3 channels matches the scalar reference byte for byte, with the SIMD kernels as
+// well as with the scalar ones. 2 channels take the interleave2 kernels for the layout changes
+static void test_all_pairs()
+{
+	for (int channels = 1; channels <= 3; channels++)
+	{
+		for (int in = 0; in < FORMAT_COUNT; in++)
+		{
+			PcmBuffer input(s_Formats[in].format, channels, SAMPLES);
+			fill_random(input, s_Formats[in].type, 17 + in * 3 + channels);
+			for (int out = 0; out < FORMAT_COUNT; out++)
+			{
+				PcmBuffer expected(s_Formats[out].format, channels, SAMPLES);
+				PcmBuffer simd(s_Formats[out].format, channels, SAMPLES);
+				PcmBuffer scalar(s_Formats[out].format, channels, SAMPLES);
+				ref_convert(input, s_Formats[in].type, expected, s_Formats[out].type);
+				MF_CHECK(convert(s_Formats[in].format, s_Formats[out].format, DITHER_NONE, input, simd));
+				mf_cpu_feature_mask() = 0;
+				MF_CHECK(convert(s_Formats[in].format, s_Formats[out].format, DITHER_NONE, input, scalar));
+				mf_cpu_feature_mask() = ~0;
+				if (simd.data != expected.data || scalar.data != expected.data)
+				{
+					fprintf(stderr, "%s -> %s, %d channels: simd %s, scalar %s\n", s_Formats[in].name, s_Formats[out].name,
+						channels, simd.data == expected.data ? "ok" : "differs", scalar.data == expected.data ? "ok" : "differs");
+				}
+				MF_CHECK(simd.data == expected.data);
+				MF_CHECK(scalar.data == expected.data);
+			}
+		}
+	}
+}
+
+// a trip through a type that holds every value of the source and back restores the source bit exact, across all
+// four layout combinations. floats beyond full scale survive in a double
+static void test_round_trip()
+{
+	const int channels = 2;
+	for (int in = 0; in < FORMAT_COUNT; in++)
+	{
+		REF_TYPE in_type = s_Formats[in].type;
+		PcmBuffer input(s_Formats[in].format, channels, SAMPLES);
+		fill_random(input, in_type, 5 + in);
+		for (int mid = 0; mid < FORMAT_COUNT; mid++)
+		{
+			REF_TYPE mid_type = s_Formats[mid].type;
+			bool lossless = in_type == mid_type || (in_type <= REF_S64 && s_TypeBits[mid_type] >= s_TypeBits[in_type]) ||
+				(in_type == REF_FLT && mid_type == REF_DBL);
+			if (!lossless)
+			{
+				continue;
+			}
+			PcmBuffer middle(s_Formats[mid].format, channels, SAMPLES);
+			PcmBuffer output(s_Formats[in].format, channels, SAMPLES);
+			MF_CHECK(convert(s_Formats[in].format, s_Formats[mid].format, DITHER_NONE, input, middle));
+			MF_CHECK(convert(s_Formats[mid].format, s_Formats[in].format, DITHER_NONE, middle, output));
+			if (output.data != input.data)
+			{
+				fprintf(stderr, "%s -> %s -> %s is not lossless\n", s_Formats[in].name, s_Formats[mid].name, s_Formats[in].name);
+			}
+			MF_CHECK(output.data == input.data);
+		}
+	}
+}
+
+// 24 bit samples are 3 little endian bytes, sign extended on the way in
+static void test_s24_packing()
+{
+	PcmBuffer s32(PCM_S32, 1, 4);
+	const int32_t values[] = { 0x12345600, -0x12345600, 0x7FFFFF00, (int32_t)0x80000000 };
+	memcpy(s32.data.data(), values, sizeof(values));
+	PcmBuffer s24(PCM_S24P, 1, 4);
+	MF_CHECK(convert(PCM_S32, PCM_S24P, DITHER_NONE, s32, s24));
+	const uint8_t expected[] = { 0x56, 0x34, 0x12, 0xAA, 0xCB, 0xED, 0xFF, 0xFF, 0x7F, 0x00, 0x00, 0x80 };
+	MF_CHECK(memcmp(s24.data.data(), expected, sizeof(expected)) == 0);
+
+	PcmBuffer s16(PCM_S16, 1, 4);
+	MF_CHECK(convert(PCM_S24P, PCM_S16, DITHER_NONE, s24, s16));
+	const int16_t* out = (const int16_t*)s16.data.data();
+	MF_CHECK_EQ(out[0], 0x1234);
+	MF_CHECK_EQ(out[1], -0x1234);
+	MF_CHECK_EQ(out[2], 0x7FFF);
+	MF_CHECK_EQ(out[3], -0x8000);
+}
+
+// float input saturates at the integer ends: +1.0 and above is the largest value, -1.0 and below the smallest
+static void test_float_clipping()
+{
+	const float values[] = { 1.0f, 1.5f, 1e30f, -1.0f, -2.0f, -1e30f, 0.5f, -0.5f };
+	const int count = (int)(sizeof(values) / sizeof(values[0]));
+	PcmBuffer input(PCM_FLT, 1, count);
+	memcpy(input.data.data(), values, sizeof(values));
+	for (int scalar = 0; scalar < 2; scalar++)
+	{
+		mf_cpu_feature_mask() = scalar ? 0 : ~0;
+		PcmBuffer u8(PCM_U8, 1, count);
+		PcmBuffer s16(PCM_S16, 1, count);
+		PcmBuffer s24(PCM_S24, 1, count);
+		PcmBuffer s32(PCM_S32, 1, count);
+		MF_CHECK(convert(PCM_FLT, PCM_U8, DITHER_NONE, input, u8));
+		MF_CHECK(convert(PCM_FLT, PCM_S16, DITHER_NONE, input, s16));
+		MF_CHECK(convert(PCM_FLT, PCM_S24, DITHER_NONE, input, s24));
+		MF_CHECK(convert(PCM_FLT, PCM_S32, DITHER_NONE, input, s32));
+		const int16_t* s16_out = (const int16_t*)s16.data.data();
+		const int32_t* s32_out = (const int32_t*)s32.data.data();
+		for (int i = 0; i < 3; i++)
+		{
+			MF_CHECK_EQ(u8.data[i], 255);
+			MF_CHECK_EQ(u8.data[i + 3], 0);
+			MF_CHECK_EQ(s16_out[i], 32767);
+			MF_CHECK_EQ(s16_out[i + 3], -32768);
+			MF_CHECK(memcmp(s24.at(0, i), "\xFF\xFF\x7F", 3) == 0);
+			MF_CHECK(memcmp(s24.at(0, i + 3), "\x00\x00\x80", 3) == 0);
+			MF_CHECK_EQ(s32_out[i], 2147483520);
+			MF_CHECK_EQ(s32_out[i + 3], (int32_t)0x80000000);
+		}
+		MF_CHECK_EQ(s16_out[6], 16384);
+		MF_CHECK_EQ(s16_out[7], -16384);
+		MF_CHECK_EQ(u8.data[6], 192);
+		MF_CHECK_EQ(u8.data[7], 64);
+	}
+	mf_cpu_feature_mask() = ~0;
+}
+
+// TPDF dither moves each sample by at most one step of the output around the rounded value, averages out, is the
+// same noise with and without SIMD, and is left out when the output is not narrower than the input
+static void test_dither()
+{
+	const int channels = 2;
+	PcmBuffer input(PCM_FLTP, channels, SAMPLES);
+	for (int c = 0; c < channels; c++)
+	{
+		for (int i = 0; i < SAMPLES; i++)
+		{
+			float value = 0.25f * (float)sin(i * 0.01 + c);
+			memcpy(input.at(c, i), &value, 4);
+		}
+	}
+	PcmBuffer plain(PCM_S16, channels, SAMPLES);
+	PcmBuffer simd(PCM_S16, channels, SAMPLES);
+	PcmBuffer scalar(PCM_S16, channels, SAMPLES);
+	MF_CHECK(convert(PCM_FLTP, PCM_S16, DITHER_NONE, input, plain));
+	MF_CHECK(convert(PCM_FLTP, PCM_S16, DITHER_TPDF, input, simd));
+	mf_cpu_feature_mask() = 0;
+	MF_CHECK(convert(PCM_FLTP, PCM_S16, DITHER_TPDF, input, scalar));
+	mf_cpu_feature_mask() = ~0;
+	MF_CHECK(simd.data == scalar.data);
+	const int16_t* plain_out = (const int16_t*)plain.data.data();
+	const int16_t* dither_out = (const int16_t*)simd.data.data();
+	int changed = 0;
+	int max_error = 0;
+	long long sum = 0;
+	for (int i = 0; i < SAMPLES * channels; i++)
+	{
+		int error = dither_out[i] - plain_out[i];
+		changed += error != 0;
+		max_error = abs(error) > max_error ? abs(error) : max_error;
+		sum += error;
+	}
+	MF_CHECK(changed > SAMPLES / 4);
+	MF_CHECK(max_error <= 1);
+	MF_CHECK(llabs(sum) < SAMPLES / 10);
+
+	// a converter keeps its noise state, the next call goes on with new noise
+	MFSampleConverter converter;
+	MF_CHECK(converter.configure(PCM_FLTP, PCM_S16, channels));
+	PcmBuffer second(PCM_S16, channels, SAMPLES);
+	MF_CHECK(converter.convert(input.planes, second.planes, SAMPLES));
+	MF_CHECK(second.data == simd.data);
+	MF_CHECK(converter.convert(input.planes, second.planes, SAMPLES));
+	MF_CHECK(second.data != simd.data);
+
+	// no dither into a type as wide as the input
+	PcmBuffer s16(PCM_S16, channels, SAMPLES);
+	PcmBuffer s24(PCM_S24, channels, SAMPLES);
+	PcmBuffer s24_dither(PCM_S24, channels, SAMPLES);
+	MF_CHECK(convert(PCM_FLTP, PCM_S16, DITHER_NONE, input, s16));
+	MF_CHECK(convert(PCM_S16, PCM_S24, DITHER_NONE, s16, s24));
+	MF_CHECK(convert(PCM_S16, PCM_S24, DITHER_TPDF, s16, s24_dither));
+	MF_CHECK(s24.data == s24_dither.data);
+}
+
+// bad formats, channel counts and pointers are refused
+static void test_invalid()
+{
+	MFSampleConverter converter;
+	uint8_t buffer[64] = {};
+	uint8_t* planes[2] = { buffer, nullptr };
+	MF_CHECK(!converter.convert(planes, planes, 1));
+	MF_CHECK(!converter.configure(PCM_UNKNOWN, PCM_S16, 2));
+	MF_CHECK(!converter.configure(PCM_S16, PCM_S16P, 0));
+	MF_CHECK(!converter.configure(PCM_S16, PCM_S16P, MF_MAX_CONVERT_CHANNELS + 1));
+	MF_CHECK(converter.configure(PCM_S16, PCM_S16P, 2));
+	MF_CHECK(!converter.convert(planes, planes, 1));
+	MF_CHECK(!converter.convert(nullptr, planes, 1));
+	planes[1] = buffer + 32;
+	MF_CHECK(!converter.convert(planes, planes, -1));
+	MF_CHECK(converter.convert(planes, planes, 0));
+}
+
+int main()
+{
+	test_all_pairs();
+	test_round_trip();
+	test_s24_packing();
+	test_float_clipping();
+	test_dither();
+	test_invalid();
+	return mf_test_result("mf_sample_convert_test");
+}
@@ -0,0 +1,242 @@
+#include "mf_test.h"
+#include "mf_scale_convert.h"
+#include "mf_cpu.h"
+#include "mf_convert_pool.h"
+#include <string.h>
+#include <vector>
+
+#define PAD 13 // bytes after every row, so strides are not a multiple of any vector width
+#define CANARY 0xCD
+
+struct ScaleCase
+{
+	int src_width;
+	int src_height;
+	int left; // crop origin in the source, odd ones included
+	int top;
+	int crop_width;
+	int crop_height;
+	int dst_width;
+	int dst_height;
+	SCALE_FILTER filter;
+};
+
+// output planes with padded strides, the padding is filled with CANARY to catch writes past the row
+struct Planes
+{
+	int stride_y;
+	int stride_c;
+	std::vector<uint8_t> y;
+	std::vector<uint8_t> u; // interleaved UV for NV12
+	std::vector<uint8_t> v;
+};
+
+static std::vector<uint8_t> make_source(int width, int height, int stride)
+{
+	std::vector<uint8_t> src((size_t)stride * height);
+	uint32_t seed = (uint32_t)(width * 7919 + height);
+	for (size_t i = 0; i < src.size(); i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		src[i] = (uint8_t)(seed >> 16);
+	}
+	return src;
+}
+
+static Planes make_planes(int width, int height, bool interleaved)
+{
+	Planes planes;
+	int chroma_width = (width + 1) / 2;
+	planes.stride_y = width + PAD;
+	planes.stride_c = (interleaved ? chroma_width * 2 : chroma_width) + PAD;
+	int chroma_height = (height + 1) / 2;
+	planes.y.assign((size_t)planes.stride_y * height, CANARY);
+	planes.u.assign((size_t)planes.stride_c * chroma_height, CANARY);
+	planes.v.assign(interleaved ? 0 : (size_t)planes.stride_c * chroma_height, CANARY);
+	return planes;
+}
+
+// converts with the kernels the feature mask allows, the converter picks them when it is constructed
+static Planes convert(const ScaleCase& c, const std::vector<uint8_t>& src, int src_stride, bool interleaved, int feature_mask)
+{
+	mf_cpu_feature_mask() = feature_mask;
+	MFScaleConverter converter;
+	mf_cpu_feature_mask() = ~0;
+	Planes planes = make_planes(c.dst_width, c.dst_height, interleaved);
+	MF_CHECK(converter.configure(c.crop_width, c.crop_height, c.dst_width, c.dst_height, c.filter));
+	MF_CHECK(converter.is_configured(c.crop_width, c.crop_height, c.dst_width, c.dst_height));
+	const uint8_t* origin = src.data() + (size_t)c.top * src_stride + c.left * 4;
+	if (interleaved)
+	{
+		converter.bgra_to_nv12(origin, src_stride, planes.y.data(), planes.stride_y, planes.u.data(), planes.stride_c);
+	}
+	else
+	{
+		converter.bgra_to_i420(origin, src_stride, planes.y.data(), planes.stride_y, planes.u.data(), planes.stride_c, planes.v.data(), planes.stride_c);
+	}
+	return planes;
+}
+
+static bool padding_intact(const std::vector<uint8_t>& plane, int stride, int width)
+{
+	for (size_t row = 0; row < plane.size() / stride; row++)
+	{
+		for (int x = width; x < stride; x++)
+		{
+			if (plane[row * stride + x] != CANARY)
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// the SIMD kernels are bit exact with the C ones, over the whole frame and without touching the row padding
+static void test_simd_parity()
+{
+	const ScaleCase cases[] = {
+		{ 64, 64, 0, 0, 64, 64, 64, 64, SCALE_FILTER_BILINEAR }, // no scaling, one vector per row
+		{ 101, 37, 3, 5, 90, 30, 90, 30, SCALE_FILTER_BILINEAR }, // odd crop origin, tail after the vectors
+		{ 3840, 2160, 0, 0, 3840, 2160, 1920, 1080, SCALE_FILTER_BOX }, // the exact 2:1 reduction
+		{ 1283, 723, 1, 3, 1280, 720, 854, 480, SCALE_FILTER_BOX }, // 3:2, odd source and crop
+		{ 1000, 600, 7, 9, 993, 587, 333, 195, SCALE_FILTER_BOX }, // non-integer ratio, odd output width and height
+		{ 640, 360, 11, 1, 600, 350, 1030, 598, SCALE_FILTER_BILINEAR }, // upscale with a tail
+		{ 97, 61, 1, 1, 95, 59, 31, 17, SCALE_FILTER_BILINEAR }, // bilinear downscale below one vector
+		{ 33, 9, 0, 0, 33, 9, 2, 2, SCALE_FILTER_BOX }, // tiny output
+	};
+	for (const ScaleCase& c : cases)
+	{
+		int src_stride = c.src_width * 4 + PAD * 4;
+		std::vector<uint8_t> src = make_source(c.src_width, c.src_height, src_stride);
+		for (int interleaved = 0; interleaved < 2; interleaved++)
+		{
+			Planes simd = convert(c, src, src_stride, interleaved != 0, ~0);
+			Planes scalar = convert(c, src, src_stride, interleaved != 0, 0);
+			if (simd.y != scalar.y || simd.u != scalar.u || simd.v != scalar.v)
+			{
+				fprintf(stderr, "%dx%d+%d+%d -> %dx%d %s differs\n", c.crop_width, c.crop_height, c.left, c.top, c.dst_width, c.dst_height,
+					interleaved ? "NV12" : "I420");
+				mf_test_failures()++;
+			}
+			int chroma_width = (c.dst_width + 1) / 2;
+			MF_CHECK(padding_intact(scalar.y, scalar.stride_y, c.dst_width));
+			MF_CHECK(padding_intact(scalar.u, scalar.stride_c, interleaved ? chroma_width * 2 : chroma_width));
+			MF_CHECK(padding_intact(simd.y, simd.stride_y, c.dst_width));
+			MF_CHECK(padding_intact(simd.u, simd.stride_c, interleaved ? chroma_width * 2 : chroma_width));
+			if (!interleaved)
+			{
+				MF_CHECK(padding_intact(scalar.v, scalar.stride_c, chroma_width));
+				MF_CHECK(padding_intact(simd.v, simd.stride_c, chroma_width));
+			}
+		}
+	}
+}
+
+// stripes converted concurrently, each on its own scratch slot, give the same frame as one pass
+static void test_stripes()
+{
+	const ScaleCase c = { 1283, 723, 1, 3, 1280, 720, 854, 482, SCALE_FILTER_BOX };
+	int src_stride = c.src_width * 4 + PAD * 4;
+	std::vector<uint8_t> src = make_source(c.src_width, c.src_height, src_stride);
+	const uint8_t* origin = src.data() + (size_t)c.top * src_stride + c.left * 4;
+	for (int interleaved = 0; interleaved < 2; interleaved++)
+	{
+		Planes whole = convert(c, src, src_stride, interleaved != 0, ~0);
+		for (int threads = 1; threads <= 4; threads++)
+		{
+			MFConvertPool pool;
+			MF_CHECK(pool.start(threads, 0));
+			MFScaleConverter converter;
+			MF_CHECK(converter.configure(c.crop_width, c.crop_height, c.dst_width, c.dst_height, c.filter));
+			converter.set_slot_count(pool.get_thread_count());
+			Planes planes = make_planes(c.dst_width, c.dst_height, interleaved != 0);
+			auto convert_stripe = [&](int stripe, int row_begin, int row_end)
+			{
+				if (interleaved)
+				{
+					converter.bgra_to_nv12(origin, src_stride, planes.y.data(), planes.stride_y, planes.u.data(), planes.stride_c, row_begin, row_end, stripe);
+				}
+				else
+				{
+					converter.bgra_to_i420(origin, src_stride, planes.y.data(), planes.stride_y, planes.u.data(), planes.stride_c, planes.v.data(),
+						planes.stride_c, row_begin, row_end, stripe);
+				}
+			};
+			pool.run(c.dst_height, 2, convert_stripe);
+			pool.stop();
+			MF_CHECK(planes.y == whole.y && planes.u == whole.u && planes.v == whole.v);
+		}
+	}
+}
+
+// a flat color stays flat through every filter and lands on the BT.601 limited range values
+static void test_flat_color()
+{
+	const ScaleCase cases[] = {
+		{ 200, 100, 1, 1, 198, 98, 198, 98, SCALE_FILTER_BILINEAR },
+		{ 200, 100, 3, 1, 190, 96, 100, 48, SCALE_FILTER_BOX },
+		{ 200, 100, 0, 0, 200, 100, 77, 41, SCALE_FILTER_BOX },
+		{ 200, 100, 0, 0, 200, 100, 310, 150, SCALE_FILTER_BILINEAR },
+	};
+	const int b = 40;
+	const int g = 160;
+	const int r = 220;
+	uint8_t y = (uint8_t)(((13 * b + 65 * g + 33 * r + 64) >> 7) + 16);
+	uint8_t u = (uint8_t)((112 * b - 74 * g - 38 * r + 0x8080) >> 8);
+	uint8_t v = (uint8_t)((112 * r - 94 * g - 18 * b + 0x8080) >> 8);
+	for (const ScaleCase& c : cases)
+	{
+		int src_stride = c.src_width * 4;
+		std::vector<uint8_t> src((size_t)src_stride * c.src_height);
+		for (size_t i = 0; i < src.size(); i += 4)
+		{
+			src[i] = (uint8_t)b;
+			src[i + 1] = (uint8_t)g;
+			src[i + 2] = (uint8_t)r;
+			src[i + 3] = 255;
+		}
+		for (int mask = 0; mask < 2; mask++)
+		{
+			Planes planes = convert(c, src, src_stride, false, mask ? ~0 : 0);
+			bool flat = true;
+			for (int row = 0; row < c.dst_height; row++)
+			{
+				for (int x = 0; x < c.dst_width; x++)
+				{
+					flat = flat && planes.y[(size_t)row * planes.stride_y + x] == y;
+				}
+			}
+			for (int row = 0; row < (c.dst_height + 1) / 2; row++)
+			{
+				for (int x = 0; x < (c.dst_width + 1) / 2; x++)
+				{
+					flat = flat && planes.u[(size_t)row * planes.stride_c + x] == u && planes.v[(size_t)row * planes.stride_c + x] == v;
+				}
+			}
+			MF_CHECK(flat);
+		}
+	}
+}
+
+// the row span the 16 bit box sums allow, and empty sizes
+static void test_configure_limits()
+{
+	MFScaleConverter converter;
+	MF_CHECK(!converter.configure(0, 100, 10, 10, SCALE_FILTER_BOX));
+	MF_CHECK(!converter.configure(100, 100, 10, 0, SCALE_FILTER_BILINEAR));
+	MF_CHECK(converter.configure(16, 256 * 2, 16, 2, SCALE_FILTER_BOX));
+	MF_CHECK(!converter.configure(16, 257 * 2, 16, 2, SCALE_FILTER_BOX));
+	MF_CHECK(converter.configure(16, 257 * 2, 16, 2, SCALE_FILTER_BILINEAR));
+	MF_CHECK(converter.is_configured(16, 257 * 2, 16, 2));
+	MF_CHECK(!converter.is_configured(16, 256 * 2, 16, 2));
+}
+
+int main()
+{
+	test_simd_parity();
+	test_stripes();
+	test_flat_color();
+	test_configure_limits();
+	return mf_test_result("mf_scale_convert_test");
+}
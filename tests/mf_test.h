@@ -0,0 +1,42 @@
+#ifndef MF_TEST_H
+#define MF_TEST_H
+
+#include <stdio.h>
+
+// Checks for the test executables, a failed check is reported and counted and the test goes on, main returns
+// mf_test_result() so ctest sees the failure.
+inline int& mf_test_failures()
+{
+	static int s_iFailures = 0;
+	return s_iFailures;
+}
+
+#define MF_CHECK(cond) \
+	do \
+	{ \
+		if (!(cond)) \
+		{ \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			mf_test_failures()++; \
+		} \
+	} while (0)
+
+#define MF_CHECK_EQ(a, b) \
+	do \
+	{ \
+		long long mf_check_a = (long long)(a); \
+		long long mf_check_b = (long long)(b); \
+		if (mf_check_a != mf_check_b) \
+		{ \
+			fprintf(stderr, "%s:%d: check failed: %s == %s, %lld != %lld\n", __FILE__, __LINE__, #a, #b, mf_check_a, mf_check_b); \
+			mf_test_failures()++; \
+		} \
+	} while (0)
+
+inline int mf_test_result(const char* name)
+{
+	printf("%s: %s\n", name, mf_test_failures() == 0 ? "passed" : "FAILED");
+	return mf_test_failures() == 0 ? 0 : 1;
+}
+
+#endif
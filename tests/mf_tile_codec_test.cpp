@@ -0,0 +1,340 @@
+#include "mf_test.h"
+#include "mf_tile_codec.h"
+#include "mf_lz4.h"
+#include <string.h>
+#include <vector>
+
+// BGRA frame with padded rows, alpha is set to 255 because the codec does not carry it
+struct Frame
+{
+	int width;
+	int height;
+	int stride;
+	std::vector<uint8_t> data;
+
+	Frame(int w, int h)
+		: width(w), height(h), stride(w * 4 + 12), data((size_t)(w * 4 + 12) * h)
+	{
+	}
+
+	void put(int x, int y, uint32_t color)
+	{
+		uint8_t* pixel = data.data() + (size_t)y * stride + x * 4;
+		pixel[0] = (uint8_t)color;
+		pixel[1] = (uint8_t)(color >> 8);
+		pixel[2] = (uint8_t)(color >> 16);
+		pixel[3] = 255;
+	}
+
+	bool same_pixels(const Frame& other) const
+	{
+		for (int y = 0; y < height; y++)
+		{
+			if (memcmp(data.data() + (size_t)y * stride, other.data.data() + (size_t)y * other.stride, (size_t)width * 4) != 0)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+// tile_x, tile_y and mode of every tile in a packet, in packet order
+struct TileInfo
+{
+	int x;
+	int y;
+	int mode;
+};
+
+static std::vector<TileInfo> parse_tiles(const uint8_t* packet, unsigned long size)
+{
+	std::vector<TileInfo> tiles;
+	unsigned long offset = 20;
+	uint32_t count = packet[16] | (packet[17] << 8) | (packet[18] << 16) | ((uint32_t)packet[19] << 24);
+	for (uint32_t i = 0; i < count && offset + 9 <= size; i++)
+	{
+		const uint8_t* p = packet + offset;
+		tiles.push_back({ p[0] | (p[1] << 8), p[2] | (p[3] << 8), p[4] });
+		offset += 9 + (p[5] | (p[6] << 8) | (p[7] << 16) | ((uint32_t)p[8] << 24));
+	}
+	return tiles;
+}
+
+static bool round_trip(const Frame& frame, int tile_size, int threads, TILE_MODE expected_mode, unsigned long* packet_size = nullptr)
+{
+	MFTileEncoder encoder;
+	MFTileDecoder decoder;
+	if (!encoder.configure(frame.width, frame.height, tile_size, threads))
+	{
+		return false;
+	}
+	const uint8_t* packet = nullptr;
+	unsigned long size = 0;
+	if (!encoder.encode(frame.data.data(), frame.stride, nullptr, 0, packet, size))
+	{
+		return false;
+	}
+	for (const TileInfo& tile : parse_tiles(packet, size))
+	{
+		if (tile.mode != expected_mode)
+		{
+			return false;
+		}
+	}
+	if (packet_size)
+	{
+		*packet_size = size;
+	}
+	Frame decoded(frame.width, frame.height);
+	return decoder.decode(packet, size, decoded.data.data(), decoded.stride, frame.width, frame.height) && decoded.same_pixels(frame);
+}
+
+// a single color tile is three bytes of payload
+static void test_solid()
+{
+	Frame frame(96, 64);
+	for (int y = 0; y < frame.height; y++)
+	{
+		for (int x = 0; x < frame.width; x++)
+		{
+			frame.put(x, y, x < 32 ? 0x102030 : 0xfafbfc);
+		}
+	}
+	unsigned long size = 0;
+	MF_CHECK(round_trip(frame, 32, 1, TILE_MODE_SOLID, &size));
+	MF_CHECK_EQ(size, 20 + 6 * (9 + 3));
+}
+
+// few colors in long runs take the palette, runs cross rows and are long enough for a multi-byte length
+static void test_palette_runs()
+{
+	Frame frame(64, 64);
+	for (int y = 0; y < frame.height; y++)
+	{
+		for (int x = 0; x < frame.width; x++)
+		{
+			frame.put(x, y, y < 40 ? 0x336699 : (x / 5) % 3 == 0 ? 0x000000 : 0xffffff);
+		}
+	}
+	MF_CHECK(round_trip(frame, 64, 1, TILE_MODE_PALETTE));
+
+	// exactly 256 colors still fit the palette, in short runs that LZ4 then finds repeated
+	Frame colors(64, 64);
+	for (int y = 0; y < colors.height; y++)
+	{
+		for (int x = 0; x < colors.width; x++)
+		{
+			colors.put(x, y, ((x + y * 64) / 2 % 256) * 0x010203u);
+		}
+	}
+	unsigned long size = 0;
+	MF_CHECK(round_trip(colors, 64, 1, TILE_MODE_PALETTE, &size));
+	MF_CHECK(size < 20 + 9 + 1 + 256 * 3 + 8 + 2048 * 2);
+}
+
+// more than 256 colors is packed BGR, LZ4 compressed when the pixels repeat and stored when they do not
+static void test_raw()
+{
+	Frame gradient(64, 64);
+	for (int y = 0; y < gradient.height; y++)
+	{
+		for (int x = 0; x < gradient.width; x++)
+		{
+			gradient.put(x, y, (uint32_t)(x * 4) | (uint32_t)(y * 4) << 8 | (uint32_t)((x + y) & 0x1f) << 16);
+		}
+	}
+	unsigned long size = 0;
+	MF_CHECK(round_trip(gradient, 64, 1, TILE_MODE_RAW, &size));
+
+	Frame noise(64, 64);
+	uint32_t seed = 1;
+	for (int y = 0; y < noise.height; y++)
+	{
+		for (int x = 0; x < noise.width; x++)
+		{
+			seed = seed * 1664525 + 1013904223;
+			noise.put(x, y, seed >> 8);
+		}
+	}
+	MF_CHECK(round_trip(noise, 64, 1, TILE_MODE_RAW, &size));
+	MF_CHECK_EQ(size, 20 + 9 + 8 + 64 * 64 * 3);
+}
+
+// odd sizes leave clipped tiles on the right and bottom edges, any thread count gives the same packet
+static void test_edges_and_threads()
+{
+	const int sizes[][2] = { { 1, 1 }, { 7, 5 }, { 65, 33 }, { 333, 191 } };
+	const int tile_sizes[] = { 8, 64, 256 };
+	for (const auto& size : sizes)
+	{
+		Frame frame(size[0], size[1]);
+		uint32_t seed = 7;
+		for (int y = 0; y < frame.height; y++)
+		{
+			for (int x = 0; x < frame.width; x++)
+			{
+				seed = seed * 1664525 + 1013904223;
+				// flat areas, a few colors and noise, so every mode shows up somewhere
+				uint32_t color = x < frame.width / 3 ? 0x202020 : x < frame.width * 2 / 3 ? (seed >> 28) * 0x111111u : seed >> 8;
+				frame.put(x, y, color);
+			}
+		}
+		for (int tile_size : tile_sizes)
+		{
+			std::vector<uint8_t> packets[3];
+			const int threads[] = { 1, 2, 5 };
+			for (int i = 0; i < 3; i++)
+			{
+				MFTileEncoder encoder;
+				MF_CHECK(encoder.configure(frame.width, frame.height, tile_size, threads[i]));
+				const uint8_t* packet = nullptr;
+				unsigned long packet_size = 0;
+				MF_CHECK(encoder.encode(frame.data.data(), frame.stride, nullptr, 0, packet, packet_size));
+				packets[i].assign(packet, packet + packet_size);
+			}
+			MF_CHECK(packets[0] == packets[1]);
+			MF_CHECK(packets[0] == packets[2]);
+
+			Frame decoded(frame.width, frame.height);
+			MFTileDecoder decoder;
+			MF_CHECK(decoder.decode(packets[2].data(), (unsigned long)packets[2].size(), decoded.data.data(), decoded.stride, frame.width, frame.height));
+			MF_CHECK(decoded.same_pixels(frame));
+		}
+	}
+}
+
+// only the tiles the rects touch are coded, in row-major order, and they update just that part of the frame
+static void test_dirty_rects()
+{
+	Frame frame(200, 130);
+	for (int y = 0; y < frame.height; y++)
+	{
+		for (int x = 0; x < frame.width; x++)
+		{
+			frame.put(x, y, (uint32_t)(x * 3 + y * 5) & 0xff);
+		}
+	}
+	MFTileEncoder encoder;
+	MF_CHECK(!encoder.configure(200, 130, 12, 1));
+	MF_CHECK(!encoder.configure(200, 130, 264, 1));
+	MF_CHECK(encoder.configure(200, 130, 32, 3));
+	const uint8_t* packet = nullptr;
+	unsigned long size = 0;
+	MF_CHECK(encoder.encode(frame.data.data(), frame.stride, nullptr, 0, packet, size));
+	Frame decoded(200, 130);
+	MFTileDecoder decoder;
+	MF_CHECK(decoder.decode(packet, size, decoded.data.data(), decoded.stride, 200, 130));
+
+	for (int y = 40; y < 50; y++)
+	{
+		for (int x = 190; x < 200; x++)
+		{
+			frame.put(x, y, 0xff0000);
+		}
+	}
+	frame.put(3, 3, 0x00ff00);
+	MonitorRect rects[] = { { 190, 40, 250, 50 }, { 3, 3, 4, 4 }, { 300, 300, 310, 310 } };
+	MF_CHECK(encoder.encode(frame.data.data(), frame.stride, rects, 3, packet, size));
+	std::vector<TileInfo> tiles = parse_tiles(packet, size);
+	MF_CHECK_EQ(tiles.size(), 3);
+	if (tiles.size() == 3)
+	{
+		MF_CHECK(tiles[0].x == 0 && tiles[0].y == 0);
+		MF_CHECK(tiles[1].x == 5 && tiles[1].y == 1);
+		MF_CHECK(tiles[2].x == 6 && tiles[2].y == 1);
+	}
+	MF_CHECK(decoder.decode(packet, size, decoded.data.data(), decoded.stride, 200, 130));
+	MF_CHECK(decoded.same_pixels(frame));
+
+	MonitorRect outside = { 200, 0, 220, 10 };
+	MF_CHECK(!encoder.encode(frame.data.data(), frame.stride, &outside, 1, packet, size));
+}
+
+// truncated, resized or corrupted packets are rejected instead of read past their end
+static void test_malformed()
+{
+	Frame frame(80, 48);
+	uint32_t seed = 3;
+	for (int y = 0; y < frame.height; y++)
+	{
+		for (int x = 0; x < frame.width; x++)
+		{
+			seed = seed * 1664525 + 1013904223;
+			frame.put(x, y, x < 40 ? (seed >> 30) * 0x404040u : seed >> 8);
+		}
+	}
+	MFTileEncoder encoder;
+	MF_CHECK(encoder.configure(80, 48, 16, 1));
+	const uint8_t* packet = nullptr;
+	unsigned long size = 0;
+	MF_CHECK(encoder.encode(frame.data.data(), frame.stride, nullptr, 0, packet, size));
+	std::vector<uint8_t> valid(packet, packet + size);
+
+	Frame decoded(80, 48);
+	MFTileDecoder decoder;
+	MF_CHECK(!decoder.decode(valid.data(), (unsigned long)valid.size(), decoded.data.data(), decoded.stride, 80, 40));
+	for (unsigned long length = 0; length < valid.size(); length += 7)
+	{
+		MF_CHECK(!decoder.decode(valid.data(), length, decoded.data.data(), decoded.stride, 80, 48));
+	}
+	std::vector<uint8_t> bad = valid;
+	bad[0] = 'X';
+	MF_CHECK(!decoder.decode(bad.data(), (unsigned long)bad.size(), decoded.data.data(), decoded.stride, 80, 48));
+	bad = valid;
+	bad[20 + 4] = 7; // unknown mode of the first tile
+	MF_CHECK(!decoder.decode(bad.data(), (unsigned long)bad.size(), decoded.data.data(), decoded.stride, 80, 48));
+	// flipped payload bytes must not crash the decoder, whether or not they still decode
+	for (size_t i = 20 + 9; i < valid.size(); i += 13)
+	{
+		bad = valid;
+		bad[i] ^= 0x5A;
+		decoder.decode(bad.data(), (unsigned long)bad.size(), decoded.data.data(), decoded.stride, 80, 48);
+	}
+}
+
+// the block format round trips, including incompressible and empty input, and a short output buffer fails
+static void test_lz4()
+{
+	std::vector<uint32_t> hash_table(MF_LZ4_HASH_ENTRIES);
+	const int sizes[] = { 0, 1, 12, 13, 100, 4096, 70000 };
+	for (int size : sizes)
+	{
+		for (int pattern = 0; pattern < 3; pattern++)
+		{
+			std::vector<uint8_t> src(size);
+			uint32_t seed = 11;
+			for (int i = 0; i < size; i++)
+			{
+				seed = seed * 1664525 + 1013904223;
+				src[i] = pattern == 0 ? (uint8_t)(i % 17) : pattern == 1 ? (uint8_t)(seed >> 24) : (uint8_t)(i < size / 2 ? 0 : seed >> 24);
+			}
+			std::vector<uint8_t> compressed(mf_lz4_compress_bound(size));
+			int compressed_size = mf_lz4_compress(src.data(), size, compressed.data(), (int)compressed.size(), hash_table.data());
+			MF_CHECK(compressed_size > 0);
+			std::vector<uint8_t> output(size + 1);
+			MF_CHECK_EQ(mf_lz4_decompress(compressed.data(), compressed_size, output.data(), (int)output.size()), size);
+			MF_CHECK(memcmp(output.data(), src.data(), size) == 0);
+			if (size > 1)
+			{
+				MF_CHECK_EQ(mf_lz4_decompress(compressed.data(), compressed_size, output.data(), size - 1), -1);
+			}
+			if (pattern == 0 && size >= 4096)
+			{
+				MF_CHECK(compressed_size < size / 8);
+			}
+		}
+	}
+}
+
+int main()
+{
+	test_solid();
+	test_palette_runs();
+	test_raw();
+	test_edges_and_threads();
+	test_dirty_rects();
+	test_malformed();
+	test_lz4();
+	return mf_test_result("mf_tile_codec_test");
+}
@@ -0,0 +1,162 @@
+#include "mf_test.h"
+#include "mf_video_frame.h"
+#include <string.h>
+#include <thread>
+#include <vector>
+
+class CountingOwner final : public MFVideoFrameOwner
+{
+public:
+	void release_frame(VideoFrame* frame) override
+	{
+		released++;
+		last_opaque = frame->opaque;
+	}
+
+	std::atomic<int> released{ 0 };
+	void* last_opaque{ nullptr };
+};
+
+// planes per format, chroma rows rounded up and none for planes a format lacks
+static void test_plane_rows()
+{
+	MF_CHECK_EQ(mf_pixel_plane_count(PIXEL_I420), 3);
+	MF_CHECK_EQ(mf_pixel_plane_count(PIXEL_NV12), 2);
+	MF_CHECK_EQ(mf_pixel_plane_count(PIXEL_YUY2), 1);
+	MF_CHECK_EQ(mf_pixel_plane_count(PIXEL_NONE), 0);
+	MF_CHECK_EQ(mf_pixel_plane_rows(PIXEL_I420, 0, 11), 11);
+	MF_CHECK_EQ(mf_pixel_plane_rows(PIXEL_I420, 1, 11), 6);
+	MF_CHECK_EQ(mf_pixel_plane_rows(PIXEL_YV12, 2, 10), 5);
+	MF_CHECK_EQ(mf_pixel_plane_rows(PIXEL_NV12, 1, 11), 6);
+	MF_CHECK_EQ(mf_pixel_plane_rows(PIXEL_NV12, 2, 11), 0);
+	MF_CHECK_EQ(mf_pixel_plane_rows(PIXEL_BGRA, 0, 11), 11);
+	MF_CHECK_EQ(mf_pixel_plane_rows(PIXEL_BGRA, 1, 11), 0);
+	MF_CHECK_EQ(mf_pixel_plane_rows(PIXEL_UYVY, 1, 11), 0);
+	MF_CHECK_EQ(mf_pixel_plane_rows(PIXEL_I420, -1, 11), 0);
+	MF_CHECK_EQ(mf_pixel_plane_rows(PIXEL_I420, MF_MAX_PLANES, 11), 0);
+	MF_CHECK_EQ(mf_pixel_frame_size(PIXEL_I420, 640, 360), 640 * 360 * 3 / 2);
+	MF_CHECK_EQ(mf_pixel_frame_size(PIXEL_NV12, 5, 3), 15 + 3 * 2 * 2);
+	MF_CHECK_EQ(mf_pixel_frame_size(PIXEL_RGB24, 5, 3), 45);
+}
+
+// a view lays the planes out one after the other, YV12 keeps Y U V order in data with V first in memory
+static void test_init_layout()
+{
+	uint8_t base[64 * 16];
+	VideoFrame frame;
+	mf_video_frame_init(frame, PIXEL_I420, 16, 8, base, 16);
+	MF_CHECK(frame.data[0] == base);
+	MF_CHECK(frame.data[1] == base + 16 * 8);
+	MF_CHECK(frame.data[2] == base + 16 * 8 + 8 * 4);
+	MF_CHECK_EQ(frame.stride[1], 8);
+	MF_CHECK_EQ(frame.ref_count.load(), 0);
+	MF_CHECK_EQ(frame.timestamp, -1);
+	MF_CHECK(mf_video_frame_is_contiguous(frame));
+
+	mf_video_frame_init(frame, PIXEL_YV12, 16, 8, base, 16);
+	MF_CHECK(frame.data[2] == base + 16 * 8);
+	MF_CHECK(frame.data[1] == base + 16 * 8 + 8 * 4);
+	MF_CHECK(mf_video_frame_is_contiguous(frame));
+
+	mf_video_frame_init(frame, PIXEL_NV12, 16, 8, base, 16);
+	MF_CHECK(frame.data[1] == base + 16 * 8);
+	MF_CHECK_EQ(frame.stride[1], 16);
+	MF_CHECK(frame.data[2] == nullptr);
+	MF_CHECK_EQ(mf_video_frame_size(PIXEL_NV12, 8, 16), (size_t)16 * 12);
+
+	// padded rows and bottom-up images are not contiguous
+	mf_video_frame_init(frame, PIXEL_I420, 16, 8, base, 32);
+	MF_CHECK(!mf_video_frame_is_contiguous(frame));
+	mf_video_frame_init(frame, PIXEL_BGRA, 4, 8, base + 16 * 7, -16);
+	MF_CHECK(frame.data[0] == base + 16 * 7);
+	MF_CHECK_EQ(frame.stride[0], -16);
+	MF_CHECK(!mf_video_frame_is_contiguous(frame));
+	MF_CHECK_EQ(mf_video_frame_size(PIXEL_BGRA, 8, -16), (size_t)16 * 8);
+}
+
+// allocated frames put every plane and row on a cache line, odd sizes included
+static void test_alloc_alignment()
+{
+	const PIXEL_FORMAT formats[] = { PIXEL_I420, PIXEL_YV12, PIXEL_NV12, PIXEL_YUY2, PIXEL_UYVY, PIXEL_BGRA, PIXEL_RGB24 };
+	const int sizes[][2] = { { 640, 360 }, { 33, 17 }, { 1, 1 }, { 1366, 769 } };
+	for (PIXEL_FORMAT format : formats)
+	{
+		for (auto& size : sizes)
+		{
+			VideoFrame* frame = mf_video_frame_alloc(format, size[0], size[1]);
+			MF_CHECK(frame != nullptr);
+			if (!frame)
+			{
+				continue;
+			}
+			MF_CHECK_EQ(frame->ref_count.load(), 1);
+			MF_CHECK(frame->owner == nullptr);
+			MF_CHECK_EQ(frame->stride[0], mf_video_frame_aligned_stride(format, size[0]));
+			for (int i = 0; i < mf_pixel_plane_count(format); i++)
+			{
+				MF_CHECK_EQ((uintptr_t)frame->data[i] % MF_CACHE_LINE, 0u);
+				MF_CHECK_EQ(frame->stride[i] % MF_CACHE_LINE, 0);
+				int row_bytes = i == 0 || format == PIXEL_NV12 ? size[0] * mf_pixel_bytes_per_pixel(format) : (size[0] + 1) / 2;
+				MF_CHECK(frame->stride[i] >= row_bytes);
+				// the last row of every plane is writable
+				int rows = mf_pixel_plane_rows(format, i, size[1]);
+				memset(frame->data[i] + (size_t)(rows - 1) * frame->stride[i], 0xff, row_bytes);
+			}
+			mf_video_frame_unref(frame);
+		}
+	}
+	MF_CHECK(mf_video_frame_alloc(PIXEL_NONE, 16, 16) == nullptr);
+	MF_CHECK(mf_video_frame_alloc(PIXEL_I420, 0, 16) == nullptr);
+}
+
+// a wrapped frame goes back to its owner once, when the last reference is dropped on whichever thread
+static void test_refcount()
+{
+	uint8_t base[16 * 16 * 4];
+	CountingOwner owner;
+	int opaque = 0;
+	VideoFrame* frame = mf_video_frame_wrap(PIXEL_BGRA, 16, 16, base, 64, &owner, &opaque);
+	MF_CHECK(frame != nullptr);
+	MF_CHECK(frame->owner == &owner);
+	MF_CHECK_EQ(frame->ref_count.load(), 1);
+	MF_CHECK(mf_video_frame_ref(frame) == frame);
+	MF_CHECK_EQ(frame->ref_count.load(), 2);
+	mf_video_frame_unref(frame);
+	MF_CHECK_EQ(owner.released.load(), 0);
+	mf_video_frame_unref(frame);
+	MF_CHECK_EQ(owner.released.load(), 1);
+	MF_CHECK(owner.last_opaque == &opaque);
+	MF_CHECK(mf_video_frame_ref(nullptr) == nullptr);
+	mf_video_frame_unref(nullptr);
+
+	// references taken and dropped from several threads
+	frame = mf_video_frame_wrap(PIXEL_BGRA, 16, 16, base, 64, &owner, nullptr);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; t++)
+	{
+		mf_video_frame_ref(frame);
+		threads.emplace_back([frame]()
+		{
+			for (int i = 0; i < 10000; i++)
+			{
+				mf_video_frame_unref(mf_video_frame_ref(frame));
+			}
+			mf_video_frame_unref(frame);
+		});
+	}
+	mf_video_frame_unref(frame);
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+	MF_CHECK_EQ(owner.released.load(), 2);
+}
+
+int main()
+{
+	test_plane_rows();
+	test_init_layout();
+	test_alloc_alignment();
+	test_refcount();
+	return mf_test_result("mf_video_frame_test");
+}
@@ -0,0 +1,384 @@
+#include "mf_test.h"
+#include "mf_video_pipeline.h"
+#include "mf_time.h"
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#define WIDTH 640
+#define HEIGHT 360
+
+static void fill_frame(VideoFrame& frame, uint8_t value)
+{
+	for (int i = 0; i < mf_pixel_plane_count(frame.format); i++)
+	{
+		int row_bytes = i == 0 || frame.format == PIXEL_NV12 ? frame.width * mf_pixel_bytes_per_pixel(frame.format) : frame.width / 2;
+		for (int row = 0; row < mf_pixel_plane_rows(frame.format, i, frame.height); row++)
+		{
+			memset(frame.data[i] + (ptrdiff_t)row * frame.stride[i], value, row_bytes);
+		}
+	}
+}
+
+// I420 frame of the encoded size filled with value, contiguous so the pipeline references it
+static VideoFrame* make_frame(uint8_t value, int64_t timestamp)
+{
+	VideoFrame* frame = mf_video_frame_alloc(PIXEL_I420, WIDTH, HEIGHT);
+	fill_frame(*frame, value);
+	frame->timestamp = timestamp;
+	frame->unchanged = false;
+	return frame;
+}
+
+static int encode(MFVideoPipeline& pipeline, uint8_t value, int64_t timestamp, OutputVData& output_data)
+{
+	VideoFrame* frame = make_frame(value, timestamp);
+	int ret = pipeline.encode(*frame, output_data);
+	mf_video_frame_unref(frame);
+	return ret;
+}
+
+static bool start(MFVideoPipeline& pipeline)
+{
+	return pipeline.start(mf_create_encoder_backend(ENCODER_BACKEND_NULL, nullptr), WIDTH, HEIGHT, 30, 1);
+}
+
+// without caller timestamps frames sit on the exact rational grid
+static void test_frame_grid(std::vector<uint8_t>& buffer)
+{
+	MFVideoPipeline pipeline;
+	pipeline.set_time_base(90000);
+	MF_CHECK(pipeline.start(mf_create_encoder_backend(ENCODER_BACKEND_NULL, nullptr), WIDTH, HEIGHT, 30000, 1001));
+	for (int i = 0; i < 4; i++)
+	{
+		OutputVData output_data = {};
+		output_data.data = buffer.data();
+		output_data.capacity = (unsigned long)buffer.size();
+		MF_CHECK_EQ(encode(pipeline, (uint8_t)i, -1, output_data), ENCODE_SUCCESS);
+		MF_CHECK_EQ(output_data.timestamp, mf_frame_time(i, 90000, 30000, 1001));
+		MF_CHECK_EQ(output_data.duration, mf_frame_time(i + 1, 90000, 30000, 1001) - mf_frame_time(i, 90000, 30000, 1001));
+		MF_CHECK_EQ(output_data.size, 6);
+		MF_CHECK(output_data.data == buffer.data());
+		MF_CHECK(!output_data.skipped);
+	}
+	OutputVData output_data = {};
+	VideoFrame flush = {};
+	MF_CHECK_EQ(pipeline.encode(flush, output_data), ENCODE_EOF);
+}
+
+// caller timestamps are passed through, they have to increase. the frame a timestamp ends is only known once the next
+// one arrives, so durations are the nominal interval of 30 fps, not the 3000 4000 500 the timestamps imply
+static void test_variable_rate(std::vector<uint8_t>& buffer)
+{
+	MFVideoPipeline pipeline;
+	MF_CHECK(start(pipeline));
+	const int64_t timestamps[] = { 0, 3000, 7000, 7500 };
+	for (int i = 0; i < 4; i++)
+	{
+		OutputVData output_data = {};
+		output_data.data = buffer.data();
+		output_data.capacity = (unsigned long)buffer.size();
+		MF_CHECK_EQ(encode(pipeline, (uint8_t)i, timestamps[i], output_data), ENCODE_SUCCESS);
+		MF_CHECK_EQ(output_data.timestamp, timestamps[i]);
+		MF_CHECK_EQ(output_data.duration, 3000);
+	}
+	OutputVData output_data = {};
+	output_data.data = buffer.data();
+	output_data.capacity = (unsigned long)buffer.size();
+	MF_CHECK_EQ(encode(pipeline, 9, 7500, output_data), ENCODE_FAIL);
+}
+
+// a copy never writes past the caller's buffer, a packet that does not fit fails with the size it needs. a polled
+// one stays queued until a buffer is large enough
+static void test_copy_capacity(std::vector<uint8_t>& buffer)
+{
+	MFVideoPipeline pipeline;
+	MF_CHECK(start(pipeline));
+	OutputVData output_data = {};
+	MF_CHECK_EQ(encode(pipeline, 1, -1, output_data), ENCODE_FAIL);
+	MF_CHECK_EQ(output_data.size, 6);
+	MF_CHECK(output_data.data == nullptr);
+	buffer.assign(buffer.size(), 0xcd);
+	output_data.data = buffer.data();
+	output_data.capacity = 5;
+	MF_CHECK_EQ(encode(pipeline, 2, -1, output_data), ENCODE_FAIL);
+	MF_CHECK_EQ(buffer[0], 0xcd);
+	output_data.capacity = 6;
+	MF_CHECK_EQ(encode(pipeline, 3, -1, output_data), ENCODE_SUCCESS);
+	MF_CHECK_EQ(output_data.size, 6);
+	MF_CHECK_EQ(buffer[6], 0xcd);
+
+	VideoFrame* frame = make_frame(4, -1);
+	MF_CHECK_EQ(pipeline.submit(*frame), ENCODE_SUCCESS);
+	mf_video_frame_unref(frame);
+	output_data = {};
+	int ret = ENCODE_MORE_INPUT;
+	while ((ret = pipeline.poll(output_data)) == ENCODE_MORE_INPUT)
+	{
+		std::this_thread::yield();
+	}
+	MF_CHECK_EQ(ret, ENCODE_FAIL);
+	MF_CHECK_EQ(output_data.size, 6);
+	output_data.data = buffer.data();
+	output_data.capacity = (unsigned long)buffer.size();
+	MF_CHECK_EQ(pipeline.poll(output_data), ENCODE_SUCCESS);
+	MF_CHECK_EQ(output_data.timestamp, mf_frame_time(3, 90000, 30, 1));
+	MF_CHECK_EQ(pipeline.poll(output_data), ENCODE_MORE_INPUT);
+}
+
+// capture times before the origin are dropped, the first frame at the origin starts at 0
+static void test_clock_origin(std::vector<uint8_t>& buffer)
+{
+	const int64_t origin = 50000000;
+	MFVideoPipeline pipeline;
+	pipeline.set_clock_origin(origin);
+	MF_CHECK(start(pipeline));
+	OutputVData output_data = {};
+	output_data.data = buffer.data();
+	output_data.capacity = (unsigned long)buffer.size();
+	MF_CHECK_EQ(encode(pipeline, 0, origin - 333333, output_data), ENCODE_DROPPED);
+	MF_CHECK_EQ(encode(pipeline, 1, origin - 1, output_data), ENCODE_DROPPED);
+	MF_CHECK_EQ(encode(pipeline, 2, origin, output_data), ENCODE_SUCCESS);
+	MF_CHECK_EQ(output_data.timestamp, 0);
+	MF_CHECK_EQ(encode(pipeline, 3, origin + 333333, output_data), ENCODE_SUCCESS);
+	MF_CHECK_EQ(output_data.timestamp, mf_rescale(333333, 90000, MF_HNS_PER_SECOND));
+}
+
+// identical frames are skipped up to the limit, the skipped ones still take their slot on the grid
+static void test_skip(std::vector<uint8_t>& buffer)
+{
+	MFVideoPipeline pipeline;
+	pipeline.set_skip_mode(SKIP_MODE_DETECT, 2);
+	MF_CHECK(start(pipeline));
+	const bool skipped[] = { false, true, true, false, true, false };
+	const uint8_t values[] = { 1, 1, 1, 1, 1, 2 };
+	for (int i = 0; i < 6; i++)
+	{
+		OutputVData output_data = {};
+		output_data.data = buffer.data();
+		output_data.capacity = (unsigned long)buffer.size();
+		MF_CHECK_EQ(encode(pipeline, values[i], -1, output_data), ENCODE_SUCCESS);
+		MF_CHECK_EQ(output_data.skipped, skipped[i]);
+		MF_CHECK_EQ(output_data.size, skipped[i] ? 0 : 6);
+		MF_CHECK_EQ(output_data.timestamp, mf_frame_time(i, 90000, 30, 1));
+		MF_CHECK(output_data.data == buffer.data());
+	}
+}
+
+// every format goes through crop, scale and conversion to the backend's I420, with and without stripes, from padded rows
+// and from a bottom-up image
+static void test_memory_formats(std::vector<uint8_t>& buffer)
+{
+	const PIXEL_FORMAT formats[] = { PIXEL_I420, PIXEL_YV12, PIXEL_NV12, PIXEL_YUY2, PIXEL_UYVY, PIXEL_BGRA, PIXEL_RGB24 };
+	for (PIXEL_FORMAT format : formats)
+	{
+		for (int threads = 1; threads <= 2; threads++)
+		{
+			MFVideoPipeline pipeline;
+			pipeline.set_crop_rect(0.1f, 0.1f, 0.9f, 0.9f);
+			pipeline.set_scale_ratio(0.5f);
+			pipeline.set_convert_threads(threads, 0);
+			MF_CHECK(start(pipeline));
+			// rows padded by 64 bytes
+			int stride = WIDTH * mf_pixel_bytes_per_pixel(format) + 64;
+			std::vector<uint8_t> frame_data(mf_video_frame_size(format, HEIGHT, stride));
+			VideoFrame frame;
+			mf_video_frame_init(frame, format, WIDTH, HEIGHT, frame_data.data(), stride);
+			fill_frame(frame, 0x80);
+			for (int i = 0; i < 2; i++)
+			{
+				OutputVData output_data = {};
+				output_data.data = buffer.data();
+				output_data.capacity = (unsigned long)buffer.size();
+				MF_CHECK_EQ(pipeline.encode(frame, output_data), ENCODE_SUCCESS);
+				MF_CHECK_EQ(output_data.size, 6);
+			}
+			// without the crop and scale the planes are converted or copied as they are
+			pipeline.stop();
+			MF_CHECK(start(pipeline));
+			OutputVData output_data = {};
+			output_data.data = buffer.data();
+			output_data.capacity = (unsigned long)buffer.size();
+			MF_CHECK_EQ(pipeline.encode(frame, output_data), ENCODE_SUCCESS);
+		}
+	}
+	MFVideoPipeline pipeline;
+	pipeline.set_crop_rect(0.1f, 0.1f, 0.9f, 0.9f);
+	MF_CHECK(start(pipeline));
+	std::vector<uint8_t> frame_data(WIDTH * HEIGHT * 4, 0x40);
+	VideoFrame bottom_up;
+	mf_video_frame_init(bottom_up, PIXEL_BGRA, WIDTH, HEIGHT, frame_data.data() + (HEIGHT - 1) * WIDTH * 4, -WIDTH * 4);
+	OutputVData output_data = {};
+	output_data.data = buffer.data();
+	output_data.capacity = (unsigned long)buffer.size();
+	MF_CHECK_EQ(pipeline.encode(bottom_up, output_data), ENCODE_SUCCESS);
+	VideoFrame invalid;
+	mf_video_frame_init(invalid, PIXEL_FORMAT_MAX, WIDTH, HEIGHT, frame_data.data(), WIDTH * 4);
+	MF_CHECK_EQ(pipeline.encode(invalid, output_data), ENCODE_FAIL);
+}
+
+// returns the planes of wrapped frames by counting them
+class CountingOwner final : public MFVideoFrameOwner
+{
+public:
+	void release_frame(VideoFrame*) override
+	{
+		released++;
+	}
+
+	int released{ 0 };
+};
+
+// a reference counted frame goes back to its owner exactly once, after the caller and the pipeline let go of it, whether
+// the backend reads it as it is or a crop makes the pipeline convert it
+static void test_frame_reference()
+{
+	std::vector<uint8_t> frame_data(mf_video_frame_size(PIXEL_I420, HEIGHT, WIDTH), 0x20);
+	std::vector<uint8_t> buffer(1024);
+	CountingOwner owner;
+	for (int crop = 0; crop < 2; crop++)
+	{
+		for (int queued = 0; queued < 2; queued++)
+		{
+			MFVideoPipeline pipeline;
+			pipeline.set_crop_rect(0.0f, 0.0f, crop ? 0.5f : 1.0f, crop ? 0.5f : 1.0f);
+			MF_CHECK(start(pipeline));
+			int released = owner.released;
+			VideoFrame* frame = mf_video_frame_wrap(PIXEL_I420, WIDTH, HEIGHT, frame_data.data(), WIDTH, &owner, nullptr);
+			OutputVData output_data = {};
+			output_data.data = buffer.data();
+			output_data.capacity = (unsigned long)buffer.size();
+			if (queued)
+			{
+				MF_CHECK_EQ(pipeline.submit(*frame), ENCODE_SUCCESS);
+				auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+				int ret = ENCODE_MORE_INPUT;
+				while (ret == ENCODE_MORE_INPUT && std::chrono::steady_clock::now() < deadline)
+				{
+					std::this_thread::yield();
+					ret = pipeline.poll(output_data);
+				}
+				MF_CHECK_EQ(ret, ENCODE_SUCCESS);
+			}
+			else
+			{
+				MF_CHECK_EQ(pipeline.encode(*frame, output_data), ENCODE_SUCCESS);
+			}
+			MF_CHECK_EQ(frame->ref_count.load(), 1);
+			MF_CHECK_EQ(owner.released, released);
+			mf_video_frame_unref(frame);
+			MF_CHECK_EQ(owner.released, released + 1);
+		}
+	}
+}
+
+// converted frames come from the pipeline's pool, a budget too small for one of them refuses the input until it is raised
+static void test_frame_memory(std::vector<uint8_t>& buffer)
+{
+	MFVideoPipeline pipeline;
+	pipeline.set_scale_ratio(0.5f);
+	pipeline.set_frame_memory(1024, false);
+	MF_CHECK(start(pipeline));
+	OutputVData output_data = {};
+	output_data.data = buffer.data();
+	output_data.capacity = (unsigned long)buffer.size();
+	MF_CHECK_EQ(encode(pipeline, 1, -1, output_data), ENCODE_QUEUE_FULL);
+	FramePoolStats stats = {};
+	pipeline.get_frame_memory_stats(stats);
+	MF_CHECK_EQ(stats.failures, 1);
+	MF_CHECK_EQ(stats.budget_bytes, 1024u);
+	pipeline.set_frame_memory(0, false);
+	for (int i = 0; i < 3; i++)
+	{
+		MF_CHECK_EQ(encode(pipeline, (uint8_t)i, -1, output_data), ENCODE_SUCCESS);
+	}
+	pipeline.get_frame_memory_stats(stats);
+	MF_CHECK_EQ(stats.misses, 1);
+	MF_CHECK_EQ(stats.hits, 2);
+	MF_CHECK_EQ(stats.in_use_bytes, 0u);
+	MF_CHECK_EQ(stats.allocated_bytes, (uint64_t)mf_pixel_frame_size(PIXEL_I420, WIDTH / 2, HEIGHT / 2));
+	pipeline.stop();
+	pipeline.get_frame_memory_stats(stats);
+	MF_CHECK_EQ(stats.allocated_bytes, 0u);
+}
+
+// frames from submit come back from poll in order, a flush ends the stream with ENCODE_EOF
+static void test_queue()
+{
+	MFVideoPipeline pipeline;
+	pipeline.set_queue_depth(2);
+	pipeline.set_output_mode(OUTPUT_MODE_LEASE);
+	MF_CHECK(start(pipeline));
+	const int frames = 32;
+	int submitted = 0;
+	int received = 0;
+	int rejected = 0;
+	bool eof = false;
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (!eof && std::chrono::steady_clock::now() < deadline)
+	{
+		if (submitted <= frames)
+		{
+			VideoFrame* frame = submitted < frames ? make_frame((uint8_t)submitted, -1) : nullptr;
+			VideoFrame flush = {};
+			int ret = pipeline.submit(frame ? *frame : flush);
+			if (frame)
+			{
+				mf_video_frame_unref(frame);
+			}
+			if (ret == ENCODE_SUCCESS)
+			{
+				submitted++;
+			}
+			else
+			{
+				MF_CHECK_EQ(ret, ENCODE_QUEUE_FULL);
+				rejected++;
+			}
+		}
+		OutputVData output_data = {};
+		int ret = pipeline.poll(output_data);
+		if (ret == ENCODE_SUCCESS)
+		{
+			MF_CHECK_EQ(output_data.timestamp, mf_frame_time(received, 90000, 30, 1));
+			MF_CHECK_EQ(output_data.size, 6);
+			MF_CHECK(output_data.lease != nullptr);
+			pipeline.release_output(output_data);
+			MF_CHECK(output_data.lease == nullptr);
+			received++;
+		}
+		else if (ret == ENCODE_EOF)
+		{
+			eof = true;
+		}
+		else
+		{
+			MF_CHECK_EQ(ret, ENCODE_MORE_INPUT);
+			std::this_thread::yield();
+		}
+	}
+	MF_CHECK(eof);
+	MF_CHECK_EQ(received, frames);
+	EncodeQueueStats stats = {};
+	pipeline.get_queue_stats(stats);
+	MF_CHECK_EQ(stats.submitted_frames, frames + 1);
+	MF_CHECK_EQ(stats.rejected_frames, rejected);
+	MF_CHECK_EQ(stats.rate_control_failures, 0);
+	MF_CHECK_EQ(stats.queue_depth, 2);
+}
+
+int main()
+{
+	std::vector<uint8_t> buffer(1024 * 1024);
+	test_frame_grid(buffer);
+	test_variable_rate(buffer);
+	test_copy_capacity(buffer);
+	test_clock_origin(buffer);
+	test_skip(buffer);
+	test_memory_formats(buffer);
+	test_frame_reference();
+	test_frame_memory(buffer);
+	test_queue();
+	return mf_test_result("mf_video_pipeline_test");
+}